@@ -0,0 +1,785 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmarks of the engine's core types, in the style of Google
+// Benchmark: each one is run for more and more iterations until it takes at
+// least the minimum time, and the time per iteration is reported.
+//
+// Usage: pie_noon_benchmarks [--benchmark_filter=<substring>]
+//                            [--benchmark_format=console|json]
+//                            [--benchmark_min_time=<seconds>]
+//                            [--benchmark_out=<file>]
+//
+// --benchmark_out writes the results as JSON, in the same layout as Google
+// Benchmark's, whatever the console format. The state machine and font are
+// read from the assets directory, as pie_noon_sim does.
+
+#include "precompiled.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "character.h"
+#include "character_state_machine.h"
+#include "character_state_machine_def_generated.h"
+#include "entity/component.h"
+#include "entity/dense_pool.h"
+#include "entity/entity_manager.h"
+#include "entity/vector_pool.h"
+#include "font_manager.h"
+#include "glyph_cache.h"
+#include "mapped_file.h"
+#include "multiplayer_generated.h"
+#include "particles.h"
+#include "player_status_history.h"
+#include "timeline_generated.h"
+#include "utilities.h"
+
+namespace fpl {
+namespace pie_noon {
+
+static const char kAssetsDir[] = "assets";
+static const char kStateMachineFileName[] = "character_state_machine_def.bin";
+static const char kFontFileName[] = "fonts/NotoSansCJKjp-Bold.otf";
+
+static const double kDefaultMinTime = 0.5;
+static const int64_t kMaxIterations = 1000000000;
+
+// Passed to each benchmark, which times the loop
+//   while (state.KeepRunning()) { ... }
+// Anything before the loop is setup, and isn't timed.
+class BenchmarkState {
+ public:
+  explicit BenchmarkState(int64_t iterations)
+      : iterations_(iterations),
+        done_(0),
+        items_per_iteration_(0),
+        seconds_(0),
+        error_(nullptr) {}
+
+  bool KeepRunning() {
+    if (done_ == 0) start_ = std::chrono::high_resolution_clock::now();
+    if (done_ < iterations_ && error_ == nullptr) {
+      ++done_;
+      return true;
+    }
+    const std::chrono::duration<double> elapsed =
+        std::chrono::high_resolution_clock::now() - start_;
+    seconds_ = elapsed.count();
+    return false;
+  }
+
+  // Report items per second too, e.g. the entities visited per iteration.
+  void SetItemsPerIteration(int64_t items) { items_per_iteration_ = items; }
+
+  // Give up on this benchmark, e.g. when its data can't be loaded.
+  void SkipWithError(const char* error) { error_ = error; }
+
+  int64_t iterations() const { return iterations_; }
+  int64_t items_per_iteration() const { return items_per_iteration_; }
+  double seconds() const { return seconds_; }
+  const char* error() const { return error_; }
+
+ private:
+  int64_t iterations_;
+  int64_t done_;
+  int64_t items_per_iteration_;
+  double seconds_;
+  const char* error_;
+  std::chrono::high_resolution_clock::time_point start_;
+};
+
+// Results are folded into this, so the work that makes them can't be
+// optimized away.
+static volatile uint64_t g_sink;
+
+template <typename T>
+static inline void Consume(T value) {
+  g_sink = g_sink + static_cast<uint64_t>(value);
+}
+
+static inline void ConsumePointer(const void* pointer) {
+  g_sink = g_sink + reinterpret_cast<uintptr_t>(pointer);
+}
+
+// Deterministic pseudo random numbers, so every run does the same work.
+class Random {
+ public:
+  explicit Random(uint32_t seed) : state_(seed) {}
+  uint32_t Next() {
+    state_ = state_ * 1664525u + 1013904223u;
+    return state_ >> 8;
+  }
+  float Range(float min, float max) {
+    return min + (max - min) * static_cast<float>(Next() & 0xFFFF) / 0xFFFF;
+  }
+
+ private:
+  uint32_t state_;
+};
+
+// Files the benchmarks share, loaded the first time one needs them.
+struct Assets {
+  Assets() : loaded(false), state_machine_def(nullptr) {}
+
+  bool Load() {
+    if (loaded) return state_machine_def != nullptr;
+    loaded = true;
+    if (!state_machine_source.Open(kStateMachineFileName)) return false;
+    const CharacterStateMachineDef* def =
+        GetCharacterStateMachineDef(state_machine_source.data());
+    if (!CharacterStateMachineDef_Validate(def)) return false;
+    state_machine_table.Initialize(def);
+    state_machine_def = def;
+    return true;
+  }
+
+  bool loaded;
+  MappedFile state_machine_source;
+  const CharacterStateMachineDef* state_machine_def;
+  CharacterStateMachineTable state_machine_table;
+};
+
+static Assets g_assets;
+
+struct PoolData {
+  float values[4];
+};
+
+static void VectorPoolAllocFree(BenchmarkState& state) {
+  static const int kCount = 1000;
+  VectorPool<PoolData> pool;
+  std::vector<VectorPool<PoolData>::VectorPoolReference> refs(kCount);
+  while (state.KeepRunning()) {
+    for (int i = 0; i < kCount; ++i) {
+      refs[i] = pool.GetNewElement(kAddToBack);
+      refs[i]->values[0] = static_cast<float>(i);
+    }
+    // Free every other one first, as entities come and go out of order.
+    for (int i = 0; i < kCount; i += 2) pool.FreeElement(refs[i]);
+    for (int i = 1; i < kCount; i += 2) pool.FreeElement(refs[i]);
+  }
+  Consume(pool.Size());
+  state.SetItemsPerIteration(kCount);
+}
+
+static void VectorPoolIterate(BenchmarkState& state) {
+  static const int kCount = 10000;
+  VectorPool<PoolData> pool;
+  std::vector<VectorPool<PoolData>::VectorPoolReference> refs(kCount);
+  for (int i = 0; i < kCount; ++i) {
+    refs[i] = pool.GetNewElement(kAddToBack);
+    refs[i]->values[0] = static_cast<float>(i);
+  }
+  // Leave holes, as a pool does after a while in play.
+  for (int i = 0; i < kCount; i += 3) pool.FreeElement(refs[i]);
+  while (state.KeepRunning()) {
+    float sum = 0;
+    for (auto it = pool.begin(); it != pool.end(); ++it) {
+      sum += it->values[0];
+    }
+    Consume(sum);
+  }
+  state.SetItemsPerIteration(static_cast<int64_t>(pool.active_count()));
+}
+
+// Components of nothing but data, to time iteration over their storage.
+// Each needs a data type of its own, since that's what its id is found by.
+struct VectorPoolComponentData {
+  float values[4];
+};
+
+struct DensePoolComponentData {
+  float values[4];
+};
+
+class VectorPoolBenchmarkComponent
+    : public entity::Component<VectorPoolComponentData> {
+ public:
+  virtual void AddFromRawData(entity::EntityRef&, const void*) {}
+};
+
+class DensePoolBenchmarkComponent
+    : public entity::Component<DensePoolComponentData, DensePool> {
+ public:
+  virtual void AddFromRawData(entity::EntityRef&, const void*) {}
+};
+
+}  // namespace pie_noon
+}  // namespace fpl
+
+// The game's own components use the ids of ComponentDataUnion, which stop
+// well short of the maximum.
+FPL_ENTITY_REGISTER_COMPONENT(fpl::pie_noon::VectorPoolBenchmarkComponent,
+                              fpl::pie_noon::VectorPoolComponentData,
+                              fpl::entity::kMaxComponentCount - 1)
+FPL_ENTITY_REGISTER_COMPONENT(fpl::pie_noon::DensePoolBenchmarkComponent,
+                              fpl::pie_noon::DensePoolComponentData,
+                              fpl::entity::kMaxComponentCount - 2)
+
+namespace fpl {
+namespace pie_noon {
+
+template <typename ComponentType>
+static void ComponentIterate(BenchmarkState& state) {
+  static const int kCount = 10000;
+  entity::EntityManager entity_manager;
+  ComponentType component;
+  entity_manager.RegisterComponent<ComponentType>(&component);
+  std::vector<entity::EntityRef> entities(kCount);
+  for (int i = 0; i < kCount; ++i) {
+    entities[i] = entity_manager.AllocateNewEntity();
+    component.AddEntity(entities[i])->values[0] = static_cast<float>(i);
+  }
+  for (int i = 0; i < kCount; i += 3) component.RemoveEntity(entities[i]);
+  while (state.KeepRunning()) {
+    float sum = 0;
+    for (auto it = component.begin(); it != component.end(); ++it) {
+      sum += it->data.values[0];
+    }
+    Consume(sum);
+  }
+  state.SetItemsPerIteration(static_cast<int64_t>(component.EntityCount()));
+}
+
+static void CharacterStateMachineUpdate(BenchmarkState& state) {
+  if (!g_assets.Load()) {
+    state.SkipWithError("Can't load the state machine.");
+    return;
+  }
+  // Inputs with a few buttons held, and the time moving on between them.
+  static const int kInputCount = 1024;
+  Random random(1);
+  std::vector<ConditionInputs> inputs(kInputCount);
+  for (int i = 0; i < kInputCount; ++i) {
+    ConditionInputs& input = inputs[i];
+    // A few of the 15 logical inputs.
+    input.is_down =
+        static_cast<int32_t>(random.Next() & random.Next() & 0x7FFF);
+    input.went_down = input.is_down & static_cast<int32_t>(random.Next());
+    input.went_up = 0;
+    input.animation_time = static_cast<int>(random.Next() % 1000);
+    input.current_time = i * 16;
+    input.is_multiscreen = false;
+  }
+  CharacterStateMachine machine(&g_assets.state_machine_table);
+  int i = 0;
+  while (state.KeepRunning()) {
+    machine.Update(inputs[i]);
+    i = (i + 1) % kInputCount;
+  }
+  Consume(machine.current_state_id());
+}
+
+// The timeline with the most events, to look things up in.
+static const Timeline* BusiestTimeline() {
+  if (!g_assets.Load()) return nullptr;
+  const Timeline* busiest = nullptr;
+  size_t most = 0;
+  auto states = g_assets.state_machine_def->states();
+  for (size_t i = 0; i < states->Length(); ++i) {
+    const Timeline* timeline = states->Get(i)->timeline();
+    if (timeline == nullptr || timeline->events() == nullptr) continue;
+    if (busiest == nullptr || timeline->events()->Length() > most) {
+      busiest = timeline;
+      most = timeline->events()->Length();
+    }
+  }
+  return busiest;
+}
+
+// Each iteration plays through the timeline a frame at a time, as a
+// character in that state does.
+static const WorldTime kTimelineStep = 16;
+
+static void TimelineIndexAfterTimeScan(BenchmarkState& state) {
+  const Timeline* timeline = BusiestTimeline();
+  if (timeline == nullptr) {
+    state.SkipWithError("No timeline has events.");
+    return;
+  }
+  const WorldTime end_time = std::max<WorldTime>(timeline->end_time(), 1);
+  while (state.KeepRunning()) {
+    for (WorldTime t = 0; t < end_time; t += kTimelineStep) {
+      Consume(TimelineIndexAfterTime(timeline->events(), 0, t));
+    }
+  }
+  state.SetItemsPerIteration((end_time + kTimelineStep - 1) / kTimelineStep);
+}
+
+static void TimelineIndexAfterTimeCursor(BenchmarkState& state) {
+  const Timeline* timeline = BusiestTimeline();
+  if (timeline == nullptr) {
+    state.SkipWithError("No timeline has events.");
+    return;
+  }
+  const WorldTime end_time = std::max<WorldTime>(timeline->end_time(), 1);
+  TimelineCursor cursor;
+  while (state.KeepRunning()) {
+    for (WorldTime t = 0; t < end_time; t += kTimelineStep) {
+      Consume(cursor.IndexAfterTime(timeline->events(), t));
+    }
+  }
+  state.SetItemsPerIteration((end_time + kTimelineStep - 1) / kTimelineStep);
+}
+
+static void TimelineAccessoriesWithTime(BenchmarkState& state) {
+  const Timeline* timeline = BusiestTimeline();
+  if (timeline == nullptr) {
+    state.SkipWithError("No timeline has events.");
+    return;
+  }
+  const WorldTime end_time = std::max<WorldTime>(timeline->end_time(), 1);
+  static const int kMaxIndices = 16;
+  int indices[kMaxIndices];
+  while (state.KeepRunning()) {
+    for (WorldTime t = 0; t < end_time; t += kTimelineStep) {
+      Consume(TimelineIndicesWithTime(timeline->accessories(), t, indices,
+                                      kMaxIndices));
+    }
+  }
+  state.SetItemsPerIteration((end_time + kTimelineStep - 1) / kTimelineStep);
+}
+
+// Glyphs of about the size the menus draw, as many as fit in a page.
+static const mathfu::vec2i kGlyphCacheSize(1024, 1024);
+static const int32_t kGlyphSize = 31;
+static const int32_t kGlyphsPerPage =
+    (kGlyphCacheSize.x() / (kGlyphSize + kGlyphCachePaddingX)) *
+    (kGlyphCacheSize.y() / (kGlyphSize + kGlyphCachePaddingY));
+
+static void GlyphCacheSet(BenchmarkState& state) {
+  std::vector<uint8_t> image(kGlyphSize * kGlyphSize);
+  GlyphCacheEntry entry;
+  entry.set_size(mathfu::vec2i(kGlyphSize, kGlyphSize));
+  std::unique_ptr<GlyphCache<uint8_t>> cache;
+  while (state.KeepRunning()) {
+    // Start again with an empty cache, so each Set() finds room.
+    cache.reset(new GlyphCache<uint8_t>(kGlyphCacheSize));
+    for (int32_t i = 0; i < kGlyphsPerPage; ++i) {
+      entry.set_code_point(i);
+      ConsumePointer(cache->Set(image.data(), kGlyphSize, entry));
+    }
+  }
+  state.SetItemsPerIteration(kGlyphsPerPage);
+}
+
+static void GlyphCacheFind(BenchmarkState& state) {
+  std::vector<uint8_t> image(kGlyphSize * kGlyphSize);
+  GlyphCacheEntry entry;
+  entry.set_size(mathfu::vec2i(kGlyphSize, kGlyphSize));
+  GlyphCache<uint8_t> cache(kGlyphCacheSize);
+  for (int32_t i = 0; i < kGlyphsPerPage; ++i) {
+    entry.set_code_point(i);
+    cache.Set(image.data(), kGlyphSize, entry);
+  }
+  // Look glyphs up in an order unrelated to the one they went in.
+  Random random(2);
+  std::vector<uint32_t> code_points(kGlyphsPerPage);
+  for (int32_t i = 0; i < kGlyphsPerPage; ++i) {
+    code_points[i] = random.Next() % kGlyphsPerPage;
+  }
+  while (state.KeepRunning()) {
+    for (int32_t i = 0; i < kGlyphsPerPage; ++i) {
+      ConsumePointer(cache.Find(code_points[i], kGlyphSize));
+    }
+    cache.Update();
+  }
+  state.SetItemsPerIteration(kGlyphsPerPage);
+}
+
+// Strings like those on the menus and the score board, at menu size.
+static const float kTextSize = 32.0f;
+static const int kStringsPerFrame = 64;
+
+static void FontManagerGetBufferCached(BenchmarkState& state) {
+  FontManager fontman;
+  if (!fontman.Open(kFontFileName)) {
+    state.SkipWithError("Can't open the font.");
+    return;
+  }
+  std::vector<std::string> strings(kStringsPerFrame);
+  for (int i = 0; i < kStringsPerFrame; ++i) {
+    char text[32];
+    snprintf(text, sizeof(text), "Player %d wins", i);
+    strings[i] = text;
+    fontman.GetBuffer(strings[i].c_str(), kTextSize);
+  }
+  while (state.KeepRunning()) {
+    fontman.StartLayoutPass();
+    for (int i = 0; i < kStringsPerFrame; ++i) {
+      ConsumePointer(fontman.GetBuffer(strings[i].c_str(), kTextSize));
+    }
+  }
+  state.SetItemsPerIteration(kStringsPerFrame);
+}
+
+// Every string is new, so is laid out, either by harfbuzz or from the
+// preshaped numbers.
+static void FontManagerGetBufferNew(BenchmarkState& state, bool preshaped) {
+  FontManager fontman;
+  if (!fontman.Open(kFontFileName)) {
+    state.SkipWithError("Can't open the font.");
+    return;
+  }
+  if (preshaped) fontman.SetPreshapedCharacters(kNumericCharacters);
+  int serial = 0;
+  while (state.KeepRunning()) {
+    // A frame's worth of strings, after which the old ones may be evicted.
+    fontman.StartLayoutPass();
+    for (int i = 0; i < kStringsPerFrame; ++i) {
+      char text[32];
+      snprintf(text, sizeof(text), preshaped ? "%d" : "Score %d", serial++);
+      ConsumePointer(fontman.GetBuffer(text, kTextSize));
+    }
+  }
+  state.SetItemsPerIteration(kStringsPerFrame);
+}
+
+static void FontManagerGetBufferShaped(BenchmarkState& state) {
+  FontManagerGetBufferNew(state, false);
+}
+
+static void FontManagerGetBufferPreshaped(BenchmarkState& state) {
+  FontManagerGetBufferNew(state, true);
+}
+
+static void ParticleManagerAdvanceFrame(BenchmarkState& state) {
+  ParticleManager particle_manager;
+  Random random(3);
+  // The particles never finish, so every frame updates the full pool.
+  const TimeStep kDuration = 1e9f;
+  int count = 0;
+  for (;;) {
+    Particle particle;
+    particle.set_base_position(
+        mathfu::vec3(random.Range(-5, 5), 0, random.Range(-5, 5)));
+    particle.set_base_velocity(
+        mathfu::vec3(random.Range(-1, 1), random.Range(0, 2), 0));
+    particle.set_acceleration(mathfu::vec3(0, -0.001f, 0));
+    particle.set_rotational_velocity(
+        mathfu::vec3(0, 0, random.Range(-0.01f, 0.01f)));
+    particle.set_duration(kDuration);
+    particle.set_duration_of_fade_out(kDuration / 2);
+    particle.set_duration_of_shrink_out(kDuration / 4);
+    if (!particle_manager.AddParticle(particle, nullptr)) break;
+    ++count;
+  }
+  while (state.KeepRunning()) {
+    particle_manager.AdvanceFrame(16.0f);
+  }
+  Consume(particle_manager.size());
+  state.SetItemsPerIteration(count);
+}
+
+// The player statuses MultiplayerDirector sends to each client during a
+// multiscreen game, built the same way into one reused builder. The
+// director's own builders are only compiled in with Google Play Games.
+static const int kMultiscreenPlayers = 4;
+
+static void StatusSnapshot(uint16_t sequence, Random* random,
+                           PlayerStatusHistory::Snapshot* status) {
+  status->sequence = sequence;
+  status->valid = true;
+  status->player_health.resize(kMultiscreenPlayers);
+  status->player_splats.resize(kMultiscreenPlayers);
+  for (int i = 0; i < kMultiscreenPlayers; ++i) {
+    status->player_health[i] = static_cast<uint8_t>(random->Next() % 11);
+    status->player_splats[i] = random->Next() & 0xFF;
+  }
+}
+
+static void MultiplayerPlayerStatusMessage(BenchmarkState& state) {
+  Random random(4);
+  PlayerStatusHistory::Snapshot status;
+  StatusSnapshot(1, &random, &status);
+  flatbuffers::FlatBufferBuilder builder;
+  std::vector<uint32_t> viewer_splats;
+  std::vector<uint8_t> payload;
+  while (state.KeepRunning()) {
+    for (int viewer = 0; viewer < kMultiscreenPlayers; ++viewer) {
+      builder.Clear();
+      auto health = builder.CreateVector(status.player_health);
+      viewer_splats = status.player_splats;
+      for (int i = 0; i < kMultiscreenPlayers; ++i) {
+        if (i != viewer) viewer_splats[i] = 0;
+      }
+      auto splats = builder.CreateVector(viewer_splats);
+      auto player_status = multiplayer::CreatePlayerStatus(
+          builder, health, splats, status.sequence);
+      builder.Finish(multiplayer::CreateMessageRoot(
+          builder, multiplayer::Data_PlayerStatus, player_status.Union()));
+      payload.assign(builder.GetBufferPointer(),
+                     builder.GetBufferPointer() + builder.GetSize());
+      Consume(payload.size());
+    }
+  }
+  state.SetItemsPerIteration(kMultiscreenPlayers);
+}
+
+static void MultiplayerPlayerStatusDeltaMessage(BenchmarkState& state) {
+  Random random(5);
+  PlayerStatusHistory::Snapshot baseline;
+  PlayerStatusHistory::Snapshot status;
+  StatusSnapshot(1, &random, &baseline);
+  // Most statuses only differ from the last acknowledged one a little.
+  status = baseline;
+  status.sequence = 2;
+  status.player_health[1]--;
+  status.player_splats[2] |= 1;
+  flatbuffers::FlatBufferBuilder builder;
+  std::vector<uint8_t> changed_players;
+  std::vector<uint8_t> changed_health;
+  std::vector<uint32_t> changed_splats;
+  std::vector<uint8_t> payload;
+  while (state.KeepRunning()) {
+    for (int viewer = 0; viewer < kMultiscreenPlayers; ++viewer) {
+      builder.Clear();
+      changed_players.clear();
+      changed_health.clear();
+      changed_splats.clear();
+      for (int i = 0; i < kMultiscreenPlayers; ++i) {
+        const bool own = i == viewer;
+        if (status.player_health[i] == baseline.player_health[i] &&
+            (!own || status.player_splats[i] == baseline.player_splats[i])) {
+          continue;
+        }
+        changed_players.push_back(static_cast<uint8_t>(i));
+        changed_health.push_back(status.player_health[i]);
+        changed_splats.push_back(own ? status.player_splats[i] : 0);
+      }
+      auto players = builder.CreateVector(changed_players);
+      auto health = builder.CreateVector(changed_health);
+      auto splats = builder.CreateVector(changed_splats);
+      auto delta = multiplayer::CreatePlayerStatusDelta(
+          builder, status.sequence, baseline.sequence, players, health,
+          splats);
+      builder.Finish(multiplayer::CreateMessageRoot(
+          builder, multiplayer::Data_PlayerStatusDelta, delta.Union()));
+      payload.assign(builder.GetBufferPointer(),
+                     builder.GetBufferPointer() + builder.GetSize());
+      Consume(payload.size());
+    }
+  }
+  state.SetItemsPerIteration(kMultiscreenPlayers);
+}
+
+struct Benchmark {
+  const char* name;
+  void (*function)(BenchmarkState& state);
+};
+
+static const Benchmark kBenchmarks[] = {
+    {"VectorPool/AllocFree", VectorPoolAllocFree},
+    {"VectorPool/Iterate", VectorPoolIterate},
+    {"Component/IterateVectorPool",
+     ComponentIterate<VectorPoolBenchmarkComponent>},
+    {"Component/IterateDensePool",
+     ComponentIterate<DensePoolBenchmarkComponent>},
+    {"CharacterStateMachine/Update", CharacterStateMachineUpdate},
+    {"Timeline/IndexAfterTimeScan", TimelineIndexAfterTimeScan},
+    {"Timeline/IndexAfterTimeCursor", TimelineIndexAfterTimeCursor},
+    {"Timeline/IndicesWithTime", TimelineAccessoriesWithTime},
+    {"GlyphCache/Set", GlyphCacheSet},
+    {"GlyphCache/Find", GlyphCacheFind},
+    {"FontManager/GetBufferCached", FontManagerGetBufferCached},
+    {"FontManager/GetBufferShaped", FontManagerGetBufferShaped},
+    {"FontManager/GetBufferPreshaped", FontManagerGetBufferPreshaped},
+    {"ParticleManager/AdvanceFrame", ParticleManagerAdvanceFrame},
+    {"MultiplayerDirector/PlayerStatus", MultiplayerPlayerStatusMessage},
+    {"MultiplayerDirector/PlayerStatusDelta",
+     MultiplayerPlayerStatusDeltaMessage},
+};
+
+struct BenchmarkResult {
+  const char* name;
+  int64_t iterations;
+  double seconds;
+  int64_t items_per_iteration;
+  const char* error;
+
+  double NanosecondsPerIteration() const {
+    return iterations > 0 ? seconds * 1e9 / iterations : 0;
+  }
+  double ItemsPerSecond() const {
+    return seconds > 0 ? items_per_iteration * iterations / seconds : 0;
+  }
+};
+
+// Run 'benchmark' with more iterations each time, until they take at least
+// 'min_time' seconds.
+static BenchmarkResult RunBenchmark(const Benchmark& benchmark,
+                                    double min_time) {
+  int64_t iterations = 1;
+  for (;;) {
+    BenchmarkState state(iterations);
+    benchmark.function(state);
+    if (state.error() != nullptr || state.seconds() >= min_time ||
+        iterations >= kMaxIterations) {
+      BenchmarkResult result = {benchmark.name, state.iterations(),
+                                state.seconds(), state.items_per_iteration(),
+                                state.error()};
+      return result;
+    }
+    // Aim a little past the minimum time, growing by at most 10x at once.
+    const double multiplier =
+        state.seconds() > 0 ? min_time * 1.4 / state.seconds() : 10.0;
+    iterations = std::min(
+        kMaxIterations,
+        std::max(iterations + 1,
+                 static_cast<int64_t>(iterations *
+                                      std::min(multiplier, 10.0))));
+  }
+}
+
+static void PrintConsole(const std::vector<BenchmarkResult>& results) {
+  printf("%-40s %14s %12s %14s\n", "Benchmark", "ns/iteration", "iterations",
+         "items/s");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchmarkResult& result = results[i];
+    if (result.error != nullptr) {
+      printf("%-40s ERROR: %s\n", result.name, result.error);
+    } else if (result.items_per_iteration > 0) {
+      printf("%-40s %14.1f %12lld %14.4g\n", result.name,
+             result.NanosecondsPerIteration(),
+             static_cast<long long>(result.iterations),
+             result.ItemsPerSecond());
+    } else {
+      printf("%-40s %14.1f %12lld\n", result.name,
+             result.NanosecondsPerIteration(),
+             static_cast<long long>(result.iterations));
+    }
+  }
+}
+
+// The results in Google Benchmark's JSON layout, so the same tools read both.
+static std::string ResultsJson(const std::vector<BenchmarkResult>& results) {
+  std::string json = "{\n  \"context\": {\n";
+  char line[256];
+  snprintf(line, sizeof(line),
+           "    \"executable\": \"pie_noon_benchmarks\",\n"
+           "    \"num_cpus\": %d,\n    \"platform\": \"%s\"\n  },\n",
+           SDL_GetCPUCount(), SDL_GetPlatform());
+  json.append(line);
+  json.append("  \"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchmarkResult& result = results[i];
+    snprintf(line, sizeof(line),
+             "    {\n      \"name\": \"%s\",\n      \"iterations\": %lld,\n"
+             "      \"real_time\": %.3f,\n      \"cpu_time\": %.3f,\n"
+             "      \"time_unit\": \"ns\"",
+             result.name, static_cast<long long>(result.iterations),
+             result.NanosecondsPerIteration(),
+             result.NanosecondsPerIteration());
+    json.append(line);
+    if (result.items_per_iteration > 0) {
+      snprintf(line, sizeof(line), ",\n      \"items_per_second\": %.6g",
+               result.ItemsPerSecond());
+      json.append(line);
+    }
+    if (result.error != nullptr) {
+      snprintf(line, sizeof(line),
+               ",\n      \"error_occurred\": true,\n"
+               "      \"error_message\": \"%s\"",
+               result.error);
+      json.append(line);
+    }
+    json.append(i + 1 < results.size() ? "\n    },\n" : "\n    }\n");
+  }
+  json.append("  ]\n}\n");
+  return json;
+}
+
+// The value of '--name=value' if 'arg' is that flag, or nullptr.
+static const char* FlagValue(const char* arg, const char* name) {
+  const size_t length = strlen(name);
+  return strncmp(arg, name, length) == 0 && arg[length] == '='
+             ? arg + length + 1
+             : nullptr;
+}
+
+static int RunBenchmarks(int argc, char* argv[]) {
+  const char* filter = "";
+  const char* format = "console";
+  const char* out = nullptr;
+  double min_time = kDefaultMinTime;
+  for (int i = 1; i < argc; ++i) {
+    const char* value;
+    if ((value = FlagValue(argv[i], "--benchmark_filter")) != nullptr) {
+      filter = value;
+    } else if ((value = FlagValue(argv[i], "--benchmark_format")) !=
+               nullptr) {
+      format = value;
+    } else if ((value = FlagValue(argv[i], "--benchmark_min_time")) !=
+               nullptr) {
+      min_time = atof(value);
+    } else if ((value = FlagValue(argv[i], "--benchmark_out")) != nullptr) {
+      out = value;
+    } else {
+      fprintf(stderr,
+              "usage: %s [--benchmark_filter=<substring>] "
+              "[--benchmark_format=console|json] "
+              "[--benchmark_min_time=<seconds>] [--benchmark_out=<file>]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  const bool json = strcmp(format, "json") == 0;
+  if (!json && strcmp(format, "console") != 0) {
+    fprintf(stderr, "Unknown format: %s\n", format);
+    return 1;
+  }
+
+  // The output file is named relative to where we started, so is opened
+  // before changing to the assets directory.
+  FILE* out_file = out != nullptr ? fopen(out, "w") : nullptr;
+  if (out != nullptr && out_file == nullptr) {
+    fprintf(stderr, "Can't write %s\n", out);
+    return 1;
+  }
+
+  const char* binary_directory = argc > 0 ? argv[0] : "";
+  if (!ChangeToUpstreamDir(binary_directory, kAssetsDir)) return 1;
+
+  std::vector<BenchmarkResult> results;
+  for (size_t i = 0; i < PIE_ARRAYSIZE(kBenchmarks); ++i) {
+    if (strstr(kBenchmarks[i].name, filter) == nullptr) continue;
+    results.push_back(RunBenchmark(kBenchmarks[i], min_time));
+  }
+
+  const std::string results_json = ResultsJson(results);
+  if (json) {
+    fputs(results_json.c_str(), stdout);
+  } else {
+    PrintConsole(results);
+  }
+  if (out_file != nullptr) {
+    fputs(results_json.c_str(), out_file);
+    fclose(out_file);
+  }
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (results[i].error != nullptr) return 1;
+  }
+  return 0;
+}
+
+}  // namespace pie_noon
+}  // namespace fpl
+
+int main(int argc, char* argv[]) {
+  return fpl::pie_noon::RunBenchmarks(argc, argv);
+}
+
+MATHFU_DEFINE_GLOBAL_SIMD_AWARE_NEW_DELETE
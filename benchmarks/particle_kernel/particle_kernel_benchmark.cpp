@@ -0,0 +1,187 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the batch particle update in particle_kernel.cpp against updating
+// Particle objects one at a time, as ParticleManager used to.
+//
+// Usage: particle_kernel_benchmark [frames]
+
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "particle_kernel.h"
+#include "particles.h"
+
+using fpl::pie_noon::Particle;
+using fpl::pie_noon::TimeStep;
+
+static const TimeStep kDeltaTime = 16.0f;
+static const TimeStep kDuration = 1e9f;
+static const size_t kParticleCounts[] = {1000, 10000, 100000};
+
+// The particle state that changes each frame, as the scalar path computes it.
+struct ScalarState {
+  mathfu::vec3_packed position;
+  mathfu::vec3_packed orientation;
+  mathfu::vec4_packed tint;
+  mathfu::vec3_packed scale;
+};
+
+static float Random(float min, float max) {
+  return min + (max - min) * static_cast<float>(rand()) / RAND_MAX;
+}
+
+static Particle RandomParticle() {
+  Particle p;
+  p.set_base_position(mathfu::vec3(Random(-5, 5), 0, Random(-5, 5)));
+  p.set_base_velocity(mathfu::vec3(Random(-1, 1), Random(0, 2), 0));
+  p.set_acceleration(mathfu::vec3(0, -0.001f, 0));
+  p.set_rotational_velocity(mathfu::vec3(0, 0, Random(-0.01f, 0.01f)));
+  p.set_duration(kDuration);
+  p.set_duration_of_fade_out(kDuration / 2);
+  p.set_duration_of_shrink_out(kDuration / 4);
+  return p;
+}
+
+// One frame of the old update: every particle is a separate object.
+static void UpdateScalar(std::vector<Particle>& particles,
+                         std::vector<ScalarState>& states) {
+  for (size_t i = 0; i < particles.size(); ++i) {
+    Particle& p = particles[i];
+    p.AdvanceFrame(kDeltaTime);
+    ScalarState& state = states[i];
+    state.position = p.CurrentPosition();
+    state.orientation =
+        p.base_orientation() + p.rotational_velocity() * p.age();
+    state.tint = p.CurrentTint();
+    state.scale = p.CurrentScale();
+  }
+}
+
+// The same particles, laid out as ParticleManager stores them.
+struct Batch {
+  explicit Batch(const std::vector<Particle>& particles) {
+    const size_t n = particles.size();
+    for (int j = 0; j < 3; ++j) {
+      base_position[j].resize(n);
+      velocity[j].resize(n);
+      acceleration[j].resize(n);
+      base_orientation[j].resize(n);
+      rotational_velocity[j].resize(n);
+      position[j].resize(n);
+      orientation[j].resize(n);
+    }
+    ages.resize(n);
+    durations.resize(n);
+    fade_durations.resize(n);
+    shrink_durations.resize(n);
+    fades.resize(n);
+    shrinks.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+      const Particle& p = particles[i];
+      for (int j = 0; j < 3; ++j) {
+        base_position[j][i] = p.base_position()[j];
+        velocity[j][i] = p.base_velocity()[j];
+        acceleration[j][i] = p.acceleration()[j];
+        base_orientation[j][i] = p.base_orientation()[j];
+        rotational_velocity[j][i] = p.rotational_velocity()[j];
+      }
+      ages[i] = p.age();
+      durations[i] = p.duration();
+      fade_durations[i] = p.duration_of_fade_out();
+      shrink_durations[i] = p.duration_of_shrink_out();
+    }
+  }
+
+  // One frame of the batch update, as in ParticleManager::AdvanceFrame().
+  void Update() {
+    using namespace fpl::pie_noon;
+    const size_t n = ages.size();
+    ParticleAddToEach(kDeltaTime, n, &ages[0]);
+    for (int j = 0; j < 3; ++j) {
+      ParticleIntegrateQuadratic(&base_position[j][0], &velocity[j][0],
+                                 &acceleration[j][0], &ages[0], n,
+                                 &position[j][0]);
+      ParticleIntegrateLinear(&base_orientation[j][0],
+                              &rotational_velocity[j][0], &ages[0], n,
+                              &orientation[j][0]);
+    }
+    ParticleEndOfLifeScales(&ages[0], &durations[0], &fade_durations[0], n,
+                            &fades[0]);
+    ParticleEndOfLifeScales(&ages[0], &durations[0], &shrink_durations[0], n,
+                            &shrinks[0]);
+  }
+
+  std::vector<float> base_position[3];
+  std::vector<float> velocity[3];
+  std::vector<float> acceleration[3];
+  std::vector<float> base_orientation[3];
+  std::vector<float> rotational_velocity[3];
+  std::vector<float> position[3];
+  std::vector<float> orientation[3];
+  std::vector<float> ages;
+  std::vector<float> durations;
+  std::vector<float> fade_durations;
+  std::vector<float> shrink_durations;
+  std::vector<float> fades;
+  std::vector<float> shrinks;
+};
+
+template <typename F>
+static double MillisecondsPerFrame(int frames, F update) {
+  const auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < frames; ++i) update();
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::high_resolution_clock::now() - start;
+  return elapsed.count() / frames;
+}
+
+int main(int argc, char** argv) {
+  const int frames = argc > 1 ? atoi(argv[1]) : 100;
+  if (frames <= 0) {
+    fprintf(stderr, "Usage: %s [frames]\n", argv[0]);
+    return 1;
+  }
+
+  printf("%d frames, batch kernel: %s\n", frames,
+         fpl::pie_noon::ParticleKernelName());
+  printf("%10s %14s %14s %8s\n", "particles", "scalar ms", "batch ms",
+         "speedup");
+  for (size_t c = 0; c < PIE_ARRAYSIZE(kParticleCounts); ++c) {
+    const size_t count = kParticleCounts[c];
+    std::vector<Particle> particles(count);
+    for (size_t i = 0; i < count; ++i) particles[i] = RandomParticle();
+    std::vector<ScalarState> states(count);
+    Batch batch(particles);
+
+    const double scalar = MillisecondsPerFrame(
+        frames, [&]() { UpdateScalar(particles, states); });
+    const double batched =
+        MillisecondsPerFrame(frames, [&]() { batch.Update(); });
+
+    // Make sure both paths agree, so neither is optimized away unchecked.
+    const size_t last = count - 1;
+    const float x = states[last].position.data[0];
+    if (fabs(x - batch.position[0][last]) > 1e-4f * (1.0f + fabs(x)) ||
+        fabs(states[last].tint.data[3] - batch.fades[last]) > 1e-4f) {
+      fprintf(stderr, "Scalar and batch results differ.\n");
+      return 1;
+    }
+    printf("%10zu %14.4f %14.4f %7.2fx\n", count, scalar, batched,
+           scalar / batched);
+  }
+  return 0;
+}
@@ -36,6 +36,10 @@ include $(CLEAR_VARS)
 
 LOCAL_MODULE := main
 LOCAL_ARM_MODE := arm
+# Enables the NEON path in particle_kernel.cpp.
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+LOCAL_ARM_NEON := true
+endif
 
 PIE_NOON_GENERATED_OUTPUT_DIR := $(PIE_NOON_DIR)/gen/include
 
@@ -56,47 +60,74 @@ LOCAL_SRC_FILES := \
   $(subst $(LOCAL_PATH)/,,$(DEPENDENCIES_SDL_DIR))/src/main/android/SDL_android_main.c \
   $(PIE_NOON_RELATIVE_DIR)/src/ai_controller.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/analytics_tracking.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/asset_archive.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/async_loader.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/billboard_batch.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/cardboard_controller.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/character.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/character_state_machine.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/controller.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/draw_list.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/dynamic_resolution.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/components/cardboard_player.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/components/drip_and_vanish.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/components/player_character.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/components/scene_object.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/components/shakeable_prop.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/entity/entity_command_buffer.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/entity/entity_manager.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/font_manager.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/frame_pacer.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/frame_profiler.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/frustum.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/full_screen_fader.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/gamepad_controller.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/game_camera.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/game_state.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/gpg_manager.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/gpg_multiplayer.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/gpu_particles.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/gui_menu.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/hitch_detector.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/imgui.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/input.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/main.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/mapped_file.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/material.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/material_manager.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/memory_accounting.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/mesh.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/multiplayer_controller.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/multiplayer_director.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/nearby_connections_transport.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/perf_hud.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/player_controller.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/particle_budget.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/particle_kernel.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/particles.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/pie_pool.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/precompiled.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/quality_governor.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/render_queue.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/render_target.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/renderer.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/renderer_android.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/runtime_config.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/scenario_benchmark.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/shader.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/simulation_thread.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/startup_trace.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/stream_buffer.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/pie_noon_game.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/touchscreen_button.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/touchscreen_controller.cpp \
-  $(PIE_NOON_RELATIVE_DIR)/src/utilities.cpp
+  $(PIE_NOON_RELATIVE_DIR)/src/utilities.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/worker_pool.cpp
 
 PIE_NOON_SCHEMA_DIR := $(PIE_NOON_DIR)/src/flatbufferschemas
 
 PIE_NOON_SCHEMA_FILES := \
+  $(PIE_NOON_SCHEMA_DIR)/baked_text.fbs \
   $(PIE_NOON_SCHEMA_DIR)/character_state_machine_def.fbs \
   $(PIE_NOON_SCHEMA_DIR)/config.fbs \
   $(PIE_NOON_SCHEMA_DIR)/components.fbs \
@@ -105,6 +136,7 @@ PIE_NOON_SCHEMA_FILES := \
   $(PIE_NOON_SCHEMA_DIR)/multiplayer.fbs \
   $(PIE_NOON_SCHEMA_DIR)/particles.fbs \
   $(PIE_NOON_SCHEMA_DIR)/pie_noon_common.fbs \
+  $(PIE_NOON_SCHEMA_DIR)/replay.fbs \
   $(PIE_NOON_SCHEMA_DIR)/scoring_rules.fbs \
   $(PIE_NOON_SCHEMA_DIR)/timeline.fbs
 
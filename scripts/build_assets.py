@@ -20,18 +20,33 @@ JSON files to flatbuffer binary files and the png files to webp files so that
 they can be loaded by the game. This script also includes various 'make' style
 rules. If you just want to build the flatbuffer binaries you can pass
 'flatbuffer' as an argument, or if you want to just build the webp files you can
-pass 'cwebp' as an argument. Additionally, if you would like to clean all
-generated files, you can call this script with the argument 'clean'.
+pass 'cwebp' as an argument. UI text listed under src/rawassets/baked_text/ is
+shaped and rasterized offline with pie_noon_font_baker, if it's been built, or
+alone with 'text'. Additionally, if you would like to clean all generated
+files, you can call this script with the argument 'clean'.
+
+Conversions run in parallel, one per core unless told otherwise with --jobs.
+Each asset is rebuilt when the contents of anything it is built from change,
+including the schemas its schema includes, as recorded in a manifest in the
+assets directory.
 """
 
 import argparse
 import distutils.spawn
 import glob
+import hashlib
+import json
+import multiprocessing
+import multiprocessing.pool
 import os
 import platform
+import re
 import shutil
+import struct
 import subprocess
 import sys
+import tempfile
+import threading
 
 # The project root directory, which is one level up from this script's
 # directory.
@@ -79,6 +94,11 @@ CWEBP_PATHS = [
     os.path.dirname(CWEBP_BINARY_IN_PATH) if CWEBP_BINARY_IN_PATH else '',
 ]
 
+# GPU compressed texture encoders. These are optional: textures that have no
+# compressed version are loaded from their webp instead.
+ASTCENC = distutils.spawn.find_executable('astcenc')
+ETCTOOL = distutils.spawn.find_executable('EtcTool')
+
 # Directory to place processed assets.
 ASSETS_PATH = os.path.join(PROJECT_ROOT, 'assets')
 
@@ -97,6 +117,12 @@ RAW_MATERIAL_PATH = os.path.join(RAW_ASSETS_PATH, 'materials')
 # Directory where unprocessed textures can be found.
 RAW_TEXTURE_PATH = os.path.join(RAW_ASSETS_PATH, 'textures')
 
+# Directory where texture atlas definitions can be found.
+RAW_ATLAS_PATH = os.path.join(RAW_ASSETS_PATH, 'atlases')
+
+# Directory where definitions of UI text to bake can be found.
+RAW_BAKED_TEXT_PATH = os.path.join(RAW_ASSETS_PATH, 'baked_text')
+
 # Directory where unprocessed assets can be found.
 SCHEMA_PATHS = [
     os.path.join(PROJECT_ROOT, 'src', 'flatbufferschemas'),
@@ -113,10 +139,45 @@ FLATC_EXECUTABLE_NAME = 'flatc' + EXECUTABLE_EXTENSION
 # Name of the cwebp executable.
 CWEBP_EXECUTABLE_NAME = 'cwebp' + EXECUTABLE_EXTENSION
 
+# Name of the text baking tool, which is built with the game.
+FONT_BAKER_EXECUTABLE_NAME = 'pie_noon_font_baker' + EXECUTABLE_EXTENSION
+
 # What level of quality we want to apply to the webp files.
 # Ranges from 0 to 100.
 WEBP_QUALITY = 90
 
+# ASTC block size. Larger blocks compress further, at a cost in quality.
+ASTC_BLOCK_SIZE = '6x6'
+
+# Largest width or height of a generated texture atlas, in pixels.
+MAX_ATLAS_SIZE = 4096
+
+# Name of the packed archive of all assets, relative to the assets directory.
+# Must match kAssetArchiveFileName in src/asset_archive.h.
+ARCHIVE_NAME = 'assets.pak'
+
+# Archive layout constants. Must match src/asset_archive.h.
+ARCHIVE_MAGIC = b'FPAK'
+ARCHIVE_VERSION = 1
+ARCHIVE_ALIGNMENT = 16
+ARCHIVE_FLAG_LZ4 = 1
+
+# Extensions of the files that go into the archive. Sounds are left out
+# since the audio engine opens them itself.
+ARCHIVE_EXTENSIONS = ('.bin', '.webp', '.ktx', '.glslv', '.glslf', '.ttf',
+                      '.txt')
+
+# Extensions of the files worth trying to compress. Images are compressed
+# already.
+ARCHIVE_COMPRESSED_EXTENSIONS = ('.bin', '.glslv', '.glslf', '.txt')
+
+# Name of the record of what each built asset was built from, relative to the
+# assets directory.
+BUILD_MANIFEST_NAME = '.build_manifest.json'
+
+# Bump to rebuild everything, e.g. when the way an asset type is built changes.
+BUILD_MANIFEST_VERSION = 1
+
 
 class FlatbuffersConversionData(object):
   """Holds data needed to convert a set of json files to flatbuffer binaries.
@@ -180,12 +241,45 @@ def processed_texture_path(path, target_directory):
 # PNG files to convert to webp.
 PNG_TEXTURES = glob.glob(os.path.join(RAW_TEXTURE_PATH, '*.png'))
 
+# Texture atlas definitions. Each is a json file of the form
+#   {
+#     "output": "textures/splatters_atlas.png",
+#     "padding": 2,
+#     "textures": [ "textures/splat01.png", "textures/splat02.png" ]
+#   }
+# with paths relative to RAW_ASSETS_PATH. The textures are packed into one
+# power-of-two sized texture, and every material that refers to one of them is
+# rewritten to refer to the atlas instead, with a texture_rect that says where
+# in the atlas the original texture now lives.
+ATLAS_DEFINITIONS = glob.glob(os.path.join(RAW_ATLAS_PATH, '*.json'))
+
 # Location of FlatBuffers compiler.
 FLATC = find_in_paths(FLATC_EXECUTABLE_NAME, FLATBUFFERS_PATHS)
 
 # Location of webp compression tool.
 CWEBP = find_in_paths(CWEBP_EXECUTABLE_NAME, CWEBP_PATHS)
 
+# Definitions of UI text to shape and rasterize offline, for
+# FontManager::LoadBakedText(). Each is a json file of the form
+#   {
+#     "output": "fonts/perf_hud_text.bin",
+#     "font": "fonts/NotoSansCJKjp-Bold.otf",
+#     "sdf": true,
+#     "size": 20,
+#     "strings": [ "0123456789" ],
+#     "sources": [ { "file": "src/perf_hud.cpp", "calls": [ "AddLine" ] } ]
+#   }
+# with the output relative to the assets directory, the font relative to
+# ASSETS_PATH and the source files relative to PROJECT_ROOT. The strings baked
+# are those listed, and every string literal that's the first argument of a
+# call to one of the functions in "calls" in a source file. They're all baked
+# at "size" pixels high, which doesn't matter for "sdf" text. Strings that
+# aren't baked are still shaped at runtime.
+BAKED_TEXT_DEFINITIONS = glob.glob(os.path.join(RAW_BAKED_TEXT_PATH, '*.json'))
+
+# Location of the text baking tool.
+FONT_BAKER = find_in_paths(FONT_BAKER_EXECUTABLE_NAME, FLATBUFFERS_PATHS)
+
 
 class BuildError(Exception):
   """Error indicating there was a problem building assets."""
@@ -240,6 +334,327 @@ def convert_png_image_to_webp(png, out, quality=80):
   """
   command = [CWEBP, '-q', str(quality), png, '-o', out]
   run_subprocess(command)
+  append_webp_mip_levels(png, out, quality)
+
+
+def append_webp_mip_levels(png, out, quality):
+  """Append the rest of the png's mip chain to a webp file.
+
+  Each level is half the size of the one before, down to 1x1, and is written
+  as a complete webp image straight after the previous one. Renderer::
+  UnpackWebP() decodes them all, so the game can upload the levels as they
+  are rather than generate them at load time. Decoders that only expect one
+  image stop at the end of the first.
+
+  Without the Python Imaging Library, the file is left with one level, and the
+  game filters the rest itself.
+
+  Args:
+    png: The path to the png file the webp was made from.
+    out: The path of the webp file to append to.
+    quality: The quality to encode the levels at, as for cwebp.
+
+  Raises:
+    BuildError: Process return code was nonzero.
+  """
+  try:
+    from PIL import Image  # pylint: disable=g-import-not-at-top
+  except ImportError:
+    return
+  image = Image.open(png)
+  image = image.convert('RGBA' if png_has_alpha(png) else 'RGB')
+  # A box filter on a power of two texture averages each 2x2 block, as
+  # glGenerateMipmap() would.
+  resample = getattr(Image, 'BOX', Image.BILINEAR)
+  width, height = image.size
+  handle, level_png = tempfile.mkstemp(suffix='.png')
+  os.close(handle)
+  handle, level_webp = tempfile.mkstemp(suffix='.webp')
+  os.close(handle)
+  try:
+    with open(out, 'ab') as f:
+      while width > 1 or height > 1:
+        width = max(1, width // 2)
+        height = max(1, height // 2)
+        image.resize((width, height), resample).save(level_png)
+        run_subprocess([CWEBP, '-quiet', '-q', str(quality), level_png,
+                        '-o', level_webp])
+        with open(level_webp, 'rb') as level:
+          f.write(level.read())
+  finally:
+    os.remove(level_png)
+    os.remove(level_webp)
+
+
+def processed_compressed_texture_path(webp, encoding):
+  """Path of the GPU compressed version of a processed webp texture.
+
+  Args:
+    webp: The path to the webp file the game would otherwise load.
+    encoding: 'astc' or 'etc2'. Must match Renderer::CompressedTextureFilename.
+  """
+  return os.path.splitext(webp)[0] + '.' + encoding + '.ktx'
+
+
+def compressed_texture_paths(webp):
+  """Paths of the GPU compressed textures built next to a webp texture."""
+  return ([processed_compressed_texture_path(webp, 'astc')] if ASTCENC else
+          []) + ([processed_compressed_texture_path(webp, 'etc2')] if ETCTOOL
+                 else [])
+
+
+def convert_png_image_to_ktx(png, webp):
+  """Encode a png file into every GPU compressed format we have a tool for.
+
+  Args:
+    png: The path to the png file to encode.
+    webp: The path of the webp built from the same png, which the compressed
+        files are then named after.
+
+  Raises:
+    BuildError: Process return code was nonzero.
+  """
+  if ASTCENC:
+    out = processed_compressed_texture_path(webp, 'astc')
+    run_subprocess([ASTCENC, '-cl', png, out, ASTC_BLOCK_SIZE, '-medium'])
+  if ETCTOOL:
+    out = processed_compressed_texture_path(webp, 'etc2')
+    width, height = png_image_size(png)
+    levels = len(bin(max(width, height))) - 2
+    run_subprocess([ETCTOOL, png, '-format',
+                    'RGBA8' if png_has_alpha(png) else 'RGB8',
+                    '-mipmaps', str(levels), '-output', out])
+
+
+def png_has_alpha(png):
+  """True if the png file has an alpha channel, judging by its header."""
+  with open(png, 'rb') as f:
+    header = f.read(26)
+  return ord(header[25:26]) in (4, 6)  # Grayscale + alpha, RGBA.
+
+
+def png_image_size(png):
+  """Read the width and height of a png file from its header.
+
+  Args:
+    png: The path to the png file.
+
+  Returns:
+    A (width, height) tuple.
+  """
+  with open(png, 'rb') as f:
+    header = f.read(24)
+  return struct.unpack('>II', header[16:24])
+
+
+def asset_name(path):
+  """Convert the path of a raw png to the name the game loads it by."""
+  relative = os.path.relpath(processed_texture_path(path, ASSETS_PATH),
+                             ASSETS_PATH)
+  return relative.replace(os.sep, '/')
+
+
+def next_power_of_two(n):
+  """Returns the smallest power of two that is at least n."""
+  power = 1
+  while power < n:
+    power *= 2
+  return power
+
+
+def shelf_pack(sizes, width, height, padding):
+  """Pack rectangles into rows, tallest first.
+
+  Args:
+    sizes: List of (width, height) tuples to pack.
+    width: Width of the area to pack into.
+    height: Height of the area to pack into.
+    padding: Empty space to leave around each rectangle.
+
+  Returns:
+    List of (x, y) positions corresponding to sizes, or None if the rectangles
+    do not fit.
+  """
+  order = sorted(range(len(sizes)),
+                 key=lambda i: (-sizes[i][1], -sizes[i][0], i))
+  positions = [None] * len(sizes)
+  x = y = shelf_height = 0
+  for i in order:
+    w = sizes[i][0] + 2 * padding
+    h = sizes[i][1] + 2 * padding
+    if x + w > width:
+      x = 0
+      y += shelf_height
+      shelf_height = 0
+    if w > width or y + h > height:
+      return None
+    positions[i] = (x + padding, y + padding)
+    x += w
+    shelf_height = max(shelf_height, h)
+  return positions
+
+
+class TextureAtlas(object):
+  """A set of png textures packed into one texture.
+
+  Attributes:
+    definition: Path to the json file this atlas is defined by.
+    output: Path of the atlas png, as though it were a raw asset.
+    textures: Paths of the raw png files in the atlas.
+    padding: Pixels of border around each texture, to prevent bleeding.
+    size: (width, height) of the atlas.
+    positions: (x, y) of each texture in the atlas.
+  """
+
+  def __init__(self, definition):
+    """Load the atlas definition and lay out its textures."""
+    with open(definition) as f:
+      data = json.load(f)
+    self.definition = definition
+    self.output = os.path.join(RAW_ASSETS_PATH, data['output'])
+    self.textures = [os.path.join(RAW_ASSETS_PATH, t)
+                     for t in data['textures']]
+    self.padding = data.get('padding', 2)
+    self.sizes = [png_image_size(t) for t in self.textures]
+    self.size, self.positions = self.layout()
+
+  def layout(self):
+    """Find the smallest power-of-two texture that all the textures fit in."""
+    area = sum((w + 2 * self.padding) * (h + 2 * self.padding)
+               for w, h in self.sizes)
+    dimensions = []
+    power = 1
+    while power <= MAX_ATLAS_SIZE:
+      dimensions.append(power)
+      power *= 2
+    candidates = [(w, h) for w in dimensions for h in dimensions
+                  if w * h >= area]
+    candidates.sort(key=lambda size: (size[0] * size[1],
+                                      abs(size[0] - size[1])))
+    for width, height in candidates:
+      positions = shelf_pack(self.sizes, width, height, self.padding)
+      if positions:
+        return (width, height), positions
+    raise BuildError([self.definition], 1,
+                     message='Textures do not fit in a %dx%d atlas.' %
+                     (MAX_ATLAS_SIZE, MAX_ATLAS_SIZE))
+
+  def texture_rects(self):
+    """Map the name of each packed texture to its atlas name and rect."""
+    atlas = asset_name(self.output)
+    width, height = self.size
+    rects = {}
+    for texture, (w, h), (x, y) in zip(self.textures, self.sizes,
+                                       self.positions):
+      rects[asset_name(texture)] = (atlas, {
+          'u0': float(x) / width, 'v0': float(y) / height,
+          'u1': float(x + w) / width, 'v1': float(y + h) / height})
+    return rects
+
+  def sources(self):
+    """The files the atlas is built from."""
+    return [self.definition] + self.textures
+
+  def build(self, target):
+    """Composite the textures into one png, then convert it to webp.
+
+    Args:
+      target: Path of the webp file to write.
+
+    Raises:
+      BuildError: The atlas could not be built.
+    """
+    try:
+      from PIL import Image  # pylint: disable=g-import-not-at-top
+    except ImportError:
+      raise BuildError([self.definition], 1,
+                       message='The Python Imaging Library is required to '
+                       'build texture atlases.')
+    atlas = Image.new('RGBA', self.size, (0, 0, 0, 0))
+    for texture, (w, h), (x, y) in zip(self.textures, self.sizes,
+                                       self.positions):
+      image = Image.open(texture).convert('RGBA')
+      # Extend the edge texels into the padding, so that filtering and
+      # smaller mip levels don't pull in the neighboring textures.
+      p = self.padding
+      if p:
+        atlas.paste(image.resize((w + 2 * p, h + 2 * p), Image.NEAREST),
+                    (x - p, y - p))
+      atlas.paste(image, (x, y))
+    handle, png = tempfile.mkstemp(suffix='.png')
+    os.close(handle)
+    try:
+      atlas.save(png)
+      convert_png_image_to_webp(png, target, WEBP_QUALITY)
+      convert_png_image_to_ktx(png, target)
+    finally:
+      os.remove(png)
+
+
+def load_texture_atlases():
+  """Returns a TextureAtlas for each atlas definition."""
+  return [TextureAtlas(definition) for definition in ATLAS_DEFINITIONS]
+
+
+def atlas_texture_rects(atlases):
+  """Map the name of every packed texture to its atlas name and rect."""
+  rects = {}
+  for atlas in atlases:
+    rects.update(atlas.texture_rects())
+  return rects
+
+
+def generate_texture_atlases(atlases, target_directory, manifest, num_jobs):
+  """Build each texture atlas that is out of date.
+
+  Args:
+    atlases: List of TextureAtlas objects.
+    target_directory: Path to the target assets directory.
+    manifest: BuildManifest recording what the atlases were built from.
+    num_jobs: How many atlases to build at once.
+  """
+  jobs = []
+  for atlas in atlases:
+    out = processed_texture_path(atlas.output, target_directory)
+    out_dir = os.path.dirname(out)
+    if not os.path.exists(out_dir):
+      os.makedirs(out_dir)
+    targets = [out] + compressed_texture_paths(out)
+    signature = manifest.signature(atlas.sources(), texture_build_settings())
+    if manifest.needs_rebuild(targets, signature):
+      jobs.append(manifest.build_job(targets, signature,
+                                     lambda atlas=atlas, out=out:
+                                     atlas.build(out)))
+  run_build_jobs(jobs, num_jobs)
+
+
+def atlas_material_json(material_json, rects, temp_directory):
+  """Point a material at the atlases its textures have been packed into.
+
+  Args:
+    material_json: Path to the raw material json file.
+    rects: Texture rects, as returned by atlas_texture_rects().
+    temp_directory: Where to write the rewritten material.
+
+  Returns:
+    The path of the json file to convert. This is material_json itself if none
+    of its textures are in an atlas.
+  """
+  with open(material_json) as f:
+    # flatc accepts trailing commas, which json doesn't.
+    material = json.loads(re.sub(r',(\s*[\]}])', r'\1', f.read()))
+  filenames = material.get('texture_filenames', [])
+  if not any(name in rects for name in filenames):
+    return material_json
+  full_rect = {'u0': 0.0, 'v0': 0.0, 'u1': 1.0, 'v1': 1.0}
+  material['texture_rects'] = [rects[name][1] if name in rects else full_rect
+                               for name in filenames]
+  material['texture_filenames'] = [rects[name][0] if name in rects else name
+                                   for name in filenames]
+  rewritten = os.path.join(temp_directory, os.path.basename(material_json))
+  with open(rewritten, 'w') as f:
+    json.dump(material, f, indent=4, sort_keys=True)
+  return rewritten
 
 
 def needs_rebuild(source, target):
@@ -257,6 +672,158 @@ def needs_rebuild(source, target):
       os.path.getmtime(source) > os.path.getmtime(target))
 
 
+def schema_includes(schema):
+  """Every schema that schema includes, directly or indirectly.
+
+  Args:
+    schema: Path to a flatbuffer schema.
+
+  Returns:
+    A sorted list of the paths of the included schemas, found the same way
+    flatc finds them: next to the including schema, then in SCHEMA_PATHS.
+  """
+  found = set()
+  pending = [schema]
+  while pending:
+    path = pending.pop()
+    try:
+      with open(path) as f:
+        text = f.read()
+    except IOError:
+      continue
+    for name in re.findall(r'^\s*include\s+"([^"]+)"\s*;', text, re.M):
+      included = find_in_paths(name, [os.path.dirname(path)] + SCHEMA_PATHS)
+      if included not in found and os.path.isfile(included):
+        found.add(included)
+        pending.append(included)
+  return sorted(found)
+
+
+class BuildManifest(object):
+  """Records the contents of the files that each built asset was made from.
+
+  An asset is rebuilt when any of those contents change, rather than only when
+  a source is newer than the asset. That catches changes to files an asset
+  only depends on indirectly, such as schemas included by its schema, and
+  changes that make a source older, such as checking out an earlier revision.
+
+  Digests of the sources are cached by size and modification time, so
+  unchanged files aren't read again. Jobs may record their targets from any
+  thread.
+
+  Attributes:
+    path: Where the manifest is saved.
+    files: Map of source path to [mtime, size, digest].
+    targets: Map of target path, relative to the assets directory, to the
+        signature of the sources it was last built from.
+  """
+
+  def __init__(self, target_directory):
+    """Load the manifest from target_directory, if there is one."""
+    self.target_directory = target_directory
+    self.path = os.path.join(target_directory, BUILD_MANIFEST_NAME)
+    self.files = {}
+    self.targets = {}
+    self.lock = threading.Lock()
+    try:
+      with open(self.path) as f:
+        data = json.load(f)
+      if data.get('version') == BUILD_MANIFEST_VERSION:
+        self.files = data['files']
+        self.targets = data['targets']
+    except (IOError, ValueError, KeyError):
+      pass
+
+  def digest(self, path):
+    """SHA-1 of the contents of the file at path."""
+    stat = os.stat(path)
+    cached = self.files.get(path)
+    if cached and cached[0] == stat.st_mtime and cached[1] == stat.st_size:
+      return cached[2]
+    with open(path, 'rb') as f:
+      digest = hashlib.sha1(f.read()).hexdigest()
+    self.files[path] = [stat.st_mtime, stat.st_size, digest]
+    return digest
+
+  def signature(self, sources, settings=''):
+    """Digest of the contents of sources, and of the settings they're built
+    with. Missing sources are signed as such, so that they show up as a change
+    once they exist."""
+    signature = hashlib.sha1(settings.encode('utf-8'))
+    for source in sources:
+      signature.update(source.encode('utf-8'))
+      signature.update((self.digest(source) if os.path.isfile(source)
+                        else 'missing').encode('utf-8'))
+    return signature.hexdigest()
+
+  def key(self, target):
+    return os.path.relpath(target, self.target_directory).replace(os.sep, '/')
+
+  def needs_rebuild(self, targets, signature):
+    """True if any of targets is missing, or was built from other sources."""
+    return any(not os.path.isfile(target) or
+               self.targets.get(self.key(target)) != signature
+               for target in targets)
+
+  def record(self, targets, signature):
+    """Note that targets have been built from sources with signature."""
+    with self.lock:
+      for target in targets:
+        self.targets[self.key(target)] = signature
+
+  def build_job(self, targets, signature, build):
+    """A job that calls build(), then records that targets are up to date."""
+    def job():
+      build()
+      self.record(targets, signature)
+    return job
+
+  def save(self):
+    """Write the manifest back out, replacing the previous one."""
+    temp_path = self.path + '.tmp'
+    with open(temp_path, 'w') as f:
+      json.dump({'version': BUILD_MANIFEST_VERSION, 'files': self.files,
+                 'targets': self.targets}, f, indent=1, sort_keys=True)
+    # Windows won't rename over an existing file.
+    if os.path.exists(self.path):
+      os.remove(self.path)
+    os.rename(temp_path, self.path)
+
+
+def run_build_jobs(jobs, num_jobs):
+  """Run each of jobs, a list of functions, with num_jobs running at once.
+
+  Every job is run even if some fail, so that as much as possible is left
+  built.
+
+  Raises:
+    BuildError: A job failed. The first failure is the one raised.
+  """
+  if num_jobs <= 1 or len(jobs) <= 1:
+    for job in jobs:
+      job()
+    return
+  # The jobs spend their time waiting on tools, so threads are enough.
+  pool = multiprocessing.pool.ThreadPool(min(num_jobs, len(jobs)))
+  errors = []
+  try:
+    for result in [pool.apply_async(job) for job in jobs]:
+      try:
+        result.get()
+      except BuildError as error:
+        errors.append(error)
+  finally:
+    pool.close()
+    pool.join()
+  if errors:
+    raise errors[0]
+
+
+def texture_build_settings():
+  """The settings that change how textures are built, for signing them."""
+  return json.dumps([CWEBP, WEBP_QUALITY, ASTCENC, ASTC_BLOCK_SIZE, ETCTOOL])
+
+
 def processed_json_path(path, target_directory):
   """Take the path to a raw json asset and convert it to target bin path.
 
@@ -267,38 +834,165 @@ def processed_json_path(path, target_directory):
     '.json', '.bin')
 
 
-def generate_flatbuffer_binaries(flatc, target_directory):
+def generate_flatbuffer_binaries(flatc, target_directory, atlases, manifest,
+                                 num_jobs):
   """Run the flatbuffer compiler on the all of the flatbuffer json files.
 
   Args:
     flatc: Path to the flatc binary.
     target_directory: Path to the target assets directory.
+    atlases: List of TextureAtlas objects, to which materials are redirected.
+    manifest: BuildManifest recording what the binaries were built from.
+    num_jobs: How many files to convert at once.
   """
-  for element in FLATBUFFERS_CONVERSION_DATA:
-    schema = element.schema
-    for json in element.input_files:
-      target = processed_json_path(json, target_directory)
-      target_file_dir = os.path.dirname(target)
-      if not os.path.exists(target_file_dir):
-        os.makedirs(target_file_dir)
-      if needs_rebuild(json, target) or needs_rebuild(schema, target):
-        convert_json_to_flatbuffer_binary(flatc, json, schema, target_file_dir)
-
-
-def generate_webp_textures(target_directory):
+  rects = atlas_texture_rects(atlases)
+  temp_directory = tempfile.mkdtemp()
+  try:
+    jobs = []
+    for element in FLATBUFFERS_CONVERSION_DATA:
+      schema = element.schema
+      schemas = [schema] + schema_includes(schema)
+      is_material = os.path.basename(schema) == 'materials.fbs'
+      # Materials also depend on where their textures landed in the atlases.
+      settings = json.dumps([flatc, rects if is_material else None],
+                            sort_keys=True)
+      for json_file in element.input_files:
+        target = processed_json_path(json_file, target_directory)
+        target_file_dir = os.path.dirname(target)
+        if not os.path.exists(target_file_dir):
+          os.makedirs(target_file_dir)
+        signature = manifest.signature([json_file] + schemas, settings)
+        if not manifest.needs_rebuild([target], signature):
+          continue
+        def build(json_file=json_file, schema=schema,
+                  is_material=is_material, target_file_dir=target_file_dir):
+          source = json_file
+          if is_material:
+            source = atlas_material_json(json_file, rects, temp_directory)
+          convert_json_to_flatbuffer_binary(flatc, source, schema,
+                                            target_file_dir)
+        jobs.append(manifest.build_job([target], signature, build))
+    run_build_jobs(jobs, num_jobs)
+  finally:
+    shutil.rmtree(temp_directory)
+
+
+def generate_webp_textures(target_directory, manifest, num_jobs):
   """Run the webp converter on off of the png files.
 
   Args:
     target_directory: Path to the target assets directory.
+    manifest: BuildManifest recording what the textures were built from.
+    num_jobs: How many textures to convert at once.
   """
   input_files = PNG_TEXTURES
+  settings = texture_build_settings()
+  jobs = []
   for png in input_files:
     out = processed_texture_path(png, target_directory)
     out_dir = os.path.dirname(out)
     if not os.path.exists(out_dir):
       os.makedirs(out_dir)
-    if needs_rebuild(png, out):
+    targets = [out] + compressed_texture_paths(out)
+    signature = manifest.signature([png], settings)
+    if not manifest.needs_rebuild(targets, signature):
+      continue
+    def build(png=png, out=out):
       convert_png_image_to_webp(png, out, WEBP_QUALITY)
+      convert_png_image_to_ktx(png, out)
+    jobs.append(manifest.build_job(targets, signature, build))
+  run_build_jobs(jobs, num_jobs)
+
+
+def load_baked_text_definition(path):
+  """Reads a baked text definition, and finds the strings it bakes.
+
+  Args:
+    path: Path to the definition, one of BAKED_TEXT_DEFINITIONS.
+
+  Returns:
+    The definition as a dictionary, with the strings it lists and those found
+    in its sources together in 'strings', in order and without duplicates, and
+    the full paths of its source files in 'source_files'.
+
+  Raises:
+    BuildError: The definition or one of its sources can't be read.
+  """
+  try:
+    with open(path) as f:
+      definition = json.load(f)
+  except (IOError, ValueError) as error:
+    raise BuildError([path], 1, message=str(error))
+  strings = list(definition.get('strings', []))
+  source_files = []
+  for source in definition.get('sources', []):
+    source_file = os.path.join(PROJECT_ROOT, source['file'])
+    try:
+      with open(source_file) as f:
+        text = f.read()
+    except IOError as error:
+      raise BuildError([path], 1, message=str(error))
+    calls = '|'.join(re.escape(call) for call in source['calls'])
+    for literal in re.findall(r'\b(?:%s)\(\s*"((?:[^"\\]|\\.)*)"' % calls,
+                              text):
+      # Only quotes and backslashes are expected to be escaped in UI text.
+      strings.append(re.sub(r'\\(.)', r'\1', literal))
+    source_files.append(source_file)
+  unique = []
+  for string in strings:
+    if string not in unique:
+      unique.append(string)
+  definition['strings'] = unique
+  definition['source_files'] = source_files
+  return definition
+
+
+def generate_baked_text(font_baker, target_directory, manifest, num_jobs):
+  """Run the text baking tool on each of the baked text definitions.
+
+  Baking is skipped if the tool hasn't been built, as when only flatc is, since
+  the game shapes any text that isn't baked at runtime instead.
+
+  Args:
+    font_baker: Path to the pie_noon_font_baker binary.
+    target_directory: Path to the target assets directory.
+    manifest: BuildManifest recording what the baked text was built from.
+    num_jobs: How many definitions to bake at once.
+
+  Raises:
+    BuildError: A definition can't be read, or baking it failed.
+  """
+  if not BAKED_TEXT_DEFINITIONS:
+    return
+  if not (os.path.isfile(font_baker) or
+          distutils.spawn.find_executable(font_baker)):
+    print('%s not found, so UI text will be shaped at runtime.' % font_baker)
+    return
+  jobs = []
+  for path in BAKED_TEXT_DEFINITIONS:
+    definition = load_baked_text_definition(path)
+    font = os.path.join(ASSETS_PATH, definition['font'])
+    target = os.path.join(target_directory, definition['output'])
+    target_dir = os.path.dirname(target)
+    if not os.path.exists(target_dir):
+      os.makedirs(target_dir)
+    command = [font_baker]
+    if definition.get('sdf'):
+      command.append('--sdf')
+    command.extend([font, target])
+    for string in definition['strings']:
+      command.extend([str(definition.get('size', 32)), string])
+    # The tool's own binary is a source too, since it does the rasterizing.
+    signature = manifest.signature(
+        [path, font, font_baker] + definition['source_files'],
+        json.dumps(command[1:]))
+    if not manifest.needs_rebuild([target], signature):
+      continue
+    def build(command=command):
+      run_subprocess(command)
+    jobs.append(manifest.build_job([target], signature, build))
+  run_build_jobs(jobs, num_jobs)
+
 
 def copy_assets(target_directory):
   """Copy modified assets to the target assets directory.
@@ -326,6 +1020,175 @@ def copy_assets(target_directory):
              os.path.getmtime(source_filename))):
           shutil.copy2(source_filename, target_filename)
 
+def archive_name_hash(name):
+  """64-bit FNV-1a hash of an archive entry name. Matches HashAssetName()."""
+  value = 0xcbf29ce484222325
+  for byte in bytearray(name.encode('utf-8')):
+    value = ((value ^ byte) * 0x100000001b3) & 0xffffffffffffffff
+  return value
+
+
+def lz4_compress(data):
+  """Compress data into a single LZ4 block (no frame header).
+
+  A simple greedy compressor. It doesn't compress as well as the reference
+  implementation, but any LZ4 decoder can read its output.
+
+  Args:
+    data: bytearray to compress.
+
+  Returns:
+    The compressed block, as a bytearray.
+  """
+  min_match = 4
+  # The format requires the last 5 bytes to be literals, and the last match
+  # to start at least 12 bytes before the end.
+  match_limit = len(data) - 12
+  literal_limit = len(data) - 5
+  out = bytearray()
+  table = {}
+  anchor = 0
+  pos = 0
+
+  def write_length(length):
+    while length >= 255:
+      out.append(255)
+      length -= 255
+    out.append(length)
+
+  while pos < match_limit:
+    key = bytes(data[pos:pos + min_match])
+    candidate = table.get(key)
+    table[key] = pos
+    if candidate is None or pos - candidate > 0xffff:
+      pos += 1
+      continue
+    match_length = min_match
+    while (pos + match_length < literal_limit and
+           data[candidate + match_length] == data[pos + match_length]):
+      match_length += 1
+    literal_length = pos - anchor
+    token_literal = min(literal_length, 15)
+    token_match = min(match_length - min_match, 15)
+    out.append((token_literal << 4) | token_match)
+    if literal_length >= 15:
+      write_length(literal_length - 15)
+    out.extend(data[anchor:pos])
+    offset = pos - candidate
+    out.append(offset & 0xff)
+    out.append(offset >> 8)
+    if match_length - min_match >= 15:
+      write_length(match_length - min_match - 15)
+    pos += match_length
+    anchor = pos
+
+  literal_length = len(data) - anchor
+  out.append(min(literal_length, 15) << 4)
+  if literal_length >= 15:
+    write_length(literal_length - 15)
+  out.extend(data[anchor:])
+  return out
+
+
+def align(offset, alignment):
+  """Round offset up to a multiple of alignment."""
+  return (offset + alignment - 1) // alignment * alignment
+
+
+def write_asset_archive(target_directory):
+  """Pack the built assets into a single archive in target_directory.
+
+  The archive is a header, then a table of contents sorted by name hash, then
+  the entry names, then the entries, each aligned to ARCHIVE_ALIGNMENT bytes.
+  Entries are LZ4 compressed when that saves at least an eighth of their size.
+  See src/asset_archive.h for the exact layout.
+
+  Args:
+    target_directory: Path to the target assets directory.
+  """
+  archive_path = os.path.join(target_directory, ARCHIVE_NAME)
+  files = []
+  for dirpath, _, names in os.walk(target_directory):
+    for name in names:
+      path = os.path.join(dirpath, name)
+      if os.path.splitext(name)[1] not in ARCHIVE_EXTENSIONS:
+        continue
+      relative = os.path.relpath(path, target_directory).replace(os.sep, '/')
+      if relative.startswith('sounds/'):
+        continue
+      files.append((archive_name_hash(relative), relative, path))
+  files.sort()
+
+  if (os.path.isfile(archive_path) and not
+      any(needs_rebuild(path, archive_path) for _, _, path in files)):
+    return
+
+  header_format = '<4sIII'
+  entry_format = '<QIIQQQI4x'
+  toc_size = struct.calcsize(entry_format) * len(files)
+  names = bytearray()
+  for _, relative, _ in files:
+    names.extend(relative.encode('utf-8'))
+  offset = align(struct.calcsize(header_format) + toc_size + len(names),
+                 ARCHIVE_ALIGNMENT)
+
+  toc = bytearray()
+  blobs = []
+  name_offset = 0
+  for name_hash, relative, path in files:
+    with open(path, 'rb') as f:
+      data = bytearray(f.read())
+    stored = data
+    flags = 0
+    if os.path.splitext(relative)[1] in ARCHIVE_COMPRESSED_EXTENSIONS:
+      compressed = lz4_compress(data)
+      if len(compressed) <= len(data) - len(data) // 8:
+        stored = compressed
+        flags |= ARCHIVE_FLAG_LZ4
+    name_length = len(relative.encode('utf-8'))
+    toc.extend(struct.pack(entry_format, name_hash, name_offset, name_length,
+                           offset, len(data), len(stored), flags))
+    name_offset += name_length
+    blobs.append((offset, stored))
+    offset = align(offset + len(stored), ARCHIVE_ALIGNMENT)
+
+  temp_path = archive_path + '.tmp'
+  with open(temp_path, 'wb') as f:
+    f.write(struct.pack(header_format, ARCHIVE_MAGIC, ARCHIVE_VERSION,
+                        len(files), struct.calcsize(header_format)))
+    f.write(toc)
+    f.write(names)
+    for blob_offset, stored in blobs:
+      f.write(b'\0' * (blob_offset - f.tell()))
+      f.write(stored)
+  # Windows won't rename over an existing file.
+  if os.path.exists(archive_path):
+    os.remove(archive_path)
+  os.rename(temp_path, archive_path)
+
+
+def clean_asset_archive(target_directory):
+  """Delete the packed asset archive.
+
+  Args:
+    target_directory: Path to the target assets directory.
+  """
+  path = os.path.join(target_directory, ARCHIVE_NAME)
+  if os.path.isfile(path):
+    os.remove(path)
+
+
+def clean_build_manifest(target_directory):
+  """Delete the record of what the built assets were built from.
+
+  Args:
+    target_directory: Path to the target assets directory.
+  """
+  path = os.path.join(target_directory, BUILD_MANIFEST_NAME)
+  if os.path.isfile(path):
+    os.remove(path)
+
+
 def clean_webp_textures():
   """Delete all the processed webp textures."""
   for webp in PNG_TEXTURES['output_files']:
@@ -346,6 +1209,23 @@ def clean_flatbuffer_binaries(target_directory):
         os.remove(path)
 
 
+def clean_baked_text(target_directory):
+  """Delete all the baked text.
+
+  Args:
+    target_directory: Path to the target assets directory.
+  """
+  for path in BAKED_TEXT_DEFINITIONS:
+    try:
+      with open(path) as f:
+        output = json.load(f)['output']
+    except (IOError, ValueError, KeyError):
+      continue
+    baked = os.path.join(target_directory, output)
+    if os.path.isfile(baked):
+      os.remove(baked)
+
+
 def clean():
   """Delete all the processed files."""
   clean_flatbuffer_binaries()
@@ -364,8 +1244,10 @@ def main(argv):
   To build all assets, either call this script without any arguments. Or
   alternatively, call it with the argument 'all'. To just convert the
   flatbuffer json files, call it with 'flatbuffers'. Likewise to convert the
-  png files to webp files, call it with 'webp'. To clean all converted files,
-  call it with 'clean'.
+  png files to webp files, call it with 'webp'. To bake the UI text, call it
+  with 'text'. To pack the built assets into a single archive, call it with
+  'pack'. To clean all converted files, call it
+  with 'clean'.
 
   Args:
     argv: The command line argument containing which command to run.
@@ -378,28 +1260,58 @@ def main(argv):
                       help='Location of the flatbuffers compiler.')
   parser.add_argument('--output', default=ASSETS_PATH,
                       help='Assets output directory.')
+  parser.add_argument('--font-baker', default=FONT_BAKER,
+                      help='Location of the text baking tool.')
+  parser.add_argument('-j', '--jobs', type=int,
+                      default=multiprocessing.cpu_count(),
+                      help='How many conversions to run at once.')
   parser.add_argument('args', nargs=argparse.REMAINDER)
   args = parser.parse_args()
   target = args.args[1] if len(args.args) >= 2 else 'all'
-  if target not in ('all', 'flatbuffers', 'webp', 'clean'):
+  if target not in ('all', 'flatbuffers', 'webp', 'text', 'pack', 'clean'):
     sys.stderr.write('No rule to build target %s.\n' % target)
 
   if target != 'clean':
     copy_assets(args.output)
+    manifest = BuildManifest(args.output)
+    try:
+      atlases = load_texture_atlases()
+    except BuildError as error:
+      handle_build_error(error)
+      return 1
   if target in ('all', 'flatbuffers'):
     try:
-      generate_flatbuffer_binaries(args.flatc, args.output)
+      generate_flatbuffer_binaries(args.flatc, args.output, atlases, manifest,
+                                   args.jobs)
     except BuildError as error:
       handle_build_error(error)
       return 1
+    finally:
+      manifest.save()
   if target in ('all', 'webp'):
     try:
-      generate_webp_textures(args.output)
+      generate_webp_textures(args.output, manifest, args.jobs)
+      generate_texture_atlases(atlases, args.output, manifest, args.jobs)
+    except BuildError as error:
+      handle_build_error(error)
+      return 1
+    finally:
+      manifest.save()
+  if target in ('all', 'text'):
+    try:
+      generate_baked_text(args.font_baker, args.output, manifest, args.jobs)
     except BuildError as error:
       handle_build_error(error)
       return 1
+    finally:
+      manifest.save()
+  if target in ('all', 'pack'):
+    write_asset_archive(args.output)
   if target == 'clean':
     try:
+      clean_build_manifest(args.output)
+      clean_asset_archive(args.output)
+      clean_baked_text(args.output)
       clean()
     except OSError as error:
       sys.stderr.write('Error cleaning: %s' % str(error))
@@ -0,0 +1,227 @@
+#!/usr/bin/python
+# Copyright 2015 Google Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Checks performance results against the stored baseline for the device.
+
+Two sets of results can be checked, on their own or together:
+
+  --sim runs the headless simulation, pie_noon_sim, and checks its frame time,
+  startup time and peak memory against the baseline for this machine.
+
+  --game checks scenario_benchmark.json, as written by the game when
+  config.scenario_benchmark_frames is set, against the baseline for the GPU it
+  ran on. Copy it from the app's preferences directory first, e.g. with
+  adb pull on Android.
+
+Baselines are kept per device in benchmarks/baselines.json. A result fails if
+it's worse than the baseline by more than the threshold, and the script exits
+with 1 if any result fails. With --update, the results become the device's new
+baseline instead.
+"""
+
+import argparse
+import json
+import os
+import platform
+import subprocess
+import sys
+import tempfile
+
+# The project root directory, which is one level up from this script's
+# directory.
+PROJECT_ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__),
+                                            os.path.pardir))
+
+DEFAULT_BASELINES = os.path.join(PROJECT_ROOT, 'benchmarks', 'baselines.json')
+
+# The matches the simulation plays. Enough for a stable p95, and few enough to
+# run on every change.
+DEFAULT_SIM_MATCHES = 200
+
+# The results compared, as a path into each results file and the threshold
+# that applies to it. Every one of them is worse when larger.
+SIM_METRICS = [
+    (('frame_us', 'p95'), 'frame_time'),
+    (('startup_ms',), 'startup'),
+    (('peak_memory_kb',), 'memory'),
+]
+GAME_METRICS = [
+    (('frame_us', 'p95'), 'frame_time'),
+    (('update_us', 'p95'), 'frame_time'),
+    (('render_us', 'p95'), 'frame_time'),
+    (('startup_ms',), 'startup'),
+    (('peak_memory_kb',), 'memory'),
+]
+
+
+class CheckError(Exception):
+  """Raised when the results can't be produced or read."""
+  pass
+
+
+def run_sim(sim, matches, threads):
+  """Runs the simulation and returns its results.
+
+  Args:
+    sim: Path to the pie_noon_sim binary.
+    matches: Number of matches to play.
+    threads: Number of threads to play them on.
+
+  Returns:
+    The results pie_noon_sim wrote, as a dictionary.
+
+  Raises:
+    CheckError: if the simulation fails.
+  """
+  handle, filename = tempfile.mkstemp(suffix='.json')
+  os.close(handle)
+  try:
+    command = [sim, '--json', filename, str(matches), str(threads)]
+    if subprocess.call(command) != 0:
+      raise CheckError('%s failed.' % ' '.join(command))
+    return read_results(filename)
+  finally:
+    os.remove(filename)
+
+
+def read_results(filename):
+  """Returns the JSON in 'filename' as a dictionary.
+
+  Raises:
+    CheckError: if it can't be read.
+  """
+  try:
+    with open(filename) as results_file:
+      return json.load(results_file)
+  except (IOError, ValueError) as error:
+    raise CheckError('Couldn\'t read %s: %s' % (filename, error))
+
+
+def lookup(results, path):
+  """Returns the value at 'path' in 'results', or None if it's missing."""
+  for key in path:
+    if not isinstance(results, dict) or key not in results:
+      return None
+    results = results[key]
+  return results
+
+
+def compare(name, results, baseline, metrics, thresholds):
+  """Compares 'results' with 'baseline', printing a line per metric.
+
+  Args:
+    name: What the results are of, to prefix each line with.
+    results: The results just measured.
+    baseline: The device's baseline, or None if it has none yet.
+    metrics: Which results to compare, from SIM_METRICS or GAME_METRICS.
+    thresholds: Map of metric kind to the fraction it may regress by.
+
+  Returns:
+    True if nothing regressed by more than its threshold.
+  """
+  passed = True
+  for path, kind in metrics:
+    label = '%s %s' % (name, '.'.join(path))
+    value = lookup(results, path)
+    expected = lookup(baseline, path) if baseline else None
+    if value is None:
+      print('%s: missing from the results' % label)
+      continue
+    if not expected:
+      print('%s: %s, with no baseline' % (label, value))
+      continue
+    change = float(value - expected) / expected
+    failed = change > thresholds[kind]
+    print('%s: %s against %s, %+.1f%%%s' % (
+        label, value, expected, change * 100,
+        ', REGRESSED' if failed else ''))
+    passed = passed and not failed
+  return passed
+
+
+def main(argv):
+  parser = argparse.ArgumentParser(
+      description='Check performance results against the device\'s baseline.')
+  parser.add_argument('--sim', help='Path to pie_noon_sim, to run and check.')
+  parser.add_argument('--sim-matches', type=int, default=DEFAULT_SIM_MATCHES,
+                      help='Matches for the simulation to play.')
+  parser.add_argument('--sim-threads', type=int, default=1,
+                      help='Threads for the simulation to play them on.')
+  parser.add_argument('--sim-device', default=platform.node(),
+                      help='Baseline to check the simulation against. '
+                      'Defaults to this machine\'s name.')
+  parser.add_argument('--game',
+                      help='scenario_benchmark.json written by the game.')
+  parser.add_argument('--baselines', default=DEFAULT_BASELINES,
+                      help='Baselines file, by device.')
+  parser.add_argument('--frame-time-threshold', type=float, default=0.1,
+                      help='Fraction by which p95 frame times may regress.')
+  parser.add_argument('--startup-threshold', type=float, default=0.15,
+                      help='Fraction by which startup time may regress.')
+  parser.add_argument('--memory-threshold', type=float, default=0.05,
+                      help='Fraction by which peak memory may regress.')
+  parser.add_argument('--update', action='store_true',
+                      help='Store the results as the new baselines.')
+  args = parser.parse_args(argv[1:])
+  if not args.sim and not args.game:
+    parser.error('Nothing to check: pass --sim, --game, or both.')
+
+  thresholds = {
+      'frame_time': args.frame_time_threshold,
+      'startup': args.startup_threshold,
+      'memory': args.memory_threshold,
+  }
+  baselines = {}
+  if os.path.exists(args.baselines):
+    try:
+      baselines = read_results(args.baselines)
+    except CheckError as error:
+      sys.stderr.write('%s\n' % error)
+      return 1
+
+  # Tuples of (device, kind of results, results, metrics).
+  checks = []
+  try:
+    if args.sim:
+      checks.append((args.sim_device, 'sim',
+                     run_sim(args.sim, args.sim_matches, args.sim_threads),
+                     SIM_METRICS))
+    if args.game:
+      results = read_results(args.game)
+      checks.append((results.get('device', 'unknown'), 'game', results,
+                     GAME_METRICS))
+  except CheckError as error:
+    sys.stderr.write('%s\n' % error)
+    return 1
+
+  passed = True
+  for device, kind, results, metrics in checks:
+    baseline = baselines.get(device, {}).get(kind)
+    passed = compare('%s %s' % (device, kind), results, baseline, metrics,
+                     thresholds) and passed
+    if args.update:
+      baselines.setdefault(device, {})[kind] = results
+
+  if args.update:
+    with open(args.baselines, 'w') as baselines_file:
+      json.dump(baselines, baselines_file, indent=2, sort_keys=True)
+      baselines_file.write('\n')
+    print('Updated %s' % args.baselines)
+    return 0
+  return 0 if passed else 1
+
+
+if __name__ == '__main__':
+  sys.exit(main(sys.argv))
@@ -83,14 +83,12 @@ void AiController::AdvanceFrame(WorldTime delta_time) {
   }
 }
 
-// Utility function for checking if someone is in danger.
+// Utility function for checking if someone is in danger. GameState counts the
+// pies aimed at each character once per frame, for all of the AIs.
 bool AiController::IsInDanger(CharacterId id) const {
-  for (size_t i = 0; i < gamestate_->pies().size(); i++) {
-    if (gamestate_->pies()[i]->target() == id) {
-      return true;
-    }
-  }
-  return false;
+  const AiBlackboard& blackboard = gamestate_->ai_blackboard();
+  return static_cast<size_t>(id) < blackboard.incoming_pies.size() &&
+         blackboard.incoming_pies[id] > 0;
 }
 
 }  // pie_noon
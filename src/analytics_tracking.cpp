@@ -14,26 +14,155 @@
 
 #include "precompiled.h"
 #include "analytics_tracking.h"
+#include "worker_pool.h"
 
 namespace fpl {
 
+#ifdef __ANDROID__
+// A tracker event waiting to be sent to Java.
+struct TrackerEvent {
+  // Which of the Java SendTrackerEvent overloads it's for.
+  enum Kind { kAction, kLabel, kValue };
+
+  Kind kind;
+  std::string category;
+  std::string action;
+  std::string label;
+  int value;
+};
+
+// Sends tracker events to Java in jobs on the worker pool, so the JNI calls
+// never hold up a frame, whichever thread the events come from. Only one job
+// sends at a time, and everything queued while it's busy goes in its next
+// batch.
+class TrackerEventQueue {
+ public:
+  TrackerEventQueue()
+      : mutex_(SDL_CreateMutex()),
+        pool_(nullptr),
+        sending_(false),
+        methods_found_(false) {
+    assert(mutex_);
+  }
+
+  void SetWorkerPool(WorkerPool *pool) {
+    SDL_LockMutex(mutex_);
+    pool_ = pool;
+    const bool send = StartSending();
+    SDL_UnlockMutex(mutex_);
+    if (send) pool->Submit([this]() { SendEvents(); });
+  }
+
+  void Push(TrackerEvent::Kind kind, const char *category, const char *action,
+            const char *label, int value) {
+    SDL_LockMutex(mutex_);
+    queued_.push_back(TrackerEvent());
+    TrackerEvent &event = queued_.back();
+    event.kind = kind;
+    event.category = category;
+    event.action = action;
+    event.label = label ? label : "";
+    event.value = value;
+    WorkerPool *pool = StartSending() ? pool_ : nullptr;
+    SDL_UnlockMutex(mutex_);
+    if (pool) pool->Submit([this]() { SendEvents(); });
+  }
+
+ private:
+  // True if a job should be submitted to send queued_, in which case it's
+  // counted as sending already. Called with mutex_ locked.
+  bool StartSending() {
+    if (!pool_ || sending_ || queued_.empty()) return false;
+    sending_ = true;
+    return true;
+  }
+
+  // Sends batches of events until there are none left. Only one job runs
+  // this at a time, so the methods are looked up without locking.
+  void SendEvents() {
+    JNIEnv *env = reinterpret_cast<JNIEnv *>(SDL_AndroidGetJNIEnv());
+    jobject activity = reinterpret_cast<jobject>(SDL_AndroidGetActivity());
+    if (!methods_found_) {
+      jclass fpl_class = env->GetObjectClass(activity);
+      methods_[TrackerEvent::kAction] = env->GetMethodID(
+          fpl_class, "SendTrackerEvent",
+          "(Ljava/lang/String;Ljava/lang/String;)V");
+      methods_[TrackerEvent::kLabel] = env->GetMethodID(
+          fpl_class, "SendTrackerEvent",
+          "(Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;)V");
+      methods_[TrackerEvent::kValue] = env->GetMethodID(
+          fpl_class, "SendTrackerEvent",
+          "(Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;I)V");
+      env->DeleteLocalRef(fpl_class);
+      methods_found_ = true;
+    }
+
+    std::vector<TrackerEvent> sending;
+    for (;;) {
+      SDL_LockMutex(mutex_);
+      sending.swap(queued_);
+      if (sending.empty()) sending_ = false;
+      SDL_UnlockMutex(mutex_);
+      if (sending.empty()) break;
+
+      for (auto it = sending.begin(); it != sending.end(); ++it) {
+        jstring category_string = env->NewStringUTF(it->category.c_str());
+        jstring action_string = env->NewStringUTF(it->action.c_str());
+        if (it->kind == TrackerEvent::kAction) {
+          env->CallVoidMethod(activity, methods_[it->kind], category_string,
+                              action_string);
+        } else {
+          jstring label_string = env->NewStringUTF(it->label.c_str());
+          if (it->kind == TrackerEvent::kLabel) {
+            env->CallVoidMethod(activity, methods_[it->kind],
+                                category_string, action_string, label_string);
+          } else {
+            env->CallVoidMethod(activity, methods_[it->kind],
+                                category_string, action_string, label_string,
+                                it->value);
+          }
+          env->DeleteLocalRef(label_string);
+        }
+        env->DeleteLocalRef(action_string);
+        env->DeleteLocalRef(category_string);
+      }
+      sending.clear();
+    }
+    // Workers never return to Java, which would free this for us.
+    env->DeleteLocalRef(activity);
+  }
+
+  // This lock protects pool_, sending_ and queued_.
+  SDL_mutex *mutex_;
+  WorkerPool *pool_;
+  bool sending_;
+  std::vector<TrackerEvent> queued_;
+
+  // The Java SendTrackerEvent overloads, by TrackerEvent::Kind.
+  bool methods_found_;
+  jmethodID methods_[3];
+};
+
+static TrackerEventQueue &GetTrackerEventQueue() {
+  static TrackerEventQueue queue;
+  return queue;
+}
+#endif  // __ANDROID__
+
+void SetTrackerWorkerPool(WorkerPool *pool) {
+#ifdef __ANDROID__
+  GetTrackerEventQueue().SetWorkerPool(pool);
+#else
+  (void)pool;
+#endif
+}
+
 void SendTrackerEvent(const char *category, const char *action) {
 #ifdef __ANDROID__
   SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "SendTrackerEvent (%s, %s)\n",
               category, action);
-  JNIEnv *env = reinterpret_cast<JNIEnv *>(SDL_AndroidGetJNIEnv());
-  jobject activity = reinterpret_cast<jobject>(SDL_AndroidGetActivity());
-  jclass fpl_class = env->GetObjectClass(activity);
-  jmethodID send_tracker_event = env->GetMethodID(
-      fpl_class, "SendTrackerEvent", "(Ljava/lang/String;Ljava/lang/String;)V");
-  jstring category_string = env->NewStringUTF(category);
-  jstring action_string = env->NewStringUTF(action);
-  env->CallVoidMethod(activity, send_tracker_event, category_string,
-                      action_string);
-  env->DeleteLocalRef(action_string);
-  env->DeleteLocalRef(category_string);
-  env->DeleteLocalRef(fpl_class);
-  env->DeleteLocalRef(activity);
+  GetTrackerEventQueue().Push(TrackerEvent::kAction, category, action,
+                              nullptr, 0);
 #else
   (void)category;
   (void)action;
@@ -45,22 +174,8 @@ void SendTrackerEvent(const char *category, const char *action,
 #ifdef __ANDROID__
   SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "SendTrackerEvent (%s, %s, %s)\n",
               category, action, label);
-  JNIEnv *env = reinterpret_cast<JNIEnv *>(SDL_AndroidGetJNIEnv());
-  jobject activity = reinterpret_cast<jobject>(SDL_AndroidGetActivity());
-  jclass fpl_class = env->GetObjectClass(activity);
-  jmethodID send_tracker_event = env->GetMethodID(
-      fpl_class, "SendTrackerEvent",
-      "(Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;)V");
-  jstring category_string = env->NewStringUTF(category);
-  jstring action_string = env->NewStringUTF(action);
-  jstring label_string = env->NewStringUTF(label);
-  env->CallVoidMethod(activity, send_tracker_event, category_string,
-                      action_string, label_string);
-  env->DeleteLocalRef(label_string);
-  env->DeleteLocalRef(action_string);
-  env->DeleteLocalRef(category_string);
-  env->DeleteLocalRef(fpl_class);
-  env->DeleteLocalRef(activity);
+  GetTrackerEventQueue().Push(TrackerEvent::kLabel, category, action, label,
+                              0);
 #else
   (void)category;
   (void)action;
@@ -74,22 +189,8 @@ void SendTrackerEvent(const char *category, const char *action,
   SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
               "SendTrackerEvent (%s, %s, %s, %i)\n", category, action, label,
               value);
-  JNIEnv *env = reinterpret_cast<JNIEnv *>(SDL_AndroidGetJNIEnv());
-  jobject activity = reinterpret_cast<jobject>(SDL_AndroidGetActivity());
-  jclass fpl_class = env->GetObjectClass(activity);
-  jmethodID send_tracker_event = env->GetMethodID(
-      fpl_class, "SendTrackerEvent",
-      "(Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;I)V");
-  jstring category_string = env->NewStringUTF(category);
-  jstring action_string = env->NewStringUTF(action);
-  jstring label_string = env->NewStringUTF(label);
-  env->CallVoidMethod(activity, send_tracker_event, category_string,
-                      action_string, label_string, value);
-  env->DeleteLocalRef(label_string);
-  env->DeleteLocalRef(action_string);
-  env->DeleteLocalRef(category_string);
-  env->DeleteLocalRef(fpl_class);
-  env->DeleteLocalRef(activity);
+  GetTrackerEventQueue().Push(TrackerEvent::kValue, category, action, label,
+                              value);
 #else
   (void)category;
   (void)action;
@@ -17,6 +17,15 @@
 
 namespace fpl {
 
+class WorkerPool;
+
+// Sends the events queued by the functions below in jobs on 'pool'. Until
+// this is called, events wait in the queue. Set it back to nullptr before
+// 'pool' is destroyed.
+void SetTrackerWorkerPool(WorkerPool *pool);
+
+// These queue the event and return straight away: it's sent to the tracker
+// in a job on the worker pool. Call them from any thread.
 void SendTrackerEvent(const char *category, const char *action);
 
 void SendTrackerEvent(const char *category, const char *action,
@@ -0,0 +1,169 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "precompiled.h"
+#include "asset_archive.h"
+#include "utilities.h"
+
+namespace fpl {
+
+static const AssetArchive* g_asset_archive = nullptr;
+
+void SetAssetArchive(const AssetArchive* archive) { g_asset_archive = archive; }
+
+const AssetArchive* GetAssetArchive() { return g_asset_archive; }
+
+uint64_t HashAssetName(const char* name) {
+  return HashBytes(name, strlen(name));
+}
+
+bool DecompressLZ4(const uint8_t* src, size_t src_size, uint8_t* dest,
+                   size_t dest_size) {
+  const uint8_t* src_end = src + src_size;
+  uint8_t* out = dest;
+  uint8_t* out_end = dest + dest_size;
+
+  // Lengths of 15 continue in the following bytes, in 255 increments.
+  auto read_length = [&src, src_end](size_t length, bool* ok) -> size_t {
+    if (length != 15) return length;
+    for (;;) {
+      if (src == src_end) {
+        *ok = false;
+        return length;
+      }
+      const uint8_t byte = *src++;
+      length += byte;
+      if (byte != 255) return length;
+    }
+  };
+
+  for (;;) {
+    if (src == src_end) return false;
+    const uint8_t token = *src++;
+    bool ok = true;
+
+    const size_t literal_length = read_length(token >> 4, &ok);
+    if (!ok || literal_length > static_cast<size_t>(src_end - src) ||
+        literal_length > static_cast<size_t>(out_end - out)) {
+      return false;
+    }
+    memcpy(out, src, literal_length);
+    src += literal_length;
+    out += literal_length;
+
+    // The last sequence has no match.
+    if (src == src_end) return out == out_end;
+
+    if (src_end - src < 2) return false;
+    const size_t offset = src[0] | (src[1] << 8);
+    src += 2;
+    const size_t match_length = read_length(token & 15, &ok) + 4;
+    if (!ok || offset == 0 || offset > static_cast<size_t>(out - dest) ||
+        match_length > static_cast<size_t>(out_end - out)) {
+      return false;
+    }
+    // Matches may overlap the bytes they produce, so copy one at a time.
+    const uint8_t* match = out - offset;
+    for (size_t i = 0; i < match_length; ++i) {
+      out[i] = match[i];
+    }
+    out += match_length;
+  }
+}
+
+bool AssetArchive::Open(const char* filename) {
+  names_ = nullptr;
+  if (!file_.Open(filename)) return false;
+  if (file_.size() < sizeof(header_)) return false;
+  memcpy(&header_, bytes(), sizeof(header_));
+  const size_t toc_end = static_cast<size_t>(header_.toc_offset) +
+                         sizeof(Entry) * header_.entry_count;
+  if (memcmp(header_.magic, "FPAK", sizeof(header_.magic)) != 0 ||
+      header_.version != kVersion || toc_end > file_.size()) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR, "%s isn't a valid asset archive\n",
+                 filename);
+    file_.Close();
+    return false;
+  }
+  names_ = reinterpret_cast<const char*>(bytes() + toc_end);
+  return true;
+}
+
+bool AssetArchive::FindEntry(const char* name, Entry* entry) const {
+  if (!file_.data()) return false;
+  const uint64_t hash = HashAssetName(name);
+  const size_t name_length = strlen(name);
+  const uint8_t* toc = bytes() + header_.toc_offset;
+
+  // Binary search for the first entry with this hash. The table isn't
+  // necessarily aligned, so copy entries out rather than casting.
+  size_t lo = 0;
+  size_t hi = header_.entry_count;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    memcpy(entry, toc + mid * sizeof(Entry), sizeof(Entry));
+    if (entry->name_hash < hash) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  // Then check the names of every entry with that hash.
+  for (size_t i = lo; i < header_.entry_count; ++i) {
+    memcpy(entry, toc + i * sizeof(Entry), sizeof(Entry));
+    if (entry->name_hash != hash) break;
+    if (entry->name_length == name_length &&
+        names_ + entry->name_offset + name_length <=
+            reinterpret_cast<const char*>(bytes() + file_.size()) &&
+        memcmp(names_ + entry->name_offset, name, name_length) == 0) {
+      return entry->offset + entry->stored_size <= file_.size();
+    }
+  }
+  return false;
+}
+
+bool AssetArchive::Contains(const char* name) const {
+  Entry entry;
+  return FindEntry(name, &entry);
+}
+
+const void* AssetArchive::FindUncompressed(const char* name,
+                                           size_t* size) const {
+  Entry entry;
+  if (!FindEntry(name, &entry) || (entry.flags & kFlagLZ4)) return nullptr;
+  *size = static_cast<size_t>(entry.size);
+  return bytes() + entry.offset;
+}
+
+bool AssetArchive::Read(const char* name, std::string* dest) const {
+  Entry entry;
+  if (!FindEntry(name, &entry)) return false;
+  const size_t size = static_cast<size_t>(entry.size);
+  const uint8_t* src = bytes() + entry.offset;
+  dest->assign(size + 1, 0);
+  if (!(entry.flags & kFlagLZ4)) {
+    memcpy(&(*dest)[0], src, size);
+    return size > 0;
+  }
+  if (!DecompressLZ4(src, static_cast<size_t>(entry.stored_size),
+                     reinterpret_cast<uint8_t*>(&(*dest)[0]), size)) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Corrupt archive entry %s\n", name);
+    return false;
+  }
+  return size > 0;
+}
+
+}  // namespace fpl
@@ -0,0 +1,113 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FPL_ASSET_ARCHIVE_H
+#define FPL_ASSET_ARCHIVE_H
+
+#include <cstdint>
+#include <string>
+#include "mapped_file.h"
+
+namespace fpl {
+
+// Name of the archive written by scripts/build_assets.py, in the assets
+// directory.
+static const char kAssetArchiveFileName[] = "assets.pak";
+
+// A single file holding many assets, so that startup opens one file and reads
+// it front to back, instead of opening every asset on its own.
+//
+// The archive is little-endian, and laid out as:
+//   Header
+//   Entry[entry_count], sorted by name hash
+//   entry names, concatenated without terminators
+//   entry data, each aligned to kAlignment bytes from the start of the file
+// Entries are optionally LZ4 compressed, as a single raw block.
+//
+// Keep the layout in sync with write_asset_archive() in
+// scripts/build_assets.py.
+class AssetArchive {
+ public:
+  AssetArchive() : names_(nullptr) {}
+
+  // Map the archive 'filename'. Returns false if it can't be read or isn't
+  // an archive we understand.
+  bool Open(const char* filename);
+
+  // True if 'name', a path relative to the assets directory, is in the
+  // archive.
+  bool Contains(const char* name) const;
+
+  // If 'name' is stored uncompressed, return a pointer to its data in the
+  // archive and its length in 'size'. Otherwise, return nullptr.
+  const void* FindUncompressed(const char* name, size_t* size) const;
+
+  // Copy 'name' into 'dest', decompressing it if need be. Like LoadFile(),
+  // 'dest' gets a zero terminator that isn't part of the data.
+  bool Read(const char* name, std::string* dest) const;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(AssetArchive);
+
+  static const uint32_t kVersion = 1;
+  static const uint32_t kAlignment = 16;
+  static const uint32_t kFlagLZ4 = 1;
+
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t toc_offset;
+  };
+
+  struct Entry {
+    uint64_t name_hash;
+    uint32_t name_offset;
+    uint32_t name_length;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t stored_size;
+    uint32_t flags;
+    uint32_t padding;
+  };
+
+  // Look up 'name' in the table of contents.
+  bool FindEntry(const char* name, Entry* entry) const;
+  const uint8_t* bytes() const {
+    return static_cast<const uint8_t*>(file_.data());
+  }
+
+  MappedFile file_;
+  Header header_;
+  const char* names_;
+};
+
+// 64-bit FNV-1a hash of 'name', which the table of contents is sorted by.
+uint64_t HashAssetName(const char* name);
+
+// Decompress the raw LZ4 block 'src' into exactly 'dest_size' bytes at
+// 'dest'. Returns false if the block is malformed.
+bool DecompressLZ4(const uint8_t* src, size_t src_size, uint8_t* dest,
+                   size_t dest_size);
+
+// The archive that LoadFile(), FileExists() and MappedFile look in before
+// the file system, or nullptr if there isn't one. The archive must outlive
+// everything loaded from it.
+void SetAssetArchive(const AssetArchive* archive);
+const AssetArchive* GetAssetArchive();
+
+}  // namespace fpl
+
+#endif  // FPL_ASSET_ARCHIVE_H
@@ -14,100 +14,148 @@
 
 #include "precompiled.h"
 #include "async_loader.h"
+#include "worker_pool.h"
 
 namespace fpl {
 
-// Push this to signal the worker thread that it's time to quit.
-class BookendAsyncResource : public AsyncResource {
-  static std::string kBookendFileName;
-
- public:
-  BookendAsyncResource() : AsyncResource(kBookendFileName) {}
-  virtual ~BookendAsyncResource() {}
-  virtual void Load() {}
-  virtual void Finalize() {}
-  static bool IsBookend(const AsyncResource &res) {
-    return res.filename() == kBookendFileName;
-  }
-};
-
 // static
-std::string BookendAsyncResource::kBookendFileName = "bookend";
+bool AsyncLoader::LoadsAfter(const AsyncResource *a, const AsyncResource *b) {
+  if (a->timing().priority != b->timing().priority)
+    return a->timing().priority < b->timing().priority;
+  return a->sequence_ > b->sequence_;
+}
+
+// Loaded jobs that can wait for the main thread before the load jobs have to
+// stall.
+static const size_t kDoneQueueSize = 1024;
 
-AsyncLoader::AsyncLoader() {
+AsyncLoader::AsyncLoader()
+    : next_sequence_(0),
+      done_(kDoneQueueSize),
+      jobs_outstanding_(0),
+      jobs_total_(0),
+      pool_(nullptr),
+      max_loads_(0),
+      loads_running_(0),
+      stopping_(false) {
   mutex_ = SDL_CreateMutex();
-  job_semaphore_ = SDL_CreateSemaphore(0);
-  assert(mutex_ && job_semaphore_);
+  loads_finished_ = SDL_CreateCond();
+  assert(mutex_ && loads_finished_);
 }
 
 AsyncLoader::~AsyncLoader() {
-  StopLoadingWhenComplete();
-  SDL_WaitThread(worker_thread_, nullptr);
+  // Running loads finish the resource they're on, and leave the rest.
+  SDL_LockMutex(mutex_);
+  stopping_ = true;
+  while (loads_running_ > 0) SDL_CondWait(loads_finished_, mutex_);
+  SDL_UnlockMutex(mutex_);
 
   if (mutex_) {
     SDL_DestroyMutex(mutex_);
     mutex_ = nullptr;
   }
-  if (job_semaphore_) {
-    SDL_DestroySemaphore(job_semaphore_);
-    job_semaphore_ = nullptr;
+  if (loads_finished_) {
+    SDL_DestroyCond(loads_finished_);
+    loads_finished_ = nullptr;
   }
 }
 
-void AsyncLoader::QueueJob(AsyncResource *res) {
-  Lock([this, res]() { queue_.push_back(res); });
-  SDL_SemPost(job_semaphore_);
+void AsyncLoader::QueueJob(AsyncResource *res, int priority) {
+  res->timing_ = AsyncLoadTiming();
+  res->timing_.filename = res->filename_;
+  res->timing_.priority = priority;
+  res->timing_.queued = static_cast<int>(SDL_GetTicks());
+  res->finalized_ = false;
+  if (jobs_outstanding_ == 0) jobs_total_ = 0;
+  jobs_outstanding_++;
+  jobs_total_++;
+  Lock([this, res]() {
+    res->sequence_ = next_sequence_++;
+    queue_.push_back(res);
+    std::push_heap(queue_.begin(), queue_.end(), LoadsAfter);
+  });
+  StartLoads();
+}
+
+void AsyncLoader::StartLoading(WorkerPool *pool, int max_loads) {
+  pool_ = pool;
+  max_loads_ = std::max(max_loads, 1);
+  StartLoads();
+}
+
+void AsyncLoader::StartLoads() {
+  if (!pool_) return;
+  const int count = LockReturn<int>([this]() {
+    if (stopping_) return 0;
+    const int count = std::min(max_loads_ - loads_running_,
+                               static_cast<int>(queue_.size()));
+    loads_running_ += std::max(count, 0);
+    return count;
+  });
+  // Submitted outside the lock, since a pool with no threads runs them here.
+  for (int i = 0; i < count; ++i) {
+    pool_->Submit([this]() { LoadNext(); });
+  }
 }
 
-void AsyncLoader::LoaderWorker() {
-  for (;;) {
-    auto res = LockReturn<AsyncResource *>(
-        [this]() { return queue_.empty() ? nullptr : queue_[0]; });
-    if (!res) {
-      SDL_SemWait(job_semaphore_);
-      continue;
+void AsyncLoader::LoadNext() {
+  AsyncResource *res = LockReturn<AsyncResource *>([this]() {
+    if (queue_.empty() || stopping_) {
+      return static_cast<AsyncResource *>(nullptr);
     }
-    // Stop loading once we reach the bookend enqueued by
-    // StopLoadingWhenComplete(). To start loading again, call StartLoading().
-    if (BookendAsyncResource::IsBookend(*res)) break;
+    std::pop_heap(queue_.begin(), queue_.end(), LoadsAfter);
+    AsyncResource *next = queue_.back();
+    queue_.pop_back();
+    return next;
+  });
+  if (res) {
     SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "async load: %s",
                  res->filename_.c_str());
+    res->timing_.thread = pool_->CurrentWorker();
+    res->timing_.load_start = static_cast<int>(SDL_GetTicks());
     res->Load();
-    Lock([this, res]() {
-      queue_.erase(queue_.begin());
-      done_.push_back(res);
-    });
+    res->timing_.load_end = static_cast<int>(SDL_GetTicks());
+    // The main thread drains done_ every frame, so this rarely waits.
+    while (!done_.TryPush(res)) {
+      SDL_Delay(1);
+    }
   }
-}
 
-int AsyncLoader::LoaderThread(void *user_data) {
-  reinterpret_cast<AsyncLoader *>(user_data)->LoaderWorker();
-  return 0;
+  // Each job loads one resource and then submits the next, so that the
+  // destructor never waits on more than one load per job.
+  const bool more = LockReturn<bool>([this]() {
+    if (!queue_.empty() && !stopping_) return true;
+    if (--loads_running_ == 0) SDL_CondSignal(loads_finished_);
+    return false;
+  });
+  if (more) pool_->Submit([this]() { LoadNext(); });
 }
 
-void AsyncLoader::StartLoading() {
-  worker_thread_ =
-      SDL_CreateThread(AsyncLoader::LoaderThread, "FPL Loader Thread", this);
-  assert(worker_thread_);
-}
-
-void AsyncLoader::StopLoadingWhenComplete() {
-  // When the loader thread hits the bookend, it will exit.
-  static BookendAsyncResource bookend;
-  QueueJob(&bookend);
-}
-
-bool AsyncLoader::TryFinalize() {
-  for (;;) {
-    auto res = LockReturn<AsyncResource *>(
-        [this]() { return done_.empty() ? nullptr : done_[0]; });
-    if (!res) break;
+bool AsyncLoader::TryFinalize(int budget_microseconds) {
+  const Uint64 start = SDL_GetPerformanceCounter();
+  const Uint64 budget =
+      SDL_GetPerformanceFrequency() * budget_microseconds / 1000000;
+  AsyncResource *res;
+  while (done_.TryPop(&res)) {
     SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "finalize: %s",
                  res->filename_.c_str());
     res->Finalize();
-    Lock([this]() { done_.erase(done_.begin()); });
+    res->finalized_ = true;
+    res->timing_.finalized = static_cast<int>(SDL_GetTicks());
+    timings_.push_back(res->timing_);
+    jobs_outstanding_--;
+    if (budget_microseconds > 0 &&
+        SDL_GetPerformanceCounter() - start >= budget) {
+      break;
+    }
   }
-  return LockReturn<bool>([this]() { return queue_.empty(); });
+  return Finished();
+}
+
+float AsyncLoader::Progress() const {
+  if (jobs_outstanding_ == 0) return 1.0f;
+  return static_cast<float>(jobs_total_ - jobs_outstanding_) /
+         static_cast<float>(jobs_total_);
 }
 
 }  // namespace fpl
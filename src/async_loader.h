@@ -15,22 +15,49 @@
 #ifndef FPL_ASYNC_LOADER_H
 #define FPL_ASYNC_LOADER_H
 
+#include "lock_free_queue.h"
+
 namespace fpl {
 
 class AsyncLoader;
+class WorkerPool;
+
+// When a job passed through the loader, in milliseconds since SDL_Init().
+struct AsyncLoadTiming {
+  AsyncLoadTiming()
+      : priority(0),
+        thread(-1),
+        queued(0),
+        load_start(0),
+        load_end(0),
+        finalized(0) {}
+
+  std::string filename;
+  int priority;
+  // Index of the worker thread that called Load(), or -1 if it was some
+  // other thread.
+  int thread;
+  int queued;
+  int load_start;
+  int load_end;
+  int finalized;
+};
 
 // Any resources that can be loaded async should inherit from this.
 class AsyncResource {
  public:
   AsyncResource(const std::string &filename)
-      : filename_(filename), data_(nullptr) {}
+      : filename_(filename),
+        data_(nullptr),
+        sequence_(0),
+        finalized_(false) {}
   virtual ~AsyncResource() {}
 
   // Load should perform the actual loading of filename_, and store the
-  // result in data_, or nullptr upon failure. It is called on the loader
-  // thread, so should not access any program state outside of this object.
-  // Since there will be only one loader thread, any libraries called by Load
-  // need not be MT-safe as long as they're not also called by the main thread.
+  // result in data_, or nullptr upon failure. It is called on one of the
+  // worker threads, so should not access any program state outside of this
+  // object. Several resources may be loading at the same time, so any
+  // libraries called by Load must be MT-safe.
   virtual void Load() = 0;
 
   // This should implement the behavior of turning data_ into the actual
@@ -38,11 +65,21 @@ class AsyncResource {
   virtual void Finalize() = 0;
 
   const std::string &filename() const { return filename_; }
+  const AsyncLoadTiming &timing() const { return timing_; }
+  // True once Finalize() has been called. Until then, the loader may still be
+  // using this object.
+  bool finalized() const { return finalized_; }
 
  protected:
   std::string filename_;
   uint8_t *data_;
 
+ private:
+  // Jobs of equal priority are loaded in the order they were queued.
+  unsigned int sequence_;
+  AsyncLoadTiming timing_;
+  bool finalized_;
+
   friend class AsyncLoader;
 };
 
@@ -51,21 +88,37 @@ class AsyncLoader {
   AsyncLoader();
   ~AsyncLoader();
 
-  // Call this any number of times before StartLoading.
-  void QueueJob(AsyncResource *res);
+  // Call this any number of times, on the main thread. Jobs queued before
+  // StartLoading wait for it; after that, they start loading right away.
+  // Jobs with a higher 'priority' are loaded first.
+  void QueueJob(AsyncResource *res, int priority = 0);
 
-  // Launches the loading thread.
-  void StartLoading();
-
-  // Cleans-up the background loading thread once all jobs have been completed.
-  // You can restart with StartLoading() if you like.
-  void StopLoadingWhenComplete();
+  // Loads the queued jobs on the workers of 'pool', at most 'max_loads' at
+  // once, so that loading leaves the rest of the pool to everything else.
+  // 'pool' must outlive the loader. If it has no threads, jobs load on the
+  // thread that queues them.
+  void StartLoading(WorkerPool *pool, int max_loads = 1);
 
   // Call this once per frame after StartLoading. Will call Finalize on any
   // resources that have finished loading. One it returns true, that means
-  // the queue is empty, all resources have been processed, and the loading
-  // thread has terminated.
-  bool TryFinalize();
+  // the queue is empty and all resources have been processed.
+  // If 'budget_microseconds' is non-zero, stops finalizing once that much time
+  // has passed, leaving the rest for the next call. At least one resource is
+  // finalized per call, so loading always makes progress.
+  bool TryFinalize(int budget_microseconds = 0);
+
+  // True once every job queued has been finalized.
+  bool Finished() const { return jobs_outstanding_ == 0; }
+
+  // Jobs queued but not yet finalized, whether or not they're loaded.
+  int jobs_outstanding() const { return jobs_outstanding_; }
+
+  // Fraction of the jobs queued since the loader was last finished that have
+  // been finalized. 1 when there is nothing left to do.
+  float Progress() const;
+
+  // Timings of every job finalized so far, in the order they were finalized.
+  const std::vector<AsyncLoadTiming> &timings() const { return timings_; }
 
  private:
   void Lock(const std::function<void()> &body) {
@@ -82,20 +135,45 @@ class AsyncLoader {
     return ret;
   }
 
-  void LoaderWorker();
-  static int LoaderThread(void *user_data);
+  // Orders queue_ so that the front of the heap is the job to load next.
+  static bool LoadsAfter(const AsyncResource *a, const AsyncResource *b);
+  // Submits as many load jobs to pool_ as max_loads_ allows.
+  void StartLoads();
+  // A pool job: loads the next resource in queue_, if there is one.
+  void LoadNext();
+
+  // Heap ordered by priority, then by sequence. Only the load jobs pop from
+  // it, so the main thread only contends for it in QueueJob.
+  std::vector<AsyncResource *> queue_;
+  unsigned int next_sequence_;
+
+  // Loaded jobs waiting for Finalize. Pushed by the load jobs and popped
+  // by TryFinalize, without locking.
+  LockFreeQueue<AsyncResource *> done_;
+
+  // Jobs queued but not yet finalized, and jobs queued in total since the
+  // loader was last finished. Only touched on the main thread.
+  int jobs_outstanding_;
+  int jobs_total_;
+
+  // Set by StartLoading.
+  WorkerPool *pool_;
+  int max_loads_;
+
+  // Load jobs submitted to pool_ and not yet finished.
+  int loads_running_;
 
-  std::vector<AsyncResource *> queue_, done_;
+  // Set by the destructor, so that no more load jobs are submitted.
+  bool stopping_;
 
-  // Keep handle to the worker thread around so that we can wait for it to
-  // finish before destroying the class.
-  SDL_Thread *worker_thread_;
+  // Only touched on the main thread, so not protected by mutex_.
+  std::vector<AsyncLoadTiming> timings_;
 
-  // This lock protects ALL state in this class, i.e. the two vectors.
+  // This lock protects queue_, next_sequence_, loads_running_ and stopping_.
   SDL_mutex *mutex_;
 
-  // Kick-off the worker thread when a new job arrives.
-  SDL_semaphore *job_semaphore_;
+  // Signalled when the last load job running finishes.
+  SDL_cond *loads_finished_;
 };
 
 }  // namespace fpl
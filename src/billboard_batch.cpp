@@ -0,0 +1,153 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "billboard_batch.h"
+#include "renderer.h"
+
+namespace fpl {
+
+typedef VertexFormat<Position3f, TexCoord2f, Color4ub> ExpandedFormat;
+
+static unsigned char ColorToByte(float c) {
+  return static_cast<unsigned char>(mathfu::Clamp(c, 0.0f, 1.0f) * 255.0f +
+                                    0.5f);
+}
+
+BillboardBatch::BillboardBatch()
+    : mesh_(nullptr),
+      quad_vertices_(nullptr),
+      quad_indices_(nullptr),
+      instance_vbo_(0),
+      uploaded_(false) {}
+
+BillboardBatch::~BillboardBatch() {
+  if (instance_vbo_) GL_CALL(glDeleteBuffers(1, &instance_vbo_));
+}
+
+void BillboardBatch::Begin(Mesh* mesh, const NormalMappedVertex* vertices,
+                           const unsigned short* indices) {
+  mesh_ = mesh;
+  quad_vertices_ = vertices;
+  quad_indices_ = indices;
+  instances_.clear();
+  uploaded_ = false;
+}
+
+void BillboardBatch::Add(const mat4& world_matrix, const vec4& color) {
+  assert(mesh_ != nullptr && !full());
+  Instance instance;
+  for (int i = 0; i < 3; ++i) {
+    instance.rows[i] = vec4(world_matrix(i, 0), world_matrix(i, 1),
+                            world_matrix(i, 2), world_matrix(i, 3));
+  }
+  for (int i = 0; i < 4; ++i) {
+    instance.color[i] = ColorToByte(color[i]);
+  }
+  instances_.push_back(instance);
+  uploaded_ = false;
+}
+
+void BillboardBatch::Render(Renderer& renderer, bool ignore_material) {
+  if (instances_.empty()) return;
+
+  if (!ignore_material) mesh_->GetMaterial(0)->Set(renderer);
+  if (renderer.SupportsInstancing()) {
+    RenderInstanced(renderer);
+  } else {
+    RenderExpanded();
+  }
+  uploaded_ = true;
+}
+
+void BillboardBatch::RenderInstanced(Renderer& renderer) {
+  if (!instance_vbo_) GL_CALL(glGenBuffers(1, &instance_vbo_));
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, instance_vbo_));
+  if (!uploaded_) {
+    GL_CALL(glBufferData(GL_ARRAY_BUFFER,
+                         instances_.size() * sizeof(Instance), &instances_[0],
+                         GL_STREAM_DRAW));
+    Renderer::CountUpload(instances_.size() * sizeof(Instance));
+  }
+
+  const char* base = nullptr;
+  for (int i = 0; i < 3; ++i) {
+    const GLuint attribute = Mesh::kAttributeInstanceRow0 + i;
+    GL_CALL(glEnableVertexAttribArray(attribute));
+    GL_CALL(glVertexAttribPointer(attribute, 4, GL_FLOAT, false,
+                                  sizeof(Instance),
+                                  base + offsetof(Instance, rows) +
+                                      i * sizeof(vec4_packed)));
+    renderer.VertexAttribDivisor(attribute, 1);
+  }
+  GL_CALL(glEnableVertexAttribArray(Mesh::kAttributeColor));
+  GL_CALL(glVertexAttribPointer(Mesh::kAttributeColor, 4, GL_UNSIGNED_BYTE,
+                                true, sizeof(Instance),
+                                base + offsetof(Instance, color)));
+  renderer.VertexAttribDivisor(Mesh::kAttributeColor, 1);
+
+  mesh_->RenderInstanced(renderer, static_cast<int>(instances_.size()), true);
+
+  // Leave the attributes as we found them, since other meshes don't expect
+  // them to advance per instance.
+  for (int i = 0; i < 3; ++i) {
+    const GLuint attribute = Mesh::kAttributeInstanceRow0 + i;
+    renderer.VertexAttribDivisor(attribute, 0);
+    GL_CALL(glDisableVertexAttribArray(attribute));
+  }
+  renderer.VertexAttribDivisor(Mesh::kAttributeColor, 0);
+  GL_CALL(glDisableVertexAttribArray(Mesh::kAttributeColor));
+}
+
+void BillboardBatch::RenderExpanded() {
+  const size_t count = instances_.size();
+  vertices_.resize(count * kBillboardNumVertices);
+  indices_.resize(count * kBillboardNumIndices);
+
+  for (size_t i = 0; i < count && !uploaded_; ++i) {
+    const Instance& instance = instances_[i];
+    const vec4 row0(instance.rows[0]);
+    const vec4 row1(instance.rows[1]);
+    const vec4 row2(instance.rows[2]);
+    Vertex* v = &vertices_[i * kBillboardNumVertices];
+    for (int j = 0; j < kBillboardNumVertices; ++j) {
+      const vec4 pos(vec3(quad_vertices_[j].pos), 1.0f);
+      v[j].pos = vec3(vec4::DotProduct(row0, pos), vec4::DotProduct(row1, pos),
+                      vec4::DotProduct(row2, pos));
+      v[j].tc = quad_vertices_[j].tc;
+      memcpy(v[j].color, instance.color, sizeof(instance.color));
+    }
+    const unsigned short base =
+        static_cast<unsigned short>(i * kBillboardNumVertices);
+    unsigned short* indices = &indices_[i * kBillboardNumIndices];
+    for (int j = 0; j < kBillboardNumIndices; ++j) {
+      indices[j] = base + quad_indices_[j];
+    }
+  }
+
+  // The vertices are already in world space, so the per-instance transform is
+  // the identity. With their arrays disabled, the attributes take these
+  // constant values.
+  GL_CALL(glVertexAttrib4f(Mesh::kAttributeInstanceRow0, 1, 0, 0, 0));
+  GL_CALL(glVertexAttrib4f(Mesh::kAttributeInstanceRow1, 0, 1, 0, 0));
+  GL_CALL(glVertexAttrib4f(Mesh::kAttributeInstanceRow2, 0, 0, 1, 0));
+
+  static_assert(ExpandedFormat::kSize == sizeof(Vertex),
+                "Vertex must be laid out as ExpandedFormat.");
+  Mesh::RenderArray<ExpandedFormat>(
+      GL_TRIANGLES, static_cast<int>(indices_.size()),
+      reinterpret_cast<const char*>(&vertices_[0]), &indices_[0]);
+}
+
+}  // namespace fpl
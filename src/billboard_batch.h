@@ -0,0 +1,109 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_BILLBOARD_BATCH_H
+#define FPL_BILLBOARD_BATCH_H
+
+#include "mesh.h"
+
+namespace fpl {
+
+class Renderer;
+
+// Number of vertices and indices in each billboard quad.
+static const int kBillboardNumVertices = 4;
+static const int kBillboardNumIndices = 6;
+
+// Collects many copies of one quad mesh, each with its own world matrix and
+// tint, and draws them all with a single call.
+//
+// When the context supports instancing, the quad's VBO is drawn once per
+// instance with the transforms streamed in as per-instance attributes.
+// Otherwise, the quads are transformed on the CPU into one vertex array.
+// Either way, draw with an instanced shader such as
+// shaders/textured_instanced, with the view-projection matrix in
+// Renderer::model_view_projection().
+class BillboardBatch {
+ public:
+  BillboardBatch();
+  ~BillboardBatch();
+
+  // Start a new batch of 'mesh'. 'vertices' and 'indices' are the CPU copy
+  // of the quad in the mesh, of length kBillboardNumVertices and
+  // kBillboardNumIndices. They must remain valid until Render() is called.
+  void Begin(Mesh* mesh, const NormalMappedVertex* vertices,
+             const unsigned short* indices);
+
+  // Add one copy of the mesh to the batch. Only call when !full().
+  void Add(const mat4& world_matrix, const vec4& color);
+
+  // Bind the mesh's material, unless 'ignore_material', and draw every copy
+  // added since Begin(). The shader must already be set. May be called more
+  // than once, e.g. once per eye, in which case the copies are only uploaded
+  // the first time.
+  void Render(Renderer& renderer, bool ignore_material = false);
+
+  // Empty the batch.
+  void Clear() { instances_.clear(); }
+
+  // Forget the instance buffer, once the GL context it was made in has been
+  // lost. It's made again by the next Render().
+  void ForgetBuffers() {
+    instance_vbo_ = 0;
+    uploaded_ = false;
+  }
+
+  // The mesh passed to Begin(), if the batch is not empty.
+  Mesh* mesh() const { return instances_.empty() ? nullptr : mesh_; }
+  size_t size() const { return instances_.size(); }
+
+  // Indices are 16-bit, which limits how many quads the CPU path can draw.
+  bool full() const { return instances_.size() >= kMaxInstances; }
+
+ private:
+  struct Instance {
+    vec4_packed rows[3];
+    unsigned char color[4];
+  };
+  struct Vertex {
+    vec3_packed pos;
+    vec2_packed tc;
+    unsigned char color[4];
+  };
+
+  static const size_t kMaxInstances = 0x10000 / kBillboardNumVertices;
+
+  void RenderInstanced(Renderer& renderer);
+  void RenderExpanded();
+
+  Mesh* mesh_;
+  const NormalMappedVertex* quad_vertices_;
+  const unsigned short* quad_indices_;
+  std::vector<Instance> instances_;
+
+  // Scratch space for the CPU path. Kept around to avoid reallocating.
+  std::vector<Vertex> vertices_;
+  std::vector<unsigned short> indices_;
+
+  // Per-instance attributes for the instanced path.
+  GLuint instance_vbo_;
+
+  // True if instances_ has been uploaded, or expanded into vertices_, since
+  // the last change to it.
+  bool uploaded_;
+};
+
+}  // namespace fpl
+
+#endif  // FPL_BILLBOARD_BATCH_H
@@ -35,11 +35,9 @@ using mathfu::mat4;
 namespace fpl {
 namespace pie_noon {
 
-static const float kMaxPosition = 20.0f;
-
 Character::Character(
     CharacterId id, Controller* controller, const Config& config,
-    const CharacterStateMachineDef* character_state_machine_def)
+    const CharacterStateMachineTable* state_machine_table)
     : config_(&config),
       id_(id),
       target_(0),
@@ -48,7 +46,7 @@ Character::Character(
       position_(mathfu::kZeros3f),
       controller_(controller),
       just_joined_game_(false),
-      state_machine_(character_state_machine_def),
+      state_machine_(state_machine_table),
       victory_state_(kResultUnknown),
       visible_(true) {
   ResetStats();
@@ -65,6 +63,11 @@ void Character::Reset(CharacterId target, CharacterHealth health,
   victory_state_ = kResultUnknown;
   visible_ = true;
 
+  // A character that has played before keeps its motivator.
+  if (face_angle_.Valid()) {
+    face_angle_.SetTarget(motive::Current1f(face_angle.ToRadians()));
+    return;
+  }
   motive::OvershootInit init;
   OvershootInitFromFlatBuffers(*config_->face_angle_def(), &init);
 
@@ -91,7 +94,7 @@ uint16_t Character::RenderableId(WorldTime anim_time) const {
 
   // Grab the TimelineRenderable for 'anim_time', from the timeline.
   const int renderable_index =
-      TimelineIndexBeforeTime(timeline->renderables(), anim_time);
+      renderable_cursor_.IndexBeforeTime(timeline->renderables(), anim_time);
   const TimelineRenderable* renderable =
       timeline->renderables()->Get(renderable_index);
   if (!renderable) return RenderableId_Invalid;
@@ -122,64 +125,17 @@ void Character::ResetStats() {
   for (int i = 0; i < kMaxStats; i++) player_stats_[i] = 0;
 }
 
-// orientation_ and position_ are set each frame in GameState::Advance.
-AirbornePie::AirbornePie(CharacterId original_source, const Character& source,
-                         const Character& target, WorldTime start_time,
+AirbornePie::AirbornePie(CharacterId original_source, CharacterId source,
+                         CharacterId target, WorldTime start_time,
                          WorldTime flight_time, CharacterHealth original_damage,
-                         CharacterHealth damage, float start_height,
-                         float peak_height, int rotations, float y_rotation,
-                         motive::MotiveEngine* engine)
+                         CharacterHealth damage)
     : original_source_(original_source),
-      source_(source.id()),
-      target_(target.id()),
+      source_(source),
+      target_(target),
       start_time_(start_time),
       flight_time_(flight_time),
       original_damage_(original_damage),
-      damage_(damage) {
-  // x,z positions are within a reasonable bound.
-  // Rotations are anglular values.
-  const motive::SmoothInit position_init(
-      fpl::Range(-kMaxPosition, kMaxPosition), false);
-  const motive::SmoothInit rotation_init(fpl::Range(-kPi, kPi), true);
-
-  // Move x,z at constant speed from source to target.
-  const motive::MotiveTarget1f x_target(motive::CurrentToTargetConstVelocity1f(
-      source.position().x(), target.position().x(), flight_time));
-  const motive::MotiveTarget1f z_target(motive::CurrentToTargetConstVelocity1f(
-      source.position().z(), target.position().z(), flight_time));
-
-  // Move y along a trajectory that starts and ends at 'start_height' and
-  // tops out at 'peak_height' half way through.
-  // Since deceleration is constant, and velocity at the peak is zero,
-  // the average velocity from start to peak is,
-  //       0.5(start_velocity + 0)
-  //
-  // At peak, height is average velocity times travel time, so
-  //       peak_height = 0.5(start_velocity + 0)*peak_time
-  // Which implies,
-  //    start_velocity = 2 * delta_height / peak_time
-  const float peak_time = 0.5f * flight_time;
-  const float delta_height = peak_height - start_height;
-  const float start_velocity = 2.0f * delta_height / peak_time;
-  const motive::MotiveTarget1f y_target(motive::CurrentToTargetToTarget1f(
-      start_height, start_velocity,                  // Initial node.
-      peak_height, 0.0f, peak_time,                  // Peak node.
-      start_height, -start_velocity, flight_time));  // End node.
-
-  // The pie rotates top to bottom a fixed number of times. Rotation speed
-  // is constant.
-  const motive::MotiveTarget1f z_rotation_target(
-      motive::CurrentToTargetConstVelocity1f(0.0f, rotations * kTwoPi,
-                                             flight_time));
-
-  motive::MatrixInit init(5);
-  init.AddOp(motive::kTranslateX, position_init, x_target);
-  init.AddOp(motive::kTranslateY, position_init, y_target);
-  init.AddOp(motive::kTranslateZ, position_init, z_target);
-  init.AddOp(motive::kRotateAboutY, y_rotation);
-  init.AddOp(motive::kRotateAboutZ, rotation_init, z_rotation_target);
-  motivator_.Initialize(init, engine);
-}
+      damage_(damage) {}
 
 void ApplyScoringRule(const ScoringRules* scoring_rules, ScoreEvent event,
                       unsigned int damage, Character* character) {
@@ -50,14 +50,98 @@ enum PlayerStats {
 
 enum VictoryState { kResultUnknown, kVictorious, kFailure };
 
+// Return index of first item with time >= t.
+// T is a flatbuffer::Vector; one of the Timeline members.
+template <class T>
+inline int TimelineIndexAfterTime(const T& arr, const int start_index,
+                                  const WorldTime t) {
+  if (!arr) return 0;
+
+  for (int i = start_index; i < static_cast<int>(arr->Length()); ++i) {
+    if (arr->Get(i)->time() >= t) return i;
+  }
+  return arr->Length();
+}
+
+// Return index of last item with time <= t, searching from start_index.
+// T is a flatbuffer::Vector; one of the Timeline members.
+template <class T>
+inline int TimelineIndexBeforeTime(const T& arr, const int start_index,
+                                   const WorldTime t) {
+  if (!arr || arr->Length() == 0) return 0;
+
+  for (int i = start_index + 1; i < static_cast<int>(arr->Length()); ++i) {
+    if (arr->Get(i)->time() > t) return i - 1;
+  }
+  return arr->Length() - 1;
+}
+
+template <class T>
+inline int TimelineIndexBeforeTime(const T& arr, const WorldTime t) {
+  return TimelineIndexBeforeTime(arr, 0, t);
+}
+
+// Write the indices of items with time <= t < end_time into 'indices', up to
+// 'max_indices' of them. Returns the number written.
+// T is a flatbuffer::Vector; one of the Timeline members.
+template <class T>
+inline int TimelineIndicesWithTime(const T& arr, const WorldTime t,
+                                   int* indices, int max_indices) {
+  if (!arr) return 0;
+
+  int count = 0;
+  for (int i = 0; i < static_cast<int>(arr->Length()) && count < max_indices;
+       ++i) {
+    const float end_time = arr->Get(i)->end_time();
+    if (arr->Get(i)->time() <= t && (t < end_time || end_time == 0.0f))
+      indices[count++] = i;
+  }
+  return count;
+}
+
+// Remembers where the last lookup in a timeline vector ended. While the
+// lookups are in the same vector at times that don't go backwards, as they do
+// while a character stays in a state, each one only scans the items since the
+// last. Timeline items are sorted by time.
+class TimelineCursor {
+ public:
+  TimelineCursor() : items_(nullptr), time_(0), index_(0) {}
+
+  // Same result as TimelineIndexAfterTime(arr, 0, t).
+  template <class T>
+  int IndexAfterTime(const T& arr, const WorldTime t) {
+    index_ = TimelineIndexAfterTime(arr, StartIndex(arr, t), t);
+    return index_;
+  }
+
+  // Same result as TimelineIndexBeforeTime(arr, t).
+  template <class T>
+  int IndexBeforeTime(const T& arr, const WorldTime t) {
+    index_ = TimelineIndexBeforeTime(arr, StartIndex(arr, t), t);
+    return index_;
+  }
+
+ private:
+  int StartIndex(const void* items, const WorldTime t) {
+    const int start = items == items_ && t >= time_ ? index_ : 0;
+    items_ = items;
+    time_ = t;
+    return start;
+  }
+
+  const void* items_;
+  WorldTime time_;
+  int index_;
+};
+
 // The current state of the character. This class tracks information external
 // to the state machine, like health.
 class Character {
  public:
   // The Character does not take ownership of the controller or
-  // character_state_machine_def pointers.
+  // state_machine_table pointers.
   Character(CharacterId id, Controller* controller, const Config& config,
-            const CharacterStateMachineDef* character_state_machine_def);
+            const CharacterStateMachineTable* state_machine_table);
 
   // Resets the character to the start-of-game state.
   void Reset(CharacterId target, CharacterHealth health, Angle face_angle,
@@ -150,6 +234,9 @@ class Character {
   bool visible() const { return visible_; }
   void set_visible(bool visible) { visible_ = visible; }
 
+  TimelineCursor* sound_cursor() const { return &sound_cursor_; }
+  TimelineCursor* event_cursor() const { return &event_cursor_; }
+
  private:
   // Constant configuration data.
   const Config* config_;
@@ -197,15 +284,20 @@ class Character {
 
   // If the character should be visible.
   bool visible_;
+
+  // Where the last lookups in the current timeline ended. They only speed up
+  // the lookups, so const methods may update them.
+  mutable TimelineCursor sound_cursor_;
+  mutable TimelineCursor event_cursor_;
+  mutable TimelineCursor renderable_cursor_;
 };
 
+// A pie in flight. Where it is on its way is kept by the PiePool holding it.
 class AirbornePie {
  public:
-  AirbornePie(CharacterId original_source, const Character& source,
-              const Character& target, WorldTime start_time,
-              WorldTime flight_time, CharacterHealth original_damage,
-              CharacterHealth damage, float start_height, float peak_height,
-              int rotations, float y_rotation, motive::MotiveEngine* engine);
+  AirbornePie(CharacterId original_source, CharacterId source,
+              CharacterId target, WorldTime start_time, WorldTime flight_time,
+              CharacterHealth original_damage, CharacterHealth damage);
 
   CharacterId original_source() const { return original_source_; }
   CharacterId source() const { return source_; }
@@ -214,8 +306,6 @@ class AirbornePie {
   WorldTime flight_time() const { return flight_time_; }
   CharacterHealth original_damage() const { return original_damage_; }
   CharacterHealth damage() const { return damage_; }
-  const mathfu::mat4& Matrix() const { return motivator_.Value(); }
-  mathfu::vec3 Position() const { return motivator_.Position(); }
 
  private:
   CharacterId original_source_;
@@ -225,50 +315,8 @@ class AirbornePie {
   WorldTime flight_time_;
   CharacterHealth original_damage_;
   CharacterHealth damage_;
-  motive::MotivatorMatrix4f motivator_;
 };
 
-// Return index of first item with time >= t.
-// T is a flatbuffer::Vector; one of the Timeline members.
-template <class T>
-inline int TimelineIndexAfterTime(const T& arr, const int start_index,
-                                  const WorldTime t) {
-  if (!arr) return 0;
-
-  for (int i = start_index; i < static_cast<int>(arr->Length()); ++i) {
-    if (arr->Get(i)->time() >= t) return i;
-  }
-  return arr->Length();
-}
-
-// Return index of last item with time <= t.
-// T is a flatbuffer::Vector; one of the Timeline members.
-template <class T>
-inline int TimelineIndexBeforeTime(const T& arr, const WorldTime t) {
-  if (!arr || arr->Length() == 0) return 0;
-
-  for (int i = 1; i < static_cast<int>(arr->Length()); ++i) {
-    if (arr->Get(i)->time() > t) return i - 1;
-  }
-  return arr->Length() - 1;
-}
-
-// Return array of indices with time <= t < end_time.
-// T is a flatbuffer::Vector; one of the Timeline members.
-template <class T>
-inline std::vector<int> TimelineIndicesWithTime(const T& arr,
-                                                const WorldTime t) {
-  std::vector<int> ret;
-  if (!arr) return ret;
-
-  for (int i = 0; i < static_cast<int>(arr->Length()); ++i) {
-    const float end_time = arr->Get(i)->end_time();
-    if (arr->Get(i)->time() <= t && (t < end_time || end_time == 0.0f))
-      ret.push_back(i);
-  }
-  return ret;
-}
-
 void ApplyScoringRule(const ScoringRules* scoring_rules, ScoreEvent event,
                       unsigned int damage, Character* character);
 
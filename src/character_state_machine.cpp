@@ -17,24 +17,227 @@
 #include "timeline_generated.h"
 #include "character_state_machine_def_generated.h"
 
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define FPL_STATE_MACHINE_NEON
+#include <arm_neon.h>
+#elif defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FPL_STATE_MACHINE_SSE
+#include <emmintrin.h>
+#endif
+
 namespace fpl {
 namespace pie_noon {
 
+#if defined(FPL_STATE_MACHINE_SSE)
+// The arrays are only aligned to their element type.
+template <typename T>
+static inline __m128i Load(const T* values) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(values));
+}
+#endif
+
+CharacterStateMachineTable::CharacterStateMachineTable()
+    : state_machine_def_(nullptr) {}
+
+void CharacterStateMachineTable::AddTransition(
+    uint32_t is_down, uint32_t is_up, uint32_t went_down, uint32_t went_up,
+    int32_t time, int32_t end_time, uint32_t game_modes,
+    int32_t target_state) {
+  // A bit that must be both down and up can never be met.
+  if (is_down & is_up) end_time = time;
+  is_down_mask_.push_back(is_down | is_up);
+  is_down_value_.push_back(is_down);
+  went_down_.push_back(went_down);
+  went_up_.push_back(went_up);
+  time_.push_back(time);
+  end_time_.push_back(end_time);
+  game_modes_.push_back(game_modes);
+  target_state_.push_back(target_state);
+}
+
+void CharacterStateMachineTable::Initialize(
+    const CharacterStateMachineDef* const state_machine_def) {
+  state_machine_def_ = state_machine_def;
+  is_down_mask_.clear();
+  is_down_value_.clear();
+  went_down_.clear();
+  went_up_.clear();
+  time_.clear();
+  end_time_.clear();
+  game_modes_.clear();
+  target_state_.clear();
+  state_begin_.clear();
+
+  auto states = state_machine_def->states();
+  for (auto state = states->begin(); state != states->end(); ++state) {
+    state_begin_.push_back(static_cast<uint32_t>(target_state_.size()));
+    if (state->transitions()) {
+      for (auto it = state->transitions()->begin();
+           it != state->transitions()->end(); ++it) {
+        const Condition* condition = it->condition();
+        if (condition == nullptr) {
+          // Never followed. Kept, so the table has a slot per transition.
+          AddTransition(0, 0, 0, 0, 0, 0, 0, it->target_state());
+          continue;
+        }
+        uint32_t game_modes = 0;
+        switch (condition->game_mode()) {
+          case GameModeCondition_AnyMode:
+            game_modes = kGameModeSingle | kGameModeMulti;
+            break;
+          case GameModeCondition_SinglePlayerOnly:
+            game_modes = kGameModeSingle;
+            break;
+          case GameModeCondition_MultiPlayerOnly:
+            game_modes = kGameModeMulti;
+            break;
+          default:
+            break;
+        }
+        AddTransition(condition->is_down(), condition->is_up(),
+                      condition->went_down(), condition->went_up(),
+                      condition->time(), condition->end_time(), game_modes,
+                      it->target_state());
+      }
+    }
+    while (target_state_.size() % kGroupSize != 0) {
+      AddTransition(0, 0, 0, 0, 0, 0, 0, -1);
+    }
+  }
+  state_begin_.push_back(static_cast<uint32_t>(target_state_.size()));
+}
+
+int CharacterStateMachineTable::FindTransition(
+    int state, const ConditionInputs& inputs) const {
+  return FindTransition(
+      state, static_cast<uint32_t>(inputs.is_down),
+      static_cast<uint32_t>(inputs.went_down),
+      static_cast<uint32_t>(inputs.went_up), inputs.animation_time,
+      inputs.is_multiscreen ? kGameModeMulti : kGameModeSingle);
+}
+
+void CharacterStateMachineTable::FindTransitions(
+    size_t count, const int* states, const int32_t* is_down,
+    const int32_t* went_down, const int32_t* went_up,
+    const int* animation_time, bool is_multiscreen, int* targets) const {
+  const uint32_t game_mode = is_multiscreen ? kGameModeMulti : kGameModeSingle;
+  for (size_t i = 0; i < count; ++i) {
+    targets[i] = FindTransition(
+        states[i], static_cast<uint32_t>(is_down[i]),
+        static_cast<uint32_t>(went_down[i]),
+        static_cast<uint32_t>(went_up[i]), animation_time[i], game_mode);
+  }
+}
+
+#if defined(FPL_STATE_MACHINE_NEON)
+
+int CharacterStateMachineTable::FindTransition(
+    int state, uint32_t is_down, uint32_t went_down, uint32_t went_up,
+    int32_t animation_time, uint32_t game_mode) const {
+  const uint32x4_t down = vdupq_n_u32(is_down);
+  const uint32x4_t wdown = vdupq_n_u32(went_down);
+  const uint32x4_t wup = vdupq_n_u32(went_up);
+  const int32x4_t anim = vdupq_n_s32(animation_time);
+  const uint32x4_t mode = vdupq_n_u32(game_mode);
+  const uint32x4_t zero = vdupq_n_u32(0);
+
+  for (uint32_t i = state_begin_[state]; i < state_begin_[state + 1];
+       i += kGroupSize) {
+    const uint32x4_t w_down = vld1q_u32(&went_down_[i]);
+    const uint32x4_t w_up = vld1q_u32(&went_up_[i]);
+    // Any bit that differs from what the condition requires fails it.
+    const uint32x4_t mismatch = vorrq_u32(
+        veorq_u32(vandq_u32(down, vld1q_u32(&is_down_mask_[i])),
+                  vld1q_u32(&is_down_value_[i])),
+        vorrq_u32(veorq_u32(vandq_u32(wdown, w_down), w_down),
+                  veorq_u32(vandq_u32(wup, w_up), w_up)));
+    uint32x4_t met = vceqq_u32(mismatch, zero);
+    met = vandq_u32(met, vcleq_s32(vld1q_s32(&time_[i]), anim));
+    met = vandq_u32(met, vcgtq_s32(vld1q_s32(&end_time_[i]), anim));
+    met = vandq_u32(met, vtstq_u32(vld1q_u32(&game_modes_[i]), mode));
+    uint32_t lanes[kGroupSize];
+    vst1q_u32(lanes, met);
+    for (size_t j = 0; j < kGroupSize; ++j) {
+      if (lanes[j]) return target_state_[i + j];
+    }
+  }
+  return -1;
+}
+
+#elif defined(FPL_STATE_MACHINE_SSE)
+
+int CharacterStateMachineTable::FindTransition(
+    int state, uint32_t is_down, uint32_t went_down, uint32_t went_up,
+    int32_t animation_time, uint32_t game_mode) const {
+  const __m128i down = _mm_set1_epi32(static_cast<int>(is_down));
+  const __m128i wdown = _mm_set1_epi32(static_cast<int>(went_down));
+  const __m128i wup = _mm_set1_epi32(static_cast<int>(went_up));
+  const __m128i anim = _mm_set1_epi32(animation_time);
+  const __m128i mode = _mm_set1_epi32(static_cast<int>(game_mode));
+  const __m128i zero = _mm_setzero_si128();
+
+  for (uint32_t i = state_begin_[state]; i < state_begin_[state + 1];
+       i += kGroupSize) {
+    const __m128i w_down = Load(&went_down_[i]);
+    const __m128i w_up = Load(&went_up_[i]);
+    // Any bit that differs from what the condition requires fails it, as does
+    // being outside the time window or in the wrong game mode.
+    const __m128i mismatch = _mm_or_si128(
+        _mm_xor_si128(_mm_and_si128(down, Load(&is_down_mask_[i])),
+                      Load(&is_down_value_[i])),
+        _mm_or_si128(_mm_xor_si128(_mm_and_si128(wdown, w_down), w_down),
+                     _mm_xor_si128(_mm_and_si128(wup, w_up), w_up)));
+    const __m128i failed = _mm_or_si128(
+        _mm_or_si128(_mm_cmplt_epi32(anim, Load(&time_[i])),
+                     _mm_cmpeq_epi32(_mm_cmpgt_epi32(Load(&end_time_[i]), anim),
+                                     zero)),
+        _mm_cmpeq_epi32(_mm_and_si128(Load(&game_modes_[i]), mode), zero));
+    const __m128i met =
+        _mm_andnot_si128(failed, _mm_cmpeq_epi32(mismatch, zero));
+    const int lanes = _mm_movemask_ps(_mm_castsi128_ps(met));
+    for (size_t j = 0; j < kGroupSize; ++j) {
+      if (lanes & (1 << j)) return target_state_[i + j];
+    }
+  }
+  return -1;
+}
+
+#else
+
+int CharacterStateMachineTable::FindTransition(
+    int state, uint32_t is_down, uint32_t went_down, uint32_t went_up,
+    int32_t animation_time, uint32_t game_mode) const {
+  for (uint32_t i = state_begin_[state]; i < state_begin_[state + 1]; ++i) {
+    // Any bit that differs from what the condition requires fails it.
+    const uint32_t mismatch =
+        ((is_down & is_down_mask_[i]) ^ is_down_value_[i]) |
+        ((went_down & went_down_[i]) ^ went_down_[i]) |
+        ((went_up & went_up_[i]) ^ went_up_[i]);
+    if (mismatch == 0 && animation_time >= time_[i] &&
+        animation_time < end_time_[i] && (game_modes_[i] & game_mode) != 0) {
+      return target_state_[i];
+    }
+  }
+  return -1;
+}
+
+#endif
+
 CharacterStateMachine::CharacterStateMachine(
-    const CharacterStateMachineDef* const state_machine_def)
-    : state_machine_def_(state_machine_def) {
+    const CharacterStateMachineTable* const table)
+    : table_(table), state_machine_def_(table->state_machine_def()) {
   Reset();
 }
 
 void CharacterStateMachine::Reset() {
-  current_state_ =
-      state_machine_def_->states()->Get(state_machine_def_->initial_state());
-  current_state_start_time_ = 0;
+  SetCurrentState(state_machine_def_->initial_state(), 0);
 }
 
 void CharacterStateMachine::SetCurrentState(int new_stateId,
                                             WorldTime state_start_time) {
   current_state_ = state_machine_def_->states()->Get(new_stateId);
+  current_state_id_ = new_stateId;
   current_state_start_time_ = state_start_time;
 }
 
@@ -65,18 +268,13 @@ bool EvaluateCondition(const Condition* condition,
 }
 
 void CharacterStateMachine::Update(const ConditionInputs& inputs) {
-  if (!current_state_->transitions()) {
-    return;
-  }
-  for (auto it = current_state_->transitions()->begin();
-       it != current_state_->transitions()->end(); ++it) {
-    const Condition* condition = it->condition();
-    if (condition && EvaluateCondition(condition, inputs)) {
-      current_state_ = state_machine_def_->states()->Get(it->target_state());
-      current_state_start_time_ = inputs.current_time;
-      return;
-    }
-  }
+  FollowTransition(table_->FindTransition(current_state_id_, inputs),
+                   inputs.current_time);
+}
+
+void CharacterStateMachine::FollowTransition(int target,
+                                             WorldTime current_time) {
+  if (target >= 0) SetCurrentState(target, current_time);
 }
 
 bool CharacterStateMachineDef_Validate(
@@ -16,6 +16,7 @@
 #define CHARACTER_STATE_MACHINE_
 
 #include <cstdint>
+#include <vector>
 #include "common.h"
 
 namespace fpl {
@@ -41,12 +42,78 @@ struct ConditionInputs {
   bool is_multiscreen;
 };
 
+// The transitions of every state in a CharacterStateMachineDef, decoded into
+// contiguous arrays. Following them then takes a few mask tests per
+// transition, without reading the flatbuffer, and can test several
+// transitions at once with SIMD.
+class CharacterStateMachineTable {
+ public:
+  CharacterStateMachineTable();
+
+  // Decode the transitions of 'state_machine_def', which must have passed
+  // CharacterStateMachineDef_Validate(). This class does not take ownership
+  // of the definition.
+  void Initialize(const CharacterStateMachineDef* const state_machine_def);
+
+  // Returns the target of the first transition out of 'state' whose condition
+  // is met by 'inputs', or -1 if there is none. Equivalent to calling
+  // EvaluateCondition() on each transition in order.
+  int FindTransition(int state, const ConditionInputs& inputs) const;
+
+  // FindTransition() for 'count' state machines at once. Each array holds one
+  // field of the ConditionInputs of every state machine. targets[i] is set to
+  // the result of FindTransition(states[i], ...), or -1.
+  void FindTransitions(size_t count, const int* states, const int32_t* is_down,
+                       const int32_t* went_down, const int32_t* went_up,
+                       const int* animation_time, bool is_multiscreen,
+                       int* targets) const;
+
+  const CharacterStateMachineDef* state_machine_def() const {
+    return state_machine_def_;
+  }
+
+ private:
+  // Transitions are tested this many at a time. Each state's transitions are
+  // padded to a multiple of it, with transitions that can never be met.
+  static const size_t kGroupSize = 4;
+
+  enum { kGameModeSingle = 1, kGameModeMulti = 2 };
+
+  void AddTransition(uint32_t is_down, uint32_t is_up, uint32_t went_down,
+                     uint32_t went_up, int32_t time, int32_t end_time,
+                     uint32_t game_modes, int32_t target_state);
+  int FindTransition(int state, uint32_t is_down, uint32_t went_down,
+                     uint32_t went_up, int32_t animation_time,
+                     uint32_t game_mode) const;
+
+  const CharacterStateMachineDef* state_machine_def_;
+
+  // The conditions of the transitions, one array per field. A condition is
+  // met when:
+  //   (is_down & is_down_mask_) == is_down_value_, which covers both the
+  //     is_down and the is_up bits of the Condition,
+  //   (went_down & went_down_) == went_down_, and the same for went_up_,
+  //   time_ <= animation_time < end_time_,
+  //   and the game mode bit is in game_modes_.
+  std::vector<uint32_t> is_down_mask_;
+  std::vector<uint32_t> is_down_value_;
+  std::vector<uint32_t> went_down_;
+  std::vector<uint32_t> went_up_;
+  std::vector<int32_t> time_;
+  std::vector<int32_t> end_time_;
+  std::vector<uint32_t> game_modes_;
+  std::vector<int32_t> target_state_;
+
+  // The transitions of state i are those from state_begin_[i] up to
+  // state_begin_[i + 1], including padding.
+  std::vector<uint32_t> state_begin_;
+};
+
 class CharacterStateMachine {
  public:
-  // Initializes a state machine with the given state machine definition.
-  // This class does not take ownership of the definition.
-  CharacterStateMachine(
-      const CharacterStateMachineDef* const state_machine_def);
+  // Initializes a state machine with the given, initialized, table of a state
+  // machine definition. This class does not take ownership of the table.
+  CharacterStateMachine(const CharacterStateMachineTable* const table);
 
   // Resets back to initial conditions. Assumes time is reseting to 0 too.
   void Reset();
@@ -57,7 +124,12 @@ class CharacterStateMachine {
   // not a state transition occurs
   void Update(const ConditionInputs& inputs);
 
+  // Moves to 'target', found by table()->FindTransitions(), unless it is -1.
+  void FollowTransition(int target, WorldTime current_time);
+
   const CharacterState* current_state() const { return current_state_; }
+  int current_state_id() const { return current_state_id_; }
+  const CharacterStateMachineTable* table() const { return table_; }
 
   void SetCurrentState(int new_stateId, WorldTime state_start_time);
 
@@ -66,8 +138,10 @@ class CharacterStateMachine {
   }
 
  private:
+  const CharacterStateMachineTable* table_;
   const CharacterStateMachineDef* state_machine_def_;
   const CharacterState* current_state_;
+  int current_state_id_;
   WorldTime current_state_start_time_;
 };
 
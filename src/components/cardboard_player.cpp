@@ -161,5 +161,14 @@ void CardboardPlayerComponent::InitEntity(entity::EntityRef& entity) {
   }
 }
 
+void CardboardPlayerComponent::RemapEntityData(
+    CardboardPlayerData* data, const std::vector<size_t>& remap) {
+  data->target_reticle.Remap(remap);
+  data->loaded_pie.Remap(remap);
+  for (int i = 0; i < kMaxHealthAccessories; i++) {
+    data->health[i].Remap(remap);
+  }
+}
+
 }  // pie noon
 }  // fpl
@@ -25,14 +25,19 @@ using mathfu::vec3;
 // Gives a child scene object behavior such that it waits for a while,
 // and then slowly sinks, while shrinking.  It's used to govern behavior
 // for splatters on the background.
+//
+// Most splatters are just waiting, and only need their lifetime counted down,
+// so their scene object is only looked up once they start to slide.
 void DripAndVanishComponent::UpdateAllEntities(entity::WorldTime delta_time) {
-  for (auto iter = entity_data_.begin(); iter != entity_data_.end(); ++iter) {
-    SceneObjectData* so_data = Data<SceneObjectData>(iter->entity);
-    DripAndVanishData* dv_data = GetEntityData(iter->entity);
+  SceneObjectComponent* scene_objects = GetComponent<SceneObjectComponent>();
+  for (auto iter = begin(); iter != end(); ++iter) {
+    DripAndVanishData* dv_data = &iter->data;
 
     dv_data->lifetime_remaining -= delta_time;
     if (dv_data->lifetime_remaining > 0) {
       if (dv_data->lifetime_remaining < dv_data->slide_time) {
+        SceneObjectData* so_data = scene_objects->GetEntityData(iter->entity);
+        if (so_data == nullptr) continue;
         float slide_amount =
             1.0f - dv_data->lifetime_remaining / dv_data->slide_time;
 
@@ -51,7 +56,7 @@ void DripAndVanishComponent::UpdateAllEntities(entity::WorldTime delta_time) {
         so_data->SetScale(relative_scale);
       }
     } else {
-      entity_manager_->DeleteEntity(iter->entity);
+      commands().DeleteEntity(iter->entity);
     }
   }
 }
@@ -35,7 +35,9 @@ struct DripAndVanishData {
 
 // Basic behavior for pie splatters:  They stay there for a while,
 // and then they slowly drip down and vanish.
-class DripAndVanishComponent : public entity::Component<DripAndVanishData> {
+// There can be a lot of them, so their data is packed together with DensePool.
+class DripAndVanishComponent
+    : public entity::Component<DripAndVanishData, DensePool> {
  public:
   virtual void AddFromRawData(entity::EntityRef& entity, const void* data);
   virtual void UpdateAllEntities(entity::WorldTime /*delta_time*/);
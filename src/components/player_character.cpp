@@ -126,13 +126,16 @@ int PlayerCharacterComponent::PopulatePieAccessories(entity::EntityRef entity,
   const WorldTime anim_time = gamestate_ptr_->GetAnimationTime(*character);
 
   if (timeline) {
-    // Get accessories that are valid for the current time.
-    const std::vector<int> accessory_indices =
-        TimelineIndicesWithTime(timeline->accessories(), anim_time);
+    // Get accessories that are valid for the current time, as many as there
+    // are entities left for.
+    int accessory_indices[kMaxAccessories];
+    const int num_indices = TimelineIndicesWithTime(
+        timeline->accessories(), anim_time, accessory_indices,
+        kMaxAccessories - num_accessories);
 
-    for (auto it = accessory_indices.begin(); it != accessory_indices.end();
-         ++it) {
-      const TimelineAccessory& accessory = *timeline->accessories()->Get(*it);
+    for (int i = 0; i < num_indices; ++i) {
+      const TimelineAccessory& accessory =
+          *timeline->accessories()->Get(accessory_indices[i]);
 
       entity::EntityRef& accessory_entity =
           pc_data->accessories[num_accessories];
@@ -278,5 +281,14 @@ void PlayerCharacterComponent::InitEntity(entity::EntityRef& entity) {
   }
 }
 
+void PlayerCharacterComponent::RemapEntityData(
+    PlayerCharacterData* data, const std::vector<size_t>& remap) {
+  data->base_circle.Remap(remap);
+  data->character.Remap(remap);
+  for (int i = 0; i < kMaxAccessories; i++) {
+    data->accessories[i].Remap(remap);
+  }
+}
+
 }  // pie noon
 }  // fpl
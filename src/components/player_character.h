@@ -45,6 +45,8 @@ class PlayerCharacterComponent : public entity::Component<PlayerCharacterData> {
   virtual void AddFromRawData(entity::EntityRef& entity, const void* data);
   virtual void UpdateAllEntities(entity::WorldTime delta_time);
   virtual void InitEntity(entity::EntityRef& entity);
+  virtual void RemapEntityData(PlayerCharacterData* data,
+                               const std::vector<size_t>& remap);
   void set_gamestate_ptr(GameState* gamestate_ptr) {
     gamestate_ptr_ = gamestate_ptr;
   }
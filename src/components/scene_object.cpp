@@ -13,9 +13,13 @@
 // limitations under the License.
 
 #include "scene_object.h"
+#include "cardboard_player.h"
+#include "drip_and_vanish.h"
 #include "motive/math/angle.h"
 #include "components_generated.h"
 #include "motive/init.h"
+#include "player_character.h"
+#include "shakeable_prop.h"
 #include "utilities.h"
 
 namespace fpl {
@@ -45,6 +49,8 @@ static const motive::MatrixOperationType kTransformOperations[] = {
     motive::kScaleZ,        // kScaleZ
 };
 
+const size_t SceneObjectComponent::kNoParent;
+
 void SceneObjectData::Initialize(motive::MotiveEngine* engine) {
   MATHFU_STATIC_ASSERT(PIE_ARRAYSIZE(kTransformOperations) ==
                        kNumTransformMatrixOperations);
@@ -63,6 +69,19 @@ void SceneObjectData::Initialize(motive::MotiveEngine* engine) {
   transform_.Initialize(init, engine);
 }
 
+void SceneObjectComponent::Init() {
+  // These move scene objects around, so they need to be done before we look
+  // at the scene objects.
+  entity_manager_->AddUpdateDependency<SceneObjectComponent,
+                                       ShakeablePropComponent>();
+  entity_manager_->AddUpdateDependency<SceneObjectComponent,
+                                       DripAndVanishComponent>();
+  entity_manager_->AddUpdateDependency<SceneObjectComponent,
+                                       PlayerCharacterComponent>();
+  entity_manager_->AddUpdateDependency<SceneObjectComponent,
+                                       CardboardPlayerComponent>();
+}
+
 void SceneObjectComponent::AddFromRawData(entity::EntityRef& entity,
                                           const void* raw_data) {
   auto component_data = static_cast<const ComponentDefInstance*>(raw_data);
@@ -88,71 +107,158 @@ void SceneObjectComponent::AddFromRawData(entity::EntityRef& entity,
 void SceneObjectComponent::InitEntity(entity::EntityRef& entity) {
   SceneObjectData* data = GetEntityData(entity);
   data->Initialize(engine_);
+  hierarchy_dirty_ = true;
 }
 
-void SceneObjectComponent::UpdateGlobalMatrix(
-    entity::EntityRef& entity,
-    std::vector<bool>& matrix_updated) {
-  const size_t data_index = GetEntityDataIndex(entity);
-  SceneObjectData* data = GetEntityData(data_index);
-
-  if (data->HasParent()) {
-    // Recurse into parent if its matrix has not been calculated.
-    const size_t parent_index = GetEntityDataIndex(data->parent());
-    if (!matrix_updated[parent_index]) {
-      UpdateGlobalMatrix(data->parent(), matrix_updated);
-    }
+void SceneObjectComponent::UpdateAllEntities(
+    entity::WorldTime /*delta_time*/) {
+  // The components that move scene objects have updated, and the
+  // MotiveEngine advances next.
+  for (auto iter = entity_data_.begin(); iter != entity_data_.end(); ++iter) {
+    iter->data.LatchTransformChanges();
+  }
+}
 
-    // Multiply our local matrix by our parent's global matrix to get our
-    // global matrix.
-    SceneObjectData* parent = GetEntityData(parent_index);
-    data->set_global_matrix(parent->global_matrix() * data->LocalMatrix());
-  } else {
+void SceneObjectComponent::CleanupEntity(entity::EntityRef& /*entity*/) {
+  hierarchy_dirty_ = true;
+}
 
-    // No parent means that our local matrix equals the global matrix.
-    data->set_global_matrix(data->LocalMatrix());
-  }
+void SceneObjectComponent::CompactEntityData() {
+  entity::Component<SceneObjectData, DensePool>::CompactEntityData();
+  hierarchy_dirty_ = true;
+}
 
-  // Remember that we've calculated this matrix so we don't try to calculate
-  // it again.
-  matrix_updated[data_index] = true;
+void SceneObjectComponent::RemapEntityData(SceneObjectData* data,
+                                           const std::vector<size_t>& remap) {
+  data->parent().Remap(remap);
 }
 
-// Traverse scene hierarchy convert local matrices into global matrices.
-void SceneObjectComponent::UpdateGlobalMatrices() {
-  std::vector<bool> matrix_updated(entity_data_.Size(), false);
+// Returns the data index of the parent, or kNoParent if there isn't one.
+size_t SceneObjectComponent::ParentIndex(const SceneObjectData& data) const {
+  // A parent that isn't a scene object doesn't move its children.
+  if (!data.HasParent() || GetEntityData(data.parent()) == nullptr) {
+    return kNoParent;
+  }
+  return GetEntityDataIndex(data.parent());
+}
+
+// Sort the scene objects by their depth in the hierarchy, so that every
+// parent comes before its children.
+void SceneObjectComponent::SortHierarchy() {
+  const size_t num_indices = entity_data_.Size();
+  depths_.assign(num_indices, 0);
+  level_starts_.clear();
+
+  // Count the objects at each depth.
+  for (auto iter = entity_data_.begin(); iter != entity_data_.end(); ++iter) {
+    size_t depth = 0;
+    for (size_t parent = ParentIndex(iter->data); parent != kNoParent;
+         parent = ParentIndex(*GetEntityData(parent))) {
+      depth++;
+      assert(depth < num_indices);  // The hierarchy can't have cycles.
+    }
+    depths_[iter.index()] = depth;
+    if (depth >= level_starts_.size()) level_starts_.resize(depth + 1, 0);
+    level_starts_[depth]++;
+  }
+  size_t start = 0;
+  for (size_t depth = 0; depth < level_starts_.size(); ++depth) {
+    const size_t count = level_starts_[depth];
+    level_starts_[depth] = start;
+    start += count;
+  }
 
-  // Loop through every entity and update its global matrix.
+  // Place each object after the others at its depth.
+  hierarchy_.resize(entity_data_.active_count());
+  positions_.assign(num_indices, kNoParent);
   for (auto iter = entity_data_.begin(); iter != entity_data_.end(); ++iter) {
+    const size_t position = level_starts_[depths_[iter.index()]]++;
+    positions_[iter.index()] = position;
+    HierarchyNode& node = hierarchy_[position];
+    node.index = iter.index();
+    node.parent_index = ParentIndex(iter->data);
+    node.visible = false;
+    node.matrix_changed = true;
+  }
+  // Placing the objects moved each depth's start along to the next one's.
+  if (!level_starts_.empty()) {
+    level_starts_.pop_back();
+    level_starts_.insert(level_starts_.begin(), 0);
+  }
 
-    // The update process is recursive, so we may have already calculated a
-    // matrix by the time we get there. If so, skip over it.
-    if (!matrix_updated[iter.index()] && iter->data.visible()) {
-      UpdateGlobalMatrix(iter->entity, matrix_updated);
+  for (size_t i = 0; i < hierarchy_.size(); ++i) {
+    HierarchyNode& node = hierarchy_[i];
+    node.parent_position = node.parent_index == kNoParent
+                               ? kNoParent
+                               : positions_[node.parent_index];
+  }
+  hierarchy_dirty_ = false;
+  hierarchy_sorted_ = true;
+}
+
+// Walk the hierarchy in order, converting local matrices into global
+// matrices and working out which objects are visible. A global matrix is
+// only recalculated if the object's transform or its parent's global matrix
+// changed. Returns false, part way through, if an object's parent has changed
+// since the hierarchy was sorted.
+bool SceneObjectComponent::UpdateHierarchy() {
+  const size_t num_roots =
+      level_starts_.size() > 1 ? level_starts_[1] : hierarchy_.size();
+  matrices_updated_ = 0;
+  matrices_skipped_ = 0;
+  for (size_t i = 0; i < hierarchy_.size(); ++i) {
+    HierarchyNode& node = hierarchy_[i];
+    SceneObjectData* data = GetEntityData(node.index);
+    if (ParentIndex(*data) != node.parent_index) return false;
+
+    if (i < num_roots) {
+      node.matrix_changed = hierarchy_sorted_ || data->matrix_dirty();
+      if (node.matrix_changed) {
+        // No parent means that our local matrix equals the global matrix.
+        data->set_global_matrix(data->LocalMatrix());
+      }
+      node.visible = data->visible();
+    } else {
+      // The parent came earlier, so it's up to date.
+      const HierarchyNode& parent = hierarchy_[node.parent_position];
+      node.matrix_changed =
+          hierarchy_sorted_ || parent.matrix_changed || data->matrix_dirty();
+      if (node.matrix_changed) {
+        // Multiply our local matrix by our parent's global matrix to get our
+        // global matrix.
+        data->set_global_matrix(GetEntityData(parent.index)->global_matrix() *
+                                data->LocalMatrix());
+      }
+      node.visible = parent.visible && data->visible();
+    }
+
+    if (node.matrix_changed) {
+      data->clear_matrix_dirty();
+      matrices_updated_++;
+    } else {
+      matrices_skipped_++;
     }
   }
+  hierarchy_sorted_ = false;
+  return true;
 }
 
-bool SceneObjectComponent::VisibleInHierarchy(
-    const entity::EntityRef& entity) const {
-  const SceneObjectData* data = GetEntityData(entity);
-  if (!data->HasParent()) {
-    return data->visible();
-  } else {
-    return data->visible() && VisibleInHierarchy(data->parent());
+void SceneObjectComponent::UpdateGlobalMatrices() {
+  if (hierarchy_dirty_ || !UpdateHierarchy()) {
+    SortHierarchy();
+    UpdateHierarchy();
   }
 }
 
 void SceneObjectComponent::PopulateScene(SceneDescription* scene) {
   UpdateGlobalMatrices();
 
-  for (auto iter = entity_data_.begin(); iter != entity_data_.end(); ++iter) {
-    entity::EntityRef entity = iter->entity;
-    if (VisibleInHierarchy(entity)) {
-      SceneObjectData* data = GetEntityData(entity);
-      scene->renderables().push_back(std::unique_ptr<Renderable>(new Renderable(
-          data->renderable_id(), data->global_matrix(), data->tint())));
-    }
+  scene->ReserveRenderables(hierarchy_.size());
+  for (size_t i = 0; i < hierarchy_.size(); ++i) {
+    if (!hierarchy_[i].visible) continue;
+    const SceneObjectData* data = GetEntityData(hierarchy_[i].index);
+    scene->renderables().push_back(Renderable(
+        data->renderable_id(), data->global_matrix(), data->tint()));
   }
 }
 
@@ -36,7 +36,9 @@ class SceneObjectData {
       : global_matrix_(mathfu::mat4::Identity()),
         tint_(mathfu::kOnes4f),
         renderable_id_(0),
-        visible_(true) {
+        visible_(true),
+        transform_changed_(true),
+        matrix_dirty_(true) {
   }
   void Initialize(motive::MotiveEngine* engine);
 
@@ -55,46 +57,46 @@ class SceneObjectData {
   // TODO: Allow callers to set up their own transformation pipeline, instead
   // of using this fixed one.
   void SetRotation(const mathfu::vec3& rotation) {
-    transform_.SetChildValue3f(kRotateAboutX, rotation);
+    SetTransformValue3f(kRotateAboutX, rotation);
   }
   void SetRotationAboutX(float angle) {
-    transform_.SetChildValue1f(kRotateAboutX, angle);
+    SetTransformValue1f(kRotateAboutX, angle);
   }
   void SetRotationAboutY(float angle) {
-    transform_.SetChildValue1f(kRotateAboutY, angle);
+    SetTransformValue1f(kRotateAboutY, angle);
   }
   void SetRotationAboutZ(float angle) {
-    transform_.SetChildValue1f(kRotateAboutZ, angle);
+    SetTransformValue1f(kRotateAboutZ, angle);
   }
   void SetRotationAboutAxis(float angle, Axis axis) {
-    transform_.SetChildValue1f(kRotateAboutX + axis, angle);
+    SetTransformValue1f(kRotateAboutX + axis, angle);
   }
   void SetPreRotation(const mathfu::vec3& rotation) {
-    transform_.SetChildValue3f(kPreRotateAboutX, rotation);
+    SetTransformValue3f(kPreRotateAboutX, rotation);
   }
   void SetPreRotationAboutX(float angle) {
-    transform_.SetChildValue1f(kPreRotateAboutX, angle);
+    SetTransformValue1f(kPreRotateAboutX, angle);
   }
   void SetPreRotationAboutY(float angle) {
-    transform_.SetChildValue1f(kPreRotateAboutY, angle);
+    SetTransformValue1f(kPreRotateAboutY, angle);
   }
   void SetPreRotationAboutZ(float angle) {
-    transform_.SetChildValue1f(kPreRotateAboutZ, angle);
+    SetTransformValue1f(kPreRotateAboutZ, angle);
   }
   void SetPreRotationAboutAxis(float angle, Axis axis) {
-    transform_.SetChildValue1f(kPreRotateAboutX + axis, angle);
+    SetTransformValue1f(kPreRotateAboutX + axis, angle);
   }
   void SetTranslation(const mathfu::vec3& translation) {
-    transform_.SetChildValue3f(kTranslateX, translation);
+    SetTransformValue3f(kTranslateX, translation);
   }
   void SetScale(const mathfu::vec3& scale) {
-    transform_.SetChildValue3f(kScaleX, scale);
+    SetTransformValue3f(kScaleX, scale);
   }
-  void SetScaleX(float scale) { transform_.SetChildValue1f(kScaleX, scale); }
-  void SetScaleY(float scale) { transform_.SetChildValue1f(kScaleY, scale); }
-  void SetScaleZ(float scale) { transform_.SetChildValue1f(kScaleZ, scale); }
+  void SetScaleX(float scale) { SetTransformValue1f(kScaleX, scale); }
+  void SetScaleY(float scale) { SetTransformValue1f(kScaleY, scale); }
+  void SetScaleZ(float scale) { SetTransformValue1f(kScaleZ, scale); }
   void SetOriginPoint(const mathfu::vec3& origin) {
-    transform_.SetChildValue3f(kTranslateToOriginX, -origin);
+    SetTransformValue3f(kTranslateToOriginX, -origin);
   }
 
   // Get components of the transformation from object-to-local space.
@@ -132,7 +134,28 @@ class SceneObjectData {
   bool visible() const { return visible_; }
   void set_visible(bool visible) { visible_ = visible; }
 
+  // Changes to the transform only reach LocalMatrix() when the MotiveEngine
+  // next advances. Call this before it does, to mark the global matrix as
+  // needing recalculation after it has.
+  void LatchTransformChanges() {
+    matrix_dirty_ = matrix_dirty_ || transform_changed_;
+    transform_changed_ = false;
+  }
+  // Whether LocalMatrix() may have changed since the global matrix was last
+  // calculated.
+  bool matrix_dirty() const { return matrix_dirty_; }
+  void clear_matrix_dirty() { matrix_dirty_ = false; }
+
  private:
+  void SetTransformValue1f(int op, float value) {
+    transform_.SetChildValue1f(op, value);
+    transform_changed_ = true;
+  }
+  void SetTransformValue3f(int op, const mathfu::vec3& value) {
+    transform_.SetChildValue3f(op, value);
+    transform_changed_ = true;
+  }
+
   // Basic matrix operations from with 'transform_.Value()' is calculated.
   // These operations are applied last-to-first to convert the object from
   // object space (i.e. the space in which it was authored) to local space
@@ -178,25 +201,85 @@ class SceneObjectData {
 
   // Whether object is currently on-screen or not.
   bool visible_;
+
+  // Whether the transform has been set since the last
+  // LatchTransformChanges().
+  bool transform_changed_;
+
+  // Whether the global matrix needs to be recalculated.
+  bool matrix_dirty_;
 };
 
 // A sceneobject is "a thing I want to place in the scene and move around."
 // So it contains basic drawing info.
-class SceneObjectComponent : public entity::Component<SceneObjectData> {
+// Every scene object is visited each frame when the scene is populated, so
+// their data is packed together with DensePool.
+class SceneObjectComponent
+    : public entity::Component<SceneObjectData, DensePool> {
  public:
   explicit SceneObjectComponent(motive::MotiveEngine* engine)
-      : engine_(engine) {}
+      : engine_(engine),
+        hierarchy_dirty_(true),
+        hierarchy_sorted_(false),
+        matrices_updated_(0),
+        matrices_skipped_(0) {}
+  virtual void Init();
   virtual void AddFromRawData(entity::EntityRef& entity, const void* data);
   virtual void InitEntity(entity::EntityRef& entity);
+  virtual void UpdateAllEntities(entity::WorldTime delta_time);
+  virtual void CleanupEntity(entity::EntityRef& entity);
+  virtual void CompactEntityData();
+  virtual void RemapEntityData(SceneObjectData* data,
+                               const std::vector<size_t>& remap);
   void PopulateScene(SceneDescription* scene);
 
+  // How many global matrices the last PopulateScene() calculated, and how
+  // many it left alone because neither the object nor its ancestors moved.
+  int matrices_updated() const { return matrices_updated_; }
+  int matrices_skipped() const { return matrices_skipped_; }
+
  private:
-  void UpdateGlobalMatrix(entity::EntityRef& entity,
-                          std::vector<bool>& matrix_calculated);
+  // A scene object's place in the hierarchy. Parents always come before
+  // their children in 'hierarchy_', so walking it in order visits each
+  // parent's global matrix and visibility before they're needed.
+  struct HierarchyNode {
+    // Data index of the scene object, and of its parent or kNoParent.
+    size_t index;
+    size_t parent_index;
+    // Position of the parent in 'hierarchy_', or kNoParent.
+    size_t parent_position;
+    // Whether the object and all of its ancestors are visible.
+    bool visible;
+    // Whether the global matrix changed in the last UpdateHierarchy().
+    bool matrix_changed;
+  };
+  static const size_t kNoParent = static_cast<size_t>(-1);
+
+  size_t ParentIndex(const SceneObjectData& data) const;
+  void SortHierarchy();
+  bool UpdateHierarchy();
   void UpdateGlobalMatrices();
-  bool VisibleInHierarchy(const entity::EntityRef& entity) const;
 
   motive::MotiveEngine* engine_;
+
+  // Scene objects in parent-before-child order, sorted by depth in the
+  // hierarchy. Rebuilt only when objects are added or removed, or a parent
+  // changes.
+  std::vector<HierarchyNode> hierarchy_;
+  // Position in 'hierarchy_' of the first object at each depth.
+  std::vector<size_t> level_starts_;
+  bool hierarchy_dirty_;
+  // Set when the hierarchy has been sorted, so every global matrix needs
+  // recalculating.
+  bool hierarchy_sorted_;
+
+  int matrices_updated_;
+  int matrices_skipped_;
+
+  // Scratch space for SortHierarchy(), kept to reuse storage. Indexed by
+  // data index.
+  std::vector<size_t> depths_;
+  std::vector<size_t> positions_;
 };
 
 }  // pie_noon
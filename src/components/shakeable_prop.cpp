@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <assert.h>
+#include "entity/component_view.h"
 #include "scene_object.h"
 #include "shakeable_prop.h"
 #include "utilities.h"
@@ -26,11 +27,11 @@ namespace pie_noon {
 
 void ShakeablePropComponent::UpdateAllEntities(
     entity::WorldTime /*delta_time*/) {
-  for (auto iter = entity_data_.begin(); iter != entity_data_.end(); ++iter) {
-    entity::EntityRef entity = iter->entity;
-    ShakeablePropData* sp_data = GetEntityData(iter->entity);
-    SceneObjectData* so_data = Data<SceneObjectData>(entity);
-    assert(so_data != nullptr && sp_data != nullptr);
+  entity::ComponentView<ShakeablePropComponent, SceneObjectComponent> view(
+      entity_manager_);
+  for (auto iter = view.begin(); iter != view.end(); ++iter) {
+    ShakeablePropData* sp_data = iter.primary_data();
+    SceneObjectData* so_data = iter.secondary_data();
 
     if (sp_data->motivator.Valid()) {
       so_data->SetPreRotationAboutAxis(sp_data->motivator.Value(),
@@ -58,7 +59,11 @@ void ShakeablePropComponent::AddFromRawData(entity::EntityRef& entity,
   entity_data->axis = sp_data->shake_axis();
   entity_data->shake_scale = sp_data->shake_scale();
 
-  if (sp_data->shake_motivator() != MotivatorSpecification_None) {
+  if (entity_data->motivator.Valid()) {
+    // The prop is being reset for a new round, so bring it to rest rather
+    // than making a new motivator.
+    entity_data->motivator.SetTarget(motive::Current1f(0.0f));
+  } else if (sp_data->shake_motivator() != MotivatorSpecification_None) {
     motive::OvershootInit scaled_shake_init =
         motivator_inits[sp_data->shake_motivator()];
     scaled_shake_init.set_range(scaled_shake_init.range() *
@@ -89,39 +94,64 @@ void ShakeablePropComponent::CleanupEntity(entity::EntityRef& entity) {
 }
 
 // General function to shake props when something hits near them.
-// Usually called by gamestate, in response to a pie landing.
-void ShakeablePropComponent::ShakeProps(float damage_percent,
-                                        const vec3& damage_position) {
-  (void)damage_percent;
-  (void)damage_position;
-
-  for (auto iter = entity_data_.begin(); iter != entity_data_.end(); ++iter) {
-    ShakeablePropData* data = &iter->data;
+// Usually called by gamestate, with the pies that landed this frame.
+void ShakeablePropComponent::ShakeProps(const std::vector<PropShake>& shakes) {
+  if (shakes.empty()) return;
+  const float max_distance = config_->prop_shake_max_distance();
+  const float max_distance_sq = max_distance * max_distance;
+
+  // Props outside the box around all the shakes, grown by max_distance, are
+  // too far from every one of them to shake.
+  vec3 box_min(shakes[0].position);
+  vec3 box_max(shakes[0].position);
+  for (size_t i = 1; i < shakes.size(); ++i) {
+    box_min = vec3::Min(box_min, vec3(shakes[i].position));
+    box_max = vec3::Max(box_max, vec3(shakes[i].position));
+  }
+  box_min -= vec3(max_distance);
+  box_max += vec3(max_distance);
 
-    SceneObjectData* so_data = Data<SceneObjectData>(iter->entity);
+  entity::ComponentView<ShakeablePropComponent, SceneObjectComponent> view(
+      entity_manager_);
+  for (auto iter = view.begin(); iter != view.end(); ++iter) {
+    ShakeablePropData* data = iter.primary_data();
+    SceneObjectData* so_data = iter.secondary_data();
 
     float shake_scale = data->shake_scale;
-    if (shake_scale == 0.0f) {
+    if (shake_scale == 0.0f || !data->motivator.Valid()) {
+      continue;
+    }
+
+    const vec3 prop_position = so_data->GlobalPosition();
+    if (max_distance > 0.0f &&
+        (prop_position.x() < box_min.x() || prop_position.x() > box_max.x() ||
+         prop_position.y() < box_min.y() || prop_position.y() > box_max.y() ||
+         prop_position.z() < box_min.z() || prop_position.z() > box_max.z())) {
       continue;
     }
 
+    // The closer the prop is to each shake, the more it should shake.
+    // The effect trails off with distance squared.
+    float shake_amount = 0.0f;
+    for (size_t i = 0; i < shakes.size(); ++i) {
+      const float distance_sq =
+          (vec3(shakes[i].position) - prop_position).LengthSquared();
+      if (max_distance > 0.0f && distance_sq > max_distance_sq) continue;
+      const float closeness = mathfu::Clamp(
+          config_->prop_shake_identity_distance_sq() / distance_sq, 0.01f,
+          1.0f);
+      shake_amount += shakes[i].percent * closeness;
+    }
+    if (shake_amount == 0.0f) continue;
+
     // We always want to add to the speed, so if the current velocity is
     // negative, we add a negative amount.
     const float current_velocity = data->motivator.Velocity();
     const float current_direction = current_velocity >= 0.0f ? 1.0f : -1.0f;
 
-    // The closer the prop is to the damage_position, the more it should shake.
-    // The effect trails off with distance squared.
-    const vec3 prop_position = so_data->GlobalPosition();
-    const float closeness =
-        mathfu::Clamp(config_->prop_shake_identity_distance_sq() /
-                          (damage_position - prop_position).LengthSquared(),
-                      0.01f, 1.0f);
-
     // Velocity added is the product of all the factors.
-    const float delta_velocity = current_direction * damage_percent *
-                                 closeness * shake_scale *
-                                 config_->prop_shake_velocity();
+    const float delta_velocity = current_direction * shake_amount *
+                                 shake_scale * config_->prop_shake_velocity();
     const float new_velocity = current_velocity + delta_velocity;
     const float current_value = data->motivator.Value();
     data->motivator.SetTarget(motive::Current1f(current_value, new_velocity));
@@ -28,6 +28,12 @@
 namespace fpl {
 namespace pie_noon {
 
+// A shake of the props around a point, e.g. where a pie landed.
+struct PropShake {
+  mathfu::vec3_packed position;
+  float percent;
+};
+
 struct ShakeablePropData {
   ShakeablePropData() {}
   float shake_scale;
@@ -45,7 +51,9 @@ class ShakeablePropComponent : public entity::Component<ShakeablePropData> {
   void set_config(const Config* config) { config_ = config; }
   void set_engine(motive::MotiveEngine* engine) { engine_ = engine; }
   void LoadMotivatorSpecs();
-  void ShakeProps(float damage_percent, const mathfu::vec3& damage_position);
+  // Shake the props near any of 'shakes'. Each prop that moves gets a single
+  // new motivator target, however many shakes it's near.
+  void ShakeProps(const std::vector<PropShake>& shakes);
 
  private:
   const Config* config_;
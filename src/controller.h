@@ -63,6 +63,12 @@ class Controller {
   // Clear all the currently set logical inputs.
   void ClearAllLogicalInputs();
 
+  // Clear what went down or up, but keep what is down.
+  void ClearInputEdges() {
+    went_down_ = 0;
+    went_up_ = 0;
+  }
+
  protected:
   // A bitfield of currently active logical input bits.
   uint32_t is_down_;
@@ -0,0 +1,231 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "draw_list.h"
+#include "renderer.h"
+
+namespace fpl {
+
+typedef VertexFormat<Position3f, TexCoord2f> QuadFormat;
+static const int kQuadVertexFloats = 5;
+static_assert(QuadFormat::kSize == sizeof(float) * kQuadVertexFloats,
+              "Quad vertices must be in QuadFormat.");
+
+// 64-bit FNV-1a, for DrawList::signature().
+static const uint64_t kSignatureBasis = 14695981039346656037ULL;
+static const uint64_t kSignaturePrime = 1099511628211ULL;
+
+// Screen space bounds of a quad, as (min x, min y, max x, max y).
+static vec4 QuadBounds(const vec3& bottom_left, const vec3& top_right) {
+  return vec4(std::min(bottom_left.x(), top_right.x()),
+              std::min(bottom_left.y(), top_right.y()),
+              std::max(bottom_left.x(), top_right.x()),
+              std::max(bottom_left.y(), top_right.y()));
+}
+
+static bool Overlaps(const vec4& a, const vec4& b) {
+  return a.x() < b.z() && b.x() < a.z() && a.y() < b.w() && b.y() < a.w();
+}
+
+DrawList::DrawList()
+    : num_batches_(0),
+      clip_rect_(mathfu::kZeros4i),
+      clipped_(false),
+      last_draw_calls_(0),
+      signature_(kSignatureBasis) {}
+
+void DrawList::AddQuad(Shader* shader, Material* material, const vec4& color,
+                       const vec3& bottom_left, const vec3& top_right,
+                       const vec2& tex_bottom_left,
+                       const vec2& tex_top_right) {
+  AddQuad(shader, material, nullptr, color, bottom_left, top_right,
+          tex_bottom_left, tex_top_right);
+}
+
+void DrawList::AddQuad(Shader* shader, const Texture* texture,
+                       const vec4& color, const vec3& bottom_left,
+                       const vec3& top_right, const vec2& tex_bottom_left,
+                       const vec2& tex_top_right) {
+  AddQuad(shader, nullptr, texture, color, bottom_left, top_right,
+          tex_bottom_left, tex_top_right);
+}
+
+bool DrawList::Matches(const Batch& batch, Shader* shader, Material* material,
+                       const Texture* texture, const vec4& color) const {
+  if (batch.shader != shader || batch.material != material ||
+      batch.texture != texture || batch.clipped != clipped_ ||
+      batch.quads.size() >= kMaxBatchQuads) {
+    return false;
+  }
+  for (int i = 0; i < 4; ++i) {
+    if (batch.color[i] != color[i]) return false;
+    if (clipped_ && batch.clip_rect[i] != clip_rect_[i]) return false;
+  }
+  return true;
+}
+
+void DrawList::AddQuad(Shader* shader, Material* material,
+                       const Texture* texture, const vec4& color,
+                       const vec3& bottom_left, const vec3& top_right,
+                       const vec2& tex_bottom_left,
+                       const vec2& tex_top_right) {
+  const vec4 bounds = QuadBounds(bottom_left, top_right);
+
+  // Look for a batch this quad can join. We can only go back past batches
+  // that don't overlap it, since those are drawn after the one we join.
+  Batch* batch = nullptr;
+  for (size_t i = num_batches_; i-- > 0;) {
+    Batch& candidate = batches_[i];
+    if (Matches(candidate, shader, material, texture, color)) {
+      batch = &candidate;
+      break;
+    }
+    if (!Overlaps(candidate.bounds, bounds)) continue;
+    bool overlap = false;
+    for (auto it = candidate.quads.begin();
+         it != candidate.quads.end() && !overlap; ++it) {
+      overlap = Overlaps(
+          QuadBounds(vec3(it->bottom_left), vec3(it->top_right)), bounds);
+    }
+    if (overlap) break;
+  }
+
+  if (batch == nullptr) {
+    if (num_batches_ == batches_.size()) batches_.push_back(Batch());
+    batch = &batches_[num_batches_++];
+    batch->shader = shader;
+    batch->material = material;
+    batch->texture = texture;
+    batch->color = color;
+    batch->clip_rect = clip_rect_;
+    batch->clipped = clipped_;
+    batch->bounds = bounds;
+    batch->quads.clear();
+  } else {
+    batch->bounds = vec4(vec2::Min(batch->bounds.xy(), bounds.xy()),
+                         vec2::Max(batch->bounds.zw(), bounds.zw()));
+  }
+
+  Quad quad;
+  quad.bottom_left = bottom_left;
+  quad.top_right = top_right;
+  quad.tex_bottom_left = tex_bottom_left;
+  quad.tex_top_right = tex_top_right;
+  batch->quads.push_back(quad);
+
+  AddToSignature(&shader, sizeof(shader));
+  AddToSignature(&material, sizeof(material));
+  AddToSignature(&texture, sizeof(texture));
+  AddToSignature(&color, sizeof(color));
+  AddToSignature(&clipped_, sizeof(clipped_));
+  if (clipped_) AddToSignature(&clip_rect_, sizeof(clip_rect_));
+  AddToSignature(&quad, sizeof(quad));
+  // Textures that finish loading, or get evicted, change what's drawn.
+  if (material) {
+    for (auto it = material->textures().begin();
+         it != material->textures().end(); ++it) {
+      AddToSignature(&(*it)->id(), sizeof(GLuint));
+    }
+  }
+  if (texture) AddToSignature(&texture->id(), sizeof(GLuint));
+}
+
+void DrawList::AddToSignature(const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    signature_ = (signature_ ^ bytes[i]) * kSignaturePrime;
+  }
+}
+
+void DrawList::Discard() {
+  for (size_t b = 0; b < num_batches_; ++b) {
+    const Batch& batch = batches_[b];
+    if (batch.material) {
+      for (auto it = batch.material->textures().begin();
+           it != batch.material->textures().end(); ++it) {
+        (*it)->MarkUsed();
+      }
+    }
+    if (batch.texture) batch.texture->MarkUsed();
+  }
+  num_batches_ = 0;
+  signature_ = kSignatureBasis;
+}
+
+void DrawList::SetClipRect(const vec2i& position, const vec2i& size) {
+  clip_rect_ = vec4i(position.x(), position.y(), size.x(), size.y());
+  clipped_ = true;
+}
+
+void DrawList::ClearClipRect() { clipped_ = false; }
+
+void DrawList::ApplyClipRect(bool clipped, const vec4i& clip_rect) {
+  if (clipped) {
+    GL_CALL(glEnable(GL_SCISSOR_TEST));
+    GL_CALL(glScissor(clip_rect.x(), clip_rect.y(), clip_rect.z(),
+                      clip_rect.w()));
+  } else {
+    GL_CALL(glDisable(GL_SCISSOR_TEST));
+  }
+}
+
+void DrawList::Flush(Renderer& renderer) {
+  last_draw_calls_ = 0;
+  for (size_t b = 0; b < num_batches_; ++b) {
+    const Batch& batch = batches_[b];
+    const size_t count = batch.quads.size();
+    vertices_.resize(count * 4 * kQuadVertexFloats);
+    indices_.resize(count * 6);
+
+    // Same vertex order as Mesh::RenderAAQuadAlongX().
+    for (size_t i = 0; i < count; ++i) {
+      const Quad& quad = batch.quads[i];
+      const vec3 bl(quad.bottom_left);
+      const vec3 tr(quad.top_right);
+      const vec2 tbl(quad.tex_bottom_left);
+      const vec2 ttr(quad.tex_top_right);
+      const float vertices[] = {
+          bl.x(), bl.y(), bl.z(), tbl.x(), tbl.y(),
+          tr.x(), bl.y(), bl.z(), ttr.x(), tbl.y(),
+          bl.x(), tr.y(), tr.z(), tbl.x(), ttr.y(),
+          tr.x(), tr.y(), tr.z(), ttr.x(), ttr.y()};
+      memcpy(&vertices_[i * 4 * kQuadVertexFloats], vertices,
+             sizeof(vertices));
+      static const unsigned short kQuadIndices[] = {0, 1, 2, 1, 2, 3};
+      const unsigned short base = static_cast<unsigned short>(i * 4);
+      for (int j = 0; j < 6; ++j) {
+        indices_[i * 6 + j] = base + kQuadIndices[j];
+      }
+    }
+
+    ApplyClipRect(batch.clipped, batch.clip_rect);
+    renderer.color() = batch.color;
+    batch.shader->Set(renderer);
+    if (batch.material) {
+      batch.material->Set(renderer);
+    } else if (batch.texture) {
+      batch.texture->Set(0);
+    }
+    Mesh::RenderArray<QuadFormat>(
+        GL_TRIANGLES, static_cast<int>(indices_.size()),
+        reinterpret_cast<const char*>(&vertices_[0]), &indices_[0]);
+    ++last_draw_calls_;
+  }
+  num_batches_ = 0;
+  signature_ = kSignatureBasis;
+  ApplyClipRect(clipped_, clip_rect_);
+}
+
+}  // namespace fpl
@@ -0,0 +1,124 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_DRAW_LIST_H
+#define FPL_DRAW_LIST_H
+
+#include <vector>
+#include "mesh.h"
+
+namespace fpl {
+
+class Renderer;
+
+// Collects the textured quads of a 2D UI, and draws them with as few calls as
+// possible once the UI is complete.
+//
+// Quads that share a shader, texture, color and clip rect are drawn together.
+// A quad may join a draw that was started earlier, but only if it doesn't
+// overlap any quad queued since, so the result looks the same as drawing
+// every quad in the order it was added.
+class DrawList {
+ public:
+  DrawList();
+
+  // Queue a quad from 'bottom_left' to 'top_right', drawn with 'shader' and
+  // 'material', or a single 'texture'. 'color' is passed to the shader as the
+  // renderer's color. The quad stays in the list until Flush().
+  void AddQuad(Shader* shader, Material* material, const vec4& color,
+               const vec3& bottom_left, const vec3& top_right,
+               const vec2& tex_bottom_left, const vec2& tex_top_right);
+  void AddQuad(Shader* shader, const Texture* texture, const vec4& color,
+               const vec3& bottom_left, const vec3& top_right,
+               const vec2& tex_bottom_left, const vec2& tex_top_right);
+
+  // Clip the quads added from now on to a rect in GL window coordinates
+  // (origin at the bottom left), as passed to glScissor.
+  void SetClipRect(const vec2i& position, const vec2i& size);
+  void ClearClipRect();
+
+  // Draw every queued quad and empty the list. Afterwards, the scissor test
+  // is set to the current clip rect, so that anything drawn directly is
+  // clipped the same way as the quads added now would be.
+  void Flush(Renderer& renderer);
+
+  // Empty the list without drawing it, for when the result of drawing it is
+  // cached. The textures still count as used this frame.
+  void Discard();
+
+  bool empty() const { return num_batches_ == 0; }
+
+  // Hash of everything queued since the last Flush() or Discard(), including
+  // which textures are loaded. The same signature means the same image.
+  uint64_t signature() const { return signature_; }
+
+  // Number of draw calls made by the last Flush(), for profiling.
+  int last_draw_calls() const { return last_draw_calls_; }
+
+ private:
+  struct Quad {
+    vec3_packed bottom_left;
+    vec3_packed top_right;
+    vec2_packed tex_bottom_left;
+    vec2_packed tex_top_right;
+  };
+
+  // Quads that can be drawn with a single call.
+  struct Batch {
+    Shader* shader;
+    Material* material;
+    const Texture* texture;
+    vec4 color;
+    vec4i clip_rect;
+    bool clipped;
+    // Screen space bounds of all quads, as (min x, min y, max x, max y).
+    vec4 bounds;
+    std::vector<Quad> quads;
+  };
+
+  // UI quads are drawn with 16-bit indices.
+  static const size_t kMaxBatchQuads = 0x10000 / 4;
+
+  void AddQuad(Shader* shader, Material* material, const Texture* texture,
+               const vec4& color, const vec3& bottom_left,
+               const vec3& top_right, const vec2& tex_bottom_left,
+               const vec2& tex_top_right);
+
+  // True if quads added now, with this state, could be drawn by 'batch'.
+  bool Matches(const Batch& batch, Shader* shader, Material* material,
+               const Texture* texture, const vec4& color) const;
+
+  void ApplyClipRect(bool clipped, const vec4i& clip_rect);
+
+  void AddToSignature(const void* data, size_t size);
+
+  // Batches are reused between flushes, to keep the storage of their quads.
+  std::vector<Batch> batches_;
+  size_t num_batches_;
+
+  // Clip rect for quads being added, as (x, y, width, height).
+  vec4i clip_rect_;
+  bool clipped_;
+
+  // Scratch space for Flush().
+  std::vector<float> vertices_;
+  std::vector<unsigned short> indices_;
+
+  int last_draw_calls_;
+  uint64_t signature_;
+};
+
+}  // namespace fpl
+
+#endif  // FPL_DRAW_LIST_H
@@ -0,0 +1,76 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "dynamic_resolution.h"
+
+namespace fpl {
+
+// Weight of each new frame time in the moving average.
+static const float kAverageWeight = 0.1f;
+
+// Drop a level when the average is this far over budget.
+static const float kOverBudget = 1.15f;
+
+// Consider frames on budget when the average is within this of the target.
+static const float kOnBudget = 1.05f;
+
+// Frames to wait after a change before dropping again, so the average has a
+// chance to reflect the new level.
+static const int kSettleFrames = 30;
+
+// Frames that must be on budget before trying the next level up.
+static const int kClimbFrames = 300;
+
+DynamicResolution::DynamicResolution()
+    : level_(0),
+      target_frame_time_(0.0f),
+      average_frame_time_(0.0f),
+      frames_at_level_(0) {}
+
+void DynamicResolution::Initialize(const std::vector<float>& scales,
+                                   float target_frame_time) {
+  scales_ = scales;
+  level_ = 0;
+  target_frame_time_ = target_frame_time;
+  average_frame_time_ = target_frame_time;
+  frames_at_level_ = 0;
+}
+
+bool DynamicResolution::Update(float frame_time) {
+  if (scales_.size() < 2 || target_frame_time_ <= 0.0f) return false;
+
+  average_frame_time_ +=
+      (frame_time - average_frame_time_) * kAverageWeight;
+  frames_at_level_++;
+
+  size_t level = level_;
+  if (average_frame_time_ > target_frame_time_ * kOverBudget) {
+    if (frames_at_level_ >= kSettleFrames && level_ + 1 < scales_.size()) {
+      level = level_ + 1;
+    }
+  } else if (average_frame_time_ > target_frame_time_ * kOnBudget) {
+    // Neither clearly over nor on budget. Start counting again.
+    frames_at_level_ = std::min(frames_at_level_, kSettleFrames);
+  } else if (frames_at_level_ >= kClimbFrames && level_ > 0) {
+    level = level_ - 1;
+  }
+
+  if (level == level_) return false;
+  level_ = level;
+  frames_at_level_ = 0;
+  return true;
+}
+
+}  // namespace fpl
@@ -0,0 +1,56 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_DYNAMIC_RESOLUTION_H
+#define FPL_DYNAMIC_RESOLUTION_H
+
+#include <vector>
+
+namespace fpl {
+
+// Chooses a render resolution scale from measured frame times, so that a
+// frame rate can be held on devices that slow down as they heat up.
+//
+// Scales drop a level quickly when frames run over budget, and climb back a
+// level at a time once frames have been on budget for a while. Since frame
+// times are capped by vsync, climbing is a probe: if the higher level misses
+// its budget, it drops back again.
+class DynamicResolution {
+ public:
+  DynamicResolution();
+
+  // 'scales' are the resolution scales to pick from, largest first.
+  // 'target_frame_time' is the frame time, in ms, to hold.
+  void Initialize(const std::vector<float>& scales, float target_frame_time);
+
+  // Record the duration of the most recent frame, in ms. Returns true if
+  // scale() has changed as a result.
+  bool Update(float frame_time);
+
+  // The current resolution scale. 1 if there are no scales.
+  float scale() const { return scales_.empty() ? 1.0f : scales_[level_]; }
+
+ private:
+  std::vector<float> scales_;
+  size_t level_;
+  float target_frame_time_;
+  // Exponential moving average of recent frame times.
+  float average_frame_time_;
+  // Frames since the last change of level.
+  int frames_at_level_;
+};
+
+}  // namespace fpl
+
+#endif  // FPL_DYNAMIC_RESOLUTION_H
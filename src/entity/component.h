@@ -19,6 +19,7 @@
 #include "component_interface.h"
 #include "entity.h"
 #include "entity_common.h"
+#include "dense_pool.h"
 #include "entity_manager.h"
 #include "vector_pool.h"
 
@@ -29,7 +30,13 @@ namespace entity {
 // All components should should extend this class.  The type T is used to
 // specify the structure of the data that needs to be associated with each
 // entity.
-template <typename T>
+// Storage is the pool that holds the data.  VectorPool, the default, keeps
+// each entity's data in place until it is removed.  Components that are
+// iterated over every frame can use DensePool instead, which keeps the data
+// packed together at the cost of moving it around when entities are removed.
+// Allocator is the allocator template the storage gets its memory from.
+template <typename T, template <typename, typename> class Storage = VectorPool,
+          template <typename> class Allocator = std::allocator>
 class Component : public ComponentInterface {
  public:
   // Structure associated with each entity.
@@ -39,7 +46,9 @@ class Component : public ComponentInterface {
     EntityRef entity;
     T data;
   };
-  typedef typename VectorPool<EntityData>::Iterator EntityIterator;
+  typedef T DataType;
+  typedef Storage<EntityData, Allocator<EntityData> > EntityStorage;
+  typedef typename EntityStorage::Iterator EntityIterator;
 
   Component() : entity_manager_(nullptr) {}
 
@@ -84,10 +93,12 @@ class Component : public ComponentInterface {
   // Same as RemoveEntity() above, but returns an iterator to the entity after
   // the one we've just removed.
   virtual EntityIterator RemoveEntity(EntityIterator iter) {
-    RemoveEntityInternal(iter->entity);
+    // Hold on to the entity, since freeing the data may move another entity's
+    // data into this slot.
+    EntityRef entity = iter->entity;
+    RemoveEntityInternal(entity);
     auto new_iter = entity_data_.FreeElement(iter);
-    iter->entity->SetComponentDataIndex(GetComponentId(),
-                                        kUnusedComponentIndex);
+    entity->SetComponentDataIndex(GetComponentId(), kUnusedComponentIndex);
     return new_iter;
   }
 
@@ -101,6 +112,16 @@ class Component : public ComponentInterface {
   // Updates all entities.  Normally called by EntityManager, once per frame.
   virtual void UpdateAllEntities(WorldTime /*delta_time*/) {}
 
+  // Returns the number of entities that have this component.
+  virtual size_t EntityCount() const { return entity_data_.active_count(); }
+
+  // Makes room for data for at least 'count' entities, so that adding them
+  // doesn't grow the storage.
+  virtual void ReserveEntities(size_t count) { entity_data_.Reserve(count); }
+
+  // Returns the number of entities the storage can hold before it grows.
+  virtual size_t EntityCapacity() const { return entity_data_.Capacity(); }
+
   // Returns the data for an entity as a void pointer.  The calling function
   // is expected to know what to do with it.
   // Returns null if the data does not exist.
@@ -150,12 +171,35 @@ class Component : public ComponentInterface {
     }
   }
 
+  // Pack our data together, and point each entity at its data's new index.
+  virtual void CompactEntityData() {
+    entity_data_.Compact(nullptr);
+    for (auto iter = entity_data_.begin(); iter != entity_data_.end(); ++iter) {
+      iter->entity->SetComponentDataIndex(GetComponentId(), iter.index());
+    }
+  }
+
+  // Fix up the entity that owns each piece of data, and any entities the data
+  // refers to.
+  virtual void RemapEntities(const std::vector<size_t>& remap) {
+    for (auto iter = entity_data_.begin(); iter != entity_data_.end(); ++iter) {
+      iter->entity.Remap(remap);
+      RemapEntityData(&iter->data, remap);
+    }
+  }
+
   // Utility function for getting the component data for a specific component.
   template <typename ComponentDataType>
   ComponentDataType* Data(EntityRef& entity) {
     return entity_manager_->GetComponentData<ComponentDataType>(entity);
   }
 
+  // Returns the buffer to record entity changes in from UpdateAllEntities.
+  // They're made once this component's update group has finished.
+  EntityCommandBuffer& commands() {
+    return *entity_manager_->command_buffer(GetComponentId());
+  }
+
   // Utility function for getting the component object for a specific component.
   template <typename ComponentDataType>
   ComponentDataType* GetComponent() {
@@ -182,6 +226,11 @@ class Component : public ComponentInterface {
   // removed from this component.
   virtual void CleanupEntity(EntityRef& /*entity*/) {}
 
+  // Override this if the component data holds onto any EntityRefs, to fix
+  // them up with EntityRef::Remap when the entity manager compacts.
+  virtual void RemapEntityData(T* /*data*/,
+                               const std::vector<size_t>& /*remap*/) {}
+
   // Set the entity manager for this component.  (used as the main point of
   // contact for components that need to talk to other things.)
   virtual void SetEntityManager(EntityManager* entity_manager) {
@@ -214,7 +263,7 @@ class Component : public ComponentInterface {
     return entity->GetComponentDataIndex(GetComponentId());
   }
 
-  VectorPool<EntityData> entity_data_;
+  EntityStorage entity_data_;
   EntityManager* entity_manager_;
 };
 
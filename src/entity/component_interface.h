@@ -15,6 +15,7 @@
 #ifndef FPL_BASE_COMPONENT_H_
 #define FPL_BASE_COMPONENT_H_
 
+#include <vector>
 #include "entity.h"
 #include "entity_common.h"
 #include "entity_manager.h"
@@ -52,6 +53,12 @@ class ComponentInterface {
   // casting it into something useful.)
   virtual void* GetEntityDataAsVoid(const EntityRef&) = 0;
   virtual const void* GetEntityDataAsVoid(const EntityRef&) const = 0;
+  // Pack the entity data together, and update the entities' data indices to
+  // match.
+  virtual void CompactEntityData() = 0;
+  // Fix up every EntityRef the component holds, after the entity manager has
+  // compacted its entities.  'remap' maps old entity indices onto new ones.
+  virtual void RemapEntities(const std::vector<size_t>& remap) = 0;
   // Called just after addition to the entitymanager
   virtual void Init() = 0;
   // Called just after an entity is added to this component.
@@ -66,6 +73,13 @@ class ComponentInterface {
   // contact for components that need to talk to other things.)
   // (Normally assigned by entitymanager)
   virtual void SetEntityManager(EntityManager* entity_manager) = 0;
+  // Returns the number of entities that have this component.
+  virtual size_t EntityCount() const = 0;
+  // Make room for at least 'count' entities, so that adding them doesn't
+  // allocate.
+  virtual void ReserveEntities(size_t count) = 0;
+  // Returns the number of entities there's room for without allocating.
+  virtual size_t EntityCapacity() const = 0;
   // Returns the ID for this component.
 };
 
@@ -0,0 +1,108 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_COMPONENT_VIEW_H_
+#define FPL_COMPONENT_VIEW_H_
+
+#include "entity_manager.h"
+
+namespace fpl {
+namespace entity {
+
+// Iterates over every entity that has both PrimaryComponent and
+// SecondaryComponent, and hands back both pieces of data together.
+// Walks the primary component's storage in order, and looks the secondary
+// data up directly in the secondary component, so there is no virtual call
+// per entity.  Pick the component with fewer entities as the primary.
+// Entities must not be added to or removed from either component while
+// iterating.  (DeleteEntity is fine, since it's deferred.)
+//
+// e.g.
+//   ComponentView<DripAndVanishComponent, SceneObjectComponent> view(manager);
+//   for (auto iter = view.begin(); iter != view.end(); ++iter) {
+//     iter.secondary_data()->SetScale(iter.primary_data()->start_scale);
+//   }
+template <typename PrimaryComponent, typename SecondaryComponent>
+class ComponentView {
+  typedef typename PrimaryComponent::DataType PrimaryData;
+  typedef typename SecondaryComponent::DataType SecondaryData;
+  typedef typename PrimaryComponent::EntityIterator PrimaryIterator;
+
+ public:
+  class Iterator {
+    friend class ComponentView;
+
+   public:
+    // Standard equality operator
+    bool operator==(const Iterator& other) const {
+      return iter_ == other.iter_;
+    }
+
+    // Standard inequality operator
+    bool operator!=(const Iterator& other) const {
+      return !operator==(other);
+    }
+
+    // Prefix increment - moves the iterator to the next entity that has both
+    // components.
+    Iterator& operator++() {
+      ++iter_;
+      FindSecondaryData();
+      return (*this);
+    }
+
+    EntityRef& entity() { return iter_->entity; }
+    PrimaryData* primary_data() { return &iter_->data; }
+    SecondaryData* secondary_data() { return secondary_data_; }
+
+   private:
+    Iterator(ComponentView* view, PrimaryIterator iter)
+        : view_(view), iter_(iter), secondary_data_(nullptr) {
+      FindSecondaryData();
+    }
+
+    // Skip forward to the first entity that also has the secondary component.
+    void FindSecondaryData() {
+      for (; iter_ != view_->primary_end_; ++iter_) {
+        secondary_data_ = view_->secondary_->GetEntityData(iter_->entity);
+        if (secondary_data_ != nullptr) return;
+      }
+      secondary_data_ = nullptr;
+    }
+
+    ComponentView* view_;
+    PrimaryIterator iter_;
+    SecondaryData* secondary_data_;
+  };
+
+  explicit ComponentView(EntityManager* entity_manager)
+      : primary_(entity_manager->GetComponent<PrimaryComponent>()),
+        secondary_(entity_manager->GetComponent<SecondaryComponent>()),
+        primary_end_(primary_->end()) {
+    assert(primary_ != nullptr && secondary_ != nullptr);
+  }
+
+  Iterator begin() { return Iterator(this, primary_->begin()); }
+  Iterator end() { return Iterator(this, primary_end_); }
+
+ private:
+  PrimaryComponent* primary_;
+  SecondaryComponent* secondary_;
+  PrimaryIterator primary_end_;
+};
+
+}  // entity
+}  // fpl
+
+#endif  // FPL_COMPONENT_VIEW_H_
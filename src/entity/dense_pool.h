@@ -0,0 +1,261 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DENSE_POOL_H
+#define DENSE_POOL_H
+
+#include <stddef.h>
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "assert.h"
+#include "vector_pool.h"
+
+namespace fpl {
+
+// Pool allocator that keeps its active elements packed together at the front
+// of a vector, so that iterating over them walks memory in order.
+//
+// Elements are addressed by a handle index that stays the same for the life
+// of the element, and is translated into the element's current position
+// through a sparse lookup table.  Freeing an element moves the last element
+// into its slot, so the order of iteration is not stable, and pointers into
+// the pool are invalidated by both allocation and deallocation.
+//
+// Exposes the subset of the VectorPool interface that entity::Component uses,
+// so either one can be used as a component's storage.  As with VectorPool,
+// the contents of a freed element are treated as raw memory, so callers must
+// destroy anything it owns before freeing it.  T must be default and move
+// constructible.  The pool's vectors get their memory from Allocator, rebound
+// as needed, as with VectorPool.
+template <typename T, typename Allocator = std::allocator<T> >
+class DensePool {
+ public:
+  template <bool> class IteratorTemplate;
+
+  typedef IteratorTemplate<false> Iterator;
+  typedef IteratorTemplate<true> ConstIterator;
+
+  // ---------------------------
+  // Iterator for the dense pool.  Visits the active elements in the order
+  // they are stored in memory.
+  template <bool is_const>
+  class IteratorTemplate {
+    typedef typename std::conditional<is_const, const T&, T&>::type reference;
+    typedef typename std::conditional<is_const, const T*, T*>::type pointer;
+
+    friend class DensePool<T, Allocator>;
+
+   public:
+    IteratorTemplate(DensePool<T, Allocator>* container, size_t position)
+        : container_(container), position_(position) {}
+    ~IteratorTemplate() {}
+
+    // Standard equality operator
+    bool operator==(const IteratorTemplate& other) const {
+      return container_ == other.container_ && position_ == other.position_;
+    }
+
+    // Standard inequality operator
+    bool operator!=(const IteratorTemplate& other) const {
+      return !operator==(other);
+    }
+
+    // Prefix increment - moves the iterator one forward in the pool.
+    IteratorTemplate& operator++() {
+      position_++;
+      return (*this);
+    }
+
+    // Postfix increment - moves the iterator one forward in the pool, but
+    // returns the original (unincremented) iterator.
+    IteratorTemplate operator++(int) {
+      IteratorTemplate temp = *this;
+      ++(*this);
+      return temp;
+    }
+
+    // Iterator dereference
+    reference operator*() { return container_->dense_[position_]; }
+
+    // Member access on the object
+    pointer operator->() { return &container_->dense_[position_]; }
+
+    // Returns the handle of the element, which is what GetElementData and
+    // FreeElement expect.  Unlike the position, it does not change when
+    // other elements are freed.
+    size_t index() const { return container_->handles_[position_]; }
+
+   private:
+    DensePool<T, Allocator>* container_;
+    size_t position_;
+  };
+
+  // ---------------------------
+
+  static const size_t kOutOfBounds = static_cast<size_t>(-1);
+
+  DensePool() {}
+
+  // Get data for the element with the specified handle.
+  // Returns null if the handle is not currently allocated.  Asserts if the
+  // handle is obviously illegal.  (i. e. out of range)
+  // Note that the pointer is not guaranteed to remain valid, since allocating
+  // or freeing any element may move the data in memory.
+  T* GetElementData(size_t index) {
+    assert(index < positions_.size());
+    const size_t position = positions_[index];
+    return position == kOutOfBounds ? nullptr : &dense_[position];
+  }
+
+  // Const version of the above.
+  const T* GetElementData(size_t index) const {
+    return const_cast<DensePool*>(this)->GetElementData(index);
+  }
+
+  // Appends a new element to the end of the pool, and returns an iterator
+  // pointing at it.  Elements are always stored in allocation order, so
+  // alloc_location is only accepted for compatibility with VectorPool.
+  Iterator GetNewElement(AllocationLocation /*alloc_location*/) {
+    const size_t position = dense_.size();
+    size_t index;
+    if (!free_indices_.empty()) {
+      index = free_indices_.back();
+      free_indices_.pop_back();
+      positions_[index] = position;
+    } else {
+      index = positions_.size();
+      positions_.push_back(position);
+    }
+    dense_.push_back(T());
+    handles_.push_back(index);
+    return Iterator(this, position);
+  }
+
+  // Frees up an element, filling the hole it leaves with the last element in
+  // the pool.  The handle will be reused by a later allocation.
+  void FreeElement(size_t index) {
+    assert(index < positions_.size() && positions_[index] != kOutOfBounds);
+    const size_t position = positions_[index];
+    const size_t last = dense_.size() - 1;
+    if (position != last) {
+      new (&dense_[position]) T(std::move(dense_[last]));
+      handles_[position] = handles_[last];
+      positions_[handles_[position]] = position;
+    } else {
+      // The slot is raw memory now, so give pop_back something to destroy.
+      new (&dense_[position]) T();
+    }
+    dense_.pop_back();
+    handles_.pop_back();
+    positions_[index] = kOutOfBounds;
+    free_indices_.push_back(index);
+  }
+
+  // Free element, except it accepts an iterator instead of a handle.  Returns
+  // an iterator to the element that should be visited next, which is the one
+  // that was moved into the freed slot.
+  Iterator FreeElement(Iterator iter) {
+    FreeElement(iter.index());
+    return iter;
+  }
+
+  // Returns the number of handles the pool has allocated, used or not.  Every
+  // handle is less than this, so it can be used to size lookup tables keyed on
+  // handle.
+  size_t Size() const { return positions_.size(); }
+
+  // Returns the total number of active elements.
+  size_t active_count() const { return dense_.size(); }
+
+  // Returns the number of active elements the pool can hold before any of its
+  // vectors has to reallocate.
+  size_t Capacity() const {
+    return std::min(std::min(dense_.capacity(), handles_.capacity()),
+                    std::min(positions_.capacity(), free_indices_.capacity()));
+  }
+
+  // Clears out all elements of the pool.
+  void Clear() {
+    dense_.clear();
+    handles_.clear();
+    positions_.clear();
+    free_indices_.clear();
+  }
+
+  // Returns an iterator suitable for traversing all of the active elements
+  // in the pool.
+  Iterator begin() { return Iterator(this, 0); }
+
+  // Returns an iterator at the end of the pool, suitable for use as an end
+  // condition when iterating over the active elements.
+  Iterator end() { return Iterator(this, dense_.size()); }
+
+  // Returns a const iterator suitable for traversing all of the active
+  // elements in the pool.
+  ConstIterator cbegin() { return ConstIterator(this, 0); }
+
+  // Returns a const iterator at the end of the pool, suitable for use as an
+  // end condition when iterating over the active elements.
+  ConstIterator cend() { return ConstIterator(this, dense_.size()); }
+
+  // The elements are already packed, so this renumbers the handles to match
+  // their positions and drops the free ones.  Has the same contract as
+  // VectorPool::Compact: any handle held onto across the call must be fixed
+  // up using 'remap', if it is not null.
+  void Compact(std::vector<size_t>* remap) {
+    if (remap != nullptr) {
+      remap->assign(positions_.size(), static_cast<size_t>(kOutOfBounds));
+      for (size_t position = 0; position < handles_.size(); ++position) {
+        (*remap)[handles_[position]] = position;
+      }
+    }
+    positions_.resize(dense_.size());
+    for (size_t position = 0; position < dense_.size(); ++position) {
+      handles_[position] = position;
+      positions_[position] = position;
+    }
+    free_indices_.clear();
+  }
+
+  // Reserves space for at least new_size active elements, so that the pool
+  // does not reallocate until it grows beyond that.
+  void Reserve(size_t new_size) {
+    dense_.reserve(new_size);
+    handles_.reserve(new_size);
+    positions_.reserve(new_size);
+    free_indices_.reserve(new_size);
+  }
+
+ private:
+  typedef typename std::allocator_traits<Allocator>::template rebind_alloc<
+      size_t> IndexAllocator;
+  typedef std::vector<size_t, IndexAllocator> IndexVector;
+
+  // The active elements, packed together.
+  std::vector<T, Allocator> dense_;
+  // The handle of each element in dense_.
+  IndexVector handles_;
+  // The position in dense_ of each handle, or kOutOfBounds if it is free.
+  IndexVector positions_;
+  // Handles that have been freed, and can be given out again.
+  IndexVector free_indices_;
+};
+
+}  // fpl
+
+#endif  // DENSE_POOL_H
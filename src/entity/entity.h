@@ -25,7 +25,7 @@ namespace entity {
 // and a boolean for tracking if this entity is marked for deletion.
 class Entity {
  public:
-  Entity() : marked_for_deletion_(false) {
+  Entity() : source_data_(nullptr), marked_for_deletion_(false) {
     for (int i = 0; i < kMaxComponentCount; i++) {
       componentDataIndex_[i] = kUnusedComponentIndex;
     }
@@ -48,6 +48,12 @@ class Entity {
     return componentDataIndex_[componentId] != kUnusedComponentIndex;
   }
 
+  // The data the entity factory created this entity from, or null if it
+  // wasn't created from data.  Lets the entity be put back the way it was
+  // created without rebuilding it.
+  const void* source_data() const { return source_data_; }
+  void set_source_data(const void* source_data) { source_data_ = source_data; }
+
   // Member variable getter
   bool marked_for_deletion() const { return marked_for_deletion_; }
 
@@ -58,6 +64,7 @@ class Entity {
 
  private:
   ComponentIndex componentDataIndex_[kMaxComponentCount];
+  const void* source_data_;
   bool marked_for_deletion_;
 };
 
@@ -0,0 +1,97 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <assert.h>
+#include "entity_command_buffer.h"
+#include "component_interface.h"
+#include "entity_manager.h"
+
+namespace fpl {
+namespace entity {
+
+void EntityCommandBuffer::AddCommand(CommandType type, const EntityRef& entity,
+                                     ComponentId component_id,
+                                     const void* data,
+                                     const CreatedCallback& on_created) {
+  Command command;
+  command.type = type;
+  command.entity = entity;
+  command.component_id = component_id;
+  command.data = data;
+  command.on_created = on_created;
+  commands_.push_back(command);
+}
+
+void EntityCommandBuffer::CreateEntityFromData(
+    const void* data, const CreatedCallback& on_created) {
+  assert(data != nullptr);
+  AddCommand(kCreateEntityFromData, EntityRef(), kInvalidComponent, data,
+             on_created);
+}
+
+void EntityCommandBuffer::DeleteEntity(const EntityRef& entity) {
+  AddCommand(kDeleteEntity, entity, kInvalidComponent, nullptr, nullptr);
+}
+
+void EntityCommandBuffer::AddEntityToComponent(const EntityRef& entity,
+                                               ComponentId component_id) {
+  assert(component_id < kMaxComponentCount);
+  AddCommand(kAddEntityToComponent, entity, component_id, nullptr, nullptr);
+}
+
+void EntityCommandBuffer::RemoveEntityFromComponent(const EntityRef& entity,
+                                                    ComponentId component_id) {
+  assert(component_id < kMaxComponentCount);
+  AddCommand(kRemoveEntityFromComponent, entity, component_id, nullptr,
+             nullptr);
+}
+
+void EntityCommandBuffer::PlayBack(EntityManager* entity_manager) {
+  // Commands may record more commands (e.g. from InitEntity), so don't hold
+  // onto references into the vector while running them.
+  for (size_t i = 0; i < commands_.size(); i++) {
+    Command command = commands_[i];
+    if (command.type == kCreateEntityFromData) {
+      EntityRef entity = entity_manager->CreateEntityFromData(command.data);
+      if (command.on_created) command.on_created(entity);
+      continue;
+    }
+    if (!command.entity.IsValid()) continue;
+
+    switch (command.type) {
+      case kDeleteEntity:
+        entity_manager->DeleteEntity(command.entity);
+        break;
+      case kAddEntityToComponent:
+        entity_manager->AddEntityToComponent(command.entity,
+                                             command.component_id);
+        break;
+      case kRemoveEntityFromComponent: {
+        ComponentInterface* component =
+            entity_manager->GetComponent(command.component_id);
+        assert(component != nullptr);
+        if (command.entity->IsRegisteredForComponent(command.component_id)) {
+          component->RemoveEntity(command.entity);
+        }
+        break;
+      }
+      default:
+        assert(0);
+    }
+  }
+  commands_.clear();
+}
+
+}  // entity
+}  // fpl
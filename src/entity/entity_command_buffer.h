@@ -0,0 +1,94 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_ENTITY_COMMAND_BUFFER_H_
+#define FPL_ENTITY_COMMAND_BUFFER_H_
+
+#include <functional>
+#include <vector>
+#include "entity.h"
+#include "entity_common.h"
+#include "vector_pool.h"
+
+namespace fpl {
+namespace entity {
+
+class EntityManager;
+
+typedef VectorPool<Entity>::VectorPoolReference EntityRef;
+
+// Records changes to the set of entities, so that they can be made later, at
+// a point where nothing else is looking at the entities.
+// The entity manager keeps one buffer per component, and plays them all back
+// after each group of component updates (see EntityManager::UpdateComponents).
+// A component's updates always run on one thread at a time, so recording into
+// its own buffer needs no locking, even when updates run in parallel.
+class EntityCommandBuffer {
+ public:
+  // Called with the new entity once it has been created.
+  typedef std::function<void(EntityRef& entity)> CreatedCallback;
+
+  // Create an entity from data, as EntityManager::CreateEntityFromData does.
+  // 'data' must stay valid until the buffer is played back.
+  void CreateEntityFromData(const void* data,
+                            const CreatedCallback& on_created = nullptr);
+
+  // Delete an entity, as EntityManager::DeleteEntity does.
+  void DeleteEntity(const EntityRef& entity);
+
+  // Register an entity with a component, as
+  // EntityManager::AddEntityToComponent does.
+  void AddEntityToComponent(const EntityRef& entity, ComponentId component_id);
+
+  // Remove an entity from a component, dropping its data for that component.
+  void RemoveEntityFromComponent(const EntityRef& entity,
+                                 ComponentId component_id);
+
+  // Perform all of the recorded commands, in the order they were recorded,
+  // and empty the buffer.  Commands on entities that have since been deleted
+  // are skipped.
+  void PlayBack(EntityManager* entity_manager);
+
+  // Drop all of the recorded commands without performing them.
+  void Clear() { commands_.clear(); }
+
+  bool empty() const { return commands_.empty(); }
+
+ private:
+  enum CommandType {
+    kCreateEntityFromData,
+    kDeleteEntity,
+    kAddEntityToComponent,
+    kRemoveEntityFromComponent
+  };
+
+  struct Command {
+    CommandType type;
+    EntityRef entity;
+    ComponentId component_id;
+    const void* data;
+    CreatedCallback on_created;
+  };
+
+  void AddCommand(CommandType type, const EntityRef& entity,
+                  ComponentId component_id, const void* data,
+                  const CreatedCallback& on_created);
+
+  std::vector<Command> commands_;
+};
+
+}  // entity
+}  // fpl
+
+#endif  // FPL_ENTITY_COMMAND_BUFFER_H_
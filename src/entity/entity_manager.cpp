@@ -19,7 +19,10 @@
 namespace fpl {
 namespace entity {
 
-EntityManager::EntityManager() : entity_factory_(nullptr) {
+EntityManager::EntityManager()
+    : entity_factory_(nullptr),
+      update_runner_(nullptr),
+      updating_in_parallel_(false) {
   for (int i = 0; i < kMaxComponentCount; i++) {
     components_[i] = nullptr;
   }
@@ -33,6 +36,7 @@ EntityRef EntityManager::AllocateNewEntity() {
 // it just marks it for deletion, and it gets cleaned out at the end of the
 // next AdvanceFrame.
 void EntityManager::DeleteEntity(EntityRef entity) {
+  assert(!updating_in_parallel_);
   if (entity->marked_for_deletion()) {
     // already marked for deletion.
     return;
@@ -57,6 +61,12 @@ void EntityManager::DeleteMarkedEntities() {
   entities_to_delete_.resize(0);
 }
 
+void EntityManager::PlayBackCommands() {
+  for (size_t i = 0; i < kMaxComponentCount; i++) {
+    if (!command_buffers_[i].empty()) command_buffers_[i].PlayBack(this);
+  }
+}
+
 void EntityManager::RemoveAllComponents(EntityRef entity) {
   for (ComponentId i = 0; i < kMaxComponentCount; i++) {
     if (entity->IsRegisteredForComponent(i)) {
@@ -80,6 +90,56 @@ void EntityManager::RegisterComponentHelper(ComponentInterface* new_component,
   components_[id] = new_component;
   new_component->SetEntityManager(this);
   new_component->Init();
+  update_groups_.clear();
+}
+
+void EntityManager::AddUpdateDependency(ComponentId id,
+                                        ComponentId dependency) {
+  assert(id < kMaxComponentCount && dependency < kMaxComponentCount);
+  assert(id != dependency);
+  update_dependencies_[id].push_back(dependency);
+  update_groups_.clear();
+}
+
+void EntityManager::BuildUpdateGroups() {
+  // Each component goes in the group after the latest of its dependencies.
+  // Dependencies on components that aren't registered are ignored.
+  static const int kUnplaced = -1;
+  int group[kMaxComponentCount];
+  for (size_t i = 0; i < kMaxComponentCount; i++) {
+    group[i] = kUnplaced;
+  }
+  size_t num_placed = 0;
+  size_t num_registered = 0;
+  for (size_t i = 0; i < kMaxComponentCount; i++) {
+    if (components_[i]) num_registered++;
+  }
+
+  update_groups_.clear();
+  while (num_placed < num_registered) {
+    const size_t placed_before = num_placed;
+    std::vector<ComponentId> next_group;
+    for (ComponentId i = 0; i < kMaxComponentCount; i++) {
+      if (!components_[i] || group[i] != kUnplaced) continue;
+      bool ready = true;
+      for (size_t j = 0; j < update_dependencies_[i].size(); j++) {
+        const ComponentId dependency = update_dependencies_[i][j];
+        if (components_[dependency] && group[dependency] == kUnplaced) {
+          ready = false;
+          break;
+        }
+      }
+      if (ready) next_group.push_back(i);
+    }
+    for (size_t j = 0; j < next_group.size(); j++) {
+      group[next_group[j]] = static_cast<int>(update_groups_.size());
+      num_placed++;
+    }
+    // A cycle means nothing more can be placed.
+    assert(num_placed > placed_before);
+    if (num_placed == placed_before) break;
+    update_groups_.push_back(next_group);
+  }
 }
 
 void* EntityManager::GetComponentDataAsVoid(EntityRef entity,
@@ -97,13 +157,45 @@ const void* EntityManager::GetComponentDataAsVoid(
 }
 
 void EntityManager::UpdateComponents(WorldTime delta_time) {
-  // Update all the registered components.
-  for (size_t i = 0; i < kMaxComponentCount; i++) {
-    if (components_[i]) components_[i]->UpdateAllEntities(delta_time);
+  if (update_groups_.empty()) BuildUpdateGroups();
+
+  // Update all the registered components.  Recorded entity changes are made
+  // after each group, so that later groups see them.
+  for (size_t i = 0; i < update_groups_.size(); i++) {
+    const std::vector<ComponentId>& group = update_groups_[i];
+    if (update_runner_ == nullptr || group.size() == 1) {
+      for (size_t j = 0; j < group.size(); j++) {
+        components_[group[j]]->UpdateAllEntities(delta_time);
+      }
+    } else {
+      updating_in_parallel_ = true;
+      update_runner_->RunTasks(
+          group.size(), [this, &group, delta_time](size_t j) {
+            components_[group[j]]->UpdateAllEntities(delta_time);
+          });
+      updating_in_parallel_ = false;
+    }
+    PlayBackCommands();
   }
   DeleteMarkedEntities();
 }
 
+void EntityManager::Compact() {
+  // The components update the entities with their new data indices, so they
+  // must go before the entities move.
+  for (size_t i = 0; i < kMaxComponentCount; i++) {
+    if (components_[i]) components_[i]->CompactEntityData();
+  }
+  std::vector<size_t> remap;
+  entities_.Compact(&remap);
+  for (size_t i = 0; i < kMaxComponentCount; i++) {
+    if (components_[i]) components_[i]->RemapEntities(remap);
+  }
+  for (size_t i = 0; i < entities_to_delete_.size(); i++) {
+    entities_to_delete_[i].Remap(remap);
+  }
+}
+
 void EntityManager::Clear() {
   for (size_t i = 0; i < kMaxComponentCount; i++) {
     if (components_[i]) {
@@ -111,7 +203,10 @@ void EntityManager::Clear() {
       components_[i]->Cleanup();
     }
     components_[i] = nullptr;
+    update_dependencies_[i].clear();
+    command_buffers_[i].Clear();
   }
+  update_groups_.clear();
   entities_.Clear();
 }
 
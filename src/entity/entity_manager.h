@@ -15,9 +15,12 @@
 #ifndef FPL_ENTITY_MANAGER_H_
 #define FPL_ENTITY_MANAGER_H_
 
+#include <functional>
+#include <vector>
 #include "component_id_lookup.h"
 #include "component_interface.h"
 #include "entity.h"
+#include "entity_command_buffer.h"
 #include "entity_common.h"
 #include "vector_pool.h"
 
@@ -28,6 +31,7 @@ typedef VectorPool<Entity>::VectorPoolReference EntityRef;
 
 class EntityFactoryInterface;
 class ComponentInterface;
+class UpdateRunnerInterface;
 
 // Entity Manager is the main piece of code that manages all entities and
 // components in the game.  Normally the game will instantiate one instance
@@ -95,12 +99,25 @@ class EntityManager {
   // Returns an entityref to the new entity.
   EntityRef AllocateNewEntity();
 
+  // Makes room for at least 'count' entities, so that allocating them doesn't
+  // grow the pool.  Components reserve their data separately.
+  void ReserveEntities(size_t count) { entities_.Reserve(count); }
+
+  // Returns the number of entities there's room for before the pool grows.
+  size_t EntityCapacity() const { return entities_.Capacity(); }
+
   // Deletes an entity, removing it from our list, and clearing any component
   // data associated with it.
   // Note: Deletion is deferred until the end of the frame.  If you want to
   // delete something instantly, use DeleteEntityImmediately.
+  // Must not be called from parallel component updates.  Record the deletion
+  // in the component's command buffer instead.
   void DeleteEntity(EntityRef entity);
 
+  // Deletes the entities marked by DeleteEntity now, rather than at the end
+  // of the next update.
+  void DeleteMarkedEntities();
+
   // Deletes an entity instantly.  In general, you should use DeleteEntity,
   // (which defers deletion until the end of the update cycle) unless you have
   // a very good reason for doing so.
@@ -120,8 +137,39 @@ class EntityManager {
 
   // Iterates through all registered components, and causes them to update.
   // delta_time represents the timestep since last update.
+  // Components are updated in dependency order (see AddUpdateDependency).
+  // If an update runner has been set, components that don't depend on each
+  // other may be updated at the same time, on different threads.
   void UpdateComponents(WorldTime delta_time);
 
+  // Declares that the component 'id' reads data that 'dependency' writes
+  // during its update, so 'dependency' must finish updating first.  Usually
+  // called from the component's Init().
+  void AddUpdateDependency(ComponentId id, ComponentId dependency);
+
+  // Same as above, but takes the component types instead of their ids.
+  template <typename T, typename Dependency>
+  void AddUpdateDependency() {
+    AddUpdateDependency(ComponentIdLookup<T>::kComponentId,
+                        ComponentIdLookup<Dependency>::kComponentId);
+  }
+
+  // Registers the object used to run independent component updates in
+  // parallel.  With none (the default), everything updates on the calling
+  // thread.  Components updated in parallel must only write their own
+  // entities' data, and must make any changes to the set of entities through
+  // their command buffer.
+  void set_update_runner(UpdateRunnerInterface* update_runner) {
+    update_runner_ = update_runner;
+  }
+
+  // Packs the entities, and every component's data, to the front of their
+  // pools so they can be walked in memory order again.  EntityRefs held by
+  // components are fixed up (see Component::RemapEntityData), but any other
+  // EntityRefs become invalid.  Best called between rounds, since all of the
+  // component data moves.
+  void Compact();
+
   // Clears all data from all components, then dumps the list of components
   // themselves, and then dumps the list of entities.  Basically resets
   // the entity manager into its original state.
@@ -149,6 +197,19 @@ class EntityManager {
   // update routines.
   void AddEntityToComponent(EntityRef entity, ComponentId component_id);
 
+  // Returns the command buffer owned by a component.  Components record
+  // entity changes here during their updates, and the changes are made once
+  // the group of components being updated has finished.
+  EntityCommandBuffer* command_buffer(ComponentId id) {
+    assert(id < kMaxComponentCount);
+    return &command_buffers_[id];
+  }
+
+  // Plays back every component's command buffer, in component order.  Called
+  // by UpdateComponents, but can also be called directly to flush commands
+  // recorded outside of an update.
+  void PlayBackCommands();
+
  private:
   // Does all the real work of registering a component, aside from template fun.
   // In particular, verifies that the requested ID isn't already in use,
@@ -172,8 +233,10 @@ class EntityManager {
   const void* GetComponentDataAsVoid(EntityRef entity,
                                      ComponentId component_id) const;
 
-  // Delete all the entities we have marked for deletion.
-  void DeleteMarkedEntities();
+  // Sort the registered components into groups that can be updated at the
+  // same time.  Each group only depends on the groups before it.
+  void BuildUpdateGroups();
+
   // Storage of all the entities currently tracked by the entitymanager
   EntityStorageContainer entities_;
 
@@ -185,6 +248,17 @@ class EntityManager {
   // Factory used for spawning new entities from data.  Provided by the
   // calling program.
   EntityFactoryInterface* entity_factory_;
+  // Runs component updates in parallel.  Provided by the calling program.
+  UpdateRunnerInterface* update_runner_;
+  // The components each component must be updated after.
+  std::vector<ComponentId> update_dependencies_[kMaxComponentCount];
+  // Components grouped by BuildUpdateGroups, in update order.  Empty when it
+  // needs to be rebuilt.
+  std::vector<std::vector<ComponentId>> update_groups_;
+  // Entity changes recorded by each component.
+  EntityCommandBuffer command_buffers_[kMaxComponentCount];
+  // True while components may be updating on other threads.
+  bool updating_in_parallel_;
 };
 
 class EntityFactoryInterface {
@@ -193,6 +267,15 @@ class EntityFactoryInterface {
                                          EntityManager* entity_manager) = 0;
 };
 
+class UpdateRunnerInterface {
+ public:
+  virtual ~UpdateRunnerInterface() {}
+  // Call task(0) through task(count - 1), possibly in parallel, and return
+  // once they have all finished.
+  virtual void RunTasks(size_t count,
+                        const std::function<void(size_t)>& task) = 0;
+};
+
 }  // entity
 }  // fpl
 #endif  // FPL_ENTITY_MANAGER_H_
@@ -16,6 +16,8 @@
 #define VECTOR_POOL_H
 
 #include <stddef.h>
+#include <memory>
+#include <utility>
 #include <vector>
 #include "assert.h"
 
@@ -24,7 +26,10 @@ namespace fpl {
 enum AllocationLocation { kAddToFront, kAddToBack };
 
 // Pool allocator, implemented as a vector-based pair of linked lists.
-template <typename T>
+// The vector's memory comes from Allocator, rebound to the pool's element
+// type. Reserve() up front, with an allocator that serves a fixed arena if
+// need be, and the pool never reallocates while it stays within Capacity().
+template <typename T, typename Allocator = std::allocator<T> >
 class VectorPool {
   template <bool> friend class IteratorTemplate;
   friend class VectorPoolReference;
@@ -45,13 +50,13 @@ class VectorPool {
   // Also correctly handles situations where the underlying vector resizes,
   // moving the elements around in memory.
   class VectorPoolReference {
-    friend class VectorPool<T>;
+    friend class VectorPool<T, Allocator>;
     template <bool> friend class IteratorTemplate;
 
    public:
     VectorPoolReference() : container_(nullptr), index_(0), unique_id_(0) {}
 
-    VectorPoolReference(VectorPool<T>* container, size_t index)
+    VectorPoolReference(VectorPool<T, Allocator>* container, size_t index)
         : container_(container), index_(index) {
       unique_id_ = container->GetElement(index)->unique_id;
     }
@@ -70,8 +75,23 @@ class VectorPool {
     // if the object pointed to has been freed, even if the location was
     // later filled with a new object.
     bool IsValid() const {
-      return container_ != nullptr &&
-             (container_->GetElement(index_)->unique_id == unique_id_);
+      if (container_ == nullptr) return false;
+      const VectorPoolElement* element = container_->GetElement(index_);
+      return element != nullptr && element->unique_id == unique_id_;
+    }
+
+    // Update the reference after its container has been compacted.  'remap'
+    // is the table filled in by VectorPool::Compact.  References to elements
+    // that were not active at the time become null references.
+    void Remap(const std::vector<size_t>& remap) {
+      if (container_ == nullptr) return;
+      if (index_ >= remap.size() || remap[index_] == kOutOfBounds) {
+        container_ = nullptr;
+        index_ = 0;
+        unique_id_ = kInvalidId;
+        return;
+      }
+      index_ = remap[index_];
     }
 
     // Member access operator.  Returns a pointer to the data the
@@ -139,7 +159,7 @@ class VectorPool {
     size_t index() { return index_; }
 
    private:
-    VectorPool<T>* container_;
+    VectorPool<T, Allocator>* container_;
     size_t index_;
     UniqueIdType unique_id_;
   };
@@ -153,10 +173,10 @@ class VectorPool {
     typedef typename std::conditional<is_const, const T&, T&>::type reference;
     typedef typename std::conditional<is_const, const T*, T*>::type pointer;
 
-    friend class VectorPool<T>;
+    friend class VectorPool<T, Allocator>;
 
    public:
-    IteratorTemplate(VectorPool<T>* container, size_t index)
+    IteratorTemplate(VectorPool<T, Allocator>* container, size_t index)
         : container_(container), index_(index) {}
     ~IteratorTemplate() {}
 
@@ -216,7 +236,7 @@ class VectorPool {
     }
 
    private:
-    VectorPool<T>* container_;
+    VectorPool<T, Allocator>* container_;
     size_t index_;
   };
 
@@ -232,6 +252,9 @@ class VectorPool {
     size_t prev;
     UniqueIdType unique_id;
   };
+  typedef typename std::allocator_traits<Allocator>::template rebind_alloc<
+      VectorPoolElement> ElementAllocator;
+  typedef std::vector<VectorPoolElement, ElementAllocator> ElementVector;
 
   // Constants for our first/last elements. They're never given actual data,
   //  but are used as list demarcations.
@@ -329,8 +352,12 @@ class VectorPool {
   // Returns the total number of active elements.
   size_t active_count() const { return active_count_; }
 
+  // Returns the number of active elements the pool can hold before the
+  // underlying vector has to reallocate.
+  size_t Capacity() const { return elements_.capacity() - kTotalReserved; }
+
   // Clears out all elements of the vectorpool, and resizes the underlying
-  // vector to the minimum.
+  // vector to the minimum.  Its capacity is kept.
   void Clear() {
     elements_.resize(kTotalReserved);
     elements_[kFirstUsed].next = kLastUsed;
@@ -358,12 +385,59 @@ class VectorPool {
   // an end condition when iterating over the active elements.
   ConstIterator cend() { return ConstIterator(this, kLastUsed); }
 
-  // Expands the vector until it is at least new_size.  If the vector
-  // already contains at least new_size elements, then there is no effect.
+  // Moves the active elements to the front of the vector, in list order, and
+  // releases the free elements.  Unique ids are kept, but indices change, so
+  // any VectorPoolReference or raw index held onto across the call must be
+  // fixed up.  If 'remap' is not null, it is filled with the new index of every
+  // old index, or kOutOfBounds if the old element was not active, which
+  // VectorPoolReference::Remap uses for the fix-up.  The capacity is kept, so
+  // a pool that was reserved up front stays that way.
+  void Compact(std::vector<size_t>* remap) {
+    if (remap != nullptr) {
+      remap->assign(elements_.size(), static_cast<size_t>(kOutOfBounds));
+    }
+
+    ElementVector compacted(elements_.get_allocator());
+    compacted.reserve(elements_.capacity());
+    compacted.resize(kTotalReserved);
+    for (size_t index = elements_[kFirstUsed].next; index != kLastUsed;
+         index = elements_[index].next) {
+      const size_t new_index = compacted.size();
+      if (remap != nullptr) (*remap)[index] = new_index;
+      compacted.push_back(VectorPoolElement());
+      VectorPoolElement& element = compacted.back();
+      element.data = std::move(elements_[index].data);
+      element.unique_id = elements_[index].unique_id;
+      element.prev = new_index - 1;
+      element.next = new_index + 1;
+    }
+
+    // Stitch the freshly packed elements into the used list, and leave the
+    // free list empty.
+    const size_t last = compacted.size() - 1;
+    compacted[kFirstFree].next = kLastFree;
+    compacted[kLastFree].prev = kFirstFree;
+    if (last < kTotalReserved) {
+      compacted[kFirstUsed].next = kLastUsed;
+      compacted[kLastUsed].prev = kFirstUsed;
+    } else {
+      compacted[kFirstUsed].next = kTotalReserved;
+      compacted[kTotalReserved].prev = kFirstUsed;
+      compacted[last].next = kLastUsed;
+      compacted[kLastUsed].prev = last;
+    }
+    elements_.swap(compacted);
+  }
+
+  // Reserves space for at least new_size active elements, so that the pool
+  // does not reallocate until it grows beyond that.  The space is added to
+  // the free list, so it's used before anything is pushed onto the vector.
   void Reserve(size_t new_size) {
     size_t current_size = elements_.size();
+    new_size += kTotalReserved;
     if (current_size >= new_size) return;
 
+    elements_.reserve(new_size);
     elements_.resize(new_size);
     for (; current_size < new_size; current_size++) {
       elements_[current_size].unique_id = kInvalidId;
@@ -434,7 +508,7 @@ class VectorPool {
     return result;
   }
 
-  std::vector<VectorPoolElement> elements_;
+  ElementVector elements_;
   size_t active_count_;
   UniqueIdType next_unique_id_;
 };
@@ -0,0 +1,67 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Bakes text for FontManager::LoadBakedText(), for scripts/build_assets.py.
+//
+//   pie_noon_font_baker [--sdf] <font> <output> [<size> <text>]...
+//
+// Each text is shaped at its size and its glyphs rasterized, just as
+// FontManager::GetBuffer() would the first time the text is drawn, and the
+// results are written to <output>. With --sdf, the glyphs are distance fields
+// and, as in SDF mode at runtime, every size is rasterized at kSDFGlyphSize.
+
+#include "precompiled.h"
+#include "font_manager.h"
+
+namespace fpl {
+namespace pie_noon {
+
+static int BakeText(int argc, char* argv[]) {
+  const bool sdf = argc > 1 && strcmp(argv[1], "--sdf") == 0;
+  if (sdf) {
+    argv++;
+    argc--;
+  }
+  if (argc < 3 || argc % 2 == 0) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                 "usage: pie_noon_font_baker [--sdf] <font> <output> "
+                 "[<size> <text>]...\n");
+    return 1;
+  }
+  const char* font = argv[1];
+  const char* output = argv[2];
+
+  FontManager fontman;
+  if (!fontman.Open(font)) return 1;
+  fontman.EnableSDF(sdf);
+  for (int i = 3; i + 1 < argc; i += 2) {
+    const float size = static_cast<float>(atof(argv[i]));
+    if (size <= 0.0f || !fontman.BakeString(argv[i + 1], size)) {
+      SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Can't bake \"%s\" at size %s.\n",
+                   argv[i + 1], argv[i]);
+      return 1;
+    }
+  }
+  if (!fontman.SaveBakedText(output)) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Can't write %s.\n", output);
+    return 1;
+  }
+  return 0;
+}
+
+}  // pie_noon
+}  // fpl
+
+int main(int argc, char* argv[]) { return fpl::pie_noon::BakeText(argc, argv); }
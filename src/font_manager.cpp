@@ -22,7 +22,9 @@
 #include <hb.h>
 #include <hb-ft.h>
 
+#include "baked_text_generated.h"
 #include "font_manager.h"
+#include "memory_accounting.h"
 #include "utilities.h"
 
 namespace fpl {
@@ -34,24 +36,48 @@ hb_buffer_t *FontManager::harfbuzz_buf_;
 FontManager::FontManager()
     : renderer_(nullptr),
       face_initialized_(false),
+      sdf_(false),
       current_atlas_revision_(0),
-      current_pass_(0) {
+      current_pass_(0),
+      async_face_(nullptr),
+      async_harfbuzz_font_(nullptr),
+      async_harfbuzz_buf_(nullptr),
+      worker_pool_(nullptr),
+      async_mutex_(nullptr),
+      baked_sdf_(false),
+      frame_(0),
+      max_buffers_(kFontCacheMaxBuffers),
+      max_textures_(kFontCacheMaxTextures),
+      max_age_(kFontCacheMaxAge) {
   Initialize();
 
   // Initialize glyph cache.
   glyph_cache_.reset(new GlyphCache<uint8_t>(
-      mathfu::vec2i(kGlyphCacheWidth, kGlyphCacheHeight)));
+      mathfu::vec2i(kGlyphCacheWidth, kGlyphCacheHeight),
+      kGlyphCacheMaxPages));
 }
 
-FontManager::FontManager(const mathfu::vec2i &cache_size)
+FontManager::FontManager(const mathfu::vec2i &cache_size,
+                         const int32_t max_pages)
     : renderer_(nullptr),
       face_initialized_(false),
+      sdf_(false),
       current_atlas_revision_(0),
-      current_pass_(0) {
+      current_pass_(0),
+      async_face_(nullptr),
+      async_harfbuzz_font_(nullptr),
+      async_harfbuzz_buf_(nullptr),
+      worker_pool_(nullptr),
+      async_mutex_(nullptr),
+      baked_sdf_(false),
+      frame_(0),
+      max_buffers_(kFontCacheMaxBuffers),
+      max_textures_(kFontCacheMaxTextures),
+      max_age_(kFontCacheMaxAge) {
   Initialize();
 
   // Initialize glyph cache.
-  glyph_cache_.reset(new GlyphCache<uint8_t>(cache_size));
+  glyph_cache_.reset(new GlyphCache<uint8_t>(cache_size, max_pages));
 }
 
 FontManager::~FontManager() { Close(); }
@@ -80,60 +106,251 @@ void FontManager::Terminate() {
   ft_ = nullptr;
 }
 
-FontBuffer *FontManager::GetBuffer(const char *text, const float ysize) {
-  // Adjust y size if the size selector is set.
-  int32_t converted_ysize = ConvertSize(ysize);
-  float scale = ysize / static_cast<float>(converted_ysize);
-
+bool FontManager::LookUpBuffer(const char *text, const float ysize,
+                               FontBuffer **buffer) {
   // Check cache if we already have a FontBuffer generated.
   auto it = map_buffers_.find(text);
-  if (it != map_buffers_.end()) {
-    auto t = it->second.find(ysize);
-    if (t != it->second.end()) {
-      // Update current pass.
-      if (current_pass_ != kRenderPass) {
-        t->second->set_pass(current_pass_);
+  if (it == map_buffers_.end()) return false;
+  auto t = it->second.find(ysize);
+  if (t == it->second.end()) return false;
+
+  // Update current pass.
+  if (current_pass_ != kRenderPass) {
+    t->second->set_pass(current_pass_);
+  }
+  t->second->set_last_used_frame(frame_);
+
+  // Update UV of the buffer
+  *buffer = UpdateUV(ConvertSize(ysize), t->second.get());
+  return true;
+}
+
+FontBuffer *FontManager::GetBuffer(const char *text, const float ysize) {
+  FontBuffer *buffer;
+  if (LookUpBuffer(text, ysize, &buffer)) return buffer;
+  MemoryTagScope tag(kMemoryTagFonts);
+
+  // Strings baked offline need neither harfbuzz nor FreeType.
+  auto baked = FindBakedString(text, ConvertSize(ysize));
+  if (baked != nullptr) {
+    return CreateBuffer(text, ysize, baked->string_width, baked->glyphs);
+  }
+
+  // Otherwise, create new FontBuffer.
+  std::vector<ShapedGlyph> glyphs;
+  uint32_t string_width;
+  if (!LayoutPreshapedText(text, ConvertSize(ysize), &glyphs, &string_width)) {
+    // Set freetype settings.
+    FT_Set_Pixel_Sizes(face_, 0, ConvertSize(ysize));
+
+    // Layout text.
+    string_width = ShapeText(text, harfbuzz_font_, harfbuzz_buf_, &glyphs);
+  }
+  return CreateBuffer(text, ysize, string_width, glyphs);
+}
+
+void FontManager::SetPreshapedCharacters(const char *characters) {
+  preshaped_characters_ = characters ? characters : "";
+  preshaped_glyphs_.clear();
+}
+
+bool FontManager::LayoutPreshapedText(const char *text,
+                                      const int32_t converted_ysize,
+                                      std::vector<ShapedGlyph> *glyphs,
+                                      uint32_t *string_width) {
+  if (preshaped_characters_.empty()) return false;
+  const size_t kNumCharacters = 128;
+  for (const char *c = text; *c; ++c) {
+    if (static_cast<unsigned char>(*c) >= kNumCharacters ||
+        preshaped_characters_.find(*c) == std::string::npos) {
+      return false;
+    }
+  }
+
+  // Shape each character on its own, the first time this size is used.
+  auto &preshaped = preshaped_glyphs_[converted_ysize];
+  if (preshaped.empty()) {
+    ShapedGlyph none = {0, 0, 0};
+    preshaped.resize(kNumCharacters, none);
+    FT_Set_Pixel_Sizes(face_, 0, converted_ysize);
+    std::vector<ShapedGlyph> shaped;
+    for (auto c : preshaped_characters_) {
+      const char character[] = {c, '\0'};
+      ShapeText(character, harfbuzz_font_, harfbuzz_buf_, &shaped);
+      if (shaped.size() == 1) {
+        preshaped[static_cast<unsigned char>(c)] = shaped[0];
       }
+    }
+  }
 
-      // Update UV of the buffer
-      auto ret = UpdateUV(converted_ysize, t->second.get());
-      return ret;
+  // Glyph 0 is the font's missing glyph, so leave those to harfbuzz.
+  glyphs->clear();
+  int32_t width = 0;
+  for (const char *c = text; *c; ++c) {
+    const ShapedGlyph &glyph = preshaped[static_cast<unsigned char>(*c)];
+    if (glyph.code_point == 0) return false;
+    glyphs->push_back(glyph);
+    width += glyph.x_advance;
+  }
+  *string_width = width / kFreeTypeUnit;
+  return true;
+}
+
+bool FontManager::LoadBakedText(const char *filename) {
+  if (!FileExists(filename)) return false;
+  MemoryTagScope tag(kMemoryTagFonts);
+  std::string source;
+  if (!LoadFile(filename, &source)) return false;
+  flatbuffers::Verifier verifier(
+      reinterpret_cast<const uint8_t *>(source.data()), source.size());
+  if (!VerifyBakedTextBuffer(verifier)) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR, "%s isn't baked text.\n", filename);
+    return false;
+  }
+  const BakedText *baked = GetBakedText(source.data());
+
+  baked_strings_.clear();
+  baked_glyphs_.clear();
+  baked_sdf_ = baked->sdf();
+  auto runs = baked->runs();
+  for (size_t i = 0; runs != nullptr && i < runs->Length(); ++i) {
+    auto run = runs->Get(i);
+    if (run->text() == nullptr || run->glyphs() == nullptr) continue;
+    BakedString &string =
+        baked_strings_[run->text()->str()][run->glyph_size()];
+    string.string_width = run->width();
+    string.glyphs.clear();
+    for (size_t j = 0; j < run->glyphs()->Length(); ++j) {
+      auto glyph = run->glyphs()->Get(j);
+      ShapedGlyph shaped = {glyph->code_point(), glyph->x_advance(),
+                            glyph->y_advance()};
+      string.glyphs.push_back(shaped);
+    }
+  }
+  auto glyphs = baked->glyphs();
+  for (size_t i = 0; glyphs != nullptr && i < glyphs->Length(); ++i) {
+    auto glyph = glyphs->Get(i);
+    const vec2i size(glyph->width(), glyph->height());
+    if (size.x() < 0 || size.y() < 0 || glyph->pixels() == nullptr ||
+        glyph->pixels()->Length() !=
+            static_cast<size_t>(size.x()) * static_cast<size_t>(size.y())) {
+      SDL_LogError(SDL_LOG_CATEGORY_ERROR, "%s has a broken glyph.\n",
+                   filename);
+      continue;
+    }
+    FontGlyphImage &image =
+        baked_glyphs_[BakedGlyphKey(glyph->code_point(), glyph->glyph_size())];
+    image.entry.set_code_point(glyph->code_point());
+    image.entry.set_size(size);
+    image.entry.set_offset(vec2i(glyph->offset_x(), glyph->offset_y()));
+    image.pixels.reset(new uint8_t[size.x() * size.y()]);
+    if (size.x() * size.y() > 0) {
+      memcpy(image.pixels.get(), glyph->pixels()->Data(),
+             size.x() * size.y());
     }
   }
+  return true;
+}
 
-  // Otherwise, create new FontBuffer.
+bool FontManager::BakeString(const char *text, const float ysize) {
+  if (!face_initialized_) return false;
+  MemoryTagScope tag(kMemoryTagFonts);
 
-  // Set freetype settings.
+  // Glyphs of both modes can't be kept together.
+  if (baked_sdf_ != sdf_) {
+    baked_strings_.clear();
+    baked_glyphs_.clear();
+    baked_sdf_ = sdf_;
+  }
+
+  const int32_t converted_ysize = ConvertSize(ysize);
   FT_Set_Pixel_Sizes(face_, 0, converted_ysize);
+  BakedString baked;
+  baked.string_width =
+      ShapeText(text, harfbuzz_font_, harfbuzz_buf_, &baked.glyphs);
+  for (auto &glyph : baked.glyphs) {
+    const uint64_t key = BakedGlyphKey(glyph.code_point, converted_ysize);
+    if (baked_glyphs_.find(key) != baked_glyphs_.end()) continue;
+    FontGlyphImage image;
+    if (!RasterizeGlyph(face_, glyph.code_point, sdf_, &image.entry,
+                        &image.pixels)) {
+      return false;
+    }
+    baked_glyphs_.insert(std::make_pair(key, std::move(image)));
+  }
+  baked_strings_[text][converted_ysize] = std::move(baked);
+  return true;
+}
 
-  // Layout text.
-  auto string_width = LayoutText(text) * scale;
+bool FontManager::SaveBakedText(const char *filename) const {
+  flatbuffers::FlatBufferBuilder builder;
+  std::vector<flatbuffers::Offset<BakedTextRun>> runs;
+  std::vector<BakedShapedGlyph> shaped;
+  for (auto it = baked_strings_.begin(); it != baked_strings_.end(); ++it) {
+    for (auto t = it->second.begin(); t != it->second.end(); ++t) {
+      shaped.clear();
+      for (auto &glyph : t->second.glyphs) {
+        shaped.push_back(BakedShapedGlyph(glyph.code_point, glyph.x_advance,
+                                          glyph.y_advance));
+      }
+      runs.push_back(CreateBakedTextRun(
+          builder, builder.CreateString(it->first), t->first,
+          t->second.string_width, builder.CreateVectorOfStructs(shaped)));
+    }
+  }
+  std::vector<flatbuffers::Offset<BakedGlyphImage>> glyphs;
+  for (auto it = baked_glyphs_.begin(); it != baked_glyphs_.end(); ++it) {
+    const GlyphCacheEntry &entry = it->second.entry;
+    const vec2i size = entry.get_size();
+    glyphs.push_back(CreateBakedGlyphImage(
+        builder, entry.get_code_point(), static_cast<int32_t>(it->first >> 32),
+        entry.get_offset().x(), entry.get_offset().y(), size.x(), size.y(),
+        builder.CreateVector(it->second.pixels.get(), size.x() * size.y())));
+  }
+  builder.Finish(CreateBakedText(builder, baked_sdf_,
+                                 builder.CreateVector(runs),
+                                 builder.CreateVector(glyphs)));
+
+  SDL_RWops *handle = SDL_RWFromFile(filename, "wb");
+  if (!handle) return false;
+  const size_t written = SDL_RWwrite(handle, builder.GetBufferPointer(), 1,
+                                     builder.GetSize());
+  SDL_RWclose(handle);
+  return written == builder.GetSize();
+}
 
-  // Retrieve layout info.
-  uint32_t glyph_count;
-  hb_glyph_info_t *glyph_info =
-      hb_buffer_get_glyph_infos(harfbuzz_buf_, &glyph_count);
-  hb_glyph_position_t *glyph_pos =
-      hb_buffer_get_glyph_positions(harfbuzz_buf_, &glyph_count);
+const FontManager::BakedString *FontManager::FindBakedString(
+    const char *text, const int32_t converted_ysize) const {
+  if (baked_sdf_ != sdf_) return nullptr;
+  auto it = baked_strings_.find(text);
+  if (it == baked_strings_.end()) return nullptr;
+  auto t = it->second.find(converted_ysize);
+  return t == it->second.end() ? nullptr : &t->second;
+}
+
+FontBuffer *FontManager::CreateBuffer(const char *text, const float ysize,
+                                      const uint32_t string_width,
+                                      const std::vector<ShapedGlyph> &glyphs) {
+  // Adjust y size if the size selector is set.
+  int32_t converted_ysize = ConvertSize(ysize);
+  float scale = ysize / static_cast<float>(converted_ysize);
 
   // Create FontBuffer with derived string length.
-  std::unique_ptr<FontBuffer> buffer(new FontBuffer(glyph_count));
+  std::unique_ptr<FontBuffer> buffer(new FontBuffer(glyphs.size()));
 
   // Initialize font metrics parameters.
   int32_t base_line = ysize * face_->ascender / face_->units_per_EM;
   FontMetrics initial_metrics(base_line, 0, base_line, base_line - ysize, 0);
 
+  // Distance field glyphs are padded beyond their outline.
+  const int32_t padding = sdf_ ? kSDFSpread : 0;
+
   mathfu::vec2 pos(mathfu::kZeros2f);
-  FT_GlyphSlot glyph = face_->glyph;
 
-  for (size_t i = 0; i < glyph_count; ++i) {
-    auto code_point = glyph_info[i].codepoint;
+  for (size_t i = 0; i < glyphs.size(); ++i) {
+    auto code_point = glyphs[i].code_point;
     auto cache = GetCachedEntry(code_point, converted_ysize);
-    if (cache == nullptr) {
-      // Cleanup buffer contents.
-      hb_buffer_clear_contents(harfbuzz_buf_);
-      return nullptr;
-    }
+    if (cache == nullptr) return nullptr;
 
     // Add the code point to the buffer. This information is used when
     // re-fetching UV information when the texture atlas is updated.
@@ -142,15 +359,14 @@ FontBuffer *FontManager::GetBuffer(const char *text, const float ysize) {
     // Calculate internal/external leading value and expand a buffer if
     // necessary.
     FontMetrics new_metrics;
-    if (UpdateMetrics(glyph, initial_metrics, &new_metrics)) {
+    if (UpdateMetrics(cache->get_offset().y() - padding,
+                      cache->get_size().y() - padding * 2, initial_metrics,
+                      &new_metrics)) {
       initial_metrics = new_metrics;
     }
 
-    // Construct indices array.
-    const uint16_t kIndices[] = {0, 1, 2, 1, 2, 3};
-    for (auto index : kIndices) {
-      buffer->get_indices()->push_back(index + i * 4);
-    }
+    // The indices array is constructed by BuildSlices() once every glyph's
+    // page is known.
 
     // Construct intermediate vertices array.
     // The vertices array is update in the render pass with correct
@@ -160,18 +376,21 @@ FontBuffer *FontManager::GetBuffer(const char *text, const float ysize) {
     buffer->AddVertices(pos, base_line, scale, *cache);
 
     // Update UV.
-    buffer->UpdateUV(i, cache->get_uv());
+    buffer->UpdateUV(i, cache->get_uv(), cache->get_page());
 
     // Set buffer revision using glyph cache revision.
     buffer->set_revision(glyph_cache_->get_revision());
 
     // Advance positions.
-    pos += mathfu::vec2(glyph_pos[i].x_advance, -glyph_pos[i].y_advance) *
-           scale / kFreeTypeUnit;
+    pos += mathfu::vec2(glyphs[i].x_advance, -glyphs[i].y_advance) * scale /
+           kFreeTypeUnit;
   }
 
+  // Group the glyphs by atlas page.
+  buffer->BuildSlices();
+
   // Setup size.
-  buffer->set_size(vec2i(string_width, ysize));
+  buffer->set_size(vec2i(string_width * scale, ysize));
 
   // Setup font metrics.
   buffer->set_metrics(initial_metrics);
@@ -180,9 +399,7 @@ FontBuffer *FontManager::GetBuffer(const char *text, const float ysize) {
   if (current_pass_ != kRenderPass) {
     buffer->set_pass(current_pass_);
   }
-
-  // Cleanup buffer contents.
-  hb_buffer_clear_contents(harfbuzz_buf_);
+  buffer->set_last_used_frame(frame_);
 
   // Verify the buffer.
   assert(buffer->Verify());
@@ -194,6 +411,143 @@ FontBuffer *FontManager::GetBuffer(const char *text, const float ysize) {
   return insert.first->second.get();
 }
 
+FontBuffer *FontManager::GetBufferAsync(const char *text, const float ysize) {
+  FontBuffer *buffer;
+  if (LookUpBuffer(text, ysize, &buffer)) return buffer;
+  MemoryTagScope tag(kMemoryTagFonts);
+
+  // Without a worker, or for baked strings that need none, do the work here.
+  if (worker_pool_ == nullptr ||
+      (async_face_ == nullptr && !StartAsyncWorker()) ||
+      FindBakedString(text, ConvertSize(ysize)) != nullptr) {
+    return GetBuffer(text, ysize);
+  }
+
+  // Already on its way.
+  const int32_t key = static_cast<int32_t>(ysize);
+  if (!async_requested_[text].insert(key).second) return nullptr;
+
+  AsyncShapingJob *shaping = new AsyncShapingJob();
+  shaping->text = text;
+  shaping->ysize = ysize;
+  shaping->converted_ysize = ConvertSize(ysize);
+  shaping->sdf = sdf_;
+  async_last_job_ = worker_pool_->Submit(
+      [this, shaping]() {
+        MemoryTagScope tag(kMemoryTagFonts);
+        ShapeAsync(shaping);
+        SDL_LockMutex(async_mutex_);
+        async_done_.push_back(std::unique_ptr<AsyncShapingJob>(shaping));
+        SDL_UnlockMutex(async_mutex_);
+      },
+      async_last_job_);
+  return nullptr;
+}
+
+bool FontManager::StartAsyncWorker() {
+  if (!face_initialized_) return false;
+
+  // FreeType faces and harfbuzz buffers can't be shared between threads, so
+  // the jobs get their own, of the same font data.
+  FT_Error err;
+  if ((err = FT_New_Memory_Face(
+           *ft_, reinterpret_cast<const unsigned char *>(&font_data_[0]),
+           font_data_.size(), 0, &async_face_))) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                 "Failed to open font for text shaping jobs. FT_Error:%d\n",
+                 err);
+    return false;
+  }
+  async_harfbuzz_font_ = hb_ft_font_create(async_face_, NULL);
+  async_harfbuzz_buf_ = hb_buffer_create();
+  async_mutex_ = SDL_CreateMutex();
+  if (!async_harfbuzz_font_ || !async_mutex_) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                 "Can't start text shaping jobs: %s\n", SDL_GetError());
+    StopAsyncWorker();
+    return false;
+  }
+  return true;
+}
+
+void FontManager::StopAsyncWorker() {
+  // The jobs run in order, so once the last has finished they all have.
+  if (worker_pool_ != nullptr) worker_pool_->Wait(async_last_job_);
+  async_last_job_.reset();
+  async_done_.clear();
+  async_requested_.clear();
+  if (async_mutex_) {
+    SDL_DestroyMutex(async_mutex_);
+    async_mutex_ = nullptr;
+  }
+  if (async_harfbuzz_buf_) {
+    hb_buffer_destroy(async_harfbuzz_buf_);
+    async_harfbuzz_buf_ = nullptr;
+  }
+  if (async_harfbuzz_font_) {
+    hb_font_destroy(async_harfbuzz_font_);
+    async_harfbuzz_font_ = nullptr;
+  }
+  if (async_face_) {
+    FT_Done_Face(async_face_);
+    async_face_ = nullptr;
+  }
+}
+
+void FontManager::ShapeAsync(AsyncShapingJob *job) {
+  // Touches nothing but the job and the jobs' own face and buffer.
+  FT_Set_Pixel_Sizes(async_face_, 0, job->converted_ysize);
+  job->string_width = ShapeText(job->text.c_str(), async_harfbuzz_font_,
+                                async_harfbuzz_buf_, &job->glyphs);
+
+  // Rasterize each distinct glyph once. The glyph cache can only be read on
+  // the render thread, so glyphs already in it are rasterized again.
+  std::unordered_set<uint32_t> rasterized;
+  for (auto &glyph : job->glyphs) {
+    if (!rasterized.insert(glyph.code_point).second) continue;
+    FontGlyphImage image;
+    if (!RasterizeGlyph(async_face_, glyph.code_point, job->sdf, &image.entry,
+                        &image.pixels)) {
+      job->failed = true;
+      return;
+    }
+    job->images.push_back(std::move(image));
+  }
+}
+
+void FontManager::FinishAsyncJobs() {
+  if (async_face_ == nullptr) return;
+
+  std::vector<std::unique_ptr<AsyncShapingJob>> done;
+  SDL_LockMutex(async_mutex_);
+  done.swap(async_done_);
+  SDL_UnlockMutex(async_mutex_);
+
+  for (auto &job : done) {
+    async_requested_[job->text].erase(static_cast<int32_t>(job->ysize));
+
+    // Jobs queued before a mode change have the wrong kind of glyphs. The
+    // next request queues them again.
+    if (job->failed || job->sdf != sdf_) continue;
+
+    // Copy the glyphs into the cache, so CreateBuffer() finds them all there.
+    bool stored = true;
+    for (auto &image : job->images) {
+      if (!glyph_cache_->Set(image.pixels.get(), job->converted_ysize,
+                             image.entry)) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Glyph cache is full. Need to flush and re-create.\n");
+        stored = false;
+        break;
+      }
+    }
+    if (stored) {
+      CreateBuffer(job->text.c_str(), job->ysize, job->string_width,
+                   job->glyphs);
+    }
+  }
+}
+
 FontBuffer *FontManager::UpdateUV(const int32_t ysize, FontBuffer *buffer) {
   if (buffer->get_revision() != current_atlas_revision_) {
     // Cache revision has been updated.
@@ -213,17 +567,19 @@ FontBuffer *FontManager::UpdateUV(const int32_t ysize, FontBuffer *buffer) {
       }
 
       // Update UV.
-      buffer->UpdateUV(i, cache->get_uv());
+      buffer->UpdateUV(i, cache->get_uv(), cache->get_page());
 
       // Update revision.
       buffer->set_revision(glyph_cache_->get_revision());
     }
+    buffer->BuildSlices();
   }
   return buffer;
 }
 
 FontTexture *FontManager::GetTexture(const char *text,
                                      const float original_ysize) {
+  MemoryTagScope tag(kMemoryTagFonts);
   // Round up y size if the size selector is set.
   int32_t ysize = ConvertSize(original_ysize);
 
@@ -231,7 +587,10 @@ FontTexture *FontManager::GetTexture(const char *text,
   auto it = map_textures_.find(text);
   if (it != map_textures_.end()) {
     auto t = it->second.find(ysize);
-    if (t != it->second.end()) return t->second.get();
+    if (t != it->second.end()) {
+      t->second->set_last_used_frame(frame_);
+      return t->second.get();
+    }
   }
 
   // Otherwise, create new texture.
@@ -240,7 +599,7 @@ FontTexture *FontManager::GetTexture(const char *text,
   FT_Set_Pixel_Sizes(face_, 0, ysize);
 
   // Layout text.
-  auto string_width = LayoutText(text);
+  auto string_width = LayoutText(text, harfbuzz_font_, harfbuzz_buf_);
 
   // Retrieve layout info.
   uint32_t glyph_count;
@@ -283,7 +642,8 @@ FontTexture *FontManager::GetTexture(const char *text,
     // Calculate internal/external leading value and expand a buffer if
     // necessary.
     FontMetrics new_metrics;
-    if (UpdateMetrics(glyph, initial_metrics, &new_metrics)) {
+    if (UpdateMetrics(glyph->bitmap_top, glyph->bitmap.rows, initial_metrics,
+                      &new_metrics)) {
       if (new_metrics.total() != initial_metrics.total()) {
         // Expand buffer and update height if necessary.
         if (ExpandBuffer(width, height, initial_metrics, new_metrics, &image)) {
@@ -312,6 +672,12 @@ FontTexture *FontManager::GetTexture(const char *text,
            kFreeTypeUnit;
   }
 
+  // The string image is laid out edge to edge, so its field is clipped at the
+  // texture's border.
+  if (sdf_) {
+    image = CreateDistanceField(image.get(), width, vec2i(width, height), 0);
+  }
+
   // Create new texture.
   FontTexture *tex = new FontTexture(*renderer_);
   tex->LoadFromMemory(image.get(), vec2i(width, height), kFormatLuminance,
@@ -325,6 +691,7 @@ FontTexture *FontManager::GetTexture(const char *text,
 
   // Setup font metrics.
   tex->set_metrics(initial_metrics);
+  tex->set_last_used_frame(frame_);
 
   // Cleanup buffer contents.
   hb_buffer_clear_contents(harfbuzz_buf_);
@@ -386,6 +753,7 @@ bool FontManager::ExpandBuffer(const int32_t width, const int32_t height,
 
 bool FontManager::Open(const char *font_name) {
   assert(!face_initialized_);
+  MemoryTagScope tag(kMemoryTagFonts);
 
   // Load the font file of assets.
   if (!LoadFile(font_name, &font_data_)) {
@@ -424,8 +792,16 @@ bool FontManager::Open(const char *font_name) {
 bool FontManager::Close() {
   if (!face_initialized_) return false;
 
+  StopAsyncWorker();
+
   map_textures_.clear();
 
+  preshaped_glyphs_.clear();
+
+  baked_strings_.clear();
+
+  baked_glyphs_.clear();
+
   map_buffers_.clear();
 
   hb_font_destroy(harfbuzz_font_);
@@ -442,26 +818,119 @@ bool FontManager::Close() {
 void FontManager::StartLayoutPass() {
   // Reset pass.
   current_pass_ = 0;
+  frame_++;
+
+  // Drop strings that are no longer drawn, before adding any new ones.
+  EvictCachedStrings();
+
+  // Turn strings the worker has shaped since the last frame into buffers.
+  FinishAsyncJobs();
+}
+
+// Remove entries from a FontManager string cache: first those last used
+// before 'expire_frame', then the least recently used ones until at most
+// 'max_entries' remain. Entries used on or after 'keep_frame' are never
+// removed. Returns the number of entries left, and their size in *bytes.
+template <typename T>
+static size_t EvictStrings(
+    std::unordered_map<std::string,
+                       std::unordered_map<int32_t, std::unique_ptr<T>>> *map,
+    const size_t max_entries, const int32_t expire_frame,
+    const int32_t keep_frame, size_t *bytes, int32_t *evicted) {
+  struct Candidate {
+    int32_t frame;
+    const std::string *text;
+    int32_t ysize;
+  };
+  std::vector<Candidate> candidates;
+  size_t count = 0;
+  for (auto it = map->begin(); it != map->end(); ++it) {
+    for (auto t = it->second.begin(); t != it->second.end();) {
+      const int32_t frame = t->second->last_used_frame();
+      if (frame < keep_frame && frame < expire_frame) {
+        t = it->second.erase(t);
+        (*evicted)++;
+        continue;
+      }
+      if (frame < keep_frame) {
+        Candidate candidate = {frame, &it->first, t->first};
+        candidates.push_back(candidate);
+      }
+      count++;
+      ++t;
+    }
+  }
+
+  // Over the limit, drop the least recently used.
+  if (count > max_entries && !candidates.empty()) {
+    const size_t excess = std::min(count - max_entries, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + excess,
+                      candidates.end(),
+                      [](const Candidate &a, const Candidate &b) {
+                        return a.frame < b.frame;
+                      });
+    for (size_t i = 0; i < excess; ++i) {
+      map->find(*candidates[i].text)->second.erase(candidates[i].ysize);
+    }
+    count -= excess;
+    *evicted += static_cast<int32_t>(excess);
+  }
+
+  // Tidy up strings with no sizes left, and add up what remains.
+  *bytes = 0;
+  for (auto it = map->begin(); it != map->end();) {
+    if (it->second.empty()) {
+      it = map->erase(it);
+      continue;
+    }
+    for (auto t = it->second.begin(); t != it->second.end(); ++t) {
+      *bytes += t->second->memory_size();
+    }
+    ++it;
+  }
+  return count;
+}
+
+void FontManager::EvictCachedStrings() {
+  // Anything used in the previous frame may still be referenced.
+  const int32_t keep_frame = frame_ - 1;
+  const int32_t expire_frame = frame_ - max_age_;
+  cache_stats_.buffers =
+      EvictStrings(&map_buffers_, max_buffers_, expire_frame, keep_frame,
+                   &cache_stats_.buffer_bytes, &cache_stats_.evicted_buffers);
+  cache_stats_.textures = EvictStrings(
+      &map_textures_, max_textures_, expire_frame, keep_frame,
+      &cache_stats_.texture_bytes, &cache_stats_.evicted_textures);
 }
 
 void FontManager::UpdatePass(const bool start_subpass) {
+  MemoryTagScope tag(kMemoryTagFonts);
   // Increment a cycle counter in glyph cache.
   glyph_cache_->Update();
 
-  if (glyph_cache_->get_dirty_state() && current_pass_ <= 0) {
-    auto rect = glyph_cache_->get_dirty_rect();
-    atlas_texture_.get()->Set(0);
-
-    // In OpenGL ES2.0, width and pitch of the src buffer needs to match. So
-    // that we are updating entire row at once.
-    // TODO: Optimize glTexSubImage2D call in ES3.0 capable platform.
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, rect.y(),
-                    glyph_cache_.get()->get_size().x(), rect.w() - rect.y(),
-                    GL_LUMINANCE, GL_UNSIGNED_BYTE,
-                    glyph_cache_.get()->get_buffer() +
-                        glyph_cache_.get()->get_size().x() * rect.y());
-    current_atlas_revision_ = glyph_cache_->get_revision();
-    glyph_cache_->set_dirty_state(false);
+  if (current_pass_ <= 0) {
+    // Pages may have been added during the layout pass.
+    CreateAtlasTextures();
+
+    for (int32_t i = 0; i < glyph_cache_->get_num_pages(); ++i) {
+      auto page = glyph_cache_->get_page(i);
+      if (!page->get_dirty_state()) continue;
+      auto rect = page->get_dirty_rect();
+      atlas_textures_[i]->Set(0);
+
+      // In OpenGL ES2.0, width and pitch of the src buffer needs to match. So
+      // that we are updating entire row at once.
+      // TODO: Optimize glTexSubImage2D call in ES3.0 capable platform.
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, rect.y(),
+                      glyph_cache_->get_size().x(), rect.w() - rect.y(),
+                      GL_LUMINANCE, GL_UNSIGNED_BYTE,
+                      page->get_buffer() +
+                          glyph_cache_->get_size().x() * rect.y());
+      Renderer::CountUpload(static_cast<size_t>(glyph_cache_->get_size().x()) *
+                            (rect.w() - rect.y()));
+      current_atlas_revision_ = glyph_cache_->get_revision();
+      page->set_dirty_state(false);
+    }
   }
 
   if (start_subpass) {
@@ -481,23 +950,148 @@ void FontManager::UpdatePass(const bool start_subpass) {
   }
 }
 
-uint32_t FontManager::LayoutText(const char *text) {
+void FontManager::EnableSDF(const bool enable) {
+  if (sdf_ == enable) return;
+  sdf_ = enable;
+
+  // Everything cached so far was rasterized for the other mode.
+  map_textures_.clear();
+  map_buffers_.clear();
+  glyph_cache_->Flush();
+  current_atlas_revision_ = glyph_cache_->get_revision();
+}
+
+float FontManager::GetSDFSmoothing(const float ysize) const {
+  // Field texels per screen pixel, times field units per texel.
+  const float smoothing = 0.5f * kSDFGlyphSize /
+                          (std::max(ysize, 1.0f) * kSDFSpread);
+  return std::min(smoothing, 0.5f);
+}
+
+// Squared distance transform of one row or column, 'f', of length 'n', after
+// Felzenszwalb & Huttenlocher. 'v' and 'z' are scratch space of length n and
+// n + 1.
+static void DistanceTransform1D(const float *f, const int32_t n, float *d,
+                                int32_t *v, float *z) {
+  const float kInfinity = 1e20f;
+  int32_t k = 0;
+  v[0] = 0;
+  z[0] = -kInfinity;
+  z[1] = kInfinity;
+  for (int32_t q = 1; q < n; ++q) {
+    float s;
+    for (;;) {
+      const int32_t r = v[k];
+      s = ((f[q] + q * q) - (f[r] + r * r)) / (2.0f * (q - r));
+      if (s > z[k] || k == 0) break;
+      k--;
+    }
+    if (s <= z[k]) s = z[k];
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k + 1] = kInfinity;
+  }
+  k = 0;
+  for (int32_t q = 0; q < n; ++q) {
+    while (z[k + 1] < q) k++;
+    const int32_t r = v[k];
+    d[q] = (q - r) * (q - r) + f[r];
+  }
+}
+
+// Squared distance from each pixel of a width x height grid to the nearest
+// pixel for which 'grid' is zero, computed in place.
+static void DistanceTransform2D(float *grid, const int32_t width,
+                                const int32_t height) {
+  const int32_t n = std::max(width, height);
+  std::vector<float> f(n), d(n), z(n + 1);
+  std::vector<int32_t> v(n);
+  for (int32_t x = 0; x < width; ++x) {
+    for (int32_t y = 0; y < height; ++y) f[y] = grid[y * width + x];
+    DistanceTransform1D(&f[0], height, &d[0], &v[0], &z[0]);
+    for (int32_t y = 0; y < height; ++y) grid[y * width + x] = d[y];
+  }
+  for (int32_t y = 0; y < height; ++y) {
+    memcpy(&f[0], &grid[y * width], width * sizeof(float));
+    DistanceTransform1D(&f[0], width, &d[0], &v[0], &z[0]);
+    memcpy(&grid[y * width], &d[0], width * sizeof(float));
+  }
+}
+
+std::unique_ptr<uint8_t[]> FontManager::CreateDistanceField(
+    const uint8_t *bitmap, const int32_t pitch, const vec2i &size,
+    const int32_t padding) {
+  const float kInfinity = 1e20f;
+  const uint8_t kCoverageThreshold = 128;
+  const int32_t width = size.x() + padding * 2;
+  const int32_t height = size.y() + padding * 2;
+
+  // Distances to the nearest inside pixel, and to the nearest outside one.
+  std::vector<float> to_inside(width * height), to_outside(width * height);
+  for (int32_t y = 0; y < height; ++y) {
+    for (int32_t x = 0; x < width; ++x) {
+      const int32_t bx = x - padding;
+      const int32_t by = y - padding;
+      const bool inside = bx >= 0 && by >= 0 && bx < size.x() &&
+                          by < size.y() &&
+                          bitmap[by * pitch + bx] >= kCoverageThreshold;
+      to_inside[y * width + x] = inside ? 0.0f : kInfinity;
+      to_outside[y * width + x] = inside ? kInfinity : 0.0f;
+    }
+  }
+  DistanceTransform2D(&to_inside[0], width, height);
+  DistanceTransform2D(&to_outside[0], width, height);
+
+  // The outline lies half way between an inside and an outside pixel.
+  std::unique_ptr<uint8_t[]> field(new uint8_t[width * height]);
+  const float kUnitsPerPixel = 127.0f / kSDFSpread;
+  for (int32_t i = 0; i < width * height; ++i) {
+    const float distance = to_outside[i] > 0.0f
+                               ? sqrtf(to_outside[i]) - 0.5f
+                               : 0.5f - sqrtf(to_inside[i]);
+    const float value = 128.0f + distance * kUnitsPerPixel;
+    field[i] = static_cast<uint8_t>(mathfu::Clamp(value, 0.0f, 255.0f));
+  }
+  return field;
+}
+
+void FontManager::CreateAtlasTextures() {
+  if (renderer_ == nullptr) return;
+  for (int32_t i = static_cast<int32_t>(atlas_textures_.size());
+       i < glyph_cache_->get_num_pages(); ++i) {
+    auto texture = new Texture(*renderer_);
+    texture->LoadFromMemory(glyph_cache_->get_page(i)->get_buffer(),
+                            glyph_cache_->get_size(), kFormatLuminance, false);
+
+    // Disable mipmap for the atlas texture.
+    texture->Set(0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+    // The texture now holds the page's current contents.
+    glyph_cache_->get_page(i)->set_dirty_state(false);
+    atlas_textures_.emplace_back(texture);
+  }
+}
+
+uint32_t FontManager::LayoutText(const char *text, hb_font_t *font,
+                                 hb_buffer_t *buffer) {
   size_t length = strlen(text);
 
   // TODO: make harfbuzz settings (and other font settings) configurable.
   // Set harfbuzz settings.
-  hb_buffer_set_direction(harfbuzz_buf_, HB_DIRECTION_LTR);
-  hb_buffer_set_script(harfbuzz_buf_, HB_SCRIPT_LATIN);
-  hb_buffer_set_language(harfbuzz_buf_, hb_language_from_string(text, length));
+  hb_buffer_set_direction(buffer, HB_DIRECTION_LTR);
+  hb_buffer_set_script(buffer, HB_SCRIPT_LATIN);
+  hb_buffer_set_language(buffer, hb_language_from_string(text, length));
 
   // Layout the text.
-  hb_buffer_add_utf8(harfbuzz_buf_, text, length, 0, length);
-  hb_shape(harfbuzz_font_, harfbuzz_buf_, nullptr, 0);
+  hb_buffer_add_utf8(buffer, text, length, 0, length);
+  hb_shape(font, buffer, nullptr, 0);
 
   // Retrieve layout info.
   uint32_t glyph_count;
   hb_glyph_position_t *glyph_pos =
-      hb_buffer_get_glyph_positions(harfbuzz_buf_, &glyph_count);
+      hb_buffer_get_glyph_positions(buffer, &glyph_count);
 
   // Retrieve a width of the string.
   uint32_t string_width = 0;
@@ -509,22 +1103,41 @@ uint32_t FontManager::LayoutText(const char *text) {
   return string_width;
 }
 
-bool FontManager::UpdateMetrics(const FT_GlyphSlot g,
+uint32_t FontManager::ShapeText(const char *text, hb_font_t *font,
+                                hb_buffer_t *buffer,
+                                std::vector<ShapedGlyph> *glyphs) {
+  auto string_width = LayoutText(text, font, buffer);
+
+  // Retrieve layout info.
+  uint32_t glyph_count;
+  hb_glyph_info_t *glyph_info = hb_buffer_get_glyph_infos(buffer, &glyph_count);
+  hb_glyph_position_t *glyph_pos =
+      hb_buffer_get_glyph_positions(buffer, &glyph_count);
+  glyphs->resize(glyph_count);
+  for (uint32_t i = 0; i < glyph_count; ++i) {
+    (*glyphs)[i].code_point = glyph_info[i].codepoint;
+    (*glyphs)[i].x_advance = glyph_pos[i].x_advance;
+    (*glyphs)[i].y_advance = glyph_pos[i].y_advance;
+  }
+
+  // Cleanup buffer contents.
+  hb_buffer_clear_contents(buffer);
+  return string_width;
+}
+
+bool FontManager::UpdateMetrics(const int32_t top, const int32_t rows,
                                 const FontMetrics &current_metrics,
                                 FontMetrics *new_metrics) {
   // Calculate internal/external leading value and expand a buffer if
   // necessary.
-  if (g->bitmap_top > current_metrics.ascender() ||
-      static_cast<int32_t>(g->bitmap_top - g->bitmap.rows) <
-      current_metrics.descender()) {
+  if (top > current_metrics.ascender() ||
+      top - rows < current_metrics.descender()) {
     *new_metrics = current_metrics;
-    new_metrics->set_internal_leading(
-        std::max(current_metrics.internal_leading(),
-                 g->bitmap_top - current_metrics.ascender()));
+    new_metrics->set_internal_leading(std::max(
+        current_metrics.internal_leading(), top - current_metrics.ascender()));
     new_metrics->set_external_leading(
         std::min(current_metrics.external_leading(),
-                 static_cast<int32_t>(g->bitmap_top - g->bitmap.rows
-                                      - current_metrics.descender())));
+                 top - rows - current_metrics.descender()));
     new_metrics->set_base_line(new_metrics->internal_leading() +
                                new_metrics->ascender());
 
@@ -538,25 +1151,22 @@ const GlyphCacheEntry *FontManager::GetCachedEntry(const uint32_t code_point,
   auto cache = glyph_cache_->Find(code_point, ysize);
 
   if (cache == nullptr) {
-    // Load glyph using harfbuzz layout information.
-    // Note that harfbuzz takes care of ligatures.
-    FT_Error err;
-    if ((err = FT_Load_Glyph(face_, code_point, FT_LOAD_RENDER))) {
-      // Error. This could happen typically the loaded font does not support
-      // particular glyph.
-      SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Can't load glyph %c FT_Error:%d\n",
-                   code_point, err);
-      return nullptr;
+    // Store the glyph to cache, from its baked image if it has one.
+    auto baked = baked_sdf_ == sdf_
+                     ? baked_glyphs_.find(BakedGlyphKey(code_point, ysize))
+                     : baked_glyphs_.end();
+    if (baked != baked_glyphs_.end()) {
+      cache = glyph_cache_->Set(baked->second.pixels.get(), ysize,
+                                baked->second.entry);
+    } else {
+      GlyphCacheEntry entry;
+      std::unique_ptr<uint8_t[]> image;
+      if (!RasterizeGlyph(face_, code_point, sdf_, &entry, &image)) {
+        return nullptr;
+      }
+      cache = glyph_cache_->Set(image.get(), ysize, entry);
     }
 
-    // Store the glyph to cache.
-    FT_GlyphSlot g = face_->glyph;
-    GlyphCacheEntry entry;
-    entry.set_code_point(code_point);
-    entry.set_size(vec2i(g->bitmap.width, g->bitmap.rows));
-    entry.set_offset(vec2i(g->bitmap_left, g->bitmap_top));
-    cache = glyph_cache_->Set(g->bitmap.buffer, ysize, entry);
-
     if (cache == nullptr) {
       // Glyph cache need to be flushed.
       // Returning nullptr here for a retry.
@@ -568,8 +1178,46 @@ const GlyphCacheEntry *FontManager::GetCachedEntry(const uint32_t code_point,
   return cache;
 }
 
+bool FontManager::RasterizeGlyph(FT_Face face, const uint32_t code_point,
+                                 const bool sdf, GlyphCacheEntry *entry,
+                                 std::unique_ptr<uint8_t[]> *image) {
+  // Load glyph using harfbuzz layout information.
+  // Note that harfbuzz takes care of ligatures.
+  FT_Error err;
+  if ((err = FT_Load_Glyph(face, code_point, FT_LOAD_RENDER))) {
+    // Error. This could happen typically the loaded font does not support
+    // particular glyph.
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Can't load glyph %c FT_Error:%d\n",
+                 code_point, err);
+    return false;
+  }
+
+  FT_GlyphSlot g = face->glyph;
+  entry->set_code_point(code_point);
+  entry->set_size(vec2i(g->bitmap.width, g->bitmap.rows));
+  entry->set_offset(vec2i(g->bitmap_left, g->bitmap_top));
+
+  if (sdf) {
+    // In SDF mode, the field extends kSDFSpread beyond the glyph's bitmap.
+    *image = CreateDistanceField(g->bitmap.buffer, g->bitmap.pitch,
+                                 entry->get_size(), kSDFSpread);
+    entry->set_size(entry->get_size() + vec2i(kSDFSpread * 2, kSDFSpread * 2));
+    entry->set_offset(entry->get_offset() + vec2i(-kSDFSpread, kSDFSpread));
+  } else {
+    // Copy the bitmap out of the glyph slot, which the next load reuses.
+    image->reset(new uint8_t[g->bitmap.width * g->bitmap.rows]);
+    for (uint32_t y = 0; y < static_cast<uint32_t>(g->bitmap.rows); ++y) {
+      memcpy(image->get() + y * g->bitmap.width,
+             &g->bitmap.buffer[y * g->bitmap.pitch], g->bitmap.width);
+    }
+  }
+  return true;
+}
+
 int32_t FontManager::ConvertSize(const int32_t original_ysize) {
-  if (size_selector_ != nullptr) {
+  if (sdf_) {
+    return kSDFGlyphSize;
+  } else if (size_selector_ != nullptr) {
     return size_selector_(original_ysize);
   } else {
     return original_ysize;
@@ -595,11 +1243,38 @@ void FontBuffer::AddVertices(const vec2 &pos, const int32_t base_line,
                          0.0f);
 }
 
-void FontBuffer::UpdateUV(const int32_t index, const vec4 &uv) {
+void FontBuffer::UpdateUV(const int32_t index, const vec4 &uv,
+                          const int32_t page) {
   vertices_[index * 4].uv_ = uv.xy();
   vertices_[index * 4 + 1].uv_ = mathfu::vec2(uv.x(), uv.w());
   vertices_[index * 4 + 2].uv_ = mathfu::vec2(uv.z(), uv.y());
   vertices_[index * 4 + 3].uv_ = uv.zw();
+  if (pages_.size() <= static_cast<size_t>(index)) pages_.resize(index + 1);
+  pages_[index] = page;
+}
+
+void FontBuffer::BuildSlices() {
+  slices_.clear();
+  indices_.clear();
+  const uint16_t kIndices[] = {0, 1, 2, 1, 2, 3};
+
+  // Most strings fit on one page, so take a pass over the glyphs per page
+  // used rather than sorting them.
+  std::vector<bool> done(pages_.size(), false);
+  for (size_t i = 0; i < pages_.size(); ++i) {
+    if (done[i]) continue;
+    const int32_t page = pages_[i];
+    const int32_t start = static_cast<int32_t>(indices_.size());
+    for (size_t j = i; j < pages_.size(); ++j) {
+      if (done[j] || pages_[j] != page) continue;
+      for (auto index : kIndices) {
+        indices_.push_back(static_cast<uint16_t>(index + j * 4));
+      }
+      done[j] = true;
+    }
+    slices_.push_back(FontBufferSlice(
+        page, start, static_cast<int32_t>(indices_.size()) - start));
+  }
 }
 
 }  // namespace fpl
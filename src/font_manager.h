@@ -15,9 +15,11 @@
 #ifndef FONT_MANAGER_H
 #define FONT_MANAGER_H
 
+#include <unordered_set>
 #include "renderer.h"
 #include "glyph_cache.h"
 #include "common.h"
+#include "worker_pool.h"
 
 // Forward decls for FreeType & Harfbuzz
 typedef struct FT_LibraryRec_ *FT_Library;
@@ -43,6 +45,44 @@ const int32_t kFreeTypeUnit = 64;
 const int32_t kGlyphCacheWidth = 1024;
 const int32_t kGlyphCacheHeight = 1024;
 
+// Default number of pages (atlas textures) the glyph cache may grow to. Each
+// page takes kGlyphCacheWidth * kGlyphCacheHeight bytes.
+const int32_t kGlyphCacheMaxPages = 4;
+
+// In SDF mode, the size in pixels glyphs are rasterized at, and how far in
+// pixels the distance field reaches either side of each glyph's outline.
+const int32_t kSDFGlyphSize = 48;
+const int32_t kSDFSpread = 6;
+
+// Default limits on the strings FontManager keeps a FontBuffer or FontTexture
+// for, and how many layout passes an unused one is kept.
+const size_t kFontCacheMaxBuffers = 256;
+const size_t kFontCacheMaxTextures = 32;
+const int32_t kFontCacheMaxAge = 600;
+
+// Characters of numbers, scores and timers, for SetPreshapedCharacters().
+const char kNumericCharacters[] = "0123456789+-.,:/% ";
+
+// How full FontManager's string caches are.
+struct FontCacheStats {
+  FontCacheStats()
+      : buffers(0),
+        textures(0),
+        buffer_bytes(0),
+        texture_bytes(0),
+        evicted_buffers(0),
+        evicted_textures(0) {}
+
+  // Cached strings, and the memory they use.
+  size_t buffers;
+  size_t textures;
+  size_t buffer_bytes;
+  size_t texture_bytes;
+  // Strings dropped since the font manager was created.
+  int32_t evicted_buffers;
+  int32_t evicted_textures;
+};
+
 // FontManager manages font rendering with OpenGL utilizing freetype
 // and harfbuzz as a glyph rendering and layout back end.
 //
@@ -50,14 +90,18 @@ const int32_t kGlyphCacheHeight = 1024;
 // An application can use the generated texture for a text rendering.
 //
 // The class is not threadsafe, it's expected to be only used from
-// within OpenGL rendering thread.
+// within OpenGL rendering thread. GetBufferAsync() hands work to jobs on a
+// WorkerPool, which use a separate FreeType face.
 class FontManager {
  public:
   FontManager();
   // Constructor with a cache size in pixels.
   // The given size is rounded up to nearest power of 2 internally to be used as
   // an OpenGL texture sizes.
-  FontManager(const mathfu::vec2i &cache_size);
+  // max_pages is how many textures of that size the glyph cache may use
+  // before it evicts glyphs.
+  FontManager(const mathfu::vec2i &cache_size,
+              const int32_t max_pages = kGlyphCacheMaxPages);
   ~FontManager();
 
   // Open font face, TTF, OT fonts are supported.
@@ -81,19 +125,26 @@ class FontManager {
   // FlushAndUpdate() call and re-try the GetBuffer() call.
   FontBuffer *GetBuffer(const char *text, const float ysize);
 
+  // Like GetBuffer(), but shapes and rasterizes new strings in a job on the
+  // worker pool instead of the calling thread. Until the buffer is ready,
+  // returns nullptr; keep asking each frame, and it's returned once a
+  // StartLayoutPass() after the job finishes has collected it. That's
+  // usually a frame or two later. Buffers it returns are the same as
+  // GetBuffer()'s, and they share the same cache. Without a worker pool, it
+  // does the work right away, like GetBuffer().
+  FontBuffer *GetBufferAsync(const char *text, const float ysize);
+
+  // The pool GetBufferAsync() runs its jobs on. It must outlive the jobs,
+  // which Close() waits for.
+  void set_worker_pool(WorkerPool *pool) { worker_pool_ = pool; }
+
   // Set renderer. Renderer is used to create a texture instance.
   void SetRenderer(Renderer &renderer) {
     renderer_ = &renderer;
 
-    // Initialize the font atlas texture.
-    atlas_texture_.reset(new Texture(renderer));
-    atlas_texture_.get()->LoadFromMemory(glyph_cache_->get_buffer(),
-                                         glyph_cache_->get_size(),
-                                         kFormatLuminance, false);
-
-    // Disable mipmap for the atlas texture.
-    atlas_texture_.get()->Set(0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    // Initialize the font atlas textures.
+    atlas_textures_.clear();
+    CreateAtlasTextures();
   }
 
   // Returns if a font has been loaded.
@@ -121,8 +172,77 @@ class FontManager {
   // a render pass.
   void StartRenderPass() { UpdatePass(false); }
 
-  // Getter of the font atlas texture.
-  Texture *GetAtlasTexture() { return atlas_texture_.get(); }
+  // Getter of the font atlas texture of a glyph cache page. A FontBuffer's
+  // slices say which page each part of it uses.
+  Texture *GetAtlasTexture(const int32_t page = 0) {
+    return atlas_textures_[page].get();
+  }
+
+  // Glyph cache usage since it was last flushed, for tuning its size.
+  const GlyphCacheStats &GetGlyphCacheStats() const {
+    return glyph_cache_->get_stats();
+  }
+  int32_t GetGlyphCachePages() const { return glyph_cache_->get_num_pages(); }
+
+  // True if glyphs were cached since the atlas textures were last uploaded,
+  // i.e. a buffer created now would not draw correctly until the next
+  // StartRenderPass().
+  bool AtlasDirty() const { return glyph_cache_->get_dirty_state(); }
+
+  // Limit the strings that GetBuffer() and GetTexture() keep results for.
+  // Strings unused for more than 'max_age' layout passes are dropped, and
+  // beyond 'max_buffers' or 'max_textures' the least recently used ones are
+  // dropped too. Strings used since the previous StartLayoutPass() are always
+  // kept, since the caller may still be drawing them.
+  void SetCacheLimits(const size_t max_buffers, const size_t max_textures,
+                      const int32_t max_age) {
+    max_buffers_ = max_buffers;
+    max_textures_ = max_textures;
+    max_age_ = max_age;
+  }
+
+  // Strings made up only of 'characters' are laid out by GetBuffer() from
+  // glyphs shaped once per size, one character at a time, rather than by
+  // running harfbuzz over the whole string. That makes new strings like
+  // changing scores and timers cheap to lay out, at the cost of kerning and
+  // ligatures between the characters, which digits rarely have. Characters
+  // must be ASCII. Pass nullptr or "" to shape every string in full.
+  void SetPreshapedCharacters(const char *characters);
+
+  // Load text that scripts/build_assets.py shaped and rasterized offline, with
+  // pie_noon_font_baker. GetBuffer() lays out the baked strings without
+  // harfbuzz, and caches their glyphs from the baked images rather than
+  // rasterizing them; other strings are shaped as usual. Baked text is only
+  // used in the mode it was baked in (see EnableSDF()), and at the glyph sizes
+  // it was baked at. Call after Open(); Close() drops it. Returns false,
+  // leaving every string to be shaped at runtime, if the file is missing or
+  // isn't baked text.
+  bool LoadBakedText(const char *filename);
+
+  // Shape 'text' at 'ysize' and rasterize its glyphs in the current mode, and
+  // keep them as baked text. Baking in the other mode drops what was baked
+  // before. Returns false if a glyph can't be rasterized.
+  bool BakeString(const char *text, const float ysize);
+
+  // Write the baked text, from BakeString() or LoadBakedText(), to 'filename'
+  // for LoadBakedText() to read.
+  bool SaveBakedText(const char *filename) const;
+
+  // Occupancy of the string caches, as of the last StartLayoutPass().
+  const FontCacheStats &GetCacheStats() const { return cache_stats_; }
+
+  // In SDF (signed distance field) mode, each glyph is rasterized once, at
+  // kSDFGlyphSize, and stored as the distance to its outline rather than its
+  // coverage. Text of any size is drawn from those same glyphs with the
+  // "shaders/font_sdf" shader, whose sdf_smoothing uniform comes from
+  // GetSDFSmoothing(). The size selector is ignored in this mode.
+  // Changing the mode flushes every cached glyph, buffer and texture.
+  void EnableSDF(const bool enable);
+  bool SDFEnabled() const { return sdf_; }
+
+  // The sdf_smoothing uniform for text drawn 'ysize' pixels high: the
+  // distance field range that one screen pixel covers.
+  float GetSDFSmoothing(const float ysize) const;
 
   // The user can supply a size selector function to adjust glyph sizes when
   // storing a glyph cache entry.
@@ -155,14 +275,115 @@ class FontManager {
                            const FontMetrics &new_metrics,
                            std::unique_ptr<uint8_t[]> *image);
 
-  // Layout text and update harfbuzz_buf_.
+  // One glyph of a shaped string, and how far to move the pen after it, in
+  // FreeType units.
+  struct ShapedGlyph {
+    uint32_t code_point;
+    int32_t x_advance;
+    int32_t y_advance;
+  };
+
+  // A rasterized glyph, waiting to be stored in the glyph cache.
+  struct FontGlyphImage {
+    GlyphCacheEntry entry;
+    std::unique_ptr<uint8_t[]> pixels;
+  };
+
+  // A string shaped offline. See LoadBakedText().
+  struct BakedString {
+    uint32_t string_width;
+    std::vector<ShapedGlyph> glyphs;
+  };
+
+  // A string for a pool job to shape and rasterize. The job owns it until
+  // it's pushed to async_done_.
+  struct AsyncShapingJob {
+    AsyncShapingJob()
+        : ysize(0), converted_ysize(0), sdf(false), string_width(0),
+          failed(false) {}
+
+    std::string text;
+    float ysize;
+    int32_t converted_ysize;
+    bool sdf;
+
+    // Results.
+    uint32_t string_width;
+    std::vector<ShapedGlyph> glyphs;
+    std::vector<FontGlyphImage> images;
+    bool failed;
+  };
+
+  // Layout text and update 'buffer'.
   // Returns the width of the text layout in pixels.
-  uint32_t LayoutText(const char *text);
+  static uint32_t LayoutText(const char *text, hb_font_t *font,
+                             hb_buffer_t *buffer);
+
+  // Layout text, and copy the result out of 'buffer' into 'glyphs'.
+  // Returns the width of the text layout in pixels.
+  static uint32_t ShapeText(const char *text, hb_font_t *font,
+                            hb_buffer_t *buffer,
+                            std::vector<ShapedGlyph> *glyphs);
+
+  // Load and render a glyph of 'face', and copy its image out of FreeType
+  // into 'image'. As a distance field if 'sdf'.
+  static bool RasterizeGlyph(FT_Face face, const uint32_t code_point,
+                             const bool sdf, GlyphCacheEntry *entry,
+                             std::unique_ptr<uint8_t[]> *image);
+
+  // Lay out 'text' from the glyphs shaped by SetPreshapedCharacters(), if
+  // every character is one of them. Returns false if not.
+  bool LayoutPreshapedText(const char *text, const int32_t converted_ysize,
+                           std::vector<ShapedGlyph> *glyphs,
+                           uint32_t *string_width);
+
+  // The string baked for 'text' at 'converted_ysize' in the current mode, or
+  // nullptr if there isn't one.
+  const BakedString *FindBakedString(const char *text,
+                                     const int32_t converted_ysize) const;
+
+  // Key of a glyph image in baked_glyphs_.
+  static uint64_t BakedGlyphKey(const uint32_t code_point,
+                                const int32_t converted_ysize) {
+    return static_cast<uint64_t>(static_cast<uint32_t>(converted_ysize))
+               << 32 |
+           code_point;
+  }
+
+  // If there's a FontBuffer for the string, set *buffer to it (or nullptr if
+  // its glyphs can't be cached again) and return true.
+  bool LookUpBuffer(const char *text, const float ysize, FontBuffer **buffer);
+
+  // Create a FontBuffer from a shaped string, and add it to map_buffers_.
+  FontBuffer *CreateBuffer(const char *text, const float ysize,
+                           const uint32_t string_width,
+                           const std::vector<ShapedGlyph> &glyphs);
+
+  // Background shaping for GetBufferAsync(). The jobs' font instances are
+  // created by the first request, and destroyed by Close() once the last job
+  // has finished.
+  bool StartAsyncWorker();
+  void StopAsyncWorker();
+  // Called from a pool job.
+  void ShapeAsync(AsyncShapingJob *job);
+  // Move the jobs' results into the glyph cache and map_buffers_.
+  void FinishAsyncJobs();
+
+  // Apply the limits set by SetCacheLimits(), and update cache_stats_.
+  void EvictCachedStrings();
+
+  // Convert the 8 bit coverage image 'bitmap' into a distance field, in which
+  // 128 is on the outline and each unit is kSDFSpread / 127 pixels. The result
+  // is 'padding' pixels larger than 'size' on every side.
+  static std::unique_ptr<uint8_t[]> CreateDistanceField(
+      const uint8_t *bitmap, const int32_t pitch, const vec2i &size,
+      const int32_t padding);
 
   // Calculate internal/external leading value and expand a buffer if
   // necessary.
   // Returns true if the size of metrics has been changed.
-  bool UpdateMetrics(const FT_GlyphSlot glyph,
+  // 'top' and 'rows' are the glyph bitmap's top bearing and height.
+  bool UpdateMetrics(const int32_t top, const int32_t rows,
                      const FontMetrics &current_metrics,
                      FontMetrics *new_metrics);
 
@@ -185,6 +406,9 @@ class FontManager {
   // flushed during a rendering pass.
   void UpdatePass(const bool start_subpass);
 
+  // Create an atlas texture for each glyph cache page that doesn't have one.
+  void CreateAtlasTextures();
+
   // Update UV value in the FontBuffer.
   // Returns nullptr if one of UV values couldn't be updated.
   FontBuffer *UpdateUV(const int32_t ysize, FontBuffer *buffer);
@@ -209,6 +433,9 @@ class FontManager {
   // flag indicating if a font file has loaded.
   bool face_initialized_;
 
+  // True if glyphs are stored as signed distance fields. See EnableSDF().
+  bool sdf_;
+
   // Texture cache for a rendered string image.
   // Using the std::string & its' vertical size in pixels (int32_t) as keys.
   // The map is used for GetTexture() API.
@@ -235,13 +462,55 @@ class FontManager {
   // Current atlas texture's contents revision.
   uint32_t current_atlas_revision_;
 
-  // Unique pointer to a font atlas texture.
-  std::unique_ptr<Texture> atlas_texture_;
+  // Font atlas textures, one per glyph cache page.
+  std::vector<std::unique_ptr<Texture>> atlas_textures_;
 
   // Current pass counter.
   // Current implementation only supports up to 2 passes in a rendering cycle.
   int32_t current_pass_;
 
+  // The shaping jobs' own font instances.
+  FT_Face async_face_;
+  hb_font_t *async_harfbuzz_font_;
+  hb_buffer_t *async_harfbuzz_buf_;
+
+  WorkerPool *worker_pool_;
+
+  // The shaping job submitted last. Each one depends on the one before, so
+  // only one at a time uses the font instances above.
+  WorkerPool::JobHandle async_last_job_;
+
+  // This lock protects async_done_.
+  SDL_mutex *async_mutex_;
+
+  std::vector<std::unique_ptr<AsyncShapingJob>> async_done_;
+
+  // Strings and sizes queued and not yet collected, so each is only queued
+  // once. Only touched on the render thread.
+  std::unordered_map<std::string, std::unordered_set<int32_t>>
+      async_requested_;
+
+  // See SetPreshapedCharacters(). Glyphs are indexed by character, per
+  // converted glyph size, with a code point of 0 for those not in the set.
+  std::string preshaped_characters_;
+  std::unordered_map<int32_t, std::vector<ShapedGlyph>> preshaped_glyphs_;
+
+  // See LoadBakedText(). Strings by text and converted glyph size, and glyph
+  // images by BakedGlyphKey(), all rasterized in SDF mode if baked_sdf_.
+  std::unordered_map<std::string, std::unordered_map<int32_t, BakedString>>
+      baked_strings_;
+  std::unordered_map<uint64_t, FontGlyphImage> baked_glyphs_;
+  bool baked_sdf_;
+
+  // Count of layout passes, used to age cached strings.
+  int32_t frame_;
+
+  // See SetCacheLimits().
+  size_t max_buffers_;
+  size_t max_textures_;
+  int32_t max_age_;
+  FontCacheStats cache_stats_;
+
   // Size selector function object used to adjust a glyph size.
   std::function<int32_t(const int32_t)> size_selector_;
 };
@@ -347,15 +616,25 @@ class FontMetrics {
 // Font texture class
 class FontTexture : public Texture {
  public:
-  FontTexture(Renderer &renderer) : Texture(renderer) {}
+  FontTexture(Renderer &renderer)
+      : Texture(renderer), last_used_frame_(0) {}
   ~FontTexture() {}
 
   // Setter/Getter of the metrics parameter of the font texture.
   const FontMetrics &metrics() const { return metrics_; }
   void set_metrics(const FontMetrics &metrics) { metrics_ = metrics; }
 
+  // Setter/Getter of the FontManager layout pass the texture was last
+  // returned in.
+  int32_t last_used_frame() const { return last_used_frame_; }
+  void set_last_used_frame(const int32_t frame) { last_used_frame_ = frame; }
+
+  // Bytes of texture memory used. Font textures are 8 bit luminance.
+  size_t memory_size() const { return size().x() * size().y(); }
+
  private:
   FontMetrics metrics_;
+  int32_t last_used_frame_;
 };
 
 // Font vertex data.
@@ -374,19 +653,31 @@ struct FontVertex {
 
 // Font buffer class
 // Used with the texture atlas rendering.
+// A run of a FontBuffer's indices whose glyphs are all on one glyph cache
+// page, and so can be drawn with that page's atlas texture bound.
+struct FontBufferSlice {
+  FontBufferSlice(const int32_t page, const int32_t start, const int32_t count)
+      : page(page), start(start), count(count) {}
+
+  int32_t page;
+  int32_t start;
+  int32_t count;
+};
+
 class FontBuffer {
  public:
   // Constants
   static const int32_t kIndiciesPerCodePoint = 6;
   static const int32_t kVerticesPerCodePoint = 4;
 
-  FontBuffer() : revision_(0) {}
+  FontBuffer() : revision_(0), last_used_frame_(0) {}
 
   // Constructor with a buffer sizse.
-  FontBuffer(uint32_t size) : revision_(0) {
+  FontBuffer(uint32_t size) : revision_(0), last_used_frame_(0) {
     indices_.reserve(size * kIndiciesPerCodePoint);
     vertices_.reserve(size * kVerticesPerCodePoint);
     code_points_.reserve(size);
+    pages_.reserve(size);
   }
   ~FontBuffer() {}
 
@@ -402,6 +693,10 @@ class FontBuffer {
   std::vector<FontVertex> *get_vertices() { return &vertices_; }
   const std::vector<FontVertex> *get_vertices() const { return &vertices_; }
 
+  // Getter of the index ranges to draw with each atlas page, in the order the
+  // pages were first used. Valid after BuildSlices().
+  const std::vector<FontBufferSlice> &get_slices() const { return slices_; }
+
   // Getter of the code points array.
   std::vector<uint32_t> *get_code_points() { return &code_points_; }
   const std::vector<uint32_t> *get_code_points() const { return &code_points_; }
@@ -424,6 +719,20 @@ class FontBuffer {
   int32_t get_pass() const { return pass_; }
   void set_pass(const int32_t pass) { pass_ = pass; }
 
+  // Setter/Getter of the FontManager layout pass the buffer was last returned
+  // in.
+  int32_t last_used_frame() const { return last_used_frame_; }
+  void set_last_used_frame(const int32_t frame) { last_used_frame_ = frame; }
+
+  // Bytes of memory used by the buffer's arrays.
+  size_t memory_size() const {
+    return indices_.capacity() * sizeof(uint16_t) +
+           vertices_.capacity() * sizeof(FontVertex) +
+           code_points_.capacity() * sizeof(uint32_t) +
+           pages_.capacity() * sizeof(int32_t) +
+           slices_.capacity() * sizeof(FontBufferSlice);
+  }
+
   // Add 4 vertices used for a glyph rendering to the vertex array.
   void AddVertices(const vec2 &pos, const int32_t base_line, const float scale,
                    const GlyphCacheEntry &entry);
@@ -431,7 +740,12 @@ class FontBuffer {
   // Update UV information of a glyph entry.
   // uv vector should include top left corner of UV value as xy, and
   // bottom right of UV value s wz component of the vector.
-  void UpdateUV(const int32_t index, const vec4 &uv);
+  // page is the glyph cache page the UV refers to.
+  void UpdateUV(const int32_t index, const vec4 &uv, const int32_t page);
+
+  // Reorder the indices so that glyphs on the same glyph cache page are
+  // contiguous, and rebuild the slices. Call after updating UVs.
+  void BuildSlices();
 
   // Verify sizes of arrays used in the buffer are correct.
   bool Verify() {
@@ -458,6 +772,12 @@ class FontBuffer {
   // entries when the glyph cache is flushed.
   std::vector<uint32_t> code_points_;
 
+  // Glyph cache page of each code point.
+  std::vector<int32_t> pages_;
+
+  // Index ranges per page, built from pages_.
+  std::vector<FontBufferSlice> slices_;
+
   // Size of the string in pixels.
   vec2i size_;
 
@@ -468,6 +788,9 @@ class FontBuffer {
 
   // Pass id. Each pass should have it's own texture atlas contents.
   int32_t pass_;
+
+  // Layout pass the buffer was last used in.
+  int32_t last_used_frame_;
 };
 
 }  // namespace fpl
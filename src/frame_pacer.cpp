@@ -0,0 +1,44 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "frame_pacer.h"
+
+namespace fpl {
+
+FramePacer::FramePacer()
+    : idle_delay_(0),
+      idle_frame_time_(0),
+      static_frame_time_(0),
+      last_frame_time_(0),
+      last_input_time_(0) {}
+
+void FramePacer::Initialize(WorldTime idle_delay, WorldTime idle_frame_time,
+                            WorldTime static_frame_time) {
+  idle_delay_ = idle_delay;
+  idle_frame_time_ = idle_frame_time;
+  static_frame_time_ = static_frame_time;
+}
+
+WorldTime FramePacer::WaitTime(WorldTime now, FrameContent content) const {
+  if (idle_delay_ <= 0 || content == kFrameContentMoving ||
+      now - last_input_time_ < idle_delay_) {
+    return 0;
+  }
+  const WorldTime frame_time =
+      content == kFrameContentIdle ? idle_frame_time_ : static_frame_time_;
+  return std::max(0, last_frame_time_ + frame_time - now);
+}
+
+}  // namespace fpl
@@ -0,0 +1,66 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_FRAME_PACER_H
+#define FPL_FRAME_PACER_H
+
+#include "common.h"
+
+namespace fpl {
+
+// How much of the screen can change from frame to frame without input.
+enum FrameContent {
+  // The game is being played, or something is loading or fading.
+  kFrameContentMoving,
+  // Only decorations move, such as the characters idling behind a menu.
+  kFrameContentIdle,
+  // Nothing moves until there's input, such as on a tutorial slide.
+  kFrameContentStatic,
+};
+
+// Decides how long to wait between frames, so that screens that aren't
+// changing don't render as fast as vsync allows. Frames run at full rate
+// while the content is moving, and for a while after any input. After that,
+// idle content drops to a low frame rate, and static content to a lower one
+// still, which only exists to keep audio and streaming ticking over.
+class FramePacer {
+ public:
+  FramePacer();
+
+  // 'idle_delay' is how long after the last input to keep running at full
+  // rate. 'idle_frame_time' and 'static_frame_time' are the times between
+  // frames after that, in ms. An 'idle_delay' of 0 disables pacing.
+  void Initialize(WorldTime idle_delay, WorldTime idle_frame_time,
+                  WorldTime static_frame_time);
+
+  // Call at the start of each frame.
+  void StartFrame(WorldTime now) { last_frame_time_ = now; }
+
+  // Call whenever there's input, to return to full rate.
+  void AddInput(WorldTime now) { last_input_time_ = now; }
+
+  // Ms to wait before starting the next frame, showing 'content'.
+  WorldTime WaitTime(WorldTime now, FrameContent content) const;
+
+ private:
+  WorldTime idle_delay_;
+  WorldTime idle_frame_time_;
+  WorldTime static_frame_time_;
+  WorldTime last_frame_time_;
+  WorldTime last_input_time_;
+};
+
+}  // namespace fpl
+
+#endif  // FPL_FRAME_PACER_H
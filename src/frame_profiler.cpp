@@ -0,0 +1,183 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "frame_profiler.h"
+
+namespace fpl {
+
+const size_t FrameProfiler::kEventsPerTrack;
+std::atomic<bool> FrameProfiler::enabled_(false);
+
+std::vector<FrameProfiler::Track *> *FrameProfiler::tracks_ = nullptr;
+
+// Guards tracks_. The TLS slot and the clock origin are set up along with
+// it, before anything is recorded.
+static SDL_SpinLock g_tracks_lock = 0;
+static SDL_TLSID g_track_tls = 0;
+static uint64_t g_counter_origin = 0;
+static uint64_t g_time_origin = 0;
+
+void FrameProfiler::Initialize() {
+  SDL_AtomicLock(&g_tracks_lock);
+  if (tracks_ == nullptr) {
+    tracks_ = new std::vector<Track *>();
+    g_track_tls = SDL_TLSCreate();
+    g_counter_origin = SDL_GetPerformanceCounter();
+    g_time_origin = static_cast<uint64_t>(SDL_GetTicks()) * 1000;
+  }
+  SDL_AtomicUnlock(&g_tracks_lock);
+}
+
+void FrameProfiler::SetEnabled(bool enabled) {
+  Initialize();
+  enabled_.store(enabled, std::memory_order_release);
+}
+
+uint64_t FrameProfiler::Now() {
+  const uint64_t elapsed = SDL_GetPerformanceCounter() - g_counter_origin;
+  return g_time_origin + elapsed * 1000000 / SDL_GetPerformanceFrequency();
+}
+
+FrameProfiler::Track *FrameProfiler::NewTrack(const char *name,
+                                              bool is_thread) {
+  Track *track = new Track();
+  track->name = name;
+  track->is_thread = is_thread;
+  track->events.resize(kEventsPerTrack);
+  SDL_AtomicLock(&g_tracks_lock);
+  tracks_->push_back(track);
+  SDL_AtomicUnlock(&g_tracks_lock);
+  return track;
+}
+
+FrameProfiler::Track *FrameProfiler::ThreadTrack() {
+  Track *track = static_cast<Track *>(SDL_TLSGet(g_track_tls));
+  if (track == nullptr) {
+    track = NewTrack(nullptr, true);
+    SDL_TLSSet(g_track_tls, track, nullptr);
+  }
+  return track;
+}
+
+void FrameProfiler::SetThreadName(const char *name) {
+  // Threads usually name themselves long before the profiler's enabled.
+  Initialize();
+  ThreadTrack()->name = name;
+}
+
+void FrameProfiler::Record(const char *name, uint64_t start, uint64_t end) {
+  Append(ThreadTrack(), name, start, end);
+}
+
+void FrameProfiler::RecordOnTrack(const char *track_name, const char *name,
+                                  uint64_t start, uint64_t end) {
+  // There are only ever a few of these, so a search is quick enough.
+  Track *track = nullptr;
+  SDL_AtomicLock(&g_tracks_lock);
+  for (size_t i = 0; i < tracks_->size() && track == nullptr; ++i) {
+    Track *candidate = (*tracks_)[i];
+    if (!candidate->is_thread && strcmp(candidate->name, track_name) == 0) {
+      track = candidate;
+    }
+  }
+  SDL_AtomicUnlock(&g_tracks_lock);
+  if (track == nullptr) track = NewTrack(track_name, false);
+  Append(track, name, start, end);
+}
+
+void FrameProfiler::Append(Track *track, const char *name, uint64_t start,
+                           uint64_t end) {
+  const uint64_t recorded = track->recorded.load(std::memory_order_relaxed);
+  Event &event = track->events[recorded % kEventsPerTrack];
+  event.name = name;
+  event.start = start;
+  event.duration = end - start;
+  track->recorded.store(recorded + 1, std::memory_order_release);
+}
+
+// Append 's' to 'out' as a JSON string.
+static void AppendJsonString(const char *s, std::string *out) {
+  out->push_back('"');
+  for (; *s != '\0'; ++s) {
+    const char c = *s;
+    if (c == '"' || c == '\\') {
+      out->push_back('\\');
+      out->push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out->append(escaped);
+    } else {
+      out->push_back(c);
+    }
+  }
+  out->push_back('"');
+}
+
+bool FrameProfiler::Write(const char *filename) {
+  std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  AppendEvents(0, &json);
+  // Name the process, which also avoids a trailing comma.
+  json.append(
+      "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+      "\"args\":{\"name\":\"Pie Noon\"}}\n]}\n");
+
+  SDL_RWops *handle = SDL_RWFromFile(filename, "wb");
+  if (!handle) return false;
+  const size_t written = SDL_RWwrite(handle, json.data(), 1, json.size());
+  SDL_RWclose(handle);
+  return written == json.size();
+}
+
+void FrameProfiler::AppendEvents(uint64_t since, std::string *json_out) {
+  std::string &json = *json_out;
+  SDL_AtomicLock(&g_tracks_lock);
+  const size_t track_count = tracks_ != nullptr ? tracks_->size() : 0;
+  for (size_t i = 0; i < track_count; ++i) {
+    const Track &track = *(*tracks_)[i];
+    const int tid = static_cast<int>(i) + 1;
+    char fields[128];
+    json.append("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,");
+    snprintf(fields, sizeof(fields), "\"tid\":%d,\"args\":{\"name\":", tid);
+    json.append(fields);
+    if (track.name != nullptr) {
+      AppendJsonString(track.name, &json);
+    } else {
+      snprintf(fields, sizeof(fields), "\"thread %d\"", tid);
+      json.append(fields);
+    }
+    json.append("}},\n");
+
+    // Only the most recent kEventsPerTrack are still in the ring.
+    const uint64_t recorded = track.recorded.load(std::memory_order_acquire);
+    const uint64_t first =
+        recorded > kEventsPerTrack ? recorded - kEventsPerTrack : 0;
+    for (uint64_t j = first; j < recorded; ++j) {
+      const Event &event = track.events[j % kEventsPerTrack];
+      if (event.start + event.duration < since) continue;
+      json.append("{\"name\":");
+      AppendJsonString(event.name, &json);
+      snprintf(fields, sizeof(fields),
+               ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+               "\"ts\":%llu,\"dur\":%llu},\n",
+               tid, static_cast<unsigned long long>(event.start),
+               static_cast<unsigned long long>(event.duration));
+      json.append(fields);
+    }
+  }
+  SDL_AtomicUnlock(&g_tracks_lock);
+}
+
+}  // namespace fpl
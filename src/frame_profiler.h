@@ -0,0 +1,131 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_FRAME_PROFILER_H
+#define FPL_FRAME_PROFILER_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace fpl {
+
+// Records how long marked scopes take, on every thread, and writes them in
+// the Chrome trace event format, for viewing in chrome://tracing or Perfetto.
+// Each thread records into a ring buffer of its own, so marking a scope takes
+// no lock; only the most recent kEventsPerTrack of each thread are kept.
+//
+// Mark scopes with FPL_PROFILE_SCOPE("name"). Names must be string literals,
+// or otherwise outlive the profiler. Nothing is recorded unless the profiler
+// is enabled, and defining FPL_DISABLE_FRAME_PROFILER compiles the markers
+// out altogether.
+class FrameProfiler {
+ public:
+  static const size_t kEventsPerTrack = 8192;
+
+  // Start or stop recording, on every thread.
+  static void SetEnabled(bool enabled);
+  static bool enabled() { return enabled_.load(std::memory_order_acquire); }
+
+  // Name the calling thread's track in the trace.
+  static void SetThreadName(const char *name);
+
+  // Microseconds since SDL_Init(), the same origin as SDL_GetTicks().
+  static uint64_t Now();
+
+  // Record a scope that ran on this thread, from 'start' to 'end' as given
+  // by Now().
+  static void Record(const char *name, uint64_t start, uint64_t end);
+
+  // Record a scope on the track called 'track_name' rather than this
+  // thread's, e.g. for work timed on the GPU. Each such track must only be
+  // recorded on by one thread at a time.
+  static void RecordOnTrack(const char *track_name, const char *name,
+                            uint64_t start, uint64_t end);
+
+  // Write what's in every track to 'filename' as Chrome trace JSON. Other
+  // threads must not be recording meanwhile, so disable the profiler and call
+  // this between frames. Returns false if the file can't be written.
+  static bool Write(const char *filename);
+
+  // Append the events in every track that ended at or after 'since', along
+  // with the tracks' names, to 'json' as Chrome trace events. Each is
+  // followed by a comma, so the caller must close the list. The same caveat
+  // as Write() applies.
+  static void AppendEvents(uint64_t since, std::string *json);
+
+ private:
+  struct Event {
+    const char *name;
+    uint64_t start;
+    uint64_t duration;
+  };
+
+  // A ring buffer of events. Only its own thread writes to it.
+  struct Track {
+    Track() : name(nullptr), is_thread(true), recorded(0) {}
+    const char *name;
+    // False for the tracks made by RecordOnTrack().
+    bool is_thread;
+    std::vector<Event> events;
+    // Events ever recorded. The next goes at recorded % kEventsPerTrack.
+    std::atomic<uint64_t> recorded;
+  };
+
+  // Set up the tracks and the clock, if they aren't already.
+  static void Initialize();
+
+  // The calling thread's track, made the first time it's needed. Tracks last
+  // as long as the program, even if their thread exits.
+  static Track *ThreadTrack();
+  // Register a new track, with room for kEventsPerTrack.
+  static Track *NewTrack(const char *name, bool is_thread);
+  static void Append(Track *track, const char *name, uint64_t start,
+                     uint64_t end);
+
+  static std::atomic<bool> enabled_;
+  static std::vector<Track *> *tracks_;
+};
+
+#ifndef FPL_DISABLE_FRAME_PROFILER
+// Records a scope for the lifetime of the object, if the profiler is enabled
+// when it starts.
+class FrameProfilerScope {
+ public:
+  explicit FrameProfilerScope(const char *name)
+      : name_(name),
+        recording_(FrameProfiler::enabled()),
+        start_(recording_ ? FrameProfiler::Now() : 0) {}
+  ~FrameProfilerScope() {
+    if (recording_) FrameProfiler::Record(name_, start_, FrameProfiler::Now());
+  }
+
+ private:
+  const char *name_;
+  bool recording_;
+  uint64_t start_;
+};
+
+#define FPL_PROFILE_CONCAT_INNER(a, b) a##b
+#define FPL_PROFILE_CONCAT(a, b) FPL_PROFILE_CONCAT_INNER(a, b)
+#define FPL_PROFILE_SCOPE(name)   \
+  ::fpl::FrameProfilerScope FPL_PROFILE_CONCAT(fpl_profile_scope_, \
+                                               __LINE__)(name)
+#else
+#define FPL_PROFILE_SCOPE(name) (void)0
+#endif  // FPL_DISABLE_FRAME_PROFILER
+
+}  // namespace fpl
+
+#endif  // FPL_FRAME_PROFILER_H
@@ -0,0 +1,51 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "frustum.h"
+
+using mathfu::vec3;
+using mathfu::vec4;
+using mathfu::mat4;
+
+namespace fpl {
+
+Frustum::Frustum(const mat4& view_projection) {
+  // A point is inside when -w <= x, y, z <= w in clip space, so each plane is
+  // the last row of the matrix plus or minus one of the others.
+  // See Gribb & Hartmann, "Fast Extraction of Viewing Frustum Planes from the
+  // World-View-Projection Matrix".
+  vec4 rows[4];
+  for (int i = 0; i < 4; ++i) {
+    rows[i] = vec4(view_projection(i, 0), view_projection(i, 1),
+                   view_projection(i, 2), view_projection(i, 3));
+  }
+  const vec4 planes[kNumPlanes] = {
+      rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1],
+      rows[3] - rows[1], rows[3] + rows[2], rows[3] - rows[2]};
+  for (int i = 0; i < kNumPlanes; ++i) {
+    const float length = planes[i].xyz().Length();
+    planes_[i] = length > 0.0f ? planes[i] / length : planes[i];
+  }
+}
+
+bool Frustum::IntersectsSphere(const vec3& center, float radius) const {
+  const vec4 point(center, 1.0f);
+  for (int i = 0; i < kNumPlanes; ++i) {
+    if (vec4::DotProduct(vec4(planes_[i]), point) < -radius) return false;
+  }
+  return true;
+}
+
+}  // namespace fpl
@@ -0,0 +1,43 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_FRUSTUM_H
+#define FPL_FRUSTUM_H
+
+#include "mathfu/glsl_mappings.h"
+
+namespace fpl {
+
+// The volume of space visible through a camera, as six inward facing planes.
+class Frustum {
+ public:
+  // Extract the planes from a combined projection * view matrix. Anything
+  // that view_projection maps into clip space is inside the frustum.
+  explicit Frustum(const mathfu::mat4& view_projection);
+
+  // False if the sphere is definitely outside the frustum. May be true for
+  // some spheres near the corners that are actually outside.
+  bool IntersectsSphere(const mathfu::vec3& center, float radius) const;
+
+ private:
+  enum { kLeft, kRight, kBottom, kTop, kNear, kFar, kNumPlanes };
+
+  // Each plane is (normal, distance), with the normal normalized and
+  // pointing into the frustum.
+  mathfu::vec4_packed planes_[kNumPlanes];
+};
+
+}  // namespace fpl
+
+#endif  // FPL_FRUSTUM_H
@@ -47,7 +47,8 @@ void GameCamera::Initialize(const GameCameraState& state,
   start_ = state;
   end_ = state;
   percent_.Invalidate();
-  movements_ = std::queue<GameCameraMovement>();
+  // Empty the queue in place, since making a new one allocates.
+  while (!movements_.empty()) movements_.pop();
   AdvanceFrame(0);
 }
 
@@ -86,7 +87,7 @@ void GameCamera::TerminateMovements() {
   if (percent_.Valid()) {
     percent_.SetTarget(motive::Current1f(1.0f));
   }
-  movements_ = std::queue<GameCameraMovement>();
+  while (!movements_.empty()) movements_.pop();
 }
 
 // Used for debugging. Haults animation and sets the camera position.
@@ -21,7 +21,10 @@
 #include "common.h"
 #include "config_generated.h"
 #include "controller.h"
+#include "entity/component_view.h"
+#include "frame_profiler.h"
 #include "game_state.h"
+#include "memory_accounting.h"
 #include "motive/io/flatbuffers.h"
 #include "motive/init.h"
 #include "motive/util.h"
@@ -64,20 +67,6 @@ static const char* kLabelSizeDelta = "Size delta";
 static const mat4 kRotate90DegreesAboutXAxis(1, 0, 0, 0, 0, 0, 1, 0, 0, -1, 0,
                                              0, 0, 0, 0, 1);
 
-// The data on a pie that just hit a player this frame
-struct ReceivedPie {
-  CharacterId original_source_id;
-  CharacterId source_id;
-  CharacterId target_id;
-  CharacterHealth original_damage;
-  CharacterHealth damage;
-};
-
-struct EventData {
-  std::vector<ReceivedPie> received_pies;
-  CharacterHealth pie_damage;
-};
-
 // Look up a value in a vector based upon pie damage.
 template <typename T>
 static T EnumerationValueForPieDamage(
@@ -92,31 +81,81 @@ static T EnumerationValueForPieDamage(
 // flatbuffer definitions) into entities and sticking them into the system.
 entity::EntityRef PieNoonEntityFactory::CreateEntityFromData(
     const void* data, entity::EntityManager* entity_manager) {
+  MemoryTagScope tag(kMemoryTagEntities);
+  const Prefab& prefab = FindPrefab(data, entity_manager);
+  entity::EntityRef entity = entity_manager->AllocateNewEntity();
+  entity->set_source_data(data);
+  for (size_t i = 0; i < prefab.size(); i++) {
+    prefab[i].component->AddFromRawData(entity, prefab[i].raw_data);
+  }
+  return entity;
+}
+
+void PieNoonEntityFactory::ResetEntity(entity::EntityRef entity,
+                                       entity::EntityManager* entity_manager) {
+  const void* data = entity->source_data();
+  if (data == nullptr) return;
+  const Prefab& prefab = FindPrefab(data, entity_manager);
+  for (size_t i = 0; i < prefab.size(); i++) {
+    prefab[i].component->AddFromRawData(entity, prefab[i].raw_data);
+  }
+}
+
+const PieNoonEntityFactory::Prefab& PieNoonEntityFactory::FindPrefab(
+    const void* data, entity::EntityManager* entity_manager) {
+  auto it = prefabs_.find(data);
+  if (it != prefabs_.end()) return it->second;
+
   const EntityDefinition* def = static_cast<const EntityDefinition*>(data);
   assert(def != nullptr);
-  entity::EntityRef entity = entity_manager->AllocateNewEntity();
+  Prefab& prefab = prefabs_[data];
+  prefab.reserve(def->component_list()->size());
   for (size_t i = 0; i < def->component_list()->size(); i++) {
     const ComponentDefInstance* currentInstance = def->component_list()->Get(i);
-    entity::ComponentInterface* component =
+    PrefabComponent prefab_component;
+    prefab_component.component =
         entity_manager->GetComponent(currentInstance->data_type());
-    assert(component != nullptr);
-    component->AddFromRawData(entity, currentInstance);
+    prefab_component.raw_data = currentInstance;
+    assert(prefab_component.component != nullptr);
+    prefab.push_back(prefab_component);
   }
-  return entity;
+  return prefab;
 }
 
 GameState::GameState()
     : time_(0),
+      turning_sound_(nullptr),
       config_(nullptr),
       arrangement_(nullptr),
+      entities_layout_(nullptr),
+      entities_in_cardboard_(false),
+      entities_character_count_(0),
       sceneobject_component_(&engine_),
       multiplayer_director_(nullptr),
       is_multiscreen_(false),
+      cardboard_config_(nullptr),
       is_in_cardboard_(false),
-      use_undistort_rendering_(true) {}
+      use_undistort_rendering_(true),
+      confetti_enabled_(true) {}
 
 GameState::~GameState() {}
 
+void GameState::set_config(const Config* config) {
+  config_ = config;
+  entities_layout_ = nullptr;
+  if (config_ && cardboard_config_) {
+    runtime_config_.Resolve(*config_, *cardboard_config_);
+  }
+}
+
+void GameState::set_cardboard_config(const Config* config) {
+  cardboard_config_ = config;
+  entities_layout_ = nullptr;
+  if (config_ && cardboard_config_) {
+    runtime_config_.Resolve(*config_, *cardboard_config_);
+  }
+}
+
 // Calculate the direction a character is facing at the start of the game.
 // We want the characters to face their initial target.
 static Angle InitialFaceAngle(const CharacterArrangement* arrangement,
@@ -149,21 +188,27 @@ static const CharacterArrangement* GetBestArrangement(const Config* config,
   return best_arrangement;
 }
 
-// All shakeable props are tracked and handled by the shakeable prop component.
-void GameState::ShakeProps(float damage_percent, const vec3& damage_position) {
-  shakeable_prop_component_.ShakeProps(damage_percent, damage_position);
-
-  for (auto iter = shakeable_prop_component_.begin();
-       iter != shakeable_prop_component_.end(); ++iter) {
-    const SceneObjectData* so_data =
-        entity_manager_.GetComponentData<SceneObjectData>(iter->entity);
-    assert(so_data != nullptr);
-    float dist_squared =
-        (so_data->GlobalPosition() - damage_position).LengthSquared();
-    if (dist_squared < config_->splatter_radius_squared()) {
-      AddSplatterToProp(iter->entity);
+// Splatter every prop near one of this frame's shakes. A prop near several
+// gets one splatter.
+void GameState::SplatterProps() {
+  // Collect the props first, since adding splatters adds scene objects.
+  splattered_props_.clear();
+  entity::ComponentView<ShakeablePropComponent, SceneObjectComponent> view(
+      &entity_manager_);
+  for (auto iter = view.begin(); iter != view.end(); ++iter) {
+    const vec3 prop_position = iter.secondary_data()->GlobalPosition();
+    for (size_t i = 0; i < effects_.shakes.size(); ++i) {
+      const float dist_squared =
+          (prop_position - vec3(effects_.shakes[i].position)).LengthSquared();
+      if (dist_squared < config_->splatter_radius_squared()) {
+        splattered_props_.push_back(iter.entity());
+        break;
+      }
     }
   }
+  for (size_t i = 0; i < splattered_props_.size(); ++i) {
+    AddSplatterToProp(splattered_props_[i]);
+  }
 }
 
 // Returns true if the game is over.
@@ -196,16 +241,60 @@ void GameState::Reset() { Reset(analytics_mode_); }
 // Reset the game back to initial configuration.
 void GameState::Reset(AnalyticsMode analytics_mode) {
   time_ = 0;
+  // Fixed steps make rounds repeatable, given the same random numbers.
+  if (config_->simulation_step_time() > 0) srand(config_->simulation_seed());
   // Use a different config for defining the scene if in Cardboard
   const Config* layout_config = is_in_cardboard_ ? cardboard_config_ : config_;
   camera_base_.position = LoadVec3(layout_config->camera_position());
   camera_base_.target = LoadVec3(layout_config->camera_target());
   camera_.Initialize(camera_base_, &engine_);
-  pies_.clear();
+  pies_.Clear();
+  effects_.Clear();
   arrangement_ = GetBestArrangement(layout_config, characters_.size());
   analytics_mode_ = analytics_mode;
 
+  // Another round in the same layout, with the same characters, keeps the
+  // last round's entities, component data and motivators, and only resets
+  // their values, so that starting it doesn't allocate.
+  if (entities_layout_ == layout_config &&
+      entities_in_cardboard_ == is_in_cardboard_ &&
+      entities_character_count_ == characters_.size()) {
+    ResetEntities();
+  } else {
+    BuildEntities(layout_config);
+  }
+
+  // Reset characters to their initial state.
+  const CharacterId num_ids = static_cast<CharacterId>(characters_.size());
+  // Initially, everyone targets the character across from themself.
+  const unsigned int target_step = num_ids / 2;
+  for (CharacterId id = 0; id < num_ids; ++id) {
+    CharacterId target_id = (id + target_step) % num_ids;
+    characters_[id]->Reset(
+        target_id, config_->character_health(),
+        InitialFaceAngle(arrangement_, id, target_id),
+        LoadVec3(arrangement_->character_data()->Get(id)->position()),
+        &engine_);
+  }
+
+  CalculateCharacterAngles();
+  UpdateAiBlackboard();
+
+  // When in cardboard, we want to make the first character invisible
+  // as that is where the camera will be located
+  if (is_in_cardboard_) {
+    characters_[0]->set_visible(false);
+  }
+
+  particle_manager_.RemoveAllParticles();
+}
+
+// Clear out the entities and components, and create the layout's props and
+// the characters' entities from scratch.
+void GameState::BuildEntities(const Config* layout_config) {
+  MemoryTagScope entities_tag(kMemoryTagEntities);
   entity_manager_.Clear();
+  pie_noon_entity_factory_.ClearPrefabs();
   entity_manager_.RegisterComponent<SceneObjectComponent>(
       &sceneobject_component_);
   entity_manager_.RegisterComponent<ShakeablePropComponent>(
@@ -227,30 +316,22 @@ void GameState::Reset(AnalyticsMode analytics_mode) {
   entity_manager_.set_entity_factory(&pie_noon_entity_factory_);
   player_character_component_.set_gamestate_ptr(this);
   cardboard_player_component_.set_gamestate_ptr(this);
+
+  // Make room for the layout's entities, the characters' and the splatters a
+  // round adds up front, so that the pools don't grow mid-match.
+  const size_t layout_entities = layout_config->entity_list()->size();
+  const size_t splatters =
+      static_cast<size_t>(std::max(config_->splatter_reserve(), 0));
+  entity_manager_.ReserveEntities(layout_entities + characters_.size() +
+                                  splatters);
+  sceneobject_component_.ReserveEntities(layout_entities + splatters);
+  drip_and_vanish_component_.ReserveEntities(splatters);
+  player_character_component_.ReserveEntities(characters_.size());
   // Load Entities from flatbuffer!
   for (size_t i = 0; i < layout_config->entity_list()->size(); i++) {
     entity_manager_.CreateEntityFromData(layout_config->entity_list()->Get(i));
   }
 
-  // Reset characters to their initial state.
-  const CharacterId num_ids = static_cast<CharacterId>(characters_.size());
-  // Initially, everyone targets the character across from themself.
-  const unsigned int target_step = num_ids / 2;
-  for (CharacterId id = 0; id < num_ids; ++id) {
-    CharacterId target_id = (id + target_step) % num_ids;
-    characters_[id]->Reset(
-        target_id, config_->character_health(),
-        InitialFaceAngle(arrangement_, id, target_id),
-        LoadVec3(arrangement_->character_data()->Get(id)->position()),
-        &engine_);
-  }
-
-  // When in cardboard, we want to make the first character invisible
-  // as that is where the camera will be located
-  if (is_in_cardboard_) {
-    characters_[0]->set_visible(false);
-  }
-
   // Create player character entities:
   for (CharacterId id = 0; id < static_cast<CharacterId>(characters_.size());
        ++id) {
@@ -266,7 +347,24 @@ void GameState::Reset(AnalyticsMode analytics_mode) {
     }
   }
 
-  particle_manager_.RemoveAllParticles();
+  entities_layout_ = layout_config;
+  entities_in_cardboard_ = is_in_cardboard_;
+  entities_character_count_ = characters_.size();
+}
+
+// Put the entities BuildEntities() made back the way it made them. The
+// splatters the last round left are the only entities that go; the props
+// read their data again, and the characters' entities follow the characters
+// every frame anyway.
+void GameState::ResetEntities() {
+  for (auto it = drip_and_vanish_component_.begin();
+       it != drip_and_vanish_component_.end(); ++it) {
+    entity_manager_.DeleteEntity(it->entity);
+  }
+  entity_manager_.DeleteMarkedEntities();
+  for (auto it = entity_manager_.begin(); it != entity_manager_.end(); ++it) {
+    pie_noon_entity_factory_.ResetEntity(it.ToReference(), &entity_manager_);
+  }
 }
 
 // Sets up the players in joining mode, where all they can do is jump up
@@ -279,30 +377,67 @@ void GameState::EnterJoiningMode() {
   }
 }
 
+void GameState::LoadSounds(const CharacterStateMachineDef* state_machine_def,
+                           pindrop::AudioEngine* audio_engine) {
+  // States are indexed by their id, as CharacterStateMachineDef_Validate()
+  // checks.
+  const auto states = state_machine_def->states();
+  timeline_sound_starts_.clear();
+  timeline_sounds_.clear();
+  for (size_t i = 0; i < states->Length(); ++i) {
+    timeline_sound_starts_.push_back(timeline_sounds_.size());
+    const Timeline* timeline = states->Get(i)->timeline();
+    if (!timeline || !timeline->sounds()) continue;
+    const auto sounds = timeline->sounds();
+    for (size_t j = 0; j < sounds->Length(); ++j) {
+      timeline_sounds_.push_back(
+          audio_engine->GetSoundHandle(sounds->Get(j)->sound()->c_str()));
+    }
+  }
+  timeline_sound_starts_.push_back(timeline_sounds_.size());
+
+  const auto hit_names = config_->hit_sound_id_for_pie_damage();
+  hit_sounds_.clear();
+  for (size_t i = 0; i < hit_names->Length(); ++i) {
+    hit_sounds_.push_back(
+        audio_engine->GetSoundHandle(hit_names->Get(i)->c_str()));
+  }
+  const auto blocked_names = config_->blocked_sound_id_for_pie_damage();
+  blocked_sounds_.clear();
+  for (size_t i = 0; i < blocked_names->Length(); ++i) {
+    blocked_sounds_.push_back(
+        audio_engine->GetSoundHandle(blocked_names->Get(i)->c_str()));
+  }
+  turning_sound_ = audio_engine->GetSoundHandle("Turning");
+}
+
 WorldTime GameState::GetAnimationTime(const Character& character) const {
   return time_ - character.state_machine()->current_state_start_time();
 }
 
-void GameState::ProcessSounds(pindrop::AudioEngine* audio_engine,
-                              const Character& character,
-                              WorldTime delta_time) const {
+void GameState::ProcessSounds(const Character& character,
+                              WorldTime delta_time) {
   // Process sounds in timeline.
   const Timeline* const timeline = character.CurrentTimeline();
   if (!timeline) return;
 
   const WorldTime anim_time = GetAnimationTime(character);
   const auto sounds = timeline->sounds();
-  const int start_index = TimelineIndexAfterTime(sounds, 0, anim_time);
-  const int end_index =
-      TimelineIndexAfterTime(sounds, start_index, anim_time + delta_time);
-  for (int i = start_index; i < end_index; ++i) {
-    const TimelineSound& timeline_sound = *sounds->Get(i);
-    audio_engine->PlaySound(timeline_sound.sound()->c_str());
+  TimelineCursor* cursor = character.sound_cursor();
+  const int start_index = cursor->IndexAfterTime(sounds, anim_time);
+  const int end_index = cursor->IndexAfterTime(sounds, anim_time + delta_time);
+  const size_t state = character.state_machine()->current_state()->id();
+  if (start_index < end_index && state + 1 < timeline_sound_starts_.size()) {
+    const pindrop::SoundHandle* state_sounds =
+        &timeline_sounds_[timeline_sound_starts_[state]];
+    for (int i = start_index; i < end_index; ++i) {
+      QueueSound(state_sounds[i], QueuedEffects::kSoundPriorityNormal);
+    }
   }
 
   // If the character is trying to turn, play the turn sound.
   if (RequestedTurn(character.id())) {
-    audio_engine->PlaySound("Turning");
+    QueueSound(turning_sound_, QueuedEffects::kSoundPriorityLow);
   }
 }
 
@@ -343,11 +478,11 @@ void GameState::CreatePie(CharacterId original_source_id, CharacterId source_id,
       CalculatePieHeight(is_in_cardboard_ ? *cardboard_config_ : *config_);
   const int rotations = CalculatePieRotations(*config_);
   const float y_rotation = CalculatePieYRotation(source_id, target_id);
-  pies_.push_back(std::unique_ptr<AirbornePie>(new AirbornePie(
-      original_source_id, *characters_[source_id], *characters_[target_id],
-      time_, config_->pie_flight_time(), original_damage, damage,
-      config_->pie_initial_height(), peak_height, rotations, y_rotation,
-      &engine_)));
+  pies_.Add(AirbornePie(original_source_id, source_id, target_id, time_,
+                        config_->pie_flight_time(), original_damage, damage),
+            characters_[source_id]->position(),
+            characters_[target_id]->position(), config_->pie_initial_height(),
+            peak_height, rotations, y_rotation);
 }
 
 CharacterId GameState::DetermineDeflectionTarget(const ReceivedPie& pie) const {
@@ -385,8 +520,7 @@ static GameCameraMovement CalculateCameraMovement(
   return movement;
 }
 
-void GameState::ProcessEvent(pindrop::AudioEngine* audio_engine,
-                             Character* character, unsigned int event,
+void GameState::ProcessEvent(Character* character, unsigned int event,
                              const EventData& event_data) {
   bool is_ai_player =
       character->controller()->controller_type() == Controller::kTypeAI;
@@ -434,18 +568,13 @@ void GameState::ProcessEvent(pindrop::AudioEngine* audio_engine,
       // Shake the nearby props. Amount of shake is a function of damage.
       const float shake_percent = mathfu::Clamp(
           total_damage * config_->prop_shake_percent_per_damage(), 0.0f, 1.0f);
-      ShakeProps(shake_percent, character->position());
+      QueueShake(shake_percent, character->position());
 
       // Move the camera.
       if (total_damage >= config_->camera_move_on_damage_min_damage() &&
           !is_in_cardboard_) {
-        camera_.TerminateMovements();
-        camera_.QueueMovement(
-            CalculateCameraMovement(*config_->camera_move_on_damage(),
-                                    character->position(), camera_base_));
-        camera_.QueueMovement(
-            CalculateCameraMovement(*config_->camera_move_to_base(),
-                                    character->position(), camera_base_));
+        effects_.move_camera = true;
+        effects_.camera_subject = character->position();
       }
       character->set_pie_damage(0);
       break;
@@ -469,12 +598,13 @@ void GameState::ProcessEvent(pindrop::AudioEngine* audio_engine,
       for (unsigned int i = 0; i < event_data.received_pies.size(); ++i) {
         const ReceivedPie& pie = event_data.received_pies[i];
 
-        const CharacterHealth index = mathfu::Clamp<CharacterHealth>(
-            pie.damage, 0,
-            config_->blocked_sound_id_for_pie_damage()->Length() - 1);
-        const auto& sound_name =
-            config_->blocked_sound_id_for_pie_damage()->Get(index);
-        audio_engine->PlaySound(sound_name->c_str());
+        if (!blocked_sounds_.empty()) {
+          const CharacterHealth index = mathfu::Clamp<CharacterHealth>(
+              pie.damage, 0,
+              static_cast<CharacterHealth>(blocked_sounds_.size()) - 1);
+          QueueSound(blocked_sounds_[index],
+                     QueuedEffects::kSoundPriorityHigh);
+        }
 
         const CharacterHealth deflected_pie_damage =
             pie.damage + config_->pie_damage_change_when_deflected();
@@ -483,7 +613,7 @@ void GameState::ProcessEvent(pindrop::AudioEngine* audio_engine,
                     DetermineDeflectionTarget(pie), pie.original_damage,
                     deflected_pie_damage);
         }
-        CreatePieSplatter(audio_engine, *character, 1);
+        CreatePieSplatter(*character, 1);
         character->IncrementStat(kBlocks);
         characters_[pie.source_id]->IncrementStat(kMisses);
         if (analytics_mode_ == kTrackAnalytics) {
@@ -545,8 +675,7 @@ void GameState::AddSplatterToProp(entity::EntityRef prop) {
   }
 }
 
-void GameState::ProcessEvents(pindrop::AudioEngine* audio_engine,
-                              Character* character, EventData* event_data,
+void GameState::ProcessEvents(Character* character, EventData* event_data,
                               WorldTime delta_time) {
   // Process events in timeline.
   const Timeline* const timeline = character->CurrentTimeline();
@@ -554,14 +683,14 @@ void GameState::ProcessEvents(pindrop::AudioEngine* audio_engine,
 
   const WorldTime anim_time = GetAnimationTime(*character);
   const auto events = timeline->events();
-  const int start_index = TimelineIndexAfterTime(events, 0, anim_time);
-  const int end_index =
-      TimelineIndexAfterTime(events, start_index, anim_time + delta_time);
+  TimelineCursor* cursor = character->event_cursor();
+  const int start_index = cursor->IndexAfterTime(events, anim_time);
+  const int end_index = cursor->IndexAfterTime(events, anim_time + delta_time);
 
   for (int i = start_index; i < end_index; ++i) {
     const TimelineEvent* event = events->Get(i);
     event_data->pie_damage = event->modifier();
-    ProcessEvent(audio_engine, character, event->event(), *event_data);
+    ProcessEvent(character, event->event(), *event_data);
   }
 }
 
@@ -575,8 +704,37 @@ void GameState::PopulateConditionInputs(ConditionInputs* condition_inputs,
   condition_inputs->is_multiscreen = is_multiscreen();
 }
 
-void GameState::ProcessConditionalEvents(pindrop::AudioEngine* audio_engine,
-                                         Character* character,
+// Find the transition of every character's state machine in one batch,
+// leaving them in state_machine_inputs_.targets.
+void GameState::FindStateMachineTransitions() {
+  StateMachineInputs& inputs = state_machine_inputs_;
+  const size_t count = characters_.size();
+  inputs.states.resize(count);
+  inputs.is_down.resize(count);
+  inputs.went_down.resize(count);
+  inputs.went_up.resize(count);
+  inputs.animation_time.resize(count);
+  inputs.targets.resize(count);
+  if (count == 0) return;
+
+  for (size_t i = 0; i < count; ++i) {
+    const Character& character = *characters_[i];
+    // Every character is built from the same table.
+    assert(character.state_machine()->table() ==
+           characters_[0]->state_machine()->table());
+    inputs.states[i] = character.state_machine()->current_state_id();
+    inputs.is_down[i] = character.controller()->is_down();
+    inputs.went_down[i] = character.controller()->went_down();
+    inputs.went_up[i] = character.controller()->went_up();
+    inputs.animation_time[i] = GetAnimationTime(character);
+  }
+  characters_[0]->state_machine()->table()->FindTransitions(
+      count, &inputs.states[0], &inputs.is_down[0], &inputs.went_down[0],
+      &inputs.went_up[0], &inputs.animation_time[0], is_multiscreen(),
+      &inputs.targets[0]);
+}
+
+void GameState::ProcessConditionalEvents(Character* character,
                                          EventData* event_data) {
   auto current_state = character->state_machine()->current_state();
   if (current_state && current_state->conditional_events()) {
@@ -589,7 +747,7 @@ void GameState::ProcessConditionalEvents(pindrop::AudioEngine* audio_engine,
       if (EvaluateCondition(conditional_event->condition(), condition_inputs)) {
         unsigned int event = conditional_event->event();
         event_data->pie_damage = conditional_event->modifier();
-        ProcessEvent(audio_engine, character, event, *event_data);
+        ProcessEvent(character, event, *event_data);
       }
     }
   }
@@ -771,14 +929,30 @@ CharacterId GameState::CalculateCharacterTarget(CharacterId id) const {
   }
 }
 
-// The angle between two characters.
+// The angle between two characters, from their positions.
+static Angle CharacterAngle(const Character& source, const Character& target) {
+  return Angle::FromXZVector(target.position() - source.position());
+}
+
+void GameState::CalculateCharacterAngles() {
+  const size_t count = characters_.size();
+  character_angles_.resize(count * count);
+  for (size_t source = 0; source < count; ++source) {
+    for (size_t target = 0; target < count; ++target) {
+      character_angles_[source * count + target] =
+          CharacterAngle(*characters_[source], *characters_[target]);
+    }
+  }
+}
+
 Angle GameState::AngleBetweenCharacters(CharacterId source_id,
                                         CharacterId target_id) const {
-  const auto& source = characters_[source_id];
-  const auto& target = characters_[target_id];
-  const vec3 vector_to_target = target->position() - source->position();
-  const Angle angle_to_target = Angle::FromXZVector(vector_to_target);
-  return angle_to_target;
+  const size_t count = characters_.size();
+  // Characters added since the last Reset() aren't in the table yet.
+  if (character_angles_.size() != count * count) {
+    return CharacterAngle(*characters_[source_id], *characters_[target_id]);
+  }
+  return character_angles_[source_id * count + target_id];
 }
 
 // Angle to the character's target.
@@ -851,27 +1025,28 @@ uint32_t GameState::AllLogicalInputs() const {
 }
 
 // Creates a bunch of particles when a character gets hit by a pie.
-void GameState::CreatePieSplatter(pindrop::AudioEngine* audio_engine,
-                                  const Character& character,
+void GameState::CreatePieSplatter(const Character& character,
                                   CharacterHealth damage) {
   const ParticleDef* def = config_->pie_splatter_def();
-  SpawnParticles(
+  QueueParticles(
       character.position(), def,
       static_cast<int>(damage) * config_->pie_noon_particles_per_damage());
   // Play a pie hit sound based upon the amount of damage applied (size of the
   // pie).
-  const CharacterHealth index = mathfu::Clamp<CharacterHealth>(
-      damage, 0, config_->hit_sound_id_for_pie_damage()->Length() - 1);
-  const auto& sound_name = config_->hit_sound_id_for_pie_damage()->Get(index);
-  audio_engine->PlaySound(sound_name->c_str());
+  if (!hit_sounds_.empty()) {
+    const CharacterHealth index = mathfu::Clamp<CharacterHealth>(
+        damage, 0, static_cast<CharacterHealth>(hit_sounds_.size()) - 1);
+    QueueSound(hit_sounds_[index], QueuedEffects::kSoundPriorityHigh);
+  }
 }
 
 // Creates confetti when a character presses buttons on the join screen.
 void GameState::CreateJoinConfettiBurst(const Character& character) {
+  if (!confetti_enabled_) return;
   const ParticleDef* def = config_->joining_confetti_def();
   vec3 character_color =
       LoadVec3(config_->character_colors()->Get(character.id()));
-  SpawnParticles(
+  QueueParticles(
       character.position(), def, config_->joining_confetti_count(),
       vec4(character_color.x(), character_color.y(), character_color.z(), 1));
 }
@@ -880,60 +1055,195 @@ void GameState::CreateJoinConfettiBurst(const Character& character) {
 void GameState::SpawnParticles(const mathfu::vec3& position,
                                const ParticleDef* def, const int particle_count,
                                const mathfu::vec4& base_tint) {
-  const vec3 min_scale = LoadVec3(def->min_scale());
-  const vec3 max_scale = LoadVec3(def->max_scale());
-  const vec3 min_velocity = LoadVec3(def->min_velocity());
-  const vec3 max_velocity = LoadVec3(def->max_velocity());
-  const vec3 min_angular_velocity = LoadVec3(def->min_angular_velocity());
-  const vec3 max_angular_velocity = LoadVec3(def->max_angular_velocity());
-  const vec3 min_position_offset = LoadVec3(def->min_position_offset());
-  const vec3 max_position_offset = LoadVec3(def->max_position_offset());
-  const vec3 min_orientation_offset = LoadVec3(def->min_orientation_offset());
-  const vec3 max_orientation_offset = LoadVec3(def->max_orientation_offset());
-
   const Angle to_position = Angle::FromXZVector(position - camera().Position());
   const vec3 additional_rotation =
       is_in_cardboard()
           ? vec3(0.0f, -(to_position.ToRadians() + fpl::kHalfPi), 0.0f)
           : mathfu::kZeros3f;
 
-  for (int i = 0; i < particle_count; i++) {
-    Particle* p = particle_manager_.CreateParticle();
-    // if we got back a null, it means new particles can't be spawned right now.
-    if (p == nullptr) {
+  // When frames are slow, or the pool is nearly full, spawn fewer, larger
+  // particles.
+  float size_scale;
+  const int count =
+      particle_manager_.BudgetSpawn(def, particle_count, &size_scale);
+  if (count <= 0) return;
+
+  // Effects simulated on the GPU just draw a random run of the particles
+  // pregenerated from their definition.
+  if (particle_manager_.BurstsEnabled(def)) {
+    ParticleBurst burst;
+    burst.def = def;
+    burst.position = position;
+    burst.orientation_offset = additional_rotation;
+    burst.tint = base_tint;
+    burst.num_particles = count;
+    burst.scale = size_scale;
+    burst.first_particle =
+        mathfu::RandomInRange<int>(0, def->gpu_pool_size() - count + 1);
+    burst.age = 0;
+    burst.duration = static_cast<TimeStep>(def->max_duration());
+    particle_manager_.AddBurst(burst);
+    return;
+  }
+
+  for (int i = 0; i < count; i++) {
+    Particle p;
+    p.Randomize(*def, position, additional_rotation, base_tint);
+    p.set_base_scale(p.base_scale() * size_scale);
+    // If the pool is full, new particles can't be spawned right now.
+    if (!particle_manager_.AddParticle(p, def)) {
       break;
     }
-    p->set_base_scale(
-        def->preserve_aspect()
-            ? vec3(mathfu::RandomInRange(min_scale.x(), max_scale.x()))
-            : vec3::RandomInRange(min_scale, max_scale));
-
-    p->set_base_velocity(vec3::RandomInRange(min_velocity, max_velocity));
-    p->set_acceleration(LoadVec3(def->acceleration()));
-    p->set_renderable_id(def->renderable()->Get(
-        mathfu::RandomInRange<int>(0, def->renderable()->size())));
-    mathfu::vec4 tint = LoadVec4(
-        def->tint()->Get(mathfu::RandomInRange<int>(0, def->tint()->size())));
-    p->set_base_tint(
-        mathfu::vec4(tint.x() * base_tint.x(), tint.y() * base_tint.y(),
-                     tint.z() * base_tint.z(), tint.w() * base_tint.w()));
-    p->set_duration(static_cast<float>(mathfu::RandomInRange<int32_t>(
-        def->min_duration(), def->max_duration())));
-    p->set_base_position(position + vec3::RandomInRange(min_position_offset,
-                                                        max_position_offset));
-    p->set_base_orientation(
-        additional_rotation +
-        vec3::RandomInRange(min_orientation_offset, max_orientation_offset));
-    p->set_rotational_velocity(
-        vec3::RandomInRange(min_angular_velocity, max_angular_velocity));
-    p->set_duration_of_shrink_out(
-        static_cast<TimeStep>(def->shrink_duration()));
-    p->set_duration_of_fade_out(static_cast<TimeStep>(def->fade_duration()));
   }
 }
 
+// Gather what every AI wants to know, in one pass over the pies and one over
+// the characters, rather than each AI scanning them all.
+void GameState::UpdateAiBlackboard() {
+  AiBlackboard& blackboard = ai_blackboard_;
+  const size_t count = characters_.size();
+  blackboard.incoming_pies.assign(count, 0);
+  blackboard.incoming_pie_eta.assign(count, 0);
+  blackboard.health_rank.resize(count);
+
+  for (size_t i = 0; i < pies_.size(); ++i) {
+    const AirbornePie& pie = pies_[i];
+    const CharacterId target = pie.target();
+    const WorldTime eta =
+        std::max(pie.start_time() + pie.flight_time() - time_, 0);
+    WorldTime& first_eta = blackboard.incoming_pie_eta[target];
+    if (blackboard.incoming_pies[target]++ == 0 || eta < first_eta) {
+      first_eta = eta;
+    }
+  }
+
+  characters_by_health_.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    characters_by_health_[i] = static_cast<CharacterId>(i);
+  }
+  std::sort(characters_by_health_.begin(), characters_by_health_.end(),
+            [this](CharacterId a, CharacterId b) {
+              return characters_[a]->health() > characters_[b]->health();
+            });
+  for (size_t i = 0; i < count; ++i) {
+    const CharacterId id = characters_by_health_[i];
+    const bool tied =
+        i > 0 && characters_[characters_by_health_[i - 1]]->health() ==
+                     characters_[id]->health();
+    blackboard.health_rank[id] =
+        tied ? blackboard.health_rank[characters_by_health_[i - 1]]
+             : static_cast<int>(i);
+  }
+}
+
+template <int d>
+static bool SameVector(const mathfu::Vector<float, d>& a,
+                       const mathfu::Vector<float, d>& b) {
+  for (int i = 0; i < d; ++i) {
+    if (a[i] != b[i]) return false;
+  }
+  return true;
+}
+
+// A sound started several times at once would only play louder, so it's
+// queued once, at the highest priority asked for.
+void GameState::QueueSound(pindrop::SoundHandle sound,
+                           QueuedEffects::SoundPriority priority) {
+  if (sound == nullptr) return;
+  for (size_t i = 0; i < effects_.sounds.size(); ++i) {
+    QueuedEffects::Sound& queued = effects_.sounds[i];
+    if (queued.handle == sound) {
+      queued.priority = std::max(queued.priority, priority);
+      return;
+    }
+  }
+  QueuedEffects::Sound queued;
+  queued.handle = sound;
+  queued.priority = priority;
+  effects_.sounds.push_back(queued);
+}
+
+void GameState::QueueParticles(const vec3& position, const ParticleDef* def,
+                               int particle_count, const vec4& base_tint) {
+  // Bursts of the same particles in the same place, e.g. from several pies
+  // hitting one character, become one bigger burst.
+  for (size_t i = 0; i < effects_.particles.size(); ++i) {
+    QueuedEffects::Particles& particles = effects_.particles[i];
+    if (particles.def == def &&
+        SameVector(vec3(particles.position), position) &&
+        SameVector(vec4(particles.tint), base_tint)) {
+      particles.count += particle_count;
+      return;
+    }
+  }
+  QueuedEffects::Particles particles;
+  particles.position = position;
+  particles.def = def;
+  particles.count = particle_count;
+  particles.tint = base_tint;
+  effects_.particles.push_back(particles);
+}
+
+void GameState::QueueShake(float percent, const vec3& damage_position) {
+  for (size_t i = 0; i < effects_.shakes.size(); ++i) {
+    QueuedEffects::Shake& shake = effects_.shakes[i];
+    if (SameVector(vec3(shake.position), damage_position)) {
+      shake.percent = std::min(shake.percent + percent, 1.0f);
+      return;
+    }
+  }
+  QueuedEffects::Shake shake;
+  shake.position = damage_position;
+  shake.percent = percent;
+  effects_.shakes.push_back(shake);
+}
+
+// Carry out the effects queued by this frame's events, each kind together.
+void GameState::DispatchEffects(pindrop::AudioEngine* audio_engine) {
+  // The most important sounds go first, up to the voice budget. A null
+  // 'audio_engine' runs the game silently, as the headless simulation does.
+  if (audio_engine != nullptr) {
+    const int max_sounds = config_->max_sounds_per_frame();
+    int voices_left = max_sounds > 0
+                          ? max_sounds
+                          : static_cast<int>(effects_.sounds.size());
+    for (int priority = QueuedEffects::kSoundPriorityCount - 1;
+         priority >= 0 && voices_left > 0; --priority) {
+      for (size_t i = 0; i < effects_.sounds.size() && voices_left > 0; ++i) {
+        const QueuedEffects::Sound& sound = effects_.sounds[i];
+        if (sound.priority != priority) continue;
+        audio_engine->PlaySound(sound.handle);
+        voices_left--;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < effects_.particles.size(); ++i) {
+    const QueuedEffects::Particles& particles = effects_.particles[i];
+    SpawnParticles(vec3(particles.position), particles.def, particles.count,
+                   vec4(particles.tint));
+  }
+
+  // All shakeable props are tracked and handled by the shakeable prop
+  // component.
+  shakeable_prop_component_.ShakeProps(effects_.shakes);
+  if (!effects_.shakes.empty()) SplatterProps();
+
+  if (effects_.move_camera) {
+    const vec3 subject(effects_.camera_subject);
+    camera_.TerminateMovements();
+    camera_.QueueMovement(CalculateCameraMovement(
+        *config_->camera_move_on_damage(), subject, camera_base_));
+    camera_.QueueMovement(CalculateCameraMovement(
+        *config_->camera_move_to_base(), subject, camera_base_));
+  }
+
+  effects_.Clear();
+}
+
 void GameState::AdvanceFrame(WorldTime delta_time,
                              pindrop::AudioEngine* audio_engine) {
+  FPL_PROFILE_SCOPE("GameState::AdvanceFrame");
   // Increment the world time counter. This happens at the start of the
   // function so that functions that reference the current world time will
   // include the delta_time. For example, GetAnimationTime needs to compare
@@ -947,13 +1257,20 @@ void GameState::AdvanceFrame(WorldTime delta_time,
                   countdown_timer_);
     }
   }
-  // Don't spawn in confetti when in cardboard, as it adds too many draw calls
-  if (NumActiveCharacters(true) == 0 && !is_in_cardboard()) {
+  // Confetti is drawn in batches (see BillboardBatch), so it's cheap enough
+  // to spawn in Cardboard too.
+  if (NumActiveCharacters(true) == 0 && confetti_enabled_) {
     SpawnParticles(mathfu::vec3(0, 10, 0), config_->confetti_def(), 1);
   }
 
   // Damage is queued up per character then applied during event processing.
-  std::vector<EventData> event_data(characters_.size());
+  // The lists are emptied, but keep their storage from earlier frames.
+  event_data_.resize(characters_.size());
+  for (auto it = event_data_.begin(); it != event_data_.end(); ++it) {
+    it->received_pies.clear();
+    it->pie_damage = 0;
+  }
+  std::vector<EventData>& event_data = event_data_;
 
   // Update controller to gather state machine inputs.
   for (size_t i = 0; i < characters_.size(); ++i) {
@@ -986,34 +1303,37 @@ void GameState::AdvanceFrame(WorldTime delta_time,
   particle_manager_.AdvanceFrame(static_cast<TimeStep>(delta_time));
 
   // Update pies. Modify state machine input when character hit by pie.
-  for (auto it = pies_.begin(); it != pies_.end();) {
-    auto& pie = *it;
+  for (size_t i = 0; i < pies_.size();) {
+    const AirbornePie& pie = pies_[i];
 
     // Remove pies that have made contact.
-    const WorldTime time_since_launch = time_ - pie->start_time();
-    if (time_since_launch >= pie->flight_time()) {
-      auto& character = characters_[pie->target()];
-      ReceivedPie received_pie = {pie->original_source(), pie->source(),
-                                  pie->target(), pie->original_damage(),
-                                  pie->damage()};
-      event_data[pie->target()].received_pies.push_back(received_pie);
+    const WorldTime time_since_launch = time_ - pie.start_time();
+    if (time_since_launch >= pie.flight_time()) {
+      auto& character = characters_[pie.target()];
+      ReceivedPie received_pie = {pie.original_source(), pie.source(),
+                                  pie.target(), pie.original_damage(),
+                                  pie.damage()};
+      event_data[pie.target()].received_pies.push_back(received_pie);
       character->controller()->SetLogicalInputs(LogicalInputs_JustHit, true);
       if (character->State() != StateId_Blocking)
-        CreatePieSplatter(audio_engine, *character, pie->damage());
-      it = pies_.erase(it);
+        CreatePieSplatter(*character, pie.damage());
+      // Pies are unordered, so the pool fills the gap with the last one
+      // rather than shifting every pie after it.
+      pies_.Remove(i);
     } else {
-      ++it;
+      ++i;
     }
   }
 
-  // Update the character state machines and the facing angles.
+  // Update the character state machines and the facing angles. A character's
+  // transition only depends on its own inputs, so they're all found at once.
+  FindStateMachineTransitions();
   for (unsigned int i = 0; i < characters_.size(); ++i) {
     auto& character = characters_[i];
 
     // Update state machines.
-    ConditionInputs condition_inputs;
-    PopulateConditionInputs(&condition_inputs, *character.get());
-    character->state_machine()->Update(condition_inputs);
+    character->state_machine()->FollowTransition(
+        state_machine_inputs_.targets[i], time_);
 
     // Update character's target.
     const CharacterId target_id = CalculateCharacterTarget(character->id());
@@ -1033,27 +1353,44 @@ void GameState::AdvanceFrame(WorldTime delta_time,
 
   // Look to timeline to see what's happening. Make it happen.
   for (unsigned int i = 0; i < characters_.size(); ++i) {
-    ProcessEvents(audio_engine, characters_[i].get(), &event_data[i],
-                  delta_time);
+    ProcessEvents(characters_[i].get(), &event_data[i], delta_time);
   }
 
   for (unsigned int i = 0; i < characters_.size(); ++i) {
-    ProcessConditionalEvents(audio_engine, characters_[i].get(),
-                             &event_data[i]);
+    ProcessConditionalEvents(characters_[i].get(), &event_data[i]);
   }
 
   // Play the sounds that need to be played at this point in time.
   for (unsigned int i = 0; i < characters_.size(); ++i) {
-    ProcessSounds(audio_engine, *characters_[i].get(), delta_time);
+    ProcessSounds(*characters_[i].get(), delta_time);
   }
 
+  // Everything the events above asked for, sounds, particles, shaking props
+  // and the camera, happens now.
+  DispatchEffects(audio_engine);
+  UpdateAiBlackboard();
+
   // Update entities.
-  entity_manager_.UpdateComponents(delta_time);
+  {
+    FPL_PROFILE_SCOPE("UpdateComponents");
+    MemoryTagScope tag(kMemoryTagEntities);
+    entity_manager_.UpdateComponents(delta_time);
+  }
 
   // Update all Motivators. Motivator updates are done in bulk for scalability.
   // Must come after entity_manager_'s update because matrix Motivators are
   // modified by Components.
-  engine_.AdvanceFrame(delta_time);
+  {
+    FPL_PROFILE_SCOPE("Motive");
+    engine_.AdvanceFrame(delta_time);
+  }
+
+  // Place every pie still in flight, all in one pass, before PopulateScene()
+  // reads them.
+  {
+    FPL_PROFILE_SCOPE("Pies");
+    pies_.UpdateTransforms(time_);
+  }
 
   camera_.AdvanceFrame(delta_time);
 }
@@ -1101,38 +1438,54 @@ class CharacterDepthComparer {
 
 // Add anything in the list of particles into the scene description:
 void GameState::AddParticlesToScene(SceneDescription* scene) const {
-  auto plist = particle_manager_.get_particle_list();
-  for (auto it = plist.begin(); it != plist.end(); ++it) {
-    scene->renderables().push_back(std::unique_ptr<Renderable>(
-        new Renderable((*it)->renderable_id(), (*it)->CalculateMatrix(),
-                       (*it)->CurrentTint())));
+  const ParticleManager& particles = particle_manager_;
+  scene->ReserveRenderables(particles.size());
+  for (size_t i = 0; i < particles.size(); ++i) {
+    scene->renderables().push_back(
+        Renderable(particles.renderable_id(i), particles.CalculateMatrix(i),
+                   particles.CurrentTint(i)));
   }
+  scene->particle_bursts().insert(scene->particle_bursts().end(),
+                                  particles.bursts().begin(),
+                                  particles.bursts().end());
+}
+
+void GameState::GetComponentCounts(std::vector<ComponentCount>* counts) const {
+  counts->clear();
+  const ComponentCount components[] = {
+      {"SceneObject", sceneobject_component_.EntityCount()},
+      {"ShakeableProp", shakeable_prop_component_.EntityCount()},
+      {"DripAndVanish", drip_and_vanish_component_.EntityCount()},
+      {"PlayerCharacter", player_character_component_.EntityCount()},
+      {"CardboardPlayer", cardboard_player_component_.EntityCount()},
+  };
+  counts->insert(counts->end(), components,
+                 components + sizeof(components) / sizeof(components[0]));
 }
 
 void GameState::PopulateScene(SceneDescription* scene) {
+  FPL_PROFILE_SCOPE("PopulateScene");
   scene->Clear();
   // Camera.
   scene->set_camera(CameraMatrix());
+  scene->set_camera_position(camera_.Position());
   AddParticlesToScene(scene);
   sceneobject_component_.PopulateScene(scene);
 
   // Add all lights from configuration file to the scene.
   // Important note: The renderer will break if there isn't at least one
   // light in the scene.
-  const auto lights = config_->light_positions();
-  for (auto it = lights->begin(); it != lights->end(); ++it) {
-    const vec3 light_position = LoadVec3(*it);
-    scene->lights().push_back(std::unique_ptr<vec3>(new vec3(light_position)));
-  }
+  const auto& lights = runtime_config_.light_positions();
+  scene->lights().insert(scene->lights().end(), lights.begin(), lights.end());
 
   // Pies.
   if (config_->draw_pies()) {
-    for (auto it = pies_.begin(); it != pies_.end(); ++it) {
-      auto& pie = *it;
-      scene->renderables().push_back(std::unique_ptr<Renderable>(new Renderable(
+    scene->ReserveRenderables(pies_.size());
+    for (size_t i = 0; i < pies_.size(); ++i) {
+      scene->renderables().push_back(Renderable(
           EnumerationValueForPieDamage<uint16_t>(
-              pie->damage(), *(config_->renderable_id_for_pie_damage())),
-          pie->Matrix())));
+              pies_[i].damage(), *(config_->renderable_id_for_pie_damage())),
+          pies_.Matrix(i)));
     }
   }
 
@@ -1144,30 +1497,30 @@ void GameState::PopulateScene(SceneDescription* scene) {
     for (int i = 0; i < 8; ++i) {
       const mat4 axis_dot =
           mat4::FromTranslationVector(vec3(static_cast<float>(i), 0.0f, 0.0f));
-      scene->renderables().push_back(std::unique_ptr<Renderable>(
-          new Renderable(RenderableId_PieSmall, axis_dot)));
+      scene->renderables().push_back(
+          Renderable(RenderableId_PieSmall, axis_dot));
     }
     for (int i = 0; i < 4; ++i) {
       const mat4 axis_dot =
           mat4::FromTranslationVector(vec3(0.0f, 0.0f, static_cast<float>(i)));
-      scene->renderables().push_back(std::unique_ptr<Renderable>(
-          new Renderable(RenderableId_PieSmall, axis_dot)));
+      scene->renderables().push_back(
+          Renderable(RenderableId_PieSmall, axis_dot));
     }
     for (int i = 0; i < 2; ++i) {
       const mat4 axis_dot =
           mat4::FromTranslationVector(vec3(0.0f, static_cast<float>(i), 0.0f));
-      scene->renderables().push_back(std::unique_ptr<Renderable>(
-          new Renderable(RenderableId_PieSmall, axis_dot)));
+      scene->renderables().push_back(
+          Renderable(RenderableId_PieSmall, axis_dot));
     }
   }
 
   // Draw one renderable right in the middle of the world, for debugging.
   // Rotate about z-axis so that it faces the camera.
   if (config_->draw_fixed_renderable() != RenderableId_Invalid) {
-    scene->renderables().push_back(std::unique_ptr<Renderable>(new Renderable(
+    scene->renderables().push_back(Renderable(
         static_cast<uint16_t>(config_->draw_fixed_renderable()),
         mat4::FromRotationMatrix(
-            Quat::FromAngleAxis(kPi, mathfu::kAxisY3f).ToMatrix()))));
+            Quat::FromAngleAxis(kPi, mathfu::kAxisY3f).ToMatrix())));
   }
 }
 
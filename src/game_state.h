@@ -17,6 +17,7 @@
 
 #include <vector>
 #include <memory>
+#include <unordered_map>
 #include "character.h"
 #include "components/cardboard_player.h"
 #include "components/drip_and_vanish.h"
@@ -30,10 +31,9 @@
 #include "motive/processor.h"
 #include "motive/util.h"
 #include "particles.h"
-
-namespace pindrop {
-class AudioEngine;
-}  // namespace pindrop
+#include "pie_pool.h"
+#include "pindrop/pindrop.h"
+#include "runtime_config.h"
 
 namespace fpl {
 
@@ -44,14 +44,114 @@ namespace pie_noon {
 
 struct Config;
 struct CharacterArrangement;
-struct EventData;
-struct ReceivedPie;
 class MultiplayerDirector;
 
+// The data on a pie that just hit a player this frame
+struct ReceivedPie {
+  CharacterId original_source_id;
+  CharacterId source_id;
+  CharacterId target_id;
+  CharacterHealth original_damage;
+  CharacterHealth damage;
+};
+
+struct EventData {
+  std::vector<ReceivedPie> received_pies;
+  CharacterHealth pie_damage;
+};
+
+// What the events of a frame do to the sound and the scenery. Gameplay, such
+// as health, scores and new pies, changes as each event is processed, but
+// these effects are queued and then dispatched together, one subsystem at a
+// time, so that duplicates can be merged.
+struct QueuedEffects {
+  QueuedEffects() : move_camera(false) {}
+
+  void Clear() {
+    sounds.clear();
+    particles.clear();
+    shakes.clear();
+    move_camera = false;
+  }
+
+  struct Particles {
+    mathfu::vec3_packed position;
+    const ParticleDef* def;
+    int count;
+    mathfu::vec4_packed tint;
+  };
+
+  // Props near 'position' shake, and may get splattered.
+  typedef PropShake Shake;
+
+  // When a frame starts more sounds than the voice budget allows, the less
+  // important ones are dropped.
+  enum SoundPriority {
+    kSoundPriorityLow,     // Always there, like the turning sound.
+    kSoundPriorityNormal,  // Animation sounds on the timelines.
+    kSoundPriorityHigh,    // Pies hitting and being blocked.
+    kSoundPriorityCount
+  };
+
+  struct Sound {
+    pindrop::SoundHandle handle;
+    SoundPriority priority;
+  };
+
+  // Each sound at most once.
+  std::vector<Sound> sounds;
+  std::vector<Particles> particles;
+  std::vector<Shake> shakes;
+  // The camera only follows the last big hit of the frame.
+  bool move_camera;
+  mathfu::vec3_packed camera_subject;
+};
+
+// Builds entities from EntityDefinition flatbuffers.
+// The first time it sees a definition, it resolves each component in its list
+// into a prefab, so that spawning the same definition again (e.g. every pie
+// splatter) goes straight to the components.
 class PieNoonEntityFactory : public entity::EntityFactoryInterface {
  public:
   virtual entity::EntityRef CreateEntityFromData(
       const void* data, entity::EntityManager* entity_manager);
+
+  // Puts an entity made by CreateEntityFromData() back the way it was made,
+  // by having its components read their data again.  Their existing data and
+  // motivators are kept.  Does nothing to entities that weren't made from
+  // data.
+  void ResetEntity(entity::EntityRef entity,
+                   entity::EntityManager* entity_manager);
+
+  // Forget all prefabs.  Call whenever the components are re-registered.
+  void ClearPrefabs() { prefabs_.clear(); }
+
+ private:
+  // One component of a prefab, and the raw data to initialize it from.
+  struct PrefabComponent {
+    entity::ComponentInterface* component;
+    const void* raw_data;
+  };
+  typedef std::vector<PrefabComponent> Prefab;
+
+  // Returns the prefab for 'data', resolving it if it isn't cached.
+  const Prefab& FindPrefab(const void* data,
+                           entity::EntityManager* entity_manager);
+
+  // Resolved definitions, keyed by the EntityDefinition they came from.
+  std::unordered_map<const void*, Prefab> prefabs_;
+};
+
+// What the AI players want to know about every character, gathered by
+// GameState once per frame for all of them. Indexed by CharacterId.
+struct AiBlackboard {
+  // Airborne pies aimed at the character.
+  std::vector<int> incoming_pies;
+  // Time until the first of those pies lands, or 0 if there are none.
+  std::vector<WorldTime> incoming_pie_eta;
+  // 0 for the healthiest characters, then counting up. Characters with equal
+  // health have equal rank.
+  std::vector<int> health_rank;
 };
 
 class GameState {
@@ -69,7 +169,15 @@ class GameState {
   void Reset(AnalyticsMode analytics_mode);
   void Reset();
 
-  // Update controller and state machine for each character.
+  // Look up the sounds that the timelines of 'state_machine_def' and the
+  // config play, so that gameplay can start them without looking up their
+  // names. Call once, after set_config(), with the engine that sounds will be
+  // played on. Until then, the game is silent.
+  void LoadSounds(const CharacterStateMachineDef* state_machine_def,
+                  pindrop::AudioEngine* audio_engine);
+
+  // Update controller and state machine for each character. Sounds are
+  // played on 'audio_engine', unless it is null.
   void AdvanceFrame(WorldTime delta_time, pindrop::AudioEngine* audio_engine);
 
   // To be run before starting a game and after ending one to log data about
@@ -80,7 +188,8 @@ class GameState {
   // Fill in the position of the characters and pies.
   void PopulateScene(SceneDescription* scene);
 
-  // Angle between two characters.
+  // Angle between two characters. Characters stay where Reset() puts them, so
+  // these are worked out once per round.
   Angle AngleBetweenCharacters(CharacterId source_id,
                                CharacterId target_id) const;
 
@@ -116,26 +225,51 @@ class GameState {
     return characters_;
   }
 
-  std::vector<std::unique_ptr<AirbornePie>>& pies() { return pies_; }
-  const std::vector<std::unique_ptr<AirbornePie>>& pies() const {
-    return pies_;
-  }
+  PiePool& pies() { return pies_; }
+  const PiePool& pies() const { return pies_; }
+
+  // The state of the game as seen by the AI, as of the end of the last frame.
+  const AiBlackboard& ai_blackboard() const { return ai_blackboard_; }
 
   WorldTime time() const { return time_; }
 
-  void set_config(const Config* config) { config_ = config; }
+  // Both configs must be set before the game state is used. Each call
+  // resolves runtime_config() again, once both are set.
+  void set_config(const Config* config);
+  void set_cardboard_config(const Config* config);
 
-  void set_cardboard_config(const Config* config) {
-    cardboard_config_ = config;
-  }
+  // The values of config and the Cardboard config read every frame, with the
+  // right one of them picked for is_in_cardboard().
+  const RuntimeConfig& runtime_config() const { return runtime_config_; }
 
   motive::MotiveEngine& engine() { return engine_; }
   ParticleManager& particle_manager() { return particle_manager_; }
+  const SceneObjectComponent& sceneobject_component() const {
+    return sceneobject_component_;
+  }
+
+  // How many entities have each component, for the performance HUD.
+  struct ComponentCount {
+    const char* name;
+    size_t entities;
+  };
+  void GetComponentCounts(std::vector<ComponentCount>* counts) const;
 
   // Sets up the players in joining mode, where all they can do is jump up
   // and down.
   void EnterJoiningMode();
 
+  // Packs the entities and their component data together in memory.  Only
+  // call between frames, since all of the component data moves.
+  void CompactEntities() { entity_manager_.Compact(); }
+
+  // Lets the entity manager update independent components, and the particle
+  // manager blocks of particles, in parallel.
+  void set_update_runner(entity::UpdateRunnerInterface* update_runner) {
+    entity_manager_.set_update_runner(update_runner);
+    particle_manager_.set_update_runner(update_runner);
+  }
+
   WorldTime GetAnimationTime(const Character& character) const;
 
   // Sets the MultiplayerDirector we can talk to to propagate some game state
@@ -148,34 +282,40 @@ class GameState {
   void set_is_multiscreen(bool b) { is_multiscreen_ = b; }
   bool is_multiscreen() const { return is_multiscreen_; }
 
-  void set_is_in_cardboard(bool b) { is_in_cardboard_ = b; }
+  void set_is_in_cardboard(bool b) {
+    is_in_cardboard_ = b;
+    runtime_config_.set_in_cardboard(b);
+  }
   bool is_in_cardboard() const { return is_in_cardboard_; }
 
   void set_use_undistort_rendering(bool b) { use_undistort_rendering_ = b; }
   bool use_undistort_rendering() { return use_undistort_rendering_; }
 
+  // Whether to spawn the victory and join confetti, set by quality tier.
+  void set_confetti_enabled(bool b) { confetti_enabled_ = b; }
+  bool confetti_enabled() const { return confetti_enabled_; }
+
  private:
-  void ProcessSounds(pindrop::AudioEngine* audio_engine,
-                     const Character& character, WorldTime delta_time) const;
+  void ProcessSounds(const Character& character, WorldTime delta_time);
   void CreatePie(CharacterId original_source_id, CharacterId source_id,
                  CharacterId target_id, CharacterHealth original_damage,
                  CharacterHealth damage);
   float CalculatePieYRotation(CharacterId source_id,
                               CharacterId target_id) const;
   CharacterId DetermineDeflectionTarget(const ReceivedPie& pie) const;
-  void ProcessEvent(pindrop::AudioEngine* audio_engine, Character* character,
-                    unsigned int event, const EventData& event_data);
+  void ProcessEvent(Character* character, unsigned int event,
+                    const EventData& event_data);
   void PopulateConditionInputs(ConditionInputs* condition_inputs,
                                const Character& character) const;
+  void FindStateMachineTransitions();
   void PopulateCharacterAccessories(SceneDescription* scene,
                                     uint16_t renderable_id,
                                     const mathfu::mat4& character_matrix,
                                     int num_accessories, int damage,
                                     int health) const;
-  void ProcessConditionalEvents(pindrop::AudioEngine* audio_engine,
-                                Character* character, EventData* event_data);
-  void ProcessEvents(pindrop::AudioEngine* audio_engine, Character* character,
-                     EventData* data, WorldTime delta_time);
+  void ProcessConditionalEvents(Character* character, EventData* event_data);
+  void ProcessEvents(Character* character, EventData* data,
+                     WorldTime delta_time);
   void UpdatePiePosition(AirbornePie* pie) const;
   CharacterId CalculateCharacterTarget(CharacterId id) const;
   float CalculateCharacterFacingAngleVelocity(const Character* character,
@@ -185,14 +325,24 @@ class GameState {
   Angle TiltCharacterAwayFromCamera(CharacterId id, const Angle angle) const;
   motive::TwitchDirection FakeResponseToTurn(CharacterId id) const;
   void AddParticlesToScene(SceneDescription* scene) const;
-  void CreatePieSplatter(pindrop::AudioEngine* audio_engine,
-                         const Character& character, int damage);
+  void CreatePieSplatter(const Character& character, int damage);
   void CreateJoinConfettiBurst(const Character& character);
   void SpawnParticles(const mathfu::vec3& position, const ParticleDef* def,
                       const int particle_count,
                       const mathfu::vec4& base_tint = mathfu::vec4(1, 1, 1, 1));
-  void ShakeProps(float percent, const mathfu::vec3& damage_position);
+  void QueueSound(pindrop::SoundHandle sound,
+                  QueuedEffects::SoundPriority priority);
+  void QueueParticles(const mathfu::vec3& position, const ParticleDef* def,
+                      int particle_count,
+                      const mathfu::vec4& base_tint = mathfu::vec4(1, 1, 1, 1));
+  void QueueShake(float percent, const mathfu::vec3& damage_position);
+  void DispatchEffects(pindrop::AudioEngine* audio_engine);
+  void SplatterProps();
   void AddSplatterToProp(entity::EntityRef prop);
+  void CalculateCharacterAngles();
+  void UpdateAiBlackboard();
+  void BuildEntities(const Config* layout_config);
+  void ResetEntities();
 
   WorldTime time_;
   // countdown_time_ is in seconds and is derived from the length of the game
@@ -202,7 +352,44 @@ class GameState {
   GameCamera camera_;
   GameCameraState camera_base_;
   std::vector<std::unique_ptr<Character>> characters_;
-  std::vector<std::unique_ptr<AirbornePie>> pies_;
+  PiePool pies_;
+
+  // Angle from every character to every other, indexed by
+  // source_id * characters_.size() + target_id. Filled in by Reset().
+  std::vector<Angle> character_angles_;
+
+  // Per character events of the current frame, kept between frames so that
+  // AdvanceFrame() doesn't allocate them again.
+  std::vector<EventData> event_data_;
+
+  // Effects of this frame's events, dispatched at the end of AdvanceFrame().
+  QueuedEffects effects_;
+
+  // Sounds found by LoadSounds(). Those of the timeline of state s, in
+  // timeline order, start at timeline_sound_starts_[s].
+  std::vector<size_t> timeline_sound_starts_;
+  std::vector<pindrop::SoundHandle> timeline_sounds_;
+  // Indexed by pie damage.
+  std::vector<pindrop::SoundHandle> hit_sounds_;
+  std::vector<pindrop::SoundHandle> blocked_sounds_;
+  pindrop::SoundHandle turning_sound_;
+  // Scratch space for SplatterProps().
+  std::vector<entity::EntityRef> splattered_props_;
+
+  AiBlackboard ai_blackboard_;
+  // Scratch space for UpdateAiBlackboard().
+  std::vector<CharacterId> characters_by_health_;
+
+  // The state machine inputs of every character, one array per field, for
+  // CharacterStateMachineTable::FindTransitions(). Kept to reuse the storage.
+  struct StateMachineInputs {
+    std::vector<int> states;
+    std::vector<int32_t> is_down;
+    std::vector<int32_t> went_down;
+    std::vector<int32_t> went_up;
+    std::vector<int> animation_time;
+    std::vector<int> targets;
+  } state_machine_inputs_;
   motive::MotiveEngine engine_;
   const Config* config_;
   const CharacterArrangement* arrangement_;
@@ -213,6 +400,12 @@ class GameState {
   entity::EntityManager entity_manager_;
   // Entity factory for creating entities from flatbuffers:
   PieNoonEntityFactory pie_noon_entity_factory_;
+  // The layout, Cardboard mode and character count the entities were built
+  // for. While they're the same, Reset() keeps the entities and only resets
+  // their values. A null layout means they must be built again.
+  const Config* entities_layout_;
+  bool entities_in_cardboard_;
+  size_t entities_character_count_;
 
   // Component for handling movable objects in the scene.
   SceneObjectComponent sceneobject_component_;
@@ -232,10 +425,12 @@ class GameState {
   bool is_multiscreen_;
 
   const Config* cardboard_config_;
+  RuntimeConfig runtime_config_;
   // Whether you are playing in Cardboard mode.
   bool is_in_cardboard_;
   // Whether it should use undistortion rendering in Cardboard.
   bool use_undistort_rendering_;
+  bool confetti_enabled_;
 };
 
 }  // pie_noon
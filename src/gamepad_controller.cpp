@@ -40,7 +40,7 @@ static const float kAnalogDeadZone = 0.25f;
 
 void GamepadController::AdvanceFrame(WorldTime /*delta_time*/) {
   went_down_ = went_up_ = 0;
-  Gamepad gamepad = input_system_->GetGamepad(controller_id_);
+  const Gamepad &gamepad = input_system_->GetGamepad(controller_id_);
   SetLogicalInputs(LogicalInputs_Up, gamepad.GetButton(Gamepad::kUp).is_down());
   SetLogicalInputs(LogicalInputs_Down,
                    gamepad.GetButton(Gamepad::kDown).is_down());
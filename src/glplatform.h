@@ -44,7 +44,9 @@
 #include <GL/gl.h>
 #include <GL/glext.h>
 #ifdef _WIN32
-#define GLBASEEXTS GLEXT(PFNGLACTIVETEXTUREARBPROC, glActiveTexture)
+#define GLBASEEXTS                                   \
+  GLEXT(PFNGLACTIVETEXTUREARBPROC, glActiveTexture) \
+  GLEXT(PFNGLCOMPRESSEDTEXIMAGE2DARBPROC, glCompressedTexImage2D)
 #else
 #define GLBASEEXTS
 #endif
@@ -60,6 +62,7 @@
   GLEXT(PFNGLVERTEXATTRIBPOINTERARBPROC, glVertexAttribPointer)           \
   GLEXT(PFNGLENABLEVERTEXATTRIBARRAYARBPROC, glEnableVertexAttribArray)   \
   GLEXT(PFNGLDISABLEVERTEXATTRIBARRAYARBPROC, glDisableVertexAttribArray) \
+  GLEXT(PFNGLVERTEXATTRIB4FARBPROC, glVertexAttrib4f)                     \
   GLEXT(PFNGLCREATEPROGRAMPROC, glCreateProgram)                          \
   GLEXT(PFNGLDELETEPROGRAMPROC, glDeleteProgram)                          \
   GLEXT(PFNGLDELETESHADERPROC, glDeleteShader)                            \
@@ -96,6 +99,149 @@ GLEXTS
 #endif
 #endif
 
+// Instanced drawing is core in OpenGL ES 3, and available through extensions
+// on many ES 2 and desktop GL 2.1 drivers, so the entry points are looked up
+// at runtime. See Renderer::SupportsInstancing().
+#if defined(GL_APIENTRY)
+#define FPL_GL_APIENTRY GL_APIENTRY
+#elif defined(APIENTRY)
+#define FPL_GL_APIENTRY APIENTRY
+#else
+#define FPL_GL_APIENTRY
+#endif
+typedef void(FPL_GL_APIENTRY *FplGlDrawElementsInstancedProc)(
+    GLenum mode, GLsizei count, GLenum type, const GLvoid *indices,
+    GLsizei instance_count);
+typedef void(FPL_GL_APIENTRY *FplGlVertexAttribDivisorProc)(GLuint index,
+                                                            GLuint divisor);
+
+// Likewise vertex array objects, which are core in OpenGL ES 3 and GL 3, and
+// extensions before that. See Renderer::SupportsVertexArrays().
+typedef void(FPL_GL_APIENTRY *FplGlGenVertexArraysProc)(GLsizei n,
+                                                        GLuint *arrays);
+typedef void(FPL_GL_APIENTRY *FplGlBindVertexArrayProc)(GLuint array);
+typedef void(FPL_GL_APIENTRY *FplGlDeleteVertexArraysProc)(
+    GLsizei n, const GLuint *arrays);
+
+// Compressed texture formats that the KTX loader understands. ETC2 is core in
+// OpenGL ES 3 (and desktop GL through ARB_ES3_compatibility), ASTC comes from
+// KHR_texture_compression_astc_ldr. Older headers don't define them.
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RGB8_ETC2 0x9274
+#endif
+#ifndef GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2
+#define GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2 0x9276
+#endif
+#ifndef GL_COMPRESSED_RGBA8_ETC2_EAC
+#define GL_COMPRESSED_RGBA8_ETC2_EAC 0x9278
+#endif
+#ifndef GL_COMPRESSED_RGBA_ASTC_4x4_KHR
+#define GL_COMPRESSED_RGBA_ASTC_4x4_KHR 0x93B0
+#endif
+#ifndef GL_COMPRESSED_RGBA_ASTC_12x12_KHR
+#define GL_COMPRESSED_RGBA_ASTC_12x12_KHR 0x93BD
+#endif
+
+// Vertex attribute types for quantized meshes, which are core in OpenGL ES 3
+// and GL 3.3, and come from ARB_half_float_vertex and
+// ARB_vertex_type_2_10_10_10_rev before that. ES 2's OES_vertex_half_float
+// uses a different value, so isn't used. See Mesh::Quantize().
+#ifndef GL_HALF_FLOAT
+#define GL_HALF_FLOAT 0x140B
+#endif
+#ifndef GL_INT_2_10_10_10_REV
+#define GL_INT_2_10_10_10_REV 0x8D9F
+#endif
+
+// Pixel buffer objects, mapped buffers and fences, for uploading textures
+// without the driver copying them first. Core in OpenGL ES 3, and from
+// ARB_pixel_buffer_object, ARB_map_buffer_range and ARB_sync on desktop.
+// See Renderer::SupportsPixelBuffers().
+typedef struct __GLsync *FplGlSync;
+typedef void *(FPL_GL_APIENTRY *FplGlMapBufferRangeProc)(GLenum target,
+                                                         GLintptr offset,
+                                                         GLsizeiptr length,
+                                                         GLbitfield access);
+typedef GLboolean(FPL_GL_APIENTRY *FplGlUnmapBufferProc)(GLenum target);
+typedef FplGlSync(FPL_GL_APIENTRY *FplGlFenceSyncProc)(GLenum condition,
+                                                       GLbitfield flags);
+typedef GLenum(FPL_GL_APIENTRY *FplGlClientWaitSyncProc)(FplGlSync sync,
+                                                         GLbitfield flags,
+                                                         uint64_t timeout);
+typedef void(FPL_GL_APIENTRY *FplGlDeleteSyncProc)(FplGlSync sync);
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT 0x0002
+#endif
+#ifndef GL_MAP_INVALIDATE_BUFFER_BIT
+#define GL_MAP_INVALIDATE_BUFFER_BIT 0x0008
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_ALREADY_SIGNALED
+#define GL_ALREADY_SIGNALED 0x911A
+#endif
+#ifndef GL_CONDITION_SATISFIED
+#define GL_CONDITION_SATISFIED 0x911C
+#endif
+
+// GPU timer queries come from EXT_disjoint_timer_query on OpenGL ES, and
+// ARB_timer_query (core in GL 3.3) on desktop. See Renderer::BeginGpuTimer().
+typedef void(FPL_GL_APIENTRY *FplGlGenQueriesProc)(GLsizei n, GLuint *ids);
+typedef void(FPL_GL_APIENTRY *FplGlDeleteQueriesProc)(GLsizei n,
+                                                      const GLuint *ids);
+typedef void(FPL_GL_APIENTRY *FplGlBeginQueryProc)(GLenum target, GLuint id);
+typedef void(FPL_GL_APIENTRY *FplGlEndQueryProc)(GLenum target);
+typedef void(FPL_GL_APIENTRY *FplGlGetQueryObjectuivProc)(GLuint id,
+                                                          GLenum pname,
+                                                          GLuint *params);
+typedef void(FPL_GL_APIENTRY *FplGlGetQueryObjectui64vProc)(GLuint id,
+                                                            GLenum pname,
+                                                            uint64_t *params);
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+#ifndef GL_QUERY_RESULT_EXT
+#define GL_QUERY_RESULT_EXT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE_EXT
+#define GL_QUERY_RESULT_AVAILABLE_EXT 0x8867
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
+// Program binaries are core in OpenGL ES 3, and come from
+// OES_get_program_binary on ES 2 and ARB_get_program_binary on desktop.
+// KHR_parallel_shader_compile lets the driver compile on its own threads.
+// See Renderer::BeginLinkShader().
+typedef void(FPL_GL_APIENTRY *FplGlGetProgramBinaryProc)(GLuint program,
+                                                         GLsizei buffer_size,
+                                                         GLsizei *length,
+                                                         GLenum *format,
+                                                         void *binary);
+typedef void(FPL_GL_APIENTRY *FplGlProgramBinaryProc)(GLuint program,
+                                                      GLenum format,
+                                                      const void *binary,
+                                                      GLint length);
+typedef void(FPL_GL_APIENTRY *FplGlProgramParameteriProc)(GLuint program,
+                                                          GLenum pname,
+                                                          GLint value);
+typedef void(FPL_GL_APIENTRY *FplGlMaxShaderCompilerThreadsProc)(
+    GLuint count);
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+
 // Define a GL_CALL macro to wrap each (void-returning) OpenGL call.
 // This logs GL error when LOG_GL_ERRORS below is defined.
 #if defined(_DEBUG) || DEBUG == 1
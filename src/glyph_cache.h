@@ -16,8 +16,10 @@
 #define GLYPH_CACH_H
 
 #include <map>
+#include <memory>
 #include <unordered_map>
 #include <list>
+#include <vector>
 
 #include "SDL_log.h"
 #include "common.h"
@@ -25,10 +27,11 @@
 
 namespace fpl {
 
-// The glyph cache maintains a list of GlyphCacheRow. Each row has a fixed sizes
-// of height, which is determined at a row creation time. A row can include
-// multiple GlyphCacheEntry with a same or smaller height and they can have
-// variable width. In a row,
+// The glyph cache maintains one or more pages, each of which corresponds to an
+// atlas texture. A page maintains a list of GlyphCacheRow. Each row has a fixed
+// sizes of height, which is determined at a row creation time. A row can
+// include multiple GlyphCacheEntry with a same or smaller height and they can
+// have variable width. In a row,
 // GlyphCacheEntry are stored from left to right in the order of registration
 // and won't be evicted per entry, but entire row is flushed when necessary to
 // make a room for new GlyphCacheEntry.
@@ -36,23 +39,26 @@ namespace fpl {
 // caching perfomance estimating same size of glphys tends to be stored in a
 // cache at same time. (e.g. Caching a string in a same size.)
 //
+// Pages are added on demand, when no page has room for a glyph, up to the
+// maximum given at construction. Only once that many pages are in use are
+// rows evicted, least recently used first, from whichever page has one to
+// spare.
+//
 // When looking up a cached entry, the API looks up unordered_map which is O(1)
 // operation.
 // If there is no cached entry for given code point, the caller needs to invoke
 // Set() API to fill in a cache.
 // Set() operation takes
-// O(log N (N=# of rows)) when there is a room in the cache for the request,
-// + O(N (N=# of rows)) to look up and evict least recently used row with
-// sufficient height.
-
-// Enable tracking stats in Debug build.
-#ifdef _DEBUG
-#define GLYPH_CACHE_STATS (1)
-#endif
+// O(P log N (P=# of pages, N=# of rows)) when there is a room in the cache for
+// the request,
+// + O(P N) to look up and evict least recently used row with sufficient
+// height.
 
 // Forward decl.
 template <typename T>
 class GlyphCache;
+template <typename T>
+class GlyphCachePage;
 class GlyphCacheRow;
 class GlyphCacheEntry;
 
@@ -63,6 +69,22 @@ const int32_t kGlyphCacheHeightRound = 4;
 const int32_t kGlyphCachePaddingX = 1;
 const int32_t kGlyphCachePaddingY = 1;
 
+// Usage statistics of a glyph cache, since it was last flushed.
+struct GlyphCacheStats {
+  GlyphCacheStats()
+      : lookups(0), hits(0), row_flushes(0), set_fails(0), pages_added(0) {}
+
+  // Calls to Find(), and how many of them found the glyph.
+  int32_t lookups;
+  int32_t hits;
+  // Rows evicted to make room for new glyphs.
+  int32_t row_flushes;
+  // Calls to Set() that found no room, even after evicting.
+  int32_t set_fails;
+  // Pages allocated because the existing ones were full.
+  int32_t pages_added;
+};
+
 // Cache entry for a glyph.
 class GlyphCacheEntry {
  public:
@@ -71,7 +93,8 @@ class GlyphCacheEntry {
       uint64_t, std::unique_ptr<GlyphCacheEntry>>::iterator iterator;
   typedef std::list<GlyphCacheRow>::iterator iterator_row;
 
-  GlyphCacheEntry() : code_point_(0), size_(0, 0), offset_(0, 0) {}
+  GlyphCacheEntry()
+      : code_point_(0), size_(0, 0), offset_(0, 0), page_(0) {}
 
   // Setter/Getter of code point.
   // Code point is an entry in a font file, not a direct transform of Unicode.
@@ -90,6 +113,10 @@ class GlyphCacheEntry {
   mathfu::vec4 get_uv() const { return uv_; }
   void set_uv(const mathfu::vec4& uv) { uv_ = uv; }
 
+  // Getter of the page the glyph image is stored in. The UV is relative to
+  // that page's texture.
+  int32_t get_page() const { return page_; }
+
  private:
   // Friend class, GlyphCache needs an access to internal variables of the
   // class.
@@ -108,6 +135,9 @@ class GlyphCacheEntry {
   // Glyph image's UV in the texture atlas.
   mathfu::vec4 uv_;
 
+  // Index of the page in the cache.
+  int32_t page_;
+
   // Iterator to the row entry.
   GlyphCacheEntry::iterator_row it_row;
 
@@ -230,18 +260,12 @@ class GlyphCacheRow {
   std::vector<GlyphCacheEntry::iterator> cached_entries_;
 };
 
+// One texture's worth of glyphs. GlyphCachePage is an internal class for
+// GlyphCache, which it is a friend of.
 template <typename T>
-class GlyphCache {
+class GlyphCachePage {
  public:
-  // Constructor with parameters.
-  // width: width of the glyph cache texture. Rounded up to power of 2.
-  // height: height of the glyph cache texture. Rounded up to power of 2.
-  GlyphCache(const mathfu::vec2i& size)
-      : counter_(0), revision_(0), dirty_(false) {
-    // Round up cache sizes to power of 2.
-    size_.x() = mathfu::RoundUpToPowerOf2(size.x());
-    size_.y() = mathfu::RoundUpToPowerOf2(size.y());
-
+  GlyphCachePage(const mathfu::vec2i& size) : size_(size), dirty_(false) {
     // Allocate the glyph cache buffer.
     // A buffer format can be 8/32 bpp (32 bpp is mostly used for Emoji).
     buffer_.reset(new T[size_.x() * size_.y()]);
@@ -250,12 +274,142 @@ class GlyphCache {
     const int32_t kCacheClearValue = 0x0;
     memset(buffer_.get(), kCacheClearValue, size_.x() * size_.y() * sizeof(T));
 
-    // Create first (empty) row entry.
-    InsertNewRow(0, size_, list_row_.end());
+    Clear(0);
+  }
+
+  // Getter/Setter of dirty state.
+  bool get_dirty_state() const { return dirty_; };
+  void set_dirty_state(const bool dirty) { dirty_ = dirty; }
+
+  // Getter of dirty rect.
+  const mathfu::vec4i& get_dirty_rect() const { return dirty_rect_; }
+
+  // Getter of the page's buffer.
+  const T* get_buffer() const { return buffer_.get(); }
+
+ private:
+  template <typename U>
+  friend class GlyphCache;
+
+  // Remove every row, leaving one empty row covering the whole page.
+  void Clear(const uint32_t counter) {
+    lru_row_.clear();
+    list_row_.clear();
+    map_row_.clear();
+    InsertNewRow(0, size_, list_row_.end(), counter);
+    dirty_ = false;
+  }
+
+  // Find a row with room for a glyph of 'size', or return list_row_.end().
+  GlyphCacheEntry::iterator_row FindRow(const mathfu::vec2i& size) {
+    auto it = map_row_.lower_bound(size.y());
+    while (it != map_row_.end()) {
+      if (it->second->DoesFit(size)) return it->second;
+      it++;
+    }
+    return list_row_.end();
+  }
+
+  // Insert new row to the row list with a given size.
+  // It tries to merge 2 rows if next row is also empty one.
+  void InsertNewRow(const int32_t y_pos, const mathfu::vec2i& size,
+                    const GlyphCacheEntry::iterator_row pos,
+                    const uint32_t counter) {
+    // First, check if we can merge the requested row with next row to free up
+    // more spaces.
+    // New row is always inserted right after valid row entry. So we don't have
+    // to check previous row entry to merge.
+    if (pos != list_row_.end()) {
+      auto next_entry = std::next(pos);
+      if (next_entry->get_num_glyphs() == 0) {
+        // We can merge them.
+        mathfu::vec2i next_size = next_entry->get_size();
+        next_size.y() += size.y();
+        next_entry->set_y_pos(next_entry->get_y_pos() - size.y());
+        next_entry->set_size(next_size);
+        next_entry->set_last_used_counter(counter);
+        return;
+      }
+    }
+
+    // Insert new row.
+    auto it = list_row_.insert(pos, GlyphCacheRow(y_pos, size));
+    auto it_lru_row = lru_row_.insert(lru_row_.end(), it);
+    auto it_map = map_row_.insert(
+        std::pair<int32_t, GlyphCacheEntry::iterator_row>(size.y(), it));
+
+    // Update a link.
+    it->set_it_lru_row(it_lru_row);
+    it->set_it_row_height_map(it_map);
+  }
+
+  // Copy glyph image into the buffer.
+  void CopyImage(const mathfu::vec2i& pos, const T* const image,
+                 const GlyphCacheEntry* entry) {
+    auto buffer = buffer_.get();
+    auto size = entry->get_size().x() * sizeof(T);
+    for (int32_t y = 0; y < entry->get_size().y(); ++y) {
+      memcpy(buffer + pos.x() + (pos.y() + y) * size_.x(),
+             image + y * entry->get_size().x(), size);
+    }
+    UpdateDirtyRect(mathfu::vec4i(pos, pos + entry->get_size()));
+  }
+
+  // Update dirty rect.
+  void UpdateDirtyRect(const mathfu::vec4i& rect) {
+    if (!dirty_) {
+      // Initialize dirty rect.
+      dirty_rect_ = mathfu::vec4i(size_, mathfu::kZeros2i);
+    }
+
+    dirty_ = true;
+    dirty_rect_ =
+        mathfu::vec4i(mathfu::vec2i::Min(dirty_rect_.xy(), rect.xy()),
+                      mathfu::vec2i::Max(dirty_rect_.zw(), rect.zw()));
+  }
+
+  // Size of the page. Same for every page in a cache.
+  mathfu::vec2i size_;
+
+  // Cache buffer;
+  std::unique_ptr<T[]> buffer_;
+
+  // list of rows in the page.
+  std::list<GlyphCacheRow> list_row_;
+
+  // LRU entries of the row. Tracks iterator to list_row_.
+  std::list<GlyphCacheEntry::iterator_row> lru_row_;
+
+  // Map to row entries to have O(log N) access to a row entry.
+  // Tracks iterator to list_row_.
+  // Using multimap because multiple rows can have same row height.
+  // Key: height of the row. With the map, an API can have quick access to a row
+  // with a given height.
+  std::multimap<int32_t, GlyphCacheEntry::iterator_row> map_row_;
+
+  // Flag indicates if the page is dirty. If it's dirty, corresponding font
+  // atlas texture needs to be uploaded.
+  bool dirty_;
+
+  // Dirty region in the buffer.
+  mathfu::vec4i dirty_rect_;
+};
+
+template <typename T>
+class GlyphCache {
+ public:
+  // Constructor with parameters.
+  // size: size of each glyph cache page. Rounded up to power of 2.
+  // max_pages: how many pages the cache may grow to before it starts evicting
+  // rows. Each page takes size.x() * size.y() * sizeof(T) bytes.
+  GlyphCache(const mathfu::vec2i& size, const int32_t max_pages = 1)
+      : counter_(0), revision_(0), max_pages_(std::max(1, max_pages)) {
+    // Round up cache sizes to power of 2.
+    size_.x() = mathfu::RoundUpToPowerOf2(size.x());
+    size_.y() = mathfu::RoundUpToPowerOf2(size.y());
 
-#ifdef GLYPH_CACHE_STATS
-    ResetStats();
-#endif
+    // Create the first (empty) page.
+    pages_.emplace_back(new GlyphCachePage<T>(size_));
   }
   ~GlyphCache(){};
 
@@ -263,10 +417,7 @@ class GlyphCache {
   // Return value: A pointer to a cached glyph entry.
   // nullptr if not found.
   const GlyphCacheEntry* Find(const uint32_t code_point, const int32_t y_size) {
-#ifdef GLYPH_CACHE_STATS
-    // Update debug variable.
-    stats_lookup_++;
-#endif
+    stats_.lookups++;
     auto it =
         map_entries_.find(static_cast<uint64_t>(code_point) << 32 | y_size);
     if (it != map_entries_.end()) {
@@ -276,12 +427,10 @@ class GlyphCache {
       it->second->it_row->set_last_used_counter(counter_);
 
       // Update row LRU entry. The row is now most recently used.
-      lru_row_.splice(lru_row_.end(), lru_row_, it->second->it_lru_row_);
+      auto& lru_row = pages_[it->second->page_]->lru_row_;
+      lru_row.splice(lru_row.end(), lru_row, it->second->it_lru_row_);
 
-#ifdef GLYPH_CACHE_STATS
-      // Update debug variable.
-      stats_hit_++;
-#endif
+      stats_.hits++;
       return it->second.get();
     }
 
@@ -298,151 +447,96 @@ class GlyphCache {
                              const GlyphCacheEntry& entry) {
     // Lookup entries if the entry is already stored in the cache.
     auto p = Find(entry.get_code_point(), y_size);
-#ifdef GLYPH_CACHE_STATS
-    // Adjust debug variable.
-    stats_lookup_--;
-#endif
+    // Adjust stats, since this isn't a lookup by the user.
+    stats_.lookups--;
     if (p) {
       // Make sure cached entry has same properties.
       // The cache only support one entry per a glyph code point for now.
       assert(p->get_size().x() == entry.get_size().x());
       assert(p->get_size().y() == entry.get_size().y());
-#ifdef GLYPH_CACHE_STATS
-      // Adjust debug variable.
-      stats_hit_--;
-#endif
+      stats_.hits--;
       return p;
     }
 
     // Adjust requested height & width.
     // Height is rounded up to multiple of kGlyphCacheHeightRound.
     // Expecting kGlyphCacheHeightRound is base 2.
-    int32_t req_width = entry.get_size().x() + kGlyphCachePaddingX;
-    int32_t req_height = ((entry.get_size().y() + kGlyphCachePaddingY +
-                           (kGlyphCacheHeightRound - 1)) &
-                          ~(kGlyphCacheHeightRound - 1));
-
-    // Look up the row map to retrieve a row iterator to start with.
-    auto it = map_row_.lower_bound(req_height);
-    while (it != map_row_.end()) {
-      if (it->second->DoesFit(mathfu::vec2i(req_width, req_height))) {
-        break;
+    const mathfu::vec2i req_size(
+        entry.get_size().x() + kGlyphCachePaddingX,
+        (entry.get_size().y() + kGlyphCachePaddingY +
+         (kGlyphCacheHeightRound - 1)) &
+            ~(kGlyphCacheHeightRound - 1));
+
+    // Look for free space in each page, then in a new page.
+    for (size_t i = 0; i < pages_.size(); ++i) {
+      auto it_row = pages_[i]->FindRow(req_size);
+      if (it_row != pages_[i]->list_row_.end()) {
+        return Insert(static_cast<int32_t>(i), it_row, image, y_size, entry,
+                      req_size);
       }
-      it++;
+    }
+    if (static_cast<int32_t>(pages_.size()) < max_pages_ &&
+        req_size.x() <= size_.x() && req_size.y() <= size_.y()) {
+      pages_.emplace_back(new GlyphCachePage<T>(size_));
+      stats_.pages_added++;
+      return Set(image, y_size, entry);
     }
 
-    GlyphCacheEntry* ret;
-    if (it != map_row_.end()) {
-      // Found sufficient space in the buffer.
-      auto it_row = it->second;
-
-      if (it_row->get_num_glyphs() == 0) {
-        // Putting first entry to the row.
-        // In this case, we create new empty row to track rest of free space.
-        auto original_height = it_row->get_size().y();
-        auto original_y_pos = it_row->get_y_pos();
-
-        if (original_height - req_height >= kGlyphCacheHeightRound) {
-          // Create new row for free space.
-          it_row->set_size(mathfu::vec2i(size_.x(), req_height));
-
-          // Update row height map key as well.
-          map_row_.erase(it_row->get_it_row_height_map());
-          auto it_map =
-              map_row_.insert(std::pair<int32_t, GlyphCacheEntry::iterator_row>(
-                  req_height, it_row));
-          it_row->set_it_row_height_map(it_map);
-
-          InsertNewRow(original_y_pos + req_height,
-                       mathfu::vec2i(size_.x(), original_height - req_height),
-                       list_row_.end());
-        }
-      }
+    // Couldn't find sufficient row entry nor free space to create new row.
 
-      // Create new entry in the look-up map.
-      auto pair = map_entries_.insert(
-          std::pair<uint64_t, std::unique_ptr<GlyphCacheEntry>>(
-              static_cast<uint64_t>(entry.get_code_point()) << 32 | y_size,
-              std::unique_ptr<GlyphCacheEntry>(new GlyphCacheEntry(entry))));
-      auto it_entry = pair.first;
-      ret = it_entry->second.get();
-
-      // Reserve a region in the row.
-      auto pos = mathfu::vec2i(
-          it_row->Reserve(it_entry, mathfu::vec2i(req_width, req_height)),
-          it_row->get_y_pos());
-
-      // Store given image into the buffer.
-      CopyImage(pos, image, it_entry->second.get());
-
-      // Update UV of the entry.
-      auto p = mathfu::vec4(
-          mathfu::vec2(pos) / mathfu::vec2(size_),
-          mathfu::vec2(pos + entry.get_size()) / mathfu::vec2(size_));
-      ret->set_uv(p);
-
-      // Establish links.
-      ret->it_row = it_row;
-      ret->it_lru_row_ = it_row->get_it_lru_row();
-
-      // Update row LRU entry.
-      lru_row_.splice(lru_row_.end(), lru_row_, it_row->get_it_lru_row());
-      it_row->set_last_used_counter(counter_);
-    } else {
-      // Couldn't find sufficient row entry nor free space to create new row.
-
-      // Try to find a row that is not used in current cycle and has enough
-      // height from LRU list.
-      for (auto row : lru_row_) {
+    // Try to find the least recently used row, of any page, that is not used
+    // in current cycle and has enough height.
+    GlyphCacheEntry::iterator_row victim;
+    int32_t victim_page = -1;
+    for (size_t i = 0; i < pages_.size(); ++i) {
+      for (auto row : pages_[i]->lru_row_) {
         if (row->get_last_used_counter() == counter_) {
           // The row is being used in current rendering cycle.
           // We can not evict the row.
           continue;
         }
-        if (row->get_size().y() >= req_height) {
-          // Now flush & initialize the row.
-          FlushRow(row);
-          row->Initialize(row->get_y_pos(), row->get_size());
-
-          // Call the function recursively.
-          return Set(image, y_size, entry);
+        if (row->get_size().y() >= req_size.y()) {
+          if (victim_page < 0 || row->get_last_used_counter() <
+                                     victim->get_last_used_counter()) {
+            victim = row;
+            victim_page = static_cast<int32_t>(i);
+          }
+          // Rows further along the page's LRU list were used more recently.
+          break;
         }
       }
-#ifdef GLYPH_CACHE_STATS
-      stats_set_fail_++;
-#endif
-      // TODO: Try to flush multiple rows and merge them to free up space.
-      // TODO: Evaluate re-allocate solution.
-      // Now we don't have any space in the cache.
-      // It's caller's responsivility to recover from the situation.
-      // Possible work arounds are:
-      // - Draw glyphs with current glyph cache contents and then flush them,
-      // start new caching.
-      // - Just increase cache size.
-      return nullptr;
     }
+    if (victim_page >= 0) {
+      // Now flush & initialize the row.
+      FlushRow(victim);
+      victim->Initialize(victim->get_y_pos(), victim->get_size());
 
-    return ret;
+      // Call the function recursively.
+      return Set(image, y_size, entry);
+    }
+
+    stats_.set_fails++;
+    // TODO: Try to flush multiple rows and merge them to free up space.
+    // Now we don't have any space in the cache.
+    // It's caller's responsivility to recover from the situation.
+    // Possible work arounds are:
+    // - Draw glyphs with current glyph cache contents and then flush them,
+    // start new caching.
+    // - Just increase cache size, or the number of pages.
+    return nullptr;
   }
 
-  // Flush all cache entries.
+  // Flush all cache entries. Pages already allocated are kept, and reused.
   bool Flush() {
-#ifdef GLYPH_CACHE_STATS
-    ResetStats();
-#endif
+    stats_ = GlyphCacheStats();
     map_entries_.clear();
-    lru_row_.clear();
-    list_row_.clear();
-    map_row_.clear();
+    for (size_t i = 0; i < pages_.size(); ++i) {
+      pages_[i]->Clear(counter_);
+    }
 
     // Update cache revision.
     revision_ = counter_;
 
-    // Create first (empty) row entry.
-    InsertNewRow(0, size_, list_row_.end());
-
-    dirty_ = false;
-
     return true;
   }
 
@@ -454,75 +548,121 @@ class GlyphCache {
 
   // Debug API to show cache statistics.
   void Status() {
-#ifdef GLYPH_CACHE_STATS
-    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Cache size: %dx%d", size_.x(),
-                size_.y());
-    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Cache hit: %d / %d", stats_hit_,
-                stats_lookup_);
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Cache size: %dx%d, %d/%d pages",
+                size_.x(), size_.y(), static_cast<int32_t>(pages_.size()),
+                max_pages_);
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Cache hit: %d / %d",
+                stats_.hits, stats_.lookups);
 
     auto total_glyph = 0;
-    for (auto row : list_row_) {
-      SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                  "Row start:%d height:%d glyphs:%d counter:%d",
-                  row.get_y_pos(), row.get_size().y(), row.get_num_glyphs(),
-                  row.get_last_used_counter());
-      total_glyph += row.get_num_glyphs();
+    for (size_t i = 0; i < pages_.size(); ++i) {
+      for (auto row : pages_[i]->list_row_) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Page:%d row start:%d height:%d glyphs:%d counter:%d",
+                    static_cast<int32_t>(i), row.get_y_pos(),
+                    row.get_size().y(), row.get_num_glyphs(),
+                    row.get_last_used_counter());
+        total_glyph += row.get_num_glyphs();
+      }
     }
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Cached glyphs: %d", total_glyph);
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Row flush: %d",
-                stats_row_flush_);
-    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Set fail: %d", stats_set_fail_);
-#endif
+                stats_.row_flushes);
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Set fail: %d",
+                stats_.set_fails);
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Pages added: %d",
+                stats_.pages_added);
   }
 
+  // Getter of usage statistics since the last Flush().
+  const GlyphCacheStats& get_stats() const { return stats_; }
+
   // Getter/Setter of the counter.
   uint32_t get_revision() const { return revision_; }
   void set_revision(const uint32_t revision) { revision_ = revision; }
 
-  // Getter/Setter of dirty state.
-  bool get_dirty_state() const { return dirty_; };
-  void set_dirty_state(const bool dirty) { dirty_ = dirty; }
-
-  // Getter of dirty rect.
-  const mathfu::vec4i& get_dirty_rect() const { return dirty_rect_; }
+  // Getter of the pages allocated so far. Only ever grows.
+  int32_t get_num_pages() const { return static_cast<int32_t>(pages_.size()); }
+  int32_t get_max_pages() const { return max_pages_; }
+  GlyphCachePage<T>* get_page(const int32_t page) {
+    return pages_[page].get();
+  }
 
-  // Getter of allocated glyph cache buffer.
-  const T* get_buffer() const { return buffer_.get(); }
+  // True if any page has changed since its dirty state was last cleared.
+  bool get_dirty_state() const {
+    for (auto& page : pages_) {
+      if (page->get_dirty_state()) return true;
+    }
+    return false;
+  }
 
-  // Getter of the cache size.
+  // Getter of the size of each page.
   const mathfu::vec2i& get_size() const { return size_; }
 
  private:
-  // Insert new row to the row list with a given size.
-  // It tries to merge 2 rows if next row is also empty one.
-  void InsertNewRow(const int32_t y_pos, const mathfu::vec2i& size,
-                    const GlyphCacheEntry::iterator_row pos) {
-    // First, check if we can merge the requested row with next row to free up
-    // more spaces.
-    // New row is always inserted right after valid row entry. So we don't have
-    // to check previous row entry to merge.
-    if (pos != list_row_.end()) {
-      auto next_entry = std::next(pos);
-      if (next_entry->get_num_glyphs() == 0) {
-        // We can merge them.
-        mathfu::vec2i next_size = next_entry->get_size();
-        next_size.y() += size.y();
-        next_entry->set_y_pos(next_entry->get_y_pos() - size.y());
-        next_entry->set_size(next_size);
-        next_entry->set_last_used_counter(counter_);
-        return;
+  // Store 'entry' in the row 'it_row' of 'page', which has room for
+  // 'req_size'.
+  const GlyphCacheEntry* Insert(const int32_t page,
+                                const GlyphCacheEntry::iterator_row it_row,
+                                const T* const image, const int32_t y_size,
+                                const GlyphCacheEntry& entry,
+                                const mathfu::vec2i& req_size) {
+    GlyphCachePage<T>* p = pages_[page].get();
+    if (it_row->get_num_glyphs() == 0) {
+      // Putting first entry to the row.
+      // In this case, we create new empty row to track rest of free space.
+      auto original_height = it_row->get_size().y();
+      auto original_y_pos = it_row->get_y_pos();
+
+      if (original_height - req_size.y() >= kGlyphCacheHeightRound) {
+        // Create new row for free space.
+        it_row->set_size(mathfu::vec2i(size_.x(), req_size.y()));
+
+        // Update row height map key as well.
+        p->map_row_.erase(it_row->get_it_row_height_map());
+        auto it_map = p->map_row_.insert(
+            std::pair<int32_t, GlyphCacheEntry::iterator_row>(req_size.y(),
+                                                              it_row));
+        it_row->set_it_row_height_map(it_map);
+
+        p->InsertNewRow(
+            original_y_pos + req_size.y(),
+            mathfu::vec2i(size_.x(), original_height - req_size.y()),
+            p->list_row_.end(), counter_);
       }
     }
 
-    // Insert new row.
-    auto it = list_row_.insert(pos, GlyphCacheRow(y_pos, size));
-    auto it_lru_row = lru_row_.insert(lru_row_.end(), it);
-    auto it_map = map_row_.insert(
-        std::pair<int32_t, GlyphCacheEntry::iterator_row>(size.y(), it));
-
-    // Update a link.
-    it->set_it_lru_row(it_lru_row);
-    it->set_it_row_height_map(it_map);
+    // Create new entry in the look-up map.
+    auto pair = map_entries_.insert(
+        std::pair<uint64_t, std::unique_ptr<GlyphCacheEntry>>(
+            static_cast<uint64_t>(entry.get_code_point()) << 32 | y_size,
+            std::unique_ptr<GlyphCacheEntry>(new GlyphCacheEntry(entry))));
+    auto it_entry = pair.first;
+    GlyphCacheEntry* ret = it_entry->second.get();
+
+    // Reserve a region in the row.
+    auto pos = mathfu::vec2i(it_row->Reserve(it_entry, req_size),
+                             it_row->get_y_pos());
+
+    // Store given image into the buffer.
+    p->CopyImage(pos, image, ret);
+
+    // Update UV of the entry.
+    auto uv = mathfu::vec4(
+        mathfu::vec2(pos) / mathfu::vec2(size_),
+        mathfu::vec2(pos + entry.get_size()) / mathfu::vec2(size_));
+    ret->set_uv(uv);
+
+    // Establish links.
+    ret->page_ = page;
+    ret->it_row = it_row;
+    ret->it_lru_row_ = it_row->get_it_lru_row();
+
+    // Update row LRU entry.
+    p->lru_row_.splice(p->lru_row_.end(), p->lru_row_,
+                       it_row->get_it_lru_row());
+    it_row->set_last_used_counter(counter_);
+    return ret;
   }
 
   void FlushRow(const GlyphCacheEntry::iterator_row row) {
@@ -537,45 +677,8 @@ class GlyphCache {
     // happens in a cycle.
     revision_ = counter_;
 
-#ifdef GLYPH_CACHE_STATS
-    stats_row_flush_++;
-#endif
-  }
-
-  // Copy glyph image into the buffer.
-  void CopyImage(const mathfu::vec2i& pos, const T* const image,
-                 const GlyphCacheEntry* entry) {
-    auto buffer = buffer_.get();
-    auto size = entry->get_size().x() * sizeof(T);
-    for (int32_t y = 0; y < entry->get_size().y(); ++y) {
-      memcpy(buffer + pos.x() + (pos.y() + y) * size_.x(),
-             image + y * entry->get_size().x(), size);
-    }
-    UpdateDirtyRect(mathfu::vec4i(pos, pos + entry->get_size()));
-  }
-
-  // Update dirty rect.
-  void UpdateDirtyRect(const mathfu::vec4i& rect) {
-    if (!dirty_) {
-      // Initialize dirty rect.
-      dirty_rect_ = mathfu::vec4i(size_, mathfu::kZeros2i);
-    }
-
-    dirty_ = true;
-    dirty_rect_ =
-        mathfu::vec4i(mathfu::vec2i::Min(dirty_rect_.xy(), rect.xy()),
-                      mathfu::vec2i::Max(dirty_rect_.zw(), rect.zw()));
-  }
-
-#ifdef GLYPH_CACHE_STATS
-  void ResetStats() {
-    // Initialize debug variables.
-    stats_hit_ = 0;
-    stats_lookup_ = 0;
-    stats_row_flush_ = 0;
-    stats_set_fail_ = 0;
+    stats_.row_flushes++;
   }
-#endif
 
   // A time counter of the cache.
   // In each rendering cycle, the counter is incremented.
@@ -583,11 +686,11 @@ class GlyphCache {
   // cycle.
   uint32_t counter_;
 
-  // Size of the glyph cache. Rounded to power of 2.
+  // Size of each glyph cache page. Rounded to power of 2.
   mathfu::vec2i size_;
 
-  // Cache buffer;
-  std::unique_ptr<T> buffer_;
+  // Pages allocated so far, up to max_pages_.
+  std::vector<std::unique_ptr<GlyphCachePage<T>>> pages_;
 
   // Hash map to the cache entries
   // This map is the primary place to look up the cache entries.
@@ -596,19 +699,6 @@ class GlyphCache {
   // font file and not a Unicode value.
   std::unordered_map<uint64_t, std::unique_ptr<GlyphCacheEntry>> map_entries_;
 
-  // list of rows in the cache.
-  std::list<GlyphCacheRow> list_row_;
-
-  // LRU entries of the row. Tracks iterator to list_row_.
-  std::list<GlyphCacheEntry::iterator_row> lru_row_;
-
-  // Map to row entries to have O(log N) access to a row entry.
-  // Tracks iterator to list_row_.
-  // Using multimap because multiple rows can have same row height.
-  // Key: height of the row. With the map, an API can have quick access to a row
-  // with a given height.
-  std::multimap<int32_t, GlyphCacheEntry::iterator_row> map_row_;
-
   // Revision of the buffer.
   // Each time one or more cache entry is evicted, a revision of the cache is
   // updated.
@@ -618,20 +708,11 @@ class GlyphCache {
   // because existing entries are still valid in that case.
   uint32_t revision_;
 
-  // Flag indicates if the cache is dirty. If it's dirty, corresponding font
-  // atlas texture needs to be uploaded.
-  bool dirty_;
-
-  // Dirty region in the buffer.
-  mathfu::vec4i dirty_rect_;
+  // Most pages the cache may allocate.
+  int32_t max_pages_;
 
-#ifdef GLYPH_CACHE_STATS
-  // Variables to track usage stats.
-  int32_t stats_lookup_;
-  int32_t stats_hit_;
-  int32_t stats_row_flush_;
-  int32_t stats_set_fail_;
-#endif
+  // Usage stats, tracked in every build since they're cheap.
+  GlyphCacheStats stats_;
 };
 
 }  // namespace fpl
@@ -20,7 +20,17 @@
 namespace fpl {
 
 GPGManager::GPGManager()
-    : state_(kStart), do_ui_login_(false), delayed_login_(false) {}
+    : state_(kStart),
+      do_ui_login_(false),
+      delayed_login_(false),
+      event_counts_(nullptr),
+      achievement_states_(nullptr) {}
+
+GPGManager::~GPGManager() {
+  FreeRetiredSnapshots();
+  delete event_counts_.load();
+  delete achievement_states_.load();
+}
 
 pthread_mutex_t GPGManager::events_mutex_ = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t GPGManager::achievements_mutex_ = PTHREAD_MUTEX_INITIALIZER;
@@ -29,8 +39,6 @@ pthread_mutex_t GPGManager::players_mutex_ = PTHREAD_MUTEX_INITIALIZER;
 bool GPGManager::Initialize(bool ui_login) {
   state_ = kStart;
   do_ui_login_ = ui_login;
-  event_data_initialized_ = false;
-  achievement_data_initialized_ = false;
   player_data_.reset(nullptr);
 #ifdef NO_GPG
   return true;
@@ -103,6 +111,7 @@ void GPGManager::Update() {
   return;
 #endif
   assert(game_services_);
+  FreeRetiredSnapshots();
   switch (state_) {
     case kStart:
     case kAutoAuthStarted:
@@ -255,45 +264,60 @@ void GPGManager::FetchEvents() {
 
   game_services_->Events().FetchAll(
       [this](const gpg::EventManager::FetchAllResponse &far) mutable {
+        EventCounts *counts = nullptr;
+        if (IsSuccess(far.status)) {
+          counts = new EventCounts();
+          for (auto it = far.data.begin(); it != far.data.end(); ++it) {
+            (*counts)[it->first] = it->second.Count();
+          }
+        }
 
         pthread_mutex_lock(&events_mutex_);
-
-        if (IsSuccess(far.status)) {
+        if (counts != nullptr) {
+          retired_event_counts_.push_back(event_counts_.exchange(counts));
           event_data_state_ = kComplete;
-          event_data_initialized_ = true;
         } else {
           event_data_state_ = kFailed;
         }
-
-        event_data_ = far.data;
         pthread_mutex_unlock(&events_mutex_);
       });
 }
 
-bool GPGManager::IsAchievementUnlocked(std::string achievement_id) {
-  if (!achievement_data_initialized_) {
-    return false;
-  }
-  bool ret = false;
-  pthread_mutex_lock(&achievements_mutex_);
-  for (unsigned int i = 0; i < achievement_data_.size(); i++) {
-    if (achievement_data_[i].Id() == achievement_id) {
-      ret = achievement_data_[i].State() == gpg::AchievementState::UNLOCKED;
-      break;
-    }
-  }
-  pthread_mutex_unlock(&achievements_mutex_);
-  return ret;
+bool GPGManager::IsAchievementUnlocked(std::string achievement_id) const {
+  const AchievementStates *states = achievement_states_.load();
+  if (states == nullptr) return false;
+  auto it = states->find(achievement_id);
+  return it != states->end() &&
+         it->second == gpg::AchievementState::UNLOCKED;
 }
 
-uint64_t GPGManager::GetEventValue(std::string event_id) {
-  if (!event_data_initialized_) {
-    return 0;
+uint64_t GPGManager::GetEventValue(std::string event_id) const {
+  const EventCounts *counts = event_counts_.load();
+  if (counts == nullptr) return 0;
+  auto it = counts->find(event_id);
+  return it != counts->end() ? it->second : 0;
+}
+
+// Free the snapshots the fetch callbacks swapped out. The thread calling
+// Update() is the only one reading them, and it isn't now. If a callback
+// holds the lock, they're freed next time instead of waiting for it.
+void GPGManager::FreeRetiredSnapshots() {
+  if (pthread_mutex_trylock(&events_mutex_) == 0) {
+    for (auto it = retired_event_counts_.begin();
+         it != retired_event_counts_.end(); ++it) {
+      delete *it;
+    }
+    retired_event_counts_.clear();
+    pthread_mutex_unlock(&events_mutex_);
+  }
+  if (pthread_mutex_trylock(&achievements_mutex_) == 0) {
+    for (auto it = retired_achievement_states_.begin();
+         it != retired_achievement_states_.end(); ++it) {
+      delete *it;
+    }
+    retired_achievement_states_.clear();
+    pthread_mutex_unlock(&achievements_mutex_);
   }
-  pthread_mutex_lock(&achievements_mutex_);
-  uint64_t result = event_data_[event_id].Count();
-  pthread_mutex_unlock(&achievements_mutex_);
-  return result;
 }
 
 // Updates local player achievements with values from the server:
@@ -303,17 +327,22 @@ void GPGManager::FetchAchievements() {
 
   game_services_->Achievements().FetchAll(
       [this](const gpg::AchievementManager::FetchAllResponse &far) mutable {
+        AchievementStates *states = nullptr;
+        if (IsSuccess(far.status)) {
+          states = new AchievementStates();
+          for (auto it = far.data.begin(); it != far.data.end(); ++it) {
+            (*states)[it->Id()] = it->State();
+          }
+        }
 
         pthread_mutex_lock(&achievements_mutex_);
-
-        if (IsSuccess(far.status)) {
+        if (states != nullptr) {
+          retired_achievement_states_.push_back(
+              achievement_states_.exchange(states));
           achievement_data_state_ = kComplete;
-          achievement_data_initialized_ = true;
         } else {
           achievement_data_state_ = kFailed;
         }
-
-        achievement_data_ = far.data;
         pthread_mutex_unlock(&achievements_mutex_);
       });
 }
@@ -15,6 +15,8 @@
 #ifndef GPG_MANAGER_H
 #define GPG_MANAGER_H
 
+#include <atomic>
+#include <unordered_map>
 #include "common.h"
 #include "pthread.h"
 #include "gpg/achievement_manager.h"
@@ -33,6 +35,7 @@ struct GPGKeyValuePair {
 class GPGManager {
  public:
   GPGManager();
+  ~GPGManager();
 
   // Start of initial initialization and auth.
   bool Initialize(bool ui_login);
@@ -71,12 +74,12 @@ class GPGManager {
 
   RequestState event_data_state() const { return event_data_state_; }
 
-  std::map<std::string, gpg::Event> &event_data() { return event_data_; }
-
   gpg::Player *player_data() const { return player_data_.get(); }
 
-  uint64_t GetEventValue(std::string event_id);
-  bool IsAchievementUnlocked(std::string achievement_id);
+  // What the last successful FetchEvents() or FetchAchievements() returned.
+  // These don't lock, so only call them from the thread calling Update().
+  uint64_t GetEventValue(std::string event_id) const;
+  bool IsAchievementUnlocked(std::string achievement_id) const;
   void UnlockAchievement(std::string achievement_id);
   void IncrementAchievement(std::string achievement_id);
   void IncrementAchievement(std::string achievement_id, uint32_t steps);
@@ -102,19 +105,30 @@ class GPGManager {
   std::unique_ptr<gpg::GameServices> game_services_;
 
   void UpdatePlayerStats();
+  void FreeRetiredSnapshots();
+
+  typedef std::unordered_map<std::string, uint64_t> EventCounts;
+  typedef std::unordered_map<std::string, gpg::AchievementState>
+      AchievementStates;
 
   // The stats the stats currently stored on the server.
   // Retrieved after authentication.
-  bool event_data_initialized_;
-  bool achievement_data_initialized_;
   RequestState event_data_state_;
   RequestState achievement_data_state_;
   static pthread_mutex_t events_mutex_;
   static pthread_mutex_t achievements_mutex_;
   static pthread_mutex_t players_mutex_;
-  std::map<std::string, gpg::Event> event_data_;
   std::unique_ptr<gpg::Player> player_data_;
-  std::vector<gpg::Achievement> achievement_data_;
+
+  // Event counts and achievement states by id, null until first fetched. The
+  // fetch callbacks build new ones and swap them in, so they can be read
+  // without locking. The ones swapped out may still be being read until the
+  // next Update(), which frees them. The retired lists are guarded by
+  // events_mutex_ and achievements_mutex_.
+  std::atomic<const EventCounts *> event_counts_;
+  std::atomic<const AchievementStates *> achievement_states_;
+  std::vector<const EventCounts *> retired_event_counts_;
+  std::vector<const AchievementStates *> retired_achievement_states_;
 };
 
 }  // fpl
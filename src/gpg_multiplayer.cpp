@@ -14,45 +14,166 @@
 
 #include "precompiled.h"
 #include "gpg_multiplayer.h"
+#include <time.h>
 #include <algorithm>
 
+#ifdef __ANDROID__
+#include "nearby_connections_transport.h"
+#endif
+
 namespace fpl {
 
+// Weight of each new round trip sample in the smoothed round trip time, as
+// 1/kRttSmoothing.
+static const int kRttSmoothing = 8;
+
+// How often the service thread acts on its state when nothing wakes it, to
+// check for dialog responses and instances found by the callbacks.
+static const long kServicePollMilliseconds = 20;
+
+static void WriteUint32(uint32_t value, uint8_t* bytes) {
+  for (size_t i = 0; i < sizeof(value); ++i) {
+    bytes[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+static uint32_t ReadUint32(const uint8_t* bytes) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < sizeof(value); ++i) {
+    value |= static_cast<uint32_t>(bytes[i]) << (8 * i);
+  }
+  return value;
+}
+
+static int RttBucket(uint32_t rtt) {
+  int bucket = 0;
+  while (bucket < GPGMultiplayer::kRttBuckets - 1 && (rtt >> bucket) != 0) {
+    ++bucket;
+  }
+  return bucket;
+}
+
+GPGMultiplayer::ConnectionStats::ConnectionStats()
+    : messages_sent(0),
+      payloads_sent(0),
+      bytes_sent(0),
+      messages_received(0),
+      payloads_received(0),
+      bytes_received(0),
+      max_outgoing_bytes(0),
+      pings_sent(0),
+      pongs_received(0),
+      rtt(-1),
+      reconnects(0),
+      last_reconnect_milliseconds(-1),
+      disconnect_time(0) {
+  for (int i = 0; i < kRttBuckets; ++i) rtt_histogram[i] = 0;
+}
+
 GPGMultiplayer::GPGMultiplayer()
-    : message_mutex_(PTHREAD_MUTEX_INITIALIZER),
+    : last_log_time_(0),
+      last_ping_time_(0),
+      max_incoming_queue_depth_(0),
+      incoming_messages_(kIncomingMessageSlots),
+      incoming_head_(0),
+      incoming_tail_(0),
       instance_mutex_(PTHREAD_MUTEX_INITIALIZER),
-      state_mutex_(PTHREAD_MUTEX_INITIALIZER) {}
+      state_mutex_(PTHREAD_MUTEX_INITIALIZER),
+      stats_mutex_(PTHREAD_MUTEX_INITIALIZER),
+      service_cond_(PTHREAD_COND_INITIALIZER),
+      service_started_(false),
+      service_running_(false) {}
+
+GPGMultiplayer::~GPGMultiplayer() {
+  if (!service_started_) return;
+  pthread_mutex_lock(&state_mutex_);
+  service_running_ = false;
+  pthread_cond_signal(&service_cond_);
+  pthread_mutex_unlock(&state_mutex_);
+  pthread_join(service_thread_, nullptr);
+}
 
 bool GPGMultiplayer::Initialize(const std::string& service_id) {
+#ifdef __ANDROID__
+  NearbyConnectionsTransport* transport = new NearbyConnectionsTransport();
+  if (!transport->Initialize(service_id)) {
+    delete transport;
+    return false;
+  }
+  return Initialize(service_id, transport);
+#else
+  SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+               "GPGMultiplayer: Nearby Connections is only on Android.");
+  return false;
+#endif  // __ANDROID__
+}
+
+bool GPGMultiplayer::Initialize(const std::string& service_id,
+                                MultiplayerTransport* transport) {
   state_ = kIdle;
   is_hosting_ = false;
   allow_reconnecting_ = true;
 
   service_id_ = service_id;
-  gpg::AndroidPlatformConfiguration platform_configuration;
-  platform_configuration.SetActivity((jobject)SDL_AndroidGetActivity());
-
-  gpg::NearbyConnections::Builder nearby_builder;
-  nearby_connections_ = nearby_builder.SetDefaultOnLog(gpg::LogLevel::VERBOSE)
-                            .SetServiceId(service_id_)
-                            .Create(platform_configuration);
-  discovery_listener_.reset(nullptr);
-  message_listener_.reset(nullptr);
-
-  if (nearby_connections_ == nullptr) {
-    SDL_LogError(
-        SDL_LOG_CATEGORY_APPLICATION,
-        "GPGMultiplayer: Unable to build a NearbyConnections instance.");
-    return false;
+  transport_.reset(transport);
+  transport_->set_listener(this);
+
+  if (!service_started_) {
+    service_running_ = true;
+    if (pthread_create(&service_thread_, nullptr, ServiceThreadMain, this) !=
+        0) {
+      SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                   "GPGMultiplayer: Unable to start the service thread.");
+      service_running_ = false;
+      return false;
+    }
+    service_started_ = true;
   }
-
   return true;
 }
 
+void* GPGMultiplayer::ServiceThreadMain(void* data) {
+  static_cast<GPGMultiplayer*>(data)->RunService();
+  return nullptr;
+}
+
+void GPGMultiplayer::RunService() {
+  pthread_mutex_lock(&state_mutex_);
+  while (service_running_) {
+    if (service_tasks_.empty() && next_states_.empty()) {
+      timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += kServicePollMilliseconds * 1000000;
+      if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+      }
+      pthread_cond_timedwait(&service_cond_, &state_mutex_, &deadline);
+      if (!service_running_) break;
+    }
+    while (!service_tasks_.empty()) {
+      std::function<void()> task = service_tasks_.front();
+      service_tasks_.pop();
+      pthread_mutex_unlock(&state_mutex_);
+      task();
+      pthread_mutex_lock(&state_mutex_);
+    }
+    pthread_mutex_unlock(&state_mutex_);
+    UpdateStateMachine();
+    pthread_mutex_lock(&state_mutex_);
+  }
+  pthread_mutex_unlock(&state_mutex_);
+}
+
+void GPGMultiplayer::PostServiceTask(const std::function<void()>& task) {
+  pthread_mutex_lock(&state_mutex_);
+  service_tasks_.push(task);
+  pthread_cond_signal(&service_cond_);
+  pthread_mutex_unlock(&state_mutex_);
+}
+
 void GPGMultiplayer::AddAppIdentifier(const std::string& identifier) {
-  gpg::AppIdentifier id;
-  id.identifier = identifier;
-  app_identifiers_.push_back(id);
+  app_identifiers_.push_back(identifier);
 }
 
 void GPGMultiplayer::StartAdvertising() { QueueNextState(kAdvertising); }
@@ -94,22 +215,27 @@ void GPGMultiplayer::ResetToIdle() {
   discovered_instances_.clear();
   pthread_mutex_unlock(&instance_mutex_);
 
-  pthread_mutex_lock(&message_mutex_);
-  while (!incoming_messages_.empty()) incoming_messages_.pop();
-  pthread_mutex_unlock(&message_mutex_);
+  pthread_mutex_lock(&stats_mutex_);
+  connection_stats_.clear();
+  pthread_mutex_unlock(&stats_mutex_);
+  logged_stats_.clear();
+
+  // Only the game thread moves the head, so it can skip everything queued.
+  incoming_head_.store(incoming_tail_.load(std::memory_order_acquire),
+                       std::memory_order_release);
 }
 
 void GPGMultiplayer::DisconnectInstance(const std::string& instance_id) {
   SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
               "GPGMultiplayer: Disconnect player (instance_id='%s')",
               instance_id.c_str());
-  nearby_connections_->Disconnect(instance_id);
+  PostServiceTask(
+      [this, instance_id]() { transport_->Disconnect(instance_id); });
 
   pthread_mutex_lock(&instance_mutex_);
-  auto i = std::find(connected_instances_.begin(), connected_instances_.end(),
-                     instance_id);
-  if (i != connected_instances_.end()) {
-    connected_instances_.erase(i);
+  auto i = connected_instances_reverse_.find(instance_id);
+  if (i != connected_instances_reverse_.end()) {
+    connected_instances_.erase(connected_instances_.begin() + i->second);
     UpdateConnectedInstances();
   }
   if (IsConnected() && connected_instances_.size() == 0) {
@@ -123,17 +249,25 @@ void GPGMultiplayer::DisconnectInstance(const std::string& instance_id) {
 void GPGMultiplayer::DisconnectAll() {
   SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
               "GPGMultiplayer: Disconnect all players");
-  // In case there are any connection requests outstanding, reject them.
-  RejectAllConnectionRequests();
-
-  // Disconnect anyone we are connected to.
+  // In case there are any connection requests outstanding, reject them, and
+  // disconnect anyone we are connected to. We forget them straight away, but
+  // tell the SDK on the service thread.
   pthread_mutex_lock(&instance_mutex_);
-  for (const auto& instance : connected_instances_) {
-    nearby_connections_->Disconnect(instance);
-  }
-  connected_instances_.clear();
+  std::list<std::string> pending;
+  pending.swap(pending_instances_);
+  std::vector<std::string> connected;
+  connected.swap(connected_instances_);
   UpdateConnectedInstances();
   pthread_mutex_unlock(&instance_mutex_);
+  PostServiceTask([this, pending, connected]() {
+    for (const auto& instance_id : pending) {
+      transport_->RejectConnectionRequest(instance_id);
+    }
+    for (const auto& instance_id : connected) {
+      // Skip the slots of disconnected instances.
+      if (!instance_id.empty()) transport_->Disconnect(instance_id);
+    }
+  });
 
   if (state() == kConnected || state() == kConnectedWithDisconnections) {
     QueueNextState(kIdle);
@@ -142,60 +276,18 @@ void GPGMultiplayer::DisconnectAll() {
 
 void GPGMultiplayer::SendConnectionRequest(
     const std::string& host_instance_id) {
-  if (message_listener_ == nullptr) {
-    message_listener_.reset(new MessageListener(
-        [this](const std::string& instance_id,
-               std::vector<uint8_t> const& payload, bool is_reliable) {
-          SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
-                       "GPGMultiplayer: OnMessageReceived(%s) callback",
-                       instance_id.c_str());
-          this->MessageReceivedCallback(instance_id, payload, is_reliable);
-        },
-        [this](const std::string& instance_id) {
-          SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
-                       "GPGMultiplayer: OnDisconnect(%s) callback",
-                       instance_id.c_str());
-          this->DisconnectedCallback(instance_id);
-        }));
-  }
   SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
               "GPGMultiplayer: Sending connection request to %s",
               host_instance_id.c_str());
-
-  // Immediately stop discovery once we start connecting.
-  nearby_connections_->SendConnectionRequest(
-      my_instance_name_, host_instance_id, std::vector<uint8_t>{},
-      [this](int64_t client_id, gpg::ConnectionResponse const& response) {
-        SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
-                     "GPGMultiplayer: OnConnectionResponse() callback");
-        this->ConnectionResponseCallback(response);
-      },
-      message_listener_.get());
+  transport_->SendConnectionRequest(my_instance_name_, host_instance_id);
 }
 
 void GPGMultiplayer::AcceptConnectionRequest(
     const std::string& client_instance_id) {
-  if (message_listener_ == nullptr) {
-    message_listener_.reset(new MessageListener(
-        [this](const std::string& instance_id,
-               std::vector<uint8_t> const& payload, bool is_reliable) {
-          SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
-                       "GPGMultiplayer: OnMessageReceived(%s) callback",
-                       instance_id.c_str());
-          this->MessageReceivedCallback(instance_id, payload, is_reliable);
-        },
-        [this](const std::string& instance_id) {
-          SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
-                       "GPGMultiplayer: OnDisconnect(%s) callback",
-                       instance_id.c_str());
-          this->DisconnectedCallback(instance_id);
-        }));
-  }
   SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
               "GPGMultiplayer: Accepting connection from %s",
               client_instance_id.c_str());
-  nearby_connections_->AcceptConnectionRequest(
-      client_instance_id, std::vector<uint8_t>{}, message_listener_.get());
+  transport_->AcceptConnectionRequest(client_instance_id);
 
   pthread_mutex_lock(&instance_mutex_);
   AddNewConnectedInstance(client_instance_id);
@@ -213,7 +305,7 @@ void GPGMultiplayer::RejectConnectionRequest(
   SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
               "GPGMultiplayer: Rejecting connection from %s",
               client_instance_id.c_str());
-  nearby_connections_->RejectConnectionRequest(client_instance_id);
+  transport_->RejectConnectionRequest(client_instance_id);
 
   pthread_mutex_lock(&instance_mutex_);
   auto i = std::find(pending_instances_.begin(), pending_instances_.end(),
@@ -224,20 +316,17 @@ void GPGMultiplayer::RejectConnectionRequest(
   pthread_mutex_unlock(&instance_mutex_);
 }
 
-void GPGMultiplayer::RejectAllConnectionRequests() {
-  pthread_mutex_lock(&instance_mutex_);
-  for (const auto& instance_id : pending_instances_) {
-    nearby_connections_->RejectConnectionRequest(instance_id);
-  }
-  pending_instances_.clear();
-  pthread_mutex_unlock(&instance_mutex_);
-}
-
 // Call me once a frame!
 void GPGMultiplayer::Update() {
+  SendPings();
+  FlushMessages();
+}
+
+// The service thread calls this whenever it wakes.
+void GPGMultiplayer::UpdateStateMachine() {
   pthread_mutex_lock(&state_mutex_);  // unlocked in two places below
   if (!next_states_.empty()) {
-    // Transition at most one state per frame.
+    // Transition at most one state per update.
     MultiplayerState next_state = next_states_.front();
     next_states_.pop();
     pthread_mutex_unlock(&state_mutex_);
@@ -379,7 +468,7 @@ void GPGMultiplayer::TransitionState(MultiplayerState old_state,
       if (new_state != kDiscoveringPromptedUser &&
           new_state != kDiscoveringWaitingForHost &&
           new_state != kDiscovering) {
-        nearby_connections_->StopDiscovery(service_id_);
+        transport_->StopDiscovery(service_id_);
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                     "GPGMultiplayer: Stopped discovery.");
       }
@@ -391,7 +480,7 @@ void GPGMultiplayer::TransitionState(MultiplayerState old_state,
       // Make sure we are totally leaving the "advertising" world.
       if (new_state != kAdvertising && new_state != kAdvertisingPromptedUser &&
           new_state != kConnectedWithDisconnections) {
-        nearby_connections_->StopAdvertising();
+        transport_->StopAdvertising();
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                     "GPGMultiplayer: Stopped advertising");
       }
@@ -422,18 +511,7 @@ void GPGMultiplayer::TransitionState(MultiplayerState old_state,
 
       if (old_state != kAdvertising && old_state != kAdvertisingPromptedUser &&
           old_state != kConnectedWithDisconnections) {
-        nearby_connections_->StartAdvertising(
-            my_instance_name_, app_identifiers_, gpg::Duration::zero(),
-            [this](int64_t client_id,
-                   gpg::StartAdvertisingResult const& result) {
-              SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
-                           "GPGMultiplayer: StartAdvertising callback");
-              this->StartAdvertisingCallback(result);
-            },
-            [this](int64_t client_id,
-                   gpg::ConnectionRequest const& connection_request) {
-              this->ConnectionRequestCallback(connection_request);
-            });
+        transport_->StartAdvertising(my_instance_name_, app_identifiers_);
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                     "GPGMultiplayer: Starting advertising");
       }
@@ -445,17 +523,7 @@ void GPGMultiplayer::TransitionState(MultiplayerState old_state,
 
       if (old_state != kDiscoveringWaitingForHost &&
           old_state != kDiscoveringPromptedUser) {
-        if (discovery_listener_ == nullptr) {
-          discovery_listener_.reset(new DiscoveryListener(
-              [this](gpg::EndpointDetails const& endpoint_details) {
-                this->DiscoveryEndpointFoundCallback(endpoint_details);
-              },
-              [this](const std::string& instance_id) {
-                this->DiscoveryEndpointLostCallback(instance_id);
-              }));
-        }
-        nearby_connections_->StartDiscovery(service_id_, gpg::Duration::zero(),
-                                            discovery_listener_.get());
+        transport_->StartDiscovery(service_id_);
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                     "GPGMultiplayer: Starting discovery");
       }
@@ -506,6 +574,7 @@ void GPGMultiplayer::TransitionState(MultiplayerState old_state,
 void GPGMultiplayer::QueueNextState(MultiplayerState next_state) {
   pthread_mutex_lock(&state_mutex_);
   next_states_.push(next_state);
+  pthread_cond_signal(&service_cond_);
   pthread_mutex_unlock(&state_mutex_);
 }
 
@@ -518,40 +587,238 @@ bool GPGMultiplayer::SendMessage(const std::string& instance_id,
   } else {
   }
 
-  if (reliable) {
-    nearby_connections_->SendReliableMessage(instance_id, payload);
-  } else {
-    nearby_connections_->SendUnreliableMessage(instance_id, payload);
-  }
+  QueueMessage(instance_id, payload, reliable);
   return true;
 }
 
 void GPGMultiplayer::BroadcastMessage(const std::vector<uint8_t>& payload,
                                       bool reliable) {
+  // Copying into broadcast_instances_ reuses the storage of the last
+  // broadcast, which usually went to the same instances.
   pthread_mutex_lock(&instance_mutex_);
-  std::vector<std::string> all_instances{connected_instances_.begin(),
-                                         connected_instances_.end()};
+  broadcast_instances_.assign(connected_instances_.begin(),
+                              connected_instances_.end());
   pthread_mutex_unlock(&instance_mutex_);
+  for (size_t i = 0; i < broadcast_instances_.size(); ++i) {
+    QueueMessage(broadcast_instances_[i], payload, reliable);
+  }
+}
+
+void GPGMultiplayer::QueueMessage(const std::string& instance_id,
+                                  const std::vector<uint8_t>& payload,
+                                  bool reliable) {
+  if (payload.empty()) return;
+  QueueFrame(instance_id, &payload[0], payload.size(), 0, reliable);
+  outgoing_messages_[instance_id].messages++;
+}
+
+void GPGMultiplayer::QueueFrame(const std::string& instance_id,
+                                const uint8_t* data, size_t size,
+                                uint16_t flags, bool reliable) {
+  const size_t max_length =
+      reliable ? transport_->MaxReliableMessageLen()
+               : transport_->MaxUnreliableMessageLen();
+  const size_t framed_length = size + sizeof(uint16_t);
+  if (framed_length > max_length || size >= kControlFrame) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                 "GPGMultiplayer: %d byte message is too long to send.",
+                 static_cast<int>(size));
+    return;
+  }
+
+  OutgoingMessages& outgoing = outgoing_messages_[instance_id];
+  std::vector<uint8_t>* batch =
+      reliable ? &outgoing.reliable : &outgoing.unreliable;
+  // Start another batch if this one is full.
+  if (batch->size() + framed_length > max_length) {
+    SendBatch(instance_id, &outgoing, reliable);
+  }
+  const uint16_t length = static_cast<uint16_t>(size) | flags;
+  batch->push_back(static_cast<uint8_t>(length & 0xFF));
+  batch->push_back(static_cast<uint8_t>(length >> 8));
+  batch->insert(batch->end(), data, data + size);
+}
+
+void GPGMultiplayer::SendBatch(const std::string& instance_id,
+                               OutgoingMessages* outgoing, bool reliable) {
+  std::vector<uint8_t>& batch =
+      reliable ? outgoing->reliable : outgoing->unreliable;
+  if (batch.empty()) return;
   if (reliable) {
-    nearby_connections_->SendReliableMessage(all_instances, payload);
+    transport_->SendReliableMessage(instance_id, batch);
   } else {
-    nearby_connections_->SendUnreliableMessage(all_instances, payload);
+    transport_->SendUnreliableMessage(instance_id, batch);
+  }
+  outgoing->payloads++;
+  outgoing->bytes += batch.size();
+  batch.clear();
+}
+
+void GPGMultiplayer::FlushMessages() {
+  for (auto it = outgoing_messages_.begin(); it != outgoing_messages_.end();
+       ++it) {
+    OutgoingMessages& outgoing = it->second;
+    // Don't send to instances that have disconnected since.
+    if (GetPlayerNumberByInstanceId(it->first) == -1) {
+      outgoing.reliable.clear();
+      outgoing.unreliable.clear();
+      outgoing.messages = outgoing.payloads = 0;
+      outgoing.bytes = 0;
+      continue;
+    }
+    if (outgoing.reliable.empty() && outgoing.unreliable.empty() &&
+        outgoing.payloads == 0) {
+      continue;
+    }
+    const size_t queued_bytes =
+        outgoing.bytes + outgoing.reliable.size() + outgoing.unreliable.size();
+    SendBatch(it->first, &outgoing, true);
+    SendBatch(it->first, &outgoing, false);
+
+    pthread_mutex_lock(&stats_mutex_);
+    ConnectionStats& stats = connection_stats_[it->first];
+    stats.messages_sent += outgoing.messages;
+    stats.payloads_sent += outgoing.payloads;
+    stats.bytes_sent += outgoing.bytes;
+    stats.max_outgoing_bytes = std::max(stats.max_outgoing_bytes, queued_bytes);
+    pthread_mutex_unlock(&stats_mutex_);
+    outgoing.messages = outgoing.payloads = 0;
+    outgoing.bytes = 0;
+  }
+}
+
+void GPGMultiplayer::SendPings() {
+  if (!IsConnected()) return;
+  const uint32_t now = SDL_GetTicks();
+  if (now - last_ping_time_ < kPingIntervalMilliseconds) return;
+  last_ping_time_ = now;
+
+  uint8_t ping[kPingFrameSize];
+  ping[0] = kControlPing;
+  WriteUint32(now, &ping[1]);
+  pthread_mutex_lock(&instance_mutex_);
+  broadcast_instances_.assign(connected_instances_.begin(),
+                              connected_instances_.end());
+  pthread_mutex_unlock(&instance_mutex_);
+  for (size_t i = 0; i < broadcast_instances_.size(); ++i) {
+    const std::string& instance_id = broadcast_instances_[i];
+    // Skip the slots of disconnected instances.
+    if (instance_id.empty()) continue;
+    QueueFrame(instance_id, ping, sizeof(ping), kControlFrame, false);
+    pthread_mutex_lock(&stats_mutex_);
+    connection_stats_[instance_id].pings_sent++;
+    pthread_mutex_unlock(&stats_mutex_);
+  }
+}
+
+void GPGMultiplayer::ReceiveControlFrame(const std::string& instance_id,
+                                         const uint8_t* frame, size_t size) {
+  if (size != kPingFrameSize) {
+    SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                "GPGMultiplayer: Received a control frame of %d bytes.",
+                static_cast<int>(size));
+    return;
+  }
+  if (frame[0] == kControlPing) {
+    // Answered straight away, rather than on the next Update(), so the
+    // round trip doesn't include the game thread's frame time. Only the game
+    // thread may use outgoing_messages_, so the pong goes on its own.
+    std::vector<uint8_t> pong(sizeof(uint16_t) + kPingFrameSize);
+    const uint16_t length = kPingFrameSize | kControlFrame;
+    pong[0] = static_cast<uint8_t>(length & 0xFF);
+    pong[1] = static_cast<uint8_t>(length >> 8);
+    pong[2] = kControlPong;
+    memcpy(&pong[3], &frame[1], sizeof(uint32_t));
+    transport_->SendUnreliableMessage(instance_id, pong);
+  } else if (frame[0] == kControlPong) {
+    const uint32_t rtt = SDL_GetTicks() - ReadUint32(&frame[1]);
+    pthread_mutex_lock(&stats_mutex_);
+    ConnectionStats& stats = connection_stats_[instance_id];
+    stats.pongs_received++;
+    stats.rtt_histogram[RttBucket(rtt)]++;
+    const int sample = static_cast<int>(rtt);
+    stats.rtt = stats.rtt < 0
+                    ? sample
+                    : stats.rtt + (sample - stats.rtt) / kRttSmoothing;
+    pthread_mutex_unlock(&stats_mutex_);
   }
 }
 
+bool GPGMultiplayer::GetConnectionStats(const std::string& instance_id,
+                                        ConnectionStats* stats) {
+  pthread_mutex_lock(&stats_mutex_);
+  auto i = connection_stats_.find(instance_id);
+  const bool found = i != connection_stats_.end();
+  if (found) *stats = i->second;
+  pthread_mutex_unlock(&stats_mutex_);
+  return found;
+}
+
+void GPGMultiplayer::GetTotalBytes(uint64_t* bytes_sent,
+                                   uint64_t* bytes_received) {
+  *bytes_sent = 0;
+  *bytes_received = 0;
+  pthread_mutex_lock(&stats_mutex_);
+  for (auto it = connection_stats_.begin(); it != connection_stats_.end();
+       ++it) {
+    *bytes_sent += it->second.bytes_sent;
+    *bytes_received += it->second.bytes_received;
+  }
+  pthread_mutex_unlock(&stats_mutex_);
+}
+
+void GPGMultiplayer::LogConnectionStats() {
+  const uint32_t now = SDL_GetTicks();
+  const float seconds =
+      std::max(now - last_log_time_, 1u) / static_cast<float>(1000);
+  last_log_time_ = now;
+
+  pthread_mutex_lock(&stats_mutex_);
+  for (auto it = connection_stats_.begin(); it != connection_stats_.end();
+       ++it) {
+    const ConnectionStats& stats = it->second;
+    ConnectionStats& logged = logged_stats_[it->first];
+    SDL_LogInfo(
+        SDL_LOG_CATEGORY_APPLICATION,
+        "GPGMultiplayer: %s: sent %.1f msgs/s %.1f payloads/s %.0f B/s "
+        "(max %d B/frame), received %.1f msgs/s %.1f payloads/s %.0f B/s, "
+        "rtt %d ms, %d/%d pongs, %d reconnects (last took %d ms)",
+        it->first.c_str(),
+        (stats.messages_sent - logged.messages_sent) / seconds,
+        (stats.payloads_sent - logged.payloads_sent) / seconds,
+        (stats.bytes_sent - logged.bytes_sent) / seconds,
+        static_cast<int>(stats.max_outgoing_bytes),
+        (stats.messages_received - logged.messages_received) / seconds,
+        (stats.payloads_received - logged.payloads_received) / seconds,
+        (stats.bytes_received - logged.bytes_received) / seconds, stats.rtt,
+        stats.pongs_received, stats.pings_sent, stats.reconnects,
+        stats.last_reconnect_milliseconds);
+    for (int i = 0; i < kRttBuckets; ++i) {
+      if (stats.rtt_histogram[i] == 0) continue;
+      SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                  "GPGMultiplayer:   rtt %s%d ms: %d",
+                  i == kRttBuckets - 1 ? ">= " : "< ",
+                  i == kRttBuckets - 1 ? 1 << (i - 1) : 1 << i,
+                  stats.rtt_histogram[i]);
+    }
+    logged = stats;
+  }
+  pthread_mutex_unlock(&stats_mutex_);
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+              "GPGMultiplayer: at most %d incoming messages queued",
+              static_cast<int>(max_incoming_queue_depth()));
+}
+
 bool GPGMultiplayer::HasMessage() {
-  pthread_mutex_lock(&message_mutex_);
-  bool empty = incoming_messages_.empty();
-  pthread_mutex_unlock(&message_mutex_);
-  return !empty;
+  return incoming_head_.load(std::memory_order_relaxed) !=
+         incoming_tail_.load(std::memory_order_acquire);
 }
 
 GPGMultiplayer::SenderAndMessage GPGMultiplayer::GetNextMessage() {
   if (HasMessage()) {
-    pthread_mutex_lock(&message_mutex_);
-    auto message = incoming_messages_.front();
-    incoming_messages_.pop();
-    pthread_mutex_unlock(&message_mutex_);
+    const size_t head = incoming_head_.load(std::memory_order_relaxed);
+    auto message = incoming_messages_[head & (kIncomingMessageSlots - 1)];
+    incoming_head_.store(head + 1, std::memory_order_release);
     return message;
   } else {
     SenderAndMessage blank{"", {}};
@@ -559,6 +826,21 @@ GPGMultiplayer::SenderAndMessage GPGMultiplayer::GetNextMessage() {
   }
 }
 
+void GPGMultiplayer::ReceiveMessages(std::vector<SenderAndMessage>* messages) {
+  const size_t head = incoming_head_.load(std::memory_order_relaxed);
+  const size_t tail = incoming_tail_.load(std::memory_order_acquire);
+  messages->resize(tail - head);
+  for (size_t i = head; i != tail; ++i) {
+    SenderAndMessage& slot =
+        incoming_messages_[i & (kIncomingMessageSlots - 1)];
+    SenderAndMessage& message = (*messages)[i - head];
+    message.first.swap(slot.first);
+    message.second.swap(slot.second);
+  }
+  // Hand the slots, with the storage swapped into them, back to the callback.
+  incoming_head_.store(tail, std::memory_order_release);
+}
+
 bool GPGMultiplayer::HasReconnectedPlayer() {
   pthread_mutex_lock(&instance_mutex_);
   bool has_reconnected_player = !reconnected_players_.empty();
@@ -582,17 +864,16 @@ int GPGMultiplayer::GetReconnectedPlayer() {
 // Callbacks are below.
 
 // Callback on the host when it starts advertising.
-void GPGMultiplayer::StartAdvertisingCallback(
-    gpg::StartAdvertisingResult const& result) {
+void GPGMultiplayer::OnAdvertisingResult(bool success,
+                                         const std::string& local_name) {
   // We've started hosting
-  if (result.status == gpg::StartAdvertisingResult::StatusCode::SUCCESS) {
+  if (success) {
     SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
                  "GPGMultiplayer: Started advertising (name='%s')",
-                 result.local_endpoint_name.c_str());
+                 local_name.c_str());
   } else {
     SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                 "GPGMultiplayer: FAILED to start advertising, error code %d",
-                 result.status);
+                 "GPGMultiplayer: FAILED to start advertising");
     if (state() == kConnectedWithDisconnections) {
       // We couldn't allow reconnections, sorry!
       ClearDisconnectedInstances();
@@ -604,33 +885,30 @@ void GPGMultiplayer::StartAdvertisingCallback(
 }
 
 // Callback on the host when a client tries to connect.
-void GPGMultiplayer::ConnectionRequestCallback(
-    gpg::ConnectionRequest const& connection_request) {
+void GPGMultiplayer::OnConnectionRequest(const std::string& instance_id,
+                                         const std::string& name) {
   SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
                "GPGMultiplayer: Incoming connection (instance_id=%s,name=%s)",
-               connection_request.remote_endpoint_id.c_str(),
-               connection_request.remote_endpoint_name.c_str());
+               instance_id.c_str(), name.c_str());
   // process the incoming connection
   pthread_mutex_lock(&instance_mutex_);
-  pending_instances_.push_back(connection_request.remote_endpoint_id);
-  instance_names_[connection_request.remote_endpoint_id] =
-      connection_request.remote_endpoint_name;
+  pending_instances_.push_back(instance_id);
+  instance_names_[instance_id] = name;
   pthread_mutex_unlock(&instance_mutex_);
 }
 
 // Callback on the client when it discovers a host.
-void GPGMultiplayer::DiscoveryEndpointFoundCallback(
-    gpg::EndpointDetails const& endpoint_details) {
+void GPGMultiplayer::OnEndpointFound(const std::string& instance_id,
+                                     const std::string& name) {
   SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "GPGMultiplayer: Found endpoint");
   pthread_mutex_lock(&instance_mutex_);
-  instance_names_[endpoint_details.endpoint_id] = endpoint_details.name;
-  discovered_instances_.push_back(endpoint_details.endpoint_id);
+  instance_names_[instance_id] = name;
+  discovered_instances_.push_back(instance_id);
   pthread_mutex_unlock(&instance_mutex_);
 }
 
 // Callback on the client when a host it previous discovered disappears.
-void GPGMultiplayer::DiscoveryEndpointLostCallback(
-    const std::string& instance_id) {
+void GPGMultiplayer::OnEndpointLost(const std::string& instance_id) {
   SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "GPGMultiplayer: Lost endpoint");
   pthread_mutex_lock(&instance_mutex_);
   auto i = std::find(discovered_instances_.begin(), discovered_instances_.end(),
@@ -642,36 +920,80 @@ void GPGMultiplayer::DiscoveryEndpointLostCallback(
 }
 
 // Callback on the client when it is either accepted or rejected by the host.
-void GPGMultiplayer::ConnectionResponseCallback(
-    gpg::ConnectionResponse const& response) {
-  if (response.status == gpg::ConnectionResponse::StatusCode::ACCEPTED) {
+void GPGMultiplayer::OnConnectionResponse(const std::string& instance_id,
+                                          bool accepted) {
+  if (accepted) {
     SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "GPGMultiplayer: Connected!");
 
     pthread_mutex_lock(&instance_mutex_);
-    connected_instances_.push_back(response.remote_endpoint_id);
+    connected_instances_.push_back(instance_id);
     UpdateConnectedInstances();
     pthread_mutex_unlock(&instance_mutex_);
 
     QueueNextState(kConnected);
   } else {
     SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
-                 "GPGMultiplayer: Didn't connect, response status = %d",
-                 response.status);
+                 "GPGMultiplayer: Didn't connect to %s", instance_id.c_str());
     QueueNextState(kDiscovering);
   }
 }
 
 // Callback on host or client when an incoming message is received.
-void GPGMultiplayer::MessageReceivedCallback(
-    const std::string& instance_id, std::vector<uint8_t> const& payload,
-    bool is_reliable) {
-  pthread_mutex_lock(&message_mutex_);
-  incoming_messages_.push({instance_id, payload});
-  pthread_mutex_unlock(&message_mutex_);
+void GPGMultiplayer::OnMessageReceived(const std::string& instance_id,
+                                       const std::vector<uint8_t>& payload,
+                                       bool /*is_reliable*/) {
+  // A payload holds one or more messages, each framed by its length.
+  size_t tail = incoming_tail_.load(std::memory_order_relaxed);
+  size_t offset = 0;
+  uint32_t messages = 0;
+  while (offset + sizeof(uint16_t) <= payload.size()) {
+    const uint16_t header = payload[offset] | (payload[offset + 1] << 8);
+    const size_t length = header & ~kControlFrame;
+    offset += sizeof(uint16_t);
+    if (offset + length > payload.size()) break;
+    if (header & kControlFrame) {
+      ReceiveControlFrame(instance_id, &payload[offset], length);
+    } else if (tail - incoming_head_.load(std::memory_order_acquire) ==
+        kIncomingMessageSlots) {
+      // The game thread has stopped reading, e.g. while it's paused.
+      SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                   "GPGMultiplayer: Incoming message queue is full, dropping "
+                   "a message.");
+    } else {
+      // Assigning reuses whatever storage the slot was last given.
+      SenderAndMessage& slot =
+          incoming_messages_[tail & (kIncomingMessageSlots - 1)];
+      slot.first = instance_id;
+      slot.second.assign(payload.begin() + offset,
+                         payload.begin() + offset + length);
+      // Publish each message as soon as it's written.
+      incoming_tail_.store(++tail, std::memory_order_release);
+      messages++;
+    }
+    offset += length;
+  }
+  // Only this thread raises the maximum, so it needn't compare and swap.
+  const size_t depth = tail - incoming_head_.load(std::memory_order_relaxed);
+  if (depth > max_incoming_queue_depth_.load(std::memory_order_relaxed)) {
+    max_incoming_queue_depth_.store(depth, std::memory_order_relaxed);
+  }
+  pthread_mutex_lock(&stats_mutex_);
+  ConnectionStats& stats = connection_stats_[instance_id];
+  stats.messages_received += messages;
+  stats.payloads_received++;
+  stats.bytes_received += payload.size();
+  pthread_mutex_unlock(&stats_mutex_);
+  if (offset != payload.size()) {
+    SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                "GPGMultiplayer: Received a badly framed message.");
+  }
 }
 
 // Callback on host or client when a connected instance disconnects.
-void GPGMultiplayer::DisconnectedCallback(const std::string& instance_id) {
+void GPGMultiplayer::OnDisconnected(const std::string& instance_id) {
+  SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
+               "GPGMultiplayer: OnDisconnect(%s) callback",
+               instance_id.c_str());
   if (allow_reconnecting() && is_hosting() && IsConnected() &&
       GetNumConnectedPlayers() > 1) {
     // We are connected, and we have other instances connected besides this one.
@@ -690,16 +1012,18 @@ void GPGMultiplayer::DisconnectedCallback(const std::string& instance_id) {
       UpdateConnectedInstances();
     }
     pthread_mutex_unlock(&instance_mutex_);
+    pthread_mutex_lock(&stats_mutex_);
+    connection_stats_[instance_id].disconnect_time = SDL_GetTicks();
+    pthread_mutex_unlock(&stats_mutex_);
     // When the state is kConnectedWithDisconnections, we start advertising
     // again and allow only the disconnected instances to reconnect.
     QueueNextState(kConnectedWithDisconnections);
   } else {
     // Simply remove the connected index.
     pthread_mutex_lock(&instance_mutex_);
-    auto i = std::find(connected_instances_.begin(), connected_instances_.end(),
-                       instance_id);
-    if (i != connected_instances_.end()) {
-      connected_instances_.erase(i);
+    auto i = connected_instances_reverse_.find(instance_id);
+    if (i != connected_instances_reverse_.end()) {
+      connected_instances_.erase(connected_instances_.begin() + i->second);
       UpdateConnectedInstances();
     }
     pthread_mutex_unlock(&instance_mutex_);
@@ -713,6 +1037,8 @@ void GPGMultiplayer::DisconnectedCallback(const std::string& instance_id) {
 void GPGMultiplayer::UpdateConnectedInstances() {
   connected_instances_reverse_.clear();
   for (unsigned int i = 0; i < connected_instances_.size(); i++) {
+    // Leave out the placeholders for disconnected instances.
+    if (connected_instances_[i].empty()) continue;
     connected_instances_reverse_[connected_instances_[i]] = i;
   }
 }
@@ -755,6 +1081,15 @@ int GPGMultiplayer::AddNewConnectedInstance(const std::string& instance_id) {
     SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
                  "GPGMultiplayer: Connected a reconnected player");
     reconnected_players_.push(new_index);
+    pthread_mutex_lock(&stats_mutex_);
+    ConnectionStats& stats = connection_stats_[instance_id];
+    if (stats.disconnect_time != 0) {
+      stats.reconnects++;
+      stats.last_reconnect_milliseconds =
+          static_cast<int>(SDL_GetTicks() - stats.disconnect_time);
+      stats.disconnect_time = 0;
+    }
+    pthread_mutex_unlock(&stats_mutex_);
   }
   SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
                "GPGMultiplayer: Instance %s goes in slot %d",
@@ -768,13 +1103,9 @@ void GPGMultiplayer::ClearDisconnectedInstances() {
 }
 
 int GPGMultiplayer::GetNumConnectedPlayers() {
-  int num_players = 0;
   pthread_mutex_lock(&instance_mutex_);
-  for (auto instance_id : connected_instances_) {
-    if (instance_id != "") {
-      num_players++;
-    }
-  }
+  // The reverse map has only the instances that are still connected.
+  int num_players = static_cast<int>(connected_instances_reverse_.size());
   pthread_mutex_unlock(&instance_mutex_);
   return num_players;
 }
@@ -805,10 +1136,10 @@ bool GPGMultiplayer::DisplayConnectionDialog(const char* title,
                                              const char* question_text,
                                              const char* yes_text,
                                              const char* no_text) {
-#ifdef __ANDROID__
   if (auto_connect_) {
     return true;
   }
+#ifdef __ANDROID__
   bool question_shown = false;
 
   JNIEnv* env = reinterpret_cast<JNIEnv*>(SDL_AndroidGetJNIEnv());
@@ -854,11 +1185,11 @@ bool GPGMultiplayer::DisplayConnectionDialog(const char* title,
 // for Yes), or kDialogWaiting if there is no result yet. Calling this consumes
 // the result.
 GPGMultiplayer::DialogResponse GPGMultiplayer::GetConnectionDialogResponse() {
-#ifdef __ANDROID__
   // If we are set to automatically connect, pretend this is true.
   if (auto_connect_) {
     return kDialogYes;
   }
+#ifdef __ANDROID__
   JNIEnv* env = reinterpret_cast<JNIEnv*>(SDL_AndroidGetJNIEnv());
   jobject activity = reinterpret_cast<jobject>(SDL_AndroidGetActivity());
   jclass fpl_class = env->GetObjectClass(activity);
@@ -42,29 +42,80 @@
 // prompting the player when they find a host to connect to. Once you have
 // connected to a host and they have accepted you, you will be fully connected.
 //
+// The state machine behind all of this runs on a service thread of its own,
+// as do the calls to connect and disconnect instances, so none of them can
+// stall a frame. Calls that change the state only queue the change for the
+// service thread, and state() catches up a moment later.
+//
 // To send a message to a specific user (as the host), call SendMessage(). To
 // send a message to all other users (as either host or client), call
-// BroadcastMessage. Only the host can see all the players.
+// BroadcastMessage. Only the host can see all the players. Messages are
+// queued, and the ones for each recipient are sent together by the next
+// Update().
+//
+// To receive, call ReceiveMessages() to take every message that has arrived
+// since the last call. HasMessage() and GetNextMessage() take them one at a
+// time instead.
+//
+// While connected, every instance pings the others once a second, and keeps
+// ConnectionStats on each connection. Call LogConnectionStats() to see them.
 //
-// To receive, call HasMessage() to check if there are any messages available,
-// then GetNextMessage() to get the next incoming message from the queue.
+// On Android, the connections are made with the Nearby Connections API.
+// Anywhere, they can be made over any other MultiplayerTransport instead,
+// such as a LoopbackTransport, to run a host and its clients in one process.
 
 #ifndef GPG_MULTIPLAYER_H
 #define GPG_MULTIPLAYER_H
 
+#include <pthread.h>
+#include <atomic>
+#include <functional>
 #include <list>
 #include <map>
+#include <memory>
 #include <queue>
 #include <string>
+#include <unordered_map>
 #include <vector>
+#include "multiplayer_transport.h"
 
 namespace fpl {
 
-class GPGMultiplayer {
+class GPGMultiplayer : private MultiplayerTransport::Listener {
  public:
   // In the pair, first = the sender's instance_id, second = the message.
   typedef std::pair<std::string, std::vector<uint8_t>> SenderAndMessage;
 
+  // Round trip times are bucketed by powers of two milliseconds, the last
+  // bucket holding everything from about a second up.
+  static const int kRttBuckets = 12;
+
+  // How the connection to one instance has behaved, since we first connected
+  // to it. Bytes count the framing of each message.
+  struct ConnectionStats {
+    ConnectionStats();
+    uint64_t messages_sent;
+    uint64_t payloads_sent;  // Each one holds one or more messages.
+    uint64_t bytes_sent;
+    uint64_t messages_received;
+    uint64_t payloads_received;
+    uint64_t bytes_received;
+    // Most bytes queued for the instance between two Update()s.
+    size_t max_outgoing_bytes;
+    uint32_t pings_sent;
+    uint32_t pongs_received;
+    // Smoothed round trip time in milliseconds, or -1 before the first pong.
+    int rtt;
+    // Number of pongs with a round trip of [2^(i-1), 2^i) milliseconds.
+    uint32_t rtt_histogram[kRttBuckets];
+    uint32_t reconnects;
+    // How long the last reconnection took after the disconnection, in
+    // milliseconds, or -1 if it never has reconnected.
+    int last_reconnect_milliseconds;
+    // When the instance disconnected, while it's allowed to reconnect.
+    uint32_t disconnect_time;
+  };
+
   enum MultiplayerState {
     // Starting state, you aren't connected, broadcasting, or scanning.
     kIdle = 0,
@@ -98,17 +149,24 @@ class GPGMultiplayer {
 
   // Initializes mutexes only.
   GPGMultiplayer();
+  // Stops the service thread.
+  ~GPGMultiplayer();
 
   // Initialize the connection manager, set up callbacks, etc.
   // Call this before doing anything else but after initializing
-  // GameServices. service_id should be unique for your game.
+  // GameServices. service_id should be unique for your game. Connects with
+  // the Nearby Connections API, so only works on Android.
   bool Initialize(const std::string& service_id);
+  // Initialize to connect over 'transport', which we take ownership of.
+  bool Initialize(const std::string& service_id,
+                  MultiplayerTransport* transport);
 
   // Add an app identifier that is used for linking to your device's app store,
   // if a user scanning for games doesn't have this one installed.
   void AddAppIdentifier(const std::string& identifier);
 
-  // Update, call this once per frame if you can.
+  // Update, call this once per frame if you can. Sends the messages queued
+  // since the last Update(). Never waits on the service thread.
   void Update();
 
   // Broadcast that you are hosting a game. To change the name from the default,
@@ -177,7 +235,7 @@ class GPGMultiplayer {
   // performance.
   int GetPlayerNumberByInstanceId(const std::string& instance_id);
 
-  // Send a message to a specific instance. Returns false if you are not
+  // Queue a message to a specific instance. Returns false if you are not
   // connected to that instance (in which case nothing is sent).
   bool SendMessage(const std::string& instance_id,
                    const std::vector<uint8_t>& payload, bool reliable);
@@ -193,6 +251,29 @@ class GPGMultiplayer {
   // none.
   SenderAndMessage GetNextMessage();
 
+  // Replace the contents of 'messages' with every incoming message, oldest
+  // first, and empty the queue. Pass the same vector each time: its elements
+  // swap storage with the queue's, so none is allocated once both are warm.
+  void ReceiveMessages(std::vector<SenderAndMessage>* messages);
+
+  // Copy the stats of the connection to an instance into 'stats'. Returns
+  // false, leaving 'stats' alone, if we've never been connected to it.
+  bool GetConnectionStats(const std::string& instance_id,
+                          ConnectionStats* stats);
+
+  // Log the stats of every connection, with the send and receive rates since
+  // the last call.
+  void LogConnectionStats();
+
+  // Bytes sent to and received from every instance we've been connected to,
+  // in total.
+  void GetTotalBytes(uint64_t* bytes_sent, uint64_t* bytes_received);
+
+  // Most messages there have been waiting for ReceiveMessages() at once.
+  size_t max_incoming_queue_depth() const {
+    return max_incoming_queue_depth_.load(std::memory_order_relaxed);
+  }
+
   // Returns true if a player has just reconnected.
   bool HasReconnectedPlayer();
 
@@ -227,86 +308,82 @@ class GPGMultiplayer {
   bool allow_reconnecting() const { return allow_reconnecting_; }
 
  private:
-  typedef std::queue<SenderAndMessage> MessageQueue;
-
-  // Listens for hosts that are advertising.
-  class DiscoveryListener : public gpg::IEndpointDiscoveryListener {
-   public:
-    explicit DiscoveryListener(
-        std::function<void(gpg::EndpointDetails const&)> endpointfound_callback,
-        std::function<void(const std::string&)> endpointremoved_callback)
-        : endpointfound_callback_(endpointfound_callback),
-          endpointremoved_callback_(endpointremoved_callback) {}
-    void OnEndpointFound(int64_t /*client_id*/,
-                         gpg::EndpointDetails const& endpoint_details) {
-      // Ignore client_id because we only have one NearbyConnections client.
-      endpointfound_callback_(endpoint_details);
-    }
-    void OnEndpointLost(int64_t /*client_id*/, const std::string& instance_id) {
-      // Ignore client_id because we only have one NearbyConnections client.
-      endpointremoved_callback_(instance_id);
-    }
-
-   private:
-    std::function<void(gpg::EndpointDetails const&)> endpointfound_callback_;
-    std::function<void(const std::string&)> endpointremoved_callback_;
+  // Messages waiting for Update() to send them to one instance. Each is
+  // framed by its length, as a little-endian uint16_t.
+  struct OutgoingMessages {
+    OutgoingMessages() : messages(0), payloads(0), bytes(0) {}
+    std::vector<uint8_t> reliable;
+    std::vector<uint8_t> unreliable;
+    // What's been queued and sent since the last Update(), to add to the
+    // instance's ConnectionStats.
+    uint32_t messages;
+    uint32_t payloads;
+    size_t bytes;
   };
 
-  // Listens for messages or disconnects from connected instances.
-  class MessageListener : public gpg::IMessageListener {
-   public:
-    explicit MessageListener(
-        std::function<void(const std::string&, std::vector<uint8_t>, bool)>
-            message_received_callback,
-        std::function<void(const std::string&)> disconnected_callback)
-        : message_received_callback_(message_received_callback),
-          disconnected_callback_(disconnected_callback) {}
-    void OnMessageReceived(int64_t /* client_id */,
-                           const std::string& instance_id,
-                           std::vector<uint8_t> const& payload,
-                           bool is_reliable) {
-      // Ignore client_id because we only have one NearbyConnections client.
-      message_received_callback_(instance_id, payload, is_reliable);
-    }
-    void OnDisconnected(int64_t /* client_id */,
-                        const std::string& instance_id) {
-      // Ignore client_id because we only have one NearbyConnections client.
-      disconnected_callback_(instance_id);
-    }
-
-   private:
-    std::function<void(const std::string&, std::vector<uint8_t>, bool)>
-        message_received_callback_;
-    std::function<void(const std::string&)> disconnected_callback_;
-  };
+  // Frames whose length has this bit set are GPGMultiplayer's own, and aren't
+  // passed on. The rest of the bits are the frame's length.
+  static const uint16_t kControlFrame = 0x8000;
+  // The first byte of a control frame. Pings and pongs follow it with the
+  // little-endian SDL_GetTicks() of the ping.
+  enum ControlFrameType { kControlPing = 0, kControlPong = 1 };
+  static const size_t kPingFrameSize = 1 + sizeof(uint32_t);
+  static const uint32_t kPingIntervalMilliseconds = 1000;
 
   // Enter a new state, exiting the previous one first.
   void TransitionState(MultiplayerState old_state, MultiplayerState new_state);
 
+  // The service thread's loop, until the destructor stops it.
+  static void* ServiceThreadMain(void* data);
+  void RunService();
+  // On the service thread, enter the next queued state if there is one, then
+  // act on the current state.
+  void UpdateStateMachine();
+  // Have the service thread run 'task' before it next updates the state.
+  void PostServiceTask(const std::function<void()>& task);
+
   // Queue up the next state to go into at the next Update.
   void QueueNextState(MultiplayerState next_state);
 
+  // Add a message to the ones queued for an instance.
+  void QueueMessage(const std::string& instance_id,
+                    const std::vector<uint8_t>& payload, bool reliable);
+  // Add a frame of 'size' bytes to the ones queued for an instance. 'flags'
+  // are or'ed into its length.
+  void QueueFrame(const std::string& instance_id, const uint8_t* data,
+                  size_t size, uint16_t flags, bool reliable);
+  // Send the framed messages of one kind queued for an instance, and empty
+  // their batch.
+  void SendBatch(const std::string& instance_id, OutgoingMessages* outgoing,
+                 bool reliable);
+  // Send every queued message.
+  void FlushMessages();
+  // Ping every connected instance, if it's time to.
+  void SendPings();
+  // On the message callback thread, act on a control frame from an instance.
+  void ReceiveControlFrame(const std::string& instance_id,
+                           const uint8_t* frame, size_t size);
+
   // On the client, request a connection from a host you have discovered.
   void SendConnectionRequest(const std::string& host_instance_id);
   // On the host, accept a client's connection request.
   void AcceptConnectionRequest(const std::string& client_instance_id);
   // On the host, reject a client's connection request, disconnecting them.
   void RejectConnectionRequest(const std::string& client_instance_id);
-  // On the host, reject all pending connection requests.
-  void RejectAllConnectionRequests();
-
-  // Callbacks used by NearbyConnections library.
-  void StartAdvertisingCallback(gpg::StartAdvertisingResult const& info);
-  void ConnectionRequestCallback(
-      gpg::ConnectionRequest const& connection_request);
-  void DiscoveryEndpointFoundCallback(
-      gpg::EndpointDetails const& endpoint_details);
-  void DiscoveryEndpointLostCallback(const std::string& instance_id);
-  void ConnectionResponseCallback(gpg::ConnectionResponse const& response);
-  void MessageReceivedCallback(const std::string& instance_id,
-                               std::vector<uint8_t> const& payload,
-                               bool is_reliable);
-  void DisconnectedCallback(const std::string& instance_id);
+
+  // Callbacks from the transport, on its threads.
+  virtual void OnAdvertisingResult(bool success, const std::string& local_name);
+  virtual void OnConnectionRequest(const std::string& instance_id,
+                                   const std::string& name);
+  virtual void OnEndpointFound(const std::string& instance_id,
+                               const std::string& name);
+  virtual void OnEndpointLost(const std::string& instance_id);
+  virtual void OnConnectionResponse(const std::string& instance_id,
+                                    bool accepted);
+  virtual void OnMessageReceived(const std::string& instance_id,
+                                 const std::vector<uint8_t>& payload,
+                                 bool is_reliable);
+  virtual void OnDisconnected(const std::string& instance_id);
 
   // Functions to prompt the user on connection.
   DialogResponse GetConnectionDialogResponse();
@@ -326,22 +403,34 @@ class GPGMultiplayer {
   // connected_instances_ to remove holes from disconnected instances.
   void ClearDisconnectedInstances();
 
-  // The NearbyConnections library.
-  std::unique_ptr<gpg::NearbyConnections> nearby_connections_;
-  // The DiscoveryListener we've instantiated.
-  std::unique_ptr<DiscoveryListener> discovery_listener_;
-  // The MessageListener we've instantiated.
-  std::unique_ptr<MessageListener> message_listener_;
+  // What we connect over.
+  std::unique_ptr<MultiplayerTransport> transport_;
 
   std::string service_id_;
-  std::vector<gpg::AppIdentifier> app_identifiers_;
+  std::vector<std::string> app_identifiers_;
 
   // Keep track of fully-connected instances here. Lock instance_mutex_ before
   // using.
   std::vector<std::string> connected_instances_;
-  // Keep a reverse map of instance IDs to vector indices. Lock instance_mutex_
+  // Scratch copy of connected_instances_ for BroadcastMessage(), kept to
+  // reuse the storage.
+  std::vector<std::string> broadcast_instances_;
+  // Messages queued since the last Update(), by instance ID. Only used on the
+  // game thread. Entries stay once created, to reuse their storage.
+  std::map<std::string, OutgoingMessages> outgoing_messages_;
+  // Stats on every instance we've been connected to. Lock stats_mutex_
   // before using.
-  std::map<std::string, int> connected_instances_reverse_;
+  std::map<std::string, ConnectionStats> connection_stats_;
+  // The stats as of the last LogConnectionStats(), to work out rates from.
+  // Only used on the game thread.
+  std::map<std::string, ConnectionStats> logged_stats_;
+  uint32_t last_log_time_;
+  uint32_t last_ping_time_;
+  std::atomic<size_t> max_incoming_queue_depth_;
+  // Keep a reverse map of instance IDs to vector indices, without the
+  // placeholders for disconnected instances. Lock instance_mutex_ before
+  // using.
+  std::unordered_map<std::string, int> connected_instances_reverse_;
   // The host keeps track of instances that are trying to connect. Lock
   // instance_mutex_ before using.
   std::list<std::string> pending_instances_;
@@ -359,29 +448,48 @@ class GPGMultiplayer {
   // so the user code can send them a game state update.
   std::queue<int> reconnected_players_;
 
-  // List of incoming messages. Lock message_mutex_ before using.
-  MessageQueue incoming_messages_;
-
-  // Our current state.
-  MultiplayerState state_;
-  // Our next state(s). Will enter the next one during the next Update().
+  // Ring of incoming messages. Only the message callback thread writes the
+  // slots, and only the game thread reads them, so neither takes a lock:
+  // incoming_tail_ is the next slot to write, and is only advanced by the
+  // callback, incoming_head_ is the next slot to read, and is only advanced
+  // by the game thread. Both count up forever; mask them to index the ring.
+  static const size_t kIncomingMessageSlots = 256;
+  std::vector<SenderAndMessage> incoming_messages_;
+  std::atomic<size_t> incoming_head_;
+  std::atomic<size_t> incoming_tail_;
+
+  // Our current state. Only the service thread changes it.
+  std::atomic<MultiplayerState> state_;
+  // Our next state(s). The service thread enters them one at a time. Lock
+  // state_mutex_ before using.
   std::queue<MultiplayerState> next_states_;
+  // Work posted for the service thread, such as disconnecting instances.
+  // Lock state_mutex_ before using.
+  std::queue<std::function<void()>> service_tasks_;
 
   std::string my_instance_name_;
   int max_connected_players_allowed_;  // 0 to allow any number
 
-  // Mutex for the incoming_messages_ queue.
-  pthread_mutex_t message_mutex_;
-
   // Mutex for instance management: connected_instances_, pending_instances_,
   // discovered_instances, and instance_names_.
   pthread_mutex_t instance_mutex_;
 
-  // Mutex for the next_states_ queue. Needed only in rare occasions like a
-  // callback setting an error condition.
+  // Mutex for the next_states_ and service_tasks_ queues, and
+  // service_running_.
   pthread_mutex_t state_mutex_;
 
-  bool is_hosting_;    // This is set to true if we are the host.
+  // Mutex for connection_stats_. If you need instance_mutex_ as well, lock
+  // that first.
+  pthread_mutex_t stats_mutex_;
+
+  // Signalled, with state_mutex_, when there's a new state or task for the
+  // service thread, or it should stop.
+  pthread_cond_t service_cond_;
+  pthread_t service_thread_;
+  bool service_started_;
+  bool service_running_;
+
+  std::atomic<bool> is_hosting_;  // This is set to true if we are the host.
   bool auto_connect_;  // If this is true, connections will be automatically
                        // approved without prompting.
   bool allow_reconnecting_;  // If this is true, a client disconnecting while a
@@ -0,0 +1,174 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "billboard_batch.h"
+#include "gpu_particles.h"
+#include "renderer.h"
+#include "utilities.h"
+
+namespace fpl {
+namespace pie_noon {
+
+// Indices are 16-bit, so a pool can't hold more particles than this.
+static const int kMaxPoolParticles = 0x10000 / kBillboardNumVertices;
+
+static const unsigned short kQuadIndices[] = {0, 1, 2, 2, 1, 3};
+
+static unsigned char ColorToByte(float c) {
+  return static_cast<unsigned char>(mathfu::Clamp(c, 0.0f, 1.0f) * 255.0f +
+                                    0.5f);
+}
+
+GpuParticlePool::GpuParticlePool()
+    : material_(nullptr),
+      acceleration_(mathfu::kZeros3f),
+      num_particles_(0),
+      vbo_(0),
+      ibo_(0) {}
+
+GpuParticlePool::~GpuParticlePool() {
+  if (vbo_) GL_CALL(glDeleteBuffers(1, &vbo_));
+  if (ibo_) GL_CALL(glDeleteBuffers(1, &ibo_));
+}
+
+void GpuParticlePool::Initialize(const ParticleDef& def,
+                                 const NormalMappedVertex* quads,
+                                 Material* material) {
+  material_ = material;
+  acceleration_ = LoadVec3(def.acceleration());
+
+  num_particles_ = std::min(def.gpu_pool_size(), kMaxPoolParticles);
+  if (num_particles_ <= 0) return;
+  std::vector<Vertex> vertices(num_particles_ * kBillboardNumVertices);
+  std::vector<unsigned short> indices(num_particles_ *
+                                      PIE_ARRAYSIZE(kQuadIndices));
+  for (int i = 0; i < num_particles_; ++i) {
+    Particle particle;
+    particle.Randomize(def, mathfu::kZeros3f, mathfu::kZeros3f,
+                       mathfu::kOnes4f);
+    const vec4 tint = particle.base_tint();
+    const NormalMappedVertex* quad =
+        &quads[particle.renderable_id() * kBillboardNumVertices];
+    Vertex* v = &vertices[i * kBillboardNumVertices];
+    for (int j = 0; j < kBillboardNumVertices; ++j) {
+      v[j].pos = quad[j].pos;
+      v[j].tc = quad[j].tc;
+      for (int k = 0; k < 4; ++k) v[j].color[k] = ColorToByte(tint[k]);
+      v[j].velocity_duration =
+          vec4(particle.base_velocity(), particle.duration());
+      v[j].offset_fade =
+          vec4(particle.base_position(), particle.duration_of_fade_out());
+      v[j].orientation_shrink = vec4(particle.base_orientation(),
+                                     particle.duration_of_shrink_out());
+      v[j].angular_velocity = particle.rotational_velocity();
+      v[j].scale = particle.base_scale();
+    }
+    const unsigned short base =
+        static_cast<unsigned short>(i * kBillboardNumVertices);
+    for (size_t j = 0; j < PIE_ARRAYSIZE(kQuadIndices); ++j) {
+      indices[i * PIE_ARRAYSIZE(kQuadIndices) + j] = base + kQuadIndices[j];
+    }
+  }
+
+  GL_CALL(glGenBuffers(1, &vbo_));
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, vbo_));
+  GL_CALL(glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
+                       &vertices[0], GL_STATIC_DRAW));
+  Renderer::CountUpload(vertices.size() * sizeof(Vertex));
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+  GL_CALL(glGenBuffers(1, &ibo_));
+  GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_));
+  GL_CALL(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                       indices.size() * sizeof(unsigned short), &indices[0],
+                       GL_STATIC_DRAW));
+  Renderer::CountUpload(indices.size() * sizeof(unsigned short));
+  GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+}
+
+void GpuParticlePool::Bind(Renderer& renderer) const {
+  material_->Set(renderer);
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, vbo_));
+  GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_));
+
+  struct {
+    GLuint attribute;
+    GLint size;
+    GLenum type;
+    size_t offset;
+  } const kAttributes[] = {
+    {Mesh::kAttributePosition, 3, GL_FLOAT, offsetof(Vertex, pos)},
+    {Mesh::kAttributeTexCoord, 2, GL_FLOAT, offsetof(Vertex, tc)},
+    {Mesh::kAttributeColor, 4, GL_UNSIGNED_BYTE, offsetof(Vertex, color)},
+    {Mesh::kAttributeParticleVelocity, 4, GL_FLOAT,
+     offsetof(Vertex, velocity_duration)},
+    {Mesh::kAttributeParticleOffset, 4, GL_FLOAT,
+     offsetof(Vertex, offset_fade)},
+    {Mesh::kAttributeParticleOrientation, 4, GL_FLOAT,
+     offsetof(Vertex, orientation_shrink)},
+    {Mesh::kAttributeParticleAngularVelocity, 3, GL_FLOAT,
+     offsetof(Vertex, angular_velocity)},
+    {Mesh::kAttributeParticleScale, 3, GL_FLOAT, offsetof(Vertex, scale)},
+  };
+  const char* base = nullptr;
+  for (size_t i = 0; i < PIE_ARRAYSIZE(kAttributes); ++i) {
+    GL_CALL(glEnableVertexAttribArray(kAttributes[i].attribute));
+    GL_CALL(glVertexAttribPointer(
+        kAttributes[i].attribute, kAttributes[i].size, kAttributes[i].type,
+        kAttributes[i].type == GL_UNSIGNED_BYTE, sizeof(Vertex),
+        base + kAttributes[i].offset));
+  }
+}
+
+void GpuParticlePool::Unbind() const {
+  const GLuint kAttributes[] = {Mesh::kAttributePosition,
+                                Mesh::kAttributeTexCoord,
+                                Mesh::kAttributeColor,
+                                Mesh::kAttributeParticleVelocity,
+                                Mesh::kAttributeParticleOffset,
+                                Mesh::kAttributeParticleOrientation,
+                                Mesh::kAttributeParticleAngularVelocity,
+                                Mesh::kAttributeParticleScale};
+  for (size_t i = 0; i < PIE_ARRAYSIZE(kAttributes); ++i) {
+    GL_CALL(glDisableVertexAttribArray(kAttributes[i]));
+  }
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+  GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+}
+
+void GpuParticlePool::Render(Renderer& renderer, Shader* shader,
+                             const ParticleBurst& burst) const {
+  renderer.color() = vec4(burst.tint);
+  shader->Set(renderer);
+  shader->SetUniform("burst_position", vec3(burst.position));
+  shader->SetUniform("burst_orientation", vec3(burst.orientation_offset));
+  shader->SetUniform("burst_scale", burst.scale);
+  shader->SetUniform("acceleration", vec3(acceleration_));
+  shader->SetUniform("age", burst.age);
+
+  // The pool may be smaller than the def asked for, if that was too many.
+  const int first = std::min(burst.first_particle, num_particles_);
+  const int count = std::min(burst.num_particles, num_particles_ - first);
+  if (count <= 0) return;
+  const size_t first_index = first * PIE_ARRAYSIZE(kQuadIndices);
+  GL_CALL(glDrawElements(
+      GL_TRIANGLES, static_cast<GLsizei>(count * PIE_ARRAYSIZE(kQuadIndices)),
+      GL_UNSIGNED_SHORT, static_cast<const char*>(nullptr) +
+                             first_index * sizeof(unsigned short)));
+  Renderer::CountDraw(GL_TRIANGLES,
+                      static_cast<int>(count * PIE_ARRAYSIZE(kQuadIndices)));
+}
+
+}  // pie_noon
+}  // fpl
@@ -0,0 +1,82 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_GPU_PARTICLES_H
+#define FPL_GPU_PARTICLES_H
+
+#include "mesh.h"
+#include "particles.h"
+
+namespace fpl {
+
+class Renderer;
+class Shader;
+
+namespace pie_noon {
+
+// The particles for every burst of one ParticleDef with gpu_simulated set.
+// They are generated once, with the same randomness SpawnParticles() would
+// use, and kept in a static VBO. Each burst draws a run of them with
+// shaders/gpu_particles, which works out where they are from the burst's age.
+class GpuParticlePool {
+ public:
+  GpuParticlePool();
+  ~GpuParticlePool();
+
+  // Generates def.gpu_pool_size() particles. 'quads' holds the
+  // kBillboardNumVertices vertices of each renderable's quad, indexed by
+  // renderable id, with texture coordinates already mapped into 'material'.
+  // Every renderable in 'def' must be drawable with 'material'.
+  void Initialize(const ParticleDef& def, const NormalMappedVertex* quads,
+                  Material* material);
+
+  // Draw 'burst', which must be from def. shaders/gpu_particles must be set,
+  // with the view-projection matrix in Renderer::model_view_projection().
+  // Changes the Renderer::color(). Call between Bind() and Unbind().
+  void Render(Renderer& renderer, Shader* shader,
+              const ParticleBurst& burst) const;
+
+  // Set up the material and vertex attributes for Render(), and put them
+  // back afterwards.
+  void Bind(Renderer& renderer) const;
+  void Unbind() const;
+
+  // Forget the buffers, once the GL context they were made in has been
+  // lost, so that deleting the pool doesn't delete what's reused their
+  // names.
+  void ForgetBuffers() { vbo_ = ibo_ = 0; }
+
+ private:
+  struct Vertex {
+    vec3_packed pos;
+    vec2_packed tc;
+    unsigned char color[4];
+    vec4_packed velocity_duration;
+    vec4_packed offset_fade;
+    vec4_packed orientation_shrink;
+    vec3_packed angular_velocity;
+    vec3_packed scale;
+  };
+
+  Material* material_;
+  vec3_packed acceleration_;
+  int num_particles_;
+  GLuint vbo_;
+  GLuint ibo_;
+};
+
+}  // pie_noon
+}  // fpl
+
+#endif  // FPL_GPU_PARTICLES_H
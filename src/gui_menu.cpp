@@ -23,11 +23,33 @@ namespace pie_noon {
 
 //#define USE_IMGUI (1)
 
-GuiMenu::GuiMenu() : time_elapsed_(0) {
+GuiMenu::GuiMenu()
+    : current_menu_(nullptr),
+      use_render_target_(false),
+      render_target_signature_(0),
+      render_target_shader_(nullptr),
+      time_elapsed_(0) {
 #ifdef USE_IMGUI
   // Initialize font manager.
   fontman_ = new FontManager();
   fontman_->Open("fonts/NotoSansCJKjp-Bold.otf");
+
+  // Menu text is scaled by its animations, so render it from distance fields.
+  fontman_->EnableSDF(true);
+
+  // Scores and timers change every frame, so skip shaping them.
+  fontman_->SetPreshapedCharacters(kNumericCharacters);
+
+  // Menus are static between Setup() calls, so only lay them out once.
+  gui::SetLayoutCaching(true);
+#endif
+}
+
+void GuiMenu::set_worker_pool(WorkerPool* pool) {
+#ifdef USE_IMGUI
+  fontman_->set_worker_pool(pool);
+#else
+  (void)pool;
 #endif
 }
 
@@ -45,35 +67,67 @@ static inline size_t ArrayLength(const T* array) {
 
 void GuiMenu::Setup(const UiGroup* menu_def, MaterialManager* matman) {
   ClearRecentSelections();
+#ifdef USE_IMGUI
+  gui::InvalidateLayout();
+#endif
 
   // Save material manager instance for later use.
   matman_ = matman;
 
+  // Hand the lists of the previous menu back to it. Only ever swaps pointers.
+  if (current_menu_ != nullptr) {
+    current_menu_->buttons.swap(button_list_);
+    current_menu_->images.swap(image_list_);
+    current_menu_ = nullptr;
+  }
+
   if (menu_def == nullptr) {
     button_list_.resize(0);
     image_list_.resize(0);
     current_focus_ = ButtonId_Undefined;
     return;  // Nothing to set up.  Just clearing things out.
   }
+
+  CompiledMenu* menu = Compile(menu_def, matman);
+  button_list_.swap(menu->buttons);
+  image_list_.swap(menu->images);
+  current_menu_ = menu;
+  menu_def_ = menu_def;
+  current_focus_ = menu_def->starting_selection();
+
+  // Start from the initial state. The lists were copied from the initial
+  // ones, so this reuses their storage rather than allocating.
+  std::copy(menu->initial_buttons.begin(), menu->initial_buttons.end(),
+            button_list_.begin());
+  std::copy(menu->initial_images.begin(), menu->initial_images.end(),
+            image_list_.begin());
+}
+
+// Build the buttons and images of 'menu_def', the first time it is used.
+GuiMenu::CompiledMenu* GuiMenu::Compile(const UiGroup* menu_def,
+                                        MaterialManager* matman) {
+  auto it = compiled_menus_.find(menu_def);
+  if (it != compiled_menus_.end()) return &it->second;
+  CompiledMenu* menu = &compiled_menus_[menu_def];
+
   assert(menu_def->cannonical_window_height() > 0);
   const size_t length_button_list = ArrayLength(menu_def->button_list());
   const size_t length_image_list = ArrayLength(menu_def->static_image_list());
-  menu_def_ = menu_def;
-  button_list_.resize(length_button_list);
-  image_list_.resize(length_image_list);
-  current_focus_ = menu_def->starting_selection();
-  // Empty the queue.
+  std::vector<TouchscreenButton>& buttons = menu->initial_buttons;
+  std::vector<StaticImage>& images = menu->initial_images;
+  buttons.resize(length_button_list);
+  images.resize(length_image_list);
 
   for (size_t i = 0; i < length_button_list; i++) {
     const ButtonDef* button = menu_def->button_list()->Get(i);
-    button_list_[i] = TouchscreenButton();
+    buttons[i] = TouchscreenButton();
     const size_t length_texture_normal = ArrayLength(button->texture_normal());
     for (size_t j = 0; j < length_texture_normal; j++) {
       const char* texture_name = TextureName(*button->texture_normal()->Get(j));
-      button_list_[i].set_up_material(j, matman->FindMaterial(texture_name));
+      buttons[i].set_up_material(j, matman->FindMaterial(texture_name));
     }
     if (button->texture_pressed()) {
-      button_list_[i].set_down_material(
+      buttons[i].set_down_material(
           matman->FindMaterial(TextureName(*button->texture_pressed())));
     }
 
@@ -92,13 +146,12 @@ void GuiMenu::Setup(const UiGroup* menu_def, MaterialManager* matman) {
       SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                   "Buttons used in menus must specify a shader!");
     }
-    button_list_[i].set_shader(shader);
-    button_list_[i].set_inactive_shader(inactive_shader);
-    button_list_[i].set_button_def(button);
-    button_list_[i].set_is_active(button->starts_active() != 0);
-    button_list_[i].set_is_highlighted(true);
-    button_list_[i]
-        .SetCannonicalWindowHeight(menu_def_->cannonical_window_height());
+    buttons[i].set_shader(shader);
+    buttons[i].set_inactive_shader(inactive_shader);
+    buttons[i].set_button_def(button);
+    buttons[i].set_is_active(button->starts_active() != 0);
+    buttons[i].set_is_highlighted(true);
+    buttons[i].SetCannonicalWindowHeight(menu_def->cannonical_window_height());
   }
 
   // Initialize image_list_.
@@ -124,9 +177,26 @@ void GuiMenu::Setup(const UiGroup* menu_def, MaterialManager* matman) {
                    "Static image missing shader '%s'", shader_name);
     }
 
-    image_list_[i].Initialize(image_def, materials, shader,
-                              menu_def_->cannonical_window_height());
+    images[i].Initialize(image_def, materials, shader,
+                         menu_def->cannonical_window_height());
   }
+
+  // Index the buttons and images by id. Duplicates sort by index, so lookups
+  // find the first one, as the linear search used to.
+  for (size_t i = 0; i < buttons.size(); i++) {
+    menu->button_index.push_back(std::make_pair(buttons[i].GetId(), i));
+  }
+  std::sort(menu->button_index.begin(), menu->button_index.end());
+  for (size_t i = 0; i < images.size(); i++) {
+    menu->image_index.push_back(std::make_pair(images[i].GetId(), i));
+  }
+  std::sort(menu->image_index.begin(), menu->image_index.end());
+  BuildHitGrid(menu);
+
+  // The lists Setup() hands out, and resets from the initial ones.
+  menu->buttons = menu->initial_buttons;
+  menu->images = menu->initial_images;
+  return menu;
 }
 
 // Force the material manager to load all the textures and shaders
@@ -165,6 +235,9 @@ void GuiMenu::LoadAssets(const UiGroup* menu_def, MaterialManager* matman) {
       matman->LoadShader(image_def.shader()->c_str());
     }
   }
+
+  // With everything loaded, switching to the menu needs no lookups.
+  Compile(menu_def, matman);
 }
 
 void GuiMenu::AdvanceFrame(WorldTime delta_time, InputSystem* input,
@@ -176,9 +249,10 @@ void GuiMenu::AdvanceFrame(WorldTime delta_time, InputSystem* input,
 #ifndef USE_IMGUI
   // Start every frame with a clean list of events.
   ClearRecentSelections();
+  FindPressedButtons(input, window_size);
   for (size_t i = 0; i < button_list_.size(); i++) {
     TouchscreenButton& current_button = button_list_[i];
-    current_button.AdvanceFrame(delta_time, input, window_size);
+    current_button.AdvanceFrame(delta_time, button_pressed_[i]);
     current_button.set_is_highlighted(current_focus_ == current_button.GetId());
 
     if (current_button.IsTriggered()) {
@@ -193,20 +267,96 @@ void GuiMenu::AdvanceFrame(WorldTime delta_time, InputSystem* input,
 #endif
 }
 
+// Column or row of the hit grid cell containing 'coord'.
+static int HitGridCell(float coord, int grid_size) {
+  return mathfu::Clamp(static_cast<int>(floorf(coord * grid_size)), 0,
+                       grid_size - 1);
+}
+
+void GuiMenu::BuildHitGrid(CompiledMenu* menu) {
+  const int num_cells = kHitGridSize * kHitGridSize;
+  std::vector<size_t>& start = menu->hit_cell_start;
+  std::vector<size_t>& cell_buttons = menu->hit_cell_buttons;
+  start.assign(num_cells + 1, 0);
+
+  // Count the buttons in each cell, then fill them in, so every cell is
+  // contiguous, and in button order.
+  for (int pass = 0; pass < 2; ++pass) {
+    for (size_t i = 0; i < menu->initial_buttons.size(); i++) {
+      const ButtonDef* def = menu->initial_buttons[i].button_def();
+      const int x0 = HitGridCell(def->top_left()->x(), kHitGridSize);
+      const int y0 = HitGridCell(def->top_left()->y(), kHitGridSize);
+      const int x1 = HitGridCell(def->bottom_right()->x(), kHitGridSize);
+      const int y1 = HitGridCell(def->bottom_right()->y(), kHitGridSize);
+      for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+          const int cell = y * kHitGridSize + x;
+          if (pass == 0) {
+            start[cell + 1]++;
+          } else {
+            cell_buttons[start[cell]++] = i;
+          }
+        }
+      }
+    }
+    if (pass == 0) {
+      for (int c = 0; c < num_cells; ++c) start[c + 1] += start[c];
+      cell_buttons.resize(start[num_cells]);
+    } else {
+      // Filling advanced each start to the next cell's; shift them back.
+      for (int c = num_cells; c > 0; --c) start[c] = start[c - 1];
+      start[0] = 0;
+    }
+  }
+}
+
+// Test each pointer that is down against the buttons in its grid cell only.
+void GuiMenu::FindPressedButtons(InputSystem* input, const vec2& window_size) {
+  button_pressed_.assign(button_list_.size(), false);
+  if (current_menu_ == nullptr) return;
+
+  for (size_t i = 0; i < input->pointers_.size(); i++) {
+    const Pointer& pointer = input->pointers_[i];
+    const Button pointer_button = input->GetPointerButton(pointer.id);
+    if (!pointer_button.is_down() && !pointer_button.went_down()) continue;
+
+    const int x = HitGridCell(pointer.mousepos.x() / window_size.x(),
+                              kHitGridSize);
+    const int y = HitGridCell(pointer.mousepos.y() / window_size.y(),
+                              kHitGridSize);
+    const int cell = y * kHitGridSize + x;
+    for (size_t j = current_menu_->hit_cell_start[cell];
+         j < current_menu_->hit_cell_start[cell + 1]; j++) {
+      const size_t button = current_menu_->hit_cell_buttons[j];
+      if (!button_pressed_[button] &&
+          button_list_[button].WillCapturePointer(pointer, window_size)) {
+        button_pressed_[button] = true;
+      }
+    }
+  }
+}
+
+// Find the first entry for 'id' in one of a CompiledMenu's indices.
+static const size_t kNotFound = static_cast<size_t>(-1);
+static size_t FindIndex(
+    const std::vector<std::pair<ButtonId, size_t>>& index, ButtonId id) {
+  auto it = std::lower_bound(index.begin(), index.end(),
+                             std::make_pair(id, static_cast<size_t>(0)));
+  return it != index.end() && it->first == id ? it->second : kNotFound;
+}
+
 // Utility function for finding indexes.
 TouchscreenButton* GuiMenu::FindButtonById(ButtonId id) {
-  for (size_t i = 0; i < button_list_.size(); i++) {
-    if (button_list_[i].GetId() == id) return &button_list_[i];
-  }
-  return nullptr;
+  if (current_menu_ == nullptr) return nullptr;
+  const size_t i = FindIndex(current_menu_->button_index, id);
+  return i == kNotFound ? nullptr : &button_list_[i];
 }
 
 // Utility function for finding indexes.
 StaticImage* GuiMenu::FindImageById(ButtonId id) {
-  for (size_t i = 0; i < image_list_.size(); i++) {
-    if (image_list_[i].GetId() == id) return &image_list_[i];
-  }
-  return nullptr;
+  if (current_menu_ == nullptr) return nullptr;
+  const size_t i = FindIndex(current_menu_->image_index, id);
+  return i == kNotFound ? nullptr : &image_list_[i];
 }
 
 // Utility function for clearing out the queue, since the syntax is weird.
@@ -318,19 +468,52 @@ gui::Event GuiMenu::ImguiButton(const ImguiButtonDef& data) {
 }
 #endif
 
+// Composite the queued quads from render_target_, redrawing it first only if
+// they are different from the ones it holds. Returns false if render targets
+// are not supported, in which case it won't try again.
+bool GuiMenu::RenderThroughTarget(Renderer* renderer) {
+  const vec2i size = renderer->window_size();
+  const bool resized = !(render_target_.size() == size);
+  if (!render_target_.Initialize(size)) {
+    use_render_target_ = false;
+    return false;
+  }
+  if (resized || draw_list_.signature() != render_target_signature_) {
+    render_target_signature_ = draw_list_.signature();
+    render_target_.Begin(*renderer);
+    draw_list_.Flush(*renderer);
+    render_target_.End();
+  } else {
+    draw_list_.Discard();
+  }
+
+  // Only load the shader the first time, since every load adds a reference.
+  if (!render_target_shader_) {
+    render_target_shader_ = matman_->LoadShader("shaders/textured");
+  }
+  render_target_.Draw(*renderer, render_target_shader_,
+                      vec3(0.0f, static_cast<float>(size.y()), 0.0f),
+                      vec3(static_cast<float>(size.x()), 0.0f, 0.0f));
+  return true;
+}
+
 void GuiMenu::Render(Renderer* renderer) {
 #ifndef USE_IMGUI
   // Render touch controls, as long as the touch-controller is active.
   for (size_t i = 0; i < image_list_.size(); i++) {
     if (!image_list_[i].image_def()->render_after_buttons())
-      image_list_[i].Render(*renderer);
+      image_list_[i].Render(*renderer, &draw_list_);
   }
   for (size_t i = 0; i < button_list_.size(); i++) {
-    button_list_[i].Render(*renderer);
+    button_list_[i].Render(*renderer, &draw_list_);
   }
   for (size_t i = 0; i < image_list_.size(); i++) {
     if (image_list_[i].image_def()->render_after_buttons())
-      image_list_[i].Render(*renderer);
+      image_list_[i].Render(*renderer, &draw_list_);
+  }
+  // Draws all of the above with one call per texture, in most menus.
+  if (!use_render_target_ || !RenderThroughTarget(renderer)) {
+    draw_list_.Flush(*renderer);
   }
 #else
   // Clear selection after the game loop finished handling them.
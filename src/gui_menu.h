@@ -16,12 +16,14 @@
 #define GUI_MENU_H
 
 #include <queue>
+#include <unordered_map>
 #include "common.h"
 #include "config_generated.h"
 #include "controller.h"
 #include "input.h"
 #include "material_manager.h"
 #include "renderer.h"
+#include "render_target.h"
 #include "touchscreen_button.h"
 #include "imgui.h"
 
@@ -49,6 +51,15 @@ class GuiMenu {
   void Setup(const UiGroup* menudef, MaterialManager* matman);
   void LoadAssets(const UiGroup* menu_def, MaterialManager* matman);
   void Render(Renderer* renderer);
+
+  // Draw the buttons and images through an offscreen buffer, which is only
+  // redrawn when they change. Falls back to drawing directly if render
+  // targets are unsupported.
+  bool use_render_target() const { return use_render_target_; }
+  void set_use_render_target(bool use) { use_render_target_ = use; }
+
+  // The pool the menus' text is shaped on. It must outlive the menu.
+  void set_worker_pool(WorkerPool* pool);
   void AdvanceFrame(WorldTime delta_time);
   MenuSelection GetRecentSelection();
   void HandleControllerInput(uint32_t logical_input,
@@ -60,8 +71,35 @@ class GuiMenu {
   const UiGroup* menu_def() const { return menu_def_; }
 
  private:
+  // The buttons and images of a UiGroup, built once. Setup() resets a copy
+  // of the initial ones and swaps it into button_list_ and image_list_.
+  struct CompiledMenu {
+    std::vector<TouchscreenButton> initial_buttons;
+    std::vector<StaticImage> initial_images;
+    // (id, index) of every button and image, sorted for FindButtonById() and
+    // FindImageById().
+    std::vector<std::pair<ButtonId, size_t>> button_index;
+    std::vector<std::pair<ButtonId, size_t>> image_index;
+    // Lists with the same contents as the initial ones, but empty while the
+    // menu is current, since they are swapped into GuiMenu.
+    std::vector<TouchscreenButton> buttons;
+    std::vector<StaticImage> images;
+    // Uniform grid over the touch zones of the buttons, in the normalized
+    // window coordinates of ButtonDef. The buttons overlapping cell c are
+    // hit_cell_buttons[hit_cell_start[c]] up to hit_cell_start[c + 1].
+    std::vector<size_t> hit_cell_start;
+    std::vector<size_t> hit_cell_buttons;
+  };
+
+  // Cells per side of CompiledMenu's hit grid.
+  static const int kHitGridSize = 8;
+
   void ClearRecentSelections();
+  CompiledMenu* Compile(const UiGroup* menu_def, MaterialManager* matman);
+  bool RenderThroughTarget(Renderer* renderer);
   void UpdateFocus(const flatbuffers::Vector<uint16_t>* destination_list);
+  static void BuildHitGrid(CompiledMenu* menu);
+  void FindPressedButtons(InputSystem* input, const vec2& window_size);
 
   // imgui custom button definition.
   gui::Event ImguiButton(const ImguiButtonDef& data);
@@ -78,6 +116,22 @@ class GuiMenu {
   std::vector<TouchscreenButton> button_list_;
   std::vector<StaticImage> image_list_;
 
+  std::unordered_map<const UiGroup*, CompiledMenu> compiled_menus_;
+  CompiledMenu* current_menu_;
+
+  // Whether each of button_list_ is touched this frame, set by
+  // FindPressedButtons().
+  std::vector<bool> button_pressed_;
+
+  // Collects the quads of the buttons and images in Render().
+  DrawList draw_list_;
+
+  // Holds the last image of draw_list_, if use_render_target_ is set.
+  bool use_render_target_;
+  RenderTarget render_target_;
+  uint64_t render_target_signature_;
+  Shader* render_target_shader_;
+
   // Total Worldtime since the menu was initialized.
   // Used for animating selections and such.
   WorldTime time_elapsed_;
@@ -0,0 +1,142 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include <string>
+#include "hitch_detector.h"
+#include "frame_profiler.h"
+
+namespace fpl {
+namespace pie_noon {
+
+const size_t HitchDetector::kMaxFrames;
+const int HitchDetector::kMaxCaptures;
+
+HitchDetector::HitchDetector()
+    : threshold_(0),
+      capture_length_(0),
+      frame_start_(0),
+      last_hitch_(0),
+      captures_(0),
+      frame_count_(0) {}
+
+void HitchDetector::Start(int threshold_ms, int capture_ms) {
+  threshold_ = static_cast<uint64_t>(std::max(threshold_ms, 0)) * 1000;
+  capture_length_ = static_cast<uint64_t>(std::max(capture_ms, 0)) * 1000;
+  frame_start_ = 0;
+  last_hitch_ = 0;
+  frame_count_ = 0;
+  frames_.resize(kMaxFrames);
+}
+
+bool HitchDetector::EndFrame(uint64_t now, const Counters &counters) {
+  if (!enabled()) return false;
+  // The first call only starts the first frame.
+  const uint64_t start = frame_start_;
+  frame_start_ = now;
+  if (start == 0) return false;
+
+  Frame &frame = frames_[frame_count_ % kMaxFrames];
+  frame.start = start;
+  frame.duration = now - start;
+  frame.counters = counters;
+  frame_count_++;
+
+  if (frame.duration <= threshold_ || captures_ >= kMaxCaptures) return false;
+  if (last_hitch_ != 0 && now < last_hitch_ + capture_length_) return false;
+  last_hitch_ = now;
+  return true;
+}
+
+// Append a counter event, which chrome://tracing draws as a graph of each of
+// its values, to 'json'.
+static void AppendCounter(const char *name, uint64_t time, const char *args,
+                          std::string *json) {
+  char event[256];
+  snprintf(event, sizeof(event),
+           "{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"ts\":%llu,"
+           "\"args\":{%s}},\n",
+           name, static_cast<unsigned long long>(time), args);
+  json->append(event);
+}
+
+// The change in a total since the last frame. The glyph cache's totals start
+// again when it's flushed, in which case the whole total is new.
+template <typename T>
+static T Change(T total, T last_total) {
+  return total >= last_total ? total - last_total : total;
+}
+
+bool HitchDetector::Write(const char *filename) {
+  if (frame_count_ == 0) return false;
+  const Frame &hitch = frames_[(frame_count_ - 1) % kMaxFrames];
+  const uint64_t end = hitch.start + hitch.duration;
+  const uint64_t since = end > capture_length_ ? end - capture_length_ : 0;
+
+  std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  FrameProfiler::AppendEvents(since, &json);
+
+  // The frames in the capture, oldest first. The oldest one kept has no
+  // frame before it to measure its changes from, so it's left out.
+  const uint64_t kept = std::min<uint64_t>(frame_count_, kMaxFrames);
+  char args[192];
+  for (uint64_t i = frame_count_ - kept + 1; i < frame_count_; ++i) {
+    const Frame &frame = frames_[i % kMaxFrames];
+    if (frame.start + frame.duration < since) continue;
+    const Counters &last = frames_[(i - 1) % kMaxFrames].counters;
+    const Counters &counters = frame.counters;
+    snprintf(args, sizeof(args), "\"ms\":%.3f", frame.duration / 1000.0);
+    AppendCounter("Frame time", frame.start, args, &json);
+    snprintf(args, sizeof(args), "\"state\":%d", counters.state);
+    AppendCounter("State", frame.start, args, &json);
+    snprintf(args, sizeof(args), "\"count\":%llu,\"KB\":%llu",
+             static_cast<unsigned long long>(
+                 Change(counters.allocations, last.allocations)),
+             static_cast<unsigned long long>(
+                 Change(counters.allocated_bytes, last.allocated_bytes) /
+                 1024));
+    AppendCounter("Allocations", frame.start, args, &json);
+    snprintf(args, sizeof(args), "\"queued\":%d,\"finalized\":%d",
+             counters.load_queue_depth,
+             Change(counters.loads_finalized, last.loads_finalized));
+    AppendCounter("Texture loads", frame.start, args, &json);
+    const int lookups = Change(counters.glyph_lookups, last.glyph_lookups);
+    const int hits = Change(counters.glyph_hits, last.glyph_hits);
+    snprintf(args, sizeof(args), "\"lookups\":%d,\"misses\":%d", lookups,
+             std::max(lookups - hits, 0));
+    AppendCounter("Glyph cache", frame.start, args, &json);
+  }
+
+  // Mark the hitch itself across every track.
+  snprintf(args, sizeof(args),
+           "{\"name\":\"Hitch\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,"
+           "\"ts\":%llu,\"args\":{\"ms\":%.3f,\"threshold_ms\":%.3f}},\n",
+           static_cast<unsigned long long>(hitch.start),
+           hitch.duration / 1000.0, threshold_ / 1000.0);
+  json.append(args);
+  // Name the process, which also avoids a trailing comma.
+  json.append(
+      "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+      "\"args\":{\"name\":\"Pie Noon\"}}\n]}\n");
+  captures_++;
+
+  SDL_RWops *handle = SDL_RWFromFile(filename, "wb");
+  if (!handle) return false;
+  const size_t written = SDL_RWwrite(handle, json.data(), 1, json.size());
+  SDL_RWclose(handle);
+  return written == json.size();
+}
+
+}  // namespace pie_noon
+}  // namespace fpl
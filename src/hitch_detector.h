@@ -0,0 +1,108 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_HITCH_DETECTOR_H
+#define FPL_HITCH_DETECTOR_H
+
+#include <vector>
+#include "common.h"
+
+namespace fpl {
+namespace pie_noon {
+
+// Catches frames that take much longer than they should, and keeps what led
+// up to them. The game passes in each frame's time and engine counters; when
+// a frame goes over the threshold, Write() dumps the last few seconds of
+// them, along with the frame profiler's markers, as a Chrome trace. The
+// profiler must be enabled for as long as the detector is running.
+class HitchDetector {
+ public:
+  // Totals, as of the end of a frame, that the trace shows per frame.
+  struct Counters {
+    Counters()
+        : state(0),
+          allocations(0),
+          allocated_bytes(0),
+          load_queue_depth(0),
+          loads_finalized(0),
+          glyph_lookups(0),
+          glyph_hits(0) {}
+    // The PieNoonState the frame ended in.
+    int state;
+    // Calls to operator new, and bytes they requested, since startup.
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+    // Textures waiting to be loaded, and textures finalized since startup.
+    int load_queue_depth;
+    int loads_finalized;
+    // The glyph cache's lookups and hits since it was last flushed.
+    int glyph_lookups;
+    int glyph_hits;
+  };
+
+  // Frames kept, however short they are.
+  static const size_t kMaxFrames = 1024;
+  // Hitches written, so a bad device doesn't fill its storage.
+  static const int kMaxCaptures = 8;
+
+  HitchDetector();
+
+  // Start watching for frames longer than 'threshold_ms', keeping the last
+  // 'capture_ms' of frames. Nothing is watched until this is called.
+  void Start(int threshold_ms, int capture_ms);
+  bool enabled() const { return threshold_ > 0; }
+
+  // Record the frame that ended at 'now', by FrameProfiler::Now(), and the
+  // counters as of then. Returns true if it was a hitch that should be
+  // written. Hitches within 'capture_ms' of the last one reported aren't
+  // reported, so that a burst of them takes one capture rather than all.
+  bool EndFrame(uint64_t now, const Counters &counters);
+
+  // Start the next frame at 'now', leaving out the time since the last
+  // EndFrame(), e.g. the time spent writing a capture.
+  void RestartFrame(uint64_t now) { frame_start_ = now; }
+
+  // Hitches written so far, to number the files by.
+  int captures() const { return captures_; }
+
+  // Write the frames and profiler events of the last capture to 'filename'
+  // as Chrome trace JSON. Disable the profiler while calling this. Returns
+  // false if the file can't be written.
+  bool Write(const char *filename);
+
+ private:
+  struct Frame {
+    uint64_t start;
+    uint64_t duration;
+    Counters counters;
+  };
+
+  // How long frames may take and how far back a capture goes, in us.
+  uint64_t threshold_;
+  uint64_t capture_length_;
+  // When the frame being timed started, or 0 before the first frame.
+  uint64_t frame_start_;
+  // When the last hitch reported ended.
+  uint64_t last_hitch_;
+  int captures_;
+  // A ring of the most recent frames. The next goes at frame_count_ %
+  // kMaxFrames.
+  std::vector<Frame> frames_;
+  uint64_t frame_count_;
+};
+
+}  // namespace pie_noon
+}  // namespace fpl
+
+#endif  // FPL_HITCH_DETECTOR_H
@@ -15,6 +15,7 @@
 #include "precompiled.h"
 
 #include "imgui.h"
+#include "draw_list.h"
 
 namespace fpl {
 namespace gui {
@@ -99,6 +100,8 @@ class InternalState : public Group {
                 InputSystem &input)
       : Group(DIR_VERTICAL, ALIGN_TOPLEFT, 0, 0),
         layout_pass_(true),
+        cached_layout_(false),
+        layout_changed_(false),
         virtual_resolution_(IMGUI_DEFAULT_VIRTUAL_RESOLUTION),
         matman_(matman),
         renderer_(matman.renderer()),
@@ -133,7 +136,9 @@ class InternalState : public Group {
     // Load shaders ahead.
     image_shader_ = matman_.LoadShader("shaders/textured");
     assert(image_shader_);
-    font_shader_ = matman_.LoadShader("shaders/font");
+    font_shader_ = matman_.LoadShader(fontman_.SDFEnabled()
+                                          ? "shaders/font_sdf"
+                                          : "shaders/font");
     assert(font_shader_);
     color_shader_ = matman_.LoadShader("shaders/color");
     assert(color_shader_);
@@ -209,6 +214,9 @@ class InternalState : public Group {
       virtual_resolution_ = virtual_resolution;
       SetScale();
     } else {
+      if (cached_layout_ && virtual_resolution != virtual_resolution_) {
+        layout_changed_ = true;
+      }
       auto space = renderer_.window_size() - size_;
       position_ += AlignDimension(horizontal, 0, space) +
                    AlignDimension(vertical, 1, space);
@@ -235,6 +243,70 @@ class InternalState : public Group {
     CheckGamePadNavigation();
   }
 
+  // Take the elements from the previous frame's layout pass instead of
+  // running one, if they were cached for this window size. The render pass
+  // then checks them against the GUI as it goes.
+  bool UseCachedLayout() {
+    if (!layout_cache_.enabled || !layout_cache_.valid ||
+        !EqualSize(layout_cache_.window_size, renderer_.window_size())) {
+      return false;
+    }
+    elements_.swap(layout_cache_.elements);
+    virtual_resolution_ = layout_cache_.virtual_resolution;
+    SetScale();
+    cached_layout_ = true;
+    return true;
+  }
+
+  // (render pass, cached layout): an element that is no longer the size it
+  // was laid out at means the next frame needs a layout pass.
+  void CheckCachedSize(const Element &element, const vec2i &size) {
+    if (cached_layout_ && !EqualSize(element.size, size)) {
+      layout_changed_ = true;
+    }
+  }
+
+  static bool EqualSize(const vec2i &a, const vec2i &b) {
+    return a.x() == b.x() && a.y() == b.y();
+  }
+
+  // Keep this frame's layout for the next frame, as long as the render pass
+  // found the same elements the layout pass did.
+  void StoreLayout() {
+    if (!layout_cache_.enabled) return;
+    if (cached_layout_) {
+      // Elements left over were not created by the GUI this time.
+      layout_cache_.valid =
+          !layout_changed_ && element_it_ == elements_.end();
+      elements_.swap(layout_cache_.elements);
+    } else {
+      layout_cache_.elements.swap(elements_);
+      layout_cache_.window_size = renderer_.window_size();
+      layout_cache_.virtual_resolution = virtual_resolution_;
+      layout_cache_.valid =
+          !layout_changed_ && !layout_cache_.elements.empty();
+    }
+  }
+
+  static void SetLayoutCaching(bool enable) {
+    layout_cache_.enabled = enable;
+    InvalidateLayout();
+  }
+
+  // Turn the cache on or off without touching what's in it. Returns whether
+  // it was on.
+  static bool SwapLayoutCaching(bool enable) {
+    const bool enabled = layout_cache_.enabled;
+    layout_cache_.enabled = enable;
+    return enabled;
+  }
+
+  static void InvalidateLayout() {
+    layout_cache_.valid = false;
+    // Don't let a GUI that is running store its layout either.
+    if (state) state->layout_changed_ = true;
+  }
+
   // (event/render pass): retrieve the next corresponding cached element we
   // created in the layout pass. This is slightly more tricky than a straight
   // lookup because event handlers may insert/remove elements.
@@ -246,10 +318,12 @@ class InternalState : public Group {
       auto &element = *element_it_;
       ++element_it_;
       if (EqualId(element.id, id)) return &element;
+      layout_changed_ = true;
     }
     // Didn't find this id at all, which means an event handler just caused
     // this element to be added, so we skip it.
     element_it_ = backup;
+    layout_changed_ = true;
     return nullptr;
   }
 
@@ -294,36 +368,39 @@ class InternalState : public Group {
     return pos;
   }
 
-  void RenderQuad(Shader *sh, const vec4 &color, const vec2i &pos,
-                  const vec2i &size, const vec4 &uv) {
-      renderer_.color() = color;
-      sh->Set(renderer_);
-      Mesh::RenderAAQuadAlongX(vec3(vec2(pos), 0), vec3(vec2(pos + size), 0),
-                               uv.xy(), uv.zw());
+  // (render pass): queue a quad in the draw list, which is flushed at the
+  // end of the render pass, or before anything that draws directly.
+  void RenderQuad(Shader *sh, const Texture *tex, const vec4 &color,
+                  const vec2i &pos, const vec2i &size, const vec4 &uv) {
+    draw_list_.AddQuad(sh, tex, color, vec3(vec2(pos), 0),
+                       vec3(vec2(pos + size), 0), uv.xy(), uv.zw());
   }
 
-  void RenderQuad(Shader *sh, const vec4 &color, const vec2i &pos,
-                  const vec2i &size) {
-    RenderQuad(sh, color, pos, size, vec4(0, 0, 1, 1));
+  void RenderQuad(Shader *sh, const Texture *tex, const vec4 &color,
+                  const vec2i &pos, const vec2i &size) {
+    RenderQuad(sh, tex, color, pos, size, vec4(0, 0, 1, 1));
   }
 
+  // Draw everything queued so far.
+  void FlushDrawList() { draw_list_.Flush(renderer_); }
+
   // An image element.
   void Image(const char *texture_name, float ysize) {
     auto tex = matman_.FindTexture(texture_name);
     assert(tex);  // You need to have called LoadTexture before.
+    auto virtual_image_size =
+        vec2(tex->size().x() * ysize / tex->size().y(), ysize);
+    // Map the size to real screen pixels, rounding to the nearest int
+    // for pixel-aligned rendering.
+    auto size = VirtualToPhysical(virtual_image_size);
     if (layout_pass_) {
-      auto virtual_image_size =
-          vec2(tex->size().x() * ysize / tex->size().y(), ysize);
-      // Map the size to real screen pixels, rounding to the nearest int
-      // for pixel-aligned rendering.
-      auto size = VirtualToPhysical(virtual_image_size);
       NewElement(size, texture_name);
       Extend(size);
     } else {
       auto element = NextElement(texture_name);
       if (element) {
-        tex->Set(0);
-        RenderQuad(image_shader_, mathfu::kOnes4f, Position(*element),
+        CheckCachedSize(*element, size);
+        RenderQuad(image_shader_, tex, mathfu::kOnes4f, Position(*element),
                    element->size);
         Advance(element->size);
       }
@@ -355,25 +432,46 @@ class InternalState : public Group {
       NewElement(buffer->get_size(), text);
       Extend(buffer->get_size());
     } else {
-      // Check if texture atlas needs to be updated.
-      if (buffer->get_pass() > 0) {
-        fontman_.StartRenderPass();
-      }
-
       auto element = NextElement(text);
+      // With a cached layout this may be text the layout pass never saw. If
+      // its glyphs haven't been uploaded yet, skip it for this frame.
+      if (element && cached_layout_ &&
+          (buffer == nullptr || fontman_.AtlasDirty())) {
+        layout_changed_ = true;
+        Advance(element->size);
+        element = nullptr;
+      }
       if (element) {
-        fontman_.GetAtlasTexture()->Set(0);
+        CheckCachedSize(*element, buffer->get_size());
 
+        // Check if texture atlas needs to be updated.
+        if (buffer->get_pass() > 0) {
+          fontman_.StartRenderPass();
+        }
+
+        // Text is drawn directly, so draw everything queued underneath it
+        // first.
+        FlushDrawList();
+        renderer_.color() = text_color_;
         font_shader_->Set(renderer_);
         auto pos = Position(*element);
         font_shader_->SetUniform("pos_offset", vec3(pos.x(), pos.y(), 0.0f));
+        if (fontman_.SDFEnabled()) {
+          font_shader_->SetUniform("sdf_smoothing",
+                                   fontman_.GetSDFSmoothing(size.y()));
+        }
 
-        const Attribute kFormat[] = {kPosition3f, kTexCoord2f, kEND};
-        Mesh::RenderArray(
-            GL_TRIANGLES, buffer->get_indices()->size(), kFormat,
-            sizeof(FontVertex),
-            reinterpret_cast<const char *>(buffer->get_vertices()->data()),
-            buffer->get_indices()->data());
+        // One draw per glyph cache page the string uses.
+        typedef VertexFormat<Position3f, TexCoord2f> FontFormat;
+        static_assert(FontFormat::kSize == sizeof(FontVertex),
+                      "FontVertex must be laid out as FontFormat.");
+        for (auto &slice : buffer->get_slices()) {
+          fontman_.GetAtlasTexture(slice.page)->Set(0);
+          Mesh::RenderArray<FontFormat>(
+              GL_TRIANGLES, slice.count,
+              reinterpret_cast<const char *>(buffer->get_vertices()->data()),
+              buffer->get_indices()->data() + slice.start);
+        }
         Advance(element->size);
       }
     }
@@ -381,19 +479,25 @@ class InternalState : public Group {
     font_shader_->SetUniform("pos_offset", vec3(0.0f, 0.0f, 0.f));
 
     auto size = VirtualToPhysical(vec2(0, ysize));
+    if (fontman_.SDFEnabled()) {
+      font_shader_->SetUniform("sdf_smoothing",
+                               fontman_.GetSDFSmoothing(size.y()));
+    }
     auto tex = fontman_.GetTexture(text, size.y());
     auto uv = tex->uv();
     auto scale = static_cast<float>(size.y()) /
                  static_cast<float>(tex->metrics().ascender() -
                                     tex->metrics().descender());
+    auto image_size =
+        vec2i(tex->size().x() * (uv.z() - uv.x()) * scale, size.y());
     if (layout_pass_) {
-      auto image_size =
-          vec2i(tex->size().x() * (uv.z() - uv.x()) * scale, size.y());
       NewElement(image_size, text);
       Extend(image_size);
     } else {
       auto element = NextElement(text);
       if (element) {
+        CheckCachedSize(*element, image_size);
+        FlushDrawList();
         tex->Set(0);
         // Note that some glyphs may render outside of element boundary.
         vec2i pos = Position(*element) -
@@ -402,7 +506,10 @@ class InternalState : public Group {
                      vec2i(0, (tex->metrics().internal_leading() -
                                tex->metrics().external_leading()) *
                                   scale);
-        RenderQuad(font_shader_, mathfu::kOnes4f, pos, size, uv);
+        renderer_.color() = mathfu::kOnes4f;
+        font_shader_->Set(renderer_);
+        Mesh::RenderAAQuadAlongX(vec3(vec2(pos), 0),
+                                 vec3(vec2(pos + size), 0), uv.xy(), uv.zw());
         Advance(element->size);
       }
     }
@@ -413,13 +520,14 @@ class InternalState : public Group {
   void CustomElement(
       const vec2 &virtual_size, const char *id,
       const std::function<void(const vec2i &pos, const vec2i &size)> renderer) {
+    auto size = VirtualToPhysical(virtual_size);
     if (layout_pass_) {
-      auto size = VirtualToPhysical(virtual_size);
       NewElement(size, id);
       Extend(size);
     } else {
       auto element = NextElement(id);
       if (element) {
+        CheckCachedSize(*element, size);
         renderer(Position(*element), element->size);
         Advance(element->size);
       }
@@ -429,8 +537,7 @@ class InternalState : public Group {
   // Render texture on the screen.
   void RenderTexture(const Texture &tex, const vec2i &pos, const vec2i &size) {
     if (!layout_pass_) {
-      tex.Set(0);
-      RenderQuad(image_shader_, mathfu::kOnes4f, pos, size);
+      RenderQuad(image_shader_, &tex, mathfu::kOnes4f, pos, size);
     }
   }
 
@@ -506,11 +613,10 @@ class InternalState : public Group {
       // glClipPlane, or stencil buffer).
       // TODO: does not support a scrolling area inside a scrolling area,
       // should assert if this is attempted.
-      glEnable(GL_SCISSOR_TEST);
-      glScissor(position_.x(),
-                renderer_.window_size().y() - position_.y() - psize.y(),
-                psize.x(),
-                psize.y());
+      draw_list_.SetClipRect(
+          vec2i(position_.x(),
+                renderer_.window_size().y() - position_.y() - psize.y()),
+          psize);
       // Scroll the pane on user input.
       // TODO: this will need to be generalized, as mousewheel only works on
       // desktops.
@@ -548,7 +654,7 @@ class InternalState : public Group {
       for (int i = 0; i <= pointer_max_active_index_; i++) {
         clip_mouse_inside_[i] = true;
       }
-      glDisable(GL_SCISSOR_TEST);
+      draw_list_.ClearClipRect();
     }
   }
 
@@ -616,11 +722,11 @@ class InternalState : public Group {
     int dir = 0;
     // FIXME: this should work on other platforms too.
 #   ifdef ANDROID_GAMEPAD
-    auto &gamepads = input_.GamepadMap();
+    auto &gamepads = input_.gamepads();
     for (auto &gamepad : gamepads) {
-      dir = CheckButtons(gamepad.second.GetButton(Gamepad::kLeft),
-                         gamepad.second.GetButton(Gamepad::kRight),
-                         gamepad.second.GetButton(Gamepad::kButtonA));
+      dir = CheckButtons(gamepad.GetButton(Gamepad::kLeft),
+                         gamepad.GetButton(Gamepad::kRight),
+                         gamepad.GetButton(Gamepad::kButtonA));
     }
 #   endif
     // For testing, also support keyboard:
@@ -668,19 +774,20 @@ class InternalState : public Group {
 
   void ColorBackground(const vec4 &color) {
     if (!layout_pass_) {
-      RenderQuad(color_shader_, color, position_, GroupSize());
+      RenderQuad(color_shader_, nullptr, color, position_, GroupSize());
     }
   }
 
   void ImageBackground(const Texture &tex) {
     if (!layout_pass_) {
-      tex.Set(0);
-      RenderQuad(image_shader_, mathfu::kOnes4f, position_, GroupSize());
+      RenderQuad(image_shader_, &tex, mathfu::kOnes4f, position_,
+                 GroupSize());
     }
   }
 
   void ImageBackgroundNinePatch(const Texture &tex, const vec4 &patch_info) {
     if (!layout_pass_) {
+      FlushDrawList();
       tex.Set(0);
       renderer_.color() = mathfu::kOnes4f;
       image_shader_->Set(renderer_);
@@ -696,6 +803,10 @@ class InternalState : public Group {
   void SetTextColor(const vec4 &color) { text_color_ = color; }
 
   bool layout_pass_;
+  // True if elements_ came from the layout cache rather than a layout pass.
+  bool cached_layout_;
+  // Set when the render pass finds the elements differ from the layout.
+  bool layout_changed_;
   std::vector<Element> elements_;
   std::vector<Element>::iterator element_it_;
   std::vector<Group> group_stack_;
@@ -726,6 +837,9 @@ class InternalState : public Group {
   bool gamepad_has_focus_element;
   Event gamepad_event;
 
+  // Quads of the render pass. Kept between frames to reuse its storage.
+  static DrawList draw_list_;
+
   // Intra-frame persistent state.
   static struct PersistentState {
     PersistentState() {
@@ -746,9 +860,23 @@ class InternalState : public Group {
     // directed to this element, e.g. for a text edit widget
     const char *keyboard_focus;
   } persistent_;
+
+  // The elements of the last layout pass, reused by later frames while the
+  // GUI keeps matching them. See gui::SetLayoutCaching().
+  static struct LayoutCache {
+    LayoutCache() : enabled(false), valid(false), virtual_resolution(0) {}
+
+    bool enabled;
+    bool valid;
+    std::vector<Element> elements;
+    vec2i window_size;
+    float virtual_resolution;
+  } layout_cache_;
 };
 
 InternalState::PersistentState InternalState::persistent_;
+InternalState::LayoutCache InternalState::layout_cache_;
+DrawList InternalState::draw_list_;
 
 void Run(MaterialManager &matman, FontManager &fontman, InputSystem &input,
          const std::function<void()> &gui_definition) {
@@ -756,8 +884,10 @@ void Run(MaterialManager &matman, FontManager &fontman, InputSystem &input,
   InternalState internal_state(matman, fontman, input);
 
   // Run two passes, one for layout, one for rendering.
-  // First pass:
-  gui_definition();
+  // First pass, unless the last frame's layout still applies:
+  if (!internal_state.UseCachedLayout()) {
+    gui_definition();
+  }
 
   // Second pass:
   internal_state.StartRenderPass();
@@ -769,10 +899,24 @@ void Run(MaterialManager &matman, FontManager &fontman, InputSystem &input,
   renderer.DepthTest(false);
 
   gui_definition();
+  internal_state.FlushDrawList();
 
   internal_state.CheckGamePadFocus();
+  internal_state.StoreLayout();
+}
+
+void RunUncached(MaterialManager &matman, FontManager &fontman,
+                 InputSystem &input,
+                 const std::function<void()> &gui_definition) {
+  const bool caching = InternalState::SwapLayoutCaching(false);
+  Run(matman, fontman, input, gui_definition);
+  InternalState::SwapLayoutCaching(caching);
 }
 
+void SetLayoutCaching(bool enable) { InternalState::SetLayoutCaching(enable); }
+
+void InvalidateLayout() { InternalState::InvalidateLayout(); }
+
 InternalState *Gui() {
   assert(state);
   return state;
@@ -34,6 +34,26 @@ namespace gui {
 void Run(MaterialManager &matman, FontManager &fontman, InputSystem &input,
          const std::function<void()> &gui_definition);
 
+// Skip the layout pass of Run() when nothing has changed since the last one.
+// The elements it laid out are kept, and reused for as long as the GUI creates
+// elements with the same ids and sizes, at the same virtual resolution and
+// window size. The render pass checks this as it goes, and schedules a layout
+// pass for the next frame when it finds a difference. A GUI changed by its own
+// event handlers behaves as without caching, but one changed any other way
+// renders a frame with the old layout unless you call InvalidateLayout().
+// The ids must remain valid across frames. Off by default.
+void SetLayoutCaching(bool enable);
+
+// Discard the cached layout, so the next Run() does a layout pass.
+void InvalidateLayout();
+
+// Like Run(), but always does a layout pass, and leaves the layout cache to
+// whichever GUI is using it. For a GUI that changes every frame, such as a
+// debug overlay, drawn as well as a cached one.
+void RunUncached(MaterialManager &matman, FontManager &fontman,
+                 InputSystem &input,
+                 const std::function<void()> &gui_definition);
+
 // Event types returned by most interactive elements. These are flags because
 // multiple may occur during one frame, and thus should be tested using &.
 // For example, it is not uncommon for the value to be
@@ -118,7 +138,10 @@ void Image(const char *texture_name, float ysize);
 // text: label string in UTF8
 // ysize: vertical size in virtual resolution. xsize will be derived
 // automatically based on the text length.
-void Label(const unsigned char *text, float ysize);
+void Label(const char *text, float ysize);
+
+// Set the color of the labels that follow.
+void SetTextColor(const mathfu::vec4 &color);
 
 // Create a group of elements with the given layout and intra-element spacing.
 // Start/end calls must be matched and may be nested to create more complex
@@ -161,6 +184,9 @@ void EndScroll();
 
 // Put a custom element with given size.
 // Renderer function is invoked while render pass to render the element.
+// Images and backgrounds are queued and only drawn at the end of the render
+// pass, so the renderer should draw with RenderTexture() to appear on top of
+// them.
 void CustomElement(const vec2 &virtual_size,
                    const char *id,
                    const std::function<void(const vec2i &pos,
@@ -14,6 +14,7 @@
 
 #include "precompiled.h"
 #include "input.h"
+#include <time.h>
 #ifdef ANDROID_GAMEPAD
 #include <jni.h>
 #include <android/keycodes.h>
@@ -101,18 +102,20 @@ void InputSystem::AdvanceFrame(vec2i *window_size) {
 
   // Reset our per-frame input state.
   mousewheel_delta_ = mathfu::kZeros2i;
-  for (auto it = button_map_.begin(); it != button_map_.end(); ++it) {
-    it->second.AdvanceFrame();
+  oldest_input_time_ = 0;
+  for (auto it = changed_buttons_.begin(); it != changed_buttons_.end(); ++it) {
+    buttons_[*it].AdvanceFrame();
   }
+  changed_buttons_.clear();
   for (auto it = pointers_.begin(); it != pointers_.end(); ++it) {
     it->mousedelta = mathfu::kZeros2i;
   }
-  for (auto it = joystick_map_.begin(); it != joystick_map_.end(); ++it) {
-    it->second.AdvanceFrame();
+  for (auto it = joysticks_.begin(); it != joysticks_.end(); ++it) {
+    it->AdvanceFrame();
   }
 #ifdef ANDROID_GAMEPAD
-  for (auto it = gamepad_map_.begin(); it != gamepad_map_.end(); ++it) {
-    it->second.AdvanceFrame();
+  for (auto it = gamepads_.begin(); it != gamepads_.end(); ++it) {
+    it->AdvanceFrame();
   }
   HandleGamepadEvents();
 #endif  // ANDROID_GAMEPAD
@@ -125,19 +128,22 @@ void InputSystem::AdvanceFrame(vec2i *window_size) {
         break;
       case SDL_KEYDOWN:
       case SDL_KEYUP: {
-        GetButton(event.key.keysym.sym).Update(event.key.state == SDL_PRESSED);
+        UpdateButton(event.key.keysym.sym, event.key.state == SDL_PRESSED);
+        NoteInputTime(event.key.timestamp);
         break;
       }
 #ifdef PLATFORM_MOBILE
       case SDL_FINGERDOWN: {
         int i = UpdateDragPosition(event.tfinger, event.type, *window_size);
-        GetPointerButton(i).Update(true);
+        UpdateButton(i + SDLK_POINTER1, true);
+        NoteInputTime(event.tfinger.timestamp);
         break;
       }
       case SDL_FINGERUP: {
         int i = FindPointer(event.tfinger.fingerId);
         RemovePointer(i);
-        GetPointerButton(i).Update(false);
+        UpdateButton(i + SDLK_POINTER1, false);
+        NoteInputTime(event.tfinger.timestamp);
         break;
       }
       case SDL_FINGERMOTION: {
@@ -156,8 +162,9 @@ void InputSystem::AdvanceFrame(vec2i *window_size) {
 #endif
       case SDL_MOUSEBUTTONDOWN:
       case SDL_MOUSEBUTTONUP: {
-        GetPointerButton(event.button.button - 1)
-            .Update(event.button.state == SDL_PRESSED);
+        UpdateButton(event.button.button - 1 + SDLK_POINTER1,
+                     event.button.state == SDL_PRESSED);
+        NoteInputTime(event.button.timestamp);
         pointers_[0].mousepos = vec2i(event.button.x, event.button.y);
         pointers_[0].used = true;
 #ifdef ANDROID_CARDBOARD
@@ -219,19 +226,18 @@ void InputSystem::HandleJoystickEvent(SDL_Event event) {
     case SDL_JOYAXISMOTION:
       // Axis data is normalized to a range of [-1.0, 1.0]
       GetJoystick(event.jaxis.which)
-          .GetAxis(event.jaxis.axis)
-          .Update(event.jaxis.value / kJoystickAxisRange);
+          .UpdateAxis(event.jaxis.axis, event.jaxis.value / kJoystickAxisRange);
       break;
     case SDL_JOYBUTTONDOWN:
     case SDL_JOYBUTTONUP:
       GetJoystick(event.jbutton.which)
-          .GetButton(event.jbutton.button)
-          .Update(event.jbutton.state == SDL_PRESSED);
+          .UpdateButton(event.jbutton.button,
+                        event.jbutton.state == SDL_PRESSED);
+      NoteInputTime(event.jbutton.timestamp);
       break;
     case SDL_JOYHATMOTION:
       GetJoystick(event.jhat.which)
-          .GetHat(event.jhat.hat)
-          .Update(ConvertHatToVector(event.jhat.value));
+          .UpdateHat(event.jhat.hat, ConvertHatToVector(event.jhat.value));
       break;
   }
 }
@@ -274,27 +280,51 @@ float InputSystem::DeltaTime() const {
   return frame_time_ / static_cast<float>(kMillisecondsPerSecond);
 }
 
+size_t InputSystem::ButtonIndex(int button) {
+  if (button >= SDLK_PAD_UP && button < kDirectKeyCount) {
+    return static_cast<size_t>(button - SDLK_PAD_UP);
+  }
+  const int scancode = button & ~SDLK_SCANCODE_MASK;
+  if (button > 0 && (button & SDLK_SCANCODE_MASK) != 0 &&
+      scancode < SDL_NUM_SCANCODES) {
+    return static_cast<size_t>(kDirectKeyCount - SDLK_PAD_UP + scancode);
+  }
+  auto it = other_button_indices_.find(button);
+  if (it != other_button_indices_.end()) return it->second;
+  buttons_.push_back(Button());
+  return other_button_indices_[button] = buttons_.size() - 1;
+}
+
 Button &InputSystem::GetButton(int button) {
-  auto it = button_map_.find(button);
-  return it != button_map_.end() ? it->second
-                                 : (button_map_[button] = Button());
+  return buttons_[ButtonIndex(button)];
+}
+
+void InputSystem::UpdateButton(int button, bool down) {
+  const size_t index = ButtonIndex(button);
+  if (buttons_[index].Update(down)) changed_buttons_.push_back(index);
+}
+
+void InputSystem::NoteInputTime(uint32_t timestamp) {
+  if (oldest_input_time_ == 0 || timestamp < oldest_input_time_) {
+    oldest_input_time_ = timestamp;
+  }
 }
 
 Joystick &InputSystem::GetJoystick(SDL_JoystickID joystick_id) {
-  auto it = joystick_map_.find(joystick_id);
-  assert(it != joystick_map_.end());
-  return it->second;
+  auto it = joysticks_.begin();
+  while (it != joysticks_.end() && it->GetJoystickId() != joystick_id) ++it;
+  assert(it != joysticks_.end());
+  return *it;
 }
 #ifdef ANDROID_GAMEPAD
 Gamepad &InputSystem::GetGamepad(AndroidInputDeviceId gamepad_device_id) {
-  auto it = gamepad_map_.find(gamepad_device_id);
-  if (it == gamepad_map_.end()) {
-    Gamepad &gamepad = gamepad_map_[gamepad_device_id];
-    gamepad.set_controller_id(gamepad_device_id);
-    return gamepad;
-  } else {
-    return it->second;
+  for (auto it = gamepads_.begin(); it != gamepads_.end(); ++it) {
+    if (it->controller_id() == gamepad_device_id) return *it;
   }
+  gamepads_.push_back(Gamepad());
+  Gamepad &gamepad = gamepads_.back();
+  gamepad.set_controller_id(gamepad_device_id);
+  return gamepad;
 }
 #endif  // ANDROID_GAMEPAD
 
@@ -357,33 +387,36 @@ void InputSystem::OpenConnectedJoysticks() {
 
     // Create our Joystick structure, if it doesn't already exist for this
     // joystick_id. Note that our Joystick structure is never removed from
-    // the map.
+    // the list.
     SDL_JoystickID joystick_id = SDL_JoystickInstanceID(sdl_joystick);
-    auto it = joystick_map_.find(joystick_id);
-    if (it == joystick_map_.end()) {
-      joystick_map_[joystick_id] = Joystick();
+    auto it = joysticks_.begin();
+    while (it != joysticks_.end() && it->GetJoystickId() != joystick_id) ++it;
+    if (it == joysticks_.end()) {
+      joysticks_.push_back(Joystick(joystick_id));
+      it = joysticks_.end() - 1;
     }
 
     // Remember the SDL handle for this joystick.
-    joystick_map_[joystick_id].set_sdl_joystick(sdl_joystick);
+    it->set_sdl_joystick(sdl_joystick);
   }
 }
 
 void InputSystem::CloseOpenJoysticks() {
-  for (auto it = joystick_map_.begin(); it != joystick_map_.end(); ++it) {
-    Joystick &joystick = it->second;
-    SDL_JoystickClose(joystick.sdl_joystick());
-    joystick.set_sdl_joystick(nullptr);
+  for (auto it = joysticks_.begin(); it != joysticks_.end(); ++it) {
+    SDL_JoystickClose(it->sdl_joystick());
+    it->set_sdl_joystick(nullptr);
   }
 }
 
-void Button::Update(bool down) {
+bool Button::Update(bool down) {
+  const bool had_changed = went_down_ || went_up_;
   if (!is_down_ && down) {
     went_down_ = true;
   } else if (is_down_ && !down) {
     went_up_ = true;
   }
   is_down_ = down;
+  return !had_changed && (went_down_ || went_up_);
 }
 
 Button &Joystick::GetButton(size_t button_index) {
@@ -407,21 +440,34 @@ JoystickHat &Joystick::GetHat(size_t hat_index) {
   return hat_list_[hat_index];
 }
 
-// Reset the per-frame input on all our sub-elements
+void Joystick::UpdateButton(size_t button_index, bool down) {
+  if (GetButton(button_index).Update(down)) {
+    changed_buttons_.push_back(button_index);
+  }
+}
+
+void Joystick::UpdateAxis(size_t axis_index, float value) {
+  if (GetAxis(axis_index).Update(value)) changed_axes_.push_back(axis_index);
+}
+
+void Joystick::UpdateHat(size_t hat_index, const vec2 &value) {
+  if (GetHat(hat_index).Update(value)) changed_hats_.push_back(hat_index);
+}
+
+// Reset the per-frame input on the sub-elements that changed.
 void Joystick::AdvanceFrame() {
-  for (size_t i = 0; i < button_list_.size(); i++) {
-    button_list_[i].AdvanceFrame();
+  for (size_t i = 0; i < changed_buttons_.size(); i++) {
+    button_list_[changed_buttons_[i]].AdvanceFrame();
   }
-  for (size_t i = 0; i < axis_list_.size(); i++) {
-    axis_list_[i].AdvanceFrame();
+  for (size_t i = 0; i < changed_axes_.size(); i++) {
+    axis_list_[changed_axes_[i]].AdvanceFrame();
   }
-  for (size_t i = 0; i < hat_list_.size(); i++) {
-    hat_list_[i].AdvanceFrame();
+  for (size_t i = 0; i < changed_hats_.size(); i++) {
+    hat_list_[changed_hats_[i]].AdvanceFrame();
   }
-}
-
-SDL_JoystickID Joystick::GetJoystickId() const {
-  return SDL_JoystickInstanceID(sdl_joystick_);
+  changed_buttons_.clear();
+  changed_axes_.clear();
+  changed_hats_.clear();
 }
 
 int Joystick::GetNumButtons() const {
@@ -462,14 +508,14 @@ void InputSystem::HandleGamepadEvents() {
         button_index = static_cast<Gamepad::GamepadInputButton>(
             Gamepad::GetGamepadCodeFromJavaKeyCode(event.control_code));
         if (button_index != Gamepad::kInvalid) {
-          gamepad.GetButton(button_index).Update(true);
+          gamepad.UpdateButton(button_index, true);
         }
         break;
       case AKEY_EVENT_ACTION_UP:
         button_index = static_cast<Gamepad::GamepadInputButton>(
             Gamepad::GetGamepadCodeFromJavaKeyCode(event.control_code));
         if (button_index != Gamepad::kInvalid) {
-          gamepad.GetButton(button_index).Update(false);
+          gamepad.UpdateButton(button_index, false);
         }
         break;
       case AMOTION_EVENT_ACTION_MOVE:
@@ -478,10 +524,10 @@ void InputSystem::HandleGamepadEvents() {
         const bool up = event.y < -kGamepadHatThreshold;
         const bool down = event.y > kGamepadHatThreshold;
 
-        gamepad.GetButton(Gamepad::kLeft).Update(left);
-        gamepad.GetButton(Gamepad::kRight).Update(right);
-        gamepad.GetButton(Gamepad::kUp).Update(up);
-        gamepad.GetButton(Gamepad::kDown).Update(down);
+        gamepad.UpdateButton(Gamepad::kLeft, left);
+        gamepad.UpdateButton(Gamepad::kRight, right);
+        gamepad.UpdateButton(Gamepad::kUp, up);
+        gamepad.UpdateButton(Gamepad::kDown, down);
         break;
     }
   }
@@ -490,11 +536,16 @@ void InputSystem::HandleGamepadEvents() {
   pthread_mutex_unlock(&android_event_mutex);
 }
 
-// Reset the per-frame input on all our sub-elements
+// Reset the per-frame input on the buttons that changed.
 void Gamepad::AdvanceFrame() {
-  for (size_t i = 0; i < button_list_.size(); i++) {
-    button_list_[i].AdvanceFrame();
+  for (size_t i = 0; i < changed_buttons_.size(); i++) {
+    button_list_[changed_buttons_[i]].AdvanceFrame();
   }
+  changed_buttons_.clear();
+}
+
+void Gamepad::UpdateButton(GamepadInputButton i, bool down) {
+  if (GetButton(i).Update(down)) changed_buttons_.push_back(i);
 }
 
 Button &Gamepad::GetButton(GamepadInputButton index) {
@@ -569,16 +620,53 @@ void CardboardInput::ResetHeadTracker() {
 #endif  // __ANDROID__
 }
 
+// Predictions are skipped when the last two gyroscope samples are further
+// apart than this, in ns, since the head's speed is no longer known.
+static const int64_t kMaxPoseInterval = 100000000;
+// Samples older than this, in ns, are assumed to be on another clock.
+static const int64_t kMaxPoseAge = 100000000;
+// The most the head is turned by a prediction, in radians.
+static const float kMaxPredictionAngle = 0.35f;
+
+#ifdef __ANDROID__
+// Now on the clock Android stamps sensor events with.
+static int64_t SensorClockNow() {
+  timespec now;
+  clock_gettime(CLOCK_BOOTTIME, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+#endif  // __ANDROID__
+
+static mat3 RotationOf(const mat4 &view) {
+  mat3 rotation;
+  for (int row = 0; row < 3; ++row) {
+    for (int col = 0; col < 3; ++col) rotation(row, col) = view(row, col);
+  }
+  return rotation;
+}
+
+// Turn the head further by 'rotation', in head space. The eye view's
+// translation is kept, since it's mostly the eye's offset from the head.
+static mat4 RotateEyeView(const mat3 &rotation, const mat4 &view) {
+  const mat3 rotated = rotation * RotationOf(view);
+  mat4 result = view;
+  for (int row = 0; row < 3; ++row) {
+    for (int col = 0; col < 3; ++col) result(row, col) = rotated(row, col);
+  }
+  return result;
+}
+
 void CardboardInput::UpdateCardboardTransforms() {
 #ifdef __ANDROID__
   JNIEnv *env = reinterpret_cast<JNIEnv *>(SDL_AndroidGetJNIEnv());
   jobject activity = reinterpret_cast<jobject>(SDL_AndroidGetActivity());
   jclass fpl_class = env->GetObjectClass(activity);
   jmethodID get_eye_views =
-      env->GetMethodID(fpl_class, "GetEyeViews", "([F[F)V");
+      env->GetMethodID(fpl_class, "GetEyeViews", "([F[F)J");
   jfloatArray left_eye = env->NewFloatArray(16);
   jfloatArray right_eye = env->NewFloatArray(16);
-  env->CallVoidMethod(activity, get_eye_views, left_eye, right_eye);
+  const int64_t sample_time =
+      env->CallLongMethod(activity, get_eye_views, left_eye, right_eye);
   jfloat *left_eye_floats = env->GetFloatArrayElements(left_eye, NULL);
   jfloat *right_eye_floats = env->GetFloatArrayElements(right_eye, NULL);
   left_eye_transform_ = mat4(left_eye_floats);
@@ -589,7 +677,39 @@ void CardboardInput::UpdateCardboardTransforms() {
   env->DeleteLocalRef(right_eye);
   env->DeleteLocalRef(fpl_class);
   env->DeleteLocalRef(activity);
+
+  // Both eyes turn with the head, so either one has its rotation. Only a new
+  // gyroscope sample moves the history on; reading the same one twice in a
+  // frame would otherwise make the head look still.
+  if (sample_time != pose_time_) {
+    previous_rotation_ = raw_rotation_;
+    previous_pose_time_ = pose_time_;
+    raw_rotation_ = RotationOf(left_eye_transform_);
+    pose_time_ = sample_time;
+  }
+  const int64_t interval = pose_time_ - previous_pose_time_;
+  int64_t age = SensorClockNow() - pose_time_;
+  if (age < 0 || age > kMaxPoseAge) age = 0;
+  if (prediction_time_ > 0.0f && previous_pose_time_ != 0 && pose_time_ != 0 &&
+      interval > 0 && interval <= kMaxPoseInterval) {
+    // The turn between the last two samples, as an angle about an axis, is
+    // extrapolated over the time from the newest one to the display.
+    typedef mathfu::Quaternion<float> Quat;
+    const Quat turn =
+        Quat::FromMatrix(raw_rotation_ * previous_rotation_.Transpose());
+    float angle;
+    mathfu::vec3 axis;
+    turn.ToAngleAxis(&angle, &axis);
+    if (angle > static_cast<float>(M_PI)) angle -= 2.0f * M_PI;
+    const float ahead = (age + prediction_time_ * 1000000.0f) / interval;
+    const float predicted =
+        mathfu::Clamp(angle * ahead, -kMaxPredictionAngle, kMaxPredictionAngle);
+    const mat3 prediction = Quat::FromAngleAxis(predicted, axis).ToMatrix();
+    left_eye_transform_ = RotateEyeView(prediction, left_eye_transform_);
+    right_eye_transform_ = RotateEyeView(prediction, right_eye_transform_);
+  }
 #endif  // __ANDROID__
+  transforms_time_ = SDL_GetTicks();
 }
 
 void InputSystem::OnCardboardTrigger() {
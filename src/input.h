@@ -33,6 +33,7 @@ namespace fpl {
 
 using mathfu::vec2;
 using mathfu::vec2i;
+using mathfu::mat3;
 using mathfu::mat4;
 
 #ifdef ANDROID_GAMEPAD
@@ -45,7 +46,9 @@ class Button {
  public:
   Button() : is_down_(false) { AdvanceFrame(); }
   void AdvanceFrame() { went_down_ = went_up_ = false; }
-  void Update(bool down);
+  // Returns true if this is the first change since AdvanceFrame(), i.e. the
+  // button now needs its AdvanceFrame() called.
+  bool Update(bool down);
 
   bool is_down() const { return is_down_; }
   bool went_down() const { return went_down_; }
@@ -96,7 +99,12 @@ class JoystickAxis {
  public:
   JoystickAxis() : value_(0), previous_value_(0) {}
   void AdvanceFrame() { previous_value_ = value_; }
-  void Update(float new_value) { value_ = new_value; }
+  // Returns true if the axis hadn't moved since AdvanceFrame().
+  bool Update(float new_value) {
+    const bool was_still = value_ == previous_value_;
+    value_ = new_value;
+    return was_still;
+  }
   float Value() const { return value_; }
   float PreviousValue() const { return previous_value_; }
 
@@ -110,7 +118,13 @@ class JoystickHat {
  public:
   JoystickHat() : value_(mathfu::kZeros2f), previous_value_(mathfu::kZeros2f) {}
   void AdvanceFrame() { previous_value_ = value_; }
-  void Update(const vec2 &new_value) { value_ = new_value; }
+  // Returns true if the hat hadn't moved since AdvanceFrame().
+  bool Update(const vec2 &new_value) {
+    const bool was_still = value_.x() == previous_value_.x() &&
+                           value_.y() == previous_value_.y();
+    value_ = new_value;
+    return was_still;
+  }
   const vec2 &Value() const { return value_; }
   vec2 PreviousValue() const { return previous_value_; }
 
@@ -121,23 +135,35 @@ class JoystickHat {
 
 class Joystick {
  public:
+  explicit Joystick(SDL_JoystickID joystick_id)
+      : sdl_joystick_(nullptr), joystick_id_(joystick_id) {}
   // Get a Button object for a pointer index.
   Button &GetButton(size_t button_index);
   JoystickAxis &GetAxis(size_t axis_index);
   JoystickHat &GetHat(size_t hat_index);
+  // Change a button, axis or hat, remembering it so AdvanceFrame() only
+  // visits what changed.
+  void UpdateButton(size_t button_index, bool down);
+  void UpdateAxis(size_t axis_index, float value);
+  void UpdateHat(size_t hat_index, const vec2 &value);
   void AdvanceFrame();
   SDL_Joystick *sdl_joystick() { return sdl_joystick_; }
   void set_sdl_joystick(SDL_Joystick *joy) { sdl_joystick_ = joy; }
-  SDL_JoystickID GetJoystickId() const;
+  SDL_JoystickID GetJoystickId() const { return joystick_id_; }
   int GetNumButtons() const;
   int GetNumAxes() const;
   int GetNumHats() const;
 
  private:
   SDL_Joystick *sdl_joystick_;
+  SDL_JoystickID joystick_id_;
   std::vector<JoystickAxis> axis_list_;
   std::vector<Button> button_list_;
   std::vector<JoystickHat> hat_list_;
+  // Indices of what changed since AdvanceFrame().
+  std::vector<size_t> changed_axes_;
+  std::vector<size_t> changed_buttons_;
+  std::vector<size_t> changed_hats_;
 };
 
 #ifdef ANDROID_GAMEPAD
@@ -158,15 +184,18 @@ class Gamepad {
     kControlCount
   };
 
-  Gamepad() { button_list_.resize(Gamepad::kControlCount); }
+  Gamepad() : controller_id_(0) {}
 
   void AdvanceFrame();
   Button &GetButton(GamepadInputButton i);
   const Button &GetButton(GamepadInputButton i) const {
     return const_cast<Gamepad *>(this)->GetButton(i);
   }
+  // Change a button, remembering it so AdvanceFrame() only visits buttons
+  // that changed.
+  void UpdateButton(GamepadInputButton i, bool down);
 
-  AndroidInputDeviceId controller_id() { return controller_id_; }
+  AndroidInputDeviceId controller_id() const { return controller_id_; }
   void set_controller_id(AndroidInputDeviceId controller_id) {
     controller_id_ = controller_id;
   }
@@ -175,7 +204,8 @@ class Gamepad {
 
  private:
   AndroidInputDeviceId controller_id_;
-  std::vector<Button> button_list_;
+  Button button_list_[kControlCount];
+  std::vector<GamepadInputButton> changed_buttons_;
 };
 
 const float kGamepadHatThreshold = 0.5f;
@@ -206,6 +236,12 @@ class CardboardInput {
   CardboardInput()
       : left_eye_transform_(),
         right_eye_transform_(),
+        transforms_time_(0),
+        raw_rotation_(mat3::Identity()),
+        previous_rotation_(mat3::Identity()),
+        pose_time_(0),
+        previous_pose_time_(0),
+        prediction_time_(0.0f),
         is_in_cardboard_(false),
         triggered_(false),
         pending_trigger_(false) {}
@@ -218,6 +254,8 @@ class CardboardInput {
 
   const mat4 &left_eye_transform() const { return left_eye_transform_; }
   const mat4 &right_eye_transform() const { return right_eye_transform_; }
+  // SDL_GetTicks() time the eye transforms were read from the head tracker.
+  uint32_t transforms_time() const { return transforms_time_; }
 
   void AdvanceFrame();
   void OnCardboardTrigger() { pending_trigger_ = true; }
@@ -225,11 +263,31 @@ class CardboardInput {
   // Realign the head tracking with the current phone heading
   void ResetHeadTracker();
 
- private:
+  // Read the eye transforms from the head tracker again. AdvanceFrame() does
+  // this too; call it again right before drawing, so the view lags the head
+  // by as little as possible.
+  //
+  // The transforms are predicted forward from the time of the gyroscope
+  // sample they're based on to prediction_time() ms from now, by how fast the
+  // head turned between the last two samples.
   void UpdateCardboardTransforms();
 
+  // How long, in ms, from reading the transforms to the frame reaching the
+  // screen. Zero uses the transforms as the head tracker gives them.
+  float prediction_time() const { return prediction_time_; }
+  void set_prediction_time(float ms) { prediction_time_ = ms; }
+
+ private:
   mat4 left_eye_transform_;
   mat4 right_eye_transform_;
+  uint32_t transforms_time_;
+  // The head tracker's rotation as of the last two gyroscope samples, and the
+  // sensor clock times of those samples, in ns.
+  mat3 raw_rotation_;
+  mat3 previous_rotation_;
+  int64_t pose_time_;
+  int64_t previous_pose_time_;
+  float prediction_time_;
   bool is_in_cardboard_;
   bool triggered_;
   bool pending_trigger_;
@@ -246,8 +304,10 @@ class InputSystem {
         start_time_(0),
         frames_(0),
         minimized_frame_(0),
-        mousewheel_delta_(mathfu::kZeros2i) {
+        mousewheel_delta_(mathfu::kZeros2i),
+        oldest_input_time_(0) {
     pointers_.assign(kMaxSimultanuousPointers, Pointer());
+    buttons_.assign(kDirectButtonCount, Button());
   }
 
   static const int kMaxSimultanuousPointers = 10;  // All current touch screens.
@@ -266,25 +326,24 @@ class InputSystem {
   float DeltaTime() const;
 
   // Get a Button object describing the current input state (see SDLK_ enum
-  // above.
+  // above. Getting a key outside the usual SDL keycodes for the first time
+  // may move the other Buttons, so don't hold on to the reference.
   Button &GetButton(int button);
 
   // Get a joystick object describing the current input state of the specified
   // joystick ID.  (Contained in every joystick event.)
   Joystick &GetJoystick(SDL_JoystickID joystick_id);
 
-  const std::map<SDL_JoystickID, Joystick> &JoystickMap() const {
-    return joystick_map_;
-  }
+  // Every joystick that has been connected, in the order they were.
+  const std::vector<Joystick> &joysticks() const { return joysticks_; }
 
 #ifdef ANDROID_GAMEPAD
   // Returns an object describing a gamepad, based on the android device ID.
   // Get the ID either from an android event, or by checking a known gamepad.
   Gamepad &GetGamepad(AndroidInputDeviceId gamepad_device_id);
 
-  const std::map<AndroidInputDeviceId, Gamepad> &GamepadMap() const {
-    return gamepad_map_;
-  }
+  // Every gamepad we've had events from, in the order we first had them.
+  const std::vector<Gamepad> &gamepads() const { return gamepads_; }
 
   // Receives events from java, and stuffs them into a vector until we're ready.
   static void ReceiveGamepadEvent(int controller_id, int event_code,
@@ -321,6 +380,12 @@ class InputSystem {
   int frames() const { return frames_; }
   vec2i mousewheel_delta() { return mousewheel_delta_; }
 
+  // SDL_GetTicks() time of the earliest key, pointer or joystick button
+  // press or release handled by the last AdvanceFrame(), or 0 if there were
+  // none. The difference from when the frame reacting to it is shown is the
+  // game's input latency.
+  uint32_t oldest_input_time() const { return oldest_input_time_; }
+
  private:
   std::vector<SDL_Joystick *> open_joystick_list;
   static int HandleAppEvents(void *userdata, SDL_Event *event);
@@ -329,6 +394,10 @@ class InputSystem {
                             const vec2i &window_size);
   void RemovePointer(size_t i);
   vec2 ConvertHatToVector(uint32_t hat_enum) const;
+  // Index of a button in buttons_, adding one for it if needed.
+  size_t ButtonIndex(int button);
+  void UpdateButton(int button, bool down);
+  void NoteInputTime(uint32_t timestamp);
   std::vector<AppEventCallback> app_event_callbacks_;
 
  public:
@@ -337,11 +406,24 @@ class InputSystem {
   std::vector<Pointer> pointers_;
 
  private:
-  std::map<int, Button> button_map_;
-  std::map<SDL_JoystickID, Joystick> joystick_map_;
+  // Pointer and pad buttons, then ASCII keys, then SDL's keycodes for keys
+  // without characters, have fixed indices in buttons_. Other keys are added
+  // after them when first seen.
+  static const int kDirectKeyCount = 128;
+  static const int kDirectButtonCount =
+      kDirectKeyCount - SDLK_PAD_UP + SDL_NUM_SCANCODES;
+
+  // Every button, indexed by ButtonIndex(), and the indices of those that
+  // changed since AdvanceFrame().
+  std::vector<Button> buttons_;
+  std::vector<size_t> changed_buttons_;
+  std::map<int, size_t> other_button_indices_;
+
+  // There are only ever a few of these, so they're found by a linear search.
+  std::vector<Joystick> joysticks_;
 
 #ifdef ANDROID_GAMEPAD
-  std::map<AndroidInputDeviceId, Gamepad> gamepad_map_;
+  std::vector<Gamepad> gamepads_;
   static pthread_mutex_t android_event_mutex;
   static std::queue<AndroidInputEvent> unhandled_java_input_events_;
 #endif  // ANDROID_GAMEPAD
@@ -369,6 +451,9 @@ class InputSystem {
   // Accumulated mousewheel delta since the last frame.
   vec2i mousewheel_delta_;
 
+  // See oldest_input_time().
+  uint32_t oldest_input_time_;
+
  public:
   static const int kMillisecondsPerSecond = 1000;
 };
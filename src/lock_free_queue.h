@@ -0,0 +1,131 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FPL_LOCK_FREE_QUEUE_H
+#define FPL_LOCK_FREE_QUEUE_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+namespace fpl {
+
+// A fixed size FIFO that any number of threads can push to and pop from at
+// the same time, without taking a lock.
+//
+// Each slot carries a sequence number that says whether it is waiting for a
+// push or a pop in the current lap around the ring. A thread claims a slot by
+// advancing the shared head or tail with a compare-and-swap, then publishes
+// it by bumping the slot's sequence number. See Dmitry Vyukov's "Bounded
+// MPMC queue" for the details.
+//
+// T must be default constructible and copy assignable.
+template <typename T>
+class LockFreeQueue {
+ public:
+  // 'capacity' must be a power of two.
+  explicit LockFreeQueue(size_t capacity)
+      : cells_(capacity), mask_(capacity - 1), tail_(0), head_(0) {
+    assert(capacity >= 2 && (capacity & mask_) == 0);
+    for (size_t i = 0; i < capacity; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Append 'value'. Returns false, leaving the queue unchanged, if full.
+  bool TryPush(const T& value) {
+    size_t pos = tail_.index.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell& cell = cells_[pos & mask_];
+      const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      const ptrdiff_t lap =
+          static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(pos);
+      if (lap == 0) {
+        if (tail_.index.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          cell.value = value;
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (lap < 0) {
+        return false;
+      } else {
+        pos = tail_.index.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Remove the oldest value into 'value'. Returns false if empty.
+  bool TryPop(T* value) {
+    size_t pos = head_.index.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell& cell = cells_[pos & mask_];
+      const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      const ptrdiff_t lap =
+          static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(pos + 1);
+      if (lap == 0) {
+        if (head_.index.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          *value = cell.value;
+          cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (lap < 0) {
+        return false;
+      } else {
+        pos = head_.index.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  size_t capacity() const { return cells_.size(); }
+
+ private:
+  struct Cell {
+    Cell() : sequence(0), value() {}
+    // std::vector needs this to size cells_. Only called on construction,
+    // before any other thread can see the queue.
+    Cell(const Cell& rhs)
+        : sequence(rhs.sequence.load(std::memory_order_relaxed)),
+          value(rhs.value) {}
+
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  LockFreeQueue(const LockFreeQueue&);
+  LockFreeQueue& operator=(const LockFreeQueue&);
+
+  std::vector<Cell> cells_;
+  const size_t mask_;
+
+  // Keep the producer and consumer ends on separate cache lines, so pushes
+  // and pops don't invalidate each other.
+  static const size_t kCacheLineSize = 64;
+  struct PaddedIndex {
+    PaddedIndex(size_t initial) : index(initial) {}
+    char before[kCacheLineSize];
+    std::atomic<size_t> index;
+    char after[kCacheLineSize - sizeof(std::atomic<size_t>)];
+  };
+
+  PaddedIndex tail_;
+  PaddedIndex head_;
+};
+
+}  // namespace fpl
+
+#endif  // FPL_LOCK_FREE_QUEUE_H
@@ -0,0 +1,327 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "loopback_transport.h"
+#include <algorithm>
+
+namespace fpl {
+
+LoopbackNetwork::LoopbackNetwork()
+    : mutex_(SDL_CreateMutex()), now_(0), next_order_(0), random_state_(1) {}
+
+LoopbackNetwork::~LoopbackNetwork() {
+  while (!events_.empty()) {
+    delete events_.top();
+    events_.pop();
+  }
+  for (size_t i = 0; i < free_events_.size(); ++i) delete free_events_[i];
+  SDL_DestroyMutex(mutex_);
+}
+
+void LoopbackNetwork::set_conditions(const NetworkConditions& conditions) {
+  SDL_LockMutex(mutex_);
+  conditions_ = conditions;
+  SDL_UnlockMutex(mutex_);
+}
+
+void LoopbackNetwork::set_seed(uint32_t seed) {
+  SDL_LockMutex(mutex_);
+  // Xorshift never leaves 0.
+  random_state_ = seed != 0 ? seed : 1;
+  SDL_UnlockMutex(mutex_);
+}
+
+LoopbackNetwork::Stats LoopbackNetwork::stats() {
+  SDL_LockMutex(mutex_);
+  const Stats stats = stats_;
+  SDL_UnlockMutex(mutex_);
+  return stats;
+}
+
+uint32_t LoopbackNetwork::Random(uint32_t range) {
+  random_state_ ^= random_state_ << 13;
+  random_state_ ^= random_state_ >> 17;
+  random_state_ ^= random_state_ << 5;
+  return random_state_ % range;
+}
+
+LoopbackNetwork::Event* LoopbackNetwork::NewEvent(EventType type,
+                                                  const std::string& to,
+                                                  const std::string& from,
+                                                  uint32_t delay) {
+  Event* event;
+  if (free_events_.empty()) {
+    event = new Event();
+  } else {
+    event = free_events_.back();
+    free_events_.pop_back();
+  }
+  event->time = now_ + delay;
+  event->order = next_order_++;
+  event->type = type;
+  event->to = to;
+  event->from = from;
+  event->name.clear();
+  event->flag = false;
+  event->payload.clear();
+  events_.push(event);
+  return event;
+}
+
+void LoopbackNetwork::SendMessage(const std::string& from,
+                                  const std::string& to,
+                                  const std::vector<uint8_t>& payload,
+                                  bool reliable) {
+  stats_.messages_sent++;
+  stats_.bytes_sent += payload.size();
+  auto link_it = links_.find(LinkId(from, to));
+  if (link_it == links_.end()) {
+    stats_.messages_dropped++;
+    return;
+  }
+  Link& link = link_it->second;
+
+  // Messages that get lost still take their time on the air.
+  uint32_t sent = now_;
+  if (conditions_.bytes_per_second > 0) {
+    link.busy_until = std::max(link.busy_until, now_) +
+                      static_cast<uint32_t>(payload.size() * 1000ULL /
+                                            conditions_.bytes_per_second);
+    sent = link.busy_until;
+  }
+  if (!reliable && conditions_.loss > 0.0f &&
+      Random(1000000) < conditions_.loss * 1000000.0f) {
+    stats_.messages_dropped++;
+    return;
+  }
+  uint32_t arrival = sent + conditions_.latency;
+  if (conditions_.jitter > 0) arrival += Random(conditions_.jitter + 1);
+  if (reliable) {
+    arrival = std::max(arrival, link.last_reliable);
+    link.last_reliable = arrival;
+  }
+  Event* event = NewEvent(kMessage, to, from, arrival - now_);
+  event->flag = reliable;
+  event->payload = payload;
+}
+
+void LoopbackNetwork::Connect(const std::string& a, const std::string& b) {
+  links_[LinkId(a, b)] = Link();
+  links_[LinkId(b, a)] = Link();
+}
+
+bool LoopbackNetwork::Disconnect(const std::string& a, const std::string& b) {
+  const bool connected = links_.erase(LinkId(a, b)) != 0;
+  links_.erase(LinkId(b, a));
+  return connected;
+}
+
+void LoopbackNetwork::Update(uint32_t now) {
+  SDL_LockMutex(mutex_);
+  now_ = now;
+  due_events_.clear();
+  while (!events_.empty() && events_.top()->time <= now) {
+    due_events_.push_back(events_.top());
+    events_.pop();
+  }
+  SDL_UnlockMutex(mutex_);
+
+  // The listeners may call back into the network, so it isn't locked while
+  // they run.
+  for (size_t i = 0; i < due_events_.size(); ++i) {
+    const Event& event = *due_events_[i];
+    SDL_LockMutex(mutex_);
+    auto endpoint = endpoints_.find(event.to);
+    Listener* listener =
+        endpoint != endpoints_.end() ? endpoint->second->listener_ : nullptr;
+    if (event.type == kMessage) {
+      // Messages in flight to an instance that's gone are lost.
+      if (listener == nullptr || !IsConnected(event.from, event.to)) {
+        listener = nullptr;
+        stats_.messages_dropped++;
+      } else {
+        stats_.messages_delivered++;
+      }
+    }
+    SDL_UnlockMutex(mutex_);
+    if (listener == nullptr) continue;
+
+    switch (event.type) {
+      case kAdvertisingResult:
+        listener->OnAdvertisingResult(event.flag, event.name);
+        break;
+      case kConnectionRequest:
+        listener->OnConnectionRequest(event.from, event.name);
+        break;
+      case kEndpointFound:
+        listener->OnEndpointFound(event.from, event.name);
+        break;
+      case kEndpointLost:
+        listener->OnEndpointLost(event.from);
+        break;
+      case kConnectionResponse:
+        listener->OnConnectionResponse(event.from, event.flag);
+        break;
+      case kMessage:
+        listener->OnMessageReceived(event.from, event.payload, event.flag);
+        break;
+      case kDisconnected:
+        listener->OnDisconnected(event.from);
+        break;
+    }
+  }
+
+  SDL_LockMutex(mutex_);
+  free_events_.insert(free_events_.end(), due_events_.begin(),
+                      due_events_.end());
+  SDL_UnlockMutex(mutex_);
+}
+
+LoopbackTransport::LoopbackTransport(LoopbackNetwork* network,
+                                     const std::string& instance_id)
+    : network_(network),
+      instance_id_(instance_id),
+      advertising_(false),
+      discovering_(false) {
+  SDL_LockMutex(network_->mutex_);
+  assert(network_->endpoints_.count(instance_id_) == 0);
+  network_->endpoints_[instance_id_] = this;
+  SDL_UnlockMutex(network_->mutex_);
+}
+
+LoopbackTransport::~LoopbackTransport() {
+  StopAdvertising();
+  SDL_LockMutex(network_->mutex_);
+  network_->endpoints_.erase(instance_id_);
+  // Whoever we're connected to sees us disconnect.
+  for (auto it = network_->endpoints_.begin();
+       it != network_->endpoints_.end(); ++it) {
+    if (network_->Disconnect(instance_id_, it->first)) {
+      network_->NewEvent(LoopbackNetwork::kDisconnected, it->first,
+                         instance_id_, network_->conditions_.latency);
+    }
+  }
+  SDL_UnlockMutex(network_->mutex_);
+}
+
+void LoopbackTransport::StartAdvertising(
+    const std::string& name,
+    const std::vector<std::string>& /*app_identifiers*/) {
+  SDL_LockMutex(network_->mutex_);
+  advertising_ = true;
+  advertised_name_ = name;
+  LoopbackNetwork::Event* result = network_->NewEvent(
+      LoopbackNetwork::kAdvertisingResult, instance_id_, instance_id_, 0);
+  result->flag = true;
+  result->name = name;
+  for (auto it = network_->endpoints_.begin();
+       it != network_->endpoints_.end(); ++it) {
+    if (it->second == this || !it->second->discovering_) continue;
+    network_->NewEvent(LoopbackNetwork::kEndpointFound, it->first,
+                       instance_id_, network_->conditions_.latency)
+        ->name = name;
+  }
+  SDL_UnlockMutex(network_->mutex_);
+}
+
+void LoopbackTransport::StopAdvertising() {
+  SDL_LockMutex(network_->mutex_);
+  if (advertising_) {
+    advertising_ = false;
+    for (auto it = network_->endpoints_.begin();
+         it != network_->endpoints_.end(); ++it) {
+      if (it->second == this || !it->second->discovering_) continue;
+      network_->NewEvent(LoopbackNetwork::kEndpointLost, it->first,
+                         instance_id_, network_->conditions_.latency);
+    }
+  }
+  SDL_UnlockMutex(network_->mutex_);
+}
+
+void LoopbackTransport::AcceptConnectionRequest(const std::string& client_id) {
+  SDL_LockMutex(network_->mutex_);
+  network_->Connect(instance_id_, client_id);
+  network_->NewEvent(LoopbackNetwork::kConnectionResponse, client_id,
+                     instance_id_, network_->conditions_.latency)
+      ->flag = true;
+  SDL_UnlockMutex(network_->mutex_);
+}
+
+void LoopbackTransport::RejectConnectionRequest(const std::string& client_id) {
+  SDL_LockMutex(network_->mutex_);
+  network_->NewEvent(LoopbackNetwork::kConnectionResponse, client_id,
+                     instance_id_, network_->conditions_.latency);
+  SDL_UnlockMutex(network_->mutex_);
+}
+
+void LoopbackTransport::StartDiscovery(const std::string& /*service_id*/) {
+  SDL_LockMutex(network_->mutex_);
+  discovering_ = true;
+  for (auto it = network_->endpoints_.begin();
+       it != network_->endpoints_.end(); ++it) {
+    if (it->second == this || !it->second->advertising_) continue;
+    network_->NewEvent(LoopbackNetwork::kEndpointFound, instance_id_,
+                       it->first, network_->conditions_.latency)
+        ->name = it->second->advertised_name_;
+  }
+  SDL_UnlockMutex(network_->mutex_);
+}
+
+void LoopbackTransport::StopDiscovery(const std::string& /*service_id*/) {
+  SDL_LockMutex(network_->mutex_);
+  discovering_ = false;
+  SDL_UnlockMutex(network_->mutex_);
+}
+
+void LoopbackTransport::SendConnectionRequest(const std::string& name,
+                                              const std::string& host_id) {
+  SDL_LockMutex(network_->mutex_);
+  auto host = network_->endpoints_.find(host_id);
+  if (host != network_->endpoints_.end() && host->second->advertising_) {
+    network_->NewEvent(LoopbackNetwork::kConnectionRequest, host_id,
+                       instance_id_, network_->conditions_.latency)
+        ->name = name;
+  } else {
+    // Nobody there to answer, so it's as good as rejected.
+    network_->NewEvent(LoopbackNetwork::kConnectionResponse, instance_id_,
+                       host_id, 2 * network_->conditions_.latency);
+  }
+  SDL_UnlockMutex(network_->mutex_);
+}
+
+void LoopbackTransport::Disconnect(const std::string& instance_id) {
+  SDL_LockMutex(network_->mutex_);
+  if (network_->Disconnect(instance_id_, instance_id)) {
+    network_->NewEvent(LoopbackNetwork::kDisconnected, instance_id,
+                       instance_id_, network_->conditions_.latency);
+  }
+  SDL_UnlockMutex(network_->mutex_);
+}
+
+void LoopbackTransport::SendReliableMessage(
+    const std::string& instance_id, const std::vector<uint8_t>& payload) {
+  SDL_LockMutex(network_->mutex_);
+  network_->SendMessage(instance_id_, instance_id, payload, true);
+  SDL_UnlockMutex(network_->mutex_);
+}
+
+void LoopbackTransport::SendUnreliableMessage(
+    const std::string& instance_id, const std::vector<uint8_t>& payload) {
+  SDL_LockMutex(network_->mutex_);
+  network_->SendMessage(instance_id_, instance_id, payload, false);
+  SDL_UnlockMutex(network_->mutex_);
+}
+
+}  // namespace fpl
@@ -0,0 +1,203 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef LOOPBACK_TRANSPORT_H
+#define LOOPBACK_TRANSPORT_H
+
+#include <map>
+#include <queue>
+#include <string>
+#include <vector>
+#include "multiplayer_transport.h"
+
+struct SDL_mutex;
+
+namespace fpl {
+
+class LoopbackTransport;
+
+// How bad the simulated radio is. The same on every link, in each direction.
+struct NetworkConditions {
+  NetworkConditions()
+      : latency(0), jitter(0), loss(0.0f), bytes_per_second(0) {}
+  // One way delay of every message and connection event, in milliseconds.
+  uint32_t latency;
+  // Each message is delayed by up to this many milliseconds more, chosen at
+  // random. Unreliable messages may overtake each other; reliable ones keep
+  // their order.
+  uint32_t jitter;
+  // Chance of dropping each unreliable message, from 0 to 1.
+  float loss;
+  // Messages queue up behind each other to be sent at this rate, or as fast
+  // as they're sent if 0.
+  uint32_t bytes_per_second;
+};
+
+// An in-process network that LoopbackTransports connect over, so a host and
+// many clients can run in one process, e.g. to load test them.
+//
+// Nothing arrives until Update() delivers it: every listener callback is
+// made from Update(), on the thread that calls it. Time is whatever the
+// caller says it is, so a test can run the network as fast as it likes.
+class LoopbackNetwork {
+ public:
+  struct Stats {
+    Stats()
+        : messages_sent(0),
+          messages_delivered(0),
+          messages_dropped(0),
+          bytes_sent(0) {}
+    uint64_t messages_sent;
+    uint64_t messages_delivered;
+    // Lost to NetworkConditions::loss, or sent to an instance that
+    // disconnected before they arrived.
+    uint64_t messages_dropped;
+    uint64_t bytes_sent;
+  };
+
+  LoopbackNetwork();
+  ~LoopbackNetwork();
+
+  // Takes effect for messages sent from now on.
+  void set_conditions(const NetworkConditions& conditions);
+  // Seed for the jitter and loss, so a run can be repeated.
+  void set_seed(uint32_t seed);
+
+  // Advance the network's clock to 'now', in milliseconds, and deliver
+  // everything due by then.
+  void Update(uint32_t now);
+
+  Stats stats();
+
+  // Longest payloads, as for Nearby Connections.
+  static const size_t kMaxReliableMessageLen = 4096;
+  static const size_t kMaxUnreliableMessageLen = 1168;
+
+ private:
+  friend class LoopbackTransport;
+
+  enum EventType {
+    kAdvertisingResult,
+    kConnectionRequest,
+    kEndpointFound,
+    kEndpointLost,
+    kConnectionResponse,
+    kMessage,
+    kDisconnected
+  };
+
+  // Something for a listener to hear about, when the clock reaches 'time'.
+  struct Event {
+    uint32_t time;
+    uint64_t order;  // Events due at the same time arrive in this order.
+    EventType type;
+    std::string to;
+    std::string from;
+    std::string name;  // for kAdvertisingResult, kConnectionRequest and
+                       // kEndpointFound
+    bool flag;         // accepted, or reliable
+    std::vector<uint8_t> payload;
+  };
+  struct LaterEvent {
+    bool operator()(const Event* a, const Event* b) const {
+      return a->time != b->time ? a->time > b->time : a->order > b->order;
+    }
+  };
+
+  // One direction of a connection.
+  struct Link {
+    Link() : busy_until(0), last_reliable(0) {}
+    // When the link has sent everything queued on it.
+    uint32_t busy_until;
+    // When the last reliable message sent on it arrives.
+    uint32_t last_reliable;
+  };
+  typedef std::pair<std::string, std::string> LinkId;  // from, to
+
+  // All of these must be called with mutex_ locked.
+  Event* NewEvent(EventType type, const std::string& to,
+                  const std::string& from, uint32_t delay);
+  void SendMessage(const std::string& from, const std::string& to,
+                   const std::vector<uint8_t>& payload, bool reliable);
+  void Connect(const std::string& a, const std::string& b);
+  // Returns false if they weren't connected.
+  bool Disconnect(const std::string& a, const std::string& b);
+  bool IsConnected(const std::string& from, const std::string& to) const {
+    return links_.find(LinkId(from, to)) != links_.end();
+  }
+  uint32_t Random(uint32_t range);
+
+  SDL_mutex* mutex_;
+  uint32_t now_;
+  uint64_t next_order_;
+  uint32_t random_state_;
+  NetworkConditions conditions_;
+  Stats stats_;
+  std::map<std::string, LoopbackTransport*> endpoints_;
+  std::map<LinkId, Link> links_;
+  std::priority_queue<Event*, std::vector<Event*>, LaterEvent> events_;
+  // Scratch space for Update(), and events kept to reuse their storage.
+  std::vector<Event*> due_events_;
+  std::vector<Event*> free_events_;
+};
+
+// A MultiplayerTransport over a LoopbackNetwork, as one instance on it.
+// Service IDs and app identifiers are ignored: every instance on the network
+// can find every other.
+class LoopbackTransport : public MultiplayerTransport {
+ public:
+  // Join 'network' as 'instance_id', which must be unique on it. The network
+  // must outlive the transport, and Update() must not be running when the
+  // transport is destroyed.
+  LoopbackTransport(LoopbackNetwork* network, const std::string& instance_id);
+  virtual ~LoopbackTransport();
+
+  const std::string& instance_id() const { return instance_id_; }
+
+  virtual void StartAdvertising(
+      const std::string& name,
+      const std::vector<std::string>& app_identifiers);
+  virtual void StopAdvertising();
+  virtual void AcceptConnectionRequest(const std::string& client_id);
+  virtual void RejectConnectionRequest(const std::string& client_id);
+  virtual void StartDiscovery(const std::string& service_id);
+  virtual void StopDiscovery(const std::string& service_id);
+  virtual void SendConnectionRequest(const std::string& name,
+                                     const std::string& host_id);
+  virtual void Disconnect(const std::string& instance_id);
+  virtual void SendReliableMessage(const std::string& instance_id,
+                                   const std::vector<uint8_t>& payload);
+  virtual void SendUnreliableMessage(const std::string& instance_id,
+                                     const std::vector<uint8_t>& payload);
+  virtual size_t MaxReliableMessageLen() const {
+    return LoopbackNetwork::kMaxReliableMessageLen;
+  }
+  virtual size_t MaxUnreliableMessageLen() const {
+    return LoopbackNetwork::kMaxUnreliableMessageLen;
+  }
+
+ private:
+  friend class LoopbackNetwork;
+
+  LoopbackNetwork* network_;
+  std::string instance_id_;
+  // These are guarded by the network's mutex.
+  bool advertising_;
+  bool discovering_;
+  std::string advertised_name_;
+};
+
+}  // namespace fpl
+
+#endif  // LOOPBACK_TRANSPORT_H
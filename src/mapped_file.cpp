@@ -0,0 +1,142 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "precompiled.h"
+#include "mapped_file.h"
+#include "asset_archive.h"
+#include "utilities.h"
+
+#if defined(__ANDROID__)
+#include <android/asset_manager.h>
+#include <android/asset_manager_jni.h>
+#include <jni.h>
+#endif  // defined(__ANDROID__)
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif  // !defined(_WIN32)
+
+namespace fpl {
+
+#if defined(__ANDROID__)
+// The activity's asset manager. The Java object is kept alive by a global
+// reference, since the native one is only valid while it is.
+static AAssetManager* GetAssetManager() {
+  static AAssetManager* asset_manager = nullptr;
+  if (asset_manager) return asset_manager;
+  JNIEnv* env = reinterpret_cast<JNIEnv*>(SDL_AndroidGetJNIEnv());
+  jobject activity = reinterpret_cast<jobject>(SDL_AndroidGetActivity());
+  jclass activity_class = env->GetObjectClass(activity);
+  jmethodID get_assets = env->GetMethodID(
+      activity_class, "getAssets", "()Landroid/content/res/AssetManager;");
+  jobject assets = env->CallObjectMethod(activity, get_assets);
+  asset_manager = AAssetManager_fromJava(env, env->NewGlobalRef(assets));
+  env->DeleteLocalRef(assets);
+  env->DeleteLocalRef(activity_class);
+  env->DeleteLocalRef(activity);
+  return asset_manager;
+}
+#endif  // defined(__ANDROID__)
+
+MappedFile::MappedFile()
+    : data_(nullptr),
+      size_(0),
+      mapping_(nullptr)
+#ifdef __ANDROID__
+      ,
+      asset_(nullptr)
+#endif  // __ANDROID__
+{
+}
+
+bool MappedFile::Open(const char* filename) {
+  Close();
+
+  // Prefer the packed archive, where uncompressed entries can be used in
+  // place.
+  const AssetArchive* archive = GetAssetArchive();
+  if (archive && archive->Contains(filename)) {
+    data_ = archive->FindUncompressed(filename, &size_);
+    if (data_) return true;
+    if (archive->Read(filename, &buffer_)) {
+      data_ = buffer_.data();
+      size_ = buffer_.size() - 1;
+      return true;
+    }
+    std::string().swap(buffer_);
+  }
+
+#if defined(__ANDROID__)
+  // Relative paths are files in the APK, which is where SDL_RWFromFile would
+  // look for them too.
+  if (filename[0] != '/') {
+    asset_ = AAssetManager_open(GetAssetManager(), filename,
+                                AASSET_MODE_BUFFER);
+    if (asset_) {
+      data_ = AAsset_getBuffer(asset_);
+      size_ = static_cast<size_t>(AAsset_getLength(asset_));
+      if (data_ && size_ > 0) return true;
+      Close();
+    }
+  }
+#endif  // defined(__ANDROID__)
+
+#if !defined(_WIN32)
+  const int fd = open(filename, O_RDONLY);
+  if (fd >= 0) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void* mapping = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                           MAP_PRIVATE, fd, 0);
+      if (mapping != MAP_FAILED) {
+        mapping_ = mapping;
+        data_ = mapping;
+        size_ = static_cast<size_t>(st.st_size);
+      }
+    }
+    close(fd);
+    if (data_) return true;
+  }
+#endif  // !defined(_WIN32)
+
+  // LoadFile logs the failure for us.
+  if (!LoadFile(filename, &buffer_)) {
+    std::string().swap(buffer_);
+    return false;
+  }
+  // Leave off the terminator that LoadFile appends.
+  data_ = buffer_.data();
+  size_ = buffer_.size() - 1;
+  return true;
+}
+
+void MappedFile::Close() {
+#if !defined(_WIN32)
+  if (mapping_) munmap(mapping_, size_);
+#endif  // !defined(_WIN32)
+  mapping_ = nullptr;
+#if defined(__ANDROID__)
+  if (asset_) AAsset_close(asset_);
+  asset_ = nullptr;
+#endif  // defined(__ANDROID__)
+  std::string().swap(buffer_);
+  data_ = nullptr;
+  size_ = 0;
+}
+
+}  // namespace fpl
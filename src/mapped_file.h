@@ -0,0 +1,69 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FPL_MAPPED_FILE_H
+#define FPL_MAPPED_FILE_H
+
+#include <string>
+#include "common.h"
+
+#ifdef __ANDROID__
+struct AAsset;
+#endif  // __ANDROID__
+
+namespace fpl {
+
+// Read-only view of a whole file, used in place rather than copied.
+//
+// Files in the asset archive (see asset_archive.h) are used straight out of
+// the archive's mapping, unless they're compressed.
+//
+// On Linux and OS X the file is mapped with mmap. On Android, files in the
+// APK are opened through the asset manager, which maps them too when they're
+// stored uncompressed. Elsewhere, or when mapping fails, the file is read into
+// a buffer owned by this object instead.
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile() { Close(); }
+
+  // Map 'filename', closing any file that was open before. Returns false,
+  // and logs an error, if it can't be read or is empty.
+  bool Open(const char* filename);
+
+  // Release the file. data() is nullptr afterwards.
+  void Close();
+
+  // The contents of the file, valid until Close() or Open() is called.
+  const void* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(MappedFile);
+
+  const void* data_;
+  size_t size_;
+
+  // Whichever of these holds the memory in data_.
+  void* mapping_;
+#ifdef __ANDROID__
+  AAsset* asset_;
+#endif  // __ANDROID__
+  std::string buffer_;
+};
+
+}  // namespace fpl
+
+#endif  // FPL_MAPPED_FILE_H
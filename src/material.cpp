@@ -14,17 +14,69 @@
 
 #include "precompiled.h"
 #include "material.h"
+#include "memory_accounting.h"
 #include "renderer.h"
+#include "utilities.h"
 
 namespace fpl {
 
+// Width and height of the copy of a texture drawn while it's evicted.
+static const int kPlaceholderSize = 8;
+
+Texture::~Texture() {
+  Delete();
+  if (placeholder_id_) {
+    GL_CALL(glDeleteTextures(1, &placeholder_id_));
+    MemoryAccounting::RemoveTexture(placeholder_id_);
+  }
+}
+
 void Texture::Load() {
-  data_ =
-      renderer_->LoadAndUnpackTexture(filename_.c_str(), &size_, &has_alpha_);
+  MemoryTagScope tag(kMemoryTagTextures);
+  // Prefer a GPU compressed version of the texture, if the build made one
+  // in a format this device supports. It can be uploaded without decoding.
+  const std::string compressed = renderer_->CompressedTextureFilename(filename_);
+  if (!compressed.empty() && FileExists(compressed.c_str()) &&
+      LoadFile(compressed.c_str(), &compressed_data_)) {
+    return;
+  }
+  compressed_data_.clear();
+  // WebP files are decoded straight into the format they're uploaded in.
+  if (Renderer::LoadAndPrepareWebP(filename_.c_str(), desired_, &prepared_,
+                                   &size_, &has_alpha_)) {
+    HashContents();
+    return;
+  }
+  data_ = renderer_->LoadAndUnpackTexture(filename_.c_str(), &size_,
+                                          &has_alpha_, &mip_levels_);
   if (!data_) {
     SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "texture load: %s: %s",
                  filename_.c_str(), renderer_->last_error().c_str());
   }
+  // Convert and filter the pixels here, rather than on the main thread.
+  if (data_) {
+    Renderer::PrepareTexture(data_, size_, has_alpha_, desired_, mip_levels_,
+                             &prepared_);
+    free(data_);
+    data_ = nullptr;
+  }
+  HashContents();
+}
+
+void Texture::HashContents() {
+  content_hash_ = 0;
+  if (!content_cache_) return;
+  uint64_t hash = HashBytes(&desired_, sizeof(desired_));
+  if (!compressed_data_.empty()) {
+    content_hash_ =
+        HashBytes(compressed_data_.data(), compressed_data_.size(), hash);
+  } else if (!prepared_.pixels.empty()) {
+    // The prepared pixels are the same whichever way they were decoded.
+    hash = HashBytes(&size_, sizeof(size_), hash);
+    hash = HashBytes(&has_alpha_, sizeof(has_alpha_), hash);
+    content_hash_ =
+        HashBytes(prepared_.pixels.data(), prepared_.pixels.size(), hash);
+  }
 }
 
 void Texture::LoadFromMemory(const uint8_t *data, const vec2i size,
@@ -36,30 +88,161 @@ void Texture::LoadFromMemory(const uint8_t *data, const vec2i size,
 }
 
 void Texture::Finalize() {
-  if (data_) {
-    id_ = renderer_->CreateTexture(data_, size_, has_alpha_, desired_);
-    free(data_);
-    data_ = nullptr;
+  MemoryTagScope tag(kMemoryTagTextures);
+  // Reuse the texture made from an identical file, if there is one.
+  const TextureContentCache::Entry *shared =
+      content_hash_ ? content_cache_->Acquire(content_hash_) : nullptr;
+  if (shared) {
+    id_ = shared->id;
+    size_ = shared->size;
+    has_alpha_ = shared->has_alpha;
+    std::string().swap(compressed_data_);
+    std::vector<uint8_t>().swap(prepared_.pixels);
+    return;
+  }
+
+  if (!compressed_data_.empty()) {
+    // LoadFile() appends a terminator, which isn't part of the file.
+    gpu_bytes_ = compressed_data_.size() - 1;
+    id_ = renderer_->CreateTextureFromKTX(
+        reinterpret_cast<const uint8_t *>(compressed_data_.data()),
+        compressed_data_.size() - 1, &size_, &has_alpha_);
+    if (!id_) {
+      SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "texture load: %s: %s",
+                   filename_.c_str(), renderer_->last_error().c_str());
+    }
+    std::string().swap(compressed_data_);
+  }
+  if (!prepared_.pixels.empty()) {
+    gpu_bytes_ = prepared_.pixels.size();
+    if (residency_) CreatePlaceholder();
+    id_ = renderer_->CreateTexture(prepared_);
+    std::vector<uint8_t>().swap(prepared_.pixels);
+  }
+  if (id_ && content_hash_) {
+    content_cache_->Insert(content_hash_, id_, size_, has_alpha_);
+  } else {
+    content_hash_ = 0;
+  }
+}
+
+void Texture::CreatePlaceholder() {
+  // GPU compressed textures have no pixels to take a mip level from, so draw
+  // as nothing while evicted.
+  if (placeholder_id_ || prepared_.pixels.empty()) return;
+  // The first mip level no bigger than kPlaceholderSize square.
+  int level = 0;
+  vec2i level_size = prepared_.size;
+  while (level_size.x() > kPlaceholderSize ||
+         level_size.y() > kPlaceholderSize) {
+    level_size = vec2i(std::max(1, level_size.x() / 2),
+                       std::max(1, level_size.y() / 2));
+    level++;
+  }
+  const size_t offset = Renderer::MipChainSize(
+      prepared_.size, prepared_.bytes_per_pixel, level);
+  placeholder_.size = level_size;
+  placeholder_.format = prepared_.format;
+  placeholder_.type = prepared_.type;
+  placeholder_.bytes_per_pixel = prepared_.bytes_per_pixel;
+  placeholder_.pixels.assign(prepared_.pixels.begin() + offset,
+                             prepared_.pixels.end());
+  placeholder_id_ = renderer_->CreateTexture(placeholder_);
+}
+
+void Texture::MarkUsed() const {
+  if (residency_) {
+    last_used_frame_ = residency_->frame();
+    if (evicted_ && !reload_requested_) {
+      reload_requested_ = true;
+      residency_->RequestReload(this);
+    }
   }
 }
 
 void Texture::Set(size_t unit) const {
+  MarkUsed();
   GL_CALL(glActiveTexture(GL_TEXTURE0 + unit));
-  GL_CALL(glBindTexture(GL_TEXTURE_2D, id_));
+  GL_CALL(glBindTexture(GL_TEXTURE_2D, id_ ? id_ : placeholder_id_));
+  Renderer::frame_stats().texture_binds++;
+}
+
+void Texture::Evict() {
+  Delete();
+  evicted_ = true;
+}
+
+void Texture::PrepareReload() {
+  evicted_ = false;
+  reload_requested_ = false;
+}
+
+void Texture::RestoreAfterContextLoss() {
+  // A texture still being loaded is finalized into the new context. Shared
+  // textures are shared again once they've been reloaded.
+  if (finalized()) {
+    id_ = 0;
+    content_hash_ = 0;
+    evicted_ = true;
+    reload_requested_ = false;
+  }
+  placeholder_id_ = 0;
+  if (!placeholder_.pixels.empty()) {
+    placeholder_id_ = renderer_->CreateTexture(placeholder_);
+  }
 }
 
 void Texture::Delete() {
   if (id_) {
-    GL_CALL(glDeleteTextures(1, &id_));
+    // Leave shared textures for the last Texture using them to delete.
+    if (!content_hash_ || content_cache_->Release(content_hash_)) {
+      GL_CALL(glDeleteTextures(1, &id_));
+      MemoryAccounting::RemoveTexture(id_);
+    }
     id_ = 0;
+    content_hash_ = 0;
   }
 }
 
+const TextureContentCache::Entry *TextureContentCache::Acquire(
+    uint64_t hash) {
+  auto it = entries_.find(hash);
+  if (it == entries_.end()) return nullptr;
+  it->second.users++;
+  return &it->second;
+}
+
+void TextureContentCache::Insert(uint64_t hash, GLuint id, const vec2i &size,
+                                 bool has_alpha) {
+  Entry entry = {id, size, has_alpha, 1};
+  entries_[hash] = entry;
+}
+
+bool TextureContentCache::Release(uint64_t hash) {
+  auto it = entries_.find(hash);
+  assert(it != entries_.end());
+  if (--it->second.users > 0) return false;
+  entries_.erase(it);
+  return true;
+}
+
 void Material::Set(Renderer &renderer) {
   renderer.SetBlendMode(blend_mode_);
   for (size_t i = 0; i < textures_.size(); i++) textures_[i]->Set(i);
 }
 
+void Material::set_texture_rect(size_t i, const vec4 &rect) {
+  if (texture_rects_.size() <= i) {
+    texture_rects_.resize(i + 1, mathfu::vec4_packed(vec4(0, 0, 1, 1)));
+  }
+  texture_rects_[i] = rect;
+}
+
+vec2 Material::TextureSize(size_t i) const {
+  const vec4 rect = texture_rect(i);
+  return vec2(textures_[i]->size()) * (rect.zw() - rect.xy());
+}
+
 void Material::DeleteTextures() {
   for (size_t i = 0; i < textures_.size(); i++) textures_[i]->Delete();
 }
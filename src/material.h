@@ -15,6 +15,7 @@
 #ifndef FPL_MATERIAL_H
 #define FPL_MATERIAL_H
 
+#include <unordered_map>
 #include "shader.h"
 #include "async_loader.h"
 
@@ -39,6 +40,72 @@ enum TextureFormat {
   kFormatLuminance,
 };
 
+// A texture's pixels, converted to the format they're uploaded in, followed
+// by the rest of its mip chain. See Renderer::PrepareTexture().
+struct PreparedTexture {
+  PreparedTexture()
+      : size(mathfu::kZeros2i), format(0), type(0), bytes_per_pixel(0) {}
+
+  std::vector<uint8_t> pixels;
+  vec2i size;
+  // As passed to glTexImage2D.
+  GLenum format;
+  GLenum type;
+  int bytes_per_pixel;
+};
+
+// OpenGL textures shared between Texture objects whose files decode to the
+// same contents, so that identical images used by several materials are only
+// uploaded once. Only used on the main thread.
+class TextureContentCache {
+ public:
+  struct Entry {
+    GLuint id;
+    vec2i size;
+    bool has_alpha;
+    int users;
+  };
+
+  // If a texture with contents 'hash' has been created, add a user to it and
+  // return it. Otherwise return nullptr.
+  const Entry *Acquire(uint64_t hash);
+
+  // Record the texture 'id', created from contents 'hash', with one user.
+  void Insert(uint64_t hash, GLuint id, const vec2i &size, bool has_alpha);
+
+  // Remove a user of the texture with contents 'hash'. Returns true if that
+  // was the last one, in which case the caller should delete the texture.
+  bool Release(uint64_t hash);
+
+  // Forget every texture, once the GL context they were made in has been
+  // lost.
+  void Clear() { entries_.clear(); }
+
+ private:
+  std::unordered_map<uint64_t, Entry> entries_;
+};
+
+class Texture;
+
+// Tracks when each texture was last drawn, so that MaterialManager can evict
+// the ones that haven't been drawn for a while, and reload them once they're
+// drawn again. Only used on the main thread.
+class TextureResidency {
+ public:
+  TextureResidency() : frame_(0) {}
+
+  int frame() const { return frame_; }
+  void AdvanceFrame() { frame_++; }
+
+  // Evicted textures that have been drawn since their eviction.
+  void RequestReload(const Texture *texture) { requests_.push_back(texture); }
+  std::vector<const Texture *> &requests() { return requests_; }
+
+ private:
+  int frame_;
+  std::vector<const Texture *> requests_;
+};
+
 class Texture : public AsyncResource {
  public:
   Texture(Renderer &renderer, const std::string &filename)
@@ -48,7 +115,16 @@ class Texture : public AsyncResource {
         size_(mathfu::kZeros2i),
         uv_(vec4(0.0f, 0.0f, 1.0f, 1.0f)),
         has_alpha_(false),
-        desired_(kFormatAuto) {}
+        mip_levels_(1),
+        desired_(kFormatAuto),
+        content_hash_(0),
+        content_cache_(nullptr),
+        residency_(nullptr),
+        last_used_frame_(-1),
+        evicted_(false),
+        reload_requested_(false),
+        placeholder_id_(0),
+        gpu_bytes_(0) {}
   Texture(Renderer &renderer)
       : AsyncResource(""),
         renderer_(&renderer),
@@ -56,8 +132,17 @@ class Texture : public AsyncResource {
         size_(mathfu::kZeros2i),
         uv_(vec4(0.0f, 0.0f, 1.0f, 1.0f)),
         has_alpha_(false),
-        desired_(kFormatAuto) {}
-  ~Texture() { Delete(); }
+        mip_levels_(1),
+        desired_(kFormatAuto),
+        content_hash_(0),
+        content_cache_(nullptr),
+        residency_(nullptr),
+        last_used_frame_(-1),
+        evicted_(false),
+        reload_requested_(false),
+        placeholder_id_(0),
+        gpu_bytes_(0) {}
+  ~Texture();
 
   virtual void Load();
   virtual void LoadFromMemory(const uint8_t *data, const vec2i size,
@@ -67,6 +152,10 @@ class Texture : public AsyncResource {
   void Set(size_t unit) const;
   void Delete();
 
+  // Count the texture as drawn this frame, as Set() does, without binding it.
+  // For when the result of drawing it is cached.
+  void MarkUsed() const;
+
   const GLuint &id() const { return id_; }
   vec2i size() { return size_; }
   const vec2i size() const { return size_; }
@@ -76,14 +165,74 @@ class Texture : public AsyncResource {
 
   void set_desired_format(TextureFormat format) { desired_ = format; }
 
+  // Share the OpenGL texture with any other Texture in 'cache' that has the
+  // same contents. Call before the texture is loaded.
+  void set_content_cache(TextureContentCache *cache) { content_cache_ = cache; }
+
+  // Record when the texture is drawn in 'residency', and keep a low
+  // resolution copy of it to draw while it's evicted. Call before the texture
+  // is loaded.
+  void set_residency(TextureResidency *residency) { residency_ = residency; }
+
+  // Delete the OpenGL texture, and draw the low resolution copy instead until
+  // it's loaded again.
+  void Evict();
+  // Clear the eviction, just before queueing the texture to be loaded again.
+  void PrepareReload();
+  bool evicted() const { return evicted_; }
+
+  // Forget the OpenGL texture, which went with the GL context it was made
+  // in, and evict it, to be loaded again the next time it's drawn. The low
+  // resolution copy is uploaded again right away. Textures that are still
+  // loading are left to finish.
+  void RestoreAfterContextLoss();
+
+  // The last TextureResidency::frame() in which Set() was called, or -1.
+  int last_used_frame() const { return last_used_frame_; }
+
+  // Roughly how much GPU memory the texture takes up, when it's loaded.
+  size_t gpu_bytes() const { return gpu_bytes_; }
+
  private:
+  // Set content_hash_ from whatever Load() loaded.
+  void HashContents();
+  // Keep the smallest mip levels of prepared_ in placeholder_, and upload
+  // them into placeholder_id_, if there isn't one.
+  void CreatePlaceholder();
+
   Renderer *renderer_;
 
   GLuint id_;
   vec2i size_;
   vec4 uv_;
   bool has_alpha_;
+  // Mip levels in data_, including the full size one.
+  int mip_levels_;
   TextureFormat desired_;
+
+  // The contents of a KTX file, if Load() found a GPU compressed version of
+  // the texture. Uploaded as is by Finalize(), instead of data_.
+  std::string compressed_data_;
+  // Otherwise, the pixels Load() decoded, converted on the loader thread so
+  // that Finalize() only has to upload them.
+  PreparedTexture prepared_;
+
+  // Hash of the loaded contents and format, computed on the loader thread.
+  // Zero if the texture isn't shared through content_cache_.
+  uint64_t content_hash_;
+  TextureContentCache *content_cache_;
+
+  // Eviction state. Set() is const, since drawing doesn't change the texture,
+  // but it still records the draw.
+  TextureResidency *residency_;
+  mutable int last_used_frame_;
+  bool evicted_;
+  mutable bool reload_requested_;
+  GLuint placeholder_id_;
+  // The pixels of placeholder_id_, so that it can be restored along with
+  // the GL context.
+  PreparedTexture placeholder_;
+  size_t gpu_bytes_;
 };
 
 class Material {
@@ -100,10 +249,29 @@ class Material {
     blend_mode_ = blend_mode;
   }
 
+  // The part of textures()[i] that this material uses, as (u0, v0, u1, v1).
+  // This is the whole texture unless the texture is an atlas.
+  vec4 texture_rect(size_t i) const {
+    return i < texture_rects_.size() ? vec4(texture_rects_[i])
+                                     : vec4(0.0f, 0.0f, 1.0f, 1.0f);
+  }
+  void set_texture_rect(size_t i, const vec4 &rect);
+
+  // Size, in texels, of the part of textures()[i] that this material uses.
+  vec2 TextureSize(size_t i) const;
+
+  // Map 'uv', a coordinate across the whole of an unpacked texture, into
+  // the part of textures()[i] that this material uses.
+  vec2 MapTexCoord(const vec2 &uv, size_t i = 0) const {
+    const vec4 rect = texture_rect(i);
+    return rect.xy() + uv * (rect.zw() - rect.xy());
+  }
+
   void DeleteTextures();
 
  private:
   std::vector<Texture *> textures_;
+  std::vector<mathfu::vec4_packed> texture_rects_;
   BlendMode blend_mode_;
 };
 
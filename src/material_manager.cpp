@@ -14,8 +14,11 @@
 
 #include "precompiled.h"
 #include "material_manager.h"
+#include "asset_archive.h"
+#include "mapped_file.h"
 #include "materials_generated.h"
 #include "mesh_generated.h"
+#include "startup_trace.h"
 #include "utilities.h"
 
 namespace fpl {
@@ -29,84 +32,305 @@ static_assert(kBlendModeOff == static_cast<BlendMode>(matdef::BlendMode_OFF) &&
 static_assert(kBlendModeCount == kBlendModeAlpha + 1,
               "Please update static_assert above with new enum values.");
 
-template <typename T>
-T FindInMap(const std::map<std::string, T> &map, const char *name) {
-  auto it = map.find(name);
-  return it != map.end() ? it->second : 0;
+template <typename Map>
+typename Map::mapped_type *FindInMap(Map &map, uint64_t hash,
+                                     const char *name) {
+  auto it = map.find(hash);
+  if (it == map.end()) return nullptr;
+  // Two names with the same 64-bit hash. Rename one of the files.
+  assert(it->second.name == name);
+  (void)name;
+  return &it->second;
+}
+
+template <typename Map>
+typename Map::mapped_type::ResourceType *FindResource(Map &map,
+                                                      const char *name) {
+  auto entry = FindInMap(map, HashAssetName(name), name);
+  return entry ? entry->resource : nullptr;
+}
+
+// Add a reference to the resource 'name' if it's already loaded.
+template <typename Map>
+typename Map::mapped_type::ResourceType *ReferenceResource(Map &map,
+                                                           const char *name) {
+  auto entry = FindInMap(map, HashAssetName(name), name);
+  if (!entry) return nullptr;
+  entry->references++;
+  return entry->resource;
+}
+
+// Record a newly loaded resource, with one reference.
+template <typename Map>
+typename Map::mapped_type &AddResource(
+    Map &map, const char *name,
+    typename Map::mapped_type::ResourceType *resource) {
+  auto &entry = map[HashAssetName(name)];
+  entry.name = name;
+  entry.resource = resource;
+  entry.references = 1;
+  return entry;
 }
 
 Shader *MaterialManager::FindShader(const char *basename) {
-  return FindInMap(shader_map_, basename);
+  return FindResource(shader_map_, basename);
 }
 
 Shader *MaterialManager::LoadShader(const char *basename) {
-  auto shader = FindShader(basename);
-  if (shader) return shader;
+  return LoadShaderSources(basename, true);
+}
+
+Shader *MaterialManager::QueueShader(const char *basename) {
+  return LoadShaderSources(basename, false);
+}
+
+bool MaterialManager::FinishLoadingShaders() {
+  bool linked = true;
+  while (!queued_shaders_.empty()) {
+    linked = FinishLoadingShader(queued_shaders_.back()) && linked;
+  }
+  return linked;
+}
+
+bool MaterialManager::FinishLoadingShader(Shader *shader) {
+  queued_shaders_.erase(
+      std::remove(queued_shaders_.begin(), queued_shaders_.end(), shader),
+      queued_shaders_.end());
+  if (renderer_.FinishLinkShader(shader)) return true;
+  SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Shader Error:\n%s\n",
+               renderer_.last_error().c_str());
+  return false;
+}
+
+Shader *MaterialManager::LoadShaderSources(const char *basename, bool wait) {
+  auto shader = ReferenceResource(shader_map_, basename);
+  if (shader) {
+    // A shader that's still queued has to be finished before it's used.
+    if (wait && std::find(queued_shaders_.begin(), queued_shaders_.end(),
+                          shader) != queued_shaders_.end()) {
+      FinishLoadingShader(shader);
+    }
+    return shader;
+  }
+  StartupTraceScope trace(basename, "asset");
   std::string vs_file, ps_file;
+  if (!LoadShaderFiles(basename, &vs_file, &ps_file)) return nullptr;
+  if (wait) {
+    shader = renderer_.CompileAndLinkShader(vs_file.c_str(), ps_file.c_str());
+  } else {
+    shader = renderer_.BeginLinkShader(vs_file.c_str(), ps_file.c_str());
+    if (shader) queued_shaders_.push_back(shader);
+  }
+  if (shader) {
+    AddResource(shader_map_, basename, shader);
+  } else {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Shader Error:\n%s\n",
+                 renderer_.last_error().c_str());
+  }
+  return shader;
+}
+
+bool MaterialManager::LoadShaderFiles(const char *basename,
+                                      std::string *vs_file,
+                                      std::string *ps_file) {
   std::string filename = std::string(basename) + ".glslv";
-  if (LoadFile(filename.c_str(), &vs_file)) {
+  if (LoadFile(filename.c_str(), vs_file)) {
     filename = std::string(basename) + ".glslf";
-    if (LoadFile(filename.c_str(), &ps_file)) {
-      shader = renderer_.CompileAndLinkShader(vs_file.c_str(), ps_file.c_str());
-      if (shader) {
-        shader_map_[basename] = shader;
-      } else {
-        SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Shader Error:\n%s\n",
-                     renderer_.last_error().c_str());
-      }
-      return shader;
-    }
+    if (LoadFile(filename.c_str(), ps_file)) return true;
   }
   SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Can\'t load shader: %s",
                filename.c_str());
   renderer_.last_error() = "Couldn\'t load: " + filename;
-  return nullptr;
+  return false;
 }
 
 Texture *MaterialManager::FindTexture(const char *filename) {
-  return FindInMap(texture_map_, filename);
+  return FindResource(texture_map_, filename);
 }
 
 Texture *MaterialManager::LoadTexture(const char *filename,
                                       TextureFormat format) {
-  auto tex = FindTexture(filename);
+  auto tex = ReferenceResource(texture_map_, filename);
   if (tex) return tex;
   tex = new Texture(renderer_, filename);
   tex->set_desired_format(format);
-  loader_.QueueJob(tex);
-  texture_map_[filename] = tex;
+  tex->set_content_cache(&texture_contents_);
+  tex->set_residency(&texture_residency_);
+  loader_.QueueJob(tex, load_priority_);
+  AddResource(texture_map_, filename, tex);
   return tex;
 }
 
-void MaterialManager::StartLoadingTextures() { loader_.StartLoading(); }
+void MaterialManager::ReleaseTexture(uint64_t hash) {
+  auto it = texture_map_.find(hash);
+  if (it == texture_map_.end() || --it->second.references > 0) return;
+  Texture *tex = it->second.resource;
+  texture_map_.erase(it);
+  auto &requests = texture_residency_.requests();
+  requests.erase(std::remove(requests.begin(), requests.end(), tex),
+                 requests.end());
+  // The loader may still be using the texture, in which case it's deleted
+  // once it has been finalized.
+  if (tex->finalized()) {
+    delete tex;
+  } else {
+    orphaned_textures_.push_back(tex);
+  }
+}
+
+void MaterialManager::DeleteOrphanedTextures() {
+  for (size_t i = 0; i < orphaned_textures_.size();) {
+    if (orphaned_textures_[i]->finalized()) {
+      delete orphaned_textures_[i];
+      orphaned_textures_[i] = orphaned_textures_.back();
+      orphaned_textures_.pop_back();
+    } else {
+      ++i;
+    }
+  }
+}
+
+void MaterialManager::StartLoadingTextures(WorkerPool *pool, int max_loads) {
+  loader_.StartLoading(pool, max_loads);
+}
 
-bool MaterialManager::TryFinalize() { return loader_.TryFinalize(); }
+bool MaterialManager::TryFinalize(int budget_microseconds) {
+  QueueRequestedReloads();
+  const bool finished = loader_.TryFinalize(budget_microseconds);
+  if (!orphaned_textures_.empty()) DeleteOrphanedTextures();
+  return finished;
+}
+
+// Textures drawn within this many frames are never evicted, since they're
+// likely to be drawn again right away.
+static const int kMinEvictionAge = 60;
+
+// Evicted textures are reloaded ahead of anything else, since they're on
+// screen.
+static const int kReloadPriority = 1000;
+
+void MaterialManager::QueueRequestedReloads() {
+  // Every texture asking for a reload is still in texture_map_, since
+  // ReleaseTexture() drops requests for the textures it removes.
+  auto &requests = texture_residency_.requests();
+  for (size_t i = 0; i < requests.size(); ++i) {
+    Texture *tex = const_cast<Texture *>(requests[i]);
+    tex->PrepareReload();
+    loader_.QueueJob(tex, kReloadPriority);
+  }
+  requests.clear();
+}
+
+void MaterialManager::UpdateTextureResidency(
+    int finalize_budget_microseconds) {
+  // Without a budget, textures are only evicted by a lost GL context.
+  if (texture_budget_ == 0 && texture_residency_.requests().empty()) return;
+
+  QueueRequestedReloads();
+  if (!loader_.Finished()) TryFinalize(finalize_budget_microseconds);
+  if (texture_budget_ == 0) return;
+
+  EvictTextures();
+  texture_residency_.AdvanceFrame();
+}
+
+void MaterialManager::RestoreAfterContextLoss() {
+  // Start every shader linking before waiting for any of them, so the
+  // driver can work on them together. Shaders still queued are begun again.
+  for (auto it = shader_map_.begin(); it != shader_map_.end(); ++it) {
+    Shader *shader = it->second.resource;
+    std::string vs_file, ps_file;
+    if (!LoadShaderFiles(it->second.name.c_str(), &vs_file, &ps_file)) {
+      continue;
+    }
+    Shader *linking =
+        renderer_.BeginLinkShader(vs_file.c_str(), ps_file.c_str());
+    if (!linking) continue;
+    shader->Replace(linking);
+    delete linking;
+    if (std::find(queued_shaders_.begin(), queued_shaders_.end(), shader) ==
+        queued_shaders_.end()) {
+      queued_shaders_.push_back(shader);
+    }
+  }
+  FinishLoadingShaders();
+
+  for (auto it = mesh_map_.begin(); it != mesh_map_.end(); ++it) {
+    it->second.resource->RestoreBuffers();
+  }
+
+  texture_contents_.Clear();
+  texture_residency_.requests().clear();
+  for (auto it = texture_map_.begin(); it != texture_map_.end(); ++it) {
+    it->second.resource->RestoreAfterContextLoss();
+  }
+  // So that deleting them doesn't delete what's reused their old names.
+  for (size_t i = 0; i < orphaned_textures_.size(); ++i) {
+    orphaned_textures_[i]->RestoreAfterContextLoss();
+  }
+}
+
+void MaterialManager::EvictTextures() {
+  resident_texture_bytes_ = 0;
+  std::vector<Texture *> candidates;
+  const int newest = texture_residency_.frame() - kMinEvictionAge;
+  for (auto it = texture_map_.begin(); it != texture_map_.end(); ++it) {
+    Texture *tex = it->second.resource;
+    if (!tex->finalized() || !tex->id()) continue;
+    resident_texture_bytes_ += tex->gpu_bytes();
+    // Textures that have never been drawn were loaded ahead of time, so
+    // leave them for when they're wanted.
+    if (tex->last_used_frame() >= 0 && tex->last_used_frame() < newest) {
+      candidates.push_back(tex);
+    }
+  }
+  if (resident_texture_bytes_ <= texture_budget_) return;
+
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Texture *a, const Texture *b) {
+              return a->last_used_frame() < b->last_used_frame();
+            });
+  for (size_t i = 0;
+       i < candidates.size() && resident_texture_bytes_ > texture_budget_;
+       ++i) {
+    resident_texture_bytes_ -= candidates[i]->gpu_bytes();
+    candidates[i]->Evict();
+  }
+}
 
 Material *MaterialManager::FindMaterial(const char *filename) {
-  return FindInMap(material_map_, filename);
+  return FindResource(material_map_, filename);
 }
 
 Material *MaterialManager::LoadMaterial(const char *filename) {
-  auto mat = FindMaterial(filename);
+  auto mat = ReferenceResource(material_map_, filename);
   if (mat) return mat;
-  std::string flatbuf;
-  if (LoadFile(filename, &flatbuf)) {
+  StartupTraceScope trace(filename, "asset");
+  MappedFile flatbuf;
+  if (flatbuf.Open(filename)) {
     flatbuffers::Verifier verifier(
-        reinterpret_cast<const uint8_t *>(flatbuf.c_str()), flatbuf.length());
+        static_cast<const uint8_t *>(flatbuf.data()), flatbuf.size());
     assert(matdef::VerifyMaterialBuffer(verifier));
-    auto matdef = matdef::GetMaterial(flatbuf.c_str());
+    auto matdef = matdef::GetMaterial(flatbuf.data());
     mat = new Material();
     mat->set_blend_mode(static_cast<BlendMode>(matdef->blendmode()));
+    std::vector<uint64_t> textures;
     for (size_t i = 0; i < matdef->texture_filenames()->size(); i++) {
       auto format =
           matdef->desired_format() && i < matdef->desired_format()->size()
               ? static_cast<TextureFormat>(matdef->desired_format()->Get(i))
               : kFormatAuto;
-      auto tex =
-          LoadTexture(matdef->texture_filenames()->Get(i)->c_str(), format);
+      const char *texture_name = matdef->texture_filenames()->Get(i)->c_str();
+      auto tex = LoadTexture(texture_name, format);
       mat->textures().push_back(tex);
+      textures.push_back(HashAssetName(texture_name));
+      if (matdef->texture_rects() && i < matdef->texture_rects()->size()) {
+        auto rect = matdef->texture_rects()->Get(i);
+        mat->set_texture_rect(
+            i, vec4(rect->u0(), rect->v0(), rect->u1(), rect->v1()));
+      }
     }
-    material_map_[filename] = mat;
+    AddResource(material_map_, filename, mat).dependencies.swap(textures);
     return mat;
   }
   renderer_.last_error() = std::string("Couldn\'t load: ") + filename;
@@ -114,18 +338,27 @@ Material *MaterialManager::LoadMaterial(const char *filename) {
 }
 
 void MaterialManager::UnloadMaterial(const char *filename) {
-  auto mat = FindMaterial(filename);
-  if (!mat) return;
-  mat->DeleteTextures();
-  material_map_.erase(filename);
-  for (auto it = mat->textures().begin(); it != mat->textures().end(); ++it) {
-    texture_map_.erase((*it)->filename());
+  if (FindInMap(material_map_, HashAssetName(filename), filename)) {
+    ReleaseMaterial(HashAssetName(filename));
+  }
+}
+
+void MaterialManager::ReleaseMaterial(uint64_t hash) {
+  auto it = material_map_.find(hash);
+  if (it == material_map_.end() || --it->second.references > 0) return;
+  // Use the textures recorded at load time, since the material's own list
+  // may have been changed since.
+  std::vector<uint64_t> textures;
+  textures.swap(it->second.dependencies);
+  delete it->second.resource;
+  material_map_.erase(it);
+  for (size_t i = 0; i < textures.size(); ++i) {
+    ReleaseTexture(textures[i]);
   }
-  delete mat;
 }
 
 Mesh *MaterialManager::FindMesh(const char *filename) {
-  return FindInMap(mesh_map_, filename);
+  return FindResource(mesh_map_, filename);
 }
 
 template<typename T> void CopyAttribute(const T *attr, uint8_t *&buf) {
@@ -135,14 +368,15 @@ template<typename T> void CopyAttribute(const T *attr, uint8_t *&buf) {
 }
 
 Mesh *MaterialManager::LoadMesh(const char *filename) {
-  auto mesh = FindMesh(filename);
+  auto mesh = ReferenceResource(mesh_map_, filename);
   if (mesh) return mesh;
-  std::string flatbuf;
-  if (LoadFile(filename, &flatbuf)) {
+  StartupTraceScope trace(filename, "asset");
+  MappedFile flatbuf;
+  if (flatbuf.Open(filename)) {
     flatbuffers::Verifier verifier(
-        reinterpret_cast<const uint8_t *>(flatbuf.c_str()), flatbuf.length());
+        static_cast<const uint8_t *>(flatbuf.data()), flatbuf.size());
     assert(matdef::VerifyMaterialBuffer(verifier));
-    auto meshdef = meshdef::GetMesh(flatbuf.c_str());
+    auto meshdef = meshdef::GetMesh(flatbuf.data());
     // Collect what attributes are available.
     std::vector<Attribute> attrs;
     attrs.push_back(kPosition3f);
@@ -164,19 +398,36 @@ Mesh *MaterialManager::LoadMesh(const char *filename) {
       if (meshdef->colors())    CopyAttribute(meshdef->colors()->Get(i), p);
       if (meshdef->texcoords()) CopyAttribute(meshdef->texcoords()->Get(i), p);
     }
-    mesh = new Mesh(buf, meshdef->positions()->Length(), vert_size,
-                    attrs.data());
+    const int count = static_cast<int>(meshdef->positions()->Length());
+    if (renderer_.SupportsQuantizedVertices()) {
+      std::vector<uint8_t> quantized;
+      std::vector<Attribute> quantized_attrs;
+      Mesh::Quantize(buf, count, attrs.data(), &quantized, &quantized_attrs);
+      const auto quantized_size = Mesh::VertexSize(quantized_attrs.data());
+      mesh = new Mesh(renderer_, quantized.data(), count,
+                      static_cast<int>(quantized_size), quantized_attrs.data());
+    } else {
+      mesh = new Mesh(renderer_, buf, count, vert_size, attrs.data());
+    }
     delete[] buf;
     // Load indices an materials.
+    std::vector<uint64_t> materials;
     for (size_t i = 0; i < meshdef->surfaces()->size(); i++) {
       auto surface = meshdef->surfaces()->Get(i);
       auto mat = LoadMaterial(surface->material()->c_str());
-      if (!mat) { delete mesh; return nullptr; }  // Error msg already set.
+      if (!mat) {  // Error msg already set.
+        for (size_t j = 0; j < materials.size(); ++j) {
+          ReleaseMaterial(materials[j]);
+        }
+        delete mesh;
+        return nullptr;
+      }
+      materials.push_back(HashAssetName(surface->material()->c_str()));
       mesh->AddIndices(
           reinterpret_cast<const uint16_t *>(surface->indices()->Data()),
           surface->indices()->Length(), mat);
     }
-    mesh_map_[filename] = mesh;
+    AddResource(mesh_map_, filename, mesh).dependencies.swap(materials);
     return mesh;
   }
   renderer_.last_error() = std::string("Couldn\'t load: ") + filename;
@@ -184,10 +435,15 @@ Mesh *MaterialManager::LoadMesh(const char *filename) {
 }
 
 void MaterialManager::UnloadMesh(const char *filename) {
-  auto mesh = FindMesh(filename);
-  if (!mesh) return;
-  mesh_map_.erase(filename);
-  delete mesh;
+  auto it = mesh_map_.find(HashAssetName(filename));
+  if (it == mesh_map_.end() || --it->second.references > 0) return;
+  std::vector<uint64_t> materials;
+  materials.swap(it->second.dependencies);
+  delete it->second.resource;
+  mesh_map_.erase(it);
+  for (size_t i = 0; i < materials.size(); ++i) {
+    ReleaseMaterial(materials[i]);
+  }
 }
 
 }  // namespace fpl
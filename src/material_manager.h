@@ -15,15 +15,24 @@
 #ifndef MATERIAL_MANAGER_H
 #define MATERIAL_MANAGER_H
 
+#include <unordered_map>
 #include "renderer.h"
 #include "common.h"
 #include "async_loader.h"
 
 namespace fpl {
 
+// Resources are looked up by the hash of the name they were loaded by, and
+// reference counted: each Load*() call adds a reference, and each Unload*()
+// call removes one. A resource is deleted when its last reference goes, along
+// with the references it holds on the resources it loaded in turn.
 class MaterialManager {
  public:
-  MaterialManager(Renderer &renderer) : renderer_(renderer) {}
+  MaterialManager(Renderer &renderer)
+      : renderer_(renderer),
+        load_priority_(0),
+        texture_budget_(0),
+        resident_texture_bytes_(0) {}
 
   // Returns a previously loaded shader object, or nullptr.
   Shader *FindShader(const char *basename);
@@ -31,22 +40,74 @@ class MaterialManager {
   // and .glslf to the basename, compiling and linking them.
   // If this returns nullptr, the error can be found in Renderer::last_error().
   Shader *LoadShader(const char *basename);
+  // Like LoadShader(), but only starts compiling and linking the shader, so
+  // the driver can work on it while other assets load. Returns nullptr only
+  // if the sources can't be loaded. Queued shaders can't be used until
+  // FinishLoadingShaders() has returned true.
+  Shader *QueueShader(const char *basename);
+  // Waits for every queued shader to link. Returns false if any of them
+  // failed, with the error in Renderer::last_error(). Shaders that failed
+  // stay loaded, but can't be used.
+  bool FinishLoadingShaders();
 
   // Returns a previously created texture, or nullptr.
   Texture *FindTexture(const char *filename);
   // Queue's a texture for loading if it hasn't been loaded already.
-  // Currently only supports TGA/WebP format files.
+  // Currently only supports TGA/WebP format files. Textures whose files have
+  // identical contents share one OpenGL texture.
   // Returned texture isn't usable until TryFinalize() succeeds and the id
   // is non-zero.
   Texture *LoadTexture(const char *filename,
                        TextureFormat format = kFormatAuto);
   // LoadTextures doesn't actually load anything, this will start the async
-  // loading of all files, and decompression.
-  void StartLoadingTextures();
+  // loading of all files, and decompression, as jobs on 'pool', with at most
+  // 'max_loads' running at once.
+  void StartLoadingTextures(WorkerPool *pool, int max_loads = 1);
   // Call this repeatedly until it returns true, which signals all textures
   // will have loaded, and turned into OpenGL textures.
   // Textures with a 0 id will have failed to load.
-  bool TryFinalize();
+  // A non-zero 'budget_microseconds' limits how long each call spends
+  // uploading textures, so a batch of them is spread over several frames.
+  bool TryFinalize(int budget_microseconds = 0);
+  // True if TryFinalize() has nothing left to do.
+  bool FinishedLoading() const { return loader_.Finished(); }
+  // Fraction of the textures queued that have been turned into OpenGL
+  // textures, for display on a loading screen.
+  float LoadProgress() const { return loader_.Progress(); }
+  // Textures queued that haven't been turned into OpenGL textures yet.
+  int LoadQueueDepth() const { return loader_.jobs_outstanding(); }
+
+  // Textures queued by subsequent Load*() calls are loaded ahead of those
+  // queued with a lower priority.
+  void set_load_priority(int priority) { load_priority_ = priority; }
+  int load_priority() const { return load_priority_; }
+
+  // When each texture finalized so far was queued, loaded and finalized.
+  const std::vector<AsyncLoadTiming> &load_timings() const {
+    return loader_.timings();
+  }
+
+  // Keep the textures loaded from now on within roughly 'bytes' of GPU
+  // memory, by evicting the ones drawn least recently. Evicted textures are
+  // drawn as a low resolution copy until they've been loaded again. Zero
+  // never evicts anything.
+  void set_texture_budget(size_t bytes) { texture_budget_ = bytes; }
+  size_t texture_budget() const { return texture_budget_; }
+  // GPU memory used by the textures currently loaded.
+  size_t resident_texture_bytes() const { return resident_texture_bytes_; }
+
+  // Call once per frame, after drawing, with the budget passed to
+  // TryFinalize(). Queues evicted textures that were drawn this frame to be
+  // loaded again, and evicts textures to stay within texture_budget().
+  void UpdateTextureResidency(int finalize_budget_microseconds = 0);
+
+  // Call when Renderer::CheckContextLoss() returns true. Relinks every
+  // shader in place, from its program binary if it has one, and uploads
+  // every mesh again from the copy it keeps. Textures are restored lazily:
+  // each is evicted, drawn as its low resolution copy, and reloaded ahead
+  // of anything else once it's drawn, so the current screen comes back
+  // first, from the textures' files.
+  void RestoreAfterContextLoss();
 
   // Returns a previously loaded material, or nullptr.
   Material *FindMaterial(const char *filename);
@@ -55,9 +116,10 @@ class MaterialManager {
   // If this returns nullptr, the error can be found in Renderer::last_error().
   Material *LoadMaterial(const char *filename);
 
-  // Deletes all OpenGL textures contained in this material, and removes the
-  // textures and the material from material manager. Any subsequent requests
-  // for these textures through Load*() will cause them to be loaded anew.
+  // Removes a reference to the material. When there are none left, the
+  // material is deleted, along with any of its textures that no other
+  // material uses. Any subsequent requests for these through Load*() will
+  // cause them to be loaded anew.
   void UnloadMaterial(const char *filename);
 
   // Returns a previously loaded mesh, or nullptr.
@@ -66,8 +128,9 @@ class MaterialManager {
   // root Mesh.
   // If this returns nullptr, the error can be found in Renderer::last_error().
   Mesh *LoadMesh(const char *filename);
-  // Deletes the mesh and removes it from the material manager. Any subsequent
-  // requests for this mesh through Load*() will cause them to be loaded anew.
+  // Removes a reference to the mesh, deleting it and releasing its materials
+  // when there are none left. Any subsequent requests for this mesh through
+  // Load*() will cause them to be loaded anew.
   void UnloadMesh(const char *filename);
 
   // Handy accessors, so you don't have to pass the renderer around too.
@@ -77,12 +140,60 @@ class MaterialManager {
  private:
   DISALLOW_COPY_AND_ASSIGN(MaterialManager);
 
+  // A loaded resource, and the references held on it.
+  template <typename T>
+  struct CachedResource {
+    typedef T ResourceType;
+    CachedResource() : resource(nullptr), references(0) {}
+    std::string name;
+    T *resource;
+    int references;
+    // Hashes of the resources this one loaded, released along with it.
+    std::vector<uint64_t> dependencies;
+  };
+  typedef std::unordered_map<uint64_t, CachedResource<Shader>> ShaderMap;
+  typedef std::unordered_map<uint64_t, CachedResource<Texture>> TextureMap;
+  typedef std::unordered_map<uint64_t, CachedResource<Material>> MaterialMap;
+  typedef std::unordered_map<uint64_t, CachedResource<Mesh>> MeshMap;
+
+  // Loads a shader's sources and starts linking them, queueing the shader
+  // to be finished later unless 'wait' is set.
+  Shader *LoadShaderSources(const char *basename, bool wait);
+  // Reads the .glslv and .glslf files of 'basename'. Logs, and sets
+  // Renderer::last_error(), if either can't be read.
+  bool LoadShaderFiles(const char *basename, std::string *vs_file,
+                       std::string *ps_file);
+  // Waits for a queued shader to link, logging the error if it failed.
+  bool FinishLoadingShader(Shader *shader);
+
+  void ReleaseTexture(uint64_t hash);
+  void ReleaseMaterial(uint64_t hash);
+
+  // Delete textures released while they were still loading, once the loader
+  // has finished with them.
+  void DeleteOrphanedTextures();
+
+  // Queue the evicted textures that have been drawn to be loaded again.
+  void QueueRequestedReloads();
+
+  // Evict the least recently drawn textures until the ones loaded fit within
+  // texture_budget_.
+  void EvictTextures();
+
   Renderer &renderer_;
-  std::map<std::string, Shader *> shader_map_;
-  std::map<std::string, Texture *> texture_map_;
-  std::map<std::string, Material *> material_map_;
-  std::map<std::string, Mesh *> mesh_map_;
+  ShaderMap shader_map_;
+  // Shaders from QueueShader() that haven't been finished yet.
+  std::vector<Shader *> queued_shaders_;
+  TextureMap texture_map_;
+  MaterialMap material_map_;
+  MeshMap mesh_map_;
+  TextureContentCache texture_contents_;
+  std::vector<Texture *> orphaned_textures_;
   AsyncLoader loader_;
+  int load_priority_;
+  TextureResidency texture_residency_;
+  size_t texture_budget_;
+  size_t resident_texture_bytes_;
 };
 
 }  // namespace fpl
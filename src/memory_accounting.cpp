@@ -0,0 +1,242 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "memory_accounting.h"
+#include <atomic>
+#include <new>
+
+using fpl::MemoryAccounting;
+using fpl::MemoryTag;
+using fpl::kMemoryTagCount;
+using fpl::kMemoryTagOther;
+
+// Count allocations by replacing the global operator new. The counters are
+// always updated, since that costs a few relaxed atomic adds per allocation.
+static std::atomic<uint64_t> g_allocation_count(0);
+static std::atomic<uint64_t> g_allocated_bytes(0);
+static std::atomic<uint64_t> g_heap_bytes[kMemoryTagCount];
+static std::atomic<uint64_t> g_peak_heap_bytes[kMemoryTagCount];
+
+// Holds each thread's current tag, plus one so that an unset slot reads as
+// kMemoryTagOther. Created by the first MemoryTagScope; until then, every
+// allocation is untagged.
+static SDL_SpinLock g_tag_tls_lock = 0;
+static std::atomic<SDL_TLSID> g_tag_tls(0);
+
+// Each allocation is preceded by its size and tag, so that deleting it can
+// credit them back. The header is padded to keep the allocation's alignment.
+struct AllocationHeader {
+  size_t size;
+  int tag;
+};
+static const size_t kHeaderSize = 16;
+static_assert(sizeof(AllocationHeader) <= kHeaderSize,
+              "AllocationHeader must fit in kHeaderSize.");
+
+static void Charge(int tag, size_t size) {
+  const uint64_t bytes =
+      g_heap_bytes[tag].fetch_add(size, std::memory_order_relaxed) + size;
+  uint64_t peak = g_peak_heap_bytes[tag].load(std::memory_order_relaxed);
+  while (bytes > peak &&
+         !g_peak_heap_bytes[tag].compare_exchange_weak(
+             peak, bytes, std::memory_order_relaxed)) {
+  }
+}
+
+static void *CountedAlloc(size_t size) {
+  g_allocation_count.fetch_add(1, std::memory_order_relaxed);
+  g_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  uint8_t *block = static_cast<uint8_t *>(malloc(kHeaderSize + size));
+  if (!block) return nullptr;
+  AllocationHeader *header = reinterpret_cast<AllocationHeader *>(block);
+  header->size = size;
+  header->tag = MemoryAccounting::CurrentTag();
+  Charge(header->tag, size);
+  return block + kHeaderSize;
+}
+
+static void CountedFree(void *p) {
+  if (!p) return;
+  uint8_t *block = static_cast<uint8_t *>(p) - kHeaderSize;
+  const AllocationHeader *header =
+      reinterpret_cast<const AllocationHeader *>(block);
+  g_heap_bytes[header->tag].fetch_sub(header->size,
+                                      std::memory_order_relaxed);
+  free(block);
+}
+
+// Exceptions are disabled on some of our platforms, so running out of memory
+// is fatal rather than throwing std::bad_alloc.
+static void *CountedAllocOrDie(size_t size) {
+  void *p = CountedAlloc(size);
+  if (!p) abort();
+  return p;
+}
+
+void *operator new(size_t size) { return CountedAllocOrDie(size); }
+void *operator new[](size_t size) { return CountedAllocOrDie(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) throw() {
+  return CountedAlloc(size);
+}
+void *operator new[](size_t size, const std::nothrow_t &) throw() {
+  return CountedAlloc(size);
+}
+
+void operator delete(void *p) throw() { CountedFree(p); }
+void operator delete[](void *p) throw() { CountedFree(p); }
+void operator delete(void *p, const std::nothrow_t &) throw() {
+  CountedFree(p);
+}
+void operator delete[](void *p, const std::nothrow_t &) throw() {
+  CountedFree(p);
+}
+
+namespace fpl {
+
+static const char *const kMemoryTagNames[] = {
+    "other", "textures", "meshes", "config", "fonts", "entities", "audio",
+};
+static_assert(sizeof(kMemoryTagNames) / sizeof(kMemoryTagNames[0]) ==
+                  kMemoryTagCount,
+              "kMemoryTagNames must name every MemoryTag.");
+
+const char *MemoryTagName(MemoryTag tag) { return kMemoryTagNames[tag]; }
+
+// GPU memory, only touched on the GL thread. The GL objects are looked up
+// by their kind in the top bit and their name in the rest.
+struct GpuAllocation {
+  MemoryTag tag;
+  size_t bytes;
+};
+static std::map<uint64_t, GpuAllocation> *g_gpu_allocations = nullptr;
+static uint64_t g_gpu_bytes[kMemoryTagCount];
+static uint64_t g_peak_gpu_bytes[kMemoryTagCount];
+static const uint64_t kBufferKey = 1ULL << 63;
+
+static void AddGpuAllocation(uint64_t key, MemoryTag default_tag,
+                             size_t bytes) {
+  if (!g_gpu_allocations) {
+    g_gpu_allocations = new std::map<uint64_t, GpuAllocation>();
+  }
+  const MemoryTag current = MemoryAccounting::CurrentTag();
+  const MemoryTag tag = current == kMemoryTagOther ? default_tag : current;
+  GpuAllocation &allocation = (*g_gpu_allocations)[key];
+  g_gpu_bytes[allocation.tag] -= allocation.bytes;
+  allocation.tag = tag;
+  allocation.bytes = bytes;
+  g_gpu_bytes[tag] += bytes;
+  g_peak_gpu_bytes[tag] = std::max(g_peak_gpu_bytes[tag], g_gpu_bytes[tag]);
+}
+
+static void RemoveGpuAllocation(uint64_t key) {
+  if (!g_gpu_allocations) return;
+  auto it = g_gpu_allocations->find(key);
+  if (it == g_gpu_allocations->end()) return;
+  g_gpu_bytes[it->second.tag] -= it->second.bytes;
+  g_gpu_allocations->erase(it);
+}
+
+MemoryTag MemoryAccounting::CurrentTag() {
+  const SDL_TLSID tls = g_tag_tls.load(std::memory_order_acquire);
+  if (!tls) return kMemoryTagOther;
+  const intptr_t slot = reinterpret_cast<intptr_t>(SDL_TLSGet(tls));
+  return slot ? static_cast<MemoryTag>(slot - 1) : kMemoryTagOther;
+}
+
+uint64_t MemoryAccounting::AllocationCount() {
+  return g_allocation_count.load(std::memory_order_relaxed);
+}
+
+uint64_t MemoryAccounting::AllocatedBytes() {
+  return g_allocated_bytes.load(std::memory_order_relaxed);
+}
+
+uint64_t MemoryAccounting::HeapBytes(MemoryTag tag) {
+  return g_heap_bytes[tag].load(std::memory_order_relaxed);
+}
+
+uint64_t MemoryAccounting::PeakHeapBytes(MemoryTag tag) {
+  return g_peak_heap_bytes[tag].load(std::memory_order_relaxed);
+}
+
+void MemoryAccounting::AddTexture(uint32_t id, size_t bytes) {
+  AddGpuAllocation(id, kMemoryTagTextures, bytes);
+}
+
+void MemoryAccounting::RemoveTexture(uint32_t id) { RemoveGpuAllocation(id); }
+
+void MemoryAccounting::AddBuffer(uint32_t id, size_t bytes) {
+  AddGpuAllocation(kBufferKey | id, kMemoryTagMeshes, bytes);
+}
+
+void MemoryAccounting::RemoveBuffer(uint32_t id) {
+  RemoveGpuAllocation(kBufferKey | id);
+}
+
+void MemoryAccounting::ForgetGpuAllocations() {
+  if (g_gpu_allocations) g_gpu_allocations->clear();
+  for (int i = 0; i < kMemoryTagCount; ++i) g_gpu_bytes[i] = 0;
+}
+
+uint64_t MemoryAccounting::GpuBytes(MemoryTag tag) { return g_gpu_bytes[tag]; }
+
+uint64_t MemoryAccounting::PeakGpuBytes(MemoryTag tag) {
+  return g_peak_gpu_bytes[tag];
+}
+
+void MemoryAccounting::LogReport() {
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+              "Memory in KB:  heap (peak)            gpu (peak)\n");
+  uint64_t heap_total = 0;
+  uint64_t gpu_total = 0;
+  for (int i = 0; i < kMemoryTagCount; ++i) {
+    const MemoryTag tag = static_cast<MemoryTag>(i);
+    heap_total += HeapBytes(tag);
+    gpu_total += GpuBytes(tag);
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "  %-10s %8d (%8d)     %8d (%8d)\n", MemoryTagName(tag),
+                static_cast<int>(HeapBytes(tag) / 1024),
+                static_cast<int>(PeakHeapBytes(tag) / 1024),
+                static_cast<int>(GpuBytes(tag) / 1024),
+                static_cast<int>(PeakGpuBytes(tag) / 1024));
+  }
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+              "  %-10s %8d                %8d\n", "total",
+              static_cast<int>(heap_total / 1024),
+              static_cast<int>(gpu_total / 1024));
+}
+
+MemoryTagScope::MemoryTagScope(MemoryTag tag)
+    : previous_(MemoryAccounting::CurrentTag()) {
+  if (!g_tag_tls.load(std::memory_order_acquire)) {
+    SDL_AtomicLock(&g_tag_tls_lock);
+    if (!g_tag_tls.load(std::memory_order_relaxed)) {
+      g_tag_tls.store(SDL_TLSCreate(), std::memory_order_release);
+    }
+    SDL_AtomicUnlock(&g_tag_tls_lock);
+  }
+  SDL_TLSSet(g_tag_tls.load(std::memory_order_relaxed),
+             reinterpret_cast<void *>(static_cast<intptr_t>(tag) + 1),
+             nullptr);
+}
+
+MemoryTagScope::~MemoryTagScope() {
+  SDL_TLSSet(g_tag_tls.load(std::memory_order_relaxed),
+             reinterpret_cast<void *>(static_cast<intptr_t>(previous_) + 1),
+             nullptr);
+}
+
+}  // namespace fpl
@@ -0,0 +1,93 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_MEMORY_ACCOUNTING_H
+#define FPL_MEMORY_ACCOUNTING_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace fpl {
+
+// The subsystems memory is budgeted by.
+enum MemoryTag {
+  kMemoryTagOther,
+  kMemoryTagTextures,
+  kMemoryTagMeshes,
+  kMemoryTagConfig,
+  kMemoryTagFonts,
+  kMemoryTagEntities,
+  kMemoryTagAudio,
+  kMemoryTagCount
+};
+
+const char *MemoryTagName(MemoryTag tag);
+
+// Counts the memory each subsystem holds, on the heap and on the GPU.
+//
+// Heap memory is counted by replacing the global operator new, which charges
+// each allocation to the tag of the innermost MemoryTagScope open on the
+// calling thread, and credits it back to the same tag when it's deleted.
+// Memory from malloc(), or allocated inside libraries that don't use
+// operator new, isn't seen. GPU memory is counted where it's created, by
+// Renderer::CreateTexture() and Mesh, which know how many bytes they upload.
+class MemoryAccounting {
+ public:
+  // The tag new allocations on this thread are charged to.
+  static MemoryTag CurrentTag();
+
+  // Number of calls to operator new, and bytes requested by them, since the
+  // program started.
+  static uint64_t AllocationCount();
+  static uint64_t AllocatedBytes();
+
+  // Bytes allocated with 'tag' and not yet deleted, and the most there have
+  // been at once.
+  static uint64_t HeapBytes(MemoryTag tag);
+  static uint64_t PeakHeapBytes(MemoryTag tag);
+
+  // Record GPU memory created and released, by GL object. Textures and
+  // buffers are separate, since their names can overlap. The memory is
+  // charged to the current tag, or if there isn't one, to textures or meshes.
+  // Only call these on the thread with the GL context.
+  static void AddTexture(uint32_t id, size_t bytes);
+  static void RemoveTexture(uint32_t id);
+  static void AddBuffer(uint32_t id, size_t bytes);
+  static void RemoveBuffer(uint32_t id);
+  // Forget every GPU allocation, when the GL context they were made in has
+  // been lost. The peaks are kept.
+  static void ForgetGpuAllocations();
+
+  // GPU bytes held with 'tag', and the most there have been at once.
+  static uint64_t GpuBytes(MemoryTag tag);
+  static uint64_t PeakGpuBytes(MemoryTag tag);
+
+  // Log the current and peak bytes of each tag, on the heap and the GPU.
+  static void LogReport();
+};
+
+// Charges allocations on this thread to 'tag' for the lifetime of the object.
+// Scopes nest; the innermost one wins.
+class MemoryTagScope {
+ public:
+  explicit MemoryTagScope(MemoryTag tag);
+  ~MemoryTagScope();
+
+ private:
+  MemoryTag previous_;
+};
+
+}  // namespace fpl
+
+#endif  // FPL_MEMORY_ACCOUNTING_H
@@ -14,102 +14,111 @@
 
 #include "precompiled.h"
 #include "mesh.h"
+#include "memory_accounting.h"
+#include "renderer.h"
+#include "stream_buffer.h"
 
 namespace fpl {
 
+// Where RenderArray() puts its vertices and indices. Sized to hold a typical
+// frame's worth of UI and text.
+static StreamBuffer vertex_stream(GL_ARRAY_BUFFER, 256 * 1024);
+static StreamBuffer index_stream(GL_ELEMENT_ARRAY_BUFFER, 64 * 1024);
+
+// How GL reads each Attribute, indexed by it, taken from the VertexAttribute
+// that describes it.
+struct AttributeInfo {
+  Attribute attribute;
+  int location;
+  int components;
+  GLenum type;
+  bool normalized;
+  size_t size;
+};
+#define FPL_ATTRIBUTE_INFO(A) \
+  { A::kAttribute, A::kLocation, A::kComponents, A::kType, A::kNormalized, \
+    A::kSize }
+static const AttributeInfo kAttributeInfo[] = {
+    {kEND, 0, 0, 0, false, 0},
+    FPL_ATTRIBUTE_INFO(Position3f),
+    FPL_ATTRIBUTE_INFO(Normal3f),
+    FPL_ATTRIBUTE_INFO(Tangent4f),
+    FPL_ATTRIBUTE_INFO(TexCoord2f),
+    FPL_ATTRIBUTE_INFO(Color4ub),
+    FPL_ATTRIBUTE_INFO(Position3h),
+    FPL_ATTRIBUTE_INFO(Normal10),
+    FPL_ATTRIBUTE_INFO(Tangent10),
+    FPL_ATTRIBUTE_INFO(TexCoord2h),
+    FPL_ATTRIBUTE_INFO(TexCoord2us),
+};
+#undef FPL_ATTRIBUTE_INFO
+static_assert(sizeof(kAttributeInfo) / sizeof(kAttributeInfo[0]) ==
+                  kTexCoord2us + 1,
+              "kAttributeInfo must describe every Attribute.");
+
 void Mesh::SetAttributes(GLuint vbo, const Attribute *attributes, int stride,
                          const char *buffer) {
   GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, vbo));
   size_t offset = 0;
-  for (;;) {
-    switch (*attributes++) {
-      case kPosition3f:
-        GL_CALL(glEnableVertexAttribArray(kAttributePosition));
-        GL_CALL(glVertexAttribPointer(kAttributePosition, 3, GL_FLOAT, false,
-                                      stride, buffer + offset));
-        offset += 3 * sizeof(float);
-        break;
-      case kNormal3f:
-        GL_CALL(glEnableVertexAttribArray(kAttributeNormal));
-        GL_CALL(glVertexAttribPointer(kAttributeNormal, 3, GL_FLOAT, false,
-                                      stride, buffer + offset));
-        offset += 3 * sizeof(float);
-        break;
-      case kTangent4f:
-        GL_CALL(glEnableVertexAttribArray(kAttributeTangent));
-        GL_CALL(glVertexAttribPointer(kAttributeTangent, 3, GL_FLOAT, false,
-                                      stride, buffer + offset));
-        offset += 4 * sizeof(float);
-        break;
-      case kTexCoord2f:
-        GL_CALL(glEnableVertexAttribArray(kAttributeTexCoord));
-        GL_CALL(glVertexAttribPointer(kAttributeTexCoord, 2, GL_FLOAT, false,
-                                      stride, buffer + offset));
-        offset += 2 * sizeof(float);
-        break;
-      case kColor4ub:
-        GL_CALL(glEnableVertexAttribArray(kAttributeColor));
-        GL_CALL(glVertexAttribPointer(kAttributeColor, 4, GL_UNSIGNED_BYTE,
-                                      true, stride, buffer + offset));
-        offset += 4;
-        break;
-      case kEND:
-        return;
-    }
+  for (; *attributes != kEND; ++attributes) {
+    const AttributeInfo &info = kAttributeInfo[*attributes];
+    assert(info.attribute == *attributes);
+    GL_CALL(glEnableVertexAttribArray(info.location));
+    GL_CALL(glVertexAttribPointer(info.location, info.components, info.type,
+                                  info.normalized, stride, buffer + offset));
+    offset += info.size;
   }
 }
 
 size_t Mesh::VertexSize(const Attribute *attributes) {
   size_t size = 0;
-  for (;;) {
-    switch (*attributes++) {
-      case kPosition3f: size += 3 * sizeof(float); break;
-      case kNormal3f:   size += 3 * sizeof(float); break;
-      case kTangent4f:  size += 4 * sizeof(float); break;
-      case kTexCoord2f: size += 2 * sizeof(float); break;
-      case kColor4ub:   size += 4;                 break;
-      case kEND:        return size;
-    }
+  for (; *attributes != kEND; ++attributes) {
+    size += kAttributeInfo[*attributes].size;
   }
+  return size;
 }
 
 void Mesh::UnSetAttributes(const Attribute *attributes) {
-  for (;;) {
-    switch (*attributes++) {
-      case kPosition3f:
-        GL_CALL(glDisableVertexAttribArray(kAttributePosition));
-        break;
-      case kNormal3f:
-        GL_CALL(glDisableVertexAttribArray(kAttributeNormal));
-        break;
-      case kTangent4f:
-        GL_CALL(glDisableVertexAttribArray(kAttributeTangent));
-        break;
-      case kTexCoord2f:
-        GL_CALL(glDisableVertexAttribArray(kAttributeTexCoord));
-        break;
-      case kColor4ub:
-        GL_CALL(glDisableVertexAttribArray(kAttributeColor));
-        break;
-      case kEND:
-        return;
-    }
+  for (; *attributes != kEND; ++attributes) {
+    GL_CALL(glDisableVertexAttribArray(kAttributeInfo[*attributes].location));
   }
 }
 
-Mesh::Mesh(const void *vertex_data, int count, int vertex_size,
-           const Attribute *format)
-    : vertex_size_(vertex_size), format_(format) {
+Mesh::Mesh(Renderer &renderer, const void *vertex_data, int count,
+           int vertex_size, const Attribute *format)
+    : renderer_(&renderer), vertex_size_(vertex_size), vao_(0) {
+  // Keep our own copy of the format, since callers may build it on the stack.
+  do {
+    format_.push_back(*format);
+  } while (*format++ != kEND);
+  const uint8_t *bytes = static_cast<const uint8_t *>(vertex_data);
+  vertex_data_.assign(bytes, bytes + count * vertex_size);
+  CreateVertexBuffer();
+}
+
+void Mesh::CreateVertexBuffer() {
   GL_CALL(glGenBuffers(1, &vbo_));
   GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, vbo_));
-  GL_CALL(glBufferData(GL_ARRAY_BUFFER, count * vertex_size, vertex_data,
-                       GL_STATIC_DRAW));
+  GL_CALL(glBufferData(GL_ARRAY_BUFFER, vertex_data_.size(),
+                       vertex_data_.data(), GL_STATIC_DRAW));
+  Renderer::CountUpload(vertex_data_.size());
+  MemoryAccounting::AddBuffer(vbo_, vertex_data_.size());
+  vao_ = 0;
+  if (renderer_->SupportsVertexArrays()) {
+    renderer_->GenVertexArrays(1, &vao_);
+    renderer_->BindVertexArray(vao_);
+    SetAttributes(vbo_, format_.data(), vertex_size_, nullptr);
+    renderer_->BindVertexArray(0);
+  }
 }
 
 Mesh::~Mesh() {
+  if (vao_) renderer_->DeleteVertexArrays(1, &vao_);
   GL_CALL(glDeleteBuffers(1, &vbo_));
+  MemoryAccounting::RemoveBuffer(vbo_);
   for (auto it = indices_.begin(); it != indices_.end(); ++it) {
     GL_CALL(glDeleteBuffers(1, &it->ibo));
+    MemoryAccounting::RemoveBuffer(it->ibo);
   }
 }
 
@@ -118,36 +127,118 @@ void Mesh::AddIndices(const unsigned short *index_data, int count,
   indices_.push_back(Indices());
   auto &idxs = indices_.back();
   idxs.count = count;
-  GL_CALL(glGenBuffers(1, &idxs.ibo));
-  GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, idxs.ibo));
-  GL_CALL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * sizeof(short),
-                       index_data, GL_STATIC_DRAW));
   idxs.mat = mat;
+  idxs.data.assign(index_data, index_data + count);
+  CreateIndexBuffer(&idxs);
+}
+
+void Mesh::CreateIndexBuffer(Indices *indices) {
+  const size_t size = indices->data.size() * sizeof(unsigned short);
+  GL_CALL(glGenBuffers(1, &indices->ibo));
+  GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices->ibo));
+  GL_CALL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, indices->data.data(),
+                       GL_STATIC_DRAW));
+  Renderer::CountUpload(size);
+  MemoryAccounting::AddBuffer(indices->ibo, size);
+}
+
+void Mesh::RestoreBuffers() {
+  CreateVertexBuffer();
+  for (auto it = indices_.begin(); it != indices_.end(); ++it) {
+    CreateIndexBuffer(&*it);
+  }
+}
+
+void Mesh::BindAttributes() const {
+  if (vao_) {
+    renderer_->BindVertexArray(vao_);
+  } else {
+    SetAttributes(vbo_, format_.data(), vertex_size_, nullptr);
+  }
+}
+
+void Mesh::UnbindAttributes() const {
+  if (vao_) {
+    renderer_->BindVertexArray(0);
+  } else {
+    UnSetAttributes(format_.data());
+  }
 }
 
 void Mesh::Render(Renderer &renderer, bool ignore_material) {
-  SetAttributes(vbo_, format_, vertex_size_, nullptr);
+  BindAttributes();
   for (auto it = indices_.begin(); it != indices_.end(); ++it) {
     if (!ignore_material) it->mat->Set(renderer);
     GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, it->ibo));
     GL_CALL(glDrawElements(GL_TRIANGLES, it->count, GL_UNSIGNED_SHORT, 0));
+    Renderer::CountDraw(GL_TRIANGLES, it->count);
+  }
+  UnbindAttributes();
+}
+
+void Mesh::RenderInstanced(Renderer &renderer, int instance_count,
+                           bool ignore_material) {
+  SetAttributes(vbo_, format_.data(), vertex_size_, nullptr);
+  for (auto it = indices_.begin(); it != indices_.end(); ++it) {
+    if (!ignore_material) it->mat->Set(renderer);
+    GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, it->ibo));
+    renderer.DrawElementsInstanced(GL_TRIANGLES, it->count, GL_UNSIGNED_SHORT,
+                                   0, instance_count);
   }
-  UnSetAttributes(format_);
+  UnSetAttributes(format_.data());
+}
+
+const char *Mesh::StreamVertices(int index_count, size_t vertex_size,
+                                 const char *vertices,
+                                 const unsigned short *indices) {
+  const unsigned short max_index =
+      *std::max_element(indices, indices + index_count);
+  const size_t vertex_offset =
+      vertex_stream.Append(vertices, (max_index + 1) * vertex_size);
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, vertex_stream.buffer()));
+  return static_cast<const char *>(nullptr) + vertex_offset;
+}
+
+void Mesh::DrawStreamed(GLenum primitive, int index_count,
+                        const unsigned short *indices) {
+  const size_t index_offset =
+      index_stream.Append(indices, index_count * sizeof(unsigned short));
+  GL_CALL(glDrawElements(primitive, index_count, GL_UNSIGNED_SHORT,
+                         static_cast<const char *>(nullptr) + index_offset));
+  Renderer::CountDraw(primitive, index_count);
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+  GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
 }
 
 void Mesh::RenderArray(GLenum primitive, int index_count,
                        const Attribute *format, int vertex_size,
                        const char *vertices, const unsigned short *indices) {
-  SetAttributes(0, format, vertex_size, vertices);
-  GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
-  GL_CALL(glDrawElements(primitive, index_count, GL_UNSIGNED_SHORT, indices));
+  if (index_count <= 0) return;
+  const char *buffer =
+      StreamVertices(index_count, vertex_size, vertices, indices);
+  SetAttributes(vertex_stream.buffer(), format, vertex_size, buffer);
+  DrawStreamed(primitive, index_count, indices);
   UnSetAttributes(format);
 }
 
+void Mesh::AdvanceStreamingFrame() {
+  vertex_stream.AdvanceFrame();
+  index_stream.AdvanceFrame();
+}
+
+void Mesh::DeleteStreamingBuffers() {
+  vertex_stream.Delete();
+  index_stream.Delete();
+}
+
+void Mesh::ForgetStreamingBuffers() {
+  vertex_stream.Forget();
+  index_stream.Forget();
+}
+
 void Mesh::RenderAAQuadAlongX(const vec3 &bottom_left, const vec3 &top_right,
                               const vec2 &tex_bottom_left,
                               const vec2 &tex_top_right) {
-  static const Attribute format[] = {kPosition3f, kTexCoord2f, kEND};
   static const unsigned short indices[] = { 0, 1, 2, 1, 2, 3 };
   // vertex format is [x, y, z] [u, v]:
   const float vertices[] = {
@@ -158,15 +249,14 @@ void Mesh::RenderAAQuadAlongX(const vec3 &bottom_left, const vec3 &top_right,
       top_right.z(),       tex_bottom_left.x(), tex_top_right.y(),
       top_right.x(),       top_right.y(),       top_right.z(),
       tex_top_right.x(),   tex_top_right.y()};
-  Mesh::RenderArray(GL_TRIANGLES, 6, format, sizeof(float) * 5,
-                    reinterpret_cast<const char *>(vertices), indices);
+  Mesh::RenderArray<VertexFormat<Position3f, TexCoord2f>>(
+      GL_TRIANGLES, 6, reinterpret_cast<const char *>(vertices), indices);
 }
 
 void Mesh::RenderAAQuadAlongXNinePatch(const vec3 &bottom_left,
                                        const vec3 &top_right,
                                        const vec2i &texture_size,
                                        const vec4 &patch_info) {
-  static const Attribute format[] = {kPosition3f, kTexCoord2f, kEND};
   static const unsigned short indices[] = {
       0, 1,  2, 1,  2, 3,  2, 3,  4,  3,  4,  5,  4,  5,  6,  5,  6,  7,
       1, 8,  3, 8,  3, 9,  3, 9,  5,  9,  5,  10, 5,  10, 7,  10, 7,  11,
@@ -204,8 +294,8 @@ void Mesh::RenderAAQuadAlongXNinePatch(const vec3 &bottom_left,
       max.x(), p0.y(),  z, 1.0f,           patch_info.y(),
       max.x(), p1.y(),  z, 1.0f,           patch_info.w(),
       max.x(), max.y(), z, 1.0f,           1.0f, };
-  Mesh::RenderArray(GL_TRIANGLES, 6 * 9, format, sizeof(float) * 5,
-                    reinterpret_cast<const char *>(vertices), indices);
+  Mesh::RenderArray<VertexFormat<Position3f, TexCoord2f>>(
+      GL_TRIANGLES, 6 * 9, reinterpret_cast<const char *>(vertices), indices);
 }
 
 // Compute normals and tangents for a mesh based on positions and texcoords.
@@ -271,4 +361,132 @@ void Mesh::ComputeNormalsTangents(NormalMappedVertex *vertices,
   }
 }
 
+// Converts 'value' to a half float, rounding to nearest. Values too small
+// for a half become zero, and values too large become infinity.
+static uint16_t FloatToHalf(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  const int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+  if (exponent >= 31) {
+    const bool is_nan = ((bits >> 23) & 0xff) == 0xff && mantissa != 0;
+    return static_cast<uint16_t>(sign | 0x7c00 | (is_nan ? 0x200 : 0));
+  }
+  if (exponent <= 0) {
+    // Becomes a denormal, or zero.
+    if (exponent < -10) return static_cast<uint16_t>(sign);
+    mantissa |= 0x800000;
+    const int shift = 14 - exponent;
+    uint32_t half = mantissa >> shift;
+    if ((mantissa >> (shift - 1)) & 1) half++;
+    return static_cast<uint16_t>(sign | half);
+  }
+  uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+  // Rounding may carry into the exponent, which is still the nearest half.
+  if (mantissa & 0x1000) half++;
+  return static_cast<uint16_t>(half);
+}
+
+// Packs 'value', clamped to [-1, 1], into the low 'bits' bits.
+static uint32_t PackSnorm(float value, int bits) {
+  const float max = static_cast<float>((1 << (bits - 1)) - 1);
+  const float clamped = std::min(std::max(value, -1.0f), 1.0f);
+  const int packed = static_cast<int>(floorf(clamped * max + 0.5f));
+  return static_cast<uint32_t>(packed) & ((1u << bits) - 1);
+}
+
+// Packs a vector for GL_INT_2_10_10_10_REV: x, y and z in 10 bits each from
+// the lowest bit up, and w in the top 2.
+static uint32_t PackSnorm2101010(float x, float y, float z, float w) {
+  return PackSnorm(x, 10) | (PackSnorm(y, 10) << 10) |
+         (PackSnorm(z, 10) << 20) | (PackSnorm(w, 2) << 30);
+}
+
+void Mesh::Quantize(const void *vertices, int count, const Attribute *format,
+                    std::vector<uint8_t> *quantized,
+                    std::vector<Attribute> *quantized_format) {
+  const size_t vertex_size = VertexSize(format);
+  const uint8_t *source = static_cast<const uint8_t *>(vertices);
+
+  // Choose each attribute's quantized format. Texture coordinates keep more
+  // precision as shorts, but those can't tile.
+  quantized_format->clear();
+  size_t offset = 0;
+  for (const Attribute *attribute = format; *attribute != kEND; ++attribute) {
+    Attribute quantized_attribute = *attribute;
+    switch (*attribute) {
+      case kPosition3f: quantized_attribute = kPosition3h; break;
+      case kNormal3f:   quantized_attribute = kNormal10;   break;
+      case kTangent4f:  quantized_attribute = kTangent10;  break;
+      case kTexCoord2f: {
+        bool in_unit_range = true;
+        for (int i = 0; i < count && in_unit_range; ++i) {
+          float tc[2];
+          memcpy(tc, source + i * vertex_size + offset, sizeof(tc));
+          in_unit_range =
+              tc[0] >= 0.0f && tc[0] <= 1.0f && tc[1] >= 0.0f && tc[1] <= 1.0f;
+        }
+        quantized_attribute = in_unit_range ? kTexCoord2us : kTexCoord2h;
+        break;
+      }
+      default: break;
+    }
+    quantized_format->push_back(quantized_attribute);
+    const Attribute single[] = { *attribute, kEND };
+    offset += VertexSize(single);
+  }
+  quantized_format->push_back(kEND);
+
+  quantized->resize(VertexSize(quantized_format->data()) * count);
+  uint8_t *dest = quantized->data();
+  for (int i = 0; i < count; ++i) {
+    const uint8_t *from = source + i * vertex_size;
+    for (size_t j = 0; format[j] != kEND; ++j) {
+      float value[4];
+      const Attribute single[] = { format[j], kEND };
+      const size_t size = VertexSize(single);
+      if (format[j] != kColor4ub) memcpy(value, from, size);
+      from += size;
+      switch ((*quantized_format)[j]) {
+        case kPosition3h: {
+          const uint16_t half[] = { FloatToHalf(value[0]),
+                                    FloatToHalf(value[1]),
+                                    FloatToHalf(value[2]), FloatToHalf(1.0f) };
+          memcpy(dest, half, sizeof(half));
+          dest += sizeof(half);
+          break;
+        }
+        case kNormal10:
+        case kTangent10: {
+          const uint32_t packed =
+              PackSnorm2101010(value[0], value[1], value[2], 1.0f);
+          memcpy(dest, &packed, sizeof(packed));
+          dest += sizeof(packed);
+          break;
+        }
+        case kTexCoord2h: {
+          const uint16_t half[] = { FloatToHalf(value[0]),
+                                    FloatToHalf(value[1]) };
+          memcpy(dest, half, sizeof(half));
+          dest += sizeof(half);
+          break;
+        }
+        case kTexCoord2us: {
+          const uint16_t unorm[] = {
+            static_cast<uint16_t>(floorf(value[0] * 65535.0f + 0.5f)),
+            static_cast<uint16_t>(floorf(value[1] * 65535.0f + 0.5f)) };
+          memcpy(dest, unorm, sizeof(unorm));
+          dest += sizeof(unorm);
+          break;
+        }
+        default:
+          memcpy(dest, from - size, size);
+          dest += size;
+          break;
+      }
+    }
+  }
+}
+
 }  // namespace fpl
@@ -32,7 +32,15 @@ enum Attribute {
   kNormal3f,
   kTangent4f,
   kTexCoord2f,
-  kColor4ub
+  kColor4ub,
+  // Quantized versions of the above, made by Mesh::Quantize(). Only usable
+  // if Renderer::SupportsQuantizedVertices() is true.
+  kPosition3h,   // Half floats, padded to 8 bytes.
+  kNormal10,     // Signed normalized 10:10:10:2, with w unused.
+  kTangent10,    // Signed normalized 10:10:10:2. Like kTangent4f, shaders
+                 // only get xyz, and see 1 in w.
+  kTexCoord2h,   // Half floats.
+  kTexCoord2us   // Unsigned normalized shorts, for coordinates in [0, 1].
 };
 
 // A vertex definition specific to normalmapping.
@@ -46,30 +54,52 @@ struct NormalMappedVertex {
   vec4_packed tangent;
 };
 
-// A mesh instance contains a VBO and one or more IBO's.
+// A mesh instance contains a VBO and one or more IBO's. It keeps a copy of
+// the data it uploaded, so that the buffers can be recreated if the GL
+// context is lost.
 class Mesh {
  public:
-  // Initialize a Mesh by creating one VBO, and no IBO's.
-  Mesh(const void *vertex_data, int count, int vertex_size,
+  // Initialize a Mesh by creating one VBO, and no IBO's. If the context
+  // supports them, also records the vertex format in a VAO, so that drawing
+  // needs a single bind instead of setting up each attribute.
+  Mesh(Renderer &renderer, const void *vertex_data, int count, int vertex_size,
        const Attribute *format);
   ~Mesh();
 
   // Create one IBO to be part of this mesh. May be called more than once.
   void AddIndices(const unsigned short *indices, int count, Material *mat);
 
+  // Upload the mesh again, once the GL context its buffers were made in has
+  // been lost. The old buffers went with it, so aren't deleted.
+  void RestoreBuffers();
+
   // Render itself. Uniforms must have been set before calling this.
   void Render(Renderer &renderer, bool ignore_material = false);
 
+  // Render 'instance_count' copies of itself in one draw call. The caller is
+  // responsible for setting up any per-instance attributes first. Those live
+  // in the default vertex array, so this doesn't use the mesh's VAO.
+  // Only valid if renderer.SupportsInstancing() is true.
+  void RenderInstanced(Renderer &renderer, int instance_count,
+                       bool ignore_material = false);
+
   // Get the material associated with the Nth IBO.
   Material *GetMaterial(int i) { return indices_[i].mat; }
 
   // Renders primatives using vertex and index data directly in local memory.
   // This is a convenient alternative to creating a Mesh instance for small
-  // amounts of data, or dynamic data.
+  // amounts of data, or dynamic data. The data is copied into a streaming
+  // VBO, so it need not outlive the call.
   static void RenderArray(GLenum primitive, int index_count,
                           const Attribute *format, int vertex_size,
                           const char *vertices, const unsigned short *indices);
 
+  // As above, for vertices in a VertexFormat, whose layout is resolved at
+  // compile time rather than read from an Attribute array on every call.
+  template <typename Format>
+  static void RenderArray(GLenum primitive, int index_count,
+                          const char *vertices, const unsigned short *indices);
+
   // Convenience method for rendering a Quad. bottom_left and top_right must
   // have their X coordinate be different, but either Y or Z can be the same.
   static void RenderAAQuadAlongX(const vec3 &bottom_left, const vec3 &top_right,
@@ -86,6 +116,16 @@ class Mesh {
                                           const vec2i &texture_size,
                                           const vec4 &patch_info);
 
+  // Move RenderArray() on to the next of its streaming buffers. Called by
+  // Renderer::AdvanceFrame().
+  static void AdvanceStreamingFrame();
+
+  // Free the streaming buffers used by RenderArray(), while the GL context
+  // still exists.
+  static void DeleteStreamingBuffers();
+  // Forget them instead, once the GL context has been lost.
+  static void ForgetStreamingBuffers();
+
   // Compute normals and tangents given position and texcoords.
   static void ComputeNormalsTangents(NormalMappedVertex *vertices,
                                      const unsigned short *indices,
@@ -96,27 +136,162 @@ class Mesh {
     kAttributeNormal,
     kAttributeTangent,
     kAttributeTexCoord,
-    kAttributeColor
+    kAttributeColor,
+    // Rows of the object-to-world transform for instanced rendering.
+    // The bottom row is always (0, 0, 0, 1), so it is not passed in.
+    kAttributeInstanceRow0,
+    kAttributeInstanceRow1,
+    kAttributeInstanceRow2,
+    // The GPU particle shader (see gpu_particles.h) has inputs of its own,
+    // which share the locations above.
+    kAttributeParticleVelocity = kAttributeNormal,
+    kAttributeParticleOffset = kAttributeTangent,
+    kAttributeParticleOrientation = kAttributeInstanceRow0,
+    kAttributeParticleAngularVelocity = kAttributeInstanceRow1,
+    kAttributeParticleScale = kAttributeInstanceRow2
   };
 
   // Compute the byte size for a vertex from given attributes.
   static size_t VertexSize(const Attribute *attributes);
 
+  // Converts 'count' vertices in 'format' to the smallest format that keeps
+  // them looking the same: positions and texture coordinates to half floats,
+  // or texture coordinates to shorts if they're all in [0, 1], and normals
+  // and tangents to 10:10:10:2. Colors are kept as they are. The quantized
+  // vertices are less than half the size of the originals, so take less
+  // memory and bandwidth to draw.
+  static void Quantize(const void *vertices, int count,
+                       const Attribute *format,
+                       std::vector<uint8_t> *quantized,
+                       std::vector<Attribute> *quantized_format);
+
  private:
   static void SetAttributes(GLuint vbo, const Attribute *attributes,
                             int vertex_size, const char *buffer);
   static void UnSetAttributes(const Attribute *attributes);
+  // Copy the vertices that RenderArray()'s 'indices' use into the streaming
+  // VBO, and bind it. Returns where they start in it, for
+  // glVertexAttribPointer().
+  static const char *StreamVertices(int index_count, size_t vertex_size,
+                                    const char *vertices,
+                                    const unsigned short *indices);
+  // Stream 'indices' too, and draw them from the streamed vertices.
+  static void DrawStreamed(GLenum primitive, int index_count,
+                           const unsigned short *indices);
+  void BindAttributes() const;
+  void UnbindAttributes() const;
   struct Indices {
     int count;
     GLuint ibo;
     Material *mat;
+    std::vector<unsigned short> data;
   };
+  // Create vbo_ and vao_ from vertex_data_, or an IBO from its data.
+  void CreateVertexBuffer();
+  static void CreateIndexBuffer(Indices *indices);
   std::vector<Indices> indices_;
+  Renderer *renderer_;
   size_t vertex_size_;
-  const Attribute *format_;
+  std::vector<Attribute> format_;
+  std::vector<uint8_t> vertex_data_;
   GLuint vbo_;
+  // The attribute setup of vbo_, or 0 if VAOs are unsupported.
+  GLuint vao_;
+};
+
+// Compile-time description of one kind of vertex attribute, for VertexFormat:
+// the Attribute it stands for, the shader input it feeds, how GL reads it and
+// its size in bytes.
+template <Attribute A, int Location, int Components, GLenum Type,
+          bool Normalized, size_t Size>
+struct VertexAttribute {
+  static const Attribute kAttribute = A;
+  static const int kLocation = Location;
+  static const int kComponents = Components;
+  static const GLenum kType = Type;
+  static const bool kNormalized = Normalized;
+  static const size_t kSize = Size;
 };
 
+typedef VertexAttribute<kPosition3f, Mesh::kAttributePosition, 3, GL_FLOAT,
+                        false, 3 * sizeof(float)> Position3f;
+typedef VertexAttribute<kNormal3f, Mesh::kAttributeNormal, 3, GL_FLOAT, false,
+                        3 * sizeof(float)> Normal3f;
+// Shaders only get xyz.
+typedef VertexAttribute<kTangent4f, Mesh::kAttributeTangent, 3, GL_FLOAT,
+                        false, 4 * sizeof(float)> Tangent4f;
+typedef VertexAttribute<kTexCoord2f, Mesh::kAttributeTexCoord, 2, GL_FLOAT,
+                        false, 2 * sizeof(float)> TexCoord2f;
+typedef VertexAttribute<kColor4ub, Mesh::kAttributeColor, 4, GL_UNSIGNED_BYTE,
+                        true, 4> Color4ub;
+typedef VertexAttribute<kPosition3h, Mesh::kAttributePosition, 3,
+                        GL_HALF_FLOAT, false, 4 * sizeof(uint16_t)> Position3h;
+typedef VertexAttribute<kNormal10, Mesh::kAttributeNormal, 4,
+                        GL_INT_2_10_10_10_REV, true, sizeof(uint32_t)> Normal10;
+typedef VertexAttribute<kTangent10, Mesh::kAttributeTangent, 4,
+                        GL_INT_2_10_10_10_REV, true, sizeof(uint32_t)>
+    Tangent10;
+typedef VertexAttribute<kTexCoord2h, Mesh::kAttributeTexCoord, 2,
+                        GL_HALF_FLOAT, false, 2 * sizeof(uint16_t)> TexCoord2h;
+typedef VertexAttribute<kTexCoord2us, Mesh::kAttributeTexCoord, 2,
+                        GL_UNSIGNED_SHORT, true, 2 * sizeof(uint16_t)>
+    TexCoord2us;
+
+// A vertex format fixed at compile time: its attributes, in the order they're
+// laid out in each vertex. For example, VertexFormat<Position3f, TexCoord2f>
+// is the same format as {kPosition3f, kTexCoord2f, kEND}. The vertex size and
+// each attribute's offset and GL setup are resolved by the compiler, so
+// setting it up is a straight run of GL calls. Formats only known at runtime,
+// as of meshes loaded from files, use Attribute arrays instead.
+template <typename... Attributes>
+struct VertexFormat;
+
+template <>
+struct VertexFormat<> {
+  static const size_t kSize = 0;
+  static const uint32_t kEnableMask = 0;
+  static void Set(GLsizei, const char *) {}
+  static void Unset() {}
+};
+
+template <typename First, typename... Rest>
+struct VertexFormat<First, Rest...> {
+  // Bytes per vertex.
+  static const size_t kSize = First::kSize + VertexFormat<Rest...>::kSize;
+  // The shader inputs the format feeds, as a bit per input.
+  static const uint32_t kEnableMask =
+      (1u << First::kLocation) | VertexFormat<Rest...>::kEnableMask;
+  static_assert((VertexFormat<Rest...>::kEnableMask &
+                 (1u << First::kLocation)) == 0,
+                "Two attributes feed the same shader input.");
+
+  // Point the shader inputs at vertices 'stride' bytes apart, starting from
+  // 'buffer' in the bound GL_ARRAY_BUFFER, and enable them.
+  static void Set(GLsizei stride, const char *buffer) {
+    GL_CALL(glEnableVertexAttribArray(First::kLocation));
+    GL_CALL(glVertexAttribPointer(First::kLocation, First::kComponents,
+                                  First::kType, First::kNormalized, stride,
+                                  buffer));
+    VertexFormat<Rest...>::Set(stride, buffer + First::kSize);
+  }
+
+  // Disable the shader inputs again.
+  static void Unset() {
+    GL_CALL(glDisableVertexAttribArray(First::kLocation));
+    VertexFormat<Rest...>::Unset();
+  }
+};
+
+template <typename Format>
+void Mesh::RenderArray(GLenum primitive, int index_count,
+                       const char *vertices, const unsigned short *indices) {
+  if (index_count <= 0) return;
+  Format::Set(Format::kSize,
+              StreamVertices(index_count, Format::kSize, vertices, indices));
+  DrawStreamed(primitive, index_count, indices);
+  Format::Unset();
+}
+
 }  // namespace fpl
 
 #endif  // FPL_MESH_H
@@ -22,8 +22,20 @@
 namespace fpl {
 namespace pie_noon {
 
+// Weight of each new round trip sample in the smoothed round trip time, as
+// 1/kRttSmoothing; the same weight TCP gives its samples.
+static const WorldTime kRttSmoothing = 8;
+
 MultiplayerDirector::MultiplayerDirector()
-    : turn_timer_(0), debug_input_system_(nullptr) {}
+    : turn_timer_(0),
+      debug_input_system_(nullptr),
+      time_(0),
+      turn_start_time_(0),
+      recording_(false),
+      playback_(nullptr),
+      seed_(0),
+      seed_pending_(false),
+      game_start_time_(0) {}
 
 void MultiplayerDirector::Initialize(GameState* gamestate,
                                      const Config* config) {
@@ -43,6 +55,8 @@ void MultiplayerDirector::RegisterController(
   controllers_.push_back(controller);
   commands_.push_back(Command());
   character_splats_.push_back(0);
+  command_turn_.push_back(0);
+  player_rtt_.push_back(-1);
 }
 
 void MultiplayerDirector::StartGame() {
@@ -62,14 +76,50 @@ void MultiplayerDirector::StartGame() {
   for (unsigned int i = 0; i < character_splats_.size(); i++) {
     character_splats_[i] = 0;
   }
+  // Round trip times carry over, since the connections are the same.
+  for (unsigned int i = 0; i < command_turn_.size(); i++) {
+    command_turn_[i] = 0;
+  }
+  game_start_time_ = time_;
+  recorded_end_times_.clear();
+  recorded_commands_.clear();
+  if (playback_ != nullptr) {
+    seed_ = playback_->seed();
+    num_ai_players_ = playback_->num_ai_players();
+  } else if (recording_) {
+    seed_ = static_cast<unsigned int>(SDL_GetPerformanceCounter());
+  }
+  seed_pending_ = playback_ != nullptr || recording_;
+#ifdef PIE_NOON_USES_GOOGLE_PLAY_GAMES
+  // Every client starts the game from a whole status.
+  status_history_.Clear();
+  acked_status_.clear();
+#endif
 }
 
 void MultiplayerDirector::EndGame() {
   game_running_ = false;
   turn_timer_ = 0;
+#ifdef PIE_NOON_USES_GOOGLE_PLAY_GAMES
+  // Rates are over the game just played, since the last call was at the end
+  // of the game before.
+  if (gpg_multiplayer_ != nullptr) gpg_multiplayer_->LogConnectionStats();
+#endif
 }
 
 void MultiplayerDirector::AdvanceFrame(WorldTime delta_time) {
+  if (seed_pending_) {
+    srand(seed_);
+    seed_pending_ = false;
+  }
+  time_ += delta_time;
+#ifdef PIE_NOON_USES_GOOGLE_PLAY_GAMES
+  if (status_pending_ && gpg_multiplayer_ != nullptr &&
+      time_ - status_time_ >=
+          config_->multiscreen_options()->status_interval_milliseconds()) {
+    SendPlayerStatusMsg();
+  }
+#endif
   if (debug_input_system_ != nullptr) {
     DebugInput(debug_input_system_);
   }
@@ -91,8 +141,10 @@ void MultiplayerDirector::AdvanceFrame(WorldTime delta_time) {
 
 void MultiplayerDirector::TriggerEndOfTurn() {
   SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "MultiplayerDirector: END TURN");
-  // if we have any AI players, set their commands now
-  if (config_->multiscreen_options()->ai_enabled()) {
+  if (playback_ != nullptr) {
+    PlayBackCommands();
+  } else if (config_->multiscreen_options()->ai_enabled()) {
+    // if we have any AI players, set their commands now
     for (unsigned int i = 0; i < num_ai_players(); i++) {
       CharacterId id =
           static_cast<CharacterId>(commands_.size() - num_ai_players() + i);
@@ -101,6 +153,11 @@ void MultiplayerDirector::TriggerEndOfTurn() {
       }
     }
   }
+  if (recording_) {
+    recorded_end_times_.push_back(time_ - game_start_time_);
+    recorded_commands_.insert(recorded_commands_.end(), commands_.begin(),
+                              commands_.end());
+  }
 
   for (int i = 0; i < static_cast<int>(controllers_.size()); i++) {
     int character_delay =
@@ -139,6 +196,48 @@ void MultiplayerDirector::TriggerEndOfTurn() {
   }
 }
 
+void MultiplayerDirector::PlayBackCommands() {
+  const auto* turns = playback_->turns();
+  if (turns == nullptr || turn_number_ == 0 || turn_number_ > turns->size()) {
+    return;
+  }
+  const auto* commands = turns->Get(turn_number_ - 1)->commands();
+  if (commands == nullptr) return;
+  for (unsigned int i = 0; i < commands->size() && i < commands_.size();
+       i++) {
+    const ReplayCommand* command = commands->Get(i);
+    commands_[i].aim_at = command->aim_at() >= 0
+                              ? static_cast<CharacterId>(command->aim_at())
+                              : kNoCharacter;
+    commands_[i].is_firing = command->is_firing();
+    commands_[i].is_blocking = command->is_blocking();
+  }
+}
+
+bool MultiplayerDirector::SaveReplay(std::vector<uint8_t>* replay) const {
+  if (recorded_end_times_.empty()) return false;
+  flatbuffers::FlatBufferBuilder builder;
+  std::vector<flatbuffers::Offset<ReplayTurn>> turns;
+  std::vector<ReplayCommand> commands;
+  for (size_t i = 0; i < recorded_end_times_.size(); i++) {
+    commands.clear();
+    for (size_t j = 0; j < controllers_.size(); j++) {
+      const Command& command = recorded_commands_[i * controllers_.size() + j];
+      commands.push_back(ReplayCommand(static_cast<int8_t>(command.aim_at),
+                                       command.is_firing,
+                                       command.is_blocking));
+    }
+    turns.push_back(CreateReplayTurn(builder, recorded_end_times_[i],
+                                     builder.CreateVectorOfStructs(commands)));
+  }
+  builder.Finish(CreateReplay(
+      builder, seed_, static_cast<uint8_t>(controllers_.size()),
+      static_cast<uint8_t>(num_ai_players_), builder.CreateVector(turns)));
+  replay->assign(builder.GetBufferPointer(),
+                 builder.GetBufferPointer() + builder.GetSize());
+  return true;
+}
+
 unsigned int MultiplayerDirector::CalculateSecondsPerTurn(
     unsigned int turn_number) {
   for (auto turn_spec : *config_->multiscreen_options()->turn_length()) {
@@ -155,13 +254,47 @@ void MultiplayerDirector::TriggerStartOfTurn() {
   start_turn_timer_ = 0;
   turn_number_++;
   set_seconds_per_turn(CalculateSecondsPerTurn(turn_number_));
-  turn_timer_ = seconds_per_turn() * kMillisecondsPerSecond +
-                config_->multiscreen_options()->network_grace_milliseconds();
+  turn_start_time_ = time_;
+  turn_timer_ = seconds_per_turn() * kMillisecondsPerSecond + NetworkGrace();
+  if (playback_ != nullptr) {
+    // End the turn when it ended in the recording, or not at all if the
+    // recording ended first.
+    const auto* turns = playback_->turns();
+    turn_timer_ = 0;
+    if (turns != nullptr && turn_number_ <= turns->size()) {
+      turn_timer_ = std::max<WorldTime>(
+          1, turns->Get(turn_number_ - 1)->end_time() -
+                 (time_ - game_start_time_));
+    }
+  }
 #ifdef PIE_NOON_USES_GOOGLE_PLAY_GAMES
   SendStartTurnMsg(seconds_per_turn());
 #endif
 }
 
+WorldTime MultiplayerDirector::NetworkGrace() const {
+  // A client's last command for a turn can come in a whole round trip after
+  // the turn's length: its StartTurn arrives half a round trip late, and the
+  // command takes another half to get back.
+  const WorldTime max_grace =
+      config_->multiscreen_options()->network_grace_milliseconds();
+  WorldTime slowest_rtt = 0;
+  const unsigned int num_humans = controllers_.size() - num_ai_players();
+  for (unsigned int i = 0; i < num_humans && i < player_rtt_.size(); i++) {
+    WorldTime rtt = player_rtt_[i];
+#ifdef PIE_NOON_USES_GOOGLE_PLAY_GAMES
+    // Before the first turn, the pings give an idea.
+    GPGMultiplayer::ConnectionStats stats;
+    if (rtt < 0 && GetPlayerConnectionStats(i, &stats)) rtt = stats.rtt;
+#endif
+    if (rtt < 0) return max_grace;
+    slowest_rtt = std::max(slowest_rtt, rtt);
+  }
+  const WorldTime margin =
+      config_->multiscreen_options()->network_grace_rtt_margin_milliseconds();
+  return std::min(max_grace, slowest_rtt + margin);
+}
+
 void MultiplayerDirector::TriggerPlayerHitByPie(CharacterId player,
                                                 int damage) {
   if (!game_running_) return;
@@ -196,7 +329,9 @@ void MultiplayerDirector::TriggerPlayerHitByPie(CharacterId player,
     splats_available.erase(splats_available.begin() + idx);
   }
 #ifdef PIE_NOON_USES_GOOGLE_PLAY_GAMES
-  SendPlayerStatusMsg();  // sent unreliably since we may send a bunch in a row
+  // Sent unreliably, and at most every status_interval_milliseconds, since
+  // we may get a bunch of hits in a row.
+  status_pending_ = true;
 #endif
 }
 
@@ -216,6 +351,25 @@ void MultiplayerDirector::InputPlayerCommand(
   command.is_firing = player_command.is_firing() != 0;
   command.is_blocking = player_command.is_blocking() != 0;
   commands_[id] = command;
+
+  // Clients answer each StartTurn with their command, so the first command
+  // of the current turn times the round trip to that client.
+  const unsigned int turn = player_command.turn();
+  if (turn == turn_number_ && turn_timer_ > 0 && command_turn_[id] != turn) {
+    const WorldTime sample = time_ - turn_start_time_;
+    player_rtt_[id] =
+        player_rtt_[id] < 0
+            ? sample
+            : player_rtt_[id] + (sample - player_rtt_[id]) / kRttSmoothing;
+  } else if (turn < turn_number_ || turn_timer_ <= 0) {
+    // Chosen in a turn that's already been played. It's kept, as the
+    // player's choice for the next turn.
+    SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
+                 "MultiplayerDirector: Late command from %d for turn %d, "
+                 "%d ms after the turn started.",
+                 id, turn, time_ - turn_start_time_);
+  }
+  command_turn_[id] = turn;
 }
 
 void MultiplayerDirector::ChooseAICommand(CharacterId id) {
@@ -478,85 +632,166 @@ void MultiplayerDirector::DebugInput(InputSystem* input) {
 #ifdef PIE_NOON_USES_GOOGLE_PLAY_GAMES
 void MultiplayerDirector::SendPlayerAssignmentMsg(const std::string& instance,
                                                   CharacterId id) {
-  flatbuffers::FlatBufferBuilder builder;
+  flatbuffers::FlatBufferBuilder& builder = StartMessage();
   auto message_root = multiplayer::CreateMessageRoot(
       builder, multiplayer::Data_PlayerAssignment,
       multiplayer::CreatePlayerAssignment(builder, id).Union());
-  builder.Finish(message_root);
+  gpg_multiplayer_->SendMessage(instance, FinishMessage(message_root), true);
+}
 
-  std::vector<uint8_t> message(builder.GetBufferPointer(),
-                               builder.GetBufferPointer() + builder.GetSize());
-  gpg_multiplayer_->SendMessage(instance, message, true);
+bool MultiplayerDirector::GetPlayerConnectionStats(
+    CharacterId id, GPGMultiplayer::ConnectionStats* stats) const {
+  if (gpg_multiplayer_ == nullptr) return false;
+  const std::string instance =
+      gpg_multiplayer_->GetInstanceIdByPlayerNumber(id);
+  return !instance.empty() &&
+         gpg_multiplayer_->GetConnectionStats(instance, stats);
 }
 
 void MultiplayerDirector::SendStartTurnMsg(unsigned int seconds) {
-  // read the player healths
-  std::vector<uint8_t> health_vec = ReadPlayerHealth();
-  std::vector<uint8_t> splats_vec = ReadPlayerSplats();
-
-  flatbuffers::FlatBufferBuilder builder;
-  auto health = builder.CreateVector(health_vec);
-  auto splats = builder.CreateVector(splats_vec);
-  auto player_status = multiplayer::CreatePlayerStatus(builder, health, splats);
+  const PlayerStatusHistory::Snapshot& status = SnapshotPlayerStatus();
+  flatbuffers::FlatBufferBuilder& builder = StartMessage();
+  auto player_status = BuildPlayerStatus(status, kNoCharacter);
   auto message_root = multiplayer::CreateMessageRoot(
       builder, multiplayer::Data_StartTurn,
       multiplayer::CreateStartTurn(builder, (unsigned short)seconds,
-                                   player_status).Union());
-  builder.Finish(message_root);
-
-  std::vector<uint8_t> message(builder.GetBufferPointer(),
-                               builder.GetBufferPointer() + builder.GetSize());
-  gpg_multiplayer_->BroadcastMessage(message, true);
+                                   player_status,
+                                   (unsigned short)turn_number_).Union());
+  gpg_multiplayer_->BroadcastMessage(FinishMessage(message_root), true);
 }
 
 void MultiplayerDirector::SendEndGameMsg() {
-  std::vector<uint8_t> health_vec = ReadPlayerHealth();
-  std::vector<uint8_t> splats_vec = ReadPlayerSplats();
-
-  flatbuffers::FlatBufferBuilder builder;
-  auto health = builder.CreateVector(health_vec);
-  auto splats = builder.CreateVector(splats_vec);
-  auto player_status = multiplayer::CreatePlayerStatus(builder, health, splats);
+  const PlayerStatusHistory::Snapshot& status = SnapshotPlayerStatus();
+  flatbuffers::FlatBufferBuilder& builder = StartMessage();
+  auto player_status = BuildPlayerStatus(status, kNoCharacter);
   auto message_root = multiplayer::CreateMessageRoot(
       builder, multiplayer::Data_EndGame,
       multiplayer::CreateEndGame(builder, player_status).Union());
-  builder.Finish(message_root);
-
-  std::vector<uint8_t> message(builder.GetBufferPointer(),
-                               builder.GetBufferPointer() + builder.GetSize());
-  gpg_multiplayer_->BroadcastMessage(message, true);
+  gpg_multiplayer_->BroadcastMessage(FinishMessage(message_root), true);
 }
 
 void MultiplayerDirector::SendPlayerStatusMsg() {
-  std::vector<uint8_t> health_vec = ReadPlayerHealth();
-  std::vector<uint8_t> splats_vec = ReadPlayerSplats();
+  status_pending_ = false;
+  status_time_ = time_;
+  const PlayerStatusHistory::Snapshot& status = SnapshotPlayerStatus();
+  // Disconnected players leave gaps, and AI players have no instance.
+  const int num_players = static_cast<int>(controllers_.size());
+  for (int player = 0; player < num_players; ++player) {
+    const std::string instance =
+        gpg_multiplayer_->GetInstanceIdByPlayerNumber(player);
+    if (instance.empty()) continue;
+
+    // Players who have a recent status only need what's changed since.
+    const PlayerStatusHistory::Snapshot* baseline =
+        player < static_cast<int>(acked_status_.size()) &&
+                acked_status_[player] >= 0
+            ? status_history_.Find(
+                  static_cast<uint16_t>(acked_status_[player]))
+            : nullptr;
+    flatbuffers::FlatBufferBuilder& builder = StartMessage();
+    auto message_root =
+        baseline != nullptr
+            ? multiplayer::CreateMessageRoot(
+                  builder, multiplayer::Data_PlayerStatusDelta,
+                  BuildPlayerStatusDelta(status, *baseline, player).Union())
+            : multiplayer::CreateMessageRoot(
+                  builder, multiplayer::Data_PlayerStatus,
+                  BuildPlayerStatus(status, player).Union());
+    // Send unreliably.
+    gpg_multiplayer_->SendMessage(instance, FinishMessage(message_root),
+                                  false);
+  }
+}
 
-  flatbuffers::FlatBufferBuilder builder;
-  auto health = builder.CreateVector(health_vec);
-  auto splats = builder.CreateVector(splats_vec);
-  auto message_root = multiplayer::CreateMessageRoot(
-      builder, multiplayer::Data_PlayerStatus,
-      multiplayer::CreatePlayerStatus(builder, health, splats).Union());
-  builder.Finish(message_root);
+void MultiplayerDirector::InputPlayerStatusAck(int player, uint16_t sequence) {
+  if (player < 0) return;
+  if (player >= static_cast<int>(acked_status_.size())) {
+    acked_status_.resize(player + 1, -1);
+  }
+  // Acks are sent unreliably, so a late one can arrive after a newer one.
+  // A stale baseline only makes the deltas bigger.
+  acked_status_[player] = sequence;
+}
 
-  std::vector<uint8_t> message(builder.GetBufferPointer(),
-                               builder.GetBufferPointer() + builder.GetSize());
-  gpg_multiplayer_->BroadcastMessage(message, false);  // Send unreliably.
+void MultiplayerDirector::ResetPlayerStatusAck(int player) {
+  if (0 <= player && player < static_cast<int>(acked_status_.size())) {
+    acked_status_[player] = -1;
+  }
 }
 
-#endif  // PIE_NOON_USES_GOOGLE_PLAY_GAMES
+flatbuffers::FlatBufferBuilder& MultiplayerDirector::StartMessage() {
+  builder_.Clear();
+  return builder_;
+}
 
-std::vector<uint8_t> MultiplayerDirector::ReadPlayerHealth() {
-  std::vector<uint8_t> vec;
-  for (auto controller : controllers_) {
-    int health = controller->GetCharacter().health();
-    vec.push_back((health < 0) ? 0 : (uint8_t)health);
+const PlayerStatusHistory::Snapshot&
+MultiplayerDirector::SnapshotPlayerStatus() {
+  PlayerStatusHistory::Snapshot* status =
+      status_history_.Add(++status_sequence_);
+  ReadPlayerHealth(&status->player_health);
+  status->player_splats = ReadPlayerSplats();
+  return *status;
+}
+
+flatbuffers::Offset<multiplayer::PlayerStatus>
+MultiplayerDirector::BuildPlayerStatus(
+    const PlayerStatusHistory::Snapshot& status, CharacterId viewer) {
+  auto health = builder_.CreateVector(status.player_health);
+  viewer_splats_ = status.player_splats;
+  if (viewer != kNoCharacter) {
+    for (size_t i = 0; i < viewer_splats_.size(); ++i) {
+      if (i != static_cast<size_t>(viewer)) viewer_splats_[i] = 0;
+    }
   }
-  return vec;
+  auto splats = builder_.CreateVector(viewer_splats_);
+  return multiplayer::CreatePlayerStatus(builder_, health, splats,
+                                         status.sequence);
+}
+
+flatbuffers::Offset<multiplayer::PlayerStatusDelta>
+MultiplayerDirector::BuildPlayerStatusDelta(
+    const PlayerStatusHistory::Snapshot& status,
+    const PlayerStatusHistory::Snapshot& baseline, CharacterId viewer) {
+  changed_players_.clear();
+  changed_health_.clear();
+  changed_splats_.clear();
+  for (size_t i = 0; i < status.player_health.size(); ++i) {
+    // Only the viewer's own splats are of interest to it.
+    const bool own = i == static_cast<size_t>(viewer);
+    const bool known = i < baseline.player_health.size() &&
+                       i < baseline.player_splats.size();
+    if (known && status.player_health[i] == baseline.player_health[i] &&
+        (!own || status.player_splats[i] == baseline.player_splats[i])) {
+      continue;
+    }
+    changed_players_.push_back(static_cast<uint8_t>(i));
+    changed_health_.push_back(status.player_health[i]);
+    changed_splats_.push_back(own ? status.player_splats[i] : 0);
+  }
+  auto players = builder_.CreateVector(changed_players_);
+  auto health = builder_.CreateVector(changed_health_);
+  auto splats = builder_.CreateVector(changed_splats_);
+  return multiplayer::CreatePlayerStatusDelta(
+      builder_, status.sequence, baseline.sequence, players, health, splats);
+}
+
+const std::vector<uint8_t>& MultiplayerDirector::FinishMessage(
+    flatbuffers::Offset<multiplayer::MessageRoot> message_root) {
+  builder_.Finish(message_root);
+  // The GPG API sends from a std::vector, so this one copy remains.
+  payload_.assign(builder_.GetBufferPointer(),
+                  builder_.GetBufferPointer() + builder_.GetSize());
+  return payload_;
 }
 
-std::vector<uint8_t> MultiplayerDirector::ReadPlayerSplats() {
-  return character_splats_;
+#endif  // PIE_NOON_USES_GOOGLE_PLAY_GAMES
+
+void MultiplayerDirector::ReadPlayerHealth(std::vector<uint8_t>* health) const {
+  health->clear();
+  for (auto controller : controllers_) {
+    const int character_health = controller->GetCharacter().health();
+    health->push_back((character_health < 0) ? 0 : (uint8_t)character_health);
+  }
 }
 
 }  // namespace pie_noon
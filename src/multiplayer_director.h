@@ -22,6 +22,8 @@
 #include "multiplayer_controller.h"
 #include "multiplayer_generated.h"
 #include "pie_noon_game.h"
+#include "player_status_history.h"
+#include "replay_generated.h"
 
 #ifdef PIE_NOON_USES_GOOGLE_PLAY_GAMES
 #include "gpg_multiplayer.h"
@@ -74,8 +76,20 @@ class MultiplayerDirector {
   void SendStartTurnMsg(unsigned int turn_seconds);
   // Broadcast end-of-game message to the players.
   void SendEndGameMsg();
-  // Broadcast player health to the players.
+  // Send player health to the players. Players who have acknowledged a
+  // recent status only get what changed since, and each player only gets
+  // their own splats.
   void SendPlayerStatusMsg();
+
+  // A client has received the status numbered 'sequence'.
+  void InputPlayerStatusAck(int player, uint16_t sequence);
+  // Send a client whole statuses again, e.g. after it reconnects.
+  void ResetPlayerStatusAck(int player);
+
+  // Copy the stats of the connection to a player's device into 'stats'.
+  // Returns false if the player isn't connected.
+  bool GetPlayerConnectionStats(CharacterId id,
+                                GPGMultiplayer::ConnectionStats *stats) const;
 #endif
 
   // Takes effect when the next turn starts.
@@ -93,6 +107,10 @@ class MultiplayerDirector {
   void InputPlayerCommand(CharacterId id,
                           const multiplayer::PlayerCommand &command);
 
+  // The smoothed round trip time to a player's device, or -1 if it hasn't
+  // been measured yet.
+  WorldTime player_rtt(CharacterId id) const { return player_rtt_[id]; }
+
   // Internally, call this when a player has been hit by a pie. The multiplayer
   // director will decide whether that player should be "stunned" by the hit
   // and have one or more of his buttons locked for a turn.
@@ -110,6 +128,23 @@ class MultiplayerDirector {
   void set_num_ai_players(unsigned int n) { num_ai_players_ = n; }
   unsigned int num_ai_players() const { return num_ai_players_; }
 
+  // From the next StartGame, record the commands every turn is played with,
+  // so the game can be saved with SaveReplay().
+  void set_recording(bool recording) { recording_ = recording; }
+  // Write the game recorded since StartGame to 'replay', as a Replay
+  // flatbuffer. Returns false if no turns were recorded.
+  bool SaveReplay(std::vector<uint8_t> *replay) const;
+
+  // From the next StartGame, end every turn when it ended in 'replay', with
+  // the commands it ended with, instead of the players' and AI's commands.
+  // 'replay' must outlive the game. Pass nullptr to go back to live play.
+  void set_playback(const Replay *replay) { playback_ = replay; }
+  // True once every turn in the replay has been played.
+  bool playback_finished() const {
+    return playback_ != nullptr && playback_->turns() != nullptr &&
+           turn_number_ >= playback_->turns()->size() && turn_timer_ <= 0;
+  }
+
  private:
   struct Command {
     CharacterId aim_at;
@@ -120,10 +155,14 @@ class MultiplayerDirector {
 
   void TriggerStartOfTurn();
   void TriggerEndOfTurn();
+  // Set commands_ from the replay's record of the turn that's ending.
+  void PlayBackCommands();
   unsigned int CalculateSecondsPerTurn(unsigned int turn_number);
+  // How long after the turn's length to wait for the clients' commands.
+  WorldTime NetworkGrace() const;
 
   // Get all the players' healths so we can send them in an update
-  std::vector<uint8_t> ReadPlayerHealth();
+  void ReadPlayerHealth(std::vector<uint8_t> *health) const;
 
   // Tell the multiplayer director to choose AI commands for this player.
   void ChooseAICommand(CharacterId id);
@@ -131,13 +170,34 @@ class MultiplayerDirector {
   void DebugInput(InputSystem *input);
 
   // Get all the players' onscreen splats to send in an update
-  std::vector<uint8_t> ReadPlayerSplats();
+  const std::vector<uint32_t> &ReadPlayerSplats() const {
+    return character_splats_;
+  }
+
+#ifdef PIE_NOON_USES_GOOGLE_PLAY_GAMES
+  // Start a new message in builder_, which keeps its storage between messages.
+  flatbuffers::FlatBufferBuilder &StartMessage();
+  // Finish the message in builder_, and return it as the payload to send.
+  const std::vector<uint8_t> &FinishMessage(
+      flatbuffers::Offset<multiplayer::MessageRoot> message_root);
+
+  // Number and record the current player status, and return it.
+  const PlayerStatusHistory::Snapshot &SnapshotPlayerStatus();
+  // Add a status to the message being built. The splats are only those of
+  // 'viewer', unless it's kNoCharacter.
+  flatbuffers::Offset<multiplayer::PlayerStatus> BuildPlayerStatus(
+      const PlayerStatusHistory::Snapshot &status, CharacterId viewer);
+  flatbuffers::Offset<multiplayer::PlayerStatusDelta> BuildPlayerStatusDelta(
+      const PlayerStatusHistory::Snapshot &status,
+      const PlayerStatusHistory::Snapshot &baseline, CharacterId viewer);
+#endif
 
   GameState *gamestate_;  // Pointer to the gamestate object
   const Config *config_;  // Pointer to the config structure
 
   std::vector<MultiplayerController *> controllers_;
-  std::vector<uint8_t> character_splats_;
+  // Bit i is set if button i is splatted.
+  std::vector<uint32_t> character_splats_;
   // How long the current turn lasts.
   WorldTime turn_timer_;
   // In how long to start the next turn.
@@ -151,8 +211,50 @@ class MultiplayerDirector {
 
   std::vector<Command> commands_;
 
+  // Time since the director was created, to timestamp commands with.
+  WorldTime time_;
+  // When the current turn's StartTurn was sent.
+  WorldTime turn_start_time_;
+  // For each player, the turn of the latest command received, and the
+  // smoothed round trip time, or -1 until it's measured.
+  std::vector<unsigned int> command_turn_;
+  std::vector<WorldTime> player_rtt_;
+
+  // Replays. rand() is seeded with seed_ on the first frame of each game,
+  // after GameState::Reset() has seeded it with the config's seed.
+  bool recording_;
+  const Replay *playback_;
+  unsigned int seed_;
+  bool seed_pending_;
+  WorldTime game_start_time_;
+  // When each recorded turn ended, since game_start_time_, and the commands
+  // it ended with, controllers_.size() of them per turn.
+  std::vector<WorldTime> recorded_end_times_;
+  std::vector<Command> recorded_commands_;
+
 #ifdef PIE_NOON_USES_GOOGLE_PLAY_GAMES
   GPGMultiplayer *gpg_multiplayer_ = nullptr;
+
+  // Outgoing messages are built and sent from these, so sending doesn't
+  // allocate once they've grown to fit.
+  flatbuffers::FlatBufferBuilder builder_;
+  std::vector<uint8_t> payload_;
+
+  // Statuses sent recently, to send deltas against.
+  PlayerStatusHistory status_history_;
+  uint16_t status_sequence_ = 0;
+  // The latest status each player number has acknowledged, or -1.
+  std::vector<int> acked_status_;
+  // Scratch space for BuildPlayerStatusDelta().
+  std::vector<uint8_t> changed_players_;
+  std::vector<uint8_t> changed_health_;
+  std::vector<uint32_t> changed_splats_;
+  // Scratch space for BuildPlayerStatus().
+  std::vector<uint32_t> viewer_splats_;
+  // A status is sent at most every status_interval_milliseconds; these say
+  // if one is waiting, and when the last one was sent.
+  bool status_pending_ = false;
+  WorldTime status_time_ = 0;
 #endif
 
   bool game_running_;
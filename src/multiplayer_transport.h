@@ -0,0 +1,98 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MULTIPLAYER_TRANSPORT_H
+#define MULTIPLAYER_TRANSPORT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace fpl {
+
+// The connections GPGMultiplayer runs over: advertising, discovery, and
+// messages between connected instances, as in the Nearby Connections API.
+//
+// NearbyConnectionsTransport uses the real thing. LoopbackTransport connects
+// instances in the same process, over a simulated network.
+//
+// Any thread may call a transport. It calls its listener back on threads of
+// its own, so the listener must be thread safe.
+class MultiplayerTransport {
+ public:
+  class Listener {
+   public:
+    virtual ~Listener() {}
+
+    // On the host, whether StartAdvertising() succeeded, and the name we're
+    // advertised by.
+    virtual void OnAdvertisingResult(bool success,
+                                     const std::string& local_name) = 0;
+    // On the host, a client asks to connect.
+    virtual void OnConnectionRequest(const std::string& instance_id,
+                                     const std::string& name) = 0;
+
+    // On the client, a host has been found, or has gone.
+    virtual void OnEndpointFound(const std::string& instance_id,
+                                 const std::string& name) = 0;
+    virtual void OnEndpointLost(const std::string& instance_id) = 0;
+    // On the client, the host has answered SendConnectionRequest().
+    virtual void OnConnectionResponse(const std::string& instance_id,
+                                      bool accepted) = 0;
+
+    // On either, a connected instance sent a message, or has disconnected.
+    virtual void OnMessageReceived(const std::string& instance_id,
+                                   const std::vector<uint8_t>& payload,
+                                   bool is_reliable) = 0;
+    virtual void OnDisconnected(const std::string& instance_id) = 0;
+  };
+
+  MultiplayerTransport() : listener_(nullptr) {}
+  virtual ~MultiplayerTransport() {}
+
+  // Set before calling anything else.
+  void set_listener(Listener* listener) { listener_ = listener; }
+
+  // Host calls.
+  virtual void StartAdvertising(
+      const std::string& name,
+      const std::vector<std::string>& app_identifiers) = 0;
+  virtual void StopAdvertising() = 0;
+  virtual void AcceptConnectionRequest(const std::string& client_id) = 0;
+  virtual void RejectConnectionRequest(const std::string& client_id) = 0;
+
+  // Client calls.
+  virtual void StartDiscovery(const std::string& service_id) = 0;
+  virtual void StopDiscovery(const std::string& service_id) = 0;
+  virtual void SendConnectionRequest(const std::string& name,
+                                     const std::string& host_id) = 0;
+
+  // Calls for either.
+  virtual void Disconnect(const std::string& instance_id) = 0;
+  virtual void SendReliableMessage(const std::string& instance_id,
+                                   const std::vector<uint8_t>& payload) = 0;
+  virtual void SendUnreliableMessage(const std::string& instance_id,
+                                     const std::vector<uint8_t>& payload) = 0;
+
+  // Longest payloads that can be sent.
+  virtual size_t MaxReliableMessageLen() const = 0;
+  virtual size_t MaxUnreliableMessageLen() const = 0;
+
+ protected:
+  Listener* listener_;
+};
+
+}  // namespace fpl
+
+#endif  // MULTIPLAYER_TRANSPORT_H
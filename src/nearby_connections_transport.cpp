@@ -0,0 +1,147 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "nearby_connections_transport.h"
+
+namespace fpl {
+
+bool NearbyConnectionsTransport::Initialize(const std::string& service_id) {
+  gpg::AndroidPlatformConfiguration platform_configuration;
+  platform_configuration.SetActivity((jobject)SDL_AndroidGetActivity());
+
+  gpg::NearbyConnections::Builder nearby_builder;
+  nearby_connections_ = nearby_builder.SetDefaultOnLog(gpg::LogLevel::VERBOSE)
+                            .SetServiceId(service_id)
+                            .Create(platform_configuration);
+  discovery_listener_.reset(nullptr);
+  message_listener_.reset(nullptr);
+
+  if (nearby_connections_ == nullptr) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                 "NearbyConnectionsTransport: Unable to build a "
+                 "NearbyConnections instance.");
+    return false;
+  }
+  return true;
+}
+
+NearbyConnectionsTransport::DiscoveryListener*
+NearbyConnectionsTransport::discovery_listener() {
+  if (discovery_listener_ == nullptr) {
+    discovery_listener_.reset(new DiscoveryListener(listener_));
+  }
+  return discovery_listener_.get();
+}
+
+NearbyConnectionsTransport::MessageListener*
+NearbyConnectionsTransport::message_listener() {
+  if (message_listener_ == nullptr) {
+    message_listener_.reset(new MessageListener(listener_));
+  }
+  return message_listener_.get();
+}
+
+void NearbyConnectionsTransport::StartAdvertising(
+    const std::string& name, const std::vector<std::string>& app_identifiers) {
+  std::vector<gpg::AppIdentifier> ids(app_identifiers.size());
+  for (size_t i = 0; i < app_identifiers.size(); ++i) {
+    ids[i].identifier = app_identifiers[i];
+  }
+  nearby_connections_->StartAdvertising(
+      name, ids, gpg::Duration::zero(),
+      [this](int64_t /*client_id*/, gpg::StartAdvertisingResult const& result) {
+        if (result.status !=
+            gpg::StartAdvertisingResult::StatusCode::SUCCESS) {
+          SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                       "NearbyConnectionsTransport: Advertising failed, "
+                       "error code %d",
+                       result.status);
+        }
+        listener_->OnAdvertisingResult(
+            result.status == gpg::StartAdvertisingResult::StatusCode::SUCCESS,
+            result.local_endpoint_name);
+      },
+      [this](int64_t /*client_id*/, gpg::ConnectionRequest const& request) {
+        listener_->OnConnectionRequest(request.remote_endpoint_id,
+                                       request.remote_endpoint_name);
+      });
+}
+
+void NearbyConnectionsTransport::StopAdvertising() {
+  nearby_connections_->StopAdvertising();
+}
+
+void NearbyConnectionsTransport::AcceptConnectionRequest(
+    const std::string& client_id) {
+  nearby_connections_->AcceptConnectionRequest(
+      client_id, std::vector<uint8_t>{}, message_listener());
+}
+
+void NearbyConnectionsTransport::RejectConnectionRequest(
+    const std::string& client_id) {
+  nearby_connections_->RejectConnectionRequest(client_id);
+}
+
+void NearbyConnectionsTransport::StartDiscovery(const std::string& service_id) {
+  nearby_connections_->StartDiscovery(service_id, gpg::Duration::zero(),
+                                      discovery_listener());
+}
+
+void NearbyConnectionsTransport::StopDiscovery(const std::string& service_id) {
+  nearby_connections_->StopDiscovery(service_id);
+}
+
+void NearbyConnectionsTransport::SendConnectionRequest(
+    const std::string& name, const std::string& host_id) {
+  nearby_connections_->SendConnectionRequest(
+      name, host_id, std::vector<uint8_t>{},
+      [this](int64_t /*client_id*/, gpg::ConnectionResponse const& response) {
+        if (response.status !=
+            gpg::ConnectionResponse::StatusCode::ACCEPTED) {
+          SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
+                       "NearbyConnectionsTransport: Didn't connect, "
+                       "response status = %d",
+                       response.status);
+        }
+        listener_->OnConnectionResponse(
+            response.remote_endpoint_id,
+            response.status == gpg::ConnectionResponse::StatusCode::ACCEPTED);
+      },
+      message_listener());
+}
+
+void NearbyConnectionsTransport::Disconnect(const std::string& instance_id) {
+  nearby_connections_->Disconnect(instance_id);
+}
+
+void NearbyConnectionsTransport::SendReliableMessage(
+    const std::string& instance_id, const std::vector<uint8_t>& payload) {
+  nearby_connections_->SendReliableMessage(instance_id, payload);
+}
+
+void NearbyConnectionsTransport::SendUnreliableMessage(
+    const std::string& instance_id, const std::vector<uint8_t>& payload) {
+  nearby_connections_->SendUnreliableMessage(instance_id, payload);
+}
+
+size_t NearbyConnectionsTransport::MaxReliableMessageLen() const {
+  return gpg::NearbyConnections::MaxReliableMessageLen();
+}
+
+size_t NearbyConnectionsTransport::MaxUnreliableMessageLen() const {
+  return gpg::NearbyConnections::MaxUnreliableMessageLen();
+}
+
+}  // namespace fpl
@@ -0,0 +1,100 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NEARBY_CONNECTIONS_TRANSPORT_H
+#define NEARBY_CONNECTIONS_TRANSPORT_H
+
+#include <memory>
+#include "multiplayer_transport.h"
+
+namespace fpl {
+
+// MultiplayerTransport over the Nearby Connections API in the Google Play
+// Games SDK. Android only.
+class NearbyConnectionsTransport : public MultiplayerTransport {
+ public:
+  // Build the NearbyConnections instance. Returns false if it can't.
+  bool Initialize(const std::string& service_id);
+
+  virtual void StartAdvertising(
+      const std::string& name,
+      const std::vector<std::string>& app_identifiers);
+  virtual void StopAdvertising();
+  virtual void AcceptConnectionRequest(const std::string& client_id);
+  virtual void RejectConnectionRequest(const std::string& client_id);
+  virtual void StartDiscovery(const std::string& service_id);
+  virtual void StopDiscovery(const std::string& service_id);
+  virtual void SendConnectionRequest(const std::string& name,
+                                     const std::string& host_id);
+  virtual void Disconnect(const std::string& instance_id);
+  virtual void SendReliableMessage(const std::string& instance_id,
+                                   const std::vector<uint8_t>& payload);
+  virtual void SendUnreliableMessage(const std::string& instance_id,
+                                     const std::vector<uint8_t>& payload);
+  virtual size_t MaxReliableMessageLen() const;
+  virtual size_t MaxUnreliableMessageLen() const;
+
+ private:
+  // Listens for hosts that are advertising.
+  class DiscoveryListener : public gpg::IEndpointDiscoveryListener {
+   public:
+    explicit DiscoveryListener(Listener* listener) : listener_(listener) {}
+    void OnEndpointFound(int64_t /*client_id*/,
+                         gpg::EndpointDetails const& endpoint_details) {
+      // Ignore client_id because we only have one NearbyConnections client.
+      listener_->OnEndpointFound(endpoint_details.endpoint_id,
+                                 endpoint_details.name);
+    }
+    void OnEndpointLost(int64_t /*client_id*/, const std::string& instance_id) {
+      // Ignore client_id because we only have one NearbyConnections client.
+      listener_->OnEndpointLost(instance_id);
+    }
+
+   private:
+    Listener* listener_;
+  };
+
+  // Listens for messages or disconnects from connected instances.
+  class MessageListener : public gpg::IMessageListener {
+   public:
+    explicit MessageListener(Listener* listener) : listener_(listener) {}
+    void OnMessageReceived(int64_t /* client_id */,
+                           const std::string& instance_id,
+                           std::vector<uint8_t> const& payload,
+                           bool is_reliable) {
+      // Ignore client_id because we only have one NearbyConnections client.
+      listener_->OnMessageReceived(instance_id, payload, is_reliable);
+    }
+    void OnDisconnected(int64_t /* client_id */,
+                        const std::string& instance_id) {
+      // Ignore client_id because we only have one NearbyConnections client.
+      listener_->OnDisconnected(instance_id);
+    }
+
+   private:
+    Listener* listener_;
+  };
+
+  // The listeners, created when first needed.
+  DiscoveryListener* discovery_listener();
+  MessageListener* message_listener();
+
+  std::unique_ptr<gpg::NearbyConnections> nearby_connections_;
+  std::unique_ptr<DiscoveryListener> discovery_listener_;
+  std::unique_ptr<MessageListener> message_listener_;
+};
+
+}  // namespace fpl
+
+#endif  // NEARBY_CONNECTIONS_TRANSPORT_H
@@ -0,0 +1,91 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "particle_budget.h"
+#include <algorithm>
+#include <math.h>
+
+namespace fpl {
+namespace pie_noon {
+
+// Weight of each new frame time in the moving average.
+static const float kAverageWeight = 0.1f;
+
+// Emission drops by this factor each frame the average is over budget, and
+// recovers by kEmissionRecovery each frame it's back under.
+static const float kEmissionDecay = 0.9f;
+static const float kEmissionRecovery = 0.01f;
+
+// Consider frames on budget when the average is this far under the target.
+static const float kOnBudget = 0.95f;
+
+// The most a particle is grown to make up for the ones that weren't spawned.
+static const float kMaxSizeScale = 2.0f;
+
+ParticleBudget::ParticleBudget()
+    : target_frame_time_(0.0f),
+      min_emission_scale_(1.0f),
+      average_frame_time_(0.0f),
+      emission_scale_(1.0f),
+      quality_scale_(1.0f),
+      throttled_frames_(0),
+      throttled_spawns_(0),
+      dropped_particles_(0) {}
+
+void ParticleBudget::Initialize(float target_frame_time,
+                                float min_emission_scale) {
+  target_frame_time_ = target_frame_time;
+  min_emission_scale_ = std::min(std::max(min_emission_scale, 0.0f), 1.0f);
+  average_frame_time_ = target_frame_time;
+  emission_scale_ = 1.0f;
+}
+
+void ParticleBudget::Update(float frame_time) {
+  if (target_frame_time_ <= 0.0f) return;
+
+  average_frame_time_ += (frame_time - average_frame_time_) * kAverageWeight;
+  if (average_frame_time_ > target_frame_time_) {
+    emission_scale_ =
+        std::max(emission_scale_ * kEmissionDecay, min_emission_scale_);
+  } else if (average_frame_time_ < target_frame_time_ * kOnBudget) {
+    emission_scale_ = std::min(emission_scale_ + kEmissionRecovery, 1.0f);
+  }
+  if (emission_scale_ < 1.0f) throttled_frames_++;
+}
+
+void ParticleBudget::set_quality_scale(float scale) {
+  quality_scale_ = std::min(std::max(scale, 0.0f), 1.0f);
+}
+
+int ParticleBudget::Allow(int requested, int available, float* size_scale) {
+  *size_scale = 1.0f;
+  if (requested <= 0) return 0;
+
+  int allowed = static_cast<int>(ceilf(requested * emission_scale()));
+  allowed = std::max(std::min(allowed, available), 0);
+  if (allowed < requested) {
+    throttled_spawns_++;
+    dropped_particles_ += requested - allowed;
+    // Keep the total area about the same.
+    if (allowed > 0) {
+      *size_scale = std::min(
+          sqrtf(static_cast<float>(requested) / static_cast<float>(allowed)),
+          kMaxSizeScale);
+    }
+  }
+  return allowed;
+}
+
+}  // pie_noon
+}  // fpl
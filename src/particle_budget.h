@@ -0,0 +1,69 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_PARTICLE_BUDGET_H
+#define FPL_PARTICLE_BUDGET_H
+
+namespace fpl {
+namespace pie_noon {
+
+// Decides how many particles each spawn may create. When there isn't room
+// for them all, or frames have been running over budget, spawns are cut down
+// to fewer particles, each scaled up to cover roughly the same area.
+class ParticleBudget {
+ public:
+  ParticleBudget();
+
+  // 'target_frame_time' is the frame time, in ms, above which emission is
+  // throttled. Zero never throttles for frame time. Emission never drops
+  // below 'min_emission_scale' of what effects ask for.
+  void Initialize(float target_frame_time, float min_emission_scale);
+
+  // Record the duration of the most recent frame, in ms.
+  void Update(float frame_time);
+
+  // Returns how many of 'requested' particles to spawn, when there's room for
+  // 'available' more, and sets 'size_scale' to the factor to grow each by.
+  int Allow(int requested, int available, float* size_scale);
+
+  // Fraction of the requested particles that spawns currently get.
+  float emission_scale() const { return emission_scale_ * quality_scale_; }
+
+  // Scale emission by 'scale' on top of any throttling, for the quality
+  // tier. Unlike throttling, this doesn't recover by itself.
+  void set_quality_scale(float scale);
+
+  // How often throttling has kicked in: frames with a reduced emission
+  // scale, spawns that got fewer particles than they asked for, and the
+  // total number of particles those spawns went without.
+  int throttled_frames() const { return throttled_frames_; }
+  int throttled_spawns() const { return throttled_spawns_; }
+  int dropped_particles() const { return dropped_particles_; }
+
+ private:
+  float target_frame_time_;
+  float min_emission_scale_;
+  // Exponential moving average of recent frame times.
+  float average_frame_time_;
+  float emission_scale_;
+  float quality_scale_;
+  int throttled_frames_;
+  int throttled_spawns_;
+  int dropped_particles_;
+};
+
+}  // pie_noon
+}  // fpl
+
+#endif  // FPL_PARTICLE_BUDGET_H
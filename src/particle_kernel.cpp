@@ -0,0 +1,193 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "particle_kernel.h"
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define FPL_PARTICLE_KERNEL_NEON
+#include <arm_neon.h>
+#elif defined(__SSE__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FPL_PARTICLE_KERNEL_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace fpl {
+namespace pie_noon {
+
+static inline float EndOfLifeScale(float age, float duration,
+                                   float fade_duration) {
+  const float remaining = duration - age;
+  return remaining < fade_duration ? remaining / fade_duration : 1.0f;
+}
+
+#if defined(FPL_PARTICLE_KERNEL_NEON)
+
+const char* ParticleKernelName() { return "NEON"; }
+
+void ParticleAddToEach(float delta, size_t count, float* values) {
+  const float32x4_t d = vdupq_n_f32(delta);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    vst1q_f32(values + i, vaddq_f32(vld1q_f32(values + i), d));
+  }
+  for (; i < count; ++i) values[i] += delta;
+}
+
+void ParticleIntegrateLinear(const float* base, const float* rate,
+                             const float* t, size_t count, float* out) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    vst1q_f32(out + i, vmlaq_f32(vld1q_f32(base + i), vld1q_f32(rate + i),
+                                 vld1q_f32(t + i)));
+  }
+  for (; i < count; ++i) out[i] = base[i] + rate[i] * t[i];
+}
+
+void ParticleIntegrateQuadratic(const float* base, const float* velocity,
+                                const float* acceleration, const float* t,
+                                size_t count, float* out) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const float32x4_t time = vld1q_f32(t + i);
+    // base + t * (velocity + t * acceleration / 2)
+    const float32x4_t half_accel =
+        vmulq_n_f32(vld1q_f32(acceleration + i), 0.5f);
+    const float32x4_t speed =
+        vmlaq_f32(vld1q_f32(velocity + i), half_accel, time);
+    vst1q_f32(out + i, vmlaq_f32(vld1q_f32(base + i), speed, time));
+  }
+  for (; i < count; ++i) {
+    out[i] = base[i] + t[i] * (velocity[i] + t[i] * 0.5f * acceleration[i]);
+  }
+}
+
+void ParticleEndOfLifeScales(const float* ages, const float* durations,
+                             const float* fade_durations, size_t count,
+                             float* out) {
+  const float32x4_t ones = vdupq_n_f32(1.0f);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const float32x4_t remaining =
+        vsubq_f32(vld1q_f32(durations + i), vld1q_f32(ages + i));
+    const float32x4_t fade = vld1q_f32(fade_durations + i);
+    // NEON has no divide, so refine the reciprocal estimate twice. Lanes with
+    // no fade produce garbage here, but are never selected.
+    float32x4_t recip = vrecpeq_f32(fade);
+    recip = vmulq_f32(vrecpsq_f32(fade, recip), recip);
+    recip = vmulq_f32(vrecpsq_f32(fade, recip), recip);
+    const uint32x4_t fading = vcltq_f32(remaining, fade);
+    vst1q_f32(out + i, vbslq_f32(fading, vmulq_f32(remaining, recip), ones));
+  }
+  for (; i < count; ++i) {
+    out[i] = EndOfLifeScale(ages[i], durations[i], fade_durations[i]);
+  }
+}
+
+#elif defined(FPL_PARTICLE_KERNEL_SSE)
+
+const char* ParticleKernelName() { return "SSE"; }
+
+void ParticleAddToEach(float delta, size_t count, float* values) {
+  const __m128 d = _mm_set1_ps(delta);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_ps(values + i, _mm_add_ps(_mm_loadu_ps(values + i), d));
+  }
+  for (; i < count; ++i) values[i] += delta;
+}
+
+void ParticleIntegrateLinear(const float* base, const float* rate,
+                             const float* t, size_t count, float* out) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(base + i),
+                                      _mm_mul_ps(_mm_loadu_ps(rate + i),
+                                                 _mm_loadu_ps(t + i))));
+  }
+  for (; i < count; ++i) out[i] = base[i] + rate[i] * t[i];
+}
+
+void ParticleIntegrateQuadratic(const float* base, const float* velocity,
+                                const float* acceleration, const float* t,
+                                size_t count, float* out) {
+  const __m128 half = _mm_set1_ps(0.5f);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128 time = _mm_loadu_ps(t + i);
+    // base + t * (velocity + t * acceleration / 2)
+    const __m128 half_accel = _mm_mul_ps(_mm_loadu_ps(acceleration + i), half);
+    const __m128 speed =
+        _mm_add_ps(_mm_loadu_ps(velocity + i), _mm_mul_ps(half_accel, time));
+    _mm_storeu_ps(out + i,
+                  _mm_add_ps(_mm_loadu_ps(base + i), _mm_mul_ps(speed, time)));
+  }
+  for (; i < count; ++i) {
+    out[i] = base[i] + t[i] * (velocity[i] + t[i] * 0.5f * acceleration[i]);
+  }
+}
+
+void ParticleEndOfLifeScales(const float* ages, const float* durations,
+                             const float* fade_durations, size_t count,
+                             float* out) {
+  const __m128 ones = _mm_set1_ps(1.0f);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128 remaining =
+        _mm_sub_ps(_mm_loadu_ps(durations + i), _mm_loadu_ps(ages + i));
+    const __m128 fade = _mm_loadu_ps(fade_durations + i);
+    // Lanes with no fade divide by zero here, but are never selected.
+    const __m128 fading = _mm_cmplt_ps(remaining, fade);
+    const __m128 scale = _mm_div_ps(remaining, fade);
+    _mm_storeu_ps(out + i, _mm_or_ps(_mm_and_ps(fading, scale),
+                                     _mm_andnot_ps(fading, ones)));
+  }
+  for (; i < count; ++i) {
+    out[i] = EndOfLifeScale(ages[i], durations[i], fade_durations[i]);
+  }
+}
+
+#else  // !FPL_PARTICLE_KERNEL_NEON && !FPL_PARTICLE_KERNEL_SSE
+
+const char* ParticleKernelName() { return "scalar"; }
+
+void ParticleAddToEach(float delta, size_t count, float* values) {
+  for (size_t i = 0; i < count; ++i) values[i] += delta;
+}
+
+void ParticleIntegrateLinear(const float* base, const float* rate,
+                             const float* t, size_t count, float* out) {
+  for (size_t i = 0; i < count; ++i) out[i] = base[i] + rate[i] * t[i];
+}
+
+void ParticleIntegrateQuadratic(const float* base, const float* velocity,
+                                const float* acceleration, const float* t,
+                                size_t count, float* out) {
+  for (size_t i = 0; i < count; ++i) {
+    out[i] = base[i] + t[i] * (velocity[i] + t[i] * 0.5f * acceleration[i]);
+  }
+}
+
+void ParticleEndOfLifeScales(const float* ages, const float* durations,
+                             const float* fade_durations, size_t count,
+                             float* out) {
+  for (size_t i = 0; i < count; ++i) {
+    out[i] = EndOfLifeScale(ages[i], durations[i], fade_durations[i]);
+  }
+}
+
+#endif  // FPL_PARTICLE_KERNEL_NEON, FPL_PARTICLE_KERNEL_SSE
+
+}  // pie_noon
+}  // fpl
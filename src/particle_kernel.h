@@ -0,0 +1,53 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_PARTICLE_KERNEL_H
+#define FPL_PARTICLE_KERNEL_H
+
+#include <stddef.h>
+
+namespace fpl {
+namespace pie_noon {
+
+// Batch updates for particles stored as structures of arrays. Each function
+// processes 'count' consecutive elements of its arrays, four at a time with
+// NEON or SSE when the target has them, and one at a time otherwise. The
+// arrays need no particular alignment, and outputs may alias inputs.
+
+// The instruction set the kernels were compiled for: "NEON", "SSE" or "scalar".
+const char* ParticleKernelName();
+
+// values[i] += delta.
+void ParticleAddToEach(float delta, size_t count, float* values);
+
+// out[i] = base[i] + rate[i] * t[i].
+void ParticleIntegrateLinear(const float* base, const float* rate,
+                             const float* t, size_t count, float* out);
+
+// out[i] = base[i] + velocity[i] * t[i] + acceleration[i] * t[i]^2 / 2.
+void ParticleIntegrateQuadratic(const float* base, const float* velocity,
+                                const float* acceleration, const float* t,
+                                size_t count, float* out);
+
+// The fraction of a fade (or shrink) that remains, given each particle's
+// 'ages', 'durations', and the length of its fade 'fade_durations', all in
+// milliseconds. 1 until the fade starts, then falls linearly to 0.
+void ParticleEndOfLifeScales(const float* ages, const float* durations,
+                             const float* fade_durations, size_t count,
+                             float* out);
+
+}  // pie_noon
+}  // fpl
+
+#endif  // FPL_PARTICLE_KERNEL_H
@@ -1,9 +1,21 @@
 #include "particles.h"
+#include "entity/entity_manager.h"
+#include "particle_kernel.h"
+#include "utilities.h"
+#include <assert.h>
 
 namespace fpl {
 namespace pie_noon {
 
+using mathfu::vec3;
+using mathfu::vec4;
+
 const int kMaxParticles = 1000;
+const size_t kMaxParticleBursts = 64;
+
+// Particles per task when updating them in parallel. Enough to be worth
+// handing to a worker, and a multiple of the SIMD width.
+const size_t kParticlesPerTask = 256;
 
 void Particle::reset() {
   base_position_ = mathfu::vec3(0, 0, 0);
@@ -19,6 +31,39 @@ void Particle::reset() {
   duration_of_shrink_out_ = 0;
 }
 
+void Particle::Randomize(const ParticleDef& def, const mathfu::vec3& position,
+                         const mathfu::vec3& orientation_offset,
+                         const mathfu::vec4& tint) {
+  const vec3 min_scale = LoadVec3(def.min_scale());
+  const vec3 max_scale = LoadVec3(def.max_scale());
+  base_scale_ = def.preserve_aspect()
+                    ? vec3(mathfu::RandomInRange(min_scale.x(), max_scale.x()))
+                    : vec3::RandomInRange(min_scale, max_scale);
+  base_velocity_ = vec3::RandomInRange(LoadVec3(def.min_velocity()),
+                                       LoadVec3(def.max_velocity()));
+  acceleration_ = LoadVec3(def.acceleration());
+  renderable_id_ = static_cast<uint16_t>(def.renderable()->Get(
+      mathfu::RandomInRange<int>(0, def.renderable()->size())));
+  const vec4 def_tint = LoadVec4(
+      def.tint()->Get(mathfu::RandomInRange<int>(0, def.tint()->size())));
+  base_tint_ = vec4(def_tint.x() * tint.x(), def_tint.y() * tint.y(),
+                    def_tint.z() * tint.z(), def_tint.w() * tint.w());
+  duration_ = static_cast<TimeStep>(
+      mathfu::RandomInRange<int32_t>(def.min_duration(), def.max_duration()));
+  base_position_ =
+      position + vec3::RandomInRange(LoadVec3(def.min_position_offset()),
+                                     LoadVec3(def.max_position_offset()));
+  base_orientation_ =
+      orientation_offset +
+      vec3::RandomInRange(LoadVec3(def.min_orientation_offset()),
+                          LoadVec3(def.max_orientation_offset()));
+  rotational_velocity_ =
+      vec3::RandomInRange(LoadVec3(def.min_angular_velocity()),
+                          LoadVec3(def.max_angular_velocity()));
+  duration_of_shrink_out_ = static_cast<TimeStep>(def.shrink_duration());
+  duration_of_fade_out_ = static_cast<TimeStep>(def.fade_duration());
+}
+
 mathfu::mat4 Particle::CalculateMatrix() const {
   return mathfu::mat4::FromTranslationVector(CurrentPosition()) *
          mathfu::mat4::FromRotationMatrix(CurrentOrientation().ToMatrix()) *
@@ -64,40 +109,186 @@ mathfu::vec3 Particle::CurrentScale() const {
               : 1.0f);
 }
 
+ParticleManager::ParticleManager()
+    : size_(0),
+      base_scales_(kMaxParticles),
+      base_tints_(kMaxParticles),
+      ages_(kMaxParticles),
+      durations_(kMaxParticles),
+      fade_out_durations_(kMaxParticles),
+      shrink_out_durations_(kMaxParticles),
+      renderable_ids_(kMaxParticles),
+      effects_(kMaxParticles),
+      fades_(kMaxParticles),
+      shrinks_(kMaxParticles),
+      update_runner_(nullptr) {
+  bursts_.reserve(kMaxParticleBursts);
+  base_positions_.resize(kMaxParticles);
+  base_velocities_.resize(kMaxParticles);
+  accelerations_.resize(kMaxParticles);
+  base_orientations_.resize(kMaxParticles);
+  rotational_velocities_.resize(kMaxParticles);
+  positions_.resize(kMaxParticles);
+  orientations_.resize(kMaxParticles);
+}
+
+// The time between frames is, near enough, how long the last frame took, so
+// it also drives the budget.
 void ParticleManager::AdvanceFrame(TimeStep delta_time) {
-  for (auto it = particle_list_.begin(); it != particle_list_.end();) {
-    (*it)->AdvanceFrame(delta_time);
-    if ((*it)->IsFinished()) {
-      inactive_particle_list_.push_back(*it);
-      it = particle_list_.erase(it);
-    } else {
-      ++it;
+  budget_.Update(delta_time);
+
+  ParticleAddToEach(delta_time, size_, &ages_[0]);
+  // Walk backwards, so that the particle swapped into a dead slot has already
+  // been checked.
+  for (size_t i = size_; i-- > 0;) {
+    if (ages_[i] >= durations_[i]) {
+      effect_stats_[effects_[i]].live_particles--;
+      --size_;
+      if (i != size_) MoveParticle(size_, i);
     }
   }
-}
-
-Particle* ParticleManager::CreateParticle() {
-  Particle* result;
-  if (inactive_particle_list_.size() > 0) {
-    result = inactive_particle_list_.back();
-    inactive_particle_list_.pop_back();
+  const size_t tasks = (size_ + kParticlesPerTask - 1) / kParticlesPerTask;
+  if (update_runner_ && tasks > 1) {
+    update_runner_->RunTasks(tasks, [this](size_t task) {
+      const size_t begin = task * kParticlesPerTask;
+      UpdateCurrentState(begin, std::min(begin + kParticlesPerTask, size_));
+    });
   } else {
-    if (particle_list_.size() >= kMaxParticles) {
-      return nullptr;
+    UpdateCurrentState(0, size_);
+  }
+
+  for (size_t i = bursts_.size(); i-- > 0;) {
+    ParticleBurst& burst = bursts_[i];
+    burst.age += delta_time;
+    if (burst.age >= burst.duration) {
+      effect_stats_[EffectIndex(burst.def)].live_particles -=
+          burst.num_particles;
+      burst = bursts_.back();
+      bursts_.pop_back();
     }
-    result = new Particle();
   }
-  result->set_age(0);
-  particle_list_.push_back(result);
-  return result;
+}
+
+int ParticleManager::BudgetSpawn(const ParticleDef* effect, int requested,
+                                 float* size_scale) {
+  // Bursts come out of their def's pool, not this one.
+  int available = static_cast<int>(capacity() - size_);
+  if (BurstsEnabled(effect)) {
+    available =
+        bursts_.size() < kMaxParticleBursts ? effect->gpu_pool_size() : 0;
+  }
+  const int allowed = budget_.Allow(requested, available, size_scale);
+  if (allowed < requested) {
+    ParticleEffectStats& stats = effect_stats_[EffectIndex(effect)];
+    stats.throttled_spawns++;
+    stats.dropped_particles += requested - allowed;
+  }
+  return allowed;
+}
+
+bool ParticleManager::AddBurst(const ParticleBurst& burst) {
+  assert(BurstsEnabled(burst.def));
+  if (bursts_.size() >= kMaxParticleBursts) return false;
+  bursts_.push_back(burst);
+  effect_stats_[EffectIndex(burst.def)].live_particles += burst.num_particles;
+  return true;
 }
 
 void ParticleManager::RemoveAllParticles() {
-  for (auto it = particle_list_.begin(); it != particle_list_.end();) {
-    inactive_particle_list_.push_back(*it);
-    it = particle_list_.erase(it);
+  size_ = 0;
+  bursts_.clear();
+  for (auto it = effect_stats_.begin(); it != effect_stats_.end(); ++it) {
+    it->live_particles = 0;
   }
 }
 
+uint8_t ParticleManager::EffectIndex(const ParticleDef* effect) {
+  for (size_t i = 0; i < effect_stats_.size(); ++i) {
+    if (effect_stats_[i].def == effect) return static_cast<uint8_t>(i);
+  }
+  // There are only a handful of effects, all from the config.
+  assert(effect_stats_.size() < 0x100);
+  ParticleEffectStats stats = {effect, 0, 0, 0};
+  effect_stats_.push_back(stats);
+  return static_cast<uint8_t>(effect_stats_.size() - 1);
+}
+
+bool ParticleManager::AddParticle(const Particle& particle,
+                                  const ParticleDef* effect) {
+  if (size_ >= capacity()) return false;
+  const size_t i = size_++;
+  effects_[i] = EffectIndex(effect);
+  effect_stats_[effects_[i]].live_particles++;
+  base_positions_.Set(i, particle.base_position());
+  base_velocities_.Set(i, particle.base_velocity());
+  accelerations_.Set(i, particle.acceleration());
+  base_orientations_.Set(i, particle.base_orientation());
+  rotational_velocities_.Set(i, particle.rotational_velocity());
+  base_scales_[i] = particle.base_scale();
+  base_tints_[i] = particle.base_tint();
+  ages_[i] = particle.age();
+  durations_[i] = particle.duration();
+  fade_out_durations_[i] = particle.duration_of_fade_out();
+  shrink_out_durations_[i] = particle.duration_of_shrink_out();
+  renderable_ids_[i] = particle.renderable_id();
+  UpdateCurrentState(i, size_);
+  return true;
+}
+
+void ParticleManager::MoveParticle(size_t from, size_t to) {
+  base_positions_.Move(from, to);
+  base_velocities_.Move(from, to);
+  accelerations_.Move(from, to);
+  base_orientations_.Move(from, to);
+  rotational_velocities_.Move(from, to);
+  base_scales_[to] = base_scales_[from];
+  base_tints_[to] = base_tints_[from];
+  ages_[to] = ages_[from];
+  durations_[to] = durations_[from];
+  fade_out_durations_[to] = fade_out_durations_[from];
+  shrink_out_durations_[to] = shrink_out_durations_[from];
+  renderable_ids_[to] = renderable_ids_[from];
+  effects_[to] = effects_[from];
+}
+
+void ParticleManager::UpdateCurrentState(size_t begin, size_t end) {
+  if (begin >= end) return;
+  const size_t count = end - begin;
+  const float* ages = &ages_[begin];
+  ParticleIntegrateQuadratic(&base_positions_.x[begin],
+                             &base_velocities_.x[begin],
+                             &accelerations_.x[begin], ages, count,
+                             &positions_.x[begin]);
+  ParticleIntegrateQuadratic(&base_positions_.y[begin],
+                             &base_velocities_.y[begin],
+                             &accelerations_.y[begin], ages, count,
+                             &positions_.y[begin]);
+  ParticleIntegrateQuadratic(&base_positions_.z[begin],
+                             &base_velocities_.z[begin],
+                             &accelerations_.z[begin], ages, count,
+                             &positions_.z[begin]);
+  ParticleIntegrateLinear(&base_orientations_.x[begin],
+                          &rotational_velocities_.x[begin], ages, count,
+                          &orientations_.x[begin]);
+  ParticleIntegrateLinear(&base_orientations_.y[begin],
+                          &rotational_velocities_.y[begin], ages, count,
+                          &orientations_.y[begin]);
+  ParticleIntegrateLinear(&base_orientations_.z[begin],
+                          &rotational_velocities_.z[begin], ages, count,
+                          &orientations_.z[begin]);
+  ParticleEndOfLifeScales(ages, &durations_[begin],
+                          &fade_out_durations_[begin], count, &fades_[begin]);
+  ParticleEndOfLifeScales(ages, &durations_[begin],
+                          &shrink_out_durations_[begin], count,
+                          &shrinks_[begin]);
+}
+
+mathfu::mat4 ParticleManager::CalculateMatrix(size_t index) const {
+  const Quat orientation = CurrentOrientation(index);
+  return mathfu::mat4::FromTranslationVector(CurrentPosition(index)) *
+         mathfu::mat4::FromRotationMatrix(orientation.ToMatrix()) *
+         mathfu::mat4::FromScaleVector(CurrentScale(index));
+}
+
 }  // pie_noon
 }  // fpl
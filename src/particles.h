@@ -16,10 +16,18 @@
 #define PARTICLES_H
 
 #include "common.h"
-#include "scene_description.h"
-#include <list>
+#include "particle_budget.h"
+#include <algorithm>
+#include <vector>
 
 namespace fpl {
+
+struct ParticleDef;
+
+namespace entity {
+class UpdateRunnerInterface;
+}
+
 namespace pie_noon {
 
 typedef float TimeStep;
@@ -30,6 +38,13 @@ class Particle {
 
   void reset();
 
+  // Picks a random starting state for a particle spawned from 'def' at
+  // 'position'. 'orientation_offset' is added to the def's orientation, and
+  // 'tint' is multiplied into its tint. Leaves the age alone.
+  void Randomize(const ParticleDef& def, const mathfu::vec3& position,
+                 const mathfu::vec3& orientation_offset,
+                 const mathfu::vec4& tint);
+
   mathfu::vec3 CurrentPosition() const;
   mathfu::vec3 CurrentVelocity() const;
   Quat CurrentOrientation() const;
@@ -127,27 +142,176 @@ class Particle {
   uint16_t renderable_id_;
 };
 
+// One spawn of a ParticleDef with gpu_simulated set. Its particles are a run
+// of the def's pregenerated pool, and are only ever evaluated on the GPU.
+struct ParticleBurst {
+  const ParticleDef* def;
+  // Where the burst was spawned, and the Euler angles added to the
+  // orientation of each of its particles.
+  mathfu::vec3_packed position;
+  mathfu::vec3_packed orientation_offset;
+  // Multiplied into the tint of each particle.
+  mathfu::vec4_packed tint;
+  // The run of the def's pool to draw, and how much to grow each particle.
+  int first_particle;
+  int num_particles;
+  float scale;
+  // Milliseconds since the burst was spawned, and until its last particle
+  // dies.
+  TimeStep age;
+  TimeStep duration;
+};
+
+// Live particles, and how often the budget has throttled, for one effect.
+struct ParticleEffectStats {
+  const ParticleDef* def;
+  int live_particles;
+  int throttled_spawns;
+  int dropped_particles;
+};
+
+// Three parallel arrays, holding the x, y and z components of a vector per
+// particle, in the layout the kernels in particle_kernel.h work on.
+struct ParticleVec3Array {
+  void resize(size_t size) {
+    x.resize(size);
+    y.resize(size);
+    z.resize(size);
+  }
+  void Set(size_t index, const mathfu::vec3& v) {
+    x[index] = v.x();
+    y[index] = v.y();
+    z[index] = v.z();
+  }
+  mathfu::vec3 Get(size_t index) const {
+    return mathfu::vec3(x[index], y[index], z[index]);
+  }
+  void Move(size_t from, size_t to) {
+    x[to] = x[from];
+    y[to] = y[from];
+    z[to] = z[from];
+  }
+
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> z;
+};
+
+// Owns every live particle, stored as a structure of arrays so that updating
+// and drawing them walks contiguous memory. Live particles always occupy
+// indices [0, size()); when one dies, the last particle is moved into its
+// slot, so indices are only stable until the next AdvanceFrame().
 class ParticleManager {
  public:
+  ParticleManager();
+
   void AdvanceFrame(TimeStep delta_time);
 
-  const std::list<Particle*>& get_particle_list() const {
-    return particle_list_;
+  // Lets AdvanceFrame() update blocks of particles in parallel.
+  void set_update_runner(entity::UpdateRunnerInterface* update_runner) {
+    update_runner_ = update_runner;
   }
 
-  // Returns a pointer to a new particle, ready to be populated.
-  // Note that this pointer is not guaranteed to be valid indefinitely!
-  // Also note that the initial state of the particle is undetermined, so
-  // users should either populate every field explicitly, or call
-  // Particle::reset().
-  Particle* CreateParticle();
+  // Asks the budget how many of 'requested' particles 'effect' may spawn
+  // now, and how much to grow each of them to make up for the rest.
+  int BudgetSpawn(const ParticleDef* effect, int requested, float* size_scale);
 
-  // Removes all active particles.
+  // Copies 'particle', spawned by 'effect', into the pool. Returns false if
+  // the pool is full, in which case new particles can't be spawned right now.
+  bool AddParticle(const Particle& particle, const ParticleDef* effect);
+
+  // Starts tracking 'burst'. Returns false if too many are already live.
+  bool AddBurst(const ParticleBurst& burst);
+
+  // Removes all active particles and bursts.
   void RemoveAllParticles();
 
+  ParticleBudget& budget() { return budget_; }
+  const ParticleBudget& budget() const { return budget_; }
+
+  // Every effect that has spawned particles, in order of first spawn.
+  const std::vector<ParticleEffectStats>& effect_stats() const {
+    return effect_stats_;
+  }
+
+  // Marks 'def' as able to spawn bursts, once its pool is on the GPU. Spawns
+  // of other defs must use AddParticle().
+  void EnableBursts(const ParticleDef* def) { burst_defs_.push_back(def); }
+  bool BurstsEnabled(const ParticleDef* def) const {
+    return std::find(burst_defs_.begin(), burst_defs_.end(), def) !=
+           burst_defs_.end();
+  }
+
+  // The live bursts, in no particular order.
+  const std::vector<ParticleBurst>& bursts() const { return bursts_; }
+
+  // Number of live particles.
+  size_t size() const { return size_; }
+
+  // Maximum number of live particles.
+  size_t capacity() const { return ages_.size(); }
+
+  // Accessors for the particle at 'index', which must be less than size().
+  // These are as of the last call to AdvanceFrame() or AddParticle().
+  mathfu::vec3 CurrentPosition(size_t index) const {
+    return positions_.Get(index);
+  }
+  Quat CurrentOrientation(size_t index) const {
+    return Quat::FromEulerAngles(orientations_.Get(index));
+  }
+  mathfu::vec4 CurrentTint(size_t index) const {
+    return mathfu::vec4(base_tints_[index]) * fades_[index];
+  }
+  mathfu::vec3 CurrentScale(size_t index) const {
+    return mathfu::vec3(base_scales_[index]) * shrinks_[index];
+  }
+  mathfu::mat4 CalculateMatrix(size_t index) const;
+  uint16_t renderable_id(size_t index) const {
+    return renderable_ids_[index];
+  }
+
  private:
-  std::list<Particle*> particle_list_;
-  std::list<Particle*> inactive_particle_list_;
+  // Moves the particle at 'from' into 'to', overwriting it.
+  void MoveParticle(size_t from, size_t to);
+
+  // The index of 'effect' in effect_stats_, adding it if it's new.
+  uint8_t EffectIndex(const ParticleDef* effect);
+
+  // Recalculates the current position, orientation, fade and shrink of the
+  // particles in [begin, end) from their ages.
+  void UpdateCurrentState(size_t begin, size_t end);
+
+  size_t size_;
+
+  // Each particle's starting state.
+  ParticleVec3Array base_positions_;
+  ParticleVec3Array base_velocities_;
+  ParticleVec3Array accelerations_;
+  ParticleVec3Array base_orientations_;
+  ParticleVec3Array rotational_velocities_;
+  std::vector<mathfu::vec3_packed> base_scales_;
+  std::vector<mathfu::vec4_packed> base_tints_;
+  std::vector<TimeStep> ages_;
+  std::vector<TimeStep> durations_;
+  std::vector<TimeStep> fade_out_durations_;
+  std::vector<TimeStep> shrink_out_durations_;
+  std::vector<uint16_t> renderable_ids_;
+  // Index into effect_stats_ of the effect that spawned each particle.
+  std::vector<uint8_t> effects_;
+
+  // Each particle's state at its current age. Orientations are Euler angles.
+  ParticleVec3Array positions_;
+  ParticleVec3Array orientations_;
+  std::vector<float> fades_;
+  std::vector<float> shrinks_;
+
+  std::vector<ParticleBurst> bursts_;
+  std::vector<const ParticleDef*> burst_defs_;
+
+  ParticleBudget budget_;
+  std::vector<ParticleEffectStats> effect_stats_;
+
+  entity::UpdateRunnerInterface* update_runner_;
 };
 
 }  // pie_noon
@@ -0,0 +1,185 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "perf_hud.h"
+#include "imgui.h"
+#include "material_manager.h"
+
+namespace fpl {
+namespace pie_noon {
+
+const int PerfHud::kFrameTimeCount;
+
+static const char kPerfHudFont[] = "fonts/NotoSansCJKjp-Bold.otf";
+// The labels, baked by scripts/build_assets.py from
+// src/rawassets/baked_text/perf_hud.json.
+static const char kPerfHudBakedText[] = "fonts/perf_hud_text.bin";
+
+// Sizes, in imgui's virtual resolution of 1000 down the screen.
+static const float kVirtualResolution = 1000.0f;
+static const float kTextSize = 20.0f;
+static const float kMargin = 10.0f;
+static const float kGraphWidth = 360.0f;
+static const float kGraphHeight = 60.0f;
+
+// Frame time at the top of the graph, in ms. Longer frames are clipped.
+static const WorldTime kGraphMaxFrameTime = 50;
+
+// How often the network rates are updated, in ms.
+static const uint32_t kRateInterval = 1000;
+
+PerfHud::PerfHud()
+    : visible_(false),
+      frame_times_(kFrameTimeCount, 0),
+      next_frame_(0),
+      rate_time_(0),
+      rate_bytes_sent_(0),
+      rate_bytes_received_(0),
+      bytes_sent_per_second_(0),
+      bytes_received_per_second_(0),
+      label_count_(0) {}
+
+void PerfHud::AddFrameTime(WorldTime frame_time) {
+  frame_times_[next_frame_] = frame_time;
+  next_frame_ = (next_frame_ + 1) % kFrameTimeCount;
+}
+
+void PerfHud::AddLine(const char* name, const char* value) {
+  if (labels_.size() < label_count_ + 2) labels_.resize(label_count_ + 2);
+  labels_[label_count_++] = name;
+  labels_[label_count_++] = value;
+}
+
+void PerfHud::FormatLines() {
+  label_count_ = 0;
+  char value[64];
+
+  const WorldTime last =
+      frame_times_[(next_frame_ + kFrameTimeCount - 1) % kFrameTimeCount];
+  WorldTime total = 0;
+  WorldTime worst = 0;
+  for (int i = 0; i < kFrameTimeCount; ++i) {
+    total += frame_times_[i];
+    worst = std::max(worst, frame_times_[i]);
+  }
+  snprintf(value, sizeof(value), "%d / %.1f / %d", last,
+           static_cast<float>(total) / kFrameTimeCount, worst);
+  AddLine("Frame ms, last / mean / max", value);
+
+  snprintf(value, sizeof(value), "%d / %d", stats_.renderables_submitted,
+           stats_.renderables_culled);
+  AddLine("Renderables drawn / culled", value);
+
+  const RenderStats& render = stats_.render;
+  snprintf(value, sizeof(value), "%d / %d", render.draw_calls,
+           render.triangles);
+  AddLine("Draw calls / triangles", value);
+
+  snprintf(value, sizeof(value), "%d / %d", render.shader_switches,
+           render.texture_binds);
+  AddLine("Shader switches / texture binds", value);
+
+  snprintf(value, sizeof(value), "%d / %d", render.buffer_uploads,
+           static_cast<int>(render.bytes_uploaded / 1024));
+  AddLine("Uploads / KB", value);
+
+  snprintf(value, sizeof(value), "%d", stats_.live_particles);
+  AddLine("Live particles", value);
+
+  for (size_t i = 0; i < stats_.components.size(); ++i) {
+    snprintf(value, sizeof(value), "%d",
+             static_cast<int>(stats_.components[i].entities));
+    AddLine(stats_.components[i].name, value);
+  }
+
+  const GlyphCacheStats& glyphs = fontman_.GetGlyphCacheStats();
+  snprintf(value, sizeof(value), "%d%% / %d",
+           glyphs.lookups > 0 ? glyphs.hits * 100 / glyphs.lookups : 100,
+           glyphs.lookups);
+  AddLine("Glyph cache hits / lookups", value);
+
+  snprintf(value, sizeof(value), "%d", stats_.load_queue_depth);
+  AddLine("Textures loading", value);
+
+  // Rates of the whole last interval, so they don't flicker every frame.
+  const uint32_t now = SDL_GetTicks();
+  if (now - rate_time_ >= kRateInterval) {
+    const uint32_t elapsed = now - rate_time_;
+    bytes_sent_per_second_ = static_cast<int>(
+        (stats_.network_bytes_sent - rate_bytes_sent_) * 1000 / elapsed);
+    bytes_received_per_second_ = static_cast<int>(
+        (stats_.network_bytes_received - rate_bytes_received_) * 1000 /
+        elapsed);
+    rate_time_ = now;
+    rate_bytes_sent_ = stats_.network_bytes_sent;
+    rate_bytes_received_ = stats_.network_bytes_received;
+  }
+  snprintf(value, sizeof(value), "%d / %d", bytes_sent_per_second_,
+           bytes_received_per_second_);
+  AddLine("Network B/s out / in", value);
+}
+
+void PerfHud::Render(MaterialManager& matman, InputSystem& input,
+                     const Texture& bar_texture) {
+  if (!fontman_.FontLoaded()) {
+    fontman_.Open(kPerfHudFont);
+    fontman_.SetRenderer(matman.renderer());
+    // Baked glyphs only fit every window size as distance fields.
+    fontman_.EnableSDF(true);
+    fontman_.LoadBakedText(kPerfHudBakedText);
+    // Every value is a number, so none of them needs shaping.
+    fontman_.SetPreshapedCharacters(kNumericCharacters);
+  }
+  FormatLines();
+
+  gui::RunUncached(matman, fontman_, input, [&]() {
+    gui::PositionUI(kVirtualResolution, gui::LAYOUT_HORIZONTAL_TOP,
+                    gui::LAYOUT_VERTICAL_LEFT);
+    gui::StartGroup(gui::LAYOUT_VERTICAL_LEFT, kMargin / 2, "perf_hud");
+    gui::SetMargin(gui::Margin(kMargin));
+    gui::ColorBackground(vec4(0.0f, 0.0f, 0.0f, 0.6f));
+
+    gui::CustomElement(
+        vec2(kGraphWidth, kGraphHeight), "perf_hud_graph",
+        [&](const vec2i& pos, const vec2i& size) {
+          // Oldest frame on the left.
+          const int bar_width = std::max(1, size.x() / kFrameTimeCount);
+          for (int i = 0; i < kFrameTimeCount; ++i) {
+            const WorldTime frame_time = std::min(
+                frame_times_[(next_frame_ + i) % kFrameTimeCount],
+                kGraphMaxFrameTime);
+            const int height = size.y() * frame_time / kGraphMaxFrameTime;
+            if (height <= 0) continue;
+            gui::RenderTexture(
+                bar_texture,
+                vec2i(pos.x() + i * bar_width, pos.y() + size.y() - height),
+                vec2i(bar_width, height));
+          }
+        });
+
+    for (size_t i = 0; i + 1 < label_count_; i += 2) {
+      gui::StartGroup(gui::LAYOUT_HORIZONTAL_TOP, kMargin);
+      gui::SetTextColor(vec4(0.7f, 0.7f, 0.7f, 1.0f));
+      gui::Label(labels_[i].c_str(), kTextSize);
+      gui::SetTextColor(mathfu::kOnes4f);
+      gui::Label(labels_[i + 1].c_str(), kTextSize);
+      gui::EndGroup();
+    }
+    gui::EndGroup();
+  });
+}
+
+}  // namespace pie_noon
+}  // namespace fpl
@@ -0,0 +1,114 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_PERF_HUD_H
+#define FPL_PERF_HUD_H
+
+#include <string>
+#include <vector>
+#include "common.h"
+#include "font_manager.h"
+#include "game_state.h"
+#include "renderer.h"
+
+namespace fpl {
+
+class InputSystem;
+class MaterialManager;
+class Texture;
+
+namespace pie_noon {
+
+// An overlay of frame times and engine counters, drawn with imgui over
+// everything else. The game records every frame's time, and fills in stats()
+// on the frames the HUD is visible.
+class PerfHud {
+ public:
+  // What the HUD shows besides frame times.
+  struct Stats {
+    Stats()
+        : renderables_submitted(0),
+          renderables_culled(0),
+          live_particles(0),
+          load_queue_depth(0),
+          network_bytes_sent(0),
+          network_bytes_received(0) {}
+    int renderables_submitted;
+    int renderables_culled;
+    int live_particles;
+    // The GL work of the last whole frame.
+    RenderStats render;
+    std::vector<GameState::ComponentCount> components;
+    // Textures waiting to be loaded or uploaded.
+    int load_queue_depth;
+    // Totals since the game started. The HUD works out the rates.
+    uint64_t network_bytes_sent;
+    uint64_t network_bytes_received;
+  };
+
+  // Frame times shown in the graph.
+  static const int kFrameTimeCount = 120;
+
+  PerfHud();
+
+  bool visible() const { return visible_; }
+  void set_visible(bool visible) { visible_ = visible; }
+
+  // Record how long the most recent frame took, in ms.
+  void AddFrameTime(WorldTime frame_time);
+
+  Stats& stats() { return stats_; }
+
+  // Lookups in the HUD's glyph cache, the only one drawn from every frame.
+  const GlyphCacheStats& glyph_cache_stats() const {
+    return fontman_.GetGlyphCacheStats();
+  }
+
+  // Draw the HUD in the top left of the screen. 'bar_texture' is stretched
+  // into the graph's bars, so should be plain white. Opens the HUD's font the
+  // first time.
+  void Render(MaterialManager& matman, InputSystem& input,
+              const Texture& bar_texture);
+
+ private:
+  // Format the labels, so that both of imgui's passes see the same text.
+  void FormatLines();
+  void AddLine(const char* name, const char* value);
+
+  bool visible_;
+  std::vector<WorldTime> frame_times_;
+  // Where the next frame time goes in frame_times_.
+  int next_frame_;
+  Stats stats_;
+
+  // Network totals as of the last rate update, and the rates since then.
+  uint32_t rate_time_;
+  uint64_t rate_bytes_sent_;
+  uint64_t rate_bytes_received_;
+  int bytes_sent_per_second_;
+  int bytes_received_per_second_;
+
+  // Pairs of name and value labels, reused from frame to frame.
+  std::vector<std::string> labels_;
+  size_t label_count_;
+
+  // The HUD's own font, so that it doesn't disturb the menus' caches. Its
+  // glyph cache is the one whose hit rate is shown.
+  FontManager fontman_;
+};
+
+}  // namespace pie_noon
+}  // namespace fpl
+
+#endif  // FPL_PERF_HUD_H
@@ -20,6 +20,7 @@
 #include "character_state_machine_def_generated.h"
 #include "config_generated.h"
 #include "imgui.h"
+#include "memory_accounting.h"
 #include "motive/io/flatbuffers.h"
 #include "motive/init.h"
 #include "motive/math/angle.h"
@@ -70,6 +71,10 @@ static const char* kLabelMultiscreenButton = "Multiscreen";
 static const char* kLabelCardboardButton = "Cardboard";
 static const char* kLabelGameModesButton = "Game Modes";
 
+static const char* kCategoryPerformance = "Performance";
+static const char* kActionQualityTierDown = "Quality tier down";
+static const char* kActionQualityTierUp = "Quality tier up";
+
 #ifdef PIE_NOON_USES_GOOGLE_PLAY_GAMES
 static const char* kCategoryMultiscreen = "Multiscreen";
 static const char* kActionStart = "Start";
@@ -86,6 +91,9 @@ static const char* kLabelConnectionLost = "ConnectionLost";
 #endif  // PIE_NOON_USES_GOOGLE_PLAY_GAMES
 
 static const unsigned short kQuadIndices[] = {0, 1, 2, 2, 1, 3};
+static_assert(kQuadNumVertices == kBillboardNumVertices &&
+                  kQuadNumIndices == kBillboardNumIndices,
+              "Cardboard quads must be billboards to be batched.");
 
 static const Attribute kQuadMeshFormat[] = {kPosition3f, kTexCoord2f, kNormal3f,
                                             kTangent4f, kEND};
@@ -93,6 +101,22 @@ static const Attribute kQuadMeshFormat[] = {kPosition3f, kTexCoord2f, kNormal3f,
 static const char kAssetsDir[] = "assets";
 
 static const char kConfigFileName[] = "config.bin";
+// Written to the app's preferences directory, if config.write_startup_trace.
+static const char kStartupTraceFileName[] = "startup_trace.json";
+
+// Written to the app's preferences directory, if config.frame_trace_frames.
+static const char kFrameTraceFileName[] = "frame_trace.json";
+// Written there too, if config.scenario_benchmark_frames.
+static const char kScenarioBenchmarkFileName[] = "scenario_benchmark.json";
+// And these, numbered from 0, if config.hitch_threshold_ms.
+static const char kHitchFileNameFormat[] = "hitch_%d.json";
+// The scenario benchmark's step, when config.simulation_step_time is 0.
+static const WorldTime kScenarioBenchmarkStepTime = 16;
+// How often to read the device's temperature, which goes through Java.
+static const WorldTime kThermalReadInterval = 5000;
+// Written there too, after each multiscreen game this device hosts, if
+// config.multiscreen_options.record_replays. Play it with pie_noon_sim.
+static const char kReplayFileName[] = "multiscreen_replay.bin";
 
 #ifdef ANDROID_CARDBOARD
 static const char kCardboardConfigFileName[] = "cardboard_config.bin";
@@ -108,6 +132,13 @@ static const int kAndroidMaxScreenHeight = 1080;
 // properly handle the wrap-around case.
 static inline WorldTime CurrentWorldTime() { return SDL_GetTicks(); }
 
+// Textures queued with a higher priority are loaded first.
+static const int kLoadPriorityDefault = 0;
+static const int kLoadPriorityFirstScreen = 1;
+static const int kLoadPriorityLoadingScreen = 2;
+// Assets that may be needed soon, behind everything needed now.
+static const int kLoadPriorityPrefetch = -1;
+
 static inline const UiGroup* TitleScreenButtons(const Config& config) {
 #ifdef __ANDROID__
   return config.title_screen_buttons_android();
@@ -132,25 +163,52 @@ PieNoonGame::PieNoonGame()
       matman_(renderer_),
       cardboard_fronts_(RenderableId_Count, nullptr),
       cardboard_backs_(RenderableId_Count, nullptr),
+      cardboard_front_quads_(RenderableId_Count * kBillboardNumVertices),
       stick_front_(nullptr),
       stick_back_(nullptr),
+      renderable_bounds_(RenderableId_Count,
+                         mathfu::vec4_packed(mathfu::kZeros4f)),
+      num_culled_renderables_(0),
+      num_submitted_renderables_(0),
       shader_lit_textured_normal_(nullptr),
-      shader_simple_shadow_(nullptr),
+      shader_simple_shadow_instanced_(nullptr),
       shader_textured_(nullptr),
+      shader_textured_instanced_(nullptr),
       shader_grayscale_(nullptr),
+      shader_gpu_particles_(nullptr),
+      shader_reproject_(nullptr),
       shadow_mat_(nullptr),
+      ground_mat_(nullptr),
+      render_scene_(0),
+      render_scene_ready_(false),
+      next_frame_delta_time_(0),
+      next_frame_fixed_steps_(false),
       prev_world_time_(0),
+      simulation_time_(0),
+      frame_input_time_(0),
+      frame_head_pose_time_(0),
+      cardboard_drawn_view_(mat4::Identity()),
+      cardboard_tan_half_fov_(mathfu::kOnes2f),
+      frame_trace_frames_left_(0),
+      render_shadows_(true),
+      max_undistort_scale_(1.0f),
+      thermal_state_(kThermalUnknown),
+      thermal_read_time_(0),
       debug_previous_states_(),
       full_screen_fader_(&renderer_),
       fade_exit_state_(kUninitialized),
       ambience_channel_(),
       stinger_channel_(),
       music_channel_(),
+      tutorial_slides_multiscreen_(false),
+      tutorial_slide_index_(0),
       next_achievement_index_(0) {
   version_ = kVersion;
 }
 
 PieNoonGame::~PieNoonGame() {
+  SetTrackerWorkerPool(nullptr);
+
   for (int i = 0; i < RenderableId_Count; ++i) {
     delete cardboard_fronts_[i];
     cardboard_fronts_[i] = nullptr;
@@ -167,7 +225,9 @@ PieNoonGame::~PieNoonGame() {
 }
 
 bool PieNoonGame::InitializeConfig() {
-  if (!LoadFile(kConfigFileName, &config_source_)) {
+  StartupTraceScope trace("InitializeConfig");
+  MemoryTagScope tag(kMemoryTagConfig);
+  if (!config_source_.Open(kConfigFileName)) {
     SDL_LogError(SDL_LOG_CATEGORY_ERROR, "can't load config.bin\n");
     return false;
   }
@@ -176,7 +236,9 @@ bool PieNoonGame::InitializeConfig() {
 
 #ifdef ANDROID_CARDBOARD
 bool PieNoonGame::InitializeCardboardConfig() {
-  if (!LoadFile(kCardboardConfigFileName, &cardboard_config_source_)) {
+  StartupTraceScope trace("InitializeCardboardConfig");
+  MemoryTagScope tag(kMemoryTagConfig);
+  if (!cardboard_config_source_.Open(kCardboardConfigFileName)) {
     SDL_LogError(SDL_LOG_CATEGORY_ERROR, "can't load %s\n",
                  kCardboardConfigFileName);
     return false;
@@ -185,9 +247,24 @@ bool PieNoonGame::InitializeCardboardConfig() {
 }
 #endif  // ANDROID_CARDBOARD
 
-// Initialize the 'renderer_' member. No other members have been initialized at
-// this point.
+// Everything that works off the main thread shares one pool, so that
+// together they never ask for more threads than there are cores. Leave a core
+// free for the main thread, and the simulation thread if there will be one.
+void PieNoonGame::InitializeWorkerPool() {
+  const Config& config = GetConfig();
+  const bool pipelined = config.pipeline_simulation() && SDL_GetCPUCount() > 1;
+  const int free_cores = SDL_GetCPUCount() - (pipelined ? 2 : 1);
+  const int wanted =
+      std::max(config.max_update_threads(), config.loader_threads());
+  worker_pool_.Start(std::max(1, std::min(wanted, free_cores)));
+  SetTrackerWorkerPool(&worker_pool_);
+  gui_menu_.set_worker_pool(&worker_pool_);
+}
+
+// Initialize the 'renderer_' member. No other members, besides worker_pool_,
+// have been initialized at this point.
 bool PieNoonGame::InitializeRenderer() {
+  StartupTraceScope trace("InitializeRenderer");
   const Config& config = GetConfig();
 
 #ifdef __ANDROID__
@@ -235,17 +312,24 @@ static void CreateVerticalQuad(const vec3& offset, const vec2& geo_size,
   vertices[2].tc = vec2(coord_bottom_left[0], coord_top_right[1]);
   vertices[3].tc = coord_top_right;
 
-  Mesh::ComputeNormalsTangents(vertices, &kQuadIndices[0], kQuadNumVertices,
-                               kQuadNumIndices);
+  // The quad faces +z, with u along +x and v along -y, so its tangent space
+  // is the same everywhere, and needn't be computed from the triangles.
+  for (int i = 0; i < kQuadNumVertices; ++i) {
+    vertices[i].norm = vec3(0.0f, 0.0f, 1.0f);
+    vertices[i].tangent = vec4(1.0f, 0.0f, 0.0f, -1.0f);
+  }
 }
 
 // Creates a mesh of a single quad (two triangles) vertically upright.
 // The quad's has x and y size determined by the size of the texture.
 // The quad is offset in (x,y,z) space by the 'offset' variable.
 // Returns a mesh with the quad and texture, or nullptr if anything went wrong.
+// If 'vertices_out' is non-null, the quad's vertices are copied into it.
 Mesh* PieNoonGame::CreateVerticalQuadMesh(
     const flatbuffers::String* material_name, const vec3& offset,
-    const vec2& pixel_bounds, float pixel_to_world_scale) {
+    const vec2& pixel_bounds, float pixel_to_world_scale,
+    NormalMappedVertex* vertices_out) {
+  MemoryTagScope tag(kMemoryTagMeshes);
   // Don't try to load obviously invalid materials. Suppresses error logs from
   // the material manager.
   if (material_name == nullptr || material_name->c_str()[0] == '\0')
@@ -269,16 +353,37 @@ Mesh* PieNoonGame::CreateVerticalQuadMesh(
   NormalMappedVertex vertices[kQuadNumVertices];
   CreateVerticalQuad(offset, geo_size, texture_coord_size, vertices);
 
-  // Create mesh and add in quad indices.
-  Mesh* mesh = new Mesh(vertices, kQuadNumVertices, sizeof(NormalMappedVertex),
-                        kQuadMeshFormat);
+  // If the texture is packed into an atlas, only cover our part of it.
+  for (int i = 0; i < kQuadNumVertices; ++i) {
+    vertices[i].tc = material->MapTexCoord(vec2(vertices[i].tc));
+  }
+
+  // Create mesh and add in quad indices. The GPU gets quantized vertices if
+  // it can read them, which are less than half the size.
+  Mesh* mesh;
+  if (renderer_.SupportsQuantizedVertices()) {
+    std::vector<uint8_t> quantized;
+    std::vector<Attribute> quantized_format;
+    Mesh::Quantize(vertices, kQuadNumVertices, kQuadMeshFormat, &quantized,
+                   &quantized_format);
+    mesh = new Mesh(renderer_, quantized.data(), kQuadNumVertices,
+                    static_cast<int>(Mesh::VertexSize(quantized_format.data())),
+                    quantized_format.data());
+  } else {
+    mesh = new Mesh(renderer_, vertices, kQuadNumVertices,
+                    sizeof(NormalMappedVertex), kQuadMeshFormat);
+  }
   mesh->AddIndices(kQuadIndices, kQuadNumIndices, material);
+  if (vertices_out != nullptr) {
+    std::copy(vertices, vertices + kQuadNumVertices, vertices_out);
+  }
   return mesh;
 }
 
 // Load textures for cardboard into 'materials_'. The 'renderer_' and 'matman_'
 // members have been initialized at this point.
 bool PieNoonGame::InitializeRenderingAssets() {
+  StartupTraceScope trace("InitializeRenderingAssets");
   const Config& config = GetConfig();
 
   // Check data validity.
@@ -290,11 +395,37 @@ bool PieNoonGame::InitializeRenderingAssets() {
     return false;
   }
 
-  // Force these textures to be queued up first, since we want to use them for
+  // Queue all shaders we use, so the driver can compile them while the
+  // meshes are built. Shaders linked on an earlier run load from their
+  // binaries instead.
+  if (config.shader_binary_cache()) {
+    char* pref_path = SDL_GetPrefPath("Google", "PieNoon");
+    if (pref_path) renderer_.set_program_binary_directory(pref_path);
+    SDL_free(pref_path);
+  }
+  shader_lit_textured_normal_ =
+      matman_.QueueShader("shaders/lit_textured_normal");
+  shader_cardboard = matman_.QueueShader("shaders/cardboard");
+  shader_simple_shadow_instanced_ =
+      matman_.QueueShader("shaders/simple_shadow_instanced");
+  shader_textured_ = matman_.QueueShader("shaders/textured");
+  shader_textured_instanced_ =
+      matman_.QueueShader("shaders/textured_instanced");
+  shader_grayscale_ = matman_.QueueShader("shaders/grayscale");
+  shader_gpu_particles_ = matman_.QueueShader("shaders/gpu_particles");
+#ifdef ANDROID_CARDBOARD
+  if (config.cardboard_reprojection()) {
+    shader_reproject_ = matman_.QueueShader("shaders/reproject");
+  }
+#endif  // ANDROID_CARDBOARD
+
+  // Force these textures to be loaded first, since we want to use them for
   // the loading screen.
+  matman_.set_load_priority(kLoadPriorityLoadingScreen);
   matman_.LoadMaterial(config.loading_material()->c_str());
   matman_.LoadMaterial(config.loading_logo()->c_str());
   matman_.LoadMaterial(config.fade_material()->c_str());
+  matman_.set_load_priority(kLoadPriorityDefault);
 
   // Create a mesh for the front and back of each cardboard cutout.
   const vec3 front_z_offset(0.0f, 0.0f, config.cardboard_front_z_offset());
@@ -313,9 +444,9 @@ bool PieNoonGame::InitializeRenderingAssets() {
     const float pixel_to_world_scale =
         renderable->geometry_scale() * config.pixel_to_world_scale();
 
-    cardboard_fronts_[id] =
-        CreateVerticalQuadMesh(renderable->cardboard_front(), front_offset,
-                               pixel_bounds, pixel_to_world_scale);
+    cardboard_fronts_[id] = CreateVerticalQuadMesh(
+        renderable->cardboard_front(), front_offset, pixel_bounds,
+        pixel_to_world_scale, &cardboard_front_quads_[id * kQuadNumVertices]);
 
     cardboard_backs_[id] =
         CreateVerticalQuadMesh(renderable->cardboard_back(), back_offset,
@@ -333,31 +464,61 @@ bool PieNoonGame::InitializeRenderingAssets() {
                                 config.stick_front_z_offset());
   const vec3 stick_back_offset(0.0f, config.stick_y_offset(),
                                config.stick_back_z_offset());
+  NormalMappedVertex stick_quad[kQuadNumVertices];
   stick_front_ = CreateVerticalQuadMesh(
       config.stick_front(), stick_front_offset, LoadVec2(config.stick_bounds()),
-      config.pixel_to_world_scale());
+      config.pixel_to_world_scale(), stick_quad);
   stick_back_ = CreateVerticalQuadMesh(config.stick_back(), stick_back_offset,
                                        LoadVec2(config.stick_bounds()),
                                        config.pixel_to_world_scale());
+  InitializeRenderableBounds(stick_front_ ? stick_quad : nullptr);
 
-  // Load all shaders we use:
-  shader_lit_textured_normal_ =
-      matman_.LoadShader("shaders/lit_textured_normal");
-  shader_cardboard = matman_.LoadShader("shaders/cardboard");
-  shader_simple_shadow_ = matman_.LoadShader("shaders/simple_shadow");
-  shader_textured_ = matman_.LoadShader("shaders/textured");
-  shader_grayscale_ = matman_.LoadShader("shaders/grayscale");
+  // Wait for the shaders queued above.
   if (!(shader_lit_textured_normal_ && shader_cardboard &&
-        shader_simple_shadow_ && shader_textured_ && shader_grayscale_))
+        shader_simple_shadow_instanced_ && shader_textured_ &&
+        shader_textured_instanced_ && shader_grayscale_ &&
+        shader_gpu_particles_ && matman_.FinishLoadingShaders()))
     return false;
+  renderer_.set_reprojection_shader(shader_reproject_);
+  InitializeDrawRecords();
+
+  game_state_.particle_manager().budget().Initialize(
+      config.particle_budget_frame_time(),
+      config.particle_min_emission_scale());
+  InitializeGpuParticlePool(config.confetti_def());
+  InitializeGpuParticlePool(config.joining_confetti_def());
+  InitializeGpuParticlePool(config.pie_splatter_def());
 
   // Load shadow material:
   shadow_mat_ = matman_.LoadMaterial("materials/floor_shadows.bin");
   if (!shadow_mat_) return false;
 
-  // Load all the menu textures.
+  // Load the ground plane material.
+  ground_mat_ = matman_.LoadMaterial("materials/floor.bin");
+  if (!ground_mat_) return false;
+
+  render_queue_.set_depth_bucket_size(config.render_queue_depth_bucket());
+
+#ifdef ANDROID_CARDBOARD
+  const Config& cardboard_config = GetCardboardConfig();
+  std::vector<float> resolution_scales;
+  if (cardboard_config.undistort_resolution_scales()) {
+    auto scales = cardboard_config.undistort_resolution_scales();
+    for (size_t i = 0; i < scales->Length(); ++i) {
+      resolution_scales.push_back(scales->Get(i));
+    }
+  }
+  dynamic_resolution_.Initialize(
+      resolution_scales, cardboard_config.undistort_target_frame_time());
+#endif  // ANDROID_CARDBOARD
+
+  // Load all the menu textures. The title screen and HUD are the first
+  // things shown after the loading screen, so get them in ahead of the rest.
+  matman_.set_load_priority(kLoadPriorityFirstScreen);
+  gui_menu_.set_use_render_target(config.hud_render_target());
   gui_menu_.LoadAssets(TitleScreenButtons(config), &matman_);
   gui_menu_.LoadAssets(config.touchscreen_zones(), &matman_);
+  matman_.set_load_priority(kLoadPriorityDefault);
   gui_menu_.LoadAssets(config.pause_screen_buttons(), &matman_);
   gui_menu_.LoadAssets(config.multiplayer_host(), &matman_);
   gui_menu_.LoadAssets(config.multiplayer_client(), &matman_);
@@ -380,8 +541,10 @@ bool PieNoonGame::InitializeRenderingAssets() {
       matman_.FindMaterial(config.fade_material()->c_str()));
   full_screen_fader_.set_shader(shader_textured_);
 
-  // Start the thread that actually loads all assets we requested above.
-  matman_.StartLoadingTextures();
+  // Start the jobs that actually load all assets we requested above.
+  matman_.StartLoadingTextures(&worker_pool_, config.loader_threads());
+  matman_.set_texture_budget(
+      static_cast<size_t>(config.texture_memory_budget_mb()) * 1024 * 1024);
 
   return true;
 }
@@ -389,6 +552,7 @@ bool PieNoonGame::InitializeRenderingAssets() {
 // Create state matchines, characters, controllers, etc. present in
 // 'gamestate_'.
 bool PieNoonGame::InitializeGameState() {
+  StartupTraceScope trace("InitializeGameState");
   const Config& config = GetConfig();
 
   game_state_.set_config(&config);
@@ -400,7 +564,7 @@ bool PieNoonGame::InitializeGameState() {
   motive::MatrixInit::Register();
 
   // Load flatbuffer into buffer.
-  if (!LoadFile("character_state_machine_def.bin", &state_machine_source_)) {
+  if (!state_machine_source_.Open("character_state_machine_def.bin")) {
     SDL_LogError(SDL_LOG_CATEGORY_ERROR,
                  "Error loading character state machine.\n");
     return false;
@@ -412,6 +576,8 @@ bool PieNoonGame::InitializeGameState() {
     SDL_LogError(SDL_LOG_CATEGORY_ERROR, "State machine is invalid.\n");
     return false;
   }
+  state_machine_table_.Initialize(state_machine_def);
+  game_state_.LoadSounds(state_machine_def, &audio_engine_);
 
   for (int i = 0; i < ControlScheme::kDefinedControlSchemeCount; i++) {
     PlayerController* controller = new PlayerController();
@@ -442,13 +608,15 @@ bool PieNoonGame::InitializeGameState() {
     AiController* controller = new AiController();
     controller->Initialize(&game_state_, &config, i);
     game_state_.characters().push_back(std::unique_ptr<Character>(
-        new Character(i, controller, config, state_machine_def)));
+        new Character(i, controller, config, &state_machine_table_)));
     AddController(controller);
     controller->Initialize(&game_state_, &config, i);
   }
 
   multiplayer_director_.reset(new MultiplayerDirector());
   multiplayer_director_->Initialize(&game_state_, &config);
+  multiplayer_director_->set_recording(
+      config.multiscreen_options()->record_replays());
 #ifdef PIE_NOON_USES_GOOGLE_PLAY_GAMES
   multiplayer_director_->RegisterGPGMultiplayer(&gpg_multiplayer_);
 #else
@@ -467,6 +635,18 @@ bool PieNoonGame::InitializeGameState() {
   debug_previous_states_.resize(config.character_count(), -1);
   game_state_.RegisterMultiplayerDirector(multiplayer_director_.get());
 
+  // Simulate each frame while the last one renders, if there's a core for
+  // it.
+  if (config.pipeline_simulation() && SDL_GetCPUCount() > 1) {
+    simulate_next_frame_ = [this]() { SimulateNextFrame(); };
+    simulation_thread_.Start();
+  }
+
+  // Whichever thread updates the game joins in with the workers.
+  if (config.max_update_threads() > 0) {
+    game_state_.set_update_runner(&worker_pool_);
+  }
+
   return true;
 }
 
@@ -495,29 +675,46 @@ class AudioEngineVolumeControl {
 // debugging and readability to have each section lexographically separate.
 bool PieNoonGame::Initialize(const char* const binary_directory) {
   SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "PieNoon initializing...\n");
+  SetStartupTrace(&startup_trace_);
+  StartupTraceScope trace("Initialize");
 
   if (!ChangeToUpstreamDir(binary_directory, kAssetsDir)) return false;
 
+  // Look up assets in the packed archive, when there is one, instead of
+  // opening each file separately.
+  if (FileExists(kAssetArchiveFileName) &&
+      asset_archive_.Open(kAssetArchiveFileName)) {
+    SetAssetArchive(&asset_archive_);
+  }
+
   if (!InitializeConfig()) return false;
 #ifdef ANDROID_CARDBOARD
   if (!InitializeCardboardConfig()) return false;
 #endif
+  InitializeWorkerPool();
+
   if (!InitializeRenderer()) return false;
 
   if (!InitializeRenderingAssets()) return false;
 
   input_.Initialize();
 
-  // Some people are having trouble loading the audio engine, and it's not
-  // strictly necessary for gameplay, so don't die if the audio engine fails to
-  // initialize.
-  if (!audio_engine_.Initialize(GetConfig().audio())) {
-    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                 "Failed to initialize audio engine.\n");
-  }
+  {
+    StartupTraceScope audio_trace("InitializeAudio");
+    MemoryTagScope tag(kMemoryTagAudio);
+    // Some people are having trouble loading the audio engine, and it's not
+    // strictly necessary for gameplay, so don't die if the audio engine fails
+    // to initialize.
+    if (!audio_engine_.Initialize(GetConfig().audio())) {
+      SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                   "Failed to initialize audio engine.\n");
+    }
 
-  if (!audio_engine_.LoadSoundBank("sound_banks/sound_assets.bin")) {
-    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to load sound bank.\n");
+    StartupTraceScope bank_trace("sound_banks/sound_assets.bin", "asset");
+    if (!audio_engine_.LoadSoundBank("sound_banks/sound_assets.bin")) {
+      SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                   "Failed to load sound bank.\n");
+    }
   }
 
   input_.AddAppEventCallback(AudioEngineVolumeControl(&audio_engine_));
@@ -525,6 +722,7 @@ bool PieNoonGame::Initialize(const char* const binary_directory) {
   if (!InitializeGameState()) return false;
 
 #ifdef PIE_NOON_USES_GOOGLE_PLAY_GAMES
+  StartupTraceScope gpg_trace("InitializeGooglePlayGames");
   if (!gpg_manager.Initialize(ReadPreference("logged_in", 1, 1) != 0))
     return false;
 
@@ -557,79 +755,371 @@ bool PieNoonGame::Initialize(const char* const binary_directory) {
   return true;
 }
 
-// Returns the mesh for renderable_id, if we have one, or the pajama mesh
-// (a mesh with a texture that's obviously wrong), if we don't.
-Mesh* PieNoonGame::GetCardboardFront(int renderable_id) {
-  const bool is_valid_id = 0 <= renderable_id &&
-                           renderable_id < RenderableId_Count &&
-                           cardboard_fronts_[renderable_id] != nullptr;
-  return is_valid_id ? cardboard_fronts_[renderable_id]
-                     : cardboard_fronts_[RenderableId_Invalid];
+// Returns how to draw renderable_id, or RenderableId_Invalid if it's out of
+// range. Records of renderables without a mesh already draw the pajama mesh
+// (a mesh with a texture that's obviously wrong).
+const PieNoonGame::DrawRecord& PieNoonGame::GetDrawRecord(
+    int renderable_id) const {
+  const bool is_valid_id =
+      0 <= renderable_id && renderable_id < RenderableId_Count;
+  return draw_records_[is_valid_id ? renderable_id : RenderableId_Invalid];
 }
 
-void PieNoonGame::RenderCardboard(const SceneDescription& scene,
-                                  const mat4& camera_transform) {
+// Look up the meshes, material, shader and render queue state of every
+// renderable. Call once the meshes and shaders are loaded.
+void PieNoonGame::InitializeDrawRecords() {
   const Config& config = GetConfig();
+  draw_records_.resize(RenderableId_Count);
+  for (int id = 0; id < RenderableId_Count; ++id) {
+    auto renderable = config.renderables()->Get(id);
+    DrawRecord& record = draw_records_[id];
+    const int front_id =
+        cardboard_fronts_[id] != nullptr ? id : RenderableId_Invalid;
+    record.front = cardboard_fronts_[front_id];
+    record.front_quad = &cardboard_front_quads_[front_id * kQuadNumVertices];
+    record.back = cardboard_backs_[id];
+    record.front_material = record.front->GetMaterial(0);
+    record.front_texture = record.front_material->textures()[0];
+    record.front_shader =
+        renderable->cardboard() ? shader_cardboard : shader_textured_;
+    record.state_key =
+        render_queue_.StateKey(record.front_shader, record.front_material);
+    record.shadow = renderable->shadow();
+    record.stick = renderable->stick() && stick_front_ != nullptr &&
+                   stick_back_ != nullptr;
+    record.batchable = cardboard_fronts_[id] != nullptr &&
+                       cardboard_backs_[id] == nullptr &&
+                       !renderable->stick() && !renderable->cardboard();
+  }
+}
+
+// Find a bounding sphere for each renderable, for culling. The cardboard
+// front and back share the same outline, a few centimeters apart in z, and
+// the stick pokes out below them.
+void PieNoonGame::InitializeRenderableBounds(
+    const NormalMappedVertex* stick_quad) {
+  const Config& config = GetConfig();
+  const float back_z = config.cardboard_back_z_offset() -
+                       config.cardboard_front_z_offset();
+  for (int id = 0; id < RenderableId_Count; ++id) {
+    if (cardboard_fronts_[id] == nullptr) continue;
+    const NormalMappedVertex* front =
+        &cardboard_front_quads_[id * kQuadNumVertices];
+    vec3 min(front[0].pos);
+    vec3 max(front[0].pos);
+    auto include = [&min, &max](const vec3& p) {
+      min = vec3::Min(min, p);
+      max = vec3::Max(max, p);
+    };
+    for (int i = 0; i < kQuadNumVertices; ++i) {
+      include(vec3(front[i].pos));
+      if (cardboard_backs_[id] != nullptr) {
+        include(vec3(front[i].pos) + vec3(0.0f, 0.0f, back_z));
+      }
+      if (stick_quad != nullptr && config.renderables()->Get(id)->stick()) {
+        include(vec3(stick_quad[i].pos));
+      }
+    }
+    renderable_bounds_[id] =
+        vec4((min + max) * 0.5f, (max - min).Length() * 0.5f);
+  }
+}
 
+// Final matrix that takes world space into the clip space of one camera.
+mat4 PieNoonGame::CameraTransform(const SceneDescription& scene,
+                                  const mat4& additional_camera_changes,
+                                  const vec2i& resolution) const {
+  const RuntimeConfig& config = game_state_.runtime_config();
+
+  // Final matrix that applies the view frustum to bring into screen space.
+  mat4 perspective_matrix_ = mat4::Perspective(
+      config.view().viewport_angle,
+      resolution.x() / static_cast<float>(resolution.y()),
+      config.viewport_near_plane(), config.viewport_far_plane(), -1.0f);
+
+  return perspective_matrix_ * (additional_camera_changes * scene.camera());
+}
+
+// True if any of the 'frustums' may see some part of 'renderable'.
+bool PieNoonGame::RenderableVisible(
+    const Renderable& renderable, const std::vector<Frustum>& frustums) const {
+  const int id = renderable.id();
+  if (id < 0 || id >= RenderableId_Count) return true;
+  const vec4 bounds(renderable_bounds_[id]);
+  const mat4& world = renderable.world_matrix();
+  const vec3 center = world * bounds.xyz();
+  // Particles and props may be scaled, so grow the sphere by the largest
+  // axis scale.
+  const float scale =
+      std::max(std::max(vec3(world(0, 0), world(1, 0), world(2, 0)).Length(),
+                        vec3(world(0, 1), world(1, 1), world(2, 1)).Length()),
+               vec3(world(0, 2), world(1, 2), world(2, 2)).Length());
+  const float radius = bounds.w() * scale;
+  for (auto it = frustums.begin(); it != frustums.end(); ++it) {
+    if (it->IntersectsSphere(center, radius)) return true;
+  }
+  return false;
+}
+
+// Sort the scene's renderables by shader, material and depth, so that
+// RenderCardboard() can skip state changes between similar draws.
+// Renderables that none of the 'views' can see are left out.
+void PieNoonGame::BuildRenderQueue(const SceneDescription& scene,
+                                   const SceneViews& views) {
+  const RuntimeConfig& config = game_state_.runtime_config();
+  const vec3& camera_position = scene.camera_position();
+
+  std::vector<Frustum> frustums;
+  if (config.frustum_culling()) {
+    for (int i = 0; i < views.count; ++i) {
+      frustums.push_back(Frustum(views.camera_transforms[i]));
+    }
+  }
+
+  render_queue_.Clear();
+  num_culled_renderables_ = 0;
   for (size_t i = 0; i < scene.renderables().size(); ++i) {
     const auto& renderable = scene.renderables()[i];
-    const int id = renderable->id();
+    if (!frustums.empty() && !RenderableVisible(renderable, frustums)) {
+      num_culled_renderables_++;
+      continue;
+    }
+    const float depth =
+        (renderable.world_matrix().TranslationVector3D() - camera_position)
+            .Length();
+    render_queue_.Add(GetDrawRecord(renderable.id()).state_key, depth,
+                      static_cast<uint32_t>(i));
+  }
+  render_queue_.Sort();
+  num_submitted_renderables_ =
+      static_cast<int>(render_queue_.entries().size());
+}
 
-    // Set up vertex transformation into projection space.
-    const mat4 mvp = camera_transform * renderable->world_matrix();
-    renderer_.model_view_projection() = mvp;
+// Point the renderer at one of the 'views': its part of the screen, and its
+// camera as the model_view_projection.
+void PieNoonGame::SetView(const SceneViews& views, int view) {
+  if (views.count > 1) {
+    const vec4i& viewport = views.viewports[view];
+    GL_CALL(glViewport(viewport.x(), viewport.y(), viewport.z(), viewport.w()));
+  }
+  renderer_.model_view_projection() = views.camera_transforms[view];
+}
+
+void PieNoonGame::RenderCardboard(const SceneDescription& scene,
+                                  const SceneViews& views) {
+  const RuntimeConfig& config = game_state_.runtime_config();
+
+  // The cardboard material properties are the same for every renderable,
+  // and uniforms stick to their program, so set them once up front.
+  shader_cardboard->Set(renderer_);
+  shader_cardboard->SetUniform("ambient_material",
+                               config.cardboard_ambient_material());
+  shader_cardboard->SetUniform("diffuse_material",
+                               config.cardboard_diffuse_material());
+  shader_cardboard->SetUniform("specular_material",
+                               config.cardboard_specular_material());
+  shader_cardboard->SetUniform("shininess", config.cardboard_shininess());
+  shader_cardboard->SetUniform("normalmap_scale",
+                               config.cardboard_normalmap_scale());
+
+  // The material whose textures and blend mode are currently bound, if we
+  // know it. Consecutive fronts that share a material skip the rebind.
+  const Material* bound_material = nullptr;
+
+  const auto& entries = render_queue_.entries();
+  for (auto it = entries.begin(); it != entries.end(); ++it) {
+    const auto& renderable = scene.renderables()[it->index];
+    const int id = renderable.id();
+    const DrawRecord& record = GetDrawRecord(id);
+
+    // Simple billboards are collected, and drawn together when the run of
+    // them ends. This preserves the render queue order.
+    if (CanBatchRenderable(id)) {
+      Mesh* front = record.front;
+      if (billboard_batch_.mesh() != front || billboard_batch_.full()) {
+        const Material* batch_material = RenderBillboardBatch(views);
+        if (batch_material) bound_material = batch_material;
+      }
+      if (billboard_batch_.size() == 0) {
+        billboard_batch_.Begin(front,
+                               &cardboard_front_quads_[id * kQuadNumVertices],
+                               kQuadIndices);
+      }
+      billboard_batch_.Add(renderable.world_matrix(), renderable.color());
+      continue;
+    }
+    const Material* batch_material = RenderBillboardBatch(views);
+    if (batch_material) bound_material = batch_material;
 
     // Set the camera and light positions in object space.
-    const mat4 world_matrix_inverse = renderable->world_matrix().Inverse();
+    const mat4 world_matrix_inverse = renderable.world_matrix().Inverse();
     renderer_.camera_pos() =
-        world_matrix_inverse * game_state_.camera().Position();
+        world_matrix_inverse * scene.camera_position();
 
     // TODO: check amount of lights.
-    renderer_.light_pos() = world_matrix_inverse * (*scene.lights()[0]);
-
-    // The popsicle stick and cardboard back are always uncolored.
-    renderer_.color() = mathfu::kOnes4f;
-
-    // Note: Draw order is back-to-front, so draw the cardboard back, then
-    // popsicle stick, then cardboard front--in that order.
-    //
-    // If we have a back, draw the back too, slightly offset.
-    // The back is the *inside* of the cardboard, representing corrugation.
-    if (cardboard_backs_[id]) {
-      shader_cardboard->Set(renderer_);
-      cardboard_backs_[id]->Render(renderer_);
-    }
-
-    // Draw the popsicle stick that props up the cardboard.
-    if (config.renderables()->Get(id)->stick() && stick_front_ != nullptr &&
-        stick_back_ != nullptr) {
-      shader_textured_->Set(renderer_);
-      stick_front_->Render(renderer_);
-      stick_back_->Render(renderer_);
-    }
-
-    renderer_.color() = renderable->color();
-
-    if (config.renderables()->Get(id)->cardboard()) {
-      shader_cardboard->Set(renderer_);
-      shader_cardboard->SetUniform(
-          "ambient_material", LoadVec3(config.cardboard_ambient_material()));
-      shader_cardboard->SetUniform(
-          "diffuse_material", LoadVec3(config.cardboard_diffuse_material()));
-      shader_cardboard->SetUniform(
-          "specular_material", LoadVec3(config.cardboard_specular_material()));
-      shader_cardboard->SetUniform("shininess", config.cardboard_shininess());
-      shader_cardboard->SetUniform("normalmap_scale",
-                                   config.cardboard_normalmap_scale());
+    renderer_.light_pos() = world_matrix_inverse * scene.lights()[0];
+
+    Mesh* front = record.front;
+    const Material* front_material = record.front_material;
+
+    for (int view = 0; view < views.count; ++view) {
+      // Set up vertex transformation into projection space.
+      SetView(views, view);
+      renderer_.model_view_projection() =
+          views.camera_transforms[view] * renderable.world_matrix();
+
+      // The popsicle stick and cardboard back are always uncolored.
+      renderer_.color() = mathfu::kOnes4f;
+
+      // Note: Draw order is back-to-front, so draw the cardboard back, then
+      // popsicle stick, then cardboard front--in that order.
+      //
+      // If we have a back, draw the back too, slightly offset.
+      // The back is the *inside* of the cardboard, representing corrugation.
+      if (record.back) {
+        shader_cardboard->Set(renderer_);
+        record.back->Render(renderer_);
+        bound_material = nullptr;
+      }
+
+      // Draw the popsicle stick that props up the cardboard.
+      if (record.stick) {
+        shader_textured_->Set(renderer_);
+        stick_front_->Render(renderer_);
+        stick_back_->Render(renderer_);
+        bound_material = nullptr;
+      }
+
+      renderer_.color() = renderable.color();
+      record.front_shader->Set(renderer_);
+      front->Render(renderer_, front_material == bound_material);
+      bound_material = front_material;
+    }
+  }
+  RenderBillboardBatch(views);
+}
+
+// Renderables that are just a textured quad--no back, stick, or lighting--
+// can be drawn many at a time with the instanced shader.
+bool PieNoonGame::CanBatchRenderable(int renderable_id) const {
+  return 0 <= renderable_id && renderable_id < RenderableId_Count &&
+         draw_records_[renderable_id].batchable;
+}
+
+// Draw the shadows in the shadow batch into every view, with 'texture', the
+// billboard's, giving their shape. Then empty it.
+void PieNoonGame::RenderShadowBatch(const SceneViews& views,
+                                    const Texture* texture) {
+  if (shadow_batch_.size() == 0) return;
+  texture->Set(0);
+  for (int view = 0; view < views.count; ++view) {
+    SetView(views, view);
+    shader_simple_shadow_instanced_->Set(renderer_);
+    shadow_batch_.Render(renderer_, true);
+  }
+  shadow_batch_.Clear();
+}
+
+// Draw the billboard batch into every view, then empty it. Returns the
+// material that was bound, or nullptr if the batch was empty.
+const Material* PieNoonGame::RenderBillboardBatch(const SceneViews& views) {
+  Mesh* mesh = billboard_batch_.mesh();
+  if (mesh == nullptr) return nullptr;
+
+  for (int view = 0; view < views.count; ++view) {
+    SetView(views, view);
+    shader_textured_instanced_->Set(renderer_);
+    billboard_batch_.Render(renderer_);
+  }
+  billboard_batch_.Clear();
+  return mesh->GetMaterial(0);
+}
+
+// If 'def' asks to be simulated on the GPU, generate its particles, and let
+// the game spawn it in bursts. Its renderables must all be billboards that
+// can be drawn with one material; if not, it stays on the CPU.
+void PieNoonGame::InitializeGpuParticlePool(const ParticleDef* def) {
+  if (def == nullptr || !def->gpu_simulated()) return;
+
+  Material* material = nullptr;
+  bool valid = def->gpu_pool_size() > 0 && def->renderable()->size() > 0;
+  for (size_t i = 0; valid && i < def->renderable()->size(); ++i) {
+    const int id = def->renderable()->Get(i);
+    valid = CanBatchRenderable(id);
+    if (!valid) break;
+    Material* front_material = cardboard_fronts_[id]->GetMaterial(0);
+    if (material == nullptr) {
+      material = front_material;
     } else {
-      shader_textured_->Set(renderer_);
+      valid = front_material->textures()[0] == material->textures()[0] &&
+              front_material->blend_mode() == material->blend_mode();
+    }
+  }
+  if (!valid) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                 "Particles can't be simulated on the GPU unless their "
+                 "renderables are billboards sharing a texture.\n");
+    return;
+  }
+
+  std::unique_ptr<GpuParticlePool> pool(new GpuParticlePool());
+  pool->Initialize(*def, &cardboard_front_quads_[0], material);
+  gpu_particle_pools_[def] = std::move(pool);
+  game_state_.particle_manager().EnableBursts(def);
+}
+
+// Make the GL objects again, after the context they were made in has been
+// lost. Textures come back as they're drawn, so the current screen first.
+void PieNoonGame::RestoreAfterContextLoss() {
+  matman_.RestoreAfterContextLoss();
+  for (size_t i = 0; i < cardboard_fronts_.size(); ++i) {
+    if (cardboard_fronts_[i]) cardboard_fronts_[i]->RestoreBuffers();
+    if (cardboard_backs_[i]) cardboard_backs_[i]->RestoreBuffers();
+  }
+  if (stick_front_) stick_front_->RestoreBuffers();
+  if (stick_back_) stick_back_->RestoreBuffers();
+  billboard_batch_.ForgetBuffers();
+  shadow_batch_.ForgetBuffers();
+  // The pools are generated again, which is quicker than keeping a copy of
+  // every particle.
+  std::vector<const ParticleDef*> defs;
+  for (auto pool = gpu_particle_pools_.begin();
+       pool != gpu_particle_pools_.end(); ++pool) {
+    pool->second->ForgetBuffers();
+    defs.push_back(pool->first);
+  }
+  for (size_t i = 0; i < defs.size(); ++i) InitializeGpuParticlePool(defs[i]);
+}
+
+// Draw the bursts of particles that are simulated on the GPU. They aren't in
+// the render queue, so they're drawn after the rest of the scene.
+void PieNoonGame::RenderParticleBursts(const SceneDescription& scene,
+                                       const SceneViews& views) {
+  const auto& bursts = scene.particle_bursts();
+  if (bursts.empty()) return;
+
+  for (auto pool = gpu_particle_pools_.begin();
+       pool != gpu_particle_pools_.end(); ++pool) {
+    bool bound = false;
+    for (auto it = bursts.begin(); it != bursts.end(); ++it) {
+      if (it->def != pool->first) continue;
+      if (!bound) {
+        pool->second->Bind(renderer_);
+        bound = true;
+      }
+      for (int view = 0; view < views.count; ++view) {
+        SetView(views, view);
+        pool->second->Render(renderer_, shader_gpu_particles_, *it);
+      }
     }
-    Mesh* front = GetCardboardFront(id);
-    front->Render(renderer_);
+    if (bound) pool->second->Unbind();
   }
+  renderer_.color() = mathfu::kOnes4f;
 }
 
 void PieNoonGame::Render(const SceneDescription& scene) {
+  FPL_PROFILE_SCOPE("Render");
+  frame_input_time_ = scene.input_time();
   if (game_state_.is_in_cardboard()) {
     RenderForCardboard(scene);
   } else {
@@ -638,35 +1128,69 @@ void PieNoonGame::Render(const SceneDescription& scene) {
 }
 
 void PieNoonGame::RenderForDefault(const SceneDescription& scene) {
-  RenderScene(scene, mat4::Identity(), renderer_.window_size());
+  SceneViews views;
+  views.count = 1;
+  views.camera_transforms[0] =
+      CameraTransform(scene, mat4::Identity(), renderer_.window_size());
+  BuildRenderQueue(scene, views);
+  RenderScene(scene, views);
 }
 
 void PieNoonGame::RenderForCardboard(const SceneDescription& scene) {
 #ifdef ANDROID_CARDBOARD
+  // The scene was simulated from input read at the top of the frame, but the
+  // head has moved since; read where to, for the camera.
+  if (GetConfig().late_input_latch()) {
+    input_.cardboard_input().UpdateCardboardTransforms();
+  }
+  frame_head_pose_time_ = input_.cardboard_input().transforms_time();
   mat4 left_eye_transform, right_eye_transform;
   GetCardboardTransforms(left_eye_transform, right_eye_transform);
   // Convert the transforms from cardboard space to game space
   CorrectCardboardCamera(left_eye_transform);
   CorrectCardboardCamera(right_eye_transform);
-  // Perform two render passes, one for each half of the screen
+  cardboard_drawn_view_ = left_eye_transform;
+  // Render one view for each half of the screen
   vec2i size = AndroidGetScalerResolution();
-  const vec2i viewport_size =
+  const vec2i screen_size =
       size.x() && size.y() ? size : renderer_.window_size();
+  // The undistortion framebuffer may be smaller than the screen, if frames
+  // have been slow.
+  const vec2i viewport_size = game_state_.use_undistort_rendering()
+                                  ? renderer_.undistort_framebuffer_size()
+                                  : screen_size;
   float window_width = viewport_size.x();
   float half_width = window_width / 2.0f;
   float window_height = viewport_size.y();
   auto res = renderer_.window_size();
   vec2i half_res(res.x() / 2.0f, res.y());
+  const float tan_half_fov_y =
+      tanf(game_state_.runtime_config().view().viewport_angle * 0.5f);
+  cardboard_tan_half_fov_ = vec2(
+      tan_half_fov_y * half_res.x() / static_cast<float>(half_res.y()),
+      tan_half_fov_y);
+  // Both eyes are drawn in a single pass over the render queue, so it holds
+  // everything either eye can see.
+  SceneViews views;
+  views.count = 2;
+  views.camera_transforms[0] =
+      CameraTransform(scene, left_eye_transform, half_res);
+  views.camera_transforms[1] =
+      CameraTransform(scene, right_eye_transform, half_res);
+  views.viewports[0] = vec4i(0, 0, static_cast<int>(half_width),
+                             static_cast<int>(window_height));
+  views.viewports[1] =
+      vec4i(static_cast<int>(half_width), 0, static_cast<int>(half_width),
+            static_cast<int>(window_height));
+  BuildRenderQueue(scene, views);
   if (game_state_.use_undistort_rendering()) {
     renderer_.BeginUndistortFramebuffer();
   }
-  GL_CALL(glViewport(0, 0, half_width, window_height));
-  RenderScene(scene, left_eye_transform, half_res);
-  GL_CALL(glViewport(half_width, 0, half_width, window_height));
-  RenderScene(scene, right_eye_transform, half_res);
+  RenderScene(scene, views);
   // Reset the viewport to the entire screen
-  GL_CALL(glViewport(0, 0, window_width, window_height));
+  GL_CALL(glViewport(0, 0, screen_size.x(), screen_size.y()));
   if (game_state_.use_undistort_rendering()) {
+    if (shader_reproject_) ReprojectCardboardFrame();
     renderer_.FinishUndistortFramebuffer();
   }
   RenderCardboardCenteringBar();
@@ -676,73 +1200,89 @@ void PieNoonGame::RenderForCardboard(const SceneDescription& scene) {
 }
 
 void PieNoonGame::RenderScene(const SceneDescription& scene,
-                              const mat4& additional_camera_changes,
-                              const vec2i& resolution) {
-  const Config& config = GetConfig();
-  const Config& cardboard_config = GetCardboardConfig();
-
-  float viewport_angle = game_state_.is_in_cardboard()
-                             ? cardboard_config.viewport_angle()
-                             : config.viewport_angle();
-  // Final matrix that applies the view frustum to bring into screen space.
-  mat4 perspective_matrix_ = mat4::Perspective(
-      viewport_angle, resolution.x() / static_cast<float>(resolution.y()),
-      config.viewport_near_plane(), config.viewport_far_plane(), -1.0f);
-
-  const mat4 camera_transform =
-      perspective_matrix_ * (additional_camera_changes * scene.camera());
+                              const SceneViews& views) {
+  FPL_PROFILE_SCOPE("RenderScene");
+  const RuntimeConfig& config = game_state_.runtime_config();
 
   // Render a ground plane.
   // TODO: Replace with a regular environment prop. Calculate scale_bias from
   // environment prop size.
-  renderer_.model_view_projection() = camera_transform;
   renderer_.color() = mathfu::kOnes4f;
-  shader_textured_->Set(renderer_);
-  auto ground_mat = matman_.LoadMaterial("materials/floor.bin");
-  assert(ground_mat);
-  ground_mat->Set(renderer_);
-  const float ground_width = game_state_.is_in_cardboard()
-                                 ? cardboard_config.ground_plane_width()
-                                 : config.ground_plane_width();
-  const float ground_depth = game_state_.is_in_cardboard()
-                                 ? cardboard_config.ground_plane_depth()
-                                 : config.ground_plane_depth();
-  Mesh::RenderAAQuadAlongX(vec3(-ground_width, 0, 0),
-                           vec3(ground_width, 0, ground_depth), vec2(0, 0),
-                           vec2(1.0f, 1.0f));
+  ground_mat_->Set(renderer_);
+  const float ground_width = config.view().ground_plane_width;
+  const float ground_depth = config.view().ground_plane_depth;
+  for (int view = 0; view < views.count; ++view) {
+    SetView(views, view);
+    shader_textured_->Set(renderer_);
+    Mesh::RenderAAQuadAlongX(vec3(-ground_width, 0, 0),
+                             vec3(ground_width, 0, ground_depth), vec2(0, 0),
+                             vec2(1.0f, 1.0f));
+  }
   const vec4 world_scale_bias(1.0f / (2.0f * ground_width), 1.0f / ground_depth,
                               0.5f, 0.0f);
 
   // Render shadows for all Renderables first, with depth testing off so
-  // they blend properly.
+  // they blend properly. Every shadow is the same color, so the order they
+  // blend in doesn't matter, and casters that share a front mesh are drawn
+  // in one batch.
+  renderer_.BeginGpuTimer("Shadows");
   renderer_.DepthTest(false);
-  renderer_.model_view_projection() = camera_transform;
-  renderer_.light_pos() = *scene.lights()[0];  // TODO: check amount of lights.
-  shader_simple_shadow_->SetUniform("world_scale_bias", world_scale_bias);
+  renderer_.light_pos() = scene.lights()[0];  // TODO: check amount of lights.
+  shader_simple_shadow_instanced_->SetUniform("world_scale_bias",
+                                              world_scale_bias);
+  // The first texture of the shadow shader has to be that of the billboard,
+  // so bind the shadow material's other textures once, and the billboard's
+  // own texture per batch, in its place.
+  renderer_.SetBlendMode(static_cast<BlendMode>(shadow_mat_->blend_mode()));
+  const auto& shadow_textures = shadow_mat_->textures();
+  for (size_t t = 1; t < shadow_textures.size(); ++t) {
+    shadow_textures[t]->Set(t);
+  }
+  shadow_casters_.clear();
   for (size_t i = 0; i < scene.renderables().size(); ++i) {
-    const auto& renderable = scene.renderables()[i];
-    const int id = renderable->id();
-    Mesh* front = GetCardboardFront(id);
-    if (config.renderables()->Get(id)->shadow()) {
-      renderer_.model() = renderable->world_matrix();
-      shader_simple_shadow_->Set(renderer_);
-      // The first texture of the shadow shader has to be that of the
-      // billboard.
-      shadow_mat_->textures()[0] = front->GetMaterial(0)->textures()[0];
-      shadow_mat_->Set(renderer_);
-      front->Render(renderer_, true);
+    if (render_shadows_ && GetDrawRecord(scene.renderables()[i].id()).shadow) {
+      shadow_casters_.push_back(static_cast<uint32_t>(i));
     }
   }
+  std::sort(shadow_casters_.begin(), shadow_casters_.end(),
+            [this, &scene](uint32_t a, uint32_t b) {
+              return GetDrawRecord(scene.renderables()[a].id()).front <
+                     GetDrawRecord(scene.renderables()[b].id()).front;
+            });
+  const Texture* batch_texture = nullptr;
+  for (auto it = shadow_casters_.begin(); it != shadow_casters_.end(); ++it) {
+    const auto& renderable = scene.renderables()[*it];
+    const DrawRecord& record = GetDrawRecord(renderable.id());
+    if (shadow_batch_.mesh() != record.front || shadow_batch_.full()) {
+      RenderShadowBatch(views, batch_texture);
+      shadow_batch_.Begin(record.front, record.front_quad, kQuadIndices);
+      batch_texture = record.front_texture;
+    }
+    shadow_batch_.Add(renderable.world_matrix(), mathfu::kOnes4f);
+  }
+  RenderShadowBatch(views, batch_texture);
   renderer_.DepthTest(true);
+  renderer_.EndGpuTimer();
 
   // Now render the Renderables normally, on top of the shadows.
-  RenderCardboard(scene, camera_transform);
+  renderer_.BeginGpuTimer("Cardboard");
+  RenderCardboard(scene, views);
+  renderer_.EndGpuTimer();
+  renderer_.BeginGpuTimer("Particles");
+  RenderParticleBursts(scene, views);
+  renderer_.EndGpuTimer();
 
   // Render any UI/HUD/Splash on top
-  Render2DElements();
+  renderer_.BeginGpuTimer("HUD");
+  for (int view = 0; view < views.count; ++view) {
+    SetView(views, view);
+    Render2DElements();
+  }
+  renderer_.EndGpuTimer();
 }
 
 void PieNoonGame::Render2DElements() {
+  FPL_PROFILE_SCOPE("Render2DElements");
   // Set up an ortho camera for all 2D elements, with (0, 0) in the top left,
   // and the bottom right the windows size in pixels.
   auto res = renderer_.window_size();
@@ -793,6 +1333,50 @@ void PieNoonGame::CorrectCardboardCamera(mat4& cardboard_camera) {
   cardboard_camera = rotation * cardboard_camera * rotation;
 }
 
+// Warp the Cardboard frame from the head pose it was drawn with to the
+// latest one, for the next time it's undistorted.
+void PieNoonGame::ReprojectCardboardFrame() {
+#ifdef ANDROID_CARDBOARD
+  input_.cardboard_input().UpdateCardboardTransforms();
+  frame_head_pose_time_ = input_.cardboard_input().transforms_time();
+  mat4 left_eye_transform, right_eye_transform;
+  GetCardboardTransforms(left_eye_transform, right_eye_transform);
+  CorrectCardboardCamera(left_eye_transform);
+  // The drawn rotation times the inverse of the latest one takes a ray seen
+  // now to where it was drawn. Both eyes turn with the head, so the left
+  // eye's turn does for both.
+  mat4 rotation = mat4::Identity();
+  for (int row = 0; row < 3; ++row) {
+    for (int col = 0; col < 3; ++col) {
+      float sum = 0.0f;
+      for (int i = 0; i < 3; ++i) {
+        sum += cardboard_drawn_view_(row, i) * left_eye_transform(col, i);
+      }
+      rotation(row, col) = sum;
+    }
+  }
+  renderer_.SetUndistortReprojection(rotation, cardboard_tan_half_fov_);
+#endif  // ANDROID_CARDBOARD
+}
+
+// While the simulation of the next frame runs long, show the Cardboard frame
+// just drawn, rather than holding the one before on screen, and then keep
+// showing it, warped to the latest head pose, until the next one can be drawn.
+void PieNoonGame::ReprojectWhileSimulating() {
+#ifdef ANDROID_CARDBOARD
+  const uint32_t interval = GetConfig().reprojection_interval();
+  if (simulation_thread_.WaitTimeout(interval)) return;
+  FPL_PROFILE_SCOPE("Reproject");
+  renderer_.Present();
+  while (!simulation_thread_.WaitTimeout(interval)) {
+    ReprojectCardboardFrame();
+    renderer_.ReprojectUndistortFramebuffer();
+    RenderCardboardCenteringBar();
+    renderer_.Present();
+  }
+#endif  // ANDROID_CARDBOARD
+}
+
 void PieNoonGame::RenderCardboardCenteringBar() {
   auto res = renderer_.window_size();
   auto ortho_mat = mathfu::OrthoHelper<float>(0.0f, static_cast<float>(res.x()),
@@ -802,8 +1386,10 @@ void PieNoonGame::RenderCardboardCenteringBar() {
 
   const Config& config = GetConfig();
   renderer_.color() = LoadVec4(config.cardboard_center_color());
-  auto material =
-      matman_.LoadMaterial(config.cardboard_center_material()->c_str());
+  // Only load the material the first time, since every load adds a reference.
+  const char* material_name = config.cardboard_center_material()->c_str();
+  Material* material = matman_.FindMaterial(material_name);
+  if (!material) material = matman_.LoadMaterial(material_name);
   material->Set(renderer_);
   shader_textured_->Set(renderer_);
 
@@ -829,25 +1415,368 @@ void PieNoonGame::DebugPrintCharacterStates() {
   }
 }
 
+// Debug function to print out how much the render queue culled, whenever it
+// changes.
+void PieNoonGame::DebugPrintCullingStats() {
+  static int previous_culled = -1;
+  static int previous_submitted = -1;
+  if (num_culled_renderables_ == previous_culled &&
+      num_submitted_renderables_ == previous_submitted)
+    return;
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+              "Renderables: %d submitted, %d culled\n",
+              num_submitted_renderables_, num_culled_renderables_);
+  previous_culled = num_culled_renderables_;
+  previous_submitted = num_submitted_renderables_;
+}
+
+// Note how long the input and head pose shown by the frame just presented
+// took to reach the screen. Doesn't include any buffering in the driver or
+// display after the swap.
+void PieNoonGame::MeasureInputLatency() {
+  const uint32_t now = SDL_GetTicks();
+  if (frame_input_time_ != 0) input_latency_.Add(now - frame_input_time_);
+  if (frame_head_pose_time_ != 0) {
+    head_pose_latency_.Add(now - frame_head_pose_time_);
+  }
+  frame_input_time_ = 0;
+  frame_head_pose_time_ = 0;
+}
+
+// Debug function to print out the average and worst input latency about once
+// a second, when there's been any input.
+void PieNoonGame::DebugPrintInputLatency() {
+  static uint32_t next_print_time = 0;
+  const uint32_t now = SDL_GetTicks();
+  if (now < next_print_time) return;
+  next_print_time = now + kMillisecondsPerSecond;
+  if (input_latency_.count > 0) {
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Input latency: %d ms average, %d ms worst, %d inputs\n",
+                static_cast<int>(input_latency_.total / input_latency_.count),
+                static_cast<int>(input_latency_.max),
+                static_cast<int>(input_latency_.count));
+  }
+  if (head_pose_latency_.count > 0) {
+    SDL_LogInfo(
+        SDL_LOG_CATEGORY_APPLICATION,
+        "Head pose latency: %d ms average, %d ms worst\n",
+        static_cast<int>(head_pose_latency_.total / head_pose_latency_.count),
+        static_cast<int>(head_pose_latency_.max));
+  }
+  input_latency_ = LatencyStats();
+  head_pose_latency_ = LatencyStats();
+}
+
+// Debug function to print out how many scene object matrices were
+// recalculated, and how many were left alone, whenever it changes.
+void PieNoonGame::DebugPrintTransformStats() {
+  static int previous_updated = -1;
+  static int previous_skipped = -1;
+  const SceneObjectComponent& scene_objects =
+      game_state_.sceneobject_component();
+  if (scene_objects.matrices_updated() == previous_updated &&
+      scene_objects.matrices_skipped() == previous_skipped)
+    return;
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+              "Scene object matrices: %d updated, %d skipped\n",
+              scene_objects.matrices_updated(),
+              scene_objects.matrices_skipped());
+  previous_updated = scene_objects.matrices_updated();
+  previous_skipped = scene_objects.matrices_skipped();
+}
+
+// Print live particles per effect, whenever the particle budget throttles
+// another spawn.
+void PieNoonGame::DebugPrintParticleStats() {
+  static int previous_throttled_spawns = 0;
+  const ParticleManager& particles = game_state_.particle_manager();
+  const ParticleBudget& budget = particles.budget();
+  if (budget.throttled_spawns() == previous_throttled_spawns) return;
+  previous_throttled_spawns = budget.throttled_spawns();
+
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+              "Particles: emission %.2f, %d throttled frames, %d throttled "
+              "spawns, %d dropped\n",
+              budget.emission_scale(), budget.throttled_frames(),
+              budget.throttled_spawns(), budget.dropped_particles());
+  const Config& config = GetConfig();
+  const auto& effects = particles.effect_stats();
+  for (auto it = effects.begin(); it != effects.end(); ++it) {
+    const char* name =
+        it->def == config.pie_splatter_def()
+            ? "pie_splatter_def"
+            : it->def == config.confetti_def()
+                  ? "confetti_def"
+                  : it->def == config.joining_confetti_def()
+                        ? "joining_confetti_def"
+                        : "unknown";
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "  %s: %d live, %d throttled spawns, %d dropped\n", name,
+                it->live_particles, it->throttled_spawns,
+                it->dropped_particles);
+  }
+}
+
+// Gather what the performance HUD shows, and draw it over everything else.
+void PieNoonGame::RenderPerfHud() {
+  PerfHud::Stats& stats = perf_hud_.stats();
+  stats.renderables_submitted = num_submitted_renderables_;
+  stats.renderables_culled = num_culled_renderables_;
+  stats.render = Renderer::last_frame_stats();
+  stats.live_particles = 0;
+  const auto& effects = game_state_.particle_manager().effect_stats();
+  for (auto it = effects.begin(); it != effects.end(); ++it) {
+    stats.live_particles += it->live_particles;
+  }
+  game_state_.GetComponentCounts(&stats.components);
+  stats.load_queue_depth = matman_.LoadQueueDepth();
+#ifdef PIE_NOON_USES_GOOGLE_PLAY_GAMES
+  gpg_multiplayer_.GetTotalBytes(&stats.network_bytes_sent,
+                                 &stats.network_bytes_received);
+#endif
+  perf_hud_.Render(matman_, input_,
+                   *full_screen_fader_.material()->textures()[0]);
+}
+
+// Print when each texture was loaded, relative to the first one queued, so
+// the critical path of startup can be seen.
+void PieNoonGame::DebugPrintLoadTimings() {
+  const std::vector<AsyncLoadTiming>& timings = matman_.load_timings();
+  if (timings.empty()) return;
+  int start = timings[0].queued;
+  int load_time = 0;
+  for (auto it = timings.begin(); it != timings.end(); ++it) {
+    start = std::min(start, it->queued);
+    load_time += it->load_end - it->load_start;
+  }
+  int end = start;
+  for (auto it = timings.begin(); it != timings.end(); ++it) {
+    end = std::max(end, it->finalized);
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Load %s: priority %d, thread %d, queued %d, loaded %d-%d, "
+                "finalized %d\n",
+                it->filename.c_str(), it->priority, it->thread,
+                it->queued - start, it->load_start - start,
+                it->load_end - start, it->finalized - start);
+  }
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+              "Loaded %d textures in %dms, %dms spent in Load()\n",
+              static_cast<int>(timings.size()), end - start, load_time);
+}
+
+// Close the startup trace, and write it out if the config asks for it.
+// Anything loaded after this isn't part of startup, so isn't recorded.
+void PieNoonGame::FinishStartupTrace() {
+  if (!GetStartupTrace()) return;
+  startup_trace_.End();
+  SetStartupTrace(nullptr);
+  if (!GetConfig().write_startup_trace()) return;
+
+  startup_trace_.AddLoadTimings(matman_.load_timings());
+  char* pref_path = SDL_GetPrefPath("Google", "PieNoon");
+  const std::string filename =
+      std::string(pref_path ? pref_path : "") + kStartupTraceFileName;
+  SDL_free(pref_path);
+  if (startup_trace_.Write(filename.c_str())) {
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Wrote startup trace to %s\n",
+                filename.c_str());
+  } else {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                 "Couldn't write startup trace to %s\n", filename.c_str());
+  }
+}
+
+// Count down the frames left to profile, and write out the profile once the
+// last of them is done.
+void PieNoonGame::AdvanceFrameTrace() {
+  if (frame_trace_frames_left_ <= 0 || --frame_trace_frames_left_ > 0) return;
+  FrameProfiler::SetEnabled(false);
+  char* pref_path = SDL_GetPrefPath("Google", "PieNoon");
+  const std::string filename =
+      std::string(pref_path ? pref_path : "") + kFrameTraceFileName;
+  SDL_free(pref_path);
+  if (FrameProfiler::Write(filename.c_str())) {
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Wrote frame trace to %s\n",
+                filename.c_str());
+  } else {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                 "Couldn't write frame trace to %s\n", filename.c_str());
+  }
+  // The hitch detector needs the profiler to keep recording.
+  FrameProfiler::SetEnabled(hitch_detector_.enabled());
+}
+
+// Time the frame that just finished, and if it hitched, write out what led
+// up to it.
+void PieNoonGame::CheckForHitch() {
+  if (!hitch_detector_.enabled()) return;
+  HitchDetector::Counters counters;
+  counters.state = state_;
+  counters.allocations = MemoryAccounting::AllocationCount();
+  counters.allocated_bytes = MemoryAccounting::AllocatedBytes();
+  counters.load_queue_depth = matman_.LoadQueueDepth();
+  counters.loads_finalized = static_cast<int>(matman_.load_timings().size());
+  const GlyphCacheStats& glyphs = perf_hud_.glyph_cache_stats();
+  counters.glyph_lookups = glyphs.lookups;
+  counters.glyph_hits = glyphs.hits;
+  if (!hitch_detector_.EndFrame(FrameProfiler::Now(), counters)) return;
+
+  char name[32];
+  snprintf(name, sizeof(name), kHitchFileNameFormat,
+           hitch_detector_.captures());
+  char* pref_path = SDL_GetPrefPath("Google", "PieNoon");
+  const std::string filename = std::string(pref_path ? pref_path : "") + name;
+  SDL_free(pref_path);
+  FrameProfiler::SetEnabled(false);
+  if (hitch_detector_.Write(filename.c_str())) {
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Wrote hitch trace to %s\n",
+                filename.c_str());
+  } else {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                 "Couldn't write hitch trace to %s\n", filename.c_str());
+  }
+  FrameProfiler::SetEnabled(true);
+  // Writing the trace isn't part of the next frame.
+  hitch_detector_.RestartFrame(FrameProfiler::Now());
+}
+
+// Read how hot the device is, from its battery. Low battery counts as warm.
+ThermalState PieNoonGame::ReadThermalState() {
+#ifdef __ANDROID__
+  const Config& config = GetConfig();
+  JNIEnv* env = reinterpret_cast<JNIEnv*>(SDL_AndroidGetJNIEnv());
+  jobject activity = reinterpret_cast<jobject>(SDL_AndroidGetActivity());
+  jclass fpl_class = env->GetObjectClass(activity);
+  jmethodID get_temperature =
+      env->GetMethodID(fpl_class, "GetBatteryTemperature", "()I");
+  jmethodID is_battery_low = env->GetMethodID(fpl_class, "IsBatteryLow", "()Z");
+  const int tenths = env->CallIntMethod(activity, get_temperature);
+  const bool battery_low = env->CallBooleanMethod(activity, is_battery_low);
+  env->DeleteLocalRef(fpl_class);
+  env->DeleteLocalRef(activity);
+  if (tenths < 0) return battery_low ? kThermalWarm : kThermalUnknown;
+  const float temperature = tenths / 10.0f;
+  if (temperature >= config.quality_hot_temperature()) return kThermalHot;
+  if (temperature >= config.quality_warm_temperature() || battery_low) {
+    return kThermalWarm;
+  }
+  return kThermalNominal;
+#else
+  return kThermalUnknown;
+#endif  // __ANDROID__
+}
+
+// Feed the last frame to the quality governor, and apply the tier it picks.
+// Only matches count, since menus are paced and loading is uneven.
+void PieNoonGame::UpdateQuality(WorldTime delta_time) {
+  const WorldTime now = CurrentWorldTime();
+  if (thermal_read_time_ == 0 ||
+      now - thermal_read_time_ >= kThermalReadInterval) {
+    thermal_state_ = ReadThermalState();
+    thermal_read_time_ = now;
+  }
+  const int previous = quality_governor_.tier();
+  if (!quality_governor_.Update(static_cast<float>(delta_time),
+                                thermal_state_)) {
+    return;
+  }
+  const int tier = quality_governor_.tier();
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+              "Quality tier %d -> %d (thermal state %d)\n", previous, tier,
+              static_cast<int>(thermal_state_));
+  // Labelled with the GPU, to see which devices struggle.
+  const char* device = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+  SendTrackerEvent(kCategoryPerformance,
+                   tier > previous ? kActionQualityTierDown
+                                   : kActionQualityTierUp,
+                   device ? device : "", tier);
+  ApplyQualityTier(tier);
+}
+
+void PieNoonGame::ApplyQualityTier(int tier) {
+  const auto tiers = GetConfig().quality_tiers();
+  if (tiers == nullptr || tier < 0 ||
+      tier >= static_cast<int>(tiers->Length())) {
+    return;
+  }
+  const QualityTier* quality = tiers->Get(tier);
+  game_state_.particle_manager().budget().set_quality_scale(
+      quality->particle_scale());
+  game_state_.set_confetti_enabled(quality->confetti());
+  render_shadows_ = quality->shadows();
+  max_undistort_scale_ = quality->undistort_scale();
+  renderer_.SetUndistortFramebuffer16bpp(quality->render_16bpp());
+  renderer_.SetUndistortFramebufferScale(UndistortScale());
+}
+
+// The Cardboard resolution scale, as picked from frame times, but no more
+// than the quality tier allows.
+float PieNoonGame::UndistortScale() const {
+#ifdef ANDROID_CARDBOARD
+  return std::min(dynamic_resolution_.scale(), max_undistort_scale_);
+#else
+  return max_undistort_scale_;
+#endif  // ANDROID_CARDBOARD
+}
+
+// Write out the scenario benchmark's results, and quit.
+void PieNoonGame::FinishScenarioBenchmark() {
+  char* pref_path = SDL_GetPrefPath("Google", "PieNoon");
+  const std::string filename =
+      std::string(pref_path ? pref_path : "") + kScenarioBenchmarkFileName;
+  SDL_free(pref_path);
+  const char* device = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+  if (scenario_benchmark_.Report(filename.c_str(), device ? device : "")) {
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Wrote scenario benchmark to %s\n", filename.c_str());
+  } else {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                 "Couldn't write scenario benchmark to %s\n",
+                 filename.c_str());
+  }
+  input_.exit_requested_ = true;
+}
+
+// Write out the multiscreen game that just ended, if it was recorded.
+void PieNoonGame::WriteMultiscreenReplay() {
+  if (!multiplayer_director_->SaveReplay(&replay_)) return;
+  char* pref_path = SDL_GetPrefPath("Google", "PieNoon");
+  const std::string filename =
+      std::string(pref_path ? pref_path : "") + kReplayFileName;
+  SDL_free(pref_path);
+  SDL_RWops* handle = SDL_RWFromFile(filename.c_str(), "wb");
+  const size_t written =
+      handle ? SDL_RWwrite(handle, &replay_[0], 1, replay_.size()) : 0;
+  if (handle) SDL_RWclose(handle);
+  if (written == replay_.size()) {
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Wrote replay to %s\n",
+                filename.c_str());
+  } else {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                 "Couldn't write replay to %s\n", filename.c_str());
+  }
+}
+
 // Debug function to print out the state of each AirbornePie.
 void PieNoonGame::DebugPrintPieStates() {
   for (unsigned int i = 0; i < game_state_.pies().size(); ++i) {
-    auto& pie = game_state_.pies()[i];
-    const vec3 position = pie->Position();
+    const AirbornePie& pie = game_state_.pies()[i];
+    const vec3 position = game_state_.pies().Position(i);
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                 "Pie from [%i]->[%i] w/ %i dmg at pos[%.2f, %.2f, %.2f]\n",
-                pie->source(), pie->target(), pie->damage(), position.x(),
+                pie.source(), pie.target(), pie.damage(), position.x(),
                 position.y(), position.z());
   }
 }
 
 const Config& PieNoonGame::GetConfig() const {
-  return *fpl::pie_noon::GetConfig(config_source_.c_str());
+  return *fpl::pie_noon::GetConfig(config_source_.data());
 }
 
 const Config& PieNoonGame::GetCardboardConfig() const {
 #ifdef ANDROID_CARDBOARD
-  return *fpl::pie_noon::GetConfig(cardboard_config_source_.c_str());
+  return *fpl::pie_noon::GetConfig(cardboard_config_source_.data());
 #else
   return GetConfig();
 #endif
@@ -855,7 +1784,7 @@ const Config& PieNoonGame::GetCardboardConfig() const {
 
 const CharacterStateMachineDef* PieNoonGame::GetStateMachine() const {
   return fpl::pie_noon::GetCharacterStateMachineDef(
-      state_machine_source_.c_str());
+      state_machine_source_.data());
 }
 
 struct ButtonToTranslation {
@@ -983,12 +1912,38 @@ PieNoonState PieNoonGame::UpdatePieNoonState() {
     case kLoading: {
       // When we initialized assets, we kicked off a thread to load all
       // textures. Here we check if those have finished loading.
-      // We also leave the loading screen up for a minimum amount of time.
-      if (!Fading() && matman_.TryFinalize()
+      // We also leave the loading screen up for a minimum amount of time,
+      // except in the scenario benchmark, which times how long loading took.
+      if (!Fading() && matman_.FinishedLoading()
 #if !IMGUI_TEST
-          && (time - state_entry_time_) > config.min_loading_time()
+          && ((time - state_entry_time_) > config.min_loading_time() ||
+              config.scenario_benchmark_frames() > 0)
 #endif  // IMGUI_TEST
               ) {
+        if (config.print_load_timings()) {
+          DebugPrintLoadTimings();
+        }
+        FinishStartupTrace();
+        if (config.print_memory_report()) MemoryAccounting::LogReport();
+        frame_trace_frames_left_ = config.frame_trace_frames();
+        hitch_detector_.Start(config.hitch_threshold_ms(),
+                              config.hitch_capture_ms());
+        FrameProfiler::SetEnabled(frame_trace_frames_left_ > 0 ||
+                                  hitch_detector_.enabled());
+
+        // The scenario benchmark goes straight into an AI match, from the
+        // same seed every run, and draws as fast as it can.
+        if (config.scenario_benchmark_frames() > 0) {
+          const WorldTime step_time = config.simulation_step_time() > 0
+                                          ? config.simulation_step_time()
+                                          : kScenarioBenchmarkStepTime;
+          scenario_benchmark_.Start(config.scenario_benchmark_frames(),
+                                    step_time, SDL_GetTicks());
+          srand(config.simulation_seed());
+          SDL_GL_SetSwapInterval(0);
+          return kPlaying;
+        }
+
         // If we've already displayed the tutorial before, jump straight to
         // the game. If we don't have the capability to record our previous
         // tutorial views, also jump straight to the game.
@@ -1035,6 +1990,7 @@ PieNoonState PieNoonGame::UpdatePieNoonState() {
       if (game_state_.IsGameOver() && stinger_channel_.Valid() &&
           !stinger_channel_.Playing()) {
         game_state_.PostGameLogging();
+        if (config.print_memory_report()) MemoryAccounting::LogReport();
         if (game_state_.is_multiscreen() && multiplayer_director_ != nullptr) {
 #ifdef PIE_NOON_USES_GOOGLE_PLAY_GAMES
           multiplayer_director_->SendEndGameMsg();
@@ -1187,9 +2143,13 @@ void PieNoonGame::UpdateCountdownImage(WorldTime time) {
 }
 
 void PieNoonGame::TransitionToPieNoonState(PieNoonState next_state) {
+  FPL_PROFILE_SCOPE("TransitionToPieNoonState");
   assert(state_ != next_state);  // Must actually transition.
   const Config& config = GetConfig();
 
+  // The last scene described may not fit the new state.
+  render_scene_ready_ = false;
+
   if (next_state == kPaused) {
     audio_engine_.Pause(true);
   } else if (state_ == kPaused) {
@@ -1210,6 +2170,7 @@ void PieNoonGame::TransitionToPieNoonState(PieNoonState next_state) {
       }
 
       game_state_.EnterJoiningMode();
+      game_state_.CompactEntities();
       break;
     }
     case kPlaying: {
@@ -1245,6 +2206,7 @@ void PieNoonGame::TransitionToPieNoonState(PieNoonState next_state) {
     case kMultiplayerWaiting: {
       if (game_state_.is_multiscreen() && multiplayer_director_ != nullptr) {
         multiplayer_director_->EndGame();
+        WriteMultiscreenReplay();
       }
       if (ambience_channel_.Valid()) {
         ambience_channel_.Stop();
@@ -1272,6 +2234,9 @@ void PieNoonGame::TransitionToPieNoonState(PieNoonState next_state) {
       }
       stinger_channel_.Clear();
       music_channel_ = audio_engine_.PlaySound("MusicMenu");
+      // The round is over, so this is a good time to undo the fragmentation
+      // left behind by all the splatters that came and went.
+      game_state_.CompactEntities();
       for (size_t i = 0; i < game_state_.characters().size(); ++i) {
         auto& character = game_state_.characters()[i];
         if (character->controller()->controller_type() != Controller::kTypeAI) {
@@ -1307,19 +2272,11 @@ void PieNoonGame::TransitionToPieNoonState(PieNoonState next_state) {
     }
     case kTutorial: {
       tutorial_slide_index_ = 0;
-      auto tutorials = (game_state_.is_multiscreen()
-                            ? GetConfig().multiscreen_tutorial_slides()
-                            : GetConfig().tutorial_slides());
-      tutorial_slides_.clear();
-      for (unsigned int i = 0; i < tutorials->Length(); i++) {
-        tutorial_slides_.push_back(std::string(tutorials->Get(i)->c_str()));
-      }
+      SetTutorialSlides(game_state_.is_multiscreen());
       tutorial_aspect_ratio_ =
           game_state_.is_multiscreen()
               ? GetConfig().multiscreen_tutorial_aspect_ratio()
               : GetConfig().tutorial_aspect_ratio();
-
-      LoadInitialTutorialSlides();
       break;
     }
     case kMultiscreenClient: {
@@ -1335,6 +2292,7 @@ void PieNoonGame::TransitionToPieNoonState(PieNoonState next_state) {
 
   state_ = next_state;
   state_entry_time_ = prev_world_time_;
+  PrefetchTutorialSlides(state_, tutorial_slide_index_);
 }
 
 // Update the current game state and perform a state transition if requested.
@@ -1355,6 +2313,12 @@ void PieNoonGame::FadeToPieNoonState(PieNoonState next_state,
   if (!Fading()) {
     full_screen_fader_.Start(CurrentWorldTime(), fade_time, color, fade_in);
     fade_exit_state_ = next_state;
+    // Start loading the first slides while the screen fades, so the tutorial
+    // doesn't open on a blank slide.
+    if (next_state == kTutorial) {
+      SetTutorialSlides(game_state_.is_multiscreen());
+      PrefetchTutorialSlides(kTutorial, 0);
+    }
   }
 }
 
@@ -1399,7 +2363,10 @@ void PieNoonGame::CheckForNewAchievements() {
                                          "CgkI97yope0IEAIQFA"};  // 10000
     int list_size = sizeof(achievements) / sizeof(char*);
     for (int i = 0; i < list_size; i++) {
-      gpg_manager.IncrementAchievement(achievements[i]);
+      // Once unlocked, there's no point telling the server about more throws.
+      if (!gpg_manager.IsAchievementUnlocked(achievements[i])) {
+        gpg_manager.IncrementAchievement(achievements[i]);
+      }
     }
   }
 #endif
@@ -1415,9 +2382,9 @@ void PieNoonGame::UploadAndShowLeaderboards() {
 void PieNoonGame::UpdateGamepadControllers() {
 #ifdef ANDROID_GAMEPAD
   // Iterate over list of currently known gamepads.
-  for (auto it = input_.GamepadMap().begin(); it != input_.GamepadMap().end();
+  for (auto it = input_.gamepads().begin(); it != input_.gamepads().end();
        ++it) {
-    int device_id = it->first;
+    int device_id = it->controller_id();
     // if we find one that doesn't have a player associated with it...
     if (gamepad_to_controller_map_.find(device_id) ==
         gamepad_to_controller_map_.end()) {
@@ -1466,6 +2433,7 @@ Controller* PieNoonGame::GetController(ControllerId id) {
 }
 
 void PieNoonGame::HandlePlayersJoining(Controller* controller) {
+  FPL_PROFILE_SCOPE("HandlePlayersJoining");
   if (controller == nullptr || controller->character_id() != kNoCharacter ||
       controller->controller_type() == Controller::kTypeAI)
     return;
@@ -1506,10 +2474,10 @@ void PieNoonGame::AttachMultiplayerControllers() {
 #ifdef PIE_NOON_USES_GOOGLE_PLAY_GAMES
 
 void PieNoonGame::ProcessMultiplayerMessages() {
-  while (gpg_multiplayer_.HasMessage()) {
-    std::pair<std::string, std::vector<uint8_t>> msg_info =
-        gpg_multiplayer_.GetNextMessage();
-    std::string sender = msg_info.first;
+  gpg_multiplayer_.ReceiveMessages(&multiplayer_messages_);
+  for (size_t i = 0; i < multiplayer_messages_.size(); ++i) {
+    const GPGMultiplayer::SenderAndMessage& msg_info = multiplayer_messages_[i];
+    const std::string& sender = msg_info.first;
     if (!msg_info.second.empty()) {
       // Verify the message contents are trustworthy.
       flatbuffers::Verifier verifier(msg_info.second.data(),
@@ -1546,7 +2514,9 @@ void PieNoonGame::ProcessMultiplayerMessages() {
               (const multiplayer::StartTurn*)message->data();
           SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                       "Multiplayer message: StartTurn.");
-          multiscreen_turn_number_++;
+          // Take the host's numbering, in case we missed a turn, e.g.
+          // while reconnecting.
+          multiscreen_turn_number_ = start_turn->turn();
           // start the countdown for another turn
           multiscreen_turn_end_time_ =
               CurrentWorldTime() +
@@ -1574,6 +2544,19 @@ void PieNoonGame::ProcessMultiplayerMessages() {
           const multiplayer::PlayerStatus* player_status =
               (const multiplayer::PlayerStatus*)message->data();
           ProcessPlayerStatusMessage(*player_status);
+        } else if (message->data_type() ==
+                   multiplayer::Data_PlayerStatusDelta) {
+          const multiplayer::PlayerStatusDelta* delta =
+              (const multiplayer::PlayerStatusDelta*)message->data();
+          ProcessPlayerStatusDeltaMessage(*delta);
+        } else if (message->data_type() == multiplayer::Data_PlayerStatusAck) {
+          const multiplayer::PlayerStatusAck* ack =
+              (const multiplayer::PlayerStatusAck*)message->data();
+          if (multiplayer_director_ != nullptr) {
+            multiplayer_director_->InputPlayerStatusAck(
+                gpg_multiplayer_.GetPlayerNumberByInstanceId(sender),
+                ack->sequence());
+          }
         } else {
           SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
                       "Multiplayer message has a data type of NONE.");
@@ -1600,6 +2583,7 @@ void PieNoonGame::ProcessMultiplayerMessages() {
           "Got reconnected player %d (instance %s), send his assignment again.",
           player, instance_id.c_str());
       multiplayer_director_->SendPlayerAssignmentMsg(instance_id, player);
+      multiplayer_director_->ResetPlayerStatusAck(player);
       SendTrackerEvent(kCategoryMultiscreen, kActionStart, kLabelReconnection);
     }
   }
@@ -1607,22 +2591,68 @@ void PieNoonGame::ProcessMultiplayerMessages() {
 
 void PieNoonGame::ProcessPlayerStatusMessage(
     const multiplayer::PlayerStatus& status) {
+  PlayerStatusHistory::Snapshot* snapshot =
+      multiscreen_status_history_.Add(status.sequence());
+  snapshot->player_health.resize(status.player_health()->Length());
+  for (size_t i = 0; i < snapshot->player_health.size(); ++i) {
+    snapshot->player_health[i] = status.player_health()->Get(i);
+  }
+  snapshot->player_splats.resize(status.player_splats()->Length());
+  for (size_t i = 0; i < snapshot->player_splats.size(); ++i) {
+    snapshot->player_splats[i] = status.player_splats()->Get(i);
+  }
+  ApplyPlayerStatus(*snapshot);
+}
+
+void PieNoonGame::ProcessPlayerStatusDeltaMessage(
+    const multiplayer::PlayerStatusDelta& delta) {
+  const PlayerStatusHistory::Snapshot* baseline =
+      multiscreen_status_history_.Find(delta.baseline());
+  if (baseline == nullptr) {
+    // Not acknowledging it leaves the host sending deltas against a status
+    // we do have, or whole statuses again.
+    SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                "Player status delta against unknown status %d.",
+                delta.baseline());
+    return;
+  }
+  PlayerStatusHistory::Snapshot* snapshot =
+      multiscreen_status_history_.Add(delta.sequence());
+  if (snapshot != baseline) {
+    snapshot->player_health = baseline->player_health;
+    snapshot->player_splats = baseline->player_splats;
+  }
+  const auto players = delta.changed_players();
+  for (size_t i = 0; i < players->Length(); ++i) {
+    const size_t player = players->Get(i);
+    if (player >= snapshot->player_health.size()) {
+      snapshot->player_health.resize(player + 1, 0);
+      snapshot->player_splats.resize(player + 1, 0);
+    }
+    snapshot->player_health[player] = delta.player_health()->Get(i);
+    snapshot->player_splats[player] = delta.player_splats()->Get(i);
+  }
+  ApplyPlayerStatus(*snapshot);
+}
+
+void PieNoonGame::ApplyPlayerStatus(
+    const PlayerStatusHistory::Snapshot& status) {
   // Iterate through characters and player healths.
   auto c = game_state_.characters().begin();
-  auto h = status.player_health()->begin();
+  auto h = status.player_health.begin();
   for (; c != game_state_.characters().end() &&
-         h != status.player_health()->end();
+         h != status.player_health.end();
        ++c, ++h) {
     (*c)->set_health(*h);
   }
-  unsigned char splats;
+  uint32_t splats;
   if (multiscreen_my_player_id_ >=
-          static_cast<int>(status.player_splats()->Length()) ||
+          static_cast<int>(status.player_splats.size()) ||
       game_state_.characters()[multiscreen_my_player_id_]->health() <= 0) {
     // we're an invalid player (or a dead one), don't show our splats.
     splats = 0;
   } else {
-    splats = status.player_splats()->Get(multiscreen_my_player_id_);
+    splats = status.player_splats[multiscreen_my_player_id_];
   }
 
   int new_splats = 0;
@@ -1645,6 +2675,7 @@ void PieNoonGame::ProcessPlayerStatusMessage(
     // play a sound effect for the new splat(s) we got
     audio_engine_.PlaySound("HitWithLargePie");
   }
+  SendPlayerStatusAck(status.sequence);
 }
 #endif  // PIE_NOON_USES_GOOGLE_PLAY_GAMES
 
@@ -2003,6 +3034,7 @@ void PieNoonGame::StartMultiscreenGameAsClient(CharacterId id) {
   // Set up the menu screen.
   gui_menu_.Setup(GetConfig().multiplayer_client(), &matman_);
   game_state_.Reset(GameState::kNoAnalytics);
+  multiscreen_status_history_.Clear();
   int num_players = GetConfig().character_count();
   // Set multiplayer_action_button to the correct button ID, and color-code the
   // other buttons to correspond to the players.
@@ -2024,7 +3056,8 @@ void PieNoonGame::SendMultiscreenPlayerCommand() {
       multiplayer::CreatePlayerCommand(
           builder, multiscreen_action_aim_at_,
           (multiscreen_action_to_perform_ == ButtonId_Attack),
-          (multiscreen_action_to_perform_ == ButtonId_Defend))
+          (multiscreen_action_to_perform_ == ButtonId_Defend),
+          static_cast<uint16_t>(multiscreen_turn_number_))
           .Union());
 
   builder.Finish(message_root);
@@ -2039,6 +3072,19 @@ void PieNoonGame::SendMultiscreenPlayerCommand() {
   gpg_multiplayer_.BroadcastMessage(message, true);
 }
 
+void PieNoonGame::SendPlayerStatusAck(uint16_t sequence) {
+  flatbuffers::FlatBufferBuilder builder;
+  auto message_root = multiplayer::CreateMessageRoot(
+      builder, multiplayer::Data_PlayerStatusAck,
+      multiplayer::CreatePlayerStatusAck(builder, sequence).Union());
+  builder.Finish(message_root);
+
+  std::vector<uint8_t> message(builder.GetBufferPointer(),
+                               builder.GetBufferPointer() + builder.GetSize());
+  // Statuses keep coming, so a lost ack only means bigger deltas for a while.
+  gpg_multiplayer_.BroadcastMessage(message, false);
+}
+
 #endif  // PIE_NOON_USES_GOOGLE_PLAY_GAMES
 
 void PieNoonGame::ReloadMultiscreenMenu() {
@@ -2218,6 +3264,90 @@ void PieNoonGame::UpdateControllers(WorldTime delta_time) {
   }
 }
 
+// True if the game is being simulated this frame, in fixed steps.
+bool PieNoonGame::UsesFixedSteps() const {
+  if (GetConfig().simulation_step_time() <= 0) return false;
+  switch (state_) {
+    case kJoining:
+    case kPlaying:
+    case kMultiplayerWaiting:
+    case kFinished:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Update game logic by a variable number of milliseconds, or in fixed steps.
+// When paused, or a multiscreen client, only animation carries on.
+void PieNoonGame::AdvanceGameState(WorldTime delta_time, bool fixed_steps) {
+  if (state_ == kPaused || state_ == kMultiscreenClient) {
+    game_state_.particle_manager().AdvanceFrame(
+        static_cast<TimeStep>(delta_time));
+    game_state_.engine().AdvanceFrame(delta_time);
+    return;
+  }
+
+  // With a simulation thread, this counts whatever rendering allocates
+  // meanwhile too.
+  const uint64_t allocations = StartupTrace::AllocationCount();
+  if (fixed_steps) {
+    StepSimulation(delta_time);
+  } else {
+    game_state_.AdvanceFrame(delta_time, &audio_engine_);
+  }
+  if (GetConfig().print_frame_allocations()) {
+    const uint64_t frame_allocations =
+        StartupTrace::AllocationCount() - allocations;
+    if (frame_allocations > 0) {
+      SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                  "GameState::AdvanceFrame made %d allocations, "
+                  "with %d pies in the air.\n",
+                  static_cast<int>(frame_allocations),
+                  static_cast<int>(game_state_.pies().size()));
+    }
+  }
+}
+
+// Runs on the simulation thread, while the main thread renders the other
+// scene.
+void PieNoonGame::SimulateNextFrame() {
+  FPL_PROFILE_SCOPE("SimulateNextFrame");
+  AdvanceGameState(next_frame_delta_time_, next_frame_fixed_steps_);
+  game_state_.PopulateScene(&scenes_[1 - render_scene_]);
+}
+
+// Advance the game by as many fixed steps as fit in the time since the last
+// frame, plus what was left over then. The controllers were already updated
+// by one step this frame.
+void PieNoonGame::StepSimulation(WorldTime delta_time) {
+  const Config& config = GetConfig();
+  const WorldTime step = config.simulation_step_time();
+  simulation_time_ += delta_time;
+  for (int i = 0; simulation_time_ >= step; ++i) {
+    if (i == config.max_simulation_steps()) {
+      // Too far behind to catch up. Let the game slow down instead.
+      simulation_time_ = 0;
+      break;
+    }
+    if (i > 0) {
+      // Input devices are only read once per frame, so later steps shouldn't
+      // see their presses and releases again. The AI makes new decisions.
+      for (size_t j = 0; j < active_controllers_.size(); j++) {
+        Controller* controller = active_controllers_[j].get();
+        if (controller == nullptr) continue;
+        if (controller->controller_type() == Controller::kTypeAI) {
+          controller->AdvanceFrame(step);
+        } else {
+          controller->ClearInputEdges();
+        }
+      }
+    }
+    game_state_.AdvanceFrame(step, &audio_engine_);
+    simulation_time_ -= step;
+  }
+}
+
 void PieNoonGame::UpdateTouchButtons(WorldTime delta_time) {
   gui_menu_.AdvanceFrame(delta_time, &input_, vec2(renderer_.window_size()));
 
@@ -2284,25 +3414,51 @@ bool PieNoonGame::AnyControllerPresses() {
   return input_.GetPointerButton(0).went_down();
 }
 
-// Load into memory the tutorial slide at slide_index, if slide_index is valid.
-// We preload some tutorial slides so that we can transition to them.
-void PieNoonGame::LoadTutorialSlide(int slide_index) {
-  const int num_slides = static_cast<int>(tutorial_slides_.size());
-  if (slide_index < 0 || slide_index >= num_slides) return;
-
-  const char* slide_name = TutorialSlideName(slide_index);
-  matman_.LoadMaterial(slide_name);
-}
-
-// Preload the initial few tutorial slides to prime the slide load-unload
-// pipeline.
-void PieNoonGame::LoadInitialTutorialSlides() {
+// Use the single screen or multiscreen tutorial's slides, letting go of the
+// other's.
+void PieNoonGame::SetTutorialSlides(bool multiscreen) {
+  if (!tutorial_slides_.empty() && tutorial_slides_multiscreen_ == multiscreen)
+    return;
+  PrefetchTutorialSlides(kUninitialized, 0);
+  auto tutorials = multiscreen ? GetConfig().multiscreen_tutorial_slides()
+                               : GetConfig().tutorial_slides();
+  tutorial_slides_.clear();
+  for (unsigned int i = 0; i < tutorials->Length(); i++) {
+    tutorial_slides_.push_back(std::string(tutorials->Get(i)->c_str()));
+  }
+  tutorial_slides_loaded_.assign(tutorial_slides_.size(), false);
+  tutorial_slides_multiscreen_ = multiscreen;
+}
+
+// Keep loaded the tutorial slides that 'state' may show next, and unload the
+// rest, since the slides take a lot of memory. In the tutorial, that's the
+// slide at 'slide_index' and the few after it, so that advancing never waits
+// for a load. On the title screen, How to Play is one press away, so the
+// first few are kept.
+void PieNoonGame::PrefetchTutorialSlides(PieNoonState state, int slide_index) {
   const Config& config = GetConfig();
-  const int num_to_load =
-      static_cast<int>(config.tutorial_num_future_slides_to_load());
-  for (int slide_index = 0; slide_index < num_to_load; ++slide_index) {
-    LoadTutorialSlide(slide_index);
+  int first = 0;
+  int count = 0;
+  if (state == kTutorial) {
+    first = slide_index;
+    count = 1 + config.tutorial_num_future_slides_to_load();
+  } else if (state == kFinished && !game_state_.is_in_cardboard()) {
+    SetTutorialSlides(game_state_.is_multiscreen());
+    count = config.tutorial_menu_prefetch_slides();
+  }
+  const int priority = matman_.load_priority();
+  matman_.set_load_priority(kLoadPriorityPrefetch);
+  for (int i = 0; i < static_cast<int>(tutorial_slides_loaded_.size()); ++i) {
+    const bool wanted = first <= i && i < first + count;
+    if (wanted == tutorial_slides_loaded_[i]) continue;
+    if (wanted) {
+      matman_.LoadMaterial(tutorial_slides_[i].c_str());
+    } else {
+      matman_.UnloadMaterial(tutorial_slides_[i].c_str());
+    }
+    tutorial_slides_loaded_[i] = wanted;
   }
+  matman_.set_load_priority(priority);
 }
 
 // Scale material by (aspect_ratio, 1) and then scale again so that it covers as
@@ -2333,12 +3489,57 @@ void PieNoonGame::RenderInMiddleOfScreen(const mat4& ortho_mat,
   Mesh::RenderAAQuadAlongX(bottom_left, top_right, vec2(0, 1), vec2(1, 0));
 }
 
+// How much the screen can change without input, for the frame pacer.
+FrameContent PieNoonGame::CurrentFrameContent() {
+  // Network messages and head tracking change the screen without input
+  // events, as do fades, loads and the perf HUD.
+  if (game_state_.is_multiscreen() || game_state_.is_in_cardboard() ||
+      Fading() || perf_hud_.visible() || !matman_.FinishedLoading()) {
+    return kFrameContentMoving;
+  }
+  switch (state_) {
+    case kPaused:
+    case kFinished:
+      return kFrameContentIdle;
+    case kTutorial: {
+      // Static once the slide has faded in, until the next press.
+      const char* slide_name = TutorialSlideName(tutorial_slide_index_);
+      const Material* slide =
+          slide_name ? matman_.FindMaterial(slide_name) : nullptr;
+      const bool slide_shown = slide == nullptr || slide->textures()[0]->id();
+      return full_screen_fader_.Finished(CurrentWorldTime()) && slide_shown
+                 ? kFrameContentStatic
+                 : kFrameContentMoving;
+    }
+    default:
+      return kFrameContentMoving;
+  }
+}
+
 void PieNoonGame::Run() {
+  FrameProfiler::SetThreadName("Main");
   // Initialize so that we don't sleep the first time through the loop.
   const Config& config = GetConfig();
   const WorldTime min_update_time = config.min_update_time();
   const WorldTime max_update_time = config.max_update_time();
   prev_world_time_ = CurrentWorldTime() - min_update_time;
+  // Left open until the loading screen is done with. See
+  // FinishStartupTrace().
+  if (GetStartupTrace()) startup_trace_.Begin("Loading", "init");
+  perf_hud_.set_visible(config.perf_hud());
+  frame_pacer_.Initialize(config.idle_frame_delay(), config.idle_frame_time(),
+                          config.static_frame_time());
+#ifdef ANDROID_CARDBOARD
+  input_.cardboard_input().set_prediction_time(
+      config.head_pose_prediction_time());
+#endif  // ANDROID_CARDBOARD
+  quality_governor_.Initialize(
+      config.quality_tiers()
+          ? static_cast<int>(config.quality_tiers()->Length())
+          : 0,
+      config.quality_target_frame_time(), config.quality_step_down_time(),
+      config.quality_step_up_time());
+  ApplyQualityTier(0);
   TransitionToPieNoonState(kLoadingInitialMaterials);
   game_state_.Reset(GameState::kNoAnalytics);
 
@@ -2347,24 +3548,81 @@ void PieNoonGame::Run() {
     // Milliseconds elapsed since last update. To avoid burning through the
     // CPU, enforce a minimum time between updates. For example, if
     // min_update_time is 1, we will not exceed 1000Hz update time.
+    // The scenario benchmark takes the same steps however long its frames
+    // take, so that every run plays the same match.
+    const bool benchmarking = scenario_benchmark_.running();
     const WorldTime world_time = CurrentWorldTime();
+    // Screens that aren't changing render less often. Input ends the wait
+    // early, and returns to full rate.
+    const WorldTime pacing_wait =
+        benchmarking ? 0 : frame_pacer_.WaitTime(world_time,
+                                                 CurrentFrameContent());
+    if (pacing_wait > 0) {
+      if (SDL_WaitEventTimeout(nullptr, pacing_wait)) {
+        frame_pacer_.AddInput(CurrentWorldTime());
+      }
+      // Time spent waiting on purpose isn't a hitch.
+      hitch_detector_.RestartFrame(FrameProfiler::Now());
+      continue;
+    }
     const WorldTime delta_time =
-        std::min(world_time - prev_world_time_, max_update_time);
-    if (delta_time < min_update_time) {
+        benchmarking ? scenario_benchmark_.step_time()
+                     : std::min(world_time - prev_world_time_, max_update_time);
+    if (!benchmarking && delta_time < min_update_time) {
       SDL_Delay(min_update_time - delta_time);
       continue;
     }
+    // With fixed steps, wait until there's at least one step to simulate, so
+    // that every frame's input reaches the game.
+    const bool fixed_steps = UsesFixedSteps();
+    const WorldTime step_time = config.simulation_step_time();
+    if (fixed_steps && simulation_time_ + delta_time < step_time) {
+      SDL_Delay(step_time - simulation_time_ - delta_time);
+      continue;
+    }
+    if (!fixed_steps) simulation_time_ = 0;
+
+    // Everything up to the end of the loop is one frame in the profile.
+    frame_pacer_.StartFrame(world_time);
+    CheckForHitch();
+    AdvanceFrameTrace();
+    FPL_PROFILE_SCOPE("Frame");
+
+#ifdef ANDROID_CARDBOARD
+    // If frames are taking too long in Cardboard, render at a lower
+    // resolution, and let the undistortion pass scale it up.
+    if (game_state_.is_in_cardboard() &&
+        game_state_.use_undistort_rendering() &&
+        dynamic_resolution_.Update(static_cast<float>(delta_time))) {
+      renderer_.SetUndistortFramebufferScale(UndistortScale());
+    }
+#endif  // ANDROID_CARDBOARD
 
     // TODO: Can we move these to 'Render'?
     renderer_.AdvanceFrame(input_.minimized_);
+    MeasureInputLatency();
     renderer_.ClearFrameBuffer(mathfu::kZeros4f);
 
     // Process input device messages since the last game loop.
     // Update render window size.
-    input_.AdvanceFrame(&renderer_.window_size());
+    {
+      FPL_PROFILE_SCOPE("Input");
+      input_.AdvanceFrame(&renderer_.window_size());
+    }
+    // Android may have taken the GL context away while the game was in the
+    // background.
+    if (!input_.minimized_ && input_.minimized_frame() == input_.frames() &&
+        renderer_.CheckContextLoss()) {
+      RestoreAfterContextLoss();
+    }
+    perf_hud_.AddFrameTime(delta_time);
+    if (state_ == kPlaying && !benchmarking) UpdateQuality(delta_time);
+    if (input_.GetButton(SDLK_F3).went_down()) {
+      perf_hud_.set_visible(!perf_hud_.visible());
+    }
 
     UpdateGamepadControllers();
-    UpdateControllers(delta_time);
+    UpdateControllers(fixed_steps ? step_time : delta_time);
     UpdateTouchButtons(delta_time);
 
     // Update the full screen fader dimensions.
@@ -2564,14 +3822,59 @@ void PieNoonGame::Run() {
         }
 #endif
 
-        if (state_ != kPaused && state_ != kMultiscreenClient) {
-          // Update game logic by a variable number of milliseconds.
-          game_state_.AdvanceFrame(delta_time, &audio_engine_);
+        if (state_ == kMultiscreenClient) {
+          AdvanceGameState(delta_time, fixed_steps);
+          Render2DElements();
+          render_scene_ready_ = false;
+        } else if (simulation_thread_.started() && !benchmarking) {
+          // Render the last frame's scene while the simulation thread
+          // advances the game and describes this frame's. The game state is
+          // only touched by that thread until it's done.
+          if (!render_scene_ready_) {
+            game_state_.PopulateScene(&scenes_[render_scene_]);
+            scenes_[render_scene_].set_input_time(0);
+          }
+          scenes_[1 - render_scene_].set_input_time(input_.oldest_input_time());
+          next_frame_delta_time_ = delta_time;
+          next_frame_fixed_steps_ = fixed_steps;
+          simulation_thread_.Run(simulate_next_frame_);
+          Render(scenes_[render_scene_]);
+          if (shader_reproject_ && game_state_.is_in_cardboard() &&
+              game_state_.use_undistort_rendering()) {
+            ReprojectWhileSimulating();
+          }
+          simulation_thread_.Wait();
+          render_scene_ = 1 - render_scene_;
+          render_scene_ready_ = true;
         } else {
-          // We are the client, we only update a few small things.
-          game_state_.particle_manager().AdvanceFrame(
-              static_cast<TimeStep>(delta_time));
-          game_state_.engine().AdvanceFrame(delta_time);
+          // The scenario benchmark runs here rather than on the simulation
+          // thread, so that updating and rendering can be timed apart.
+          const uint64_t update_start = FrameProfiler::Now();
+          AdvanceGameState(delta_time, fixed_steps);
+
+          // Populate 'scene' from the game state--all the positions,
+          // orientations, and renderable-ids (which specify materials) of the
+          // characters and props. Also specify the camera matrix.
+          SceneDescription& scene = scenes_[render_scene_];
+          game_state_.PopulateScene(&scene);
+          scene.set_input_time(input_.oldest_input_time());
+
+          // Issue draw calls for the 'scene'.
+          const uint64_t render_start = FrameProfiler::Now();
+          Render(scene);
+          if (benchmarking) {
+            // Wait for the GPU too, or the render time is only the driver's.
+            GL_CALL(glFinish());
+            scenario_benchmark_.AddFrame(render_start - update_start,
+                                         FrameProfiler::Now() - render_start);
+          }
+        }
+
+        // The scenario benchmark plays match after match until it's done.
+        if (benchmarking && game_state_.IsGameOver()) {
+          srand(config.simulation_seed());
+          game_state_.Reset(GameState::kNoAnalytics);
+          scenario_benchmark_.AddMatch();
         }
 
         if (state_ == kPlaying && !stinger_channel_.Valid() &&
@@ -2583,19 +3886,6 @@ void PieNoonGame::Run() {
         // Update audio engine state.
         audio_engine_.AdvanceFrame(world_time);
 
-        // Issue draw calls for the 'scene'.
-        if (state_ != kMultiscreenClient) {
-          // Populate 'scene' from the game state--all the positions,
-          // orientations, and renderable-ids (which specify materials) of the
-          // characters and props. Also specify the camera matrix.
-          game_state_.PopulateScene(&scene_);
-
-          // Issue draw calls for the 'scene'.
-          Render(scene_);
-        } else {
-          Render2DElements();
-        }
-
 // TEMP: testing GUI on top of everything else.
 #if IMGUI_TEST
         // Open OpenType font
@@ -2614,13 +3904,36 @@ void PieNoonGame::Run() {
         if (config.print_pie_states()) {
           DebugPrintPieStates();
         }
+        if (config.print_culling_stats()) {
+          DebugPrintCullingStats();
+        }
+        if (config.print_transform_stats()) {
+          DebugPrintTransformStats();
+        }
+        if (config.print_input_latency()) {
+          DebugPrintInputLatency();
+        }
+        if (config.print_particle_stats()) {
+          DebugPrintParticleStats();
+        }
         if (config.allow_camera_movement()) {
           DebugCamera();
         }
+        if (perf_hud_.visible()) {
+          RenderPerfHud();
+        }
+
+        // Unload textures that haven't been seen for a while, and reload the
+        // ones that have come back into view.
+        matman_.UpdateTextureResidency(config.texture_finalize_budget());
 
         // Remember the real-world time from this frame.
         prev_world_time_ = world_time;
 
+        if (benchmarking && scenario_benchmark_.finished()) {
+          FinishScenarioBenchmark();
+        }
+
         // Advance to the next play state, if required.
         UpdatePieNoonStateAndTransition();
 
@@ -2648,7 +3961,11 @@ void PieNoonGame::Run() {
         auto spinmat = matman_.FindMaterial(config.loading_material()->c_str());
         auto logomat = matman_.FindMaterial(config.loading_logo()->c_str());
         assert(spinmat && logomat);
-        assert(spinmat->textures()[0]->id() && logomat->textures()[0]->id());
+        // They're only missing while being restored after a lost context.
+        assert((spinmat->textures()[0]->id() ||
+                spinmat->textures()[0]->evicted()) &&
+               (logomat->textures()[0]->id() ||
+                logomat->textures()[0]->evicted()));
         const auto mid = res / 2;
         const float time = static_cast<float>(world_time) /
                            static_cast<float>(kMillisecondsPerSecond);
@@ -2677,11 +3994,28 @@ void PieNoonGame::Run() {
         Mesh::RenderAAQuadAlongX(vec3(-extend.x(), extend.y(), 0),
                                  vec3(extend.x(), -extend.y(), 0), vec2(0, 1),
                                  vec2(1, 0));
+
+        // Show how far along the texture uploads are, as a bar below the
+        // logo drawn with the fader's plain white texture.
+        const vec2 bar_size(static_cast<float>(res.x()) * 0.25f,
+                            static_cast<float>(res.y()) * 0.005f);
+        const float progress = matman_.LoadProgress();
+        renderer_.model_view_projection() =
+            ortho_mat * mat4::FromTranslationVector(
+                            vec3(static_cast<float>(mid.x()),
+                                 static_cast<float>(res.y()) * 0.85f, 0.0f));
+        renderer_.color() = mathfu::kOnes4f;
+        full_screen_fader_.material()->Set(renderer_);
+        shader_textured_->Set(renderer_);
+        Mesh::RenderAAQuadAlongX(
+            vec3(-bar_size.x(), bar_size.y(), 0),
+            vec3(bar_size.x() * (2.0f * progress - 1.0f), -bar_size.y(), 0),
+            vec2(0, 1), vec2(1, 0));
       }  // Fallthrough
 
       case kLoadingInitialMaterials:
         // Finalize the materials that have been loaded thus far.
-        matman_.TryFinalize();
+        matman_.TryFinalize(config.texture_finalize_budget());
 
         if (UpdatePieNoonStateAndTransition() == kFinished) {
           game_state_.Reset(GameState::kNoAnalytics);
@@ -2689,7 +4023,7 @@ void PieNoonGame::Run() {
         break;
 
       case kTutorial: {
-        matman_.TryFinalize();
+        matman_.TryFinalize(config.texture_finalize_budget());
 
         const bool should_transition =
             full_screen_fader_.Finished(world_time) && AnyControllerPresses();
@@ -2697,13 +4031,6 @@ void PieNoonGame::Run() {
           // Start fade-out --> fade-in transition.
           full_screen_fader_.Start(world_time, config.tutorial_fade_time(),
                                    mathfu::kZeros4f, false);
-
-          // Initiate asynchronous loading of a slide, several slides before
-          // it is needed.
-          const int future_slide_index =
-              tutorial_slide_index_ +
-              config.tutorial_num_future_slides_to_load();
-          LoadTutorialSlide(future_slide_index);
         }
 
         // Draw the slide covering the entire screen.
@@ -2719,9 +4046,6 @@ void PieNoonGame::Run() {
         if (!full_screen_fader_.Finished(world_time)) {
           const bool opaque = full_screen_fader_.Render(world_time);
           if (opaque) {
-            // Unload current slide to save memory.
-            matman_.UnloadMaterial(slide_name);
-
             const unsigned int SLIDE_NUMBER_BUFFER_SIZE = 32;
             char slide_number[SLIDE_NUMBER_BUFFER_SIZE];
             snprintf(slide_number, sizeof(slide_number),
@@ -2733,9 +4057,12 @@ void PieNoonGame::Run() {
                                               : kActionViewedTutorialSlide,
                              slide_number, world_time - tutorial_slide_time_);
 
-            // When completely dark, transition to the next slide.
+            // When completely dark, transition to the next slide. The one
+            // just shown is unloaded to save memory, and the next one to be
+            // needed starts loading, several slides ahead.
             tutorial_slide_index_++;
             tutorial_slide_time_ = world_time;
+            PrefetchTutorialSlides(kTutorial, tutorial_slide_index_);
           }
         }
 
@@ -20,20 +20,37 @@
 #endif
 
 #include "ai_controller.h"
+#include "asset_archive.h"
+#include "billboard_batch.h"
 #include "cardboard_controller.h"
+#include "dynamic_resolution.h"
+#include "frustum.h"
+#include "frame_pacer.h"
+#include "frame_profiler.h"
 #include "full_screen_fader.h"
 #include "game_state.h"
+#include "gpu_particles.h"
 #include "gui_menu.h"
+#include "hitch_detector.h"
 #include "input.h"
+#include "mapped_file.h"
 #include "material_manager.h"
 #include "multiplayer_controller.h"
 #include "multiplayer_director.h"
+#include "perf_hud.h"
 #include "pindrop/pindrop.h"
 #include "player_controller.h"
+#include "player_status_history.h"
+#include "quality_governor.h"
+#include "render_queue.h"
 #include "renderer.h"
+#include "scenario_benchmark.h"
 #include "scene_description.h"
+#include "simulation_thread.h"
+#include "startup_trace.h"
 #include "touchscreen_button.h"
 #include "touchscreen_controller.h"
+#include "worker_pool.h"
 
 #ifdef ANDROID_GAMEPAD
 #include "gamepad_controller.h"
@@ -71,36 +88,108 @@ class PieNoonGame {
   void Run();
 
  private:
+  // How to draw one RenderableId.
+  struct DrawRecord {
+    // Never null. Renderables without a front of their own draw the pajama
+    // mesh, that of RenderableId_Invalid.
+    Mesh* front;
+    // Null if the renderable has no back.
+    Mesh* back;
+    const Material* front_material;
+    // The front's texture, which the shadow pass draws the shadow from.
+    Texture* front_texture;
+    // The CPU copy of the front's quad, for batching.
+    const NormalMappedVertex* front_quad;
+    Shader* front_shader;
+    // The shader and material part of the front's render queue key.
+    uint64_t state_key;
+    bool shadow;
+    // True if the renderable is propped up by a stick, and the stick meshes
+    // exist.
+    bool stick;
+    // True if the front is a plain textured quad of its own, with no back,
+    // stick or lighting, which BillboardBatch can draw many at a time.
+    bool batchable;
+  };
+
+  // The cameras a frame is drawn from, and where on screen each one goes.
+  // Normally a single camera fills the screen; in Cardboard there is one per
+  // eye. The scene is walked once, and each draw is issued for every view
+  // before moving on to the next.
+  struct SceneViews {
+    static const int kMaxViews = 2;
+    int count;
+    mat4 camera_transforms[kMaxViews];
+    // (x, y, width, height) of each view. Ignored when there is only one
+    // view, which leaves the viewport as it is.
+    vec4i viewports[kMaxViews];
+  };
+
   bool InitializeConfig();
 #ifdef ANDROID_CARDBOARD
   bool InitializeCardboardConfig();
 #endif
   bool InitializeRenderer();
+  void InitializeWorkerPool();
   Mesh* CreateVerticalQuadMesh(const flatbuffers::String* material_name,
                                const vec3& offset, const vec2& pixel_bounds,
-                               float pixel_to_world_scale);
+                               float pixel_to_world_scale,
+                               NormalMappedVertex* vertices_out = nullptr);
   bool InitializeRenderingAssets();
+  void InitializeRenderableBounds(const NormalMappedVertex* stick_quad);
   bool InitializeGameState();
-  void RenderCardboard(const SceneDescription& scene,
-                       const mat4& camera_transform);
+  mat4 CameraTransform(const SceneDescription& scene,
+                       const mat4& additional_camera_changes,
+                       const vec2i& resolution) const;
+  bool RenderableVisible(const Renderable& renderable,
+                         const std::vector<Frustum>& frustums) const;
+  void BuildRenderQueue(const SceneDescription& scene,
+                        const SceneViews& views);
+  void SetView(const SceneViews& views, int view);
+  void RenderCardboard(const SceneDescription& scene, const SceneViews& views);
+  void InitializeDrawRecords();
+  bool CanBatchRenderable(int renderable_id) const;
+  const Material* RenderBillboardBatch(const SceneViews& views);
+  void RenderShadowBatch(const SceneViews& views, const Texture* texture);
+  void InitializeGpuParticlePool(const ParticleDef* def);
+  void RenderParticleBursts(const SceneDescription& scene,
+                            const SceneViews& views);
   void Render(const SceneDescription& scene);
   void RenderForDefault(const SceneDescription& scene);
   void RenderForCardboard(const SceneDescription& scene);
-  void RenderScene(const SceneDescription& scene,
-                   const mat4& additional_camera_changes,
-                   const vec2i& resolution);
+  void RenderScene(const SceneDescription& scene, const SceneViews& views);
   void Render2DElements();
   void GetCardboardTransforms(mat4& left_eye_transform,
                               mat4& right_eye_transform);
   void CorrectCardboardCamera(mat4& cardboard_camera);
   void RenderCardboardCenteringBar();
+  void ReprojectCardboardFrame();
+  void ReprojectWhileSimulating();
+  void RestoreAfterContextLoss();
   void DebugPrintCharacterStates();
   void DebugPrintPieStates();
+  void DebugPrintCullingStats();
+  void DebugPrintTransformStats();
+  void DebugPrintInputLatency();
+  void MeasureInputLatency();
+  void DebugPrintParticleStats();
+  void DebugPrintLoadTimings();
+  void RenderPerfHud();
+  void FinishStartupTrace();
+  void AdvanceFrameTrace();
+  void CheckForHitch();
+  FrameContent CurrentFrameContent();
+  ThermalState ReadThermalState();
+  void UpdateQuality(WorldTime delta_time);
+  void ApplyQualityTier(int tier);
+  float UndistortScale() const;
+  void FinishScenarioBenchmark();
+  void WriteMultiscreenReplay();
   void DebugCamera();
   const Config& GetConfig() const;
   const Config& GetCardboardConfig() const;
   const CharacterStateMachineDef* GetStateMachine() const;
-  Mesh* GetCardboardFront(int renderable_id);
+  const DrawRecord& GetDrawRecord(int renderable_id) const;
   PieNoonState UpdatePieNoonState();
   void TransitionToPieNoonState(PieNoonState next_state);
   PieNoonState UpdatePieNoonStateAndTransition();
@@ -120,6 +209,10 @@ class PieNoonGame {
   PieNoonState HandleMenuButtons(WorldTime time);
   // void HandleMenuButton(Controller* controller, TouchscreenButton* button);
   void UpdateControllers(WorldTime delta_time);
+  bool UsesFixedSteps() const;
+  void AdvanceGameState(WorldTime delta_time, bool fixed_steps);
+  void SimulateNextFrame();
+  void StepSimulation(WorldTime delta_time);
   void UpdateTouchButtons(WorldTime delta_time);
 
   pindrop::Channel PlayStinger();
@@ -129,13 +222,15 @@ class PieNoonGame {
   ButtonId CurrentlyAnimatingJoinImage(WorldTime time) const;
   const char* TutorialSlideName(int slide_index);
   bool AnyControllerPresses();
-  void LoadTutorialSlide(int slide_index);
-  void LoadInitialTutorialSlides();
+  void SetTutorialSlides(bool multiscreen);
+  void PrefetchTutorialSlides(PieNoonState state, int slide_index);
   void RenderInMiddleOfScreen(const mathfu::mat4& ortho_mat, float x_scale,
                               Material* material);
 
   void ProcessMultiplayerMessages();
   void ProcessPlayerStatusMessage(const multiplayer::PlayerStatus&);
+  void ProcessPlayerStatusDeltaMessage(const multiplayer::PlayerStatusDelta&);
+  void ApplyPlayerStatus(const PlayerStatusHistory::Snapshot& status);
 
   // returns true if a new splat was displayed
   bool ShowMultiscreenSplat(int splat_num);
@@ -150,6 +245,7 @@ class PieNoonGame {
   void StartMultiscreenGameAsHost();
   void StartMultiscreenGameAsClient(CharacterId id);
   void SendMultiscreenPlayerCommand();
+  void SendPlayerStatusAck(uint16_t sequence);
 #endif
   void ReloadMultiscreenMenu();
   void UpdateMultiscreenMenuIcons();
@@ -163,10 +259,17 @@ class PieNoonGame {
   // prev_world_time_.
   WorldTime state_entry_time_;
 
+  // Packed assets, if the build made an archive. Declared ahead of everything
+  // loaded from it, so that it is destroyed last.
+  AssetArchive asset_archive_;
+
+  // Timings of each phase of Initialize(), and of the loading that follows.
+  StartupTrace startup_trace_;
+
   // Hold configuration binary data.
-  std::string config_source_;
+  MappedFile config_source_;
 #ifdef ANDROID_CARDBOARD
-  std::string cardboard_config_source_;
+  MappedFile cardboard_config_source_;
 #endif
 
   // Report touches, button presses, keyboard presses.
@@ -175,6 +278,11 @@ class PieNoonGame {
   // Hold rendering context.
   Renderer renderer_;
 
+  // Runs the background work of every subsystem: loading, updates, text
+  // shaping and analytics. Declared before everything that submits jobs to
+  // it, so that it stops last.
+  WorkerPool worker_pool_;
+
   // Load and own rendering resources.
   MaterialManager matman_;
 
@@ -185,32 +293,104 @@ class PieNoonGame {
   std::vector<Mesh*> cardboard_fronts_;
   std::vector<Mesh*> cardboard_backs_;
 
+  // Everything drawing each RenderableId needs, looked up once after the
+  // meshes and shaders are loaded, so that drawing only indexes this.
+  std::vector<DrawRecord> draw_records_;
+
+  // CPU copy of the quad in each of cardboard_fronts_, for batching.
+  // kBillboardNumVertices entries per RenderableId.
+  std::vector<NormalMappedVertex> cardboard_front_quads_;
+
   // Rendering mesh for front and back of the stick that props cardboard.
   Mesh* stick_front_;
   Mesh* stick_back_;
 
+  // Bounding sphere of everything drawn for each RenderableId (front, back
+  // and stick), in object space, as (center, radius).
+  std::vector<mathfu::vec4_packed> renderable_bounds_;
+
+  // How many renderables the last BuildRenderQueue() left out because no
+  // camera could see them, and how many it kept.
+  int num_culled_renderables_;
+  int num_submitted_renderables_;
+
   // Shaders we use.
   Shader* shader_cardboard;
   Shader* shader_lit_textured_normal_;
-  Shader* shader_simple_shadow_;
+  Shader* shader_simple_shadow_instanced_;
   Shader* shader_textured_;
+  Shader* shader_textured_instanced_;
   Shader* shader_grayscale_;
+  Shader* shader_gpu_particles_;
+  // Warps Cardboard frames to the latest head pose, if
+  // config.cardboard_reprojection is set.
+  Shader* shader_reproject_;
 
   // Shadow material.
   Material* shadow_mat_;
 
+  // Ground plane material.
+  Material* ground_mat_;
+
+  // Draw order for the renderables in the current scene. Rebuilt every frame
+  // so that draws sharing a shader and material are submitted together.
+  RenderQueue render_queue_;
+
+  // Consecutive uncolored billboards in the render queue that share a mesh
+  // are collected here and drawn in one call.
+  BillboardBatch billboard_batch_;
+
+  // The shadows of casters that share a front mesh, drawn in one call, and
+  // the scene's casters in the order they're batched in. Kept around to
+  // avoid reallocating.
+  BillboardBatch shadow_batch_;
+  std::vector<uint32_t> shadow_casters_;
+
+  // The pregenerated particles of each ParticleDef that is simulated on the
+  // GPU.
+  std::map<const ParticleDef*, std::unique_ptr<GpuParticlePool>>
+      gpu_particle_pools_;
+
   // Hold state machine binary data.
-  std::string state_machine_source_;
+  MappedFile state_machine_source_;
+
+  // The transitions of the state machine, shared by all characters.
+  CharacterStateMachineTable state_machine_table_;
+
+  // Picks the Cardboard render resolution from recent frame times.
+  DynamicResolution dynamic_resolution_;
+
+  // Lowers the frame rate of menus and other screens that aren't changing.
+  FramePacer frame_pacer_;
+
+  // Steps rendering quality down when matches run slow or the device hot.
+  QualityGovernor quality_governor_;
+
+  // Frame times and engine counters, drawn over the game. F3 toggles it.
+  PerfHud perf_hud_;
+
+  // Times the frames of AI matches, if config.scenario_benchmark_frames.
+  ScenarioBenchmark scenario_benchmark_;
+
+  // Writes a trace of the last few seconds whenever a frame takes longer than
+  // config.hitch_threshold_ms.
+  HitchDetector hitch_detector_;
 
   // Hold characters, pies, camera state.
   GameState game_state_;
 
+  // Advances game_state_ a frame ahead of rendering, if pipeline_simulation
+  // is set. Declared after game_state_, so it stops first.
+  SimulationThread simulation_thread_;
+
   // Map containing every active controller, referenced by a unique,
   // unchanging ID.
   std::vector<std::unique_ptr<Controller>> active_controllers_;
 
   // On the host, directs the fake controllers in the multiscreen gameplay.
   std::unique_ptr<MultiplayerDirector> multiplayer_director_;
+  // Scratch space for WriteMultiscreenReplay().
+  std::vector<uint8_t> replay_;
   // On the client, which player are we? 0-3
   CharacterId multiscreen_my_player_id_;
   // On the client, Which action we are performing: Attack, Defend, or Cancel
@@ -220,13 +400,25 @@ class PieNoonGame {
   // player starts aimed at the next player (or p3 is aimed back at p0).
   CharacterId multiscreen_action_aim_at_;
   int multiscreen_turn_number_;
+  // On the client, the statuses received recently, which the host may send
+  // deltas against.
+  PlayerStatusHistory multiscreen_status_history_;
   // Animation for the multiscreen splats that appear.
   float multiscreen_splat_param;
   float multiscreen_splat_param_speed;
 
   // Description of the scene to be rendered. Isolates gameplay and rendering
-  // code with a type-light structure. Recreated every frame.
-  SceneDescription scene_;
+  // code with a type-light structure. Recreated every frame. With a
+  // simulation thread, it fills one while the main thread renders the other.
+  SceneDescription scenes_[2];
+  // The one to render next, and whether it describes the current state yet.
+  int render_scene_;
+  bool render_scene_ready_;
+  // What SimulateNextFrame() does on the simulation thread. Made once, so
+  // handing it over doesn't allocate.
+  std::function<void()> simulate_next_frame_;
+  WorldTime next_frame_delta_time_;
+  bool next_frame_fixed_steps_;
 
   // World time of previous update. We use this to calculate the delta_time
   // of the current update. This value is tied to the real-world clock.
@@ -235,6 +427,44 @@ class PieNoonGame {
   // prev_world_time_ will keep chugging.
   WorldTime prev_world_time_;
 
+  // Time not yet simulated, when config.simulation_step_time is set. Always
+  // less than one step between frames.
+  WorldTime simulation_time_;
+
+  // Latencies measured since they were last printed, in milliseconds.
+  struct LatencyStats {
+    LatencyStats() : total(0), count(0), max(0) {}
+    void Add(uint32_t latency) {
+      total += latency;
+      count++;
+      max = std::max(max, latency);
+    }
+    uint32_t total;
+    uint32_t count;
+    uint32_t max;
+  };
+  // SDL_GetTicks() times of the input and the Cardboard head pose shown by
+  // the frame being drawn, until it's presented. 0 if there's nothing new.
+  uint32_t frame_input_time_;
+  uint32_t frame_head_pose_time_;
+
+  // The left eye's view the Cardboard frame was drawn with, in game space,
+  // and the tangent of half of each eye's field of view, to reproject it.
+  mat4 cardboard_drawn_view_;
+  vec2 cardboard_tan_half_fov_;
+  LatencyStats input_latency_;
+  LatencyStats head_pose_latency_;
+
+  // Frames left to record in the frame profile. 0 if it isn't recording.
+  int frame_trace_frames_left_;
+
+  // What the current quality tier allows, beyond what it sets elsewhere.
+  bool render_shadows_;
+  float max_undistort_scale_;
+  // The device's thermal state, and the world time it was last read.
+  ThermalState thermal_state_;
+  WorldTime thermal_read_time_;
+
   // Debug data. For displaying when a character's state has changed.
   std::vector<int> debug_previous_states_;
   std::vector<Angle> debug_previous_angles_;
@@ -266,6 +496,10 @@ class PieNoonGame {
 
   // Tutorial slides we are in the midst of displaying.
   std::vector<std::string> tutorial_slides_;
+  // Which of them we hold a reference on, from PrefetchTutorialSlides().
+  std::vector<bool> tutorial_slides_loaded_;
+  // Whether they're the multiscreen tutorial's slides.
+  bool tutorial_slides_multiscreen_;
 
   // Tutorial aspect ratio
   float tutorial_aspect_ratio_;
@@ -297,6 +531,9 @@ class PieNoonGame {
 
   // Network multiplayer library for multi-screen version
   GPGMultiplayer gpg_multiplayer_;
+  // Messages taken from gpg_multiplayer_ each frame, kept to reuse the
+  // storage.
+  std::vector<GPGMultiplayer::SenderAndMessage> multiplayer_messages_;
 #endif
 };
 
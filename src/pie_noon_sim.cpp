@@ -0,0 +1,460 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Headless simulation of AI-vs-AI matches, for load testing the game logic.
+// Runs GameState with no window, renderer or audio, as fast as it will go.
+//
+//   pie_noon_sim [--json <file>] [matches] [threads]
+//   pie_noon_sim --replay <file>
+//
+// The matches are sharded over a WorkerPool. Each shard plays its matches in
+// a GameState of its own, with its own EntityManager and MotiveEngine, and
+// the shards' results are merged at the end. With --json, the frame rate,
+// frame time percentiles, startup time and peak memory are also written to
+// <file>, for scripts/check_perf_baselines.py to compare against a baseline.
+//
+// With --replay, plays back a multiscreen game recorded by the host (see
+// MultiscreenOptions.record_replays) instead, through a MultiplayerDirector
+// with no network, and reports how much faster than real time it ran.
+
+#include "precompiled.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "ai_controller.h"
+#include "character.h"
+#include "character_state_machine.h"
+#include "character_state_machine_def_generated.h"
+#include "config_generated.h"
+#include "game_state.h"
+#include "mapped_file.h"
+#include "motive/init.h"
+#include "multiplayer_controller.h"
+#include "multiplayer_director.h"
+#include "replay_generated.h"
+#include "utilities.h"
+#include "worker_pool.h"
+
+namespace fpl {
+namespace pie_noon {
+
+static const char kAssetsDir[] = "assets";
+static const char kConfigFileName[] = "config.bin";
+static const char kStateMachineFileName[] = "character_state_machine_def.bin";
+
+static const int kDefaultMatches = 1000;
+// Used when config.simulation_step_time is 0.
+static const WorldTime kDefaultStepTime = 16;
+// Matches that take longer than this, in game time, are abandoned as draws.
+static const WorldTime kMaxMatchTime = 5 * 60 * 1000;
+// Frame times are bucketed by powers of two microseconds, the last bucket
+// holding everything from about 65ms up.
+static const int kFrameTimeBuckets = 17;
+// For the percentiles, frame times are also counted to the microsecond, up to
+// about 16ms.
+static const int kFrameMicrosBuckets = 1 << 14;
+
+// What one seat did, summed over all of the matches.
+struct SeatResults {
+  SeatResults() : wins(0), damage_taken(0) {
+    for (int i = 0; i < kMaxStats; ++i) stats[i] = 0;
+  }
+  int wins;
+  int64_t damage_taken;
+  uint64_t stats[kMaxStats];
+};
+
+struct SimulationResults {
+  SimulationResults()
+      : matches(0), draws(0), frames(0), frame_micros(kFrameMicrosBuckets, 0) {
+    for (int i = 0; i < kFrameTimeBuckets; ++i) frame_times[i] = 0;
+  }
+
+  void Merge(const SimulationResults& other) {
+    matches += other.matches;
+    draws += other.draws;
+    frames += other.frames;
+    for (int i = 0; i < kFrameTimeBuckets; ++i) {
+      frame_times[i] += other.frame_times[i];
+    }
+    for (int i = 0; i < kFrameMicrosBuckets; ++i) {
+      frame_micros[i] += other.frame_micros[i];
+    }
+    if (seats.size() < other.seats.size()) seats.resize(other.seats.size());
+    for (size_t i = 0; i < other.seats.size(); ++i) {
+      seats[i].wins += other.seats[i].wins;
+      seats[i].damage_taken += other.seats[i].damage_taken;
+      for (int j = 0; j < kMaxStats; ++j) {
+        seats[i].stats[j] += other.seats[i].stats[j];
+      }
+    }
+  }
+
+  int matches;
+  int draws;
+  int64_t frames;
+  // Number of frames that took [2^(i-1), 2^i) microseconds to simulate.
+  int64_t frame_times[kFrameTimeBuckets];
+  // Number of frames that took i microseconds, the last holding the rest.
+  std::vector<int64_t> frame_micros;
+  std::vector<SeatResults> seats;
+};
+
+static Uint64 TicksToMicros(Uint64 ticks) {
+  return ticks * 1000000 / SDL_GetPerformanceFrequency();
+}
+
+static int FrameTimeBucket(Uint64 micros) {
+  int bucket = 0;
+  while (bucket < kFrameTimeBuckets - 1 && (micros >> bucket) != 0) ++bucket;
+  return bucket;
+}
+
+// The frame time, in microseconds, that 'percent' of frames took no longer
+// than.
+static int FrameTimePercentile(const SimulationResults& results,
+                               int percent) {
+  const int64_t rank = results.frames * percent / 100;
+  int64_t frames = 0;
+  for (int i = 0; i < kFrameMicrosBuckets; ++i) {
+    frames += results.frame_micros[i];
+    if (frames > rank) return i;
+  }
+  return kFrameMicrosBuckets - 1;
+}
+
+// A match played by AI characters only. Survival mode's usual end condition
+// needs at least one human, so here it ends when one character is left.
+static bool MatchOver(const GameState& game_state, const Config& config) {
+  if (config.game_mode() == GameMode_Survival) {
+    return game_state.pies().size() == 0 &&
+           game_state.NumActiveCharacters() <= 1;
+  }
+  return game_state.IsGameOver();
+}
+
+// Plays matches until 'matches_left' runs out.
+static void SimulateMatches(const Config* config,
+                            const CharacterStateMachineTable* table,
+                            std::atomic<int>* matches_left,
+                            SimulationResults* results) {
+  GameState game_state;
+  game_state.set_config(config);
+  game_state.set_cardboard_config(config);
+  game_state.particle_manager().budget().Initialize(
+      config->particle_budget_frame_time(),
+      config->particle_min_emission_scale());
+
+  std::vector<std::unique_ptr<AiController>> controllers;
+  for (unsigned int i = 0; i < config->character_count(); ++i) {
+    AiController* controller = new AiController();
+    controller->Initialize(&game_state, config, i);
+    controllers.push_back(std::unique_ptr<AiController>(controller));
+    game_state.characters().push_back(std::unique_ptr<Character>(
+        new Character(i, controller, *config, table)));
+  }
+  results->seats.resize(controllers.size());
+
+  const WorldTime step_time = config->simulation_step_time() > 0
+                                  ? config->simulation_step_time()
+                                  : kDefaultStepTime;
+  while (matches_left->fetch_sub(1) > 0) {
+    game_state.Reset(GameState::kNoAnalytics);
+    WorldTime match_time = 0;
+    while (!MatchOver(game_state, *config) && match_time < kMaxMatchTime) {
+      const Uint64 frame_start = SDL_GetPerformanceCounter();
+      for (size_t i = 0; i < controllers.size(); ++i) {
+        controllers[i]->AdvanceFrame(step_time);
+      }
+      // A null audio engine keeps the match silent.
+      game_state.AdvanceFrame(step_time, nullptr);
+      const Uint64 micros =
+          TicksToMicros(SDL_GetPerformanceCounter() - frame_start);
+      results->frame_times[FrameTimeBucket(micros)]++;
+      results->frame_micros[std::min(
+          micros, static_cast<Uint64>(kFrameMicrosBuckets - 1))]++;
+      match_time += step_time;
+      results->frames++;
+    }
+
+    results->matches++;
+    auto& characters = game_state.characters();
+    for (size_t i = 0; i < characters.size(); ++i) {
+      results->seats[i].damage_taken +=
+          config->character_health() - std::max(characters[i]->health(), 0);
+    }
+    if (!MatchOver(game_state, *config)) {
+      results->draws++;
+      continue;
+    }
+    game_state.DetermineWinnersAndLosers();
+    for (size_t i = 0; i < characters.size(); ++i) {
+      if (characters[i]->victory_state() == kVictorious) {
+        results->seats[i].wins++;
+      }
+    }
+  }
+
+  // Characters count their stats over every match they play.
+  for (size_t i = 0; i < game_state.characters().size(); ++i) {
+    for (int j = 0; j < kMaxStats; ++j) {
+      results->seats[i].stats[j] =
+          game_state.characters()[i]->GetStat(static_cast<PlayerStats>(j));
+    }
+  }
+}
+
+// Plays a recorded multiscreen game again, in fixed steps, as fast as it
+// will go. Returns false if it doesn't match the config.
+static bool PlayReplay(const Config* config,
+                       const CharacterStateMachineTable* table,
+                       const Replay* replay) {
+  if (replay->character_count() != config->character_count()) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                 "Replay has %d characters, but the config has %d.\n",
+                 replay->character_count(), config->character_count());
+    return false;
+  }
+
+  GameState game_state;
+  game_state.set_config(config);
+  game_state.set_cardboard_config(config);
+  game_state.set_is_multiscreen(true);
+  game_state.particle_manager().budget().Initialize(
+      config->particle_budget_frame_time(),
+      config->particle_min_emission_scale());
+
+  MultiplayerDirector director;
+  director.Initialize(&game_state, config);
+  std::vector<std::unique_ptr<MultiplayerController>> controllers;
+  for (unsigned int i = 0; i < config->character_count(); ++i) {
+    MultiplayerController* controller = new MultiplayerController();
+    controller->Initialize(&game_state, config);
+    controller->set_character_id(i);
+    director.RegisterController(controller);
+    controllers.push_back(std::unique_ptr<MultiplayerController>(controller));
+    game_state.characters().push_back(std::unique_ptr<Character>(
+        new Character(i, controller, *config, table)));
+  }
+  game_state.RegisterMultiplayerDirector(&director);
+
+  // The same order the game runs them in: controllers, the director, then
+  // the game itself.
+  const WorldTime step_time = config->simulation_step_time() > 0
+                                  ? config->simulation_step_time()
+                                  : kDefaultStepTime;
+  director.set_playback(replay);
+  game_state.Reset(GameState::kNoAnalytics);
+  director.StartGame();
+  // After the last turn, give its pies time to land.
+  WorldTime settle_time =
+      config->multiscreen_options()->start_turn_delay_milliseconds();
+  WorldTime game_time = 0;
+  const Uint64 start = SDL_GetPerformanceCounter();
+  while (!game_state.IsGameOver() && settle_time > 0) {
+    for (size_t i = 0; i < controllers.size(); ++i) {
+      controllers[i]->AdvanceFrame(step_time);
+    }
+    director.AdvanceFrame(step_time);
+    game_state.AdvanceFrame(step_time, nullptr);
+    game_time += step_time;
+    if (director.playback_finished()) settle_time -= step_time;
+  }
+  const double seconds =
+      static_cast<double>(SDL_GetPerformanceCounter() - start) /
+      static_cast<double>(SDL_GetPerformanceFrequency());
+  director.EndGame();
+
+  printf("%d turns, %.1fs of play in %.3fs: %.0fx real time\n",
+         director.turn_number(), game_time / 1000.0, seconds,
+         seconds > 0 ? game_time / 1000.0 / seconds : 0.0);
+  if (!game_state.IsGameOver()) printf("The game didn't finish.\n");
+  for (size_t i = 0; i < game_state.characters().size(); ++i) {
+    printf("player %d: %d health%s\n", static_cast<int>(i) + 1,
+           game_state.characters()[i]->health(),
+           director.IsAIPlayer(static_cast<CharacterId>(i)) ? " (AI)" : "");
+  }
+  return true;
+}
+
+// Write the results of a run of matches as JSON, and close 'file'.
+static bool WriteResults(FILE* file, const SimulationResults& results,
+                         int num_threads, double seconds,
+                         double startup_seconds) {
+  fprintf(file,
+          "{\n"
+          "  \"platform\": \"%s\",\n"
+          "  \"threads\": %d,\n"
+          "  \"matches\": %d,\n"
+          "  \"frames\": %lld,\n"
+          "  \"frames_per_second\": %.0f,\n"
+          "  \"frame_us\": {\"p50\": %d, \"p95\": %d, \"p99\": %d},\n"
+          "  \"startup_ms\": %d,\n"
+          "  \"peak_memory_kb\": %d\n"
+          "}\n",
+          SDL_GetPlatform(), num_threads, results.matches,
+          static_cast<long long>(results.frames),
+          static_cast<double>(results.frames) / seconds,
+          FrameTimePercentile(results, 50), FrameTimePercentile(results, 95),
+          FrameTimePercentile(results, 99),
+          static_cast<int>(startup_seconds * 1000),
+          static_cast<int>(PeakResidentBytes() / 1024));
+  const bool written = !ferror(file);
+  return fclose(file) == 0 && written;
+}
+
+static int RunSimulation(int argc, char* argv[]) {
+  const Uint64 program_start = SDL_GetPerformanceCounter();
+  // The results file and the replay are named relative to where we started,
+  // so are opened before changing to the assets directory.
+  FILE* results_file = nullptr;
+  if (argc > 1 && strcmp(argv[1], "--json") == 0) {
+    results_file = argc > 2 ? fopen(argv[2], "w") : nullptr;
+    if (!results_file) {
+      SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                   "usage: pie_noon_sim [--json <file>] [matches] [threads]\n");
+      return 1;
+    }
+    // The rest of the arguments are read as though it weren't there.
+    argv[2] = argv[0];
+    argv += 2;
+    argc -= 2;
+  }
+  const bool replaying = argc > 1 && strcmp(argv[1], "--replay") == 0;
+  MappedFile replay_source;
+  if (replaying && (argc < 3 || results_file || !replay_source.Open(argv[2]))) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                 "usage: pie_noon_sim --replay <file>\n");
+    return 1;
+  }
+  if (replaying) {
+    flatbuffers::Verifier verifier(
+        static_cast<const uint8_t*>(replay_source.data()),
+        replay_source.size());
+    if (!VerifyReplayBuffer(verifier)) {
+      SDL_LogError(SDL_LOG_CATEGORY_ERROR, "%s isn't a replay.\n", argv[2]);
+      return 1;
+    }
+  }
+  const int num_matches =
+      argc > 1 && !replaying ? atoi(argv[1]) : kDefaultMatches;
+  const int num_threads =
+      argc > 2 && !replaying ? atoi(argv[2]) : SDL_GetCPUCount();
+  if (num_matches <= 0 || num_threads <= 0) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                 "usage: pie_noon_sim [--json <file>] [matches] [threads]\n");
+    return 1;
+  }
+
+  const char* binary_directory = argc > 0 ? argv[0] : "";
+  if (!ChangeToUpstreamDir(binary_directory, kAssetsDir)) return 1;
+
+  MappedFile config_source;
+  MappedFile state_machine_source;
+  if (!config_source.Open(kConfigFileName) ||
+      !state_machine_source.Open(kStateMachineFileName)) {
+    return 1;
+  }
+  const Config* config = GetConfig(config_source.data());
+  const CharacterStateMachineDef* state_machine_def =
+      GetCharacterStateMachineDef(state_machine_source.data());
+  if (!CharacterStateMachineDef_Validate(state_machine_def)) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR, "State machine is invalid.\n");
+    return 1;
+  }
+  CharacterStateMachineTable state_machine_table;
+  state_machine_table.Initialize(state_machine_def);
+
+  // Registration is global, so happens once, before any thread starts.
+  motive::OvershootInit::Register();
+  motive::SmoothInit::Register();
+  motive::MatrixInit::Register();
+
+  // Every match logs its winners, which would swamp the results.
+  SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_WARN);
+  srand(config->simulation_seed());
+
+  if (replaying) {
+    return PlayReplay(config, &state_machine_table,
+                      GetReplay(replay_source.data()))
+               ? 0
+               : 1;
+  }
+
+  // The calling thread runs a shard too.
+  WorkerPool pool;
+  pool.Start(num_threads - 1);
+  std::atomic<int> matches_left(num_matches);
+  std::vector<SimulationResults> shards(num_threads);
+  const Uint64 start = SDL_GetPerformanceCounter();
+  const double startup_seconds =
+      static_cast<double>(start - program_start) /
+      static_cast<double>(SDL_GetPerformanceFrequency());
+  pool.RunTasks(shards.size(), [&](size_t i) {
+    SimulateMatches(config, &state_machine_table, &matches_left, &shards[i]);
+  });
+  const double seconds =
+      static_cast<double>(SDL_GetPerformanceCounter() - start) /
+      static_cast<double>(SDL_GetPerformanceFrequency());
+  pool.Stop();
+
+  SimulationResults total;
+  for (size_t i = 0; i < shards.size(); ++i) {
+    total.Merge(shards[i]);
+  }
+
+  printf("%d matches on %d threads in %.2fs: %.1f matches/s, %.0f frames/s\n",
+         total.matches, num_threads, seconds, total.matches / seconds,
+         static_cast<double>(total.frames) / seconds);
+  printf("%d draws\n", total.draws);
+  for (size_t i = 0; i < total.seats.size(); ++i) {
+    const SeatResults& seat = total.seats[i];
+    printf(
+        "player %d: %.1f%% wins, %.1f damage taken per match, "
+        "%llu attacks, %llu hits, %llu blocks\n",
+        static_cast<int>(i) + 1, 100.0 * seat.wins / total.matches,
+        static_cast<double>(seat.damage_taken) / total.matches,
+        static_cast<unsigned long long>(seat.stats[kAttacks]),
+        static_cast<unsigned long long>(seat.stats[kHits]),
+        static_cast<unsigned long long>(seat.stats[kBlocks]));
+  }
+  printf("frame times:\n");
+  for (int i = 0; i < kFrameTimeBuckets; ++i) {
+    if (total.frame_times[i] == 0) continue;
+    printf("  %s%dus: %lld\n", i == kFrameTimeBuckets - 1 ? ">= " : "< ",
+           i == kFrameTimeBuckets - 1 ? 1 << (i - 1) : 1 << i,
+           static_cast<long long>(total.frame_times[i]));
+  }
+  printf("frame time p50 %dus, p95 %dus, p99 %dus\n",
+         FrameTimePercentile(total, 50), FrameTimePercentile(total, 95),
+         FrameTimePercentile(total, 99));
+  if (results_file &&
+      !WriteResults(results_file, total, num_threads, seconds,
+                    startup_seconds)) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Couldn't write the results.\n");
+    return 1;
+  }
+  return 0;
+}
+
+}  // pie_noon
+}  // fpl
+
+int main(int argc, char* argv[]) {
+  return fpl::pie_noon::RunSimulation(argc, argv);
+}
+
+MATHFU_DEFINE_GLOBAL_SIMD_AWARE_NEW_DELETE
@@ -0,0 +1,137 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "precompiled.h"
+#include "pie_pool.h"
+#include "particle_kernel.h"
+
+using mathfu::vec3;
+using mathfu::mat3;
+using mathfu::mat4;
+
+namespace fpl {
+namespace pie_noon {
+
+void PiePool::Add(const AirbornePie& pie, const vec3& source_position,
+                  const vec3& target_position, float start_height,
+                  float peak_height, int rotations, float y_rotation) {
+  assert(pie.flight_time() > 0);
+  const size_t i = pies_.size();
+  pies_.push_back(pie);
+  Resize(i + 1);
+  const float flight_time = static_cast<float>(pie.flight_time());
+
+  // Move x,z at constant speed from source to target.
+  //
+  // Move y along a trajectory that starts and ends at 'start_height' and
+  // tops out at 'peak_height' half way through.
+  // Since deceleration is constant, and velocity at the peak is zero,
+  // the average velocity from start to peak is,
+  //       0.5(start_velocity + 0)
+  //
+  // At peak, height is average velocity times travel time, so
+  //       peak_height = 0.5(start_velocity + 0)*peak_time
+  // Which implies,
+  //    start_velocity = 2 * delta_height / peak_time
+  const float peak_time = 0.5f * flight_time;
+  const float delta_height = peak_height - start_height;
+  const float start_velocity = 2.0f * delta_height / peak_time;
+  start_positions_.Set(
+      i, vec3(source_position.x(), start_height, source_position.z()));
+  velocities_.Set(
+      i, vec3((target_position.x() - source_position.x()) / flight_time,
+              start_velocity,
+              (target_position.z() - source_position.z()) / flight_time));
+  accelerations_.Set(i, vec3(0.0f, -start_velocity / peak_time, 0.0f));
+
+  // The pie rotates top to bottom a fixed number of times. Rotation speed
+  // is constant. It's rotated about Y a constant amount.
+  spins_[i] = rotations * kTwoPi / flight_time;
+  y_rotations_[i] = mat3::RotationY(y_rotation);
+
+  UpdateTransforms(i, i + 1, pie.start_time());
+}
+
+void PiePool::Remove(size_t index) {
+  const size_t last = pies_.size() - 1;
+  if (index != last) {
+    pies_[index] = pies_[last];
+    start_positions_.Move(last, index);
+    velocities_.Move(last, index);
+    accelerations_.Move(last, index);
+    spins_[index] = spins_[last];
+    y_rotations_[index] = y_rotations_[last];
+    ages_[index] = ages_[last];
+    positions_.Move(last, index);
+    z_rotations_[index] = z_rotations_[last];
+    matrices_[index] = matrices_[last];
+  }
+  pies_.pop_back();
+  Resize(last);
+}
+
+void PiePool::Clear() {
+  pies_.clear();
+  Resize(0);
+}
+
+void PiePool::UpdateTransforms(WorldTime time) {
+  UpdateTransforms(0, pies_.size(), time);
+}
+
+// Shrinking keeps the arrays' capacity, so pies thrown later reuse it.
+void PiePool::Resize(size_t size) {
+  start_positions_.resize(size);
+  velocities_.resize(size);
+  accelerations_.resize(size);
+  spins_.resize(size);
+  y_rotations_.resize(size);
+  ages_.resize(size);
+  positions_.resize(size);
+  z_rotations_.resize(size);
+  matrices_.resize(size);
+}
+
+void PiePool::UpdateTransforms(size_t begin, size_t end, WorldTime time) {
+  if (begin >= end) return;
+  const size_t count = end - begin;
+  for (size_t i = begin; i < end; ++i) {
+    ages_[i] = static_cast<float>(time - pies_[i].start_time());
+  }
+  const float* ages = &ages_[begin];
+  ParticleIntegrateQuadratic(&start_positions_.x[begin],
+                             &velocities_.x[begin], &accelerations_.x[begin],
+                             ages, count, &positions_.x[begin]);
+  ParticleIntegrateQuadratic(&start_positions_.y[begin],
+                             &velocities_.y[begin], &accelerations_.y[begin],
+                             ages, count, &positions_.y[begin]);
+  ParticleIntegrateQuadratic(&start_positions_.z[begin],
+                             &velocities_.z[begin], &accelerations_.z[begin],
+                             ages, count, &positions_.z[begin]);
+  for (size_t i = begin; i < end; ++i) {
+    z_rotations_[i] = spins_[i] * ages_[i];
+  }
+
+  // Translate, then rotate about Y, then about Z.
+  for (size_t i = begin; i < end; ++i) {
+    matrices_[i] =
+        mat4::FromTranslationVector(positions_.Get(i)) *
+        mat4::FromRotationMatrix(y_rotations_[i] *
+                                 mat3::RotationZ(z_rotations_[i]));
+  }
+}
+
+}  // pie_noon
+}  // fpl
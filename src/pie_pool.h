@@ -0,0 +1,90 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PIE_NOON_PIE_POOL_H_
+#define PIE_NOON_PIE_POOL_H_
+
+#include <vector>
+#include "character.h"
+#include "particles.h"
+
+namespace fpl {
+namespace pie_noon {
+
+// Every pie in flight. Each pie's arc is kept as a structure of arrays, in
+// the layout the kernels in particle_kernel.h work on, so that one pass
+// finds where they all are. A pie that lands frees its slot for the next one
+// thrown, and the arrays keep their capacity, so throwing a pie doesn't
+// allocate once the pool has held that many. As with ParticleManager,
+// removing a pie moves the last one into its slot, so indices are only
+// stable until the next Remove().
+class PiePool {
+ public:
+  // Throws 'pie' from 'source_position' to 'target_position'. Its arc starts
+  // and ends at 'start_height', and tops out at 'peak_height' half way
+  // through. It turns top to bottom 'rotations' times on the way, and turns
+  // 'y_rotation' radians about Y.
+  void Add(const AirbornePie& pie, const mathfu::vec3& source_position,
+           const mathfu::vec3& target_position, float start_height,
+           float peak_height, int rotations, float y_rotation);
+
+  // Removes the pie at 'index', moving the last pie into its place.
+  void Remove(size_t index);
+
+  // Removes every pie.
+  void Clear();
+
+  // Places every pie where it is 'time' after it was thrown.
+  void UpdateTransforms(WorldTime time);
+
+  size_t size() const { return pies_.size(); }
+  const AirbornePie& operator[](size_t index) const { return pies_[index]; }
+
+  // Where the pie at 'index' is, as of the last call to UpdateTransforms()
+  // or Add().
+  const mathfu::mat4& Matrix(size_t index) const { return matrices_[index]; }
+  mathfu::vec3 Position(size_t index) const {
+    return positions_.Get(index);
+  }
+
+ private:
+  void Resize(size_t size);
+
+  // Places the pies in [begin, end).
+  void UpdateTransforms(size_t begin, size_t end, WorldTime time);
+
+  std::vector<AirbornePie> pies_;
+
+  // Each pie's arc, as a function of the time t since it was thrown:
+  //   position = start_position + velocity * t + acceleration * t^2 / 2
+  //   turn about Z = spin * t
+  // and then a constant turn about Y.
+  ParticleVec3Array start_positions_;
+  ParticleVec3Array velocities_;
+  ParticleVec3Array accelerations_;
+  std::vector<float> spins_;
+  std::vector<mathfu::mat3> y_rotations_;
+
+  // Each pie's state as of the last update.
+  std::vector<float> ages_;
+  ParticleVec3Array positions_;
+  std::vector<float> z_rotations_;
+  std::vector<mathfu::mat4> matrices_;
+};
+
+}  // pie_noon
+}  // fpl
+
+#endif  // PIE_NOON_PIE_POOL_H_
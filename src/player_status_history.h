@@ -0,0 +1,72 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PLAYER_STATUS_HISTORY_H_
+#define PLAYER_STATUS_HISTORY_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace fpl {
+namespace pie_noon {
+
+// The multiscreen player statuses sent most recently, by sequence number.
+//
+// The host keeps the statuses it sent, and the clients keep the ones they
+// received, so that a PlayerStatusDelta can be sent against any status a
+// client has acknowledged, as long as it's recent enough to still be here.
+class PlayerStatusHistory {
+ public:
+  struct Snapshot {
+    Snapshot() : sequence(0), valid(false) {}
+    uint16_t sequence;
+    bool valid;
+    std::vector<uint8_t> player_health;
+    std::vector<uint32_t> player_splats;
+  };
+
+  // Number of statuses kept. Older ones are forgotten.
+  static const int kSize = 16;
+
+  PlayerStatusHistory() : snapshots_(kSize) {}
+
+  // Forget every status.
+  void Clear() {
+    for (size_t i = 0; i < snapshots_.size(); ++i) snapshots_[i].valid = false;
+  }
+
+  // Record a status, replacing the oldest one. Returns the new snapshot, for
+  // the caller to fill in. Its storage is reused from the one it replaces.
+  Snapshot *Add(uint16_t sequence) {
+    Snapshot &snapshot = snapshots_[sequence % kSize];
+    snapshot.sequence = sequence;
+    snapshot.valid = true;
+    return &snapshot;
+  }
+
+  // The status numbered 'sequence', or nullptr if it's not been kept.
+  const Snapshot *Find(uint16_t sequence) const {
+    const Snapshot &snapshot = snapshots_[sequence % kSize];
+    return snapshot.valid && snapshot.sequence == sequence ? &snapshot
+                                                           : nullptr;
+  }
+
+ private:
+  std::vector<Snapshot> snapshots_;
+};
+
+}  // pie_noon
+}  // fpl
+
+#endif  // PLAYER_STATUS_HISTORY_H_
@@ -0,0 +1,101 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "quality_governor.h"
+
+namespace fpl {
+namespace pie_noon {
+
+// Weight of each new frame time in the moving average. Lower than the
+// other governors', since tiers are coarse and changing them is visible.
+static const float kAverageWeight = 0.05f;
+
+// Drop a tier when the average is this far over budget.
+static const float kOverBudget = 1.15f;
+
+// Climb a tier only when the average is this far under budget.
+static const float kUnderBudget = 0.85f;
+
+// A climb that's followed by a drop within this many climb times failed.
+static const float kFailedClimbTime = 2.0f;
+
+// The most a failed climb can put off the next one by, in step up times.
+static const float kMaxClimbBackoff = 8.0f;
+
+QualityGovernor::QualityGovernor()
+    : tier_count_(1),
+      tier_(0),
+      target_frame_time_(0.0f),
+      step_down_time_(0.0f),
+      step_up_time_(0.0f),
+      average_frame_time_(0.0f),
+      time_at_tier_(0.0f),
+      climb_time_(0.0f),
+      climbed_(false) {}
+
+void QualityGovernor::Initialize(int tier_count, float target_frame_time,
+                                 float step_down_time, float step_up_time) {
+  tier_count_ = std::max(tier_count, 1);
+  tier_ = 0;
+  target_frame_time_ = target_frame_time;
+  step_down_time_ = step_down_time;
+  step_up_time_ = step_up_time;
+  average_frame_time_ = target_frame_time;
+  time_at_tier_ = 0.0f;
+  climb_time_ = step_up_time;
+  climbed_ = false;
+}
+
+bool QualityGovernor::Update(float frame_time, ThermalState thermal) {
+  if (target_frame_time_ <= 0.0f || tier_count_ <= 1) return false;
+
+  average_frame_time_ += (frame_time - average_frame_time_) * kAverageWeight;
+  time_at_tier_ += frame_time;
+
+  const bool over_budget =
+      average_frame_time_ > target_frame_time_ * kOverBudget ||
+      thermal == kThermalHot;
+  if (over_budget && tier_ + 1 < tier_count_ &&
+      time_at_tier_ >= step_down_time_) {
+    // Back off the next climb if this undoes the last one soon after it.
+    if (climbed_) {
+      climb_time_ = time_at_tier_ < climb_time_ * kFailedClimbTime
+                        ? std::min(climb_time_ * 2.0f,
+                                   step_up_time_ * kMaxClimbBackoff)
+                        : step_up_time_;
+    }
+    tier_++;
+    time_at_tier_ = 0.0f;
+    climbed_ = false;
+    // Start from the budget, so the next tier gets a fair chance.
+    average_frame_time_ = target_frame_time_;
+    return true;
+  }
+
+  const bool under_budget =
+      average_frame_time_ < target_frame_time_ * kUnderBudget &&
+      (thermal == kThermalNominal || thermal == kThermalUnknown);
+  if (under_budget && tier_ > 0 && time_at_tier_ >= climb_time_) {
+    tier_--;
+    time_at_tier_ = 0.0f;
+    climbed_ = true;
+    average_frame_time_ = target_frame_time_;
+    return true;
+  }
+  return false;
+}
+
+}  // pie_noon
+}  // fpl
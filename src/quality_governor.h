@@ -0,0 +1,77 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_QUALITY_GOVERNOR_H
+#define FPL_QUALITY_GOVERNOR_H
+
+namespace fpl {
+namespace pie_noon {
+
+// How hot the device is running, where the platform can tell. Low battery is
+// reported as kThermalWarm, since it calls for the same caution.
+enum ThermalState {
+  kThermalUnknown,
+  kThermalNominal,
+  // Hold the current quality, rather than climbing back up.
+  kThermalWarm,
+  // Shed quality even if frames are on budget, before the device throttles.
+  kThermalHot,
+};
+
+// Steps through quality tiers, from 0 (the best) down, to hold a frame rate
+// over long sessions on devices that slow down as they heat up.
+//
+// The tier drops when the average frame time has been over budget, or the
+// device hot, for a while, and climbs back once frames have been well under
+// budget and the device cool for much longer. If frames go over budget
+// again soon after a climb, the next climb waits twice as long, so that a
+// device on the edge of a tier doesn't keep flipping between them.
+class QualityGovernor {
+ public:
+  QualityGovernor();
+
+  // 'tier_count' is the number of tiers. 'target_frame_time' is the frame
+  // time, in ms, to hold; zero disables the governor. A tier is kept for at
+  // least 'step_down_time' ms before dropping, and 'step_up_time' ms before
+  // climbing.
+  void Initialize(int tier_count, float target_frame_time,
+                  float step_down_time, float step_up_time);
+
+  // Record the duration of the most recent frame, in ms, and the device's
+  // thermal state. Returns true if tier() has changed as a result.
+  bool Update(float frame_time, ThermalState thermal);
+
+  // The current tier, from 0 to tier_count - 1.
+  int tier() const { return tier_; }
+
+ private:
+  int tier_count_;
+  int tier_;
+  float target_frame_time_;
+  float step_down_time_;
+  float step_up_time_;
+  // Exponential moving average of recent frame times.
+  float average_frame_time_;
+  // Ms of frames since the last change of tier.
+  float time_at_tier_;
+  // How long to wait before the next climb, which grows after failed ones.
+  float climb_time_;
+  // True if the last change was a climb.
+  bool climbed_;
+};
+
+}  // pie_noon
+}  // fpl
+
+#endif  // FPL_QUALITY_GOVERNOR_H
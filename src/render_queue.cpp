@@ -0,0 +1,87 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "render_queue.h"
+
+namespace fpl {
+
+static const int kShaderBits = 8;
+static const int kMaterialBits = 16;
+static const int kDepthBits = 24;
+static const int kUnusedBits = 15;
+static const uint32_t kMaxShaderId = (1 << kShaderBits) - 1;
+static const uint32_t kMaxMaterialId = (1 << kMaterialBits) - 1;
+static const uint32_t kMaxDepth = (1 << kDepthBits) - 1;
+static const uint64_t kBlendedBit = static_cast<uint64_t>(1) << 63;
+
+uint32_t RenderQueue::StateId(const void* state, uint32_t max_id) {
+  auto it = state_ids_.find(state);
+  if (it != state_ids_.end()) return it->second;
+
+  // Running out of ids only costs us batching, not correctness, so share the
+  // last id between all the overflow states.
+  const uint32_t id =
+      std::min(static_cast<uint32_t>(state_ids_.size()), max_id);
+  state_ids_[state] = id;
+  return id;
+}
+
+uint32_t RenderQueue::QuantizeDepth(float depth) const {
+  if (depth <= 0.0f) return 0;
+  if (depth_bucket_size_ > 0.0f) {
+    const float bucket = depth / depth_bucket_size_;
+    return bucket >= static_cast<float>(kMaxDepth)
+               ? kMaxDepth
+               : static_cast<uint32_t>(bucket);
+  }
+  // The bit pattern of a positive float increases with its value, so the top
+  // bits (below the sign bit) sort the same way the float does.
+  uint32_t bits;
+  memcpy(&bits, &depth, sizeof(bits));
+  return bits >> (31 - kDepthBits);
+}
+
+uint64_t RenderQueue::StateKey(const void* shader,
+                               const Material* material) {
+  const uint64_t shader_id = StateId(shader, kMaxShaderId);
+  const uint64_t material_id = StateId(material, kMaxMaterialId);
+  const bool blended =
+      material != nullptr && material->blend_mode() != kBlendModeOff &&
+      material->blend_mode() != kBlendModeTest;
+  if (blended) {
+    return kBlendedBit | (shader_id << (kMaterialBits + kUnusedBits)) |
+           (material_id << kUnusedBits);
+  }
+  return (shader_id << (kMaterialBits + kDepthBits + kUnusedBits)) |
+         (material_id << (kDepthBits + kUnusedBits));
+}
+
+void RenderQueue::Add(uint64_t state_key, float depth, uint32_t index) {
+  const uint64_t depth_key = QuantizeDepth(depth);
+  const uint64_t key =
+      (state_key & kBlendedBit)
+          ? state_key | ((kMaxDepth - depth_key)
+                         << (kShaderBits + kMaterialBits + kUnusedBits))
+          : state_key | (depth_key << kUnusedBits);
+  Entry entry = { key, index };
+  entries_.push_back(entry);
+}
+
+void RenderQueue::Sort() {
+  std::stable_sort(entries_.begin(), entries_.end(),
+                   [](const Entry& a, const Entry& b) { return a.key < b.key; });
+}
+
+}  // namespace fpl
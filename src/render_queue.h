@@ -0,0 +1,91 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_RENDER_QUEUE_H
+#define FPL_RENDER_QUEUE_H
+
+#include <unordered_map>
+#include <vector>
+#include "material.h"
+
+namespace fpl {
+
+// Orders draw calls so that consecutive draws share as much GPU state as
+// possible, without breaking the back-to-front order that blended materials
+// need.
+//
+// Each entry is a 64-bit key plus the index of the item it draws. The key is
+// laid out so that a plain integer sort gives the submission order:
+//
+//   opaque (kBlendModeOff, kBlendModeTest):
+//     [ 0:1 | shader:8 | material:16 | depth front-to-back:24 | unused:15 ]
+//   blended (everything else):
+//     [ 1:1 | depth back-to-front:24 | shader:8 | material:16 | unused:15 ]
+//
+// Opaque draws are grouped by state, since the depth buffer resolves their
+// visibility. Blended draws are depth sorted first, and only fall back to
+// state order when they land in the same depth bucket.
+class RenderQueue {
+ public:
+  struct Entry {
+    uint64_t key;
+    uint32_t index;
+  };
+
+  RenderQueue() : depth_bucket_size_(0.0f) {}
+
+  // Remove all entries. Keeps the allocated storage and the state ids.
+  void Clear() { entries_.clear(); }
+
+  // Queue the item 'index' (the meaning of which is up to the caller).
+  // 'depth' is any non-negative measure of distance from the camera.
+  void Add(const void* shader, const Material* material, float depth,
+           uint32_t index) {
+    Add(StateKey(shader, material), depth, index);
+  }
+
+  // The shader and material part of the key, which doesn't change from frame
+  // to frame, so callers can work it out once and pass it to Add().
+  uint64_t StateKey(const void* shader, const Material* material);
+
+  // Queue the item 'index', drawn with the state of 'state_key'.
+  void Add(uint64_t state_key, float depth, uint32_t index);
+
+  // Sort the queued entries into submission order. Entries with equal keys
+  // keep the order in which they were added.
+  void Sort();
+
+  const std::vector<Entry>& entries() const { return entries_; }
+
+  // Blended draws within this distance of each other are considered to be at
+  // the same depth, and are sorted by state instead. Zero means exact depth.
+  void set_depth_bucket_size(float size) { depth_bucket_size_ = size; }
+  float depth_bucket_size() const { return depth_bucket_size_; }
+
+ private:
+  // Map a state object onto a small integer. Ids are allocated in order of
+  // first use, and are stable for the lifetime of the queue.
+  uint32_t StateId(const void* state, uint32_t max_id);
+
+  // Convert 'depth' into an integer that sorts in the same order.
+  uint32_t QuantizeDepth(float depth) const;
+
+  std::vector<Entry> entries_;
+  std::unordered_map<const void*, uint32_t> state_ids_;
+  float depth_bucket_size_;
+};
+
+}  // namespace fpl
+
+#endif  // FPL_RENDER_QUEUE_H
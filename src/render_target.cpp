@@ -0,0 +1,125 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "render_target.h"
+#include "renderer.h"
+
+namespace fpl {
+
+RenderTarget::RenderTarget()
+    : framebuffer_(0),
+      texture_(0),
+      size_(mathfu::kZeros2i),
+      previous_framebuffer_(0) {
+  for (int i = 0; i < 4; ++i) previous_viewport_[i] = 0;
+}
+
+bool RenderTarget::Initialize(const vec2i &size) {
+#ifdef __ANDROID__
+  if (valid() && size == size_) return true;
+
+  if (!texture_) {
+    GL_CALL(glGenTextures(1, &texture_));
+    GL_CALL(glBindTexture(GL_TEXTURE_2D, texture_));
+    GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+                            GL_CLAMP_TO_EDGE));
+    GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+                            GL_CLAMP_TO_EDGE));
+    // The target is drawn back at its own resolution.
+    GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+    GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+  }
+  // Respecifying the storage keeps the texture, so the framebuffer's
+  // attachment remains valid.
+  GL_CALL(glBindTexture(GL_TEXTURE_2D, texture_));
+  GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size.x(), size.y(), 0,
+                       GL_RGBA, GL_UNSIGNED_BYTE, nullptr));
+  size_ = size;
+
+  if (!framebuffer_) {
+    GLint previous = 0;
+    GL_CALL(glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous));
+    GL_CALL(glGenFramebuffers(1, &framebuffer_));
+    GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_));
+    GL_CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                   GL_TEXTURE_2D, texture_, 0));
+    const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, previous));
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+      SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                   "Render target incomplete: 0x%x\n", status);
+      Delete();
+      return false;
+    }
+  }
+  return true;
+#else
+  (void)size;
+  return false;
+#endif  // __ANDROID__
+}
+
+void RenderTarget::Delete() {
+#ifdef __ANDROID__
+  if (framebuffer_) GL_CALL(glDeleteFramebuffers(1, &framebuffer_));
+  if (texture_) GL_CALL(glDeleteTextures(1, &texture_));
+#endif  // __ANDROID__
+  framebuffer_ = 0;
+  texture_ = 0;
+  size_ = mathfu::kZeros2i;
+}
+
+void RenderTarget::Begin(Renderer &renderer) {
+  assert(valid());
+#ifdef __ANDROID__
+  // We may be inside another framebuffer, e.g. the one for Cardboard.
+  GL_CALL(glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous_framebuffer_));
+  GL_CALL(glGetIntegerv(GL_VIEWPORT, previous_viewport_));
+  GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_));
+  GL_CALL(glViewport(0, 0, size_.x(), size_.y()));
+  renderer.ClearFrameBuffer(mathfu::kZeros4f);
+#else
+  (void)renderer;
+#endif  // __ANDROID__
+}
+
+void RenderTarget::End() {
+#ifdef __ANDROID__
+  GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, previous_framebuffer_));
+  GL_CALL(glViewport(previous_viewport_[0], previous_viewport_[1],
+                     previous_viewport_[2], previous_viewport_[3]));
+#endif  // __ANDROID__
+}
+
+void RenderTarget::Draw(Renderer &renderer, Shader *shader,
+                        const vec3 &bottom_left, const vec3 &top_right) {
+  assert(valid());
+  renderer.color() = mathfu::kOnes4f;
+  shader->Set(renderer);
+  GL_CALL(glActiveTexture(GL_TEXTURE0));
+  GL_CALL(glBindTexture(GL_TEXTURE_2D, texture_));
+
+  // The color in the target is already multiplied by its alpha. There's no
+  // BlendMode for that, so set it directly, with the renderer believing
+  // blending is off, and leave it that way.
+  renderer.SetBlendMode(kBlendModeOff);
+  GL_CALL(glEnable(GL_BLEND));
+  GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+  // Texture row 0 is the bottom of the target.
+  Mesh::RenderAAQuadAlongX(bottom_left, top_right, vec2(0, 0), vec2(1, 1));
+  GL_CALL(glDisable(GL_BLEND));
+}
+
+}  // namespace fpl
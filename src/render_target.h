@@ -0,0 +1,67 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_RENDER_TARGET_H
+#define FPL_RENDER_TARGET_H
+
+#include "shader.h"
+
+namespace fpl {
+
+class Renderer;
+
+// An offscreen color buffer, that can be rendered into once and then drawn
+// as a single textured quad for as long as its contents stay valid.
+//
+// Like the Cardboard framebuffer, this is only implemented on Android for now.
+// Elsewhere Initialize() fails, and callers should render directly instead.
+class RenderTarget {
+ public:
+  RenderTarget();
+  ~RenderTarget() { Delete(); }
+
+  // Create the buffer, or resize it if it exists already. Returns false if
+  // render targets are not supported.
+  bool Initialize(const vec2i &size);
+  void Delete();
+
+  // Redirect rendering into the target, cleared to transparent black, until
+  // End() restores the previous framebuffer and viewport.
+  //
+  // Alpha blended rendering leaves premultiplied color in the target, which
+  // Draw() composites accordingly.
+  void Begin(Renderer &renderer);
+  void End();
+
+  // Draw the contents of the target from 'bottom_left' to 'top_right' in the
+  // current projection, with 'shader' (which samples texture unit 0).
+  void Draw(Renderer &renderer, Shader *shader, const vec3 &bottom_left,
+            const vec3 &top_right);
+
+  bool valid() const { return framebuffer_ != 0; }
+  const vec2i &size() const { return size_; }
+
+ private:
+  GLuint framebuffer_;
+  GLuint texture_;
+  vec2i size_;
+
+  // State saved by Begin(), and restored by End().
+  GLint previous_framebuffer_;
+  GLint previous_viewport_[4];
+};
+
+}  // namespace fpl
+
+#endif  // FPL_RENDER_TARGET_H
@@ -14,6 +14,9 @@
 
 #include "precompiled.h"
 #include "renderer.h"
+#include "frame_profiler.h"
+#include "mapped_file.h"
+#include "memory_accounting.h"
 #include "utilities.h"
 
 #include "webp/decode.h"
@@ -55,11 +58,6 @@ bool Renderer::Initialize(const vec2i &window_size, const char *window_title) {
   SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 6);
   SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 5);
 
-  // In some Android devices (particulary Galaxy Nexus), there is an issue
-  // of glGenerateMipmap() with 16BPP texture format.
-  // In that case, we are going to fallback to 888/8888 textures
-  use_16bpp_ = fpl::MipmapGeneration16bppSupported();
-
   // Create the window:
   window_ = SDL_CreateWindow(
       window_title, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
@@ -123,7 +121,16 @@ bool Renderer::Initialize(const vec2i &window_size, const char *window_title) {
 #undef GLEXT
 #endif
 
-      blend_mode_ = kBlendModeOff;
+  InitializeInstancing();
+  InitializeVertexArrays();
+  InitializeTextureCompression();
+  InitializeQuantizedVertices();
+  InitializePixelBuffers();
+  InitializeGpuTimers();
+  InitializeProgramBinaries();
+  CreateContextProbe();
+
+  blend_mode_ = kBlendModeOff;
 
 // Set up undistortion framebuffer for Cardboard, using the scaled resolution
 // of the device, as it will be what is rendered at the end
@@ -135,18 +142,29 @@ bool Renderer::Initialize(const vec2i &window_size, const char *window_title) {
 (void)undistortFramebufferId_;
 (void)undistortTextureId_;
 (void)undistortRenderbufferId_;
+(void)reprojectFramebufferId_;
+(void)reprojectTextureId_;
 #endif
 
   return true;
 }
 
+RenderStats Renderer::frame_stats_;
+RenderStats Renderer::last_frame_stats_;
+
 void Renderer::AdvanceFrame(bool minimized) {
+  last_frame_stats_ = frame_stats_;
+  frame_stats_.Clear();
+  Mesh::AdvanceStreamingFrame();
   if (minimized) {
     // Save some cpu / battery:
     SDL_Delay(10);
-  } else {
+  } else if (!presented_) {
     SDL_GL_SwapWindow(window_);
   }
+  presented_ = false;
+  CollectGpuTimers();
+  CollectPixelBuffers();
   // Get window size again, just in case it has changed.
   SDL_GetWindowSize(window_, &window_size_.x(), &window_size_.y());
 #ifdef __ANDROID__
@@ -162,6 +180,25 @@ void Renderer::AdvanceFrame(bool minimized) {
 
 void Renderer::ShutDown() {
   if (context_) {
+    Mesh::DeleteStreamingBuffers();
+    if (context_probe_) {
+      GL_CALL(glDeleteTextures(1, &context_probe_));
+      context_probe_ = 0;
+    }
+    if (SupportsGpuTimers()) {
+      for (int i = 0; i < kGpuTimerCount; ++i) {
+        GL_CALL(delete_queries_(1, &gpu_timers_[i].query));
+      }
+      get_query_objectui64v_ = nullptr;
+      gpu_timer_count_ = 0;
+      gpu_timer_open_ = false;
+    }
+    for (auto it = pixel_buffers_.begin(); it != pixel_buffers_.end(); ++it) {
+      if (it->fence) delete_sync_(it->fence);
+      GL_CALL(glDeleteBuffers(1, &it->buffer));
+      MemoryAccounting::RemoveBuffer(it->buffer);
+    }
+    pixel_buffers_.clear();
     SDL_GL_DeleteContext(context_);
     context_ = nullptr;
   }
@@ -171,105 +208,442 @@ void Renderer::ShutDown() {
   }
 }
 
+void Renderer::CreateContextProbe() {
+  // A name only becomes a texture once it's bound, and needs no storage.
+  GL_CALL(glGenTextures(1, &context_probe_));
+  GL_CALL(glBindTexture(GL_TEXTURE_2D, context_probe_));
+  GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+}
+
+bool Renderer::CheckContextLoss() {
+  if (!context_ || glIsTexture(context_probe_)) return false;
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "GL context lost, restoring\n");
+  // SDL makes a new context when the old one can't be made current again.
+  SDL_GLContext current = SDL_GL_GetCurrentContext();
+  if (current) context_ = current;
+  RestoreContextObjects();
+  return true;
+}
+
+void Renderer::RestoreContextObjects() {
+  // Nothing made in the old context can be deleted, since its names may
+  // have been reused already. They're forgotten instead.
+  MemoryAccounting::ForgetGpuAllocations();
+  Mesh::ForgetStreamingBuffers();
+  pixel_buffers_.clear();
+  pending_program_binaries_.clear();
+  if (SupportsGpuTimers()) {
+    for (int i = 0; i < kGpuTimerCount; ++i) {
+      GL_CALL(gen_queries_(1, &gpu_timers_[i].query));
+    }
+  }
+  gpu_timer_first_ = 0;
+  gpu_timer_count_ = 0;
+  gpu_timer_open_ = false;
+  // The new context starts with the default state.
+  blend_mode_ = kBlendModeOff;
+  CreateContextProbe();
+
+  // The reprojection target is made again on first use. The undistortion
+  // framebuffer is made at its full size, then scaled back down.
+  reprojectFramebufferId_ = 0;
+  reprojectTextureId_ = 0;
+  if (undistortFramebufferId_) {
+    const vec2i size = undistort_size_;
+    InitializeUndistortFramebuffer(undistort_full_size_.x(),
+                                   undistort_full_size_.y());
+    if (size != undistort_full_size_) ResizeUndistortFramebuffer(size);
+  }
+}
+
 void Renderer::ClearFrameBuffer(const vec4 &color) {
   GL_CALL(glClearColor(color.x(), color.y(), color.z(), color.w()));
   GL_CALL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
 }
 
-GLuint Renderer::CompileShader(GLenum stage, GLuint program,
-                               const GLchar *source) {
-  std::string platform_source =
+// Prepended to every shader's source, to paper over the differences between
+// GLSL ES and desktop GLSL.
+static const char *const kShaderSourcePrefix =
 #ifdef PLATFORM_MOBILE
-      "#ifdef GL_ES\nprecision highp float;\n#endif\n";
+    "#ifdef GL_ES\nprecision highp float;\n#endif\n";
 #else
-      "#version 120\n#define lowp\n#define mediump\n#define highp\n";
+    "#version 120\n#define lowp\n#define mediump\n#define highp\n";
 #endif
+
+// The vertex attribute each Mesh attribute slot is bound to.
+struct AttributeBinding {
+  GLuint location;
+  const char *name;
+};
+static const AttributeBinding kAttributeBindings[] = {
+  { Mesh::kAttributePosition, "aPosition" },
+  { Mesh::kAttributeNormal, "aNormal" },
+  { Mesh::kAttributeTangent, "aTangent" },
+  { Mesh::kAttributeTexCoord, "aTexCoord" },
+  { Mesh::kAttributeColor, "aColor" },
+  { Mesh::kAttributeInstanceRow0, "aInstanceRow0" },
+  { Mesh::kAttributeInstanceRow1, "aInstanceRow1" },
+  { Mesh::kAttributeInstanceRow2, "aInstanceRow2" },
+  { Mesh::kAttributeParticleVelocity, "aParticleVelocity" },
+  { Mesh::kAttributeParticleOffset, "aParticleOffset" },
+  { Mesh::kAttributeParticleOrientation, "aParticleOrientation" },
+  { Mesh::kAttributeParticleAngularVelocity, "aParticleAngularVelocity" },
+  { Mesh::kAttributeParticleScale, "aParticleScale" },
+};
+
+// Program binary files start with this, followed by the binary itself.
+struct ProgramBinaryHeader {
+  uint32_t magic;
+  uint32_t format;
+};
+static const uint32_t kProgramBinaryMagic = 0x42504c46;  // "FLPB"
+
+// Whether the shader compiled isn't asked here, since asking waits for the
+// driver to finish. FinishLinkShader() asks once the program has linked.
+GLuint Renderer::CompileShader(GLenum stage, GLuint program,
+                               const GLchar *source) {
+  std::string platform_source = kShaderSourcePrefix;
   platform_source += source;
   const char *platform_source_ptr = platform_source.c_str();
   auto shader_obj = glCreateShader(stage);
   GL_CALL(glShaderSource(shader_obj, 1, &platform_source_ptr, nullptr));
   GL_CALL(glCompileShader(shader_obj));
-  GLint success;
-  GL_CALL(glGetShaderiv(shader_obj, GL_COMPILE_STATUS, &success));
-  if (success) {
-    GL_CALL(glAttachShader(program, shader_obj));
-    return shader_obj;
-  } else {
-    GLint length = 0;
-    GL_CALL(glGetShaderiv(shader_obj, GL_INFO_LOG_LENGTH, &length));
-    last_error_.assign(length, '\0');
-    GL_CALL(glGetShaderInfoLog(shader_obj, length, &length, &last_error_[0]));
-    GL_CALL(glDeleteShader(shader_obj));
-    return 0;
-  }
+  GL_CALL(glAttachShader(program, shader_obj));
+  return shader_obj;
 }
 
 Shader *Renderer::CompileAndLinkShader(const char *vs_source,
                                        const char *ps_source) {
+  auto shader = BeginLinkShader(vs_source, ps_source);
+  if (shader && !FinishLinkShader(shader)) {
+    delete shader;
+    shader = nullptr;
+  }
+  return shader;
+}
+
+Shader *Renderer::BeginLinkShader(const char *vs_source,
+                                  const char *ps_source) {
+  std::string binary_filename;
+  if (SupportsProgramBinaries() && !program_binary_directory_.empty()) {
+    binary_filename = ProgramBinaryFilename(vs_source, ps_source);
+    const GLuint program = LoadProgramBinary(binary_filename);
+    if (program) return new Shader(program, 0, 0);
+  }
+
   auto program = glCreateProgram();
+  if (!program) {
+    last_error_ = "could not create a shader program";
+    return nullptr;
+  }
   auto vs = CompileShader(GL_VERTEX_SHADER, program, vs_source);
-  if (vs) {
-    auto ps = CompileShader(GL_FRAGMENT_SHADER, program, ps_source);
-    if (ps) {
-      GL_CALL(
-          glBindAttribLocation(program, Mesh::kAttributePosition, "aPosition"));
-      GL_CALL(glBindAttribLocation(program, Mesh::kAttributeNormal, "aNormal"));
-      GL_CALL(
-          glBindAttribLocation(program, Mesh::kAttributeTangent, "aTangent"));
-      GL_CALL(
-          glBindAttribLocation(program, Mesh::kAttributeTexCoord, "aTexCoord"));
-      GL_CALL(glBindAttribLocation(program, Mesh::kAttributeColor, "aColor"));
-      GL_CALL(glLinkProgram(program));
-      GLint status;
-      GL_CALL(glGetProgramiv(program, GL_LINK_STATUS, &status));
-      if (status == GL_TRUE) {
-        auto shader = new Shader(program, vs, ps);
-        GL_CALL(glUseProgram(program));
-        shader->InitializeUniforms();
-        return shader;
-      }
+  auto ps = CompileShader(GL_FRAGMENT_SHADER, program, ps_source);
+  for (size_t i = 0;
+       i < sizeof(kAttributeBindings) / sizeof(kAttributeBindings[0]); ++i) {
+    GL_CALL(glBindAttribLocation(program, kAttributeBindings[i].location,
+                                 kAttributeBindings[i].name));
+  }
+  if (!binary_filename.empty()) {
+    if (program_parameteri_) {
+      GL_CALL(program_parameteri_(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                                  GL_TRUE));
+    }
+    pending_program_binaries_[program] = binary_filename;
+  }
+  GL_CALL(glLinkProgram(program));
+  return new Shader(program, vs, ps);
+}
+
+bool Renderer::FinishLinkShader(Shader *shader) {
+  const GLuint program = shader->program();
+  std::string binary_filename;
+  auto pending = pending_program_binaries_.find(program);
+  if (pending != pending_program_binaries_.end()) {
+    binary_filename.swap(pending->second);
+    pending_program_binaries_.erase(pending);
+  }
+
+  GLint status;
+  GL_CALL(glGetProgramiv(program, GL_LINK_STATUS, &status));
+  if (status == GL_TRUE) {
+    if (!binary_filename.empty()) SaveProgramBinary(program, binary_filename);
+    GL_CALL(glUseProgram(program));
+    shader->InitializeUniforms();
+    return true;
+  }
+
+  // Report the first stage that didn't compile, or else why it didn't link.
+  const GLuint stages[] = { shader->vs(), shader->ps() };
+  for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); ++i) {
+    GLint compiled = GL_TRUE;
+    if (stages[i]) {
+      GL_CALL(glGetShaderiv(stages[i], GL_COMPILE_STATUS, &compiled));
+    }
+    if (!compiled) {
       GLint length = 0;
-      GL_CALL(glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length));
+      GL_CALL(glGetShaderiv(stages[i], GL_INFO_LOG_LENGTH, &length));
       last_error_.assign(length, '\0');
-      GL_CALL(glGetProgramInfoLog(program, length, &length, &last_error_[0]));
-      GL_CALL(glDeleteShader(ps));
+      GL_CALL(glGetShaderInfoLog(stages[i], length, &length, &last_error_[0]));
+      return false;
     }
-    GL_CALL(glDeleteShader(vs));
   }
-  GL_CALL(glDeleteProgram(program));
-  return nullptr;
+  GLint length = 0;
+  GL_CALL(glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length));
+  last_error_.assign(length, '\0');
+  GL_CALL(glGetProgramInfoLog(program, length, &length, &last_error_[0]));
+  return false;
+}
+
+std::string Renderer::ProgramBinaryFilename(const char *vs_source,
+                                            const char *ps_source) const {
+  uint64_t hash =
+      HashBytes(vs_source, strlen(vs_source), program_binary_driver_key_);
+  hash = HashBytes(ps_source, strlen(ps_source), hash);
+  char name[32];
+  snprintf(name, sizeof(name), "shader_%016llx.bin",
+           static_cast<unsigned long long>(hash));
+  return program_binary_directory_ + name;
+}
+
+GLuint Renderer::LoadProgramBinary(const std::string &filename) {
+  SDL_RWops *handle = SDL_RWFromFile(filename.c_str(), "rb");
+  if (!handle) return 0;
+  const Sint64 size = SDL_RWsize(handle);
+  std::vector<uint8_t> contents(size > 0 ? static_cast<size_t>(size) : 0);
+  const bool read =
+      !contents.empty() &&
+      SDL_RWread(handle, contents.data(), 1, contents.size()) ==
+          contents.size();
+  SDL_RWclose(handle);
+  ProgramBinaryHeader header;
+  if (!read || contents.size() <= sizeof(header)) return 0;
+  memcpy(&header, contents.data(), sizeof(header));
+  if (header.magic != kProgramBinaryMagic) return 0;
+
+  const GLint length = static_cast<GLint>(contents.size() - sizeof(header));
+  auto program = glCreateProgram();
+  GL_CALL(program_binary_(program, header.format,
+                          contents.data() + sizeof(header), length));
+  GLint status = GL_FALSE;
+  GL_CALL(glGetProgramiv(program, GL_LINK_STATUS, &status));
+  if (status != GL_TRUE) {
+    // Drivers may stop accepting their old binaries without changing their
+    // version string, so this isn't an error. The program is compiled from
+    // source instead, and its new binary replaces this one.
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Program binary %s rejected by the driver\n",
+                filename.c_str());
+    GL_CALL(glDeleteProgram(program));
+    return 0;
+  }
+  return program;
+}
+
+void Renderer::SaveProgramBinary(GLuint program, const std::string &filename) {
+  GLint length = 0;
+  GL_CALL(glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length));
+  if (length <= 0) return;
+  std::vector<uint8_t> contents(sizeof(ProgramBinaryHeader) + length);
+  ProgramBinaryHeader header = { kProgramBinaryMagic, 0 };
+  GLsizei written = 0;
+  GLenum format = 0;
+  GL_CALL(get_program_binary_(program, length, &written, &format,
+                              contents.data() + sizeof(header)));
+  if (written <= 0) return;
+  header.format = format;
+  memcpy(contents.data(), &header, sizeof(header));
+  contents.resize(sizeof(header) + written);
+  SDL_RWops *handle = SDL_RWFromFile(filename.c_str(), "wb");
+  if (!handle) return;
+  SDL_RWwrite(handle, contents.data(), 1, contents.size());
+  SDL_RWclose(handle);
+}
+
+// Pack 'count' pixels from 'buffer' into 'dest', which has room for them.
+static void Pack8888To5551(const uint8_t *buffer, int count, uint16_t *dest) {
+  for (int i = 0; i < count; i++) {
+    auto c = &buffer[i * 4];
+    dest[i] = ((c[0] >> 3) << 11) | ((c[1] >> 3) << 6) | ((c[2] >> 3) << 1) |
+              ((c[3] >> 7) << 0);
+  }
+}
+
+static void Pack888To565(const uint8_t *buffer, int count, uint16_t *dest) {
+  for (int i = 0; i < count; i++) {
+    auto c = &buffer[i * 3];
+    dest[i] = ((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | ((c[2] >> 3) << 0);
+  }
 }
 
 uint16_t *Renderer::Convert8888To5551(const uint8_t *buffer,
                                       const vec2i &size) {
   auto buffer16 = new uint16_t[size.x() * size.y()];
-  for (int i = 0; i < size.x() * size.y(); i++) {
-    auto c = &buffer[i * 4];
-    buffer16[i] = ((c[0] >> 3) << 11) | ((c[1] >> 3) << 6) |
-                  ((c[2] >> 3) << 1) | ((c[3] >> 7) << 0);
-  }
+  Pack8888To5551(buffer, size.x() * size.y(), buffer16);
   return buffer16;
 }
 
 uint16_t *Renderer::Convert888To565(const uint8_t *buffer, const vec2i &size) {
   auto buffer16 = new uint16_t[size.x() * size.y()];
-  for (int i = 0; i < size.x() * size.y(); i++) {
-    auto c = &buffer[i * 3];
-    buffer16[i] = ((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | ((c[2] >> 3) << 0);
-  }
+  Pack888To565(buffer, size.x() * size.y(), buffer16);
   return buffer16;
 }
 
-GLuint Renderer::CreateTexture(const uint8_t *buffer, const vec2i &size,
-                               bool has_alpha, TextureFormat desired) {
+static vec2i MipLevelSize(const vec2i &size, int level) {
+  return vec2i(std::max(1, size.x() >> level), std::max(1, size.y() >> level));
+}
+
+int Renderer::MipLevelCount(const vec2i &size) {
+  int levels = 1;
+  for (int extent = std::max(size.x(), size.y()); extent > 1; extent /= 2) {
+    levels++;
+  }
+  return levels;
+}
+
+size_t Renderer::MipChainSize(const vec2i &size, int bytes_per_pixel,
+                              int levels) {
+  size_t total = 0;
+  for (int level = 0; level < levels; level++) {
+    const vec2i level_size = MipLevelSize(size, level);
+    total += static_cast<size_t>(level_size.x()) * level_size.y() *
+             bytes_per_pixel;
+  }
+  return total;
+}
+
+// Average each 2x2 block of 'src' into one pixel of 'dest'. A dimension that
+// is already 1 is left as it is.
+static void DownsampleMipLevel(const uint8_t *src, const vec2i &src_size,
+                               int bytes_per_pixel, uint8_t *dest) {
+  const int width = std::max(1, src_size.x() / 2);
+  const int height = std::max(1, src_size.y() / 2);
+  const int step_x = src_size.x() > 1 ? bytes_per_pixel : 0;
+  const int step_y = src_size.y() > 1 ? src_size.x() * bytes_per_pixel : 0;
+  for (int y = 0; y < height; y++) {
+    const uint8_t *row =
+        src + (src_size.y() > 1 ? 2 * y : y) * src_size.x() * bytes_per_pixel;
+    for (int x = 0; x < width; x++) {
+      const uint8_t *p = row + (src_size.x() > 1 ? 2 * x : x) * bytes_per_pixel;
+      for (int c = 0; c < bytes_per_pixel; c++) {
+        *dest++ = static_cast<uint8_t>(
+            (p[c] + p[c + step_x] + p[c + step_y] + p[c + step_x + step_y] +
+             2) / 4);
+      }
+    }
+  }
+}
+
+// Set how 'prepared' is passed to glTexImage2D in 'desired', which mustn't be
+// kFormatAuto. Returns false if 'desired' doesn't suit an image with or
+// without alpha, as 'has_alpha' says.
+static bool SetUploadFormat(TextureFormat desired, bool has_alpha,
+                            PreparedTexture *prepared) {
+  switch (desired) {
+    case kFormat5551:
+      prepared->format = GL_RGBA;
+      prepared->type = GL_UNSIGNED_SHORT_5_5_5_1;
+      prepared->bytes_per_pixel = 2;
+      return has_alpha;
+    case kFormat565:
+      prepared->format = GL_RGB;
+      prepared->type = GL_UNSIGNED_SHORT_5_6_5;
+      prepared->bytes_per_pixel = 2;
+      return !has_alpha;
+    case kFormat8888:
+      prepared->format = GL_RGBA;
+      prepared->type = GL_UNSIGNED_BYTE;
+      prepared->bytes_per_pixel = 4;
+      return has_alpha;
+    case kFormat888:
+      prepared->format = GL_RGB;
+      prepared->type = GL_UNSIGNED_BYTE;
+      prepared->bytes_per_pixel = 3;
+      return !has_alpha;
+    case kFormatLuminance:
+      prepared->format = GL_LUMINANCE;
+      prepared->type = GL_UNSIGNED_BYTE;
+      prepared->bytes_per_pixel = 1;
+      return !has_alpha;
+    default:
+      return false;
+  }
+}
+
+bool Renderer::PrepareTexture(const uint8_t *buffer, const vec2i &size,
+                              bool has_alpha, TextureFormat desired,
+                              int mip_levels, PreparedTexture *prepared) {
   int area = size.x() * size.y();
   if (area & (area - 1)) {
     SDL_LogError(SDL_LOG_CATEGORY_ERROR,
                  "CreateTexture: not power of two in size: (%d,%d)", size.x(),
                  size.y());
+    return false;
+  }
+  if (desired == kFormatAuto) desired = has_alpha ? kFormat5551 : kFormat565;
+  const int bytes_per_pixel =
+      desired == kFormatLuminance ? 1 : has_alpha ? 4 : 3;
+  if (!SetUploadFormat(desired, has_alpha, prepared)) {
+    assert(0);
+    return false;
+  }
+
+  // Levels the caller didn't supply are filtered down from the smallest one
+  // they did. Doing this ourselves rather than with glGenerateMipmap() works
+  // for 16bpp formats on every driver.
+  const int levels = MipLevelCount(size);
+  mip_levels = std::max(1, std::min(mip_levels, levels));
+  std::vector<uint8_t> generated(
+      MipChainSize(size, bytes_per_pixel, levels) -
+      MipChainSize(size, bytes_per_pixel, mip_levels));
+  prepared->size = size;
+  prepared->pixels.resize(
+      MipChainSize(size, prepared->bytes_per_pixel, levels));
+
+  const uint8_t *pixels = buffer;
+  uint8_t *next_generated = generated.data();
+  uint8_t *dest = prepared->pixels.data();
+  for (int level = 0; level < levels; level++) {
+    const vec2i level_size = MipLevelSize(size, level);
+    if (level > 0) {
+      const vec2i prev_size = MipLevelSize(size, level - 1);
+      if (level < mip_levels) {
+        pixels += static_cast<size_t>(prev_size.x()) * prev_size.y() *
+                  bytes_per_pixel;
+      } else {
+        DownsampleMipLevel(pixels, prev_size, bytes_per_pixel, next_generated);
+        pixels = next_generated;
+        next_generated += static_cast<size_t>(level_size.x()) *
+                          level_size.y() * bytes_per_pixel;
+      }
+    }
+    const int count = level_size.x() * level_size.y();
+    if (desired == kFormat5551) {
+      Pack8888To5551(pixels, count, reinterpret_cast<uint16_t *>(dest));
+    } else if (desired == kFormat565) {
+      Pack888To565(pixels, count, reinterpret_cast<uint16_t *>(dest));
+    } else {
+      memcpy(dest, pixels, static_cast<size_t>(count) * bytes_per_pixel);
+    }
+    dest += static_cast<size_t>(count) * prepared->bytes_per_pixel;
+  }
+  return true;
+}
+
+GLuint Renderer::CreateTexture(const uint8_t *buffer, const vec2i &size,
+                               bool has_alpha, TextureFormat desired,
+                               int mip_levels) {
+  PreparedTexture prepared;
+  if (!PrepareTexture(buffer, size, has_alpha, desired, mip_levels,
+                      &prepared)) {
     return 0;
   }
-  // TODO: support default args for mipmap/wrap/trilinear
+  return CreateTexture(prepared);
+}
+
+GLuint Renderer::CreateTexture(const PreparedTexture &prepared,
+                               int first_level) {
+  if (prepared.pixels.empty()) return 0;
+  // TODO: support default args for wrap/trilinear
   GLuint texture_id;
   GL_CALL(glGenTextures(1, &texture_id));
   GL_CALL(glActiveTexture(GL_TEXTURE0));
@@ -280,59 +654,189 @@ GLuint Renderer::CreateTexture(const uint8_t *buffer, const vec2i &size,
   GL_CALL(
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
                       GL_LINEAR_MIPMAP_NEAREST /*GL_LINEAR_MIPMAP_LINEAR*/));
-  if (desired == kFormatAuto) desired = has_alpha ? kFormat5551 : kFormat565;
-  switch (desired) {
-    case kFormat5551: {
-      assert(has_alpha);
-      if (use_16bpp_) {
-        auto buffer16 = Convert8888To5551(buffer, size);
-        GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size.x(), size.y(), 0,
-                             GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, buffer16));
-        delete[] buffer16;
-      } else {
-        // Fallback to 8888
-        GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size.x(), size.y(), 0,
-                             GL_RGBA, GL_UNSIGNED_BYTE, buffer));
-      }
-      break;
-    }
-    case kFormat565: {
-      assert(!has_alpha);
-      if (use_16bpp_) {
-        auto buffer16 = Convert888To565(buffer, size);
-        GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, size.x(), size.y(), 0,
-                             GL_RGB, GL_UNSIGNED_SHORT_5_6_5, buffer16));
-        delete[] buffer16;
-      } else {
-        // Fallback to 888
-        GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, size.x(), size.y(), 0,
-                             GL_RGB, GL_UNSIGNED_BYTE, buffer));
-      }
-      break;
+
+  const int levels = MipLevelCount(prepared.size);
+  first_level = std::max(0, std::min(first_level, levels - 1));
+  const size_t first_offset =
+      MipChainSize(prepared.size, prepared.bytes_per_pixel, first_level);
+  const uint8_t *pixels = prepared.pixels.data() + first_offset;
+  const size_t bytes = prepared.pixels.size() - first_offset;
+  // If the pixels are staged in a pixel buffer, offsets into it stand in for
+  // the pointers.
+  const int staging = StagePixels(pixels, bytes);
+
+  // The smaller levels have rows that aren't a multiple of 4 bytes long.
+  GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+  size_t offset = 0;
+  for (int level = first_level; level < levels; level++) {
+    const vec2i level_size = MipLevelSize(prepared.size, level);
+    const GLvoid *data = staging >= 0
+                             ? reinterpret_cast<const GLvoid *>(offset)
+                             : static_cast<const GLvoid *>(pixels + offset);
+    GL_CALL(glTexImage2D(GL_TEXTURE_2D, level - first_level, prepared.format,
+                         level_size.x(), level_size.y(), 0, prepared.format,
+                         prepared.type, data));
+    const size_t level_bytes = static_cast<size_t>(level_size.x()) *
+                               level_size.y() * prepared.bytes_per_pixel;
+    CountUpload(level_bytes);
+    offset += level_bytes;
+  }
+  GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+  if (staging >= 0) FenceStagedPixels(staging);
+  MemoryAccounting::AddTexture(texture_id, bytes);
+  return texture_id;
+}
+
+int Renderer::StagePixels(const uint8_t *pixels, size_t size) {
+  if (!SupportsPixelBuffers() || size < kMinStagedPixelBytes) return -1;
+  // Use the smallest free buffer that's big enough, or else make another,
+  // or else grow the largest free one.
+  int fitting = -1;
+  int largest_free = -1;
+  for (size_t i = 0; i < pixel_buffers_.size(); ++i) {
+    const PixelBuffer &buffer = pixel_buffers_[i];
+    if (buffer.fence) continue;
+    if (buffer.size >= size &&
+        (fitting < 0 || buffer.size < pixel_buffers_[fitting].size)) {
+      fitting = static_cast<int>(i);
     }
-    case kFormat8888: {
-      assert(has_alpha);
-      GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size.x(), size.y(), 0,
-                           GL_RGBA, GL_UNSIGNED_BYTE, buffer));
-      break;
+    if (largest_free < 0 || buffer.size > pixel_buffers_[largest_free].size) {
+      largest_free = static_cast<int>(i);
     }
-    case kFormat888: {
-      assert(!has_alpha);
-      GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, size.x(), size.y(), 0,
-                           GL_RGB, GL_UNSIGNED_BYTE, buffer));
-      break;
+  }
+  int staging = fitting;
+  if (staging < 0 && pixel_buffers_.size() < kMaxPixelBuffers) {
+    PixelBuffer buffer = { 0, 0, nullptr };
+    GL_CALL(glGenBuffers(1, &buffer.buffer));
+    pixel_buffers_.push_back(buffer);
+    staging = static_cast<int>(pixel_buffers_.size()) - 1;
+  }
+  if (staging < 0) staging = largest_free;
+  // Every buffer is still being read by the GPU. Waiting for one would stall
+  // just as the driver's copy does, so upload without staging.
+  if (staging < 0) return -1;
+
+  PixelBuffer &buffer = pixel_buffers_[staging];
+  GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.buffer));
+  if (buffer.size < size) {
+    GL_CALL(glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr,
+                         GL_STREAM_DRAW));
+    MemoryAccounting::AddBuffer(buffer.buffer, size);
+    buffer.size = size;
+  }
+  void *mapped = map_buffer_range_(
+      GL_PIXEL_UNPACK_BUFFER, 0, size,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  if (mapped) {
+    memcpy(mapped, pixels, size);
+    // The contents are lost if the buffer became corrupt while mapped.
+    if (unmap_buffer_(GL_PIXEL_UNPACK_BUFFER)) return staging;
+  }
+  GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+  return -1;
+}
+
+void Renderer::FenceStagedPixels(int staging) {
+  pixel_buffers_[staging].fence =
+      fence_sync_(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+}
+
+void Renderer::CollectPixelBuffers() {
+  for (auto it = pixel_buffers_.begin(); it != pixel_buffers_.end(); ++it) {
+    if (!it->fence) continue;
+    const GLenum status = client_wait_sync_(it->fence, 0, 0);
+    if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+      delete_sync_(it->fence);
+      it->fence = nullptr;
     }
-    case kFormatLuminance: {
-      assert(!has_alpha);
-      GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, size.x(), size.y(),
-                           0, GL_LUMINANCE, GL_UNSIGNED_BYTE, buffer));
-      break;
+  }
+}
+
+GLuint Renderer::CreateTextureFromKTX(const uint8_t *ktx_buf, size_t size,
+                                      vec2i *dimensions, bool *has_alpha) {
+  struct KTX {
+    uint8_t identifier[12];
+    uint32_t endianness, gl_type, gl_type_size, gl_format, gl_internal_format,
+        gl_base_internal_format, pixel_width, pixel_height, pixel_depth,
+        number_of_array_elements, number_of_faces, number_of_mipmap_levels,
+        bytes_of_key_value_data;
+  };
+  static_assert(sizeof(KTX) == 64,
+                "Members of struct KTX need to be packed with no padding.");
+  static const uint8_t kIdentifier[12] = { 0xAB, 'K',  'T',  'X', ' ',  '1',
+                                           '1',  0xBB, '\r', '\n', 0x1A, '\n' };
+  auto header = reinterpret_cast<const KTX *>(ktx_buf);
+  if (size < sizeof(KTX) ||
+      memcmp(header->identifier, kIdentifier, sizeof(kIdentifier)) ||
+      header->endianness != 0x04030201 ||  // Written with our endianness.
+      header->gl_type != 0 ||              // Compressed.
+      header->pixel_depth > 1 || header->number_of_array_elements > 1 ||
+      header->number_of_faces != 1) {
+    last_error_ = "KTX: not a compressed 2D texture";
+    return 0;
+  }
+  const GLenum format = header->gl_internal_format;
+  const bool is_etc2 = format == GL_COMPRESSED_RGB8_ETC2 ||
+                       format == GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2 ||
+                       format == GL_COMPRESSED_RGBA8_ETC2_EAC;
+  const bool is_astc = format >= GL_COMPRESSED_RGBA_ASTC_4x4_KHR &&
+                       format <= GL_COMPRESSED_RGBA_ASTC_12x12_KHR;
+  if (!(is_etc2 && supports_etc2_) && !(is_astc && supports_astc_)) {
+    last_error_ = "KTX: compressed format not supported by this GPU";
+    return 0;
+  }
+  const int levels =
+      std::max(1, static_cast<int>(header->number_of_mipmap_levels));
+
+  GLuint texture_id;
+  GL_CALL(glGenTextures(1, &texture_id));
+  GL_CALL(glActiveTexture(GL_TEXTURE0));
+  GL_CALL(glBindTexture(GL_TEXTURE_2D, texture_id));
+  GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT));
+  GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT));
+  GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+  // Compressed textures can't have their mips generated by GL, so only
+  // sample from mips that are in the file.
+  GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                          levels > 1 ? GL_LINEAR_MIPMAP_NEAREST : GL_LINEAR));
+
+  size_t offset = sizeof(KTX) + header->bytes_of_key_value_data;
+  size_t gpu_bytes = 0;
+  int width = header->pixel_width;
+  int height = header->pixel_height;
+  for (int level = 0; level < levels; level++) {
+    uint32_t image_size;
+    if (offset + sizeof(image_size) > size) break;
+    memcpy(&image_size, ktx_buf + offset, sizeof(image_size));
+    offset += sizeof(image_size);
+    if (offset + image_size > size) break;
+    GL_CALL(glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height,
+                                   0, image_size, ktx_buf + offset));
+    CountUpload(image_size);
+    gpu_bytes += image_size;
+    // Each level is padded to a multiple of 4 bytes.
+    offset += (image_size + 3) & ~3;
+    width = std::max(1, width / 2);
+    height = std::max(1, height / 2);
+    if (level == levels - 1) {
+      *dimensions = vec2i(header->pixel_width, header->pixel_height);
+      *has_alpha = format != GL_COMPRESSED_RGB8_ETC2;
+      MemoryAccounting::AddTexture(texture_id, gpu_bytes);
+      return texture_id;
     }
-    default:
-      assert(0);
   }
-  GL_CALL(glGenerateMipmap(GL_TEXTURE_2D));
-  return texture_id;
+  GL_CALL(glDeleteTextures(1, &texture_id));
+  last_error_ = "KTX: file truncated";
+  return 0;
+}
+
+std::string Renderer::CompressedTextureFilename(
+    const std::string &filename) const {
+  const char *suffix =
+      supports_astc_ ? ".astc.ktx" : supports_etc2_ ? ".etc2.ktx" : nullptr;
+  if (!suffix) return std::string();
+  return filename.substr(0, filename.find_last_of('.')) + suffix;
 }
 
 uint8_t *Renderer::UnpackTGA(const void *tga_buf, vec2i *dimensions,
@@ -382,24 +886,202 @@ uint8_t *Renderer::UnpackTGA(const void *tga_buf, vec2i *dimensions,
   return dest;
 }
 
+// One of the images in a WebP file.
+struct WebPImage {
+  const uint8_t *data;
+  size_t size;
+};
+
+// build_assets.py appends the smaller mip levels of a texture to its WebP
+// file, each as a complete WebP image of its own. Find the first
+// 'max_levels' of them in 'data', stopping early at any that's missing or
+// isn't the right size.
+static void FindWebPLevels(const uint8_t *data, size_t size,
+                           const vec2i &dimensions, int max_levels,
+                           std::vector<WebPImage> *levels) {
+  size_t offset = 0;
+  while (static_cast<int>(levels->size()) < max_levels) {
+    // Each image is a RIFF chunk: "RIFF", little endian size, then payload.
+    uint32_t riff_size = 0;
+    if (offset + 8 > size || memcmp(data + offset, "RIFF", 4)) break;
+    memcpy(&riff_size, data + offset + 4, sizeof(riff_size));
+    const size_t image_size = 8 + riff_size;
+    if (offset + image_size > size) break;
+    const vec2i level_size =
+        MipLevelSize(dimensions, static_cast<int>(levels->size()));
+    int width = 0;
+    int height = 0;
+    if (!WebPGetInfo(data + offset, image_size, &width, &height) ||
+        width != level_size.x() || height != level_size.y()) {
+      break;
+    }
+    WebPImage image = { data + offset, image_size };
+    levels->push_back(image);
+    // RIFF chunks are padded to an even size.
+    offset += (image_size + 1) & ~static_cast<size_t>(1);
+  }
+}
+
+// WebP images are fed to the decoder this many bytes at a time, so it gets
+// on with each part of a mapped file while the rest is paged in.
+static const size_t kWebPChunkSize = 64 * 1024;
+// Images with at least this many pixels are decoded with a second thread
+// doing the filtering, when libwebp is built with threads.
+static const int kWebPThreadedPixels = 256 * 256;
+
+// Decode 'image', which is 'size' pixels, into 'out' in 'mode', which takes
+// 'bytes_per_pixel'. Returns false if the image is corrupt.
+static bool DecodeWebP(const WebPImage &image, WEBP_CSP_MODE mode,
+                       const vec2i &size, int bytes_per_pixel, uint8_t *out) {
+  WebPDecoderConfig config;
+  if (!WebPInitDecoderConfig(&config)) return false;
+  config.options.use_threads = size.x() * size.y() >= kWebPThreadedPixels;
+  config.output.colorspace = mode;
+  config.output.is_external_memory = 1;
+  config.output.u.RGBA.rgba = out;
+  config.output.u.RGBA.stride = size.x() * bytes_per_pixel;
+  config.output.u.RGBA.size =
+      static_cast<size_t>(size.x()) * size.y() * bytes_per_pixel;
+  WebPIDecoder *decoder = WebPIDecode(nullptr, 0, &config);
+  if (!decoder) return false;
+  VP8StatusCode status = VP8_STATUS_SUSPENDED;
+  for (size_t offset = 0;
+       offset < image.size && status == VP8_STATUS_SUSPENDED;
+       offset += kWebPChunkSize) {
+    status = WebPIAppend(decoder, image.data + offset,
+                         std::min(kWebPChunkSize, image.size - offset));
+  }
+  WebPIDelete(decoder);
+  return status == VP8_STATUS_OK;
+}
+
+// libwebp writes MODE_RGB_565 with red in the first byte, unless it's built
+// with WEBP_SWAP_16BIT_CSP, which ours isn't. GL reads each pixel as a
+// native 16 bit value.
+static void WebP565ToNative(uint8_t *pixels, int count) {
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+  for (int i = 0; i < count; i++) std::swap(pixels[2 * i], pixels[2 * i + 1]);
+#else
+  (void)pixels;
+  (void)count;
+#endif
+}
+
 uint8_t *Renderer::UnpackWebP(const void *webp_buf, size_t size,
-                              vec2i *dimensions, bool *has_alpha) {
+                              vec2i *dimensions, bool *has_alpha,
+                              int *mip_levels) {
+  auto data = static_cast<const uint8_t *>(webp_buf);
   WebPBitstreamFeatures features;
-  auto status =
-      WebPGetFeatures(static_cast<const uint8_t *>(webp_buf), size, &features);
+  auto status = WebPGetFeatures(data, size, &features);
   if (status != VP8_STATUS_OK) return nullptr;
   *has_alpha = features.has_alpha != 0;
-  if (features.has_alpha) {
-    return WebPDecodeRGBA(static_cast<const uint8_t *>(webp_buf), size,
-                          &dimensions->x(), &dimensions->y());
-  } else {
-    return WebPDecodeRGB(static_cast<const uint8_t *>(webp_buf), size,
-                         &dimensions->x(), &dimensions->y());
+  *dimensions = vec2i(features.width, features.height);
+  const int bytes_per_pixel = *has_alpha ? 4 : 3;
+
+  // Decode as many of the mip levels as are there.
+  const int max_levels = mip_levels ? MipLevelCount(*dimensions) : 1;
+  std::vector<WebPImage> images;
+  FindWebPLevels(data, size, *dimensions, max_levels, &images);
+  if (images.empty()) return nullptr;
+  auto buffer = static_cast<uint8_t *>(malloc(MipChainSize(
+      *dimensions, bytes_per_pixel, static_cast<int>(images.size()))));
+  uint8_t *out = buffer;
+  int level = 0;
+  for (; level < static_cast<int>(images.size()); level++) {
+    const vec2i level_size = MipLevelSize(*dimensions, level);
+    if (!DecodeWebP(images[level], *has_alpha ? MODE_RGBA : MODE_RGB,
+                    level_size, bytes_per_pixel, out)) {
+      break;
+    }
+    out += static_cast<size_t>(level_size.x()) * level_size.y() *
+           bytes_per_pixel;
+  }
+  if (level == 0) {
+    free(buffer);
+    return nullptr;
   }
+  if (mip_levels) *mip_levels = level;
+  return buffer;
+}
+
+bool Renderer::LoadAndPrepareWebP(const char *filename, TextureFormat desired,
+                                  PreparedTexture *prepared,
+                                  vec2i *dimensions, bool *has_alpha) {
+  const size_t length = strlen(filename);
+  if (length < 5 || strcmp(filename + length - 5, ".webp")) return false;
+  MappedFile file;
+  if (!file.Open(filename)) return false;
+  auto data = static_cast<const uint8_t *>(file.data());
+  WebPBitstreamFeatures features;
+  if (WebPGetFeatures(data, file.size(), &features) != VP8_STATUS_OK) {
+    return false;
+  }
+  const bool alpha = features.has_alpha != 0;
+  const vec2i size(features.width, features.height);
+  const int area = size.x() * size.y();
+  if (area & (area - 1)) return false;
+  if (desired == kFormatAuto) desired = alpha ? kFormat5551 : kFormat565;
+  PreparedTexture result;
+  if (desired == kFormatLuminance ||
+      !SetUploadFormat(desired, alpha, &result)) {
+    return false;
+  }
+
+  // Levels missing from the file are filtered down from the ones before,
+  // which only works in place for the 8 bit per channel formats.
+  // PrepareTexture() does it for the others.
+  const int levels = MipLevelCount(size);
+  const int bytes_per_pixel = result.bytes_per_pixel;
+  std::vector<WebPImage> images;
+  FindWebPLevels(data, file.size(), size, levels, &images);
+  const int decoded_levels = static_cast<int>(images.size());
+  if (decoded_levels == 0 ||
+      (bytes_per_pixel == 2 && decoded_levels < levels)) {
+    return false;
+  }
+
+  result.size = size;
+  result.pixels.resize(MipChainSize(size, bytes_per_pixel, levels));
+  // libwebp has no 5551 mode, so those levels are decoded into this and
+  // packed from there.
+  std::vector<uint8_t> scratch(desired == kFormat5551 ? area * 4 : 0);
+  uint8_t *dest = result.pixels.data();
+  for (int level = 0; level < levels; level++) {
+    const vec2i level_size = MipLevelSize(size, level);
+    const int count = level_size.x() * level_size.y();
+    if (level >= decoded_levels) {
+      const vec2i prev_size = MipLevelSize(size, level - 1);
+      DownsampleMipLevel(
+          dest - static_cast<size_t>(prev_size.x()) * prev_size.y() *
+                     bytes_per_pixel,
+          prev_size, bytes_per_pixel, dest);
+    } else if (desired == kFormat5551) {
+      if (!DecodeWebP(images[level], MODE_RGBA, level_size, 4,
+                      scratch.data())) {
+        return false;
+      }
+      Pack8888To5551(scratch.data(), count, reinterpret_cast<uint16_t *>(dest));
+    } else {
+      const WEBP_CSP_MODE mode = desired == kFormat565
+                                     ? MODE_RGB_565
+                                     : alpha ? MODE_RGBA : MODE_RGB;
+      if (!DecodeWebP(images[level], mode, level_size, bytes_per_pixel,
+                      dest)) {
+        return false;
+      }
+      if (desired == kFormat565) WebP565ToNative(dest, count);
+    }
+    dest += static_cast<size_t>(count) * bytes_per_pixel;
+  }
+  *prepared = std::move(result);
+  *dimensions = size;
+  *has_alpha = alpha;
+  return true;
 }
 
 uint8_t *Renderer::LoadAndUnpackTexture(const char *filename, vec2i *dimensions,
-                                        bool *has_alpha) {
+                                        bool *has_alpha, int *mip_levels) {
+  if (mip_levels) *mip_levels = 1;
   std::string file;
   if (LoadFile(filename, &file)) {
     std::string ext = filename;
@@ -410,7 +1092,8 @@ uint8_t *Renderer::LoadAndUnpackTexture(const char *filename, vec2i *dimensions,
       if (!buf) last_error() = std::string("TGA format problem: ") + filename;
       return buf;
     } else if (ext == "webp") {
-      auto buf = UnpackWebP(file.c_str(), file.length(), dimensions, has_alpha);
+      auto buf = UnpackWebP(file.c_str(), file.length(), dimensions, has_alpha,
+                            mip_levels);
       if (!buf) last_error() = std::string("WebP format problem: ") + filename;
       return buf;
     } else {
@@ -464,7 +1147,14 @@ void Renderer::SetBlendMode(BlendMode blend_mode, float amount) {
 #endif
     case kBlendModeAlpha:
       GL_CALL(glEnable(GL_BLEND));
+#ifdef PLATFORM_MOBILE
+      // Accumulate coverage in destination alpha, so that a RenderTarget
+      // ends up with premultiplied color and the right alpha to composite.
+      GL_CALL(glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE,
+                                  GL_ONE_MINUS_SRC_ALPHA));
+#else
       GL_CALL(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+#endif
       break;
     default:
       assert(false);  // Not yet implemented
@@ -475,6 +1165,444 @@ void Renderer::SetBlendMode(BlendMode blend_mode, float amount) {
   blend_mode_ = blend_mode;
 }
 
+void Renderer::InitializeInstancing() {
+  draw_elements_instanced_ = nullptr;
+  vertex_attrib_divisor_ = nullptr;
+
+  // Entry point suffixes to try, with the extension that provides them.
+  // GL ES 3 has instancing in core, so needs no extension or suffix.
+  struct InstancingApi {
+    const char *extension;
+    const char *suffix;
+  };
+  static const InstancingApi kApis[] = {
+    { nullptr, "" },
+    { "GL_ARB_instanced_arrays", "ARB" },
+    { "GL_EXT_instanced_arrays", "EXT" },
+    { "GL_ANGLE_instanced_arrays", "ANGLE" },
+    { "GL_NV_instanced_arrays", "NV" },
+  };
+
+  const char *version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+  const char *exts = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+  const bool is_es3 =
+      version != nullptr && strstr(version, "OpenGL ES 3") == version;
+
+  for (size_t i = 0; i < sizeof(kApis) / sizeof(kApis[0]); ++i) {
+    const InstancingApi &api = kApis[i];
+    if (api.extension == nullptr ? !is_es3
+                                 : exts == nullptr ||
+                                       !strstr(exts, api.extension)) {
+      continue;
+    }
+    const std::string draw_name =
+        std::string("glDrawElementsInstanced") + api.suffix;
+    const std::string divisor_name =
+        std::string("glVertexAttribDivisor") + api.suffix;
+    union {
+      void *data;
+      FplGlDrawElementsInstancedProc function;
+    } draw_union;
+    union {
+      void *data;
+      FplGlVertexAttribDivisorProc function;
+    } divisor_union;
+    draw_union.data = SDL_GL_GetProcAddress(draw_name.c_str());
+    divisor_union.data = SDL_GL_GetProcAddress(divisor_name.c_str());
+    if (draw_union.data && divisor_union.data) {
+      draw_elements_instanced_ = draw_union.function;
+      vertex_attrib_divisor_ = divisor_union.function;
+      SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                  "Instanced rendering enabled (%s)\n",
+                  api.extension ? api.extension : version);
+      return;
+    }
+  }
+}
+
+void Renderer::InitializeVertexArrays() {
+  gen_vertex_arrays_ = nullptr;
+  bind_vertex_array_ = nullptr;
+  delete_vertex_arrays_ = nullptr;
+
+  // Entry point suffixes to try, with the extension that provides them.
+  // GL ES 3 has vertex array objects in core, so needs no extension. The ARB
+  // extension also uses the unsuffixed names.
+  struct VertexArrayApi {
+    const char *extension;
+    const char *suffix;
+  };
+  static const VertexArrayApi kApis[] = {
+    { nullptr, "" },
+    { "GL_ARB_vertex_array_object", "" },
+    { "GL_OES_vertex_array_object", "OES" },
+    { "GL_APPLE_vertex_array_object", "APPLE" },
+  };
+
+  const char *version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+  const char *exts = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+  const bool is_es3 =
+      version != nullptr && strstr(version, "OpenGL ES 3") == version;
+
+  for (size_t i = 0; i < sizeof(kApis) / sizeof(kApis[0]); ++i) {
+    const VertexArrayApi &api = kApis[i];
+    if (api.extension == nullptr ? !is_es3
+                                 : exts == nullptr ||
+                                       !strstr(exts, api.extension)) {
+      continue;
+    }
+    union {
+      void *data;
+      FplGlGenVertexArraysProc function;
+    } gen_union;
+    union {
+      void *data;
+      FplGlBindVertexArrayProc function;
+    } bind_union;
+    union {
+      void *data;
+      FplGlDeleteVertexArraysProc function;
+    } delete_union;
+    gen_union.data = SDL_GL_GetProcAddress(
+        (std::string("glGenVertexArrays") + api.suffix).c_str());
+    bind_union.data = SDL_GL_GetProcAddress(
+        (std::string("glBindVertexArray") + api.suffix).c_str());
+    delete_union.data = SDL_GL_GetProcAddress(
+        (std::string("glDeleteVertexArrays") + api.suffix).c_str());
+    if (gen_union.data && bind_union.data && delete_union.data) {
+      gen_vertex_arrays_ = gen_union.function;
+      bind_vertex_array_ = bind_union.function;
+      delete_vertex_arrays_ = delete_union.function;
+      SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                  "Vertex array objects enabled (%s)\n",
+                  api.extension ? api.extension : version);
+      return;
+    }
+  }
+}
+
+void Renderer::InitializeTextureCompression() {
+  const char *version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+  const char *exts = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+  const bool is_es3 =
+      version != nullptr && strstr(version, "OpenGL ES 3") == version;
+  auto has_extension = [exts](const char *extension) {
+    return exts != nullptr && strstr(exts, extension) != nullptr;
+  };
+  supports_etc2_ = is_es3 || has_extension("GL_ARB_ES3_compatibility");
+  supports_astc_ = has_extension("GL_KHR_texture_compression_astc_ldr");
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+              "Compressed textures: ETC2 %s, ASTC %s\n",
+              supports_etc2_ ? "yes" : "no", supports_astc_ ? "yes" : "no");
+}
+
+void Renderer::InitializeQuantizedVertices() {
+  const char *version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+  const char *exts = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+  const bool is_es3 =
+      version != nullptr && strstr(version, "OpenGL ES 3") == version;
+  auto has_extension = [exts](const char *extension) {
+    return exts != nullptr && strstr(exts, extension) != nullptr;
+  };
+  supports_quantized_vertices_ =
+      is_es3 || (has_extension("GL_ARB_half_float_vertex") &&
+                 has_extension("GL_ARB_vertex_type_2_10_10_10_rev"));
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Quantized vertices: %s\n",
+              supports_quantized_vertices_ ? "yes" : "no");
+}
+
+void Renderer::InitializePixelBuffers() {
+  map_buffer_range_ = nullptr;
+  unmap_buffer_ = nullptr;
+  fence_sync_ = nullptr;
+  client_wait_sync_ = nullptr;
+  delete_sync_ = nullptr;
+
+  // All of these are core in GL ES 3, and come from separate extensions on
+  // desktop, which use the same unsuffixed names.
+  const char *version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+  const char *exts = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+  const bool is_es3 =
+      version != nullptr && strstr(version, "OpenGL ES 3") == version;
+  auto has_extension = [exts](const char *extension) {
+    return exts != nullptr && strstr(exts, extension) != nullptr;
+  };
+  if (!is_es3 && !(has_extension("GL_ARB_pixel_buffer_object") &&
+                   has_extension("GL_ARB_map_buffer_range") &&
+                   has_extension("GL_ARB_sync"))) {
+    return;
+  }
+  union {
+    void *data;
+    FplGlMapBufferRangeProc function;
+  } map_union;
+  union {
+    void *data;
+    FplGlUnmapBufferProc function;
+  } unmap_union;
+  union {
+    void *data;
+    FplGlFenceSyncProc function;
+  } fence_union;
+  union {
+    void *data;
+    FplGlClientWaitSyncProc function;
+  } wait_union;
+  union {
+    void *data;
+    FplGlDeleteSyncProc function;
+  } delete_union;
+  map_union.data = SDL_GL_GetProcAddress("glMapBufferRange");
+  unmap_union.data = SDL_GL_GetProcAddress("glUnmapBuffer");
+  fence_union.data = SDL_GL_GetProcAddress("glFenceSync");
+  wait_union.data = SDL_GL_GetProcAddress("glClientWaitSync");
+  delete_union.data = SDL_GL_GetProcAddress("glDeleteSync");
+  if (map_union.data && unmap_union.data && fence_union.data &&
+      wait_union.data && delete_union.data) {
+    map_buffer_range_ = map_union.function;
+    unmap_buffer_ = unmap_union.function;
+    fence_sync_ = fence_union.function;
+    client_wait_sync_ = wait_union.function;
+    delete_sync_ = delete_union.function;
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Texture uploads through pixel buffers\n");
+  }
+}
+
+void Renderer::InitializeGpuTimers() {
+  get_query_objectui64v_ = nullptr;
+  gpu_timers_can_be_disjoint_ = false;
+
+  // Entry point suffixes to try, with the extension that provides them.
+  // The ARB extension uses the unsuffixed names.
+  struct TimerApi {
+    const char *extension;
+    const char *suffix;
+    bool can_be_disjoint;
+  };
+  static const TimerApi kApis[] = {
+    { "GL_EXT_disjoint_timer_query", "EXT", true },
+    { "GL_ARB_timer_query", "", false },
+  };
+
+  const char *exts = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+  for (size_t i = 0; i < sizeof(kApis) / sizeof(kApis[0]); ++i) {
+    const TimerApi &api = kApis[i];
+    if (exts == nullptr || !strstr(exts, api.extension)) continue;
+    union {
+      void *data;
+      FplGlGenQueriesProc function;
+    } gen_union;
+    union {
+      void *data;
+      FplGlDeleteQueriesProc function;
+    } delete_union;
+    union {
+      void *data;
+      FplGlBeginQueryProc function;
+    } begin_union;
+    union {
+      void *data;
+      FplGlEndQueryProc function;
+    } end_union;
+    union {
+      void *data;
+      FplGlGetQueryObjectuivProc function;
+    } get_union;
+    union {
+      void *data;
+      FplGlGetQueryObjectui64vProc function;
+    } get64_union;
+    gen_union.data = SDL_GL_GetProcAddress(
+        (std::string("glGenQueries") + api.suffix).c_str());
+    delete_union.data = SDL_GL_GetProcAddress(
+        (std::string("glDeleteQueries") + api.suffix).c_str());
+    begin_union.data = SDL_GL_GetProcAddress(
+        (std::string("glBeginQuery") + api.suffix).c_str());
+    end_union.data = SDL_GL_GetProcAddress(
+        (std::string("glEndQuery") + api.suffix).c_str());
+    get_union.data = SDL_GL_GetProcAddress(
+        (std::string("glGetQueryObjectuiv") + api.suffix).c_str());
+    get64_union.data = SDL_GL_GetProcAddress(
+        (std::string("glGetQueryObjectui64v") + api.suffix).c_str());
+    if (gen_union.data && delete_union.data && begin_union.data &&
+        end_union.data && get_union.data && get64_union.data) {
+      gen_queries_ = gen_union.function;
+      delete_queries_ = delete_union.function;
+      begin_query_ = begin_union.function;
+      end_query_ = end_union.function;
+      get_query_objectuiv_ = get_union.function;
+      get_query_objectui64v_ = get64_union.function;
+      gpu_timers_can_be_disjoint_ = api.can_be_disjoint;
+      for (int j = 0; j < kGpuTimerCount; ++j) {
+        GL_CALL(gen_queries_(1, &gpu_timers_[j].query));
+      }
+      gpu_timer_first_ = 0;
+      gpu_timer_count_ = 0;
+      gpu_timer_open_ = false;
+      SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "GPU timers enabled (%s)\n",
+                  api.extension);
+      return;
+    }
+  }
+}
+
+void Renderer::InitializeProgramBinaries() {
+  get_program_binary_ = nullptr;
+  program_binary_ = nullptr;
+  program_parameteri_ = nullptr;
+
+  const char *vendor = reinterpret_cast<const char *>(glGetString(GL_VENDOR));
+  const char *renderer =
+      reinterpret_cast<const char *>(glGetString(GL_RENDERER));
+  const char *version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+  const char *exts = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+  const bool is_es3 =
+      version != nullptr && strstr(version, "OpenGL ES 3") == version;
+  auto has_extension = [exts](const char *extension) {
+    return exts != nullptr && strstr(exts, extension) != nullptr;
+  };
+
+  // A binary is only good for the driver that linked it, and for the source
+  // prefix and attribute bindings it was linked with.
+  const char *const driver[] = { vendor, renderer, version };
+  uint64_t key = kHashSeed;
+  for (size_t i = 0; i < sizeof(driver) / sizeof(driver[0]); ++i) {
+    if (driver[i]) key = HashBytes(driver[i], strlen(driver[i]) + 1, key);
+  }
+  key = HashBytes(kShaderSourcePrefix, strlen(kShaderSourcePrefix), key);
+  for (size_t i = 0;
+       i < sizeof(kAttributeBindings) / sizeof(kAttributeBindings[0]); ++i) {
+    const AttributeBinding &binding = kAttributeBindings[i];
+    key = HashBytes(&binding.location, sizeof(binding.location), key);
+    key = HashBytes(binding.name, strlen(binding.name) + 1, key);
+  }
+  program_binary_driver_key_ = key;
+
+  // Entry point suffixes to try, with the extension that provides them.
+  // GL ES 3 has program binaries in core, and the ARB extension uses the
+  // unsuffixed names. Only ES 2 lacks the retrievable hint.
+  struct BinaryApi {
+    const char *extension;
+    const char *suffix;
+    bool has_hint;
+  };
+  static const BinaryApi kApis[] = {
+    { nullptr, "", true },
+    { "GL_ARB_get_program_binary", "", true },
+    { "GL_OES_get_program_binary", "OES", false },
+  };
+  for (size_t i = 0; i < sizeof(kApis) / sizeof(kApis[0]); ++i) {
+    const BinaryApi &api = kApis[i];
+    if (api.extension == nullptr ? !is_es3 : !has_extension(api.extension)) {
+      continue;
+    }
+    // Some drivers have the extension, but no formats to save binaries in.
+    GLint formats = 0;
+    GL_CALL(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats));
+    if (formats <= 0) break;
+    union {
+      void *data;
+      FplGlGetProgramBinaryProc function;
+    } get_union;
+    union {
+      void *data;
+      FplGlProgramBinaryProc function;
+    } binary_union;
+    union {
+      void *data;
+      FplGlProgramParameteriProc function;
+    } parameteri_union;
+    get_union.data = SDL_GL_GetProcAddress(
+        (std::string("glGetProgramBinary") + api.suffix).c_str());
+    binary_union.data = SDL_GL_GetProcAddress(
+        (std::string("glProgramBinary") + api.suffix).c_str());
+    parameteri_union.data =
+        api.has_hint ? SDL_GL_GetProcAddress("glProgramParameteri") : nullptr;
+    if (get_union.data && binary_union.data &&
+        (parameteri_union.data || !api.has_hint)) {
+      get_program_binary_ = get_union.function;
+      program_binary_ = binary_union.function;
+      program_parameteri_ = parameteri_union.function;
+      SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                  "Program binaries enabled (%s)\n",
+                  api.extension ? api.extension : version);
+      break;
+    }
+  }
+
+  // Without this, drivers that can compile on other threads may still do it
+  // on this one. The count is the driver's choice.
+  static const char *const kParallelCompileApis[][2] = {
+    { "GL_KHR_parallel_shader_compile", "glMaxShaderCompilerThreadsKHR" },
+    { "GL_ARB_parallel_shader_compile", "glMaxShaderCompilerThreadsARB" },
+  };
+  for (size_t i = 0;
+       i < sizeof(kParallelCompileApis) / sizeof(kParallelCompileApis[0]);
+       ++i) {
+    if (!has_extension(kParallelCompileApis[i][0])) continue;
+    union {
+      void *data;
+      FplGlMaxShaderCompilerThreadsProc function;
+    } threads_union;
+    threads_union.data = SDL_GL_GetProcAddress(kParallelCompileApis[i][1]);
+    if (threads_union.data) {
+      GL_CALL(threads_union.function(0xFFFFFFFF));
+      SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                  "Parallel shader compilation enabled (%s)\n",
+                  kParallelCompileApis[i][0]);
+      break;
+    }
+  }
+}
+
+void Renderer::BeginGpuTimer(const char *name) {
+  if (!SupportsGpuTimers() || !FrameProfiler::enabled()) return;
+  assert(!gpu_timer_open_);
+  if (gpu_timer_open_ || gpu_timer_count_ == kGpuTimerCount) return;
+  GpuTimer &timer =
+      gpu_timers_[(gpu_timer_first_ + gpu_timer_count_) % kGpuTimerCount];
+  timer.name = name;
+  timer.cpu_start = FrameProfiler::Now();
+  GL_CALL(begin_query_(GL_TIME_ELAPSED_EXT, timer.query));
+  gpu_timer_count_++;
+  gpu_timer_open_ = true;
+}
+
+void Renderer::EndGpuTimer() {
+  if (!gpu_timer_open_) return;
+  GL_CALL(end_query_(GL_TIME_ELAPSED_EXT));
+  gpu_timer_open_ = false;
+}
+
+void Renderer::CollectGpuTimers() {
+  if (!SupportsGpuTimers()) return;
+  // Reading the flag clears it, so it covers everything since the last time.
+  GLint disjoint = 0;
+  if (gpu_timers_can_be_disjoint_) {
+    GL_CALL(glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint));
+  }
+  while (gpu_timer_count_ > (gpu_timer_open_ ? 1 : 0)) {
+    const GpuTimer &timer = gpu_timers_[gpu_timer_first_];
+    GLuint available = 0;
+    GL_CALL(get_query_objectuiv_(timer.query, GL_QUERY_RESULT_AVAILABLE_EXT,
+                                 &available));
+    if (!available) break;
+    uint64_t nanoseconds = 0;
+    GL_CALL(get_query_objectui64v_(timer.query, GL_QUERY_RESULT_EXT,
+                                   &nanoseconds));
+    if (!disjoint && FrameProfiler::enabled()) {
+      // Only the duration is known, so place the pass when it was issued, or
+      // when the GPU finished the one before, whichever is later.
+      const uint64_t start = std::max(timer.cpu_start, gpu_track_end_);
+      gpu_track_end_ = start + nanoseconds / 1000;
+      FrameProfiler::RecordOnTrack("GPU", timer.name, start, gpu_track_end_);
+    }
+    gpu_timer_first_ = (gpu_timer_first_ + 1) % kGpuTimerCount;
+    gpu_timer_count_--;
+  }
+}
+
 void Renderer::InitializeUndistortFramebuffer(int width, int height) {
 #ifdef __ANDROID__
   // Set up a framebuffer that matches the window, such that we can render to
@@ -485,13 +1613,11 @@ void Renderer::InitializeUndistortFramebuffer(int width, int height) {
   GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
   GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
   GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
-  GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
-                       GL_UNSIGNED_BYTE, nullptr));
 
   GL_CALL(glGenRenderbuffers(1, &undistortRenderbufferId_));
-  GL_CALL(glBindRenderbuffer(GL_RENDERBUFFER, undistortRenderbufferId_));
-  GL_CALL(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, width,
-                                height));
+
+  undistort_full_size_ = vec2i(width, height);
+  ResizeUndistortFramebuffer(undistort_full_size_);
 
   GL_CALL(glGenFramebuffers(1, &undistortFramebufferId_));
   GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, undistortFramebufferId_));
@@ -508,6 +1634,42 @@ void Renderer::InitializeUndistortFramebuffer(int width, int height) {
 #endif  // __ANDROID__
 }
 
+void Renderer::ResizeUndistortFramebuffer(const vec2i &size) {
+#ifdef __ANDROID__
+  // Respecifying the storage keeps the objects, so the framebuffer's
+  // attachments remain valid. The reprojection target, if there is one,
+  // always matches.
+  const GLuint textures[] = {undistortTextureId_, reprojectTextureId_};
+  for (size_t i = 0; i < sizeof(textures) / sizeof(textures[0]); ++i) {
+    if (textures[i] == 0) continue;
+    GL_CALL(glBindTexture(GL_TEXTURE_2D, textures[i]));
+    GL_CALL(glTexImage2D(
+        GL_TEXTURE_2D, 0, GL_RGB, size.x(), size.y(), 0, GL_RGB,
+        use_16bpp_ ? GL_UNSIGNED_SHORT_5_6_5 : GL_UNSIGNED_BYTE, nullptr));
+  }
+  GL_CALL(glBindRenderbuffer(GL_RENDERBUFFER, undistortRenderbufferId_));
+  GL_CALL(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, size.x(),
+                                size.y()));
+  undistort_size_ = size;
+#else
+  (void)size;
+#endif  // __ANDROID__
+}
+
+void Renderer::SetUndistortFramebufferScale(float scale) {
+  const vec2i size(
+      std::max(1, static_cast<int>(undistort_full_size_.x() * scale + 0.5f)),
+      std::max(1, static_cast<int>(undistort_full_size_.y() * scale + 0.5f)));
+  if (undistortTextureId_ == 0 || size == undistort_size_) return;
+  ResizeUndistortFramebuffer(size);
+}
+
+void Renderer::SetUndistortFramebuffer16bpp(bool use_16bpp) {
+  if (use_16bpp == use_16bpp_) return;
+  use_16bpp_ = use_16bpp;
+  if (undistortTextureId_ != 0) ResizeUndistortFramebuffer(undistort_size_);
+}
+
 void Renderer::BeginUndistortFramebuffer() {
 #ifdef __ANDROID__
   GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, undistortFramebufferId_));
@@ -516,15 +1678,90 @@ void Renderer::BeginUndistortFramebuffer() {
 }
 
 void Renderer::FinishUndistortFramebuffer() {
+  UndistortTexture(reprojection_shader_ ? ReprojectUndistortTexture()
+                                        : undistortTextureId_);
+}
+
+void Renderer::SetUndistortReprojection(const mat4 &rotation,
+                                        const vec2 &tan_half_fov) {
+  reprojection_ = rotation;
+  reprojection_tan_half_fov_ = tan_half_fov;
+}
+
+void Renderer::ReprojectUndistortFramebuffer() {
+  if (!reprojection_shader_) return;
+  UndistortTexture(ReprojectUndistortTexture());
+}
+
+void Renderer::Present() {
+  SDL_GL_SwapWindow(window_);
+  presented_ = true;
+}
+
+GLuint Renderer::ReprojectUndistortTexture() {
+#ifdef __ANDROID__
+  BeginGpuTimer("Reproject");
+  if (reprojectTextureId_ == 0) {
+    GL_CALL(glGenTextures(1, &reprojectTextureId_));
+    GL_CALL(glBindTexture(GL_TEXTURE_2D, reprojectTextureId_));
+    GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+                            GL_CLAMP_TO_EDGE));
+    GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+                            GL_CLAMP_TO_EDGE));
+    GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+    ResizeUndistortFramebuffer(undistort_size_);
+    GL_CALL(glGenFramebuffers(1, &reprojectFramebufferId_));
+    GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, reprojectFramebufferId_));
+    GL_CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                   GL_TEXTURE_2D, reprojectTextureId_, 0));
+  }
+  GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, reprojectFramebufferId_));
+  GLint viewport[4];
+  GL_CALL(glGetIntegerv(GL_VIEWPORT, viewport));
+  GL_CALL(glViewport(0, 0, undistort_size_.x(), undistort_size_.y()));
+  DepthTest(false);
+  SetBlendMode(kBlendModeOff);
+
+  // Each eye is a quad over its half of the target, in clip space.
+  const mat4 model_view_projection = model_view_projection_;
+  const mat4 model = model_;
+  model_view_projection_ = mat4::Identity();
+  model_ = reprojection_;
+  reprojection_shader_->Set(*this);
+  reprojection_shader_->SetUniform("tan_half_fov", reprojection_tan_half_fov_);
+  GL_CALL(glActiveTexture(GL_TEXTURE0));
+  GL_CALL(glBindTexture(GL_TEXTURE_2D, undistortTextureId_));
+  for (int eye = 0; eye < 2; ++eye) {
+    reprojection_shader_->SetUniform("eye_offset", eye * 0.5f);
+    // Texture row 0 is the bottom of the target.
+    Mesh::RenderAAQuadAlongX(vec3(eye - 1.0f, -1, 0), vec3(eye, 1, 0),
+                             vec2(0, 0), vec2(1, 1));
+  }
+  model_view_projection_ = model_view_projection;
+  model_ = model;
+
+  GL_CALL(glViewport(viewport[0], viewport[1], viewport[2], viewport[3]));
+  DepthTest(true);
+  EndGpuTimer();
+#endif  // __ANDROID__
+  return reprojectTextureId_;
+}
+
+void Renderer::UndistortTexture(GLuint texture) {
 #ifdef __ANDROID__
+  BeginGpuTimer("Undistort");
   GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
   JNIEnv *env = reinterpret_cast<JNIEnv *>(SDL_AndroidGetJNIEnv());
   jobject activity = reinterpret_cast<jobject>(SDL_AndroidGetActivity());
   jclass fpl_class = env->GetObjectClass(activity);
   jmethodID undistort = env->GetMethodID(fpl_class, "UndistortTexture", "(I)V");
-  env->CallVoidMethod(activity, undistort, (jint)undistortTextureId_);
+  env->CallVoidMethod(activity, undistort, (jint)texture);
   env->DeleteLocalRef(fpl_class);
   env->DeleteLocalRef(activity);
+  EndGpuTimer();
+#else
+  (void)texture;
 #endif  // __ANDROID__
 }
 
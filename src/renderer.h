@@ -26,6 +26,27 @@
 
 namespace fpl {
 
+// Counts of the GL work done in a frame, for checking that batching and
+// culling keep it down.
+struct RenderStats {
+  RenderStats() { Clear(); }
+  void Clear() {
+    draw_calls = 0;
+    triangles = 0;
+    shader_switches = 0;
+    texture_binds = 0;
+    buffer_uploads = 0;
+    bytes_uploaded = 0;
+  }
+  int draw_calls;
+  int triangles;
+  int shader_switches;
+  int texture_binds;
+  // Buffer and texture uploads, and how much they added up to.
+  int buffer_uploads;
+  size_t bytes_uploaded;
+};
+
 // The core of the rendering system. Deals with setting up and shutting down
 // the window + OpenGL context (based on SDL), and creating/using resources
 // such as shaders, textures, and geometry.
@@ -42,6 +63,13 @@ class Renderer {
   // Cleans up whatever Initialize creates.
   void ShutDown();
 
+  // Returns true if the GL context has been lost since Initialize(), or
+  // since this last returned true, as Android may do while the app is in the
+  // background. Every GL object made before went with it. The renderer's own
+  // are recreated before this returns; the rest are up to their owners, see
+  // MaterialManager::RestoreAfterContextLoss().
+  bool CheckContextLoss();
+
   // Clears the framebuffer. Call this after AdvanceFrame if desired.
   void ClearFrameBuffer(const vec4 &color);
 
@@ -49,12 +77,54 @@ class Renderer {
   // Returns nullptr upon error, with a descriptive message in glsl_error().
   // Attribute names in the vertex shader should be aPosition, aNormal,
   // aTexCoord and aColor to match whatever attributes your vertex data has.
+  // Instanced shaders get their transform from aInstanceRow0..2.
   Shader *CompileAndLinkShader(const char *vs_source, const char *ps_source);
 
+  // Like CompileAndLinkShader(), but only starts the work, which the driver
+  // may do on other threads while the caller gets on with loading. The shader
+  // can't be used until FinishLinkShader() has returned true. Returns nullptr
+  // only if the program couldn't be created.
+  Shader *BeginLinkShader(const char *vs_source, const char *ps_source);
+  // Waits for 'shader' to link, then sets it up for use. Returns false, with
+  // a descriptive message in last_error(), if it failed to compile or link.
+  bool FinishLinkShader(Shader *shader);
+
+  // Keep the binaries of the shaders linked from now on in 'directory',
+  // which must end in a path separator, and load them from there in place
+  // of compiling their sources again. Binaries are only reused by the
+  // driver that made them. An empty directory turns the cache off.
+  void set_program_binary_directory(const std::string &directory) {
+    program_binary_directory_ = directory;
+  }
+
   // Create a texture from a memory buffer containing xsize * ysize RGBA pixels.
+  // The buffer may be followed by the first 'mip_levels' - 1 smaller mip
+  // levels, each half the size of the last; any further levels are filtered
+  // down from the smallest one given.
   // Return 0 if not a power of two in size.
   GLuint CreateTexture(const uint8_t *buffer, const vec2i &size, bool has_alpha,
-                       TextureFormat desired = kFormatAuto);
+                       TextureFormat desired = kFormatAuto,
+                       int mip_levels = 1);
+
+  // Does the CPU side of CreateTexture(): converts the pixels to the format
+  // they're uploaded in, and fills in the rest of the mip chain. Uses no GL,
+  // so can be called on a loader thread. Returns false if not a power of two
+  // in size.
+  static bool PrepareTexture(const uint8_t *buffer, const vec2i &size,
+                             bool has_alpha, TextureFormat desired,
+                             int mip_levels, PreparedTexture *prepared);
+  // Create a texture from the mip levels of 'prepared' from 'first_level' on.
+  // If SupportsPixelBuffers(), large textures are staged in a pixel buffer,
+  // so the driver copies them to the texture after this returns, rather than
+  // before. Staging buffers are reused once a fence says the GPU is done
+  // with them.
+  GLuint CreateTexture(const PreparedTexture &prepared, int first_level = 0);
+
+  // Number of levels in a full mip chain for a texture of 'size'.
+  static int MipLevelCount(const vec2i &size);
+  // Bytes taken by the first 'levels' mip levels of a texture of 'size'.
+  static size_t MipChainSize(const vec2i &size, int bytes_per_pixel,
+                             int levels);
 
   // Unpacks a memory buffer containing a TGA format file.
   // May only be uncompressed RGB or RGBA data, Y-flipped or not.
@@ -66,16 +136,47 @@ class Renderer {
   // Unpacks a memory buffer containing a Webp format file.
   // Returns RGBA array of the returned dimensions or nullptr if the format
   // is not understood.
+  // If 'mip_levels' is given, also unpacks the mip levels that follow the
+  // image in the file (see build_assets.py), placing them after it in the
+  // returned array, and sets 'mip_levels' to the number of levels, including
+  // the first.
   // You must free() the returned pointer when done.
   uint8_t *UnpackWebP(const void *webp_buf, size_t size, vec2i *dimensions,
-                      bool *has_alpha);
+                      bool *has_alpha, int *mip_levels = nullptr);
+
+  // Like LoadAndUnpackTexture() then PrepareTexture(), for WebP files, but
+  // decodes each mip level in the file straight into 'prepared', in the
+  // format it's uploaded in, without unpacking the whole chain first. The
+  // file is mapped rather than read, and fed to libwebp's incremental
+  // decoder a chunk at a time, on two threads for large images. Uses no GL.
+  // Returns false if the file isn't a WebP, or can't be decoded this way,
+  // such as for kFormatLuminance, in which case load it with
+  // LoadAndUnpackTexture() instead.
+  static bool LoadAndPrepareWebP(const char *filename, TextureFormat desired,
+                                 PreparedTexture *prepared,
+                                 vec2i *dimensions, bool *has_alpha);
 
   // Loads the file in filename, and then unpacks the file format (supports
-  // TGA and WebP).
+  // TGA and WebP), along with any mip levels it contains if 'mip_levels' is
+  // given. Pass the results to CreateTexture().
   // last_error() contains more information if nullptr is returned.
   // You must free() the returned pointer when done.
   uint8_t *LoadAndUnpackTexture(const char *filename, vec2i *dimensions,
-                                bool *has_alpha);
+                                bool *has_alpha, int *mip_levels = nullptr);
+
+  // Create a texture from a memory buffer containing a KTX file of ETC2 or
+  // ASTC compressed data, which is uploaded without decoding.
+  // Mip levels come from the file; if it has only one, none are generated.
+  // Returns 0 if the file is malformed, or in a format this GPU can't sample,
+  // with a descriptive message in last_error().
+  GLuint CreateTextureFromKTX(const uint8_t *ktx_buf, size_t size,
+                              vec2i *dimensions, bool *has_alpha);
+
+  // The name of the GPU compressed version of 'filename' (as built by
+  // build_assets.py), in the best format this GPU supports. For example,
+  // "textures/foo.webp" becomes "textures/foo.astc.ktx". Returns the empty
+  // string if the GPU supports none of the formats we build.
+  std::string CompressedTextureFilename(const std::string &filename) const;
 
   // Utility functions to convert 32bit RGBA to 16bit.
   // You must delete[] the return value afterwards.
@@ -90,11 +191,143 @@ class Renderer {
   // Set to compare fragment against Z-buffer before writing, or not.
   void DepthTest(bool on);
 
+  // True if the GL context can draw many instances of a mesh in one call,
+  // either through OpenGL ES 3 or one of the instanced arrays extensions.
+  bool SupportsInstancing() const {
+    return draw_elements_instanced_ != nullptr &&
+           vertex_attrib_divisor_ != nullptr;
+  }
+
+  // Wrappers for glDrawElementsInstanced and glVertexAttribDivisor, or
+  // whichever extension versions of them the context has.
+  // Only call these if SupportsInstancing() is true.
+  void DrawElementsInstanced(GLenum mode, GLsizei count, GLenum type,
+                             const GLvoid *indices,
+                             GLsizei instance_count) const {
+    assert(SupportsInstancing());
+    GL_CALL(draw_elements_instanced_(mode, count, type, indices,
+                                     instance_count));
+    CountDraw(mode, count * instance_count);
+  }
+  void VertexAttribDivisor(GLuint index, GLuint divisor) const {
+    assert(SupportsInstancing());
+    GL_CALL(vertex_attrib_divisor_(index, divisor));
+  }
+
+  // True if the GL context supports vertex array objects, either through
+  // OpenGL ES 3 or one of the vertex array object extensions.
+  bool SupportsVertexArrays() const {
+    return gen_vertex_arrays_ != nullptr && bind_vertex_array_ != nullptr &&
+           delete_vertex_arrays_ != nullptr;
+  }
+
+  // Wrappers for glGenVertexArrays, glBindVertexArray and
+  // glDeleteVertexArrays, or whichever extension versions the context has.
+  // Only call these if SupportsVertexArrays() is true.
+  void GenVertexArrays(GLsizei n, GLuint *arrays) const {
+    assert(SupportsVertexArrays());
+    GL_CALL(gen_vertex_arrays_(n, arrays));
+  }
+  void BindVertexArray(GLuint array) const {
+    assert(SupportsVertexArrays());
+    GL_CALL(bind_vertex_array_(array));
+  }
+  void DeleteVertexArrays(GLsizei n, const GLuint *arrays) const {
+    assert(SupportsVertexArrays());
+    GL_CALL(delete_vertex_arrays_(n, arrays));
+  }
+
+  // True if the GL context can save and load linked programs, through
+  // OpenGL ES 3, OES_get_program_binary or ARB_get_program_binary.
+  bool SupportsProgramBinaries() const {
+    return get_program_binary_ != nullptr && program_binary_ != nullptr;
+  }
+
+  // True if meshes can use the quantized vertex formats from
+  // Mesh::Quantize(): half floats and 10:10:10:2 vectors.
+  bool SupportsQuantizedVertices() const {
+    return supports_quantized_vertices_;
+  }
+
+  // True if textures can be uploaded through pixel buffer objects, with
+  // fences to tell when they're done.
+  bool SupportsPixelBuffers() const { return delete_sync_ != nullptr; }
+
+  // True if the GL context can time work on the GPU, through
+  // EXT_disjoint_timer_query or ARB_timer_query.
+  bool SupportsGpuTimers() const { return get_query_objectui64v_ != nullptr; }
+
+  // Time the GPU commands issued between these, while the FrameProfiler is
+  // enabled. Timers don't nest. Results are read back in AdvanceFrame() a few
+  // frames later, once the GPU has them, so timing never stalls the pipeline,
+  // and are recorded on the profiler's "GPU" track.
+  void BeginGpuTimer(const char *name);
+  void EndGpuTimer();
+
+  // The stats of the frame being drawn, counted where draws, shader and
+  // texture binds, and uploads go through Mesh, Shader, Texture and
+  // CreateTexture(). Other code that talks to GL directly counts itself with
+  // CountDraw() and CountUpload(). These are static because RenderArray()
+  // draws without a Renderer; there's only one GL context anyway.
+  static RenderStats &frame_stats() { return frame_stats_; }
+  // The stats of the last whole frame, kept by AdvanceFrame().
+  static const RenderStats &last_frame_stats() { return last_frame_stats_; }
+
+  // Count a draw of 'count' vertices as 'mode' primitives.
+  static void CountDraw(GLenum mode, int count) {
+    frame_stats_.draw_calls++;
+    if (mode == GL_TRIANGLES) {
+      frame_stats_.triangles += count / 3;
+    } else if (mode == GL_TRIANGLE_STRIP || mode == GL_TRIANGLE_FAN) {
+      frame_stats_.triangles += std::max(0, count - 2);
+    }
+  }
+  // Count the upload of 'bytes' to a buffer or texture.
+  static void CountUpload(size_t bytes) {
+    frame_stats_.buffer_uploads++;
+    frame_stats_.bytes_uploaded += bytes;
+  }
+
   // Call before rendering for Cardboard to set up the framebuffer
   void BeginUndistortFramebuffer();
   // Call when finished with Cardboard, to undistort and render the framebuffer
   void FinishUndistortFramebuffer();
 
+  // Render Cardboard at 'scale' times the full resolution. The undistortion
+  // pass stretches the result over the whole screen.
+  void SetUndistortFramebufferScale(float scale);
+
+  // Render Cardboard into a 16 bit (565) framebuffer instead of a 24 bit one,
+  // which halves the bandwidth of rendering into it and undistorting it.
+  void SetUndistortFramebuffer16bpp(bool use_16bpp);
+
+  // Warp the Cardboard framebuffer with 'shader' before undistorting it, so
+  // that it's seen from a newer head pose than it was drawn with. nullptr,
+  // the default, undistorts it as drawn.
+  void set_reprojection_shader(Shader *shader) {
+    reprojection_shader_ = shader;
+  }
+
+  // The warp applied to the Cardboard framebuffer. 'rotation' turns rays seen
+  // from the newer head pose into the rays they were drawn as, and
+  // 'tan_half_fov' is the tangent of half of each eye's horizontal and
+  // vertical field of view.
+  void SetUndistortReprojection(const mat4 &rotation, const vec2 &tan_half_fov);
+
+  // Undistort the last Cardboard framebuffer again, with the current warp,
+  // to be Present()ed while the next one isn't ready to be drawn yet. Does
+  // nothing without a reprojection shader.
+  void ReprojectUndistortFramebuffer();
+
+  // Show the frame now, rather than in the next AdvanceFrame(), which then
+  // leaves the screen as it is.
+  void Present();
+
+  // Size of the Cardboard framebuffer at the current scale.
+  const vec2i &undistort_framebuffer_size() const {
+    return undistort_size_;
+  }
+
   Renderer()
       : model_view_projection_(mat4::Identity()),
         model_(mat4::Identity()),
@@ -104,9 +337,47 @@ class Renderer {
         window_size_(mathfu::kZeros2i),
         window_(nullptr),
         context_(nullptr),
+        context_probe_(0),
+        draw_elements_instanced_(nullptr),
+        vertex_attrib_divisor_(nullptr),
+        gen_vertex_arrays_(nullptr),
+        bind_vertex_array_(nullptr),
+        delete_vertex_arrays_(nullptr),
+        supports_etc2_(false),
+        supports_astc_(false),
+        supports_quantized_vertices_(false),
         undistortFramebufferId_(0),
         undistortTextureId_(0),
-        undistortRenderbufferId_(0) {}
+        undistortRenderbufferId_(0),
+        undistort_full_size_(mathfu::kZeros2i),
+        undistort_size_(mathfu::kZeros2i),
+        use_16bpp_(false),
+        reprojectFramebufferId_(0),
+        reprojectTextureId_(0),
+        reprojection_shader_(nullptr),
+        reprojection_(mat4::Identity()),
+        reprojection_tan_half_fov_(mathfu::kOnes2f),
+        presented_(false),
+        gen_queries_(nullptr),
+        delete_queries_(nullptr),
+        begin_query_(nullptr),
+        end_query_(nullptr),
+        get_query_objectuiv_(nullptr),
+        get_query_objectui64v_(nullptr),
+        gpu_timers_can_be_disjoint_(false),
+        gpu_timer_first_(0),
+        gpu_timer_count_(0),
+        gpu_timer_open_(false),
+        gpu_track_end_(0),
+        map_buffer_range_(nullptr),
+        unmap_buffer_(nullptr),
+        fence_sync_(nullptr),
+        client_wait_sync_(nullptr),
+        delete_sync_(nullptr),
+        get_program_binary_(nullptr),
+        program_binary_(nullptr),
+        program_parameteri_(nullptr),
+        program_binary_driver_key_(0) {}
   ~Renderer() { ShutDown(); }
 
   // Shader uniform: model_view_projection
@@ -145,6 +416,65 @@ class Renderer {
   // Initializes the framebuffer needed for Cardboard mode
   void InitializeUndistortFramebuffer(int width, int height);
 
+  // Reallocates the Cardboard framebuffer's attachments at 'size'.
+  void ResizeUndistortFramebuffer(const vec2i &size);
+
+  // Warps the Cardboard framebuffer by the reprojection into a second one,
+  // created on first use, and returns the texture it drew into.
+  GLuint ReprojectUndistortTexture();
+
+  // Undistorts 'texture' onto the screen with Cardboard.
+  void UndistortTexture(GLuint texture);
+
+  // Looks up the instanced drawing entry points, if the context has them.
+  void InitializeInstancing();
+
+  // Looks up the vertex array object entry points, if the context has them.
+  void InitializeVertexArrays();
+
+  // Makes context_probe_, and recreates the renderer's other GL objects
+  // after the context has been lost.
+  void CreateContextProbe();
+  void RestoreContextObjects();
+
+  // Checks which compressed texture formats the context can sample from.
+  void InitializeTextureCompression();
+
+  // Checks whether the context can read quantized vertex attributes.
+  void InitializeQuantizedVertices();
+
+  // Looks up the pixel buffer and fence entry points, if the context has
+  // them.
+  void InitializePixelBuffers();
+
+  // Copies 'size' bytes into a free staging buffer, and leaves it bound to
+  // GL_PIXEL_UNPACK_BUFFER. Returns its index, or -1 if the pixels should be
+  // uploaded from client memory instead.
+  int StagePixels(const uint8_t *pixels, size_t size);
+  // Call once the uploads from the staging buffer have been issued.
+  void FenceStagedPixels(int staging);
+  // Frees the staging buffers whose uploads the GPU has finished.
+  void CollectPixelBuffers();
+
+  // Looks up the timer query entry points, and makes the queries, if the
+  // context has them.
+  void InitializeGpuTimers();
+
+  // Looks up the program binary entry points, if the context has them, and
+  // lets the driver compile shaders on as many threads as it likes.
+  void InitializeProgramBinaries();
+
+  // The file the binary of the program linked from these sources is kept in.
+  std::string ProgramBinaryFilename(const char *vs_source,
+                                    const char *ps_source) const;
+  // Makes a program from the binary in 'filename'. Returns 0 if there's no
+  // binary, or the driver no longer accepts it.
+  GLuint LoadProgramBinary(const std::string &filename);
+  void SaveProgramBinary(GLuint program, const std::string &filename);
+
+  // Records the results of every timer the GPU has finished, oldest first.
+  void CollectGpuTimers();
+
   // The mvp. Use the Ortho() and Perspective() methods in mathfu::Matrix
   // to conveniently change the camera.
   mat4 model_view_projection_;
@@ -159,10 +489,30 @@ class Renderer {
 
   SDL_Window *window_;
   SDL_GLContext context_;
+  // A texture that exists for as long as the context does, so that
+  // CheckContextLoss() can tell when it's gone.
+  GLuint context_probe_;
 
   BlendMode blend_mode_;
 
-  bool use_16bpp_;
+  // Instanced drawing entry points, or nullptr if unsupported.
+  FplGlDrawElementsInstancedProc draw_elements_instanced_;
+  FplGlVertexAttribDivisorProc vertex_attrib_divisor_;
+
+  // Vertex array object entry points, or nullptr if unsupported.
+  FplGlGenVertexArraysProc gen_vertex_arrays_;
+  FplGlBindVertexArrayProc bind_vertex_array_;
+  FplGlDeleteVertexArraysProc delete_vertex_arrays_;
+
+  static RenderStats frame_stats_;
+  static RenderStats last_frame_stats_;
+
+  // Compressed texture formats the GPU can sample from.
+  bool supports_etc2_;
+  bool supports_astc_;
+
+  // Whether SupportsQuantizedVertices().
+  bool supports_quantized_vertices_;
 
   // The id of the framebuffer that is used for rendering for Cardboard.
   // After rendering to it, passed to Cardboard's undistortTexture call, which
@@ -172,6 +522,84 @@ class Renderer {
   GLuint undistortTextureId_;
   // The renderbuffer that is used with the framebuffer, needed for the depth
   GLuint undistortRenderbufferId_;
+  // The size of the framebuffer at a scale of 1, and its current size.
+  vec2i undistort_full_size_;
+  vec2i undistort_size_;
+  // True if the Cardboard framebuffer is 565 rather than 888.
+  bool use_16bpp_;
+  // The framebuffer the Cardboard framebuffer is warped into, and its color
+  // texture, which matches the undistortion texture's size and format. It
+  // needs no depth.
+  GLuint reprojectFramebufferId_;
+  GLuint reprojectTextureId_;
+  Shader *reprojection_shader_;
+  mat4 reprojection_;
+  vec2 reprojection_tan_half_fov_;
+  // True once the frame has been shown by Present().
+  bool presented_;
+
+  // Timer query entry points, or nullptr if unsupported.
+  FplGlGenQueriesProc gen_queries_;
+  FplGlDeleteQueriesProc delete_queries_;
+  FplGlBeginQueryProc begin_query_;
+  FplGlEndQueryProc end_query_;
+  FplGlGetQueryObjectuivProc get_query_objectuiv_;
+  FplGlGetQueryObjectui64vProc get_query_objectui64v_;
+  // True for EXT_disjoint_timer_query, whose results are garbage if
+  // GL_GPU_DISJOINT_EXT says the GPU clock jumped meanwhile.
+  bool gpu_timers_can_be_disjoint_;
+
+  // A ring of timer queries, enough for several frames of passes. Timers
+  // issued while all of them are waiting for results are dropped.
+  static const int kGpuTimerCount = 32;
+  struct GpuTimer {
+    GLuint query;
+    const char *name;
+    // FrameProfiler::Now() when the timer began.
+    uint64_t cpu_start;
+  };
+  GpuTimer gpu_timers_[kGpuTimerCount];
+  // The oldest timer waiting for its result, and how many are, including one
+  // that's still open.
+  int gpu_timer_first_;
+  int gpu_timer_count_;
+  bool gpu_timer_open_;
+  // When the last pass recorded on the GPU track ended. The GPU runs passes
+  // one after another, so each starts no earlier than this.
+  uint64_t gpu_track_end_;
+
+  // Pixel buffer and fence entry points, or nullptr if unsupported.
+  FplGlMapBufferRangeProc map_buffer_range_;
+  FplGlUnmapBufferProc unmap_buffer_;
+  FplGlFenceSyncProc fence_sync_;
+  FplGlClientWaitSyncProc client_wait_sync_;
+  FplGlDeleteSyncProc delete_sync_;
+
+  // Buffers to stage texture uploads in. One is free to reuse once the GPU
+  // has passed its fence. With all of them in use, uploads go straight from
+  // client memory. Smaller uploads aren't worth staging.
+  static const size_t kMaxPixelBuffers = 4;
+  static const size_t kMinStagedPixelBytes = 64 * 1024;
+  struct PixelBuffer {
+    GLuint buffer;
+    size_t size;
+    FplGlSync fence;
+  };
+  std::vector<PixelBuffer> pixel_buffers_;
+
+  // Program binary entry points, or nullptr if unsupported.
+  FplGlGetProgramBinaryProc get_program_binary_;
+  FplGlProgramBinaryProc program_binary_;
+  // Set when binaries have to be asked for before linking, which ES 2
+  // doesn't need.
+  FplGlProgramParameteriProc program_parameteri_;
+  std::string program_binary_directory_;
+  // Hash of the driver and of the state baked into a program when it links,
+  // so binaries from another driver or build are never loaded.
+  uint64_t program_binary_driver_key_;
+  // Programs linking from source, by the file to keep their binary in once
+  // they've linked.
+  std::map<GLuint, std::string> pending_program_binaries_;
 };
 
 }  // namespace fpl
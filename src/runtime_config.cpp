@@ -0,0 +1,74 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "config_generated.h"
+#include "runtime_config.h"
+#include "utilities.h"
+
+namespace fpl {
+namespace pie_noon {
+
+RuntimeConfig::RuntimeConfig()
+    : view_(&views_[0]),
+      cardboard_ambient_material_(mathfu::kZeros3f),
+      cardboard_diffuse_material_(mathfu::kZeros3f),
+      cardboard_specular_material_(mathfu::kZeros3f),
+      cardboard_shininess_(0.0f),
+      cardboard_normalmap_scale_(0.0f),
+      viewport_near_plane_(0.0f),
+      viewport_far_plane_(0.0f),
+      frustum_culling_(false) {}
+
+static void ResolveView(const Config& config, RuntimeConfig::View* view) {
+  view->ground_plane_width = config.ground_plane_width();
+  view->ground_plane_depth = config.ground_plane_depth();
+  view->viewport_angle = config.viewport_angle();
+}
+
+void RuntimeConfig::Resolve(const Config& config,
+                            const Config& cardboard_config) {
+  ResolveView(config, &views_[0]);
+  ResolveView(cardboard_config, &views_[1]);
+
+  // Renderables missing from the config keep the default flags.
+  const auto renderables = config.renderables();
+  const int count = std::min(static_cast<int>(renderables->size()),
+                             static_cast<int>(RenderableId_Count));
+  for (int id = 0; id < count; ++id) {
+    const CardboardFigure* figure = renderables->Get(id);
+    renderables_[id].shadow = figure->shadow();
+    renderables_[id].cardboard = figure->cardboard();
+    renderables_[id].stick = figure->stick();
+  }
+
+  light_positions_.clear();
+  const auto lights = config.light_positions();
+  for (auto it = lights->begin(); it != lights->end(); ++it) {
+    light_positions_.push_back(LoadVec3(*it));
+  }
+
+  cardboard_ambient_material_ = LoadVec3(config.cardboard_ambient_material());
+  cardboard_diffuse_material_ = LoadVec3(config.cardboard_diffuse_material());
+  cardboard_specular_material_ =
+      LoadVec3(config.cardboard_specular_material());
+  cardboard_shininess_ = config.cardboard_shininess();
+  cardboard_normalmap_scale_ = config.cardboard_normalmap_scale();
+  viewport_near_plane_ = config.viewport_near_plane();
+  viewport_far_plane_ = config.viewport_far_plane();
+  frustum_culling_ = config.frustum_culling();
+}
+
+}  // namespace pie_noon
+}  // namespace fpl
@@ -0,0 +1,110 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_RUNTIME_CONFIG_H
+#define FPL_RUNTIME_CONFIG_H
+
+#include <vector>
+#include "mathfu/glsl_mappings.h"
+#include "pie_noon_common_generated.h"
+
+namespace fpl {
+namespace pie_noon {
+
+struct Config;
+
+// What the renderer needs to know about each renderable, from
+// config.renderables().
+struct RenderableFlags {
+  RenderableFlags() : shadow(false), cardboard(false), stick(false) {}
+  bool shadow;
+  bool cardboard;
+  bool stick;
+};
+
+// The config values read every frame, pulled out of the Config flatbuffer
+// once when it's loaded, so the render loop and GameState don't go through
+// flatbuffer accessors and LoadVec3() for each of them. Values that differ
+// between the normal and Cardboard configs are kept for both, and
+// set_in_cardboard() picks which of them view() returns, so callers don't
+// check is_in_cardboard() themselves.
+class RuntimeConfig {
+ public:
+  // Values that come from the Cardboard config in Cardboard mode.
+  struct View {
+    View()
+        : ground_plane_width(0.0f),
+          ground_plane_depth(0.0f),
+          viewport_angle(0.0f) {}
+    float ground_plane_width;
+    float ground_plane_depth;
+    float viewport_angle;
+  };
+
+  RuntimeConfig();
+
+  // Read the values from 'config', and the Cardboard variants from
+  // 'cardboard_config'. Call again if either changes.
+  void Resolve(const Config& config, const Config& cardboard_config);
+
+  void set_in_cardboard(bool in_cardboard) {
+    view_ = &views_[in_cardboard ? 1 : 0];
+  }
+  const View& view() const { return *view_; }
+
+  // The flags of 'id', or of RenderableId_Invalid if 'id' is out of range.
+  const RenderableFlags& renderable(int id) const {
+    return renderables_[0 <= id && id < RenderableId_Count
+                            ? id
+                            : RenderableId_Invalid];
+  }
+
+  const std::vector<mathfu::vec3>& light_positions() const {
+    return light_positions_;
+  }
+  const mathfu::vec3& cardboard_ambient_material() const {
+    return cardboard_ambient_material_;
+  }
+  const mathfu::vec3& cardboard_diffuse_material() const {
+    return cardboard_diffuse_material_;
+  }
+  const mathfu::vec3& cardboard_specular_material() const {
+    return cardboard_specular_material_;
+  }
+  float cardboard_shininess() const { return cardboard_shininess_; }
+  float cardboard_normalmap_scale() const { return cardboard_normalmap_scale_; }
+  float viewport_near_plane() const { return viewport_near_plane_; }
+  float viewport_far_plane() const { return viewport_far_plane_; }
+  bool frustum_culling() const { return frustum_culling_; }
+
+ private:
+  // The normal view, then the Cardboard one.
+  View views_[2];
+  const View* view_;
+  RenderableFlags renderables_[RenderableId_Count];
+  std::vector<mathfu::vec3> light_positions_;
+  mathfu::vec3 cardboard_ambient_material_;
+  mathfu::vec3 cardboard_diffuse_material_;
+  mathfu::vec3 cardboard_specular_material_;
+  float cardboard_shininess_;
+  float cardboard_normalmap_scale_;
+  float viewport_near_plane_;
+  float viewport_far_plane_;
+  bool frustum_culling_;
+};
+
+}  // namespace pie_noon
+}  // namespace fpl
+
+#endif  // FPL_RUNTIME_CONFIG_H
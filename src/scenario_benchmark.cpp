@@ -0,0 +1,123 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include <string>
+#include "scenario_benchmark.h"
+#include "frame_profiler.h"
+#include "utilities.h"
+
+namespace fpl {
+namespace pie_noon {
+
+ScenarioBenchmark::ScenarioBenchmark()
+    : started_(false),
+      frames_left_(0),
+      step_time_(0),
+      matches_(0),
+      startup_time_(0),
+      last_frame_end_(0) {}
+
+void ScenarioBenchmark::Start(int frames, WorldTime step_time,
+                              uint32_t startup_time) {
+  started_ = true;
+  frames_left_ = frames;
+  step_time_ = step_time;
+  matches_ = 1;
+  startup_time_ = startup_time;
+  last_frame_end_ = FrameProfiler::Now();
+  update_times_.clear();
+  render_times_.clear();
+  frame_times_.clear();
+  update_times_.reserve(frames);
+  render_times_.reserve(frames);
+  frame_times_.reserve(frames);
+}
+
+void ScenarioBenchmark::AddFrame(uint64_t update_time, uint64_t render_time) {
+  if (frames_left_ <= 0) return;
+  const uint64_t now = FrameProfiler::Now();
+  update_times_.push_back(update_time);
+  render_times_.push_back(render_time);
+  frame_times_.push_back(now - last_frame_end_);
+  last_frame_end_ = now;
+  frames_left_--;
+}
+
+ScenarioBenchmark::Summary ScenarioBenchmark::Summarize(
+    const std::vector<uint64_t>& times) {
+  Summary summary = {0, 0, 0, 0};
+  if (times.empty()) return summary;
+  std::vector<uint64_t> sorted(times);
+  std::sort(sorted.begin(), sorted.end());
+  uint64_t total = 0;
+  for (size_t i = 0; i < sorted.size(); ++i) total += sorted[i];
+  // Nearest rank, so a percentile is always one of the frames.
+  const size_t last = sorted.size() - 1;
+  summary.mean = static_cast<double>(total) / sorted.size();
+  summary.p95 = sorted[std::min(last, sorted.size() * 95 / 100)];
+  summary.p99 = sorted[std::min(last, sorted.size() * 99 / 100)];
+  summary.max = sorted[last];
+  return summary;
+}
+
+bool ScenarioBenchmark::Report(const char* filename, const char* device) const {
+  static const char* const kNames[] = {"update", "render", "frame"};
+  const Summary summaries[] = {Summarize(update_times_),
+                               Summarize(render_times_),
+                               Summarize(frame_times_)};
+  const int frames = static_cast<int>(frame_times_.size());
+  const int peak_memory_kb = static_cast<int>(PeakResidentBytes() / 1024);
+
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+              "Scenario benchmark: %d frames of %dms, %d matches, on %s\n",
+              frames, step_time_, matches_, device);
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+              "  startup %dms, peak memory %dKB\n",
+              static_cast<int>(startup_time_), peak_memory_kb);
+  std::string json = "{\n";
+  char line[512];
+  snprintf(line, sizeof(line),
+           "  \"device\": \"%s\",\n  \"platform\": \"%s\",\n"
+           "  \"frames\": %d,\n  \"step_time_ms\": %d,\n"
+           "  \"matches\": %d,\n  \"startup_ms\": %d,\n"
+           "  \"peak_memory_kb\": %d,\n",
+           device, SDL_GetPlatform(), frames, step_time_, matches_,
+           static_cast<int>(startup_time_), peak_memory_kb);
+  json.append(line);
+  for (size_t i = 0; i < PIE_ARRAYSIZE(kNames); ++i) {
+    const Summary& summary = summaries[i];
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "  %-6s us: mean %.0f, p95 %d, p99 %d, max %d\n", kNames[i],
+                summary.mean, static_cast<int>(summary.p95),
+                static_cast<int>(summary.p99), static_cast<int>(summary.max));
+    snprintf(line, sizeof(line),
+             "  \"%s_us\": {\"mean\": %.1f, \"p95\": %d, \"p99\": %d, "
+             "\"max\": %d}%s\n",
+             kNames[i], summary.mean, static_cast<int>(summary.p95),
+             static_cast<int>(summary.p99), static_cast<int>(summary.max),
+             i + 1 < PIE_ARRAYSIZE(kNames) ? "," : "");
+    json.append(line);
+  }
+  json.append("}\n");
+
+  SDL_RWops* handle = SDL_RWFromFile(filename, "wb");
+  if (!handle) return false;
+  const size_t written = SDL_RWwrite(handle, json.data(), 1, json.size());
+  SDL_RWclose(handle);
+  return written == json.size();
+}
+
+}  // namespace pie_noon
+}  // namespace fpl
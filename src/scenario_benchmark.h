@@ -0,0 +1,82 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_SCENARIO_BENCHMARK_H
+#define FPL_SCENARIO_BENCHMARK_H
+
+#include <vector>
+#include "common.h"
+
+namespace fpl {
+namespace pie_noon {
+
+// Times whole frames of a scripted match, to compare builds on one device.
+// The game plays AI-only matches from a fixed seed, in fixed steps, for a
+// set number of frames, and records how long each frame's update and render
+// took. Report() then gives the mean and the 95th and 99th percentiles, along
+// with how long startup took and the peak memory use, for
+// scripts/check_perf_baselines.py to compare against the device's baseline.
+class ScenarioBenchmark {
+ public:
+  ScenarioBenchmark();
+
+  // Start timing the next 'frames' frames, each of which advances the game
+  // by 'step_time'. 'startup_time' is how long the game took to load, in ms.
+  void Start(int frames, WorldTime step_time, uint32_t startup_time);
+
+  // True from Start() until the last frame has been recorded.
+  bool running() const { return frames_left_ > 0; }
+  // True once every frame has been recorded.
+  bool finished() const { return started_ && frames_left_ <= 0; }
+
+  WorldTime step_time() const { return step_time_; }
+
+  // Record a frame, given how long its update and render took, in
+  // microseconds. The time of the whole frame is measured from the last
+  // call.
+  void AddFrame(uint64_t update_time, uint64_t render_time);
+
+  // Count a match that ended, and was restarted, during the benchmark.
+  void AddMatch() { matches_++; }
+
+  // Log the results, and write them to 'filename' as JSON. 'device' names
+  // the GPU, so results from different devices aren't compared. Returns
+  // false if the file couldn't be written.
+  bool Report(const char* filename, const char* device) const;
+
+ private:
+  struct Summary {
+    double mean;
+    uint64_t p95;
+    uint64_t p99;
+    uint64_t max;
+  };
+  static Summary Summarize(const std::vector<uint64_t>& times);
+
+  bool started_;
+  int frames_left_;
+  WorldTime step_time_;
+  int matches_;
+  uint32_t startup_time_;
+  // When the last frame was recorded, by FrameProfiler::Now().
+  uint64_t last_frame_end_;
+  std::vector<uint64_t> update_times_;
+  std::vector<uint64_t> render_times_;
+  std::vector<uint64_t> frame_times_;
+};
+
+}  // namespace pie_noon
+}  // namespace fpl
+
+#endif  // FPL_SCENARIO_BENCHMARK_H
@@ -16,7 +16,8 @@
 #define PIE_NOON_SCENE_DESCRIPTION_H
 
 #include "mathfu/glsl_mappings.h"
-#include <memory>
+#include "particles.h"
+#include <algorithm>
 #include <vector>
 
 namespace fpl {
@@ -47,38 +48,76 @@ class Renderable {
   mathfu::vec4 color_;
 };
 
+// Everything to draw in one frame. Renderables and lights are stored by
+// value, and Clear() keeps the storage, so once the scene has been as big as
+// it gets, populating it each frame doesn't allocate.
+//
+// Rendering only reads the scene, never the game state it came from, so the
+// next frame can be simulated into another SceneDescription meanwhile.
 class SceneDescription {
  public:
+  SceneDescription() : input_time_(0) {}
+
   const mathfu::mat4& camera() const { return camera_; }
   void set_camera(const mathfu::mat4& camera) { camera_ = camera; }
 
-  std::vector<std::unique_ptr<Renderable>>& renderables() {
-    return renderables_;
+  const mathfu::vec3& camera_position() const { return camera_position_; }
+  void set_camera_position(const mathfu::vec3& position) {
+    camera_position_ = position;
   }
-  const std::vector<std::unique_ptr<Renderable>>& renderables() const {
-    return renderables_;
+
+  std::vector<Renderable>& renderables() { return renderables_; }
+  const std::vector<Renderable>& renderables() const { return renderables_; }
+
+  std::vector<mathfu::vec3>& lights() { return lights_; }
+  const std::vector<mathfu::vec3>& lights() const { return lights_; }
+
+  // Make room for 'count' more renderables than the scene holds now. Grows
+  // the storage geometrically, as push_back would, so that a scene growing a
+  // little each frame doesn't reallocate each frame.
+  void ReserveRenderables(size_t count) {
+    const size_t needed = renderables_.size() + count;
+    if (needed > renderables_.capacity()) {
+      renderables_.reserve(std::max(needed, 2 * renderables_.capacity()));
+    }
   }
 
-  std::vector<std::unique_ptr<mathfu::vec3>>& lights() { return lights_; }
-  const std::vector<std::unique_ptr<mathfu::vec3>>& lights() const {
-    return lights_;
+  // The bursts of particles simulated on the GPU, which aren't renderables.
+  std::vector<pie_noon::ParticleBurst>& particle_bursts() {
+    return particle_bursts_;
   }
+  const std::vector<pie_noon::ParticleBurst>& particle_bursts() const {
+    return particle_bursts_;
+  }
+
+  // SDL_GetTicks() time of the earliest input that this scene is the first
+  // to show the reaction to, or 0 if there's none. Not touched by Clear().
+  uint32_t input_time() const { return input_time_; }
+  void set_input_time(uint32_t input_time) { input_time_ = input_time; }
 
   // Clear out the render list. Should be called once per frame.
   void Clear() {
     renderables_.clear();
     lights_.clear();
+    particle_bursts_.clear();
   }
 
  private:
   // The camera position, orientation, fov.
   mathfu::mat4 camera_;
 
+  // Where the camera is in world space.
+  mathfu::vec3 camera_position_;
+
   // Array of items to be rendered and their positions.
-  std::vector<std::unique_ptr<Renderable>> renderables_;
+  std::vector<Renderable> renderables_;
 
   // Array of positions for where to place point lights.
-  std::vector<std::unique_ptr<mathfu::vec3>> lights_;
+  std::vector<mathfu::vec3> lights_;
+
+  std::vector<pie_noon::ParticleBurst> particle_bursts_;
+
+  uint32_t input_time_;
 };
 
 }  // namespace fpl
@@ -47,17 +47,22 @@ void Shader::InitializeUniforms() {
 
 void Shader::Set(const Renderer &renderer) const {
   GL_CALL(glUseProgram(program_));
+  Renderer::frame_stats().shader_switches++;
 
-  if (uniform_model_view_projection_ >= 0)
+  if (uniform_model_view_projection_ >= 0 &&
+      model_view_projection_cache_.Update(
+          &renderer.model_view_projection()[0]))
     GL_CALL(glUniformMatrix4fv(uniform_model_view_projection_, 1, false,
                                &renderer.model_view_projection()[0]));
-  if (uniform_model_ >= 0)
+  if (uniform_model_ >= 0 && model_cache_.Update(&renderer.model()[0]))
     GL_CALL(glUniformMatrix4fv(uniform_model_, 1, false, &renderer.model()[0]));
-  if (uniform_color_ >= 0)
+  if (uniform_color_ >= 0 && color_cache_.Update(&renderer.color()[0]))
     GL_CALL(glUniform4fv(uniform_color_, 1, &renderer.color()[0]));
-  if (uniform_light_pos_ >= 0)
+  if (uniform_light_pos_ >= 0 &&
+      light_pos_cache_.Update(&renderer.light_pos()[0]))
     GL_CALL(glUniform3fv(uniform_light_pos_, 1, &renderer.light_pos()[0]));
-  if (uniform_camera_pos_ >= 0)
+  if (uniform_camera_pos_ >= 0 &&
+      camera_pos_cache_.Update(&renderer.camera_pos()[0]))
     GL_CALL(glUniform3fv(uniform_camera_pos_, 1, &renderer.camera_pos()[0]));
 }
 
@@ -51,7 +51,8 @@ class Shader {
 
   // Will make this shader active for any subsequent draw calls, and sets
   // all standard uniforms (e.g. mvp matrix) based on current values in
-  // Renderer, if this shader refers to them.
+  // Renderer, if this shader refers to them. Uniforms that still hold the
+  // same value since the last Set() are not uploaded again.
   void Set(const Renderer &renderer) const;
 
   // Find a non-standard uniform by name, -1 means not found.
@@ -103,7 +104,42 @@ class Shader {
 
   void InitializeUniforms();
 
+  // Take over the GL objects of 'other', just begun linking from the same
+  // sources, in place of this shader's, which went with the GL context they
+  // were made in. Leaves 'other' empty, to be deleted.
+  void Replace(Shader *other) {
+    *this = *other;
+    other->program_ = other->vs_ = other->ps_ = 0;
+  }
+
+  // The GL objects the shader is made of. The stages are 0 if the program
+  // was loaded from a binary rather than compiled.
+  GLuint program() const { return program_; }
+  GLuint vs() const { return vs_; }
+  GLuint ps() const { return ps_; }
+
  private:
+  // The value most recently uploaded to one of the standard uniforms.
+  // Program uniforms keep their values between uses of the program, so
+  // a value only needs uploading when it differs from this.
+  template <int N>
+  class UniformCache {
+   public:
+    UniformCache() : valid_(false) {}
+
+    // Returns true if 'value' needs uploading, and remembers it as uploaded.
+    bool Update(const float *value) {
+      if (valid_ && !memcmp(value_, value, sizeof(value_))) return false;
+      memcpy(value_, value, sizeof(value_));
+      valid_ = true;
+      return true;
+    }
+
+   private:
+    float value_[N];
+    bool valid_;
+  };
+
   GLuint program_, vs_, ps_;
 
   GLint uniform_model_view_projection_;
@@ -111,6 +147,12 @@ class Shader {
   GLint uniform_color_;
   GLint uniform_light_pos_;
   GLint uniform_camera_pos_;
+
+  mutable UniformCache<16> model_view_projection_cache_;
+  mutable UniformCache<16> model_cache_;
+  mutable UniformCache<4> color_cache_;
+  mutable UniformCache<3> light_pos_cache_;
+  mutable UniformCache<3> camera_pos_cache_;
 };
 
 }  // namespace fpl
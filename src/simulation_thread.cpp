@@ -0,0 +1,127 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "precompiled.h"
+#include "simulation_thread.h"
+#include "frame_profiler.h"
+
+namespace fpl {
+
+SimulationThread::SimulationThread()
+    : thread_(nullptr), job_(nullptr), quit_(false) {
+  mutex_ = SDL_CreateMutex();
+  job_available_ = SDL_CreateCond();
+  job_done_ = SDL_CreateCond();
+  assert(mutex_ && job_available_ && job_done_);
+}
+
+SimulationThread::~SimulationThread() {
+  Stop();
+  if (mutex_) {
+    SDL_DestroyMutex(mutex_);
+    mutex_ = nullptr;
+  }
+  if (job_available_) {
+    SDL_DestroyCond(job_available_);
+    job_available_ = nullptr;
+  }
+  if (job_done_) {
+    SDL_DestroyCond(job_done_);
+    job_done_ = nullptr;
+  }
+}
+
+bool SimulationThread::Start() {
+  assert(thread_ == nullptr);
+  quit_ = false;
+  thread_ = SDL_CreateThread(SimulationThread::ThreadMain,
+                             "FPL Simulation Thread", this);
+  if (!thread_) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                 "Can't create simulation thread: %s\n", SDL_GetError());
+    return false;
+  }
+  return true;
+}
+
+void SimulationThread::Stop() {
+  if (thread_ == nullptr) return;
+  Wait();
+  SDL_LockMutex(mutex_);
+  quit_ = true;
+  SDL_CondSignal(job_available_);
+  SDL_UnlockMutex(mutex_);
+  SDL_WaitThread(thread_, nullptr);
+  thread_ = nullptr;
+}
+
+void SimulationThread::Run(const std::function<void()>& job) {
+  if (thread_ == nullptr) {
+    job();
+    return;
+  }
+  SDL_LockMutex(mutex_);
+  assert(job_ == nullptr);
+  job_ = &job;
+  SDL_CondSignal(job_available_);
+  SDL_UnlockMutex(mutex_);
+}
+
+void SimulationThread::Wait() {
+  SDL_LockMutex(mutex_);
+  while (job_ != nullptr) {
+    SDL_CondWait(job_done_, mutex_);
+  }
+  SDL_UnlockMutex(mutex_);
+}
+
+bool SimulationThread::WaitTimeout(uint32_t ms) {
+  if (thread_ == nullptr) return true;
+  const uint32_t deadline = SDL_GetTicks() + ms;
+  SDL_LockMutex(mutex_);
+  while (job_ != nullptr) {
+    const uint32_t now = SDL_GetTicks();
+    if (SDL_TICKS_PASSED(now, deadline)) break;
+    SDL_CondWaitTimeout(job_done_, mutex_, deadline - now);
+  }
+  const bool done = job_ == nullptr;
+  SDL_UnlockMutex(mutex_);
+  return done;
+}
+
+void SimulationThread::Main() {
+  FrameProfiler::SetThreadName("Simulation");
+  SDL_LockMutex(mutex_);
+  for (;;) {
+    while (!quit_ && job_ == nullptr) {
+      SDL_CondWait(job_available_, mutex_);
+    }
+    if (quit_) break;
+    const std::function<void()>& job = *job_;
+    SDL_UnlockMutex(mutex_);
+    job();
+    SDL_LockMutex(mutex_);
+    job_ = nullptr;
+    SDL_CondSignal(job_done_);
+  }
+  SDL_UnlockMutex(mutex_);
+}
+
+int SimulationThread::ThreadMain(void* user_data) {
+  static_cast<SimulationThread*>(user_data)->Main();
+  return 0;
+}
+
+}  // namespace fpl
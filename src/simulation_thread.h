@@ -0,0 +1,81 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FPL_SIMULATION_THREAD_H
+#define FPL_SIMULATION_THREAD_H
+
+#include <cstdint>
+#include <functional>
+
+struct SDL_Thread;
+struct SDL_mutex;
+struct SDL_cond;
+
+namespace fpl {
+
+// A thread that runs one job at a time beside the main thread, so that the
+// main thread can render one frame while the next one is being simulated.
+class SimulationThread {
+ public:
+  SimulationThread();
+  ~SimulationThread();
+
+  // Launch the thread. Must not already be started. Returns false if the
+  // thread can't be created.
+  bool Start();
+
+  // Waits for the current job to finish and the thread to exit. You can
+  // restart with Start().
+  void Stop();
+
+  // Starts 'job' running on the thread, and returns without waiting for it.
+  // 'job' must stay alive until Wait() returns. Only one job can be in
+  // flight at a time, so Wait() for the last one first. If the thread isn't
+  // started, runs 'job' on the calling thread instead.
+  void Run(const std::function<void()>& job);
+
+  // Returns once the job passed to Run() has finished.
+  void Wait();
+
+  // Waits up to 'ms' milliseconds for the job passed to Run() to finish.
+  // Returns true if it has.
+  bool WaitTimeout(uint32_t ms);
+
+  bool started() const { return thread_ != nullptr; }
+
+ private:
+  void Main();
+  static int ThreadMain(void* user_data);
+
+  SDL_Thread* thread_;
+
+  // This lock protects the job state below.
+  SDL_mutex* mutex_;
+
+  // Signalled when a job arrives, or when the thread should quit.
+  SDL_cond* job_available_;
+
+  // Signalled when the job finishes.
+  SDL_cond* job_done_;
+
+  // The job to run, or null once it has finished.
+  const std::function<void()>* job_;
+
+  bool quit_;
+};
+
+}  // namespace fpl
+
+#endif  // FPL_SIMULATION_THREAD_H
@@ -0,0 +1,142 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "precompiled.h"
+#include "startup_trace.h"
+#include "memory_accounting.h"
+
+namespace fpl {
+
+static StartupTrace *g_startup_trace = nullptr;
+
+void SetStartupTrace(StartupTrace *trace) { g_startup_trace = trace; }
+
+StartupTrace *GetStartupTrace() { return g_startup_trace; }
+
+uint64_t StartupTrace::AllocationCount() {
+  return MemoryAccounting::AllocationCount();
+}
+
+uint64_t StartupTrace::AllocatedBytes() {
+  return MemoryAccounting::AllocatedBytes();
+}
+
+StartupTrace::StartupTrace()
+    : counter_origin_(SDL_GetPerformanceCounter()),
+      time_origin_(static_cast<uint64_t>(SDL_GetTicks()) * 1000) {}
+
+uint64_t StartupTrace::Now() const {
+  const uint64_t elapsed = SDL_GetPerformanceCounter() - counter_origin_;
+  return time_origin_ + elapsed * 1000000 / SDL_GetPerformanceFrequency();
+}
+
+void StartupTrace::Begin(const char *name, const char *category) {
+  Event event;
+  event.name = name;
+  event.category = category;
+  event.track = 0;
+  event.start = Now();
+  event.duration = 0;
+  // Hold the totals at the start for now, and turn them into the amount
+  // allocated within the phase in End().
+  event.allocations = AllocationCount();
+  event.allocated_bytes = AllocatedBytes();
+  open_.push_back(events_.size());
+  events_.push_back(event);
+}
+
+void StartupTrace::End() {
+  assert(!open_.empty());
+  Event &event = events_[open_.back()];
+  open_.pop_back();
+  event.duration = Now() - event.start;
+  event.allocations = AllocationCount() - event.allocations;
+  event.allocated_bytes = AllocatedBytes() - event.allocated_bytes;
+}
+
+void StartupTrace::AddLoadTimings(
+    const std::vector<AsyncLoadTiming> &timings) {
+  for (auto it = timings.begin(); it != timings.end(); ++it) {
+    Event event;
+    event.category = "asset";
+    event.allocations = 0;
+    event.allocated_bytes = 0;
+
+    event.name = "Load " + it->filename;
+    event.track = 1 + std::max(0, it->thread);
+    event.start = static_cast<uint64_t>(it->load_start) * 1000;
+    event.duration = static_cast<uint64_t>(it->load_end - it->load_start) * 1000;
+    events_.push_back(event);
+
+    event.name = "Finalize " + it->filename;
+    event.track = 0;
+    event.start = static_cast<uint64_t>(it->finalized) * 1000;
+    event.duration = 0;
+    events_.push_back(event);
+  }
+}
+
+// Append 's' to 'out' as a JSON string.
+static void AppendJsonString(const std::string &s, std::string *out) {
+  out->push_back('"');
+  for (size_t i = 0; i < s.size(); ++i) {
+    const char c = s[i];
+    if (c == '"' || c == '\\') {
+      out->push_back('\\');
+      out->push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out->append(escaped);
+    } else {
+      out->push_back(c);
+    }
+  }
+  out->push_back('"');
+}
+
+bool StartupTrace::Write(const char *filename) const {
+  std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  for (size_t i = 0; i < events_.size(); ++i) {
+    const Event &event = events_[i];
+    // Phases still open have no end to show.
+    if (std::find(open_.begin(), open_.end(), i) != open_.end()) continue;
+    char fields[256];
+    json.append("{\"name\":");
+    AppendJsonString(event.name, &json);
+    snprintf(fields, sizeof(fields),
+             ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+             "\"ts\":%llu,\"dur\":%llu,\"args\":{\"allocations\":%llu,"
+             "\"allocated_bytes\":%llu}},\n",
+             event.category, event.track,
+             static_cast<unsigned long long>(event.start),
+             static_cast<unsigned long long>(event.duration),
+             static_cast<unsigned long long>(event.allocations),
+             static_cast<unsigned long long>(event.allocated_bytes));
+    json.append(fields);
+  }
+  // Name the tracks, which also avoids a trailing comma.
+  json.append(
+      "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+      "\"args\":{\"name\":\"main\"}}\n]}\n");
+
+  SDL_RWops *handle = SDL_RWFromFile(filename, "wb");
+  if (!handle) return false;
+  const size_t written = SDL_RWwrite(handle, json.data(), 1, json.size());
+  SDL_RWclose(handle);
+  return written == json.size();
+}
+
+}  // namespace fpl
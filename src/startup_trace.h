@@ -0,0 +1,100 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FPL_STARTUP_TRACE_H
+#define FPL_STARTUP_TRACE_H
+
+#include <string>
+#include <vector>
+#include "async_loader.h"
+
+namespace fpl {
+
+// Records how long each phase of startup takes, and how much it allocates,
+// and writes the result in the Chrome trace event format, for viewing in
+// chrome://tracing. Phases nest. Only used on the main thread.
+//
+// Allocation totals count every operator new made while a phase is open, on
+// any thread, so phases that overlap with background loading include some of
+// its allocations too.
+class StartupTrace {
+ public:
+  StartupTrace();
+
+  // Open a phase, nested within whichever one is open already. 'category'
+  // groups the phases in the trace viewer, e.g. "init" or "asset".
+  void Begin(const char *name, const char *category);
+  // Close the phase opened most recently.
+  void End();
+
+  // Add the loading and finalizing of each texture, as recorded by the
+  // AsyncLoader, on a track per worker thread.
+  void AddLoadTimings(const std::vector<AsyncLoadTiming> &timings);
+
+  // Write every phase closed so far to 'filename' as Chrome trace JSON.
+  // Returns false if the file can't be written.
+  bool Write(const char *filename) const;
+
+  // Number of calls to operator new, and bytes requested by them, since the
+  // program started.
+  static uint64_t AllocationCount();
+  static uint64_t AllocatedBytes();
+
+ private:
+  struct Event {
+    std::string name;
+    const char *category;
+    // Trace viewer track. 0 for the main thread, 1 + the index of a worker
+    // thread otherwise.
+    int track;
+    uint64_t start;
+    uint64_t duration;
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+  };
+
+  // Microseconds since SDL_Init(), the same origin as SDL_GetTicks().
+  uint64_t Now() const;
+
+  std::vector<Event> events_;
+  // Indices into events_ of the phases still open.
+  std::vector<size_t> open_;
+  uint64_t counter_origin_;
+  uint64_t time_origin_;
+};
+
+// Phases in scope are recorded in the trace passed to SetStartupTrace(), if
+// any. Nothing is recorded once startup is done and the trace is unset.
+void SetStartupTrace(StartupTrace *trace);
+StartupTrace *GetStartupTrace();
+
+// Records a phase for the lifetime of the object.
+class StartupTraceScope {
+ public:
+  StartupTraceScope(const char *name, const char *category = "init")
+      : trace_(GetStartupTrace()) {
+    if (trace_) trace_->Begin(name, category);
+  }
+  ~StartupTraceScope() {
+    if (trace_) trace_->End();
+  }
+
+ private:
+  StartupTrace *trace_;
+};
+
+}  // namespace fpl
+
+#endif  // FPL_STARTUP_TRACE_H
@@ -0,0 +1,78 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "stream_buffer.h"
+#include "renderer.h"
+
+namespace fpl {
+
+// Keep each copy aligned, since some drivers are slow at fetching vertex
+// data that isn't.
+static const size_t kAlignment = 16;
+
+StreamBuffer::StreamBuffer(GLenum target, size_t size)
+    : target_(target),
+      capacity_(size),
+      offset_(0),
+      frame_(0),
+      needs_orphan_(true) {
+  for (int i = 0; i < kNumFrames; i++) buffers_[i] = 0;
+}
+
+void StreamBuffer::Orphan() {
+  GL_CALL(glBufferData(target_, capacity_, nullptr, GL_STREAM_DRAW));
+  offset_ = 0;
+  needs_orphan_ = false;
+}
+
+size_t StreamBuffer::Append(const void *data, size_t size) {
+  GLuint &buffer = buffers_[frame_];
+  if (!buffer) {
+    GL_CALL(glGenBuffers(1, &buffer));
+    needs_orphan_ = true;
+  }
+  GL_CALL(glBindBuffer(target_, buffer));
+  if (size > capacity_) {
+    while (capacity_ < size) capacity_ *= 2;
+    needs_orphan_ = true;
+  }
+  if (needs_orphan_ || offset_ + size > capacity_) Orphan();
+
+  const size_t offset = offset_;
+  GL_CALL(glBufferSubData(target_, offset, size, data));
+  Renderer::CountUpload(size);
+  offset_ = (offset + size + kAlignment - 1) & ~(kAlignment - 1);
+  return offset;
+}
+
+void StreamBuffer::AdvanceFrame() {
+  frame_ = (frame_ + 1) % kNumFrames;
+  needs_orphan_ = true;
+}
+
+void StreamBuffer::Delete() {
+  for (int i = 0; i < kNumFrames; i++) {
+    if (buffers_[i]) {
+      GL_CALL(glDeleteBuffers(1, &buffers_[i]));
+      buffers_[i] = 0;
+    }
+  }
+}
+
+void StreamBuffer::Forget() {
+  for (int i = 0; i < kNumFrames; i++) buffers_[i] = 0;
+}
+
+}  // namespace fpl
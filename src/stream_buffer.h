@@ -0,0 +1,67 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_STREAM_BUFFER_H
+#define FPL_STREAM_BUFFER_H
+
+namespace fpl {
+
+// A GPU buffer for geometry that changes every draw, such as the quads drawn
+// by Mesh::RenderArray.
+//
+// Data is appended to one of several buffers, which are cycled through once
+// per frame. Whenever a buffer is rewound (at the start of its frame, or when
+// it fills up), it is orphaned first, so that writing to it never has to wait
+// for the GPU to finish with draws that were issued from it earlier.
+class StreamBuffer {
+ public:
+  // 'target' is GL_ARRAY_BUFFER or GL_ELEMENT_ARRAY_BUFFER. 'size' is the
+  // initial size of each buffer in bytes; they grow if a single Append()
+  // needs more.
+  StreamBuffer(GLenum target, size_t size);
+
+  // Copy 'data' into the current buffer, and leave that buffer bound to the
+  // target. Returns the offset of the copy within the buffer, to be used in
+  // place of a client-side pointer.
+  size_t Append(const void *data, size_t size);
+
+  // Switch to the next buffer. Call once per frame.
+  void AdvanceFrame();
+
+  // Free the GL buffers. They're recreated on the next Append().
+  void Delete();
+  // Forget the GL buffers without deleting them, once the context they were
+  // made in has been lost. They're recreated on the next Append().
+  void Forget();
+
+  GLuint buffer() const { return buffers_[frame_]; }
+
+ private:
+  static const int kNumFrames = 3;
+
+  // Replace the storage of the current buffer, and start writing to the
+  // beginning of it.
+  void Orphan();
+
+  GLenum target_;
+  size_t capacity_;
+  size_t offset_;
+  int frame_;
+  bool needs_orphan_;
+  GLuint buffers_[kNumFrames];
+};
+
+}  // namespace fpl
+
+#endif  // FPL_STREAM_BUFFER_H
@@ -38,8 +38,6 @@ bool TouchscreenButton::WillCapturePointer(const Pointer& pointer,
 
 void TouchscreenButton::AdvanceFrame(WorldTime delta_time, InputSystem* input,
                                      vec2 window_size) {
-  elapsed_time_ += delta_time;
-  button_.AdvanceFrame();
   bool down = false;
 
   for (size_t i = 0; i < input->pointers_.size(); i++) {
@@ -51,6 +49,12 @@ void TouchscreenButton::AdvanceFrame(WorldTime delta_time, InputSystem* input,
       break;
     }
   }
+  AdvanceFrame(delta_time, down);
+}
+
+void TouchscreenButton::AdvanceFrame(WorldTime delta_time, bool down) {
+  elapsed_time_ += delta_time;
+  button_.AdvanceFrame();
   button_.Update(down);
 }
 
@@ -61,13 +65,12 @@ bool TouchscreenButton::IsTriggered() {
           button_.went_down());
 }
 
-void TouchscreenButton::Render(Renderer& renderer) {
+void TouchscreenButton::Render(Renderer& renderer, DrawList* draw_list) {
   static const float kButtonZDepth = 0.0f;
 
   if (!is_visible_) {
     return;
   }
-  renderer.color() = color_;
 
   Material* mat = (button_.is_down() && down_material_ != nullptr)
                       ? down_material_
@@ -90,23 +93,21 @@ void TouchscreenButton::Render(Renderer& renderer) {
     base_size += mathfu::kOnes2f * pulse * 0.05f;
   }
 
-  vec3 texture_size =
-      texture_scale * vec3(mat->textures()[0]->size().x() * base_size.x(),
-                           -mat->textures()[0]->size().y() * base_size.y(), 0);
+  const vec2 mat_size = mat->TextureSize(0);
+  vec3 texture_size = texture_scale * vec3(mat_size.x() * base_size.x(),
+                                           -mat_size.y() * base_size.y(), 0);
 
   vec3 position = vec3(button_def()->texture_position()->x() * window_size.x(),
                        button_def()->texture_position()->y() * window_size.y(),
                        kButtonZDepth);
 
-  if (is_active_ || inactive_shader_ == nullptr) {
-    shader_->Set(renderer);
-  } else {
-    inactive_shader_->Set(renderer);
-  }
-  mat->Set(renderer);
-  Mesh::RenderAAQuadAlongX(position - (texture_size / 2.0f),
-                           position + (texture_size / 2.0f), vec2(0, 1),
-                           vec2(1, 0));
+  Shader* shader = is_active_ || inactive_shader_ == nullptr
+                       ? shader_
+                       : inactive_shader_;
+  draw_list->AddQuad(shader, mat, color_, position - (texture_size / 2.0f),
+                     position + (texture_size / 2.0f),
+                     mat->MapTexCoord(vec2(0, 1)),
+                     mat->MapTexCoord(vec2(1, 0)));
 }
 
 StaticImage::StaticImage()
@@ -141,29 +142,26 @@ bool StaticImage::Valid() const {
          materials_[current_material_index_] != nullptr && shader_ != nullptr;
 }
 
-void StaticImage::Render(Renderer& renderer) {
+void StaticImage::Render(Renderer& renderer, DrawList* draw_list) {
   if (!Valid()) return;
   if (!is_visible_) return;
-  renderer.color() = color_;
 
   Material* material = materials_[current_material_index_];
   const vec2 window_size = vec2(renderer.window_size());
   const float texture_scale =
       window_size.y() * one_over_cannonical_window_height_;
-  const vec2 texture_size =
-      texture_scale * vec2(material->textures()[0]->size()) * scale_;
+  const vec2 texture_size = texture_scale * material->TextureSize(0) * scale_;
   const vec2 position_percent = texture_position_;
   const vec2 position = window_size * position_percent;
 
   const vec3 position3d(position.x(), position.y(), image_def_->z_depth());
   const vec3 texture_size3d(texture_size.x(), -texture_size.y(), 0.0f);
 
-  shader_->Set(renderer);
-  material->Set(renderer);
-
-  Mesh::RenderAAQuadAlongX(position3d - texture_size3d * 0.5f,
-                           position3d + texture_size3d * 0.5f, vec2(0, 1),
-                           vec2(1, 0));
+  draw_list->AddQuad(shader_, material, color_,
+                     position3d - texture_size3d * 0.5f,
+                     position3d + texture_size3d * 0.5f,
+                     material->MapTexCoord(vec2(0, 1)),
+                     material->MapTexCoord(vec2(1, 0)));
 }
 
 }  // pie_noon
@@ -18,6 +18,7 @@
 #include "precompiled.h"
 #include "common.h"
 #include "config_generated.h"
+#include "draw_list.h"
 #include "input.h"
 #include "material.h"
 #include "renderer.h"
@@ -33,8 +34,10 @@ class TouchscreenButton {
   void AdvanceFrame(WorldTime delta_time, InputSystem* input, vec2 window_size);
 
   // bool HandlePointer(Pointer pointer, vec2 window_size);
-  void Render(Renderer& renderer);
-  void AdvanceFrame(WorldTime delta_time);
+  // Queue the button's quad in 'draw_list'.
+  void Render(Renderer& renderer, DrawList* draw_list);
+  // Advance with the pointer test already done, e.g. by GuiMenu.
+  void AdvanceFrame(WorldTime delta_time, bool down);
   ButtonId GetId() const;
   bool WillCapturePointer(const Pointer& pointer, vec2 window_size);
   bool IsTriggered();
@@ -128,7 +131,7 @@ class StaticImage {
   void Initialize(const StaticImageDef& image_def,
                   std::vector<Material*> materials, Shader* shader,
                   int cannonical_window_height);
-  void Render(Renderer& renderer);
+  void Render(Renderer& renderer, DrawList* draw_list);
   bool Valid() const;
   ButtonId GetId() const {
     return image_def_ == nullptr ? ButtonId_Undefined : image_def_->ID();
@@ -15,10 +15,18 @@
 #include "precompiled.h"
 
 #include "utilities.h"
+#include "asset_archive.h"
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif  // !defined(_WIN32)
 
 namespace fpl {
 
 bool LoadFile(const char* filename, std::string* dest) {
+  const AssetArchive* archive = GetAssetArchive();
+  if (archive && archive->Read(filename, dest)) return true;
+
   auto handle = SDL_RWFromFile(filename, "rb");
   if (!handle) {
     SDL_LogError(SDL_LOG_CATEGORY_ERROR, "LoadFile fail on %s", filename);
@@ -32,6 +40,24 @@ bool LoadFile(const char* filename, std::string* dest) {
   return len == rlen && len > 0;
 }
 
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+bool FileExists(const char* filename) {
+  const AssetArchive* archive = GetAssetArchive();
+  if (archive && archive->Contains(filename)) return true;
+
+  auto handle = SDL_RWFromFile(filename, "rb");
+  if (!handle) return false;
+  SDL_RWclose(handle);
+  return true;
+}
+
 #if defined(_WIN32)
 inline char* getcwd(char* buffer, int maxlen) {
   return _getcwd(buffer, maxlen);
@@ -131,42 +157,19 @@ bool TouchScreenDevice() {
 #endif
 }
 
-#ifdef __ANDROID__
-bool AndroidCheckDeviceList(const char* device_list[], const int num_devices) {
-  // Retrieve device name through JNI.
-  JNIEnv* env = reinterpret_cast<JNIEnv*>(SDL_AndroidGetJNIEnv());
-  jclass build_class = env->FindClass("android/os/Build");
-  jfieldID model_id =
-      env->GetStaticFieldID(build_class, "MODEL", "Ljava/lang/String;");
-  jstring model_obj =
-      static_cast<jstring>(env->GetStaticObjectField(build_class, model_id));
-  const char* device_name = env->GetStringUTFChars(model_obj, 0);
-
-  // Check if the device name is in the list.
-  bool result = true;
-  for (int i = 0; i < num_devices; ++i) {
-    if (strcmp(device_list[i], device_name) == 0) {
-      result = false;
-      break;
-    }
-  }
-
-  // Clean up
-  env->ReleaseStringUTFChars(model_obj, device_name);
-  env->DeleteLocalRef(model_obj);
-  env->DeleteLocalRef(build_class);
-  return result;
-}
-#endif
-
-bool MipmapGeneration16bppSupported() {
-#ifdef __ANDROID__
-  const char* device_list[] = {"Galaxy Nexus"};
-  return AndroidCheckDeviceList(device_list,
-                                sizeof(device_list) / sizeof(device_list[0]));
+uint64_t PeakResidentBytes() {
+#if defined(_WIN32)
+  return 0;
 #else
-  return true;
-#endif
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+  // Darwin reports bytes, where Linux and Android report kilobytes.
+  return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif  // defined(__APPLE__)
+#endif  // defined(_WIN32)
 }
 
 }  // namespace fpl
@@ -28,6 +28,15 @@ namespace fpl {
 
 bool LoadFile(const char* filename, std::string* dest);
 
+// 64-bit FNV-1a hash of the 'size' bytes at 'data'. Pass the result of a
+// previous call as 'hash' to continue hashing where it left off.
+static const uint64_t kHashSeed = 0xcbf29ce484222325ULL;
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash = kHashSeed);
+
+// True if filename can be opened for reading. Unlike LoadFile, logs nothing
+// when it can't, so is suitable for probing for optional files.
+bool FileExists(const char* filename);
+
 inline const mathfu::vec3 LoadVec3(const pie_noon::Vec3* v) {
   // Note: eschew the constructor that loads contiguous floats. It's faster
   // than the x, y, z constructor we use here, but doesn't account for the
@@ -64,7 +73,9 @@ std::string FileNameFromEnumName(const char* const enum_name,
 
 bool TouchScreenDevice();
 
-bool MipmapGeneration16bppSupported();
+// The most memory the process has had resident at once, in bytes, including
+// anything the GPU driver keeps in it. 0 where it can't be measured.
+uint64_t PeakResidentBytes();
 
 }  // namespace fpl
 
@@ -0,0 +1,302 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "worker_pool.h"
+#include "frame_profiler.h"
+
+namespace fpl {
+
+class WorkerPool::Job {
+ public:
+  enum State { kWaiting, kQueued, kRunning, kFinished };
+
+  explicit Job(const std::function<void()>& work)
+      : work(work), state(kWaiting), unfinished_dependencies(1) {}
+
+  std::function<void()> work;
+  std::atomic<int> state;
+  // Dependencies that haven't finished, plus one until Submit() is done
+  // adding them.
+  std::atomic<int> unfinished_dependencies;
+  // Jobs to release when this one finishes.  Protected by the pool's mutex_.
+  std::vector<JobHandle> dependents;
+};
+
+WorkerPool::WorkerPool()
+    : worker_tls_(SDL_TLSCreate()),
+      inline_tls_(SDL_TLSCreate()),
+      jobs_queued_(0),
+      jobs_unfinished_(0),
+      quit_(false) {
+  mutex_ = SDL_CreateMutex();
+  work_available_ = SDL_CreateCond();
+  job_finished_ = SDL_CreateCond();
+  assert(worker_tls_ && inline_tls_);
+  assert(mutex_ && work_available_ && job_finished_);
+}
+
+WorkerPool::~WorkerPool() {
+  Stop();
+  if (mutex_) {
+    SDL_DestroyMutex(mutex_);
+    mutex_ = nullptr;
+  }
+  if (work_available_) {
+    SDL_DestroyCond(work_available_);
+    work_available_ = nullptr;
+  }
+  if (job_finished_) {
+    SDL_DestroyCond(job_finished_);
+    job_finished_ = nullptr;
+  }
+}
+
+void WorkerPool::Start(int num_threads) {
+  assert(threads_.empty());
+  quit_ = false;
+  const size_t count = static_cast<size_t>(std::max(num_threads, 0));
+  deques_ = std::vector<JobDeque>(count + 1);
+  thread_args_.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    thread_args_[i].pool = this;
+    thread_args_[i].index = static_cast<int>(i);
+    SDL_Thread* thread = SDL_CreateThread(
+        WorkerPool::WorkerThread, "FPL Worker Thread", &thread_args_[i]);
+    if (!thread) {
+      SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                   "Can't create worker thread: %s\n", SDL_GetError());
+      break;
+    }
+    threads_.push_back(thread);
+  }
+}
+
+void WorkerPool::Stop() {
+  if (threads_.empty()) return;
+  SDL_LockMutex(mutex_);
+  quit_ = true;
+  SDL_CondBroadcast(work_available_);
+  SDL_UnlockMutex(mutex_);
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    SDL_WaitThread(threads_[i], nullptr);
+  }
+  threads_.clear();
+  assert(jobs_unfinished_ == 0);
+}
+
+WorkerPool::JobHandle WorkerPool::Submit(
+    const std::function<void()>& work,
+    const std::vector<JobHandle>& dependencies) {
+  JobHandle job = std::make_shared<Job>(work);
+  jobs_unfinished_++;
+  if (!dependencies.empty()) {
+    SDL_LockMutex(mutex_);
+    for (auto it = dependencies.begin(); it != dependencies.end(); ++it) {
+      if (*it && (*it)->state != Job::kFinished) {
+        (*it)->dependents.push_back(job);
+        job->unfinished_dependencies++;
+      }
+    }
+    SDL_UnlockMutex(mutex_);
+  }
+  Release(job);
+  return job;
+}
+
+WorkerPool::JobHandle WorkerPool::Submit(const std::function<void()>& work,
+                                         const JobHandle& dependency) {
+  return Submit(work, std::vector<JobHandle>(1, dependency));
+}
+
+bool WorkerPool::Finished(const JobHandle& job) const {
+  return !job || job->state == Job::kFinished;
+}
+
+void WorkerPool::Wait(const JobHandle& job) {
+  if (Finished(job)) return;
+  if (Claim(job)) {
+    Run(job);
+    return;
+  }
+  SDL_LockMutex(mutex_);
+  while (job->state != Job::kFinished) {
+    SDL_CondWait(job_finished_, mutex_);
+  }
+  SDL_UnlockMutex(mutex_);
+}
+
+void WorkerPool::RunTasks(size_t count,
+                          const std::function<void(size_t)>& task) {
+  // Not worth waking anyone up for.
+  if (threads_.empty() || count <= 1) {
+    for (size_t i = 0; i < count; ++i) task(i);
+    return;
+  }
+
+  // Every helper claims tasks until there are none left, so a helper that
+  // starts late costs next to nothing.
+  std::atomic<size_t> next_task(0);
+  const std::function<void()> claim_tasks = [&task, &next_task, count]() {
+    for (size_t index; (index = next_task++) < count;) {
+      FPL_PROFILE_SCOPE("Worker task");
+      task(index);
+    }
+  };
+  const size_t num_helpers = std::min(count - 1, threads_.size());
+  std::vector<JobHandle> helpers;
+  helpers.reserve(num_helpers);
+  for (size_t i = 0; i < num_helpers; ++i) {
+    helpers.push_back(Submit(claim_tasks));
+  }
+  claim_tasks();
+  for (size_t i = 0; i < helpers.size(); ++i) Wait(helpers[i]);
+}
+
+int WorkerPool::CurrentWorker() const {
+  const intptr_t slot = reinterpret_cast<intptr_t>(SDL_TLSGet(worker_tls_));
+  return static_cast<int>(slot) - 1;
+}
+
+void WorkerPool::Release(const JobHandle& job) {
+  if (--job->unfinished_dependencies == 0) Enqueue(job);
+}
+
+void WorkerPool::Enqueue(const JobHandle& job) {
+  job->state = Job::kQueued;
+  if (threads_.empty()) {
+    jobs_queued_++;
+    RunInline(job);
+    return;
+  }
+  const int worker = CurrentWorker();
+  JobDeque& deque =
+      deques_[worker >= 0 ? static_cast<size_t>(worker) : deques_.size() - 1];
+  SDL_AtomicLock(&deque.lock);
+  deque.jobs.push_back(job);
+  SDL_AtomicUnlock(&deque.lock);
+
+  // Counted under the lock, so that a worker can't check for work, miss
+  // this job, and then sleep through the signal.
+  SDL_LockMutex(mutex_);
+  jobs_queued_++;
+  SDL_CondSignal(work_available_);
+  SDL_UnlockMutex(mutex_);
+}
+
+void WorkerPool::RunInline(const JobHandle& job) {
+  // Jobs released by an inline job run after it rather than inside it, so
+  // that long chains of dependencies don't grow the stack.
+  std::vector<JobHandle>* pending =
+      static_cast<std::vector<JobHandle>*>(SDL_TLSGet(inline_tls_));
+  if (pending) {
+    pending->push_back(job);
+    return;
+  }
+  std::vector<JobHandle> jobs(1, job);
+  SDL_TLSSet(inline_tls_, &jobs, nullptr);
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    // Copied, since running it can add to 'jobs'.
+    const JobHandle next = jobs[i];
+    if (Claim(next)) Run(next);
+  }
+  SDL_TLSSet(inline_tls_, nullptr, nullptr);
+}
+
+bool WorkerPool::Pop(size_t index, bool steal, JobHandle* job) {
+  JobDeque& deque = deques_[index];
+  SDL_AtomicLock(&deque.lock);
+  const bool popped = !deque.jobs.empty();
+  if (popped && steal) {
+    job->swap(deque.jobs.front());
+    deque.jobs.pop_front();
+  } else if (popped) {
+    job->swap(deque.jobs.back());
+    deque.jobs.pop_back();
+  }
+  SDL_AtomicUnlock(&deque.lock);
+  return popped;
+}
+
+bool WorkerPool::RunNextJob(size_t index) {
+  for (size_t i = 0; i < deques_.size(); ++i) {
+    const size_t victim = (index + i) % deques_.size();
+    JobHandle job;
+    while (Pop(victim, victim != index, &job)) {
+      if (Claim(job)) {
+        Run(job);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool WorkerPool::Claim(const JobHandle& job) {
+  int expected = Job::kQueued;
+  if (!job->state.compare_exchange_strong(expected, Job::kRunning)) {
+    return false;
+  }
+  jobs_queued_--;
+  return true;
+}
+
+void WorkerPool::Run(const JobHandle& job) {
+  {
+    // Moved out, so that whatever it captured is destroyed before the jobs
+    // that depend on it start.
+    std::function<void()> work;
+    work.swap(job->work);
+    FPL_PROFILE_SCOPE("Worker job");
+    work();
+  }
+
+  std::vector<JobHandle> dependents;
+  SDL_LockMutex(mutex_);
+  job->state = Job::kFinished;
+  dependents.swap(job->dependents);
+  SDL_CondBroadcast(job_finished_);
+  if (--jobs_unfinished_ == 0 && quit_) SDL_CondBroadcast(work_available_);
+  SDL_UnlockMutex(mutex_);
+  for (auto it = dependents.begin(); it != dependents.end(); ++it) {
+    Release(*it);
+  }
+}
+
+void WorkerPool::Worker(int index) {
+  FrameProfiler::SetThreadName("Worker");
+  SDL_TLSSet(worker_tls_, reinterpret_cast<void*>(
+                              static_cast<intptr_t>(index) + 1),
+             nullptr);
+  for (;;) {
+    if (RunNextJob(index)) continue;
+    SDL_LockMutex(mutex_);
+    // Quit only once every job has finished, since the ones still running
+    // may yet release more.
+    while (jobs_queued_ <= 0 && !(quit_ && jobs_unfinished_ == 0)) {
+      SDL_CondWait(work_available_, mutex_);
+    }
+    const bool done = jobs_queued_ <= 0;
+    SDL_UnlockMutex(mutex_);
+    if (done) break;
+  }
+}
+
+int WorkerPool::WorkerThread(void* user_data) {
+  const WorkerThreadArgs* args = static_cast<WorkerThreadArgs*>(user_data);
+  args->pool->Worker(args->index);
+  return 0;
+}
+
+}  // namespace fpl
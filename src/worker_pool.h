@@ -0,0 +1,154 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_WORKER_POOL_H
+#define FPL_WORKER_POOL_H
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include "entity/entity_manager.h"
+
+namespace fpl {
+
+// The engine's one set of worker threads, shared by everything that has work
+// to do off the main thread: asset loading, entity and particle updates, text
+// shaping and analytics. Sharing them means the subsystems together never
+// run more threads than the pool was started with, however busy they get.
+//
+// Work is submitted as jobs. Each worker has a deque of its own: the jobs it
+// submits go on the back, and it runs them newest first, while idle workers
+// steal the oldest jobs from the front of each other's deques. Jobs submitted
+// from any other thread go on a shared deque that every worker steals from.
+// A job can depend on others, in which case it isn't queued until they have
+// all finished.
+//
+// A pool with no threads runs each job on the thread that makes it runnable,
+// once that thread's current job, if any, has finished.
+class WorkerPool : public entity::UpdateRunnerInterface {
+ public:
+  class Job;
+  // Refers to a submitted job, for waiting on it or depending on it. Null
+  // handles count as finished.
+  typedef std::shared_ptr<Job> JobHandle;
+
+  WorkerPool();
+  virtual ~WorkerPool();
+
+  // Launch num_threads worker threads.  Must not already be started.
+  void Start(int num_threads);
+
+  // Waits for every job submitted so far to finish, then for the worker
+  // threads to exit.  Nothing else may submit jobs while it does.  You can
+  // restart with Start().
+  void Stop();
+
+  // Queues 'work' to run once every job in 'dependencies' has finished.
+  // Call from any thread, including from inside another job.
+  JobHandle Submit(const std::function<void()>& work,
+                   const std::vector<JobHandle>& dependencies);
+  JobHandle Submit(const std::function<void()>& work,
+                   const JobHandle& dependency = JobHandle());
+
+  // True once 'job' has finished running.
+  bool Finished(const JobHandle& job) const;
+
+  // A sync point: returns once 'job' has finished.  If no worker has started
+  // it yet, it runs here instead, so that the caller never waits behind
+  // unrelated jobs.  Inside a job, only wait for jobs whose dependencies
+  // have already finished, or every worker could end up waiting.
+  void Wait(const JobHandle& job);
+
+  // Calls task(0) through task(count - 1), spread over the worker threads and
+  // the calling thread, and returns when they have all finished.  The batch
+  // costs one job per helping worker, rather than one per task.
+  virtual void RunTasks(size_t count, const std::function<void(size_t)>& task);
+
+  int num_threads() const { return static_cast<int>(threads_.size()); }
+
+  // Index of the worker thread calling this, or -1 on any other thread.
+  int CurrentWorker() const;
+
+ private:
+  // A deque of queued jobs.  Jobs another thread has already claimed are
+  // left in place, and skipped when they're popped.
+  struct JobDeque {
+    JobDeque() : lock(0) {}
+    SDL_SpinLock lock;
+    std::deque<JobHandle> jobs;
+  };
+
+  struct WorkerThreadArgs {
+    WorkerPool* pool;
+    int index;
+  };
+
+  void Worker(int index);
+  static int WorkerThread(void* user_data);
+
+  // Counts off one of the job's dependencies, queuing it after the last.
+  void Release(const JobHandle& job);
+  void Enqueue(const JobHandle& job);
+  // Runs 'job' on this thread, after the rest of the jobs this thread is
+  // already running inline.  Only used when there are no threads.
+  void RunInline(const JobHandle& job);
+
+  // Takes the job from the back of deques_[index], or the front if
+  // 'steal'.  Returns false if the deque is empty.
+  bool Pop(size_t index, bool steal, JobHandle* job);
+  // Runs one queued job, looking in deques_[index] first and then stealing
+  // from the others.  Returns false if there was nothing to run.
+  bool RunNextJob(size_t index);
+
+  // Marks a queued job as running.  Returns false if it isn't queued, or if
+  // another thread got to it first.
+  bool Claim(const JobHandle& job);
+  // Runs a claimed job, then releases the jobs that depend on it.
+  void Run(const JobHandle& job);
+
+  std::vector<SDL_Thread*> threads_;
+
+  // The threads hold pointers into this, so it's sized before they start.
+  std::vector<WorkerThreadArgs> thread_args_;
+
+  // One deque per worker thread, then the shared one.  Sized by Start().
+  std::vector<JobDeque> deques_;
+
+  // Per thread, one more than the index of the worker it is, or 0.
+  SDL_TLSID worker_tls_;
+
+  // Per thread, the jobs waiting for RunInline(), or null.
+  SDL_TLSID inline_tls_;
+
+  // This lock protects the dependents and finishing of every job, quit_,
+  // and waiting on the conditions below.
+  SDL_mutex* mutex_;
+
+  // Signalled when a job is queued, and when the workers should quit.
+  SDL_cond* work_available_;
+
+  // Signalled when a job finishes.
+  SDL_cond* job_finished_;
+
+  // Jobs queued but not yet claimed, and jobs submitted but not yet
+  // finished.
+  std::atomic<int> jobs_queued_;
+  std::atomic<int> jobs_unfinished_;
+
+  bool quit_;
+};
+
+}  // namespace fpl
+
+#endif  // FPL_WORKER_POOL_H
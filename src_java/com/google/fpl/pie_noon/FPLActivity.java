@@ -22,10 +22,16 @@ import android.app.AlertDialog;
 import android.content.Context;
 import android.content.DialogInterface;
 import android.content.Intent;
+import android.content.IntentFilter;
 import android.content.SharedPreferences;
 import android.content.pm.PackageManager;
 import android.graphics.Point;
+import android.hardware.Sensor;
+import android.hardware.SensorEvent;
+import android.hardware.SensorEventListener;
+import android.hardware.SensorManager;
 import android.nfc.NdefMessage;
+import android.os.BatteryManager;
 import android.os.Bundle;
 import android.text.Html;
 import android.text.method.LinkMovementMethod;
@@ -72,6 +78,23 @@ public class FPLActivity extends SDLActivity implements
   private Eye leftEyeNoDistortion;
   private Eye rightEyeNoDistortion;
 
+  // The head tracker integrates the gyroscope's samples, so its pose is as of
+  // the latest one. Its timestamp lets the native code predict the pose
+  // forward to when the frame is displayed.
+  private SensorManager sensorManager;
+  private Sensor gyroscope;
+  private volatile long gyroscopeTimestamp = 0;
+  private final SensorEventListener gyroscopeListener =
+      new SensorEventListener() {
+        @Override
+        public void onSensorChanged(SensorEvent event) {
+          gyroscopeTimestamp = event.timestamp;
+        }
+
+        @Override
+        public void onAccuracyChanged(Sensor sensor, int accuracy) {}
+      };
+
   @Override
   public void onCreate(Bundle savedInstanceState) {
     super.onCreate(savedInstanceState);
@@ -85,6 +108,8 @@ public class FPLActivity extends SDLActivity implements
     monocularEye = new Eye(Eye.Type.MONOCULAR);
     leftEyeNoDistortion = new Eye(Eye.Type.LEFT);
     rightEyeNoDistortion = new Eye(Eye.Type.RIGHT);
+    sensorManager = (SensorManager)getSystemService(Context.SENSOR_SERVICE);
+    gyroscope = sensorManager.getDefaultSensor(Sensor.TYPE_GYROSCOPE);
     magnetSensor = new MagnetSensor(this);
     magnetSensor.setOnCardboardTriggerListener(this);
     nfcSensor = NfcSensor.getInstance(this);
@@ -101,6 +126,10 @@ public class FPLActivity extends SDLActivity implements
     cardboardView.onResume();
     magnetSensor.start();
     nfcSensor.onResume(this);
+    if (gyroscope != null) {
+      sensorManager.registerListener(gyroscopeListener, gyroscope,
+                                     SensorManager.SENSOR_DELAY_FASTEST);
+    }
   }
 
   @Override
@@ -109,6 +138,7 @@ public class FPLActivity extends SDLActivity implements
     cardboardView.onPause();
     magnetSensor.stop();
     nfcSensor.onPause(this);
+    sensorManager.unregisterListener(gyroscopeListener);
   }
 
   // GPG's GUIs need activity lifecycle events to function properly, but
@@ -325,6 +355,27 @@ public class FPLActivity extends SDLActivity implements
       TypedValue.COMPLEX_UNIT_DIP, dp, getResources().getDisplayMetrics());
   }
 
+  // The battery's temperature in tenths of a degree C, or -1 if unknown.
+  public int GetBatteryTemperature() {
+    Intent battery = registerReceiver(
+        null, new IntentFilter(Intent.ACTION_BATTERY_CHANGED));
+    if (battery == null)
+      return -1;
+    return battery.getIntExtra(BatteryManager.EXTRA_TEMPERATURE, -1);
+  }
+
+  // True if the battery is below 15% and not charging.
+  public boolean IsBatteryLow() {
+    Intent battery = registerReceiver(
+        null, new IntentFilter(Intent.ACTION_BATTERY_CHANGED));
+    if (battery == null)
+      return false;
+    int level = battery.getIntExtra(BatteryManager.EXTRA_LEVEL, -1);
+    int scale = battery.getIntExtra(BatteryManager.EXTRA_SCALE, -1);
+    int plugged = battery.getIntExtra(BatteryManager.EXTRA_PLUGGED, 0);
+    return plugged == 0 && level >= 0 && scale > 0 && level * 100 < scale * 15;
+  }
+
   public void SendTrackerEvent(String category, String action) {
     tracker.send(new HitBuilders.EventBuilder()
              .setCategory(category)
@@ -390,8 +441,11 @@ public class FPLActivity extends SDLActivity implements
     cardboardView.updateCardboardDeviceParams(newParams);
   }
 
-  // Function to access the transforms of the eyes, which includes head tracking
-  public void GetEyeViews(float[] leftTransform, float[] rightTransform) {
+  // Function to access the transforms of the eyes, which includes head tracking.
+  // Returns the timestamp of the gyroscope sample they're based on, in ns, or
+  // 0 if there isn't one.
+  public long GetEyeViews(float[] leftTransform, float[] rightTransform) {
+    long timestamp = gyroscopeTimestamp;
     cardboardView.getCurrentEyeParams(headTransform,
                                       leftEye,
                                       rightEye,
@@ -406,6 +460,7 @@ public class FPLActivity extends SDLActivity implements
       float[] rightView = rightEye.getEyeView();
       System.arraycopy(rightView, 0, rightTransform, 0, 16);
     }
+    return timestamp;
   }
 
   // Reset the head tracker to the current heading
@@ -16,6 +16,8 @@
 * 3. This notice may not be removed or altered from any source distribution.
 */
 
+#include <chrono>
+#include <cstdio>
 #include <string>
 #include "character_state_machine.h"
 #include "timeline_generated.h"
@@ -28,6 +30,88 @@
 namespace pn = ::fpl::pie_noon;
 namespace fb = ::flatbuffers;
 
+// Inputs with only the given buttons held.
+static pn::ConditionInputs MakeInputs(int32_t is_down) {
+  pn::ConditionInputs inputs;
+  inputs.is_down = is_down;
+  inputs.went_down = 0;
+  inputs.went_up = 0;
+  inputs.animation_time = 0;
+  inputs.current_time = 0;
+  inputs.is_multiscreen = false;
+  return inputs;
+}
+
+// Deterministic pseudo random numbers, so failures can be reproduced.
+class Random {
+ public:
+  explicit Random(uint32_t seed) : state_(seed) {}
+  uint32_t Next() {
+    state_ = state_ * 1664525u + 1013904223u;
+    return state_ >> 8;
+  }
+  // A few bits out of the 15 logical inputs.
+  uint16_t Bits() { return static_cast<uint16_t>(Next() & Next() & 0x7FFF); }
+
+ private:
+  uint32_t state_;
+};
+
+// Builds a valid state machine in 'builder', where every state has
+// 'transitions_per_state' transitions with random conditions.
+static const pn::CharacterStateMachineDef* BuildRandomStateMachine(
+    fb::FlatBufferBuilder* builder, int transitions_per_state, Random* rand) {
+  std::vector<flatbuffers::Offset<pn::CharacterState>> states;
+  for (int i = 0; i < pn::StateId_Count; i++) {
+    std::vector<flatbuffers::Offset<pn::Transition>> trans_vec;
+    for (int j = 0; j < transitions_per_state; j++) {
+      const int time = static_cast<int>(rand->Next() % 500);
+      auto condition = pn::CreateCondition(
+          *builder, static_cast<pn::LogicalInputs>(rand->Bits() & rand->Bits()),
+          static_cast<pn::LogicalInputs>(rand->Bits() & rand->Bits()),
+          static_cast<pn::LogicalInputs>(rand->Bits() & rand->Bits()),
+          static_cast<pn::LogicalInputs>(rand->Bits() & rand->Bits()), time,
+          time + static_cast<int>(rand->Next() % 1000),
+          static_cast<pn::GameModeCondition>(rand->Next() % 3));
+      const pn::StateId target =
+          static_cast<pn::StateId>(rand->Next() % pn::StateId_Count);
+      trans_vec.push_back(pn::CreateTransition(*builder, target, condition));
+    }
+    auto trans = builder->CreateVector<fb::Offset<pn::Transition>>(
+        &trans_vec.front(), trans_vec.size());
+    auto timeline = fpl::CreateTimeline(*builder);
+    states.push_back(pn::CreateCharacterState(
+        *builder, static_cast<pn::StateId>(i), trans, timeline));
+  }
+  auto state_machine_offset = pn::CreateCharacterStateMachineDef(*builder,
+      builder->CreateVector<fb::Offset<pn::CharacterState>>(
+          &states.front(), states.size()), pn::StateId_Idling);
+  builder->Finish(state_machine_offset);
+  return pn::GetCharacterStateMachineDef(builder->GetBufferPointer());
+}
+
+static pn::ConditionInputs RandomInputs(Random* rand) {
+  pn::ConditionInputs inputs = MakeInputs(rand->Bits() | rand->Bits());
+  inputs.went_down = rand->Bits() & inputs.is_down;
+  inputs.went_up = rand->Bits() & ~inputs.is_down & 0x7FFF;
+  inputs.animation_time = static_cast<int>(rand->Next() % 1500);
+  inputs.is_multiscreen = (rand->Next() & 1) != 0;
+  return inputs;
+}
+
+// The transition CharacterStateMachine used to follow, by walking the
+// flatbuffer.
+static int FindTransitionInDef(const pn::CharacterStateMachineDef* def,
+                               int state, const pn::ConditionInputs& inputs) {
+  auto transitions = def->states()->Get(state)->transitions();
+  for (auto it = transitions->begin(); it != transitions->end(); ++it) {
+    if (it->condition() && EvaluateCondition(it->condition(), inputs)) {
+      return it->target_state();
+    }
+  }
+  return -1;
+}
+
 TEST(CharacterStateMachineTests, NotAllStatesUsedDeathTest) {
   flatbuffers::FlatBufferBuilder builder;
   std::vector<flatbuffers::Offset<pn::CharacterState>> states;
@@ -94,9 +178,9 @@ TEST(CharacterStateMachineTests, FollowTransitions) {
   for (uint8_t i = 0; i < pn::StateId_Count; i++) {
     std::vector<flatbuffers::Offset<pn::Transition>> trans_vec;
     uint8_t target_id = (i + 1) % pn::StateId_Count;
-    uint16_t conditions = pn::LogicalInputs_ThrowPie;
+    auto condition = pn::CreateCondition(builder, pn::LogicalInputs_ThrowPie);
     trans_vec.push_back(pn::CreateTransition(builder,
-                              static_cast<pn::StateId>(target_id), conditions));
+                              static_cast<pn::StateId>(target_id), condition));
 
     auto trans = builder.CreateVector<fb::Offset<pn::Transition>>(
       &trans_vec.front(), trans_vec.size());
@@ -113,16 +197,13 @@ TEST(CharacterStateMachineTests, FollowTransitions) {
 
   CharacterStateMachineDef_Validate(def);
 
-  pn::CharacterStateMachine state_machine(def);
-  pn::ConditionInputs correct_input1;
-  correct_input1.is_down = pn::LogicalInputs_ThrowPie;
-
-  pn::ConditionInputs correct_input2;
-  correct_input2.is_down =
-      pn::LogicalInputs_ThrowPie | pn::LogicalInputs_Deflect;
-
-  pn::ConditionInputs incorrect_input;
-  incorrect_input.is_down = pn::LogicalInputs_Deflect;
+  pn::CharacterStateMachineTable table;
+  table.Initialize(def);
+  pn::CharacterStateMachine state_machine(&table);
+  pn::ConditionInputs correct_input1 = MakeInputs(pn::LogicalInputs_ThrowPie);
+  pn::ConditionInputs correct_input2 =
+      MakeInputs(pn::LogicalInputs_ThrowPie | pn::LogicalInputs_Deflect);
+  pn::ConditionInputs incorrect_input = MakeInputs(pn::LogicalInputs_Deflect);
 
   ASSERT_EQ(state_machine.current_state()->id(), 0);
   state_machine.Update(correct_input1);
@@ -133,6 +214,86 @@ TEST(CharacterStateMachineTests, FollowTransitions) {
   ASSERT_EQ(state_machine.current_state()->id(), 2);
 }
 
+TEST(CharacterStateMachineTests, TableMatchesConditions) {
+  Random rand(1);
+  flatbuffers::FlatBufferBuilder builder;
+  auto def = BuildRandomStateMachine(&builder, 6, &rand);
+  ASSERT_TRUE(CharacterStateMachineDef_Validate(def));
+
+  pn::CharacterStateMachineTable table;
+  table.Initialize(def);
+  for (int i = 0; i < 10000; i++) {
+    const pn::ConditionInputs inputs = RandomInputs(&rand);
+    const int state = static_cast<int>(rand.Next() % pn::StateId_Count);
+    ASSERT_EQ(FindTransitionInDef(def, state, inputs),
+              table.FindTransition(state, inputs));
+  }
+}
+
+TEST(CharacterStateMachineTests, BatchMatchesSingle) {
+  static const int kCount = 37;
+  Random rand(3);
+  flatbuffers::FlatBufferBuilder builder;
+  auto def = BuildRandomStateMachine(&builder, 5, &rand);
+  pn::CharacterStateMachineTable table;
+  table.Initialize(def);
+
+  std::vector<pn::ConditionInputs> inputs;
+  std::vector<int> states, animation_time, targets(kCount);
+  std::vector<int32_t> is_down, went_down, went_up;
+  const bool is_multiscreen = true;
+  for (int i = 0; i < kCount; i++) {
+    inputs.push_back(RandomInputs(&rand));
+    inputs.back().is_multiscreen = is_multiscreen;
+    states.push_back(static_cast<int>(rand.Next() % pn::StateId_Count));
+    is_down.push_back(inputs.back().is_down);
+    went_down.push_back(inputs.back().went_down);
+    went_up.push_back(inputs.back().went_up);
+    animation_time.push_back(inputs.back().animation_time);
+  }
+  table.FindTransitions(kCount, &states[0], &is_down[0], &went_down[0],
+                        &went_up[0], &animation_time[0], is_multiscreen,
+                        &targets[0]);
+  for (int i = 0; i < kCount; i++) {
+    EXPECT_EQ(table.FindTransition(states[i], inputs[i]), targets[i]);
+  }
+}
+
+// Not a correctness test: reports how long following transitions takes with
+// the table and with the flatbuffer.
+TEST(CharacterStateMachineTests, TransitionBenchmark) {
+  static const int kIterations = 200000;
+  static const int kNumInputs = 256;
+  Random rand(2);
+  flatbuffers::FlatBufferBuilder builder;
+  auto def = BuildRandomStateMachine(&builder, 8, &rand);
+  pn::CharacterStateMachineTable table;
+  table.Initialize(def);
+  std::vector<pn::ConditionInputs> inputs;
+  for (int i = 0; i < kNumInputs; i++) inputs.push_back(RandomInputs(&rand));
+
+  typedef std::chrono::high_resolution_clock Clock;
+  int def_sum = 0;
+  const Clock::time_point def_start = Clock::now();
+  for (int i = 0; i < kIterations; i++) {
+    def_sum += FindTransitionInDef(def, i % pn::StateId_Count,
+                                   inputs[i % kNumInputs]);
+  }
+  const Clock::time_point table_start = Clock::now();
+  int table_sum = 0;
+  for (int i = 0; i < kIterations; i++) {
+    table_sum += table.FindTransition(i % pn::StateId_Count,
+                                      inputs[i % kNumInputs]);
+  }
+  const Clock::time_point table_end = Clock::now();
+
+  EXPECT_EQ(def_sum, table_sum);
+  typedef std::chrono::duration<double, std::nano> Nanoseconds;
+  printf("flatbuffer: %.1fns, table: %.1fns per update\n",
+         Nanoseconds(table_start - def_start).count() / kIterations,
+         Nanoseconds(table_end - table_start).count() / kIterations);
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,141 @@
+#include "gtest/gtest.h"
+#include "entity/dense_pool.h"
+
+// Allocator that counts the allocations made through it, to check that
+// pools stay within what was reserved.
+static int g_allocations = 0;
+
+template <typename T>
+struct CountingAllocator {
+  typedef T value_type;
+  CountingAllocator() {}
+  template <typename U>
+  CountingAllocator(const CountingAllocator<U>&) {}
+  T* allocate(size_t n) {
+    g_allocations++;
+    return std::allocator<T>().allocate(n);
+  }
+  void deallocate(T* p, size_t n) { std::allocator<T>().deallocate(p, n); }
+};
+template <typename T, typename U>
+bool operator==(const CountingAllocator<T>&, const CountingAllocator<U>&) {
+  return true;
+}
+template <typename T, typename U>
+bool operator!=(const CountingAllocator<T>&, const CountingAllocator<U>&) {
+  return false;
+}
+
+class DensePoolTests : public ::testing::Test {
+ protected:
+  virtual void SetUp() {}
+  virtual void TearDown() {}
+};
+
+// Iterate over a pool and modify the values.
+TEST_F(DensePoolTests, Iterator_LoopAndModify) {
+  int data[] = {1, 2, 3};
+  fpl::DensePool<int> pool;
+  *pool.GetNewElement(fpl::kAddToBack) = data[0];
+  *pool.GetNewElement(fpl::kAddToBack) = data[1];
+  *pool.GetNewElement(fpl::kAddToBack) = data[2];
+
+  int i = 0;
+  for (fpl::DensePool<int>::Iterator it = pool.begin(); it != pool.end();
+       ++it) {
+    *it += 1;
+    EXPECT_EQ(data[i] + 1, *it);
+    i++;
+  }
+  EXPECT_EQ(3, i);
+}
+
+// Freeing an element moves the last one into its place, without changing
+// the handles of the elements that remain.
+TEST_F(DensePoolTests, FreeElement_KeepsHandles) {
+  fpl::DensePool<int> pool;
+  size_t handles[4];
+  for (int i = 0; i < 4; ++i) {
+    auto it = pool.GetNewElement(fpl::kAddToBack);
+    *it = i;
+    handles[i] = it.index();
+  }
+
+  pool.FreeElement(handles[1]);
+  EXPECT_EQ(3u, pool.active_count());
+  EXPECT_EQ(nullptr, pool.GetElementData(handles[1]));
+  EXPECT_EQ(0, *pool.GetElementData(handles[0]));
+  EXPECT_EQ(2, *pool.GetElementData(handles[2]));
+  EXPECT_EQ(3, *pool.GetElementData(handles[3]));
+
+  // The active elements stay contiguous.
+  int expected[] = {0, 3, 2};
+  int i = 0;
+  for (auto it = pool.begin(); it != pool.end(); ++it, ++i) {
+    EXPECT_EQ(expected[i], *it);
+    EXPECT_EQ(pool.GetElementData(it.index()), &*it);
+  }
+  EXPECT_EQ(3, i);
+}
+
+// Freed handles are reused by later allocations.
+TEST_F(DensePoolTests, GetNewElement_ReusesHandles) {
+  fpl::DensePool<int> pool;
+  pool.GetNewElement(fpl::kAddToBack);
+  const size_t freed = pool.GetNewElement(fpl::kAddToBack).index();
+  pool.FreeElement(freed);
+  EXPECT_EQ(freed, pool.GetNewElement(fpl::kAddToBack).index());
+  EXPECT_EQ(2u, pool.Size());
+}
+
+// Freeing through an iterator visits every element exactly once.
+TEST_F(DensePoolTests, FreeElement_WhileIterating) {
+  fpl::DensePool<int> pool;
+  for (int i = 0; i < 6; ++i) {
+    *pool.GetNewElement(fpl::kAddToBack) = i;
+  }
+
+  int visited = 0;
+  for (auto it = pool.begin(); it != pool.end();) {
+    visited++;
+    if (*it % 2 == 0) {
+      it = pool.FreeElement(it);
+    } else {
+      ++it;
+    }
+  }
+  EXPECT_EQ(6, visited);
+  EXPECT_EQ(3u, pool.active_count());
+  for (auto it = pool.cbegin(); it != pool.cend(); ++it) {
+    EXPECT_EQ(1, *it % 2);
+  }
+}
+
+// Once reserved, allocating and freeing within the capacity doesn't allocate.
+TEST_F(DensePoolTests, Reserve_NoAllocationWithinCapacity) {
+  typedef fpl::DensePool<int, CountingAllocator<int> > IntPool;
+  IntPool pool;
+  pool.Reserve(16);
+  EXPECT_LE(16u, pool.Capacity());
+
+  const int allocations = g_allocations;
+  size_t handles[16];
+  for (int i = 0; i < 16; ++i) {
+    auto it = pool.GetNewElement(fpl::kAddToBack);
+    *it = i;
+    handles[i] = it.index();
+  }
+  for (int i = 0; i < 16; ++i) {
+    pool.FreeElement(handles[i]);
+  }
+  for (int i = 0; i < 16; ++i) {
+    pool.GetNewElement(fpl::kAddToBack);
+  }
+  EXPECT_EQ(allocations, g_allocations);
+  EXPECT_EQ(16u, pool.active_count());
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -142,6 +142,56 @@ TEST_F(FontManagerTests, Glyph_Cache_InvolveEviction) {
   EXPECT_EQ(cache, cache);
 }
 
+// Test to
+// 1) Create a cache (256x256) that may grow to 2 pages.
+// 2) Fill both pages with 32x32 entries, and see the second page is added
+// rather than rows being evicted.
+// 3) Add one more entry and see it evicts a row once both pages are full.
+TEST_F(FontManagerTests, Glyph_Cache_MultiplePages) {
+  mathfu::vec2i cache_size = mathfu::vec2i(256, 256);
+  int32_t image_width = 31;
+  int32_t image_height = 31;
+
+  // Initialize Glyph cache
+  std::unique_ptr<fpl::GlyphCache<uint8_t>> cache(
+      new fpl::GlyphCache<uint8_t>(cache_size, 2));
+  std::unique_ptr<uint8_t[]> image(new uint8_t[image_width * image_height]);
+  EXPECT_EQ(1, cache->get_num_pages());
+
+  fpl::GlyphCacheEntry entry;
+  entry.set_size(mathfu::vec2i(image_width, image_height));
+
+  // Fill both pages.
+  const int32_t entries_per_page =
+      (cache_size.y() / (image_height + fpl::kGlyphCachePaddingY)) *
+      (cache_size.x() / (image_width + fpl::kGlyphCachePaddingX));
+  for (int32_t k = 0; k < entries_per_page * 2; ++k) {
+    entry.set_code_point(k);
+    auto p = cache->Set(image.get(), image_height, entry);
+    ASSERT_TRUE(p != nullptr);
+    EXPECT_EQ(k < entries_per_page ? 0 : 1, p->get_page());
+  }
+  EXPECT_EQ(2, cache->get_num_pages());
+  EXPECT_EQ(1, cache->get_stats().pages_added);
+  EXPECT_EQ(0, cache->get_stats().row_flushes);
+  EXPECT_TRUE(cache->get_page(1)->get_dirty_state());
+
+  // Rows used in the current cycle can't be evicted.
+  entry.set_code_point(entries_per_page * 2);
+  EXPECT_TRUE(cache->Set(image.get(), image_height, entry) == nullptr);
+  EXPECT_EQ(1, cache->get_stats().set_fails);
+
+  // In the next cycle, the least recently used row, on the first page, goes.
+  cache->Update();
+  auto p = cache->Set(image.get(), image_height, entry);
+  ASSERT_TRUE(p != nullptr);
+  EXPECT_EQ(0, p->get_page());
+  EXPECT_EQ(2, cache->get_num_pages());
+  EXPECT_EQ(1, cache->get_stats().row_flushes);
+  EXPECT_TRUE(cache->Find(0, image_height) == nullptr);
+  EXPECT_TRUE(cache->Find(entries_per_page, image_height) != nullptr);
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
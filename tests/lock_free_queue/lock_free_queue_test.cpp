@@ -0,0 +1,69 @@
+#include <thread>
+#include "gtest/gtest.h"
+#include "lock_free_queue.h"
+
+class LockFreeQueueTests : public ::testing::Test {
+ protected:
+  virtual void SetUp() {}
+  virtual void TearDown() {}
+};
+
+// Values come out in the order they went in, and a full queue refuses more.
+TEST_F(LockFreeQueueTests, PushPop_Fifo) {
+  fpl::LockFreeQueue<int> queue(4);
+  int value = 0;
+  EXPECT_FALSE(queue.TryPop(&value));
+
+  // Go around the ring a few times.
+  for (int lap = 0; lap < 3; ++lap) {
+    for (int i = 0; i < 4; ++i) {
+      EXPECT_TRUE(queue.TryPush(lap * 10 + i));
+    }
+    EXPECT_FALSE(queue.TryPush(-1));
+    for (int i = 0; i < 4; ++i) {
+      EXPECT_TRUE(queue.TryPop(&value));
+      EXPECT_EQ(lap * 10 + i, value);
+    }
+    EXPECT_FALSE(queue.TryPop(&value));
+  }
+}
+
+// Every value pushed by several threads is popped exactly once by the others.
+TEST_F(LockFreeQueueTests, PushPop_ManyThreads) {
+  static const int kThreads = 4;
+  static const int kValuesPerThread = 10000;
+  fpl::LockFreeQueue<int> queue(64);
+  std::vector<int> popped(kThreads * kValuesPerThread, 0);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.push_back(std::thread([&queue, t]() {
+      for (int i = 0; i < kValuesPerThread; ++i) {
+        while (!queue.TryPush(t * kValuesPerThread + i)) {
+          std::this_thread::yield();
+        }
+      }
+    }));
+    threads.push_back(std::thread([&queue, &popped]() {
+      for (int i = 0; i < kValuesPerThread; ++i) {
+        int value;
+        while (!queue.TryPop(&value)) {
+          std::this_thread::yield();
+        }
+        popped[value]++;
+      }
+    }));
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+
+  for (size_t i = 0; i < popped.size(); ++i) {
+    EXPECT_EQ(1, popped[i]);
+  }
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,257 @@
+#include <memory>
+#include <string>
+#include <vector>
+#include "SDL.h"
+#include "gtest/gtest.h"
+#include "gpg_multiplayer.h"
+#include "loopback_transport.h"
+
+// Remembers everything a transport told it, with the network's time.
+class RecordingListener : public fpl::MultiplayerTransport::Listener {
+ public:
+  struct Message {
+    std::string from;
+    std::vector<uint8_t> payload;
+    bool reliable;
+    uint32_t time;
+  };
+
+  RecordingListener() : now(0), accepted(0), rejected(0), disconnects(0) {}
+
+  virtual void OnAdvertisingResult(bool, const std::string&) {}
+  virtual void OnConnectionRequest(const std::string& instance_id,
+                                   const std::string&) {
+    requests.push_back(instance_id);
+  }
+  virtual void OnEndpointFound(const std::string& instance_id,
+                               const std::string&) {
+    found.push_back(instance_id);
+  }
+  virtual void OnEndpointLost(const std::string&) {}
+  virtual void OnConnectionResponse(const std::string&, bool ok) {
+    (ok ? accepted : rejected)++;
+  }
+  virtual void OnMessageReceived(const std::string& instance_id,
+                                 const std::vector<uint8_t>& payload,
+                                 bool reliable) {
+    Message message = {instance_id, payload, reliable, now};
+    messages.push_back(message);
+  }
+  virtual void OnDisconnected(const std::string&) { disconnects++; }
+
+  uint32_t now;
+  std::vector<std::string> requests;
+  std::vector<std::string> found;
+  int accepted;
+  int rejected;
+  int disconnects;
+  std::vector<Message> messages;
+};
+
+class LoopbackTransportTests : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    host_.reset(new fpl::LoopbackTransport(&network_, "host"));
+    client_.reset(new fpl::LoopbackTransport(&network_, "client"));
+    host_->set_listener(&host_listener_);
+    client_->set_listener(&client_listener_);
+  }
+  virtual void TearDown() {
+    client_.reset();
+    host_.reset();
+  }
+
+  // Step the network a millisecond at a time, until it's at 'time'.
+  void RunUntil(uint32_t time) {
+    while (now_ < time) {
+      ++now_;
+      host_listener_.now = client_listener_.now = now_;
+      network_.Update(now_);
+    }
+  }
+
+  // Connect the client to the host, and return the time that took.
+  uint32_t Connect() {
+    const uint32_t start = now_;
+    host_->StartAdvertising("Host", std::vector<std::string>());
+    client_->StartDiscovery("");
+    RunUntil(now_ + 1000);
+    EXPECT_EQ(1u, client_listener_.found.size());
+    client_->SendConnectionRequest("Client", "host");
+    while (host_listener_.requests.empty()) RunUntil(now_ + 1);
+    host_->AcceptConnectionRequest("client");
+    while (client_listener_.accepted == 0) RunUntil(now_ + 1);
+    return now_ - start;
+  }
+
+  fpl::LoopbackNetwork network_;
+  std::unique_ptr<fpl::LoopbackTransport> host_;
+  std::unique_ptr<fpl::LoopbackTransport> client_;
+  RecordingListener host_listener_;
+  RecordingListener client_listener_;
+  uint32_t now_ = 0;
+};
+
+// Messages arrive after the latency, and not before.
+TEST_F(LoopbackTransportTests, Latency) {
+  fpl::NetworkConditions conditions;
+  conditions.latency = 50;
+  network_.set_conditions(conditions);
+  Connect();
+
+  const uint32_t sent = now_;
+  client_->SendReliableMessage("host", std::vector<uint8_t>(10, 1));
+  RunUntil(sent + 49);
+  EXPECT_EQ(0u, host_listener_.messages.size());
+  RunUntil(sent + 50);
+  ASSERT_EQ(1u, host_listener_.messages.size());
+  EXPECT_EQ("client", host_listener_.messages[0].from);
+  EXPECT_TRUE(host_listener_.messages[0].reliable);
+}
+
+// Reliable messages keep their order however much they're jittered, and are
+// never lost.
+TEST_F(LoopbackTransportTests, ReliableOrderUnderJitterAndLoss) {
+  fpl::NetworkConditions conditions;
+  conditions.latency = 20;
+  conditions.jitter = 100;
+  conditions.loss = 0.5f;
+  network_.set_conditions(conditions);
+  Connect();
+
+  for (uint8_t i = 0; i < 100; ++i) {
+    client_->SendReliableMessage("host", std::vector<uint8_t>(1, i));
+    RunUntil(now_ + 1);
+  }
+  RunUntil(now_ + 200);
+  ASSERT_EQ(100u, host_listener_.messages.size());
+  for (uint8_t i = 0; i < 100; ++i) {
+    EXPECT_EQ(i, host_listener_.messages[i].payload[0]);
+  }
+}
+
+// About the given share of unreliable messages are lost, the same ones for
+// the same seed.
+TEST_F(LoopbackTransportTests, UnreliableLoss) {
+  fpl::NetworkConditions conditions;
+  conditions.loss = 0.25f;
+  network_.set_conditions(conditions);
+  network_.set_seed(1234);
+  Connect();
+
+  for (int i = 0; i < 1000; ++i) {
+    host_->SendUnreliableMessage("client", std::vector<uint8_t>(8, 0));
+  }
+  RunUntil(now_ + 1);
+  const size_t received = client_listener_.messages.size();
+  EXPECT_GT(received, 700u);
+  EXPECT_LT(received, 800u);
+  EXPECT_EQ(1000u - received, network_.stats().messages_dropped);
+}
+
+// Messages queue up behind each other when the link is slower than they're
+// sent.
+TEST_F(LoopbackTransportTests, BandwidthCap) {
+  fpl::NetworkConditions conditions;
+  conditions.bytes_per_second = 10000;
+  network_.set_conditions(conditions);
+  Connect();
+
+  // 10 messages of 100 bytes take 100ms at 10000 bytes/s.
+  const uint32_t sent = now_;
+  for (int i = 0; i < 10; ++i) {
+    host_->SendUnreliableMessage("client", std::vector<uint8_t>(100, 0));
+  }
+  RunUntil(sent + 200);
+  ASSERT_EQ(10u, client_listener_.messages.size());
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(sent + 10 * (i + 1), client_listener_.messages[i].time);
+  }
+}
+
+// Disconnecting tells the other side, and drops what's still in flight.
+TEST_F(LoopbackTransportTests, Disconnect) {
+  fpl::NetworkConditions conditions;
+  conditions.latency = 10;
+  network_.set_conditions(conditions);
+  Connect();
+
+  host_->SendReliableMessage("client", std::vector<uint8_t>(1, 0));
+  host_->Disconnect("client");
+  RunUntil(now_ + 100);
+  EXPECT_EQ(0u, client_listener_.messages.size());
+  EXPECT_EQ(1, client_listener_.disconnects);
+  EXPECT_EQ(0, host_listener_.disconnects);
+}
+
+static const int kClients = 3;
+static const uint32_t kTimeout = 10000;
+
+// Runs a GPGMultiplayer host and clients in this process, the network
+// delivering on this thread in real time.
+class GPGMultiplayerLoopbackTests : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    fpl::NetworkConditions conditions;
+    conditions.latency = 20;
+    conditions.jitter = 10;
+    network_.set_conditions(conditions);
+    for (int i = 0; i <= kClients; ++i) {
+      fpl::GPGMultiplayer* instance = new fpl::GPGMultiplayer();
+      instance->set_auto_connect(true);
+      instance->Initialize(
+          "test", new fpl::LoopbackTransport(&network_,
+                                             "instance" + std::to_string(i)));
+      instances_.push_back(std::unique_ptr<fpl::GPGMultiplayer>(instance));
+    }
+  }
+
+  virtual void TearDown() { instances_.clear(); }
+
+  // Run until 'done' returns true, or the time runs out.
+  template <typename F>
+  bool RunUntil(F done) {
+    const uint32_t start = SDL_GetTicks();
+    while (!done()) {
+      if (SDL_GetTicks() - start > kTimeout) return false;
+      network_.Update(SDL_GetTicks());
+      for (size_t i = 0; i < instances_.size(); ++i) instances_[i]->Update();
+      SDL_Delay(1);
+    }
+    return true;
+  }
+
+  fpl::LoopbackNetwork network_;
+  std::vector<std::unique_ptr<fpl::GPGMultiplayer>> instances_;
+};
+
+// Every client connects to the host, and gets what it broadcasts.
+TEST_F(GPGMultiplayerLoopbackTests, HostAndClientsConnect) {
+  fpl::GPGMultiplayer& host = *instances_[0];
+  host.set_max_connected_players_allowed(kClients);
+  host.StartAdvertising();
+  ASSERT_TRUE(RunUntil([&]() { return host.IsAdvertising(); }));
+  for (int i = 1; i <= kClients; ++i) {
+    instances_[i]->StartDiscovery();
+    // One at a time, so they get player numbers in order.
+    ASSERT_TRUE(RunUntil([&]() { return instances_[i]->IsConnected(); }));
+  }
+  EXPECT_EQ(kClients, host.GetNumConnectedPlayers());
+  host.StopAdvertising();
+
+  host.BroadcastMessage(std::vector<uint8_t>(3, 7), true);
+  std::vector<fpl::GPGMultiplayer::SenderAndMessage> messages;
+  for (int i = 1; i <= kClients; ++i) {
+    ASSERT_TRUE(RunUntil([&]() {
+      instances_[i]->ReceiveMessages(&messages);
+      return !messages.empty();
+    }));
+    ASSERT_EQ(1u, messages.size());
+    EXPECT_EQ(std::vector<uint8_t>(3, 7), messages[0].second);
+  }
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
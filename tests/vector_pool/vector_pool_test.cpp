@@ -1,6 +1,31 @@
 #include "gtest/gtest.h"
 #include "entity/vector_pool.h"
 
+// Allocator that counts the allocations made through it, to check that
+// pools stay within what was reserved.
+static int g_allocations = 0;
+
+template <typename T>
+struct CountingAllocator {
+  typedef T value_type;
+  CountingAllocator() {}
+  template <typename U>
+  CountingAllocator(const CountingAllocator<U>&) {}
+  T* allocate(size_t n) {
+    g_allocations++;
+    return std::allocator<T>().allocate(n);
+  }
+  void deallocate(T* p, size_t n) { std::allocator<T>().deallocate(p, n); }
+};
+template <typename T, typename U>
+bool operator==(const CountingAllocator<T>&, const CountingAllocator<U>&) {
+  return true;
+}
+template <typename T, typename U>
+bool operator!=(const CountingAllocator<T>&, const CountingAllocator<U>&) {
+  return false;
+}
+
 class VectorPoolTests : public ::testing::Test {
  protected:
   virtual void SetUp() {}
@@ -40,6 +65,88 @@ TEST_F(VectorPoolTests, ConstIterator_Loop) {
   }
 }
 
+// Compacting packs the active elements in order, and remapped references
+// still point at the same data.
+TEST_F(VectorPoolTests, Compact_RemapsReferences) {
+  typedef fpl::VectorPool<int> IntPool;
+  IntPool pool;
+  IntPool::VectorPoolReference refs[5];
+  for (int i = 0; i < 5; ++i) {
+    refs[i] = pool.GetNewElement(fpl::kAddToBack);
+    *refs[i] = i;
+  }
+  pool.FreeElement(refs[0]);
+  pool.FreeElement(refs[3]);
+
+  std::vector<size_t> remap;
+  pool.Compact(&remap);
+  EXPECT_EQ(3u, pool.active_count());
+  EXPECT_EQ(IntPool::kTotalReserved + 3, pool.Size());
+
+  int expected[] = {1, 2, 4};
+  int i = 0;
+  for (IntPool::Iterator it = pool.begin(); it != pool.end(); ++it, ++i) {
+    EXPECT_EQ(expected[i], *it);
+  }
+  EXPECT_EQ(3, i);
+
+  for (int j = 0; j < 5; ++j) {
+    refs[j].Remap(remap);
+  }
+  EXPECT_FALSE(refs[0].IsValid());
+  EXPECT_FALSE(refs[3].IsValid());
+  EXPECT_EQ(1, *refs[1]);
+  EXPECT_EQ(2, *refs[2]);
+  EXPECT_EQ(4, *refs[4]);
+
+  // The pool is still usable afterwards.
+  *pool.GetNewElement(fpl::kAddToFront) = 5;
+  EXPECT_EQ(5, *pool.begin());
+  EXPECT_EQ(4u, pool.active_count());
+}
+
+// References that are not remapped become invalid rather than pointing off
+// the end of the shrunken pool.
+TEST_F(VectorPoolTests, Compact_StaleReferenceIsInvalid) {
+  fpl::VectorPool<int> pool;
+  pool.GetNewElement(fpl::kAddToBack);
+  fpl::VectorPool<int>::VectorPoolReference last =
+      pool.GetNewElement(fpl::kAddToBack);
+  pool.FreeElement(last);
+  pool.Compact(nullptr);
+  EXPECT_FALSE(last.IsValid());
+}
+
+// Once reserved, filling the pool, emptying it and compacting it again
+// doesn't allocate.
+TEST_F(VectorPoolTests, Reserve_NoAllocationWithinCapacity) {
+  typedef fpl::VectorPool<int, CountingAllocator<int> > IntPool;
+  IntPool pool;
+  pool.Reserve(16);
+  EXPECT_LE(16u, pool.Capacity());
+
+  const int allocations = g_allocations;
+  IntPool::VectorPoolReference refs[16];
+  for (int i = 0; i < 16; ++i) {
+    refs[i] = pool.GetNewElement(fpl::kAddToBack);
+    *refs[i] = i;
+  }
+  EXPECT_EQ(allocations, g_allocations);
+  EXPECT_EQ(16u, pool.active_count());
+
+  for (int i = 0; i < 16; i += 2) {
+    pool.FreeElement(refs[i]);
+  }
+  pool.Compact(nullptr);
+  EXPECT_LE(16u, pool.Capacity());
+  const int compacted_allocations = g_allocations;
+  for (int i = 0; i < 8; ++i) {
+    pool.GetNewElement(fpl::kAddToBack);
+  }
+  EXPECT_EQ(compacted_allocations, g_allocations);
+  EXPECT_EQ(16u, pool.active_count());
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();